@@ -203,7 +203,16 @@ typedef enum {
 	GIT_OPT_ENABLE_UNSAVED_INDEX_SAFETY,
 	GIT_OPT_GET_PACK_MAX_OBJECTS,
 	GIT_OPT_SET_PACK_MAX_OBJECTS,
-	GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS
+	GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS,
+	GIT_OPT_GET_CACHE_STATS,
+	GIT_OPT_RESET_CACHE_STATS,
+	GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE,
+	GIT_OPT_GET_DELTA_BASE_CACHE_MAX_SIZE,
+	GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+	GIT_OPT_RESET_DELTA_BASE_CACHE_STATS,
+	GIT_OPT_ENABLE_PACK_FULL_MMAP,
+	GIT_OPT_SET_ODB_REFRESH_INTERVAL,
+	GIT_OPT_GET_ODB_REFRESH_INTERVAL
 } git_libgit2_opt_t;
 
 /**
@@ -397,6 +406,60 @@ typedef enum {
  *		> This will cause .keep file existence checks to be skipped when
  *		> accessing packfiles, which can help performance with remote filesystems.
  *
+ *	 opts(GIT_OPT_GET_CACHE_STATS, size_t *hits, size_t *misses, size_t *evictions)
+ *
+ *		> Get the number of object cache lookups that found an object,
+ *		> the number that did not, and the number of objects that were
+ *		> evicted to stay within `GIT_OPT_SET_CACHE_MAX_SIZE`, summed
+ *		> over the caches of all repositories and object databases.
+ *
+ *	 opts(GIT_OPT_RESET_CACHE_STATS)
+ *
+ *		> Reset the object cache counters to zero.
+ *
+ *	 opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, size_t max_storage_bytes)
+ *
+ *		> Set the maximum amount of memory that the delta base cache may
+ *		> use, shared by all open packfiles.  Reconstructed bases that
+ *		> are not in use are evicted, least recently used first, to stay
+ *		> within the budget.  The default is 96MB.
+ *
+ *	 opts(GIT_OPT_GET_DELTA_BASE_CACHE_MAX_SIZE, size_t *max_storage_bytes)
+ *
+ *		> Get the maximum amount of memory that the delta base cache may use.
+ *
+ *	 opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS, size_t *hits, size_t *misses,
+ *	      size_t *evictions, size_t *current_storage_bytes)
+ *
+ *		> Get the number of delta base cache lookups that found a base,
+ *		> the number that did not, the number of bases that were evicted
+ *		> and the memory the cache currently uses.
+ *
+ *	 opts(GIT_OPT_RESET_DELTA_BASE_CACHE_STATS)
+ *
+ *		> Reset the delta base cache counters to zero.
+ *
+ *	 opts(GIT_OPT_ENABLE_PACK_FULL_MMAP, int enabled)
+ *
+ *		> Map each packfile in full when it is opened, instead of in
+ *		> windows of `GIT_OPT_SET_MWINDOW_SIZE` bytes, so that reading
+ *		> objects needs no window management.  Full mappings don't count
+ *		> towards `GIT_OPT_SET_MWINDOW_MAPPED_LIMIT`.  This only has an
+ *		> effect on 64-bit platforms and on packfiles opened after it is
+ *		> set.  It is disabled by default.
+ *
+ *	 opts(GIT_OPT_SET_ODB_REFRESH_INTERVAL, int milliseconds)
+ *
+ *		> When an object cannot be found, the object database rescans
+ *		> its backends for new packfiles before giving up.  Skip that
+ *		> rescan when the previous one was less than `milliseconds`
+ *		> ago.  Explicit calls to `git_odb_refresh` are never skipped.
+ *		> Set to 0 (the default) to rescan after every failed lookup.
+ *
+ *	 opts(GIT_OPT_GET_ODB_REFRESH_INTERVAL, int *milliseconds)
+ *
+ *		> Get the minimum interval between rescans after failed lookups.
+ *
  * @param option Option key
  * @param ... value to set the option
  * @return 0 on success, <0 on failure
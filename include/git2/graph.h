@@ -53,6 +53,30 @@ GIT_EXTERN(int) git_graph_descendant_of(
 	const git_oid *commit,
 	const git_oid *ancestor);
 
+/**
+ * Determine if a commit is the descendant of another commit, visiting
+ * at most `max_commits` commits.
+ *
+ * This behaves like `git_graph_descendant_of`, but gives up instead of
+ * walking an arbitrarily large part of the history.  With a
+ * commit-graph file, generation numbers usually let the walk finish
+ * well before the limit.
+ *
+ * @param repo the repository where the commits exist
+ * @param commit a previously loaded commit.
+ * @param ancestor a potential ancestor commit.
+ * @param max_commits the maximum number of commits to visit, or 0 for
+ * no limit.
+ * @return 1 if the given commit is a descendant of the potential ancestor,
+ * 0 if not, GIT_ELIMIT if the limit was reached before an answer was
+ * found, or an error code otherwise.
+ */
+GIT_EXTERN(int) git_graph_descendant_of_bounded(
+	git_repository *repo,
+	const git_oid *commit,
+	const git_oid *ancestor,
+	size_t max_commits);
+
 /** @} */
 GIT_END_DECL
 #endif
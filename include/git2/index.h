@@ -120,6 +120,12 @@ typedef enum {
 	GIT_INDEX_ENTRY_EXTENDED_FLAGS =  (GIT_INDEX_ENTRY_INTENT_TO_ADD | GIT_INDEX_ENTRY_SKIP_WORKTREE),
 
 	GIT_INDEX_ENTRY_UPTODATE       =  (1 << 2),
+
+	/**
+	 * The filesystem monitor of the repository did not report a change
+	 * of the entry, which is trusted to match the working directory.
+	 */
+	GIT_INDEX_ENTRY_FSMONITOR_VALID =  (1 << 3),
 } git_index_entry_extended_flag_t;
 
 /** Capabilities of system that affect index actions. */
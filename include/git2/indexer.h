@@ -66,6 +66,24 @@ typedef struct git_indexer_options {
 
 	/** Do connectivity checks for the received pack */
 	unsigned char verify;
+
+	/**
+	 * Number of threads to resolve deltas with in `git_indexer_commit`.
+	 * By default (0 or 1), deltas are resolved on the calling thread.
+	 * This has no effect when libgit2 is built without thread support.
+	 */
+	unsigned int threads;
+
+	/**
+	 * Size of the buffer used to pipeline indexing, in bytes.  When it
+	 * is not zero, `git_indexer_append` only copies the data into a
+	 * buffer of this size, waiting while it is full; background threads
+	 * write the pack, hash its trailer and inflate and hash its objects.
+	 * Progress is reported, and errors are returned, by a later call to
+	 * `git_indexer_append` or by `git_indexer_commit`.
+	 * This has no effect when libgit2 is built without thread support.
+	 */
+	size_t pipeline_buffer_size;
 } git_indexer_options;
 
 #define GIT_INDEXER_OPTIONS_VERSION 1
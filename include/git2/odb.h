@@ -99,6 +99,29 @@ GIT_EXTERN(void) git_odb_free(git_odb *db);
  */
 GIT_EXTERN(int) git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id);
 
+/**
+ * Read several objects from the database at once.
+ *
+ * This works like calling `git_odb_read` for each of the ids, but
+ * lets the backends read the objects together: the pack backend reads
+ * them in the order they are stored and inflates them on several
+ * threads.
+ *
+ * The objects are stored in `out` in the order of their ids, and must
+ * each be freed with `git_odb_object_free`.  When any of them cannot
+ * be read, none of them are returned.
+ *
+ * @param out array of `count` pointers where to store the read objects
+ * @param db database to search for the objects in.
+ * @param ids array of the `count` identities of the objects to read.
+ * @param count the number of objects to read
+ * @return
+ * - 0 if all of the objects were read;
+ * - GIT_ENOTFOUND if one of the objects is not in the database.
+ */
+GIT_EXTERN(int) git_odb_read_many(
+	git_odb_object **out, git_odb *db, const git_oid *ids, size_t count);
+
 /**
  * Read an object from the database, given a prefix
  * of its identifier.
@@ -230,7 +253,9 @@ GIT_EXTERN(int) git_odb_expand_ids(
  * NOTE that it is not necessary to call this function at all. The
  * library will automatically attempt to refresh the ODB
  * when a lookup fails, to see if the looked up object exists
- * on disk but hasn't been loaded yet.
+ * on disk but hasn't been loaded yet.  Objects that are still
+ * missing after that are not looked for again until a packfile is
+ * added or this function is called.
  *
  * @param db database to refresh
  * @return 0 on success, error code otherwise
@@ -394,6 +419,21 @@ GIT_EXTERN(int) git_odb_write_pack(
 	git_indexer_progress_cb progress_cb,
 	void *progress_payload);
 
+/**
+ * Write a `multi-pack-index` file from all the `.pack` files in the ODB.
+ *
+ * If the ODB layer understands pack files, then this will create a file
+ * called `multi-pack-index` next to the `.pack` and `.idx` files, which
+ * will contain an index of all objects stored in `.pack` files. This will
+ * allow for O(log n) lookup for n objects (regardless of how many
+ * packfiles there exist).
+ *
+ * @param db object database where the `multi-pack-index` file will be written.
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_odb_write_multi_pack_index(
+	git_odb *db);
+
 /**
  * Determine the object-ID (sha1 hash) of a data buffer
  *
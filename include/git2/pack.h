@@ -68,7 +68,8 @@ GIT_EXTERN(int) git_packbuilder_new(git_packbuilder **out, git_repository *repo)
  *
  * By default, libgit2 won't spawn any threads at all;
  * when set to 0, libgit2 will autodetect the number of
- * CPUs.
+ * CPUs.  The threads search for deltas, and then deflate
+ * objects ahead of the one writing the pack.
  *
  * @param pb The packbuilder
  * @param n Number of threads to spawn
@@ -76,6 +77,58 @@ GIT_EXTERN(int) git_packbuilder_new(git_packbuilder **out, git_repository *repo)
  */
 GIT_EXTERN(unsigned int) git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n);
 
+/**
+ * Write a reachability bitmap index along with the packfile
+ *
+ * When enabled, `git_packbuilder_write` also writes a `.bitmap` file
+ * next to the packfile and its index. It records which objects of the
+ * pack are reachable from the tips of the packed history and from a
+ * sample of the other commits, which lets `git_packbuilder_insert_walk`
+ * find the objects to send without walking every tree.
+ *
+ * The bitmap index is only written if the packfile contains every
+ * object that is reachable from its commits.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to write the bitmap index
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled);
+
+/**
+ * Write deltas with the offset of their base in the pack
+ *
+ * By default deltas name their base by its id (`GIT_OBJECT_REF_DELTA`).
+ * When enabled, deltas against objects of the pack give how far back
+ * in the pack their base is instead (`GIT_OBJECT_OFS_DELTA`), which is
+ * smaller and lets the receiver find the base without a lookup.  Only
+ * enable it when the receiver understands such deltas, e.g. when a
+ * remote advertises the "ofs-delta" capability.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to write offset deltas
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_ofs_delta(git_packbuilder *pb, int enabled);
+
+/**
+ * Build a thin pack
+ *
+ * When enabled, `git_packbuilder_insert_walk` remembers objects that
+ * the hidden commits of the walk reference, and which the receiver
+ * therefore has, and objects of the pack may be written as deltas
+ * against them without including them.  The receiver must complete
+ * the pack from its own objects, as `git_indexer` does when it is
+ * given an object database.
+ *
+ * This must be set before objects are inserted.
+ *
+ * @param pb The packbuilder
+ * @param enabled Whether to build a thin pack
+ * @return 0 or an error code
+ */
+GIT_EXTERN(int) git_packbuilder_set_thin(git_packbuilder *pb, int enabled);
+
 /**
  * Insert a single object
  *
@@ -521,7 +521,9 @@ struct git_remote_callbacks {
 
 	/**
 	 * Each time a reference is updated locally, this function
-	 * will be called with information about it.
+	 * will be called with information about it.  When fetching, the
+	 * references are written in batches and this is called for each
+	 * reference of a batch once the batch has been written.
 	 */
 	int GIT_CALLBACK(update_tips)(const char *refname, const git_oid *a, const git_oid *b, void *data);
 
@@ -779,6 +781,12 @@ GIT_EXTERN(int) git_remote_upload(git_remote *remote, const git_strarray *refspe
  * @param download_tags what the behaviour for downloading tags is for this fetch. This is
  * ignored for push. This must be the same value passed to `git_remote_download()`.
  * @return 0 or an error code
+ *
+ * The tips of a refspec are written in batches of up to 256 references,
+ * each in a single transaction.  When a reference cannot be updated, for
+ * instance because it conflicts with an existing reference, none of the
+ * references of its batch are updated and an error is returned; the
+ * batches before it stay written.
  */
 GIT_EXTERN(int) git_remote_update_tips(
 		git_remote *remote,
@@ -82,6 +82,18 @@ struct git_config_backend {
 	 */
 	int GIT_CALLBACK(unlock)(struct git_config_backend *, int success);
 	void GIT_CALLBACK(free)(struct git_config_backend *);
+
+	/**
+	 * Optional: bring the backend up to date with its data store and
+	 * return a number which changes whenever the entries it returns
+	 * change.  A snapshot must report the same number as the backend
+	 * it was taken from, as long as that backend has not changed.
+	 *
+	 * When every backend of a configuration implements this, lookups
+	 * are served from a compiled table of all the levels which is only
+	 * rebuilt when one of the numbers changes.
+	 */
+	int GIT_CALLBACK(generation)(uint64_t *out, struct git_config_backend *);
 };
 #define GIT_CONFIG_BACKEND_VERSION 1
 #define GIT_CONFIG_BACKEND_INIT {GIT_CONFIG_BACKEND_VERSION}
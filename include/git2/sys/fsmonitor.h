@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_sys_git_fsmonitor_h__
+#define INCLUDE_sys_git_fsmonitor_h__
+
+#include "git2/common.h"
+#include "git2/types.h"
+#include "git2/buffer.h"
+
+/**
+ * @file git2/sys/fsmonitor.h
+ * @brief Git filesystem monitor routines
+ * @defgroup git_fsmonitor Git filesystem monitor APIs
+ * @ingroup Git
+ * @{
+ */
+GIT_BEGIN_DECL
+
+/**
+ * A filesystem monitor, which tells which paths of the working directory
+ * may have changed since a point in time.
+ *
+ * When a repository has a filesystem monitor, the index entries that it
+ * does not report as changed are trusted to match the working directory
+ * and are not `lstat`ed when computing the status of the repository, or
+ * diffing or checking out its working directory.  What the monitor knows
+ * is recorded in the index with git's `FSMN` extension.
+ */
+typedef struct git_fsmonitor git_fsmonitor;
+
+struct git_fsmonitor {
+	unsigned int version; /**< The `version` field should be set to `GIT_FSMONITOR_VERSION`. */
+
+	/**
+	 * Report the paths that changed since `token`.
+	 *
+	 * Like git's `fsmonitor-watchman` hook (version 2), the output is
+	 * written to `out` as a new token that identifies the current point
+	 * in time, followed by the paths that changed since `token`, each
+	 * of them terminated by a NUL character.  Paths are relative to the
+	 * working directory; a path ending with a `/` covers everything in
+	 * that directory and `/` covers the whole working directory.
+	 *
+	 * `token` is NULL when the index does not have one yet, in which
+	 * case every path is assumed to have changed and the monitor only
+	 * needs to provide the new token.
+	 *
+	 * Return 0 on success, `GIT_PASSTHROUGH` when the monitor cannot
+	 * tell what changed (every path is then assumed to have changed),
+	 * or any other negative value to fail the operation.
+	 */
+	int GIT_CALLBACK(query)(
+		git_buf *out, git_fsmonitor *fsmonitor, const char *token);
+
+	/** Free the filesystem monitor; optional. */
+	void GIT_CALLBACK(free)(git_fsmonitor *fsmonitor);
+};
+
+#define GIT_FSMONITOR_VERSION 1
+#define GIT_FSMONITOR_INIT {GIT_FSMONITOR_VERSION}
+
+/**
+ * Initializes a `git_fsmonitor` with default values. Equivalent to
+ * creating an instance with GIT_FSMONITOR_INIT.
+ *
+ * @param fsmonitor the `git_fsmonitor` struct to initialize.
+ * @param version Version of struct; pass `GIT_FSMONITOR_VERSION`
+ * @return Zero on success; -1 on failure.
+ */
+GIT_EXTERN(int) git_fsmonitor_init(
+	git_fsmonitor *fsmonitor, unsigned int version);
+
+/**
+ * Set the filesystem monitor of a repository.
+ *
+ * The repository takes ownership of the monitor, which is freed when
+ * the repository is freed or when another monitor is set.  Pass NULL to
+ * remove the monitor of the repository, which then `lstat`s every index
+ * entry again.
+ *
+ * @param repo The repository
+ * @param fsmonitor The filesystem monitor, or NULL
+ * @return 0 on success, or an error code
+ */
+GIT_EXTERN(int) git_repository_set_fsmonitor(
+	git_repository *repo, git_fsmonitor *fsmonitor);
+
+/** @} */
+GIT_END_DECL
+#endif
@@ -45,6 +45,23 @@ struct git_odb_backend {
 	int GIT_CALLBACK(read_header)(
 		size_t *, git_object_t *, git_odb_backend *, const git_oid *);
 
+	/**
+	 * Read several objects at once, storing the buffer, length and
+	 * type of the object with the id at `ids[i]` in `buffers[i]`,
+	 * `lens[i]` and `types[i]`.  The buffers are allocated like those
+	 * of `read`.
+	 *
+	 * Objects whose type is not `GIT_OBJECT_INVALID` on entry were
+	 * already read elsewhere and must be left alone; objects that are
+	 * not in the backend keep `GIT_OBJECT_INVALID` as their type.  On
+	 * error, the backend must free the buffers it allocated and reset
+	 * their types.  Backends without it are asked for one object at a
+	 * time with `read`.
+	 */
+	int GIT_CALLBACK(read_many)(
+		void **, size_t *, git_object_t *, git_odb_backend *,
+		const git_oid *, size_t);
+
 	/**
 	 * Write an object into the backend. The id of the object has
 	 * already been calculated and is passed in.
@@ -84,6 +101,13 @@ struct git_odb_backend {
 		git_odb_writepack **, git_odb_backend *, git_odb *odb,
 		git_indexer_progress_cb progress_cb, void *progress_payload);
 
+	/**
+	 * If the backend supports pack files, this will create a
+	 * `multi-pack-index` file which will contain an index of all objects
+	 * across all the `.pack` files.
+	 */
+	int GIT_CALLBACK(writemidx)(git_odb_backend *);
+
 	/**
 	 * "Freshens" an already existing object, updating its last-used
 	 * time.  This occurs when `git_odb_write` was called, but the
@@ -56,6 +56,31 @@ struct git_reference_iterator {
 		git_reference_iterator *iter);
 };
 
+/**
+ * The outcome of a locked reference, as given to the `unlock_many`
+ * function of a backend.  The fields match the arguments of `unlock`.
+ */
+typedef struct {
+	/** The opaque value returned by `lock` for this reference */
+	void *payload;
+
+	/**
+	 * 0 to discard the lock, 1 to update the reference to `ref`
+	 * and 2 to delete it
+	 */
+	int success;
+
+	/** Whether the update should be written to the reference's log */
+	int update_reflog;
+
+	/** The new value of the reference, or the one being deleted */
+	const git_reference *ref;
+
+	/** The signature and message of the reflog entry */
+	const git_signature *sig;
+	const char *message;
+} git_refdb_update;
+
 /** An instance for a custom backend */
 struct git_refdb_backend {
 	unsigned int version;
@@ -167,6 +192,18 @@ struct git_refdb_backend {
 	 */
 	int GIT_CALLBACK(unlock)(git_refdb_backend *backend, void *payload, int success, int update_reflog,
 		      const git_reference *ref, const git_signature *sig, const char *message);
+
+	/**
+	 * Unlock several references at once, applying all of their
+	 * updates together; this is how a transaction is committed.  The
+	 * backend must release every lock, even when it fails, unless it
+	 * returns `GIT_PASSTHROUGH` without having touched any of them, in
+	 * which case `unlock` is called for each reference instead.
+	 *
+	 * A refdb implementation may provide this function; if it is not
+	 * provided, `unlock` is called for each reference in turn.
+	 */
+	int GIT_CALLBACK(unlock_many)(git_refdb_backend *backend, git_refdb_update *updates, size_t count);
 };
 
 #define GIT_REFDB_BACKEND_VERSION 1
@@ -199,6 +236,24 @@ GIT_EXTERN(int) git_refdb_backend_fs(
 	git_refdb_backend **backend_out,
 	git_repository *repo);
 
+/**
+ * Constructors for the reftable backend, which stores references and
+ * their logs in a stack of tables in the repository's `reftable`
+ * directory.  Repositories with `extensions.refStorage` set to
+ * "reftable" use this backend by default.
+ *
+ * Under normal usage, this is called for you when the repository is
+ * opened / created, but you can use this to explicitly construct a
+ * reftable backend for a repository.
+ *
+ * @param backend_out Output pointer to the git_refdb_backend object
+ * @param repo Git repository to access
+ * @return 0 on success, <0 error code on failure
+ */
+GIT_EXTERN(int) git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repo);
+
 /**
  * Sets the custom backend to an existing reference DB
  *
@@ -82,6 +82,9 @@ on_oom:
 
 #define git_array_valid_index(a, i) ((i) < (a).size)
 
+#define git_array_sort(a, cmp) \
+	qsort((a).ptr, (a).size, sizeof(*(a).ptr), (cmp))
+
 #define git_array_foreach(a, i, element) \
 	for ((i) = 0; (i) < (a).size && ((element) = &(a).ptr[(i)]); (i)++)
 
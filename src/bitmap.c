@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "bitmap.h"
+
+#define BITMAP_WORD_BITS 64
+#define BITMAP_WORD(pos) ((pos) / BITMAP_WORD_BITS)
+#define BITMAP_MASK(pos) ((uint64_t)1 << ((pos) % BITMAP_WORD_BITS))
+
+/*
+ * An EWAH stream is a sequence of "running length words", each followed
+ * by a number of literal words.  A running length word stores, from the
+ * least significant bit: the value of the run (1 bit), the number of
+ * clean words in the run (32 bits) and the number of literal words that
+ * follow it (31 bits).
+ */
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING_COUNT (((uint64_t)1 << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT (((uint64_t)1 << RLW_LITERAL_BITS) - 1)
+
+#define rlw_running_bit(w) ((w) & 1)
+#define rlw_running_len(w) (((w) >> 1) & RLW_LARGEST_RUNNING_COUNT)
+#define rlw_literal_words(w) ((w) >> (1 + RLW_RUNNING_BITS))
+
+static int bitmap_grow(git_bitmap *bitmap, size_t words)
+{
+	uint64_t *new_words;
+	size_t new_alloc;
+
+	if (words <= bitmap->word_alloc)
+		return 0;
+
+	new_alloc = bitmap->word_alloc ? bitmap->word_alloc : 8;
+	while (new_alloc < words) {
+		GIT_ERROR_CHECK_ALLOC_MULTIPLY(&new_alloc, new_alloc, 2);
+	}
+
+	new_words = git__reallocarray(bitmap->words, new_alloc, sizeof(uint64_t));
+	GIT_ERROR_CHECK_ALLOC(new_words);
+
+	memset(new_words + bitmap->word_alloc, 0,
+		(new_alloc - bitmap->word_alloc) * sizeof(uint64_t));
+
+	bitmap->words = new_words;
+	bitmap->word_alloc = new_alloc;
+	return 0;
+}
+
+void git_bitmap_dispose(git_bitmap *bitmap)
+{
+	if (!bitmap)
+		return;
+
+	git__free(bitmap->words);
+	bitmap->words = NULL;
+	bitmap->word_alloc = 0;
+}
+
+void git_bitmap_clear(git_bitmap *bitmap)
+{
+	if (bitmap->words)
+		memset(bitmap->words, 0, bitmap->word_alloc * sizeof(uint64_t));
+}
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos)
+{
+	if (bitmap_grow(bitmap, BITMAP_WORD(pos) + 1) < 0)
+		return -1;
+
+	bitmap->words[BITMAP_WORD(pos)] |= BITMAP_MASK(pos);
+	return 0;
+}
+
+bool git_bitmap_get(const git_bitmap *bitmap, size_t pos)
+{
+	if (BITMAP_WORD(pos) >= bitmap->word_alloc)
+		return false;
+
+	return (bitmap->words[BITMAP_WORD(pos)] & BITMAP_MASK(pos)) != 0;
+}
+
+static size_t popcount(uint64_t word)
+{
+	size_t count = 0;
+
+	while (word) {
+		word &= word - 1;
+		count++;
+	}
+
+	return count;
+}
+
+size_t git_bitmap_count(const git_bitmap *bitmap)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < bitmap->word_alloc; i++)
+		count += popcount(bitmap->words[i]);
+
+	return count;
+}
+
+int git_bitmap_or(git_bitmap *bitmap, const git_bitmap *other)
+{
+	size_t i;
+
+	if (bitmap_grow(bitmap, other->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < other->word_alloc; i++)
+		bitmap->words[i] |= other->words[i];
+
+	return 0;
+}
+
+int git_bitmap_xor(git_bitmap *bitmap, const git_bitmap *other)
+{
+	size_t i;
+
+	if (bitmap_grow(bitmap, other->word_alloc) < 0)
+		return -1;
+
+	for (i = 0; i < other->word_alloc; i++)
+		bitmap->words[i] ^= other->words[i];
+
+	return 0;
+}
+
+void git_bitmap_and_not(git_bitmap *bitmap, const git_bitmap *other)
+{
+	size_t i, words = min(bitmap->word_alloc, other->word_alloc);
+
+	for (i = 0; i < words; i++)
+		bitmap->words[i] &= ~other->words[i];
+}
+
+int git_bitmap_foreach(
+	const git_bitmap *bitmap, git_bitmap_foreach_cb cb, void *payload)
+{
+	size_t i, bit;
+	int error;
+
+	for (i = 0; i < bitmap->word_alloc; i++) {
+		uint64_t word = bitmap->words[i];
+
+		for (bit = 0; word; bit++, word >>= 1) {
+			if (!(word & 1))
+				continue;
+
+			if ((error = cb(i * BITMAP_WORD_BITS + bit, payload)) != 0)
+				return git_error_set_after_callback(error);
+		}
+	}
+
+	return 0;
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *data)
+{
+	return ntohl(*(const uint32_t *)data);
+}
+
+GIT_INLINE(uint64_t) get_be64(const unsigned char *data)
+{
+	return ((uint64_t)get_be32(data) << 32) | get_be32(data + 4);
+}
+
+static int ewah_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid EWAH bitmap: %s", message);
+	return -1;
+}
+
+int git_bitmap_read_ewah(
+	git_bitmap *bitmap,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len)
+{
+	const unsigned char *words;
+	uint32_t bit_size, word_count, i;
+	size_t pos = 0, total, max_words;
+
+	/* bit size, word count, words, position of the last RLW */
+	if (len < 8)
+		return ewah_error("truncated header");
+
+	bit_size = get_be32(data);
+	word_count = get_be32(data + 4);
+
+	if ((len - 8) / 8 < word_count || len - 8 - (size_t)word_count * 8 < 4)
+		return ewah_error("truncated data");
+
+	words = data + 8;
+	total = 8 + (size_t)word_count * 8 + 4;
+	max_words = ((size_t)bit_size + BITMAP_WORD_BITS - 1) / BITMAP_WORD_BITS;
+
+	git_bitmap_clear(bitmap);
+
+	for (i = 0; i < word_count; ) {
+		uint64_t rlw = get_be64(words + (size_t)i * 8), run, literals, j;
+
+		run = rlw_running_len(rlw);
+		literals = rlw_literal_words(rlw);
+		i++;
+
+		if (literals > word_count - i)
+			return ewah_error("literal words overflow the buffer");
+
+		/* the words must fit in the bits the header announced */
+		if (run > max_words - pos || literals > max_words - pos - run)
+			return ewah_error("words overflow the bit size");
+
+		if (rlw_running_bit(rlw)) {
+			if (bitmap_grow(bitmap, pos + run) < 0)
+				return -1;
+			for (j = 0; j < run; j++)
+				bitmap->words[pos + j] = ~(uint64_t)0;
+		}
+		pos += run;
+
+		if (bitmap_grow(bitmap, pos + literals) < 0)
+			return -1;
+		for (j = 0; j < literals; j++, i++)
+			bitmap->words[pos + j] = get_be64(words + (size_t)i * 8);
+		pos += literals;
+	}
+
+	*consumed = total;
+	return 0;
+}
+
+static int put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static void set_be64(unsigned char *dst, uint64_t value)
+{
+	uint32_t word;
+
+	word = htonl((uint32_t)(value >> 32));
+	memcpy(dst, &word, 4);
+	word = htonl((uint32_t)value);
+	memcpy(dst + 4, &word, 4);
+}
+
+static int put_be64(git_buf *out, uint64_t value)
+{
+	unsigned char data[8];
+
+	set_be64(data, value);
+	return git_buf_put(out, (const char *)data, sizeof(data));
+}
+
+int git_bitmap_write_ewah(git_buf *out, const git_bitmap *bitmap)
+{
+	size_t words = bitmap->word_alloc, start, i = 0, rlw_pos = 0;
+	uint32_t word_count = 0, bit_size;
+	uint64_t last = 0;
+
+	/* Trailing zero words are implied by the bit size. */
+	while (words && !bitmap->words[words - 1])
+		words--;
+
+	if (words) {
+		last = bitmap->words[words - 1];
+		bit_size = (uint32_t)((words - 1) * BITMAP_WORD_BITS);
+		while (last) {
+			bit_size++;
+			last >>= 1;
+		}
+	} else {
+		bit_size = 0;
+	}
+
+	start = git_buf_len(out);
+	if (put_be32(out, bit_size) < 0 || put_be32(out, 0) < 0)
+		return -1;
+
+	do {
+		uint64_t run = 0, literals = 0, running_bit = 0, rlw;
+
+		rlw_pos = word_count;
+		if (put_be64(out, 0) < 0)
+			return -1;
+		word_count++;
+
+		if (i < words && (bitmap->words[i] == 0 || bitmap->words[i] == ~(uint64_t)0)) {
+			uint64_t clean = bitmap->words[i];
+
+			running_bit = clean ? 1 : 0;
+			while (i < words && bitmap->words[i] == clean &&
+			       run < RLW_LARGEST_RUNNING_COUNT) {
+				run++;
+				i++;
+			}
+		}
+
+		while (i < words && bitmap->words[i] != 0 &&
+		       bitmap->words[i] != ~(uint64_t)0 &&
+		       literals < RLW_LARGEST_LITERAL_COUNT) {
+			if (put_be64(out, bitmap->words[i]) < 0)
+				return -1;
+			word_count++;
+			literals++;
+			i++;
+		}
+
+		rlw = running_bit | (run << 1) | (literals << (1 + RLW_RUNNING_BITS));
+		set_be64((unsigned char *)out->ptr + start + 8 + rlw_pos * 8, rlw);
+	} while (i < words);
+
+	word_count = htonl(word_count);
+	memcpy(out->ptr + start + 4, &word_count, sizeof(word_count));
+
+	return put_be32(out, (uint32_t)rlw_pos);
+}
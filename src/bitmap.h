@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_bitmap_h__
+#define INCLUDE_bitmap_h__
+
+#include "common.h"
+
+#include "buffer.h"
+
+/*
+ * An uncompressed, growable bitmap.
+ *
+ * Bitmaps are stored on disk using the EWAH (Enhanced Word-Aligned Hybrid)
+ * run-length compression used by git's `.bitmap` files; they are inflated
+ * into this representation to operate on them.
+ */
+typedef struct {
+	uint64_t *words;
+	size_t word_alloc;
+} git_bitmap;
+
+#define GIT_BITMAP_INIT { NULL, 0 }
+
+void git_bitmap_dispose(git_bitmap *bitmap);
+void git_bitmap_clear(git_bitmap *bitmap);
+
+int git_bitmap_set(git_bitmap *bitmap, size_t pos);
+bool git_bitmap_get(const git_bitmap *bitmap, size_t pos);
+
+/* Number of bits that are set. */
+size_t git_bitmap_count(const git_bitmap *bitmap);
+
+/* `bitmap |= other` */
+int git_bitmap_or(git_bitmap *bitmap, const git_bitmap *other);
+
+/* `bitmap ^= other` */
+int git_bitmap_xor(git_bitmap *bitmap, const git_bitmap *other);
+
+/* `bitmap &= ~other` */
+void git_bitmap_and_not(git_bitmap *bitmap, const git_bitmap *other);
+
+/* Call `cb` for every set bit, in ascending order. */
+typedef int (*git_bitmap_foreach_cb)(size_t pos, void *payload);
+int git_bitmap_foreach(
+	const git_bitmap *bitmap, git_bitmap_foreach_cb cb, void *payload);
+
+/*
+ * Inflate an EWAH-compressed bitmap from `data` into `bitmap`, which is
+ * cleared first. `consumed` is set to the number of bytes of `data` that
+ * the serialized bitmap occupies.
+ */
+int git_bitmap_read_ewah(
+	git_bitmap *bitmap,
+	size_t *consumed,
+	const unsigned char *data,
+	size_t len);
+
+/* Append the EWAH-compressed serialization of `bitmap` to `out`. */
+int git_bitmap_write_ewah(git_buf *out, const git_bitmap *bitmap);
+
+#endif
@@ -7,6 +7,7 @@
 
 #include "cache.h"
 
+#include "global.h"
 #include "repository.h"
 #include "commit.h"
 #include "thread-utils.h"
@@ -41,108 +42,338 @@ int git_cache_set_max_object_size(git_object_t type, size_t size)
 	return 0;
 }
 
+/*
+ * Every live cache, so that their statistics can be summed; the counters
+ * of disposed caches are folded into `cache_retired_stats`.
+ */
+static git_mutex cache_registry_lock;
+static git_vector cache_registry = GIT_VECTOR_INIT;
+static size_t cache_retired_stats[3];
+
+static void git_cache_global_shutdown(void)
+{
+	git_vector_free(&cache_registry);
+	git_mutex_free(&cache_registry_lock);
+	memset(cache_retired_stats, 0, sizeof(cache_retired_stats));
+}
+
+int git_cache_global_init(void)
+{
+	if (git_mutex_init(&cache_registry_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize cache registry lock");
+		return -1;
+	}
+
+	git__on_shutdown(git_cache_global_shutdown);
+	return 0;
+}
+
+GIT_INLINE(git_cache_shard *) cache_shard(git_cache *cache, const git_oid *oid)
+{
+	/*
+	 * The oidmap hashes the leading bytes of the id, so pick the shard
+	 * from the trailing ones to keep the buckets of every shard evenly
+	 * used.
+	 */
+	return &cache->shards[oid->id[GIT_OID_RAWSZ - 1] % GIT_CACHE_SHARDS];
+}
+
+size_t git_cache_size(git_cache *cache)
+{
+	size_t i, size = 0;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		if (shard->map)
+			size += git_oidmap_size(shard->map);
+		git_mutex_unlock(&shard->lock);
+	}
+
+	return size;
+}
+
 void git_cache_dump_stats(git_cache *cache)
 {
 	git_cached_obj *object;
+	size_t i;
 
 	if (git_cache_size(cache) == 0)
 		return;
 
-	printf("Cache %p: %"PRIuZ" items cached, %"PRIdZ" bytes\n",
-		cache, git_cache_size(cache), cache->used_memory);
-
-	git_oidmap_foreach_value(cache->map, object, {
-		char oid_str[9];
-		printf(" %s%c %s (%"PRIuZ")\n",
-			git_object_type2string(object->type),
-			object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
-			git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
-			object->size
-		);
-	});
+	printf("Cache %p: %"PRIuZ" items cached\n", cache, git_cache_size(cache));
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
+
+		printf(" shard %"PRIuZ": %"PRIdZ" bytes, %"PRIuZ" hits, %"PRIuZ" misses, %"PRIuZ" evictions\n",
+			i, shard->used_memory, shard->hits, shard->misses, shard->evictions);
+
+		if (!shard->map)
+			continue;
+
+		git_oidmap_foreach_value(shard->map, object, {
+			char oid_str[9];
+			printf("  %s%c %s (%"PRIuZ")\n",
+				git_object_type2string(object->type),
+				object->flags == GIT_CACHE_STORE_PARSED ? '*' : ' ',
+				git_oid_tostr(oid_str, sizeof(oid_str), &object->oid),
+				object->size
+			);
+		});
+	}
 }
 
+static void cache_free_shards(git_cache *cache)
+{
+	size_t i;
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_oidmap_free(cache->shards[i].map);
+		git_array_clear(cache->shards[i].clock);
+		git_mutex_free(&cache->shards[i].lock);
+	}
+}
+
+/*
+ * The shard maps are created by the first store into the shard and the
+ * cache joins the registry on its first lookup, so that opening a
+ * repository neither allocates maps it may never use nor contends for
+ * the registry lock.
+ */
 int git_cache_init(git_cache *cache)
 {
-	memset(cache, 0, sizeof(*cache));
+	size_t i;
 
-	if ((git_oidmap_new(&cache->map)) < 0)
-		return -1;
+	memset(cache, 0, sizeof(*cache));
 
-	if (git_rwlock_init(&cache->lock)) {
-		git_error_set(GIT_ERROR_OS, "failed to initialize cache rwlock");
-		return -1;
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		if (git_mutex_init(&cache->shards[i].lock)) {
+			git_error_set(GIT_ERROR_OS, "failed to initialize cache lock");
+			goto on_error;
+		}
 	}
 
 	return 0;
+
+on_error:
+	while (i--)
+		git_mutex_free(&cache->shards[i].lock);
+	git__memzero(cache, sizeof(*cache));
+	return -1;
+}
+
+static void cache_register(git_cache *cache)
+{
+	if (git_mutex_lock(&cache_registry_lock) < 0)
+		return;
+
+	/* a failed insert is retried by the next lookup */
+	if (!git_atomic_get(&cache->registered) &&
+	    git_vector_insert(&cache_registry, cache) == 0)
+		git_atomic_set(&cache->registered, 1);
+
+	git_mutex_unlock(&cache_registry_lock);
 }
 
 /* called with lock */
-static void clear_cache(git_cache *cache)
+static void clear_shard(git_cache_shard *shard)
 {
 	git_cached_obj *evict = NULL;
 
-	if (git_cache_size(cache) == 0)
+	if (!shard->map || git_oidmap_size(shard->map) == 0)
 		return;
 
-	git_oidmap_foreach_value(cache->map, evict, {
+	git_oidmap_foreach_value(shard->map, evict, {
 		git_cached_obj_decref(evict);
 	});
 
-	git_oidmap_clear(cache->map);
-	git_atomic_ssize_add(&git_cache__current_storage, -cache->used_memory);
-	cache->used_memory = 0;
+	git_oidmap_clear(shard->map);
+	git_array_clear(shard->clock);
+	shard->clock_hand = 0;
+
+	git_atomic_ssize_add(&git_cache__current_storage, -shard->used_memory);
+	shard->used_memory = 0;
 }
 
 void git_cache_clear(git_cache *cache)
 {
-	if (git_rwlock_wrlock(&cache->lock) < 0)
-		return;
+	size_t i;
 
-	clear_cache(cache);
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[i];
 
-	git_rwlock_wrunlock(&cache->lock);
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		clear_shard(shard);
+
+		git_mutex_unlock(&shard->lock);
+	}
 }
 
 void git_cache_dispose(git_cache *cache)
 {
+	size_t i, pos;
+
 	git_cache_clear(cache);
-	git_oidmap_free(cache->map);
-	git_rwlock_free(&cache->lock);
+
+	if (git_mutex_lock(&cache_registry_lock) == 0) {
+		if (git_atomic_get(&cache->registered) &&
+		    git_vector_search(&pos, &cache_registry, cache) == 0)
+			git_vector_remove(&cache_registry, pos);
+
+		for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+			cache_retired_stats[0] += cache->shards[i].hits;
+			cache_retired_stats[1] += cache->shards[i].misses;
+			cache_retired_stats[2] += cache->shards[i].evictions;
+		}
+
+		git_mutex_unlock(&cache_registry_lock);
+	}
+
+	cache_free_shards(cache);
 	git__memzero(cache, sizeof(*cache));
 }
 
-/* Called with lock */
-static void cache_evict_entries(git_cache *cache)
+void git_cache_stats(size_t *hits, size_t *misses, size_t *evictions)
 {
-	size_t evict_count = 8, i;
-	ssize_t evicted_memory = 0;
+	git_cache *cache;
+	size_t i, j, stats[3];
+
+	if (git_mutex_lock(&cache_registry_lock) < 0) {
+		*hits = *misses = *evictions = 0;
+		return;
+	}
+
+	memcpy(stats, cache_retired_stats, sizeof(stats));
+
+	git_vector_foreach(&cache_registry, i, cache) {
+		for (j = 0; j < GIT_CACHE_SHARDS; j++) {
+			git_cache_shard *shard = &cache->shards[j];
+
+			if (git_mutex_lock(&shard->lock) < 0)
+				continue;
+
+			stats[0] += shard->hits;
+			stats[1] += shard->misses;
+			stats[2] += shard->evictions;
+
+			git_mutex_unlock(&shard->lock);
+		}
+	}
+
+	git_mutex_unlock(&cache_registry_lock);
 
-	/* do not infinite loop if there's not enough entries to evict  */
-	if (evict_count > git_cache_size(cache)) {
-		clear_cache(cache);
+	*hits = stats[0];
+	*misses = stats[1];
+	*evictions = stats[2];
+}
+
+void git_cache_stats_reset(void)
+{
+	git_cache *cache;
+	size_t i, j;
+
+	if (git_mutex_lock(&cache_registry_lock) < 0)
 		return;
+
+	memset(cache_retired_stats, 0, sizeof(cache_retired_stats));
+
+	git_vector_foreach(&cache_registry, i, cache) {
+		for (j = 0; j < GIT_CACHE_SHARDS; j++) {
+			git_cache_shard *shard = &cache->shards[j];
+
+			if (git_mutex_lock(&shard->lock) < 0)
+				continue;
+
+			shard->hits = shard->misses = shard->evictions = 0;
+
+			git_mutex_unlock(&shard->lock);
+		}
 	}
 
-	i = 0;
-	while (evict_count > 0) {
+	git_mutex_unlock(&cache_registry_lock);
+}
+
+/*
+ * Evict entries with the CLOCK algorithm until `wanted` bytes were
+ * freed or the shard is empty. Called with lock.
+ */
+static void shard_evict_entries(git_cache_shard *shard, ssize_t wanted)
+{
+	ssize_t evicted_memory = 0;
+	size_t scanned = 0;
+
+	/* two turns of the hand find an unreferenced entry, if any */
+	while (evicted_memory < wanted && git_array_size(shard->clock) > 0 &&
+	       scanned <= 2 * git_array_size(shard->clock)) {
+		git_oid *key, *last;
 		git_cached_obj *evict;
-		const git_oid *key;
 
-		if (git_oidmap_iterate((void **) &evict, cache->map, &i, &key) == GIT_ITEROVER)
-			break;
+		if (shard->clock_hand >= git_array_size(shard->clock))
+			shard->clock_hand = 0;
 
-		evict_count--;
-		evicted_memory += evict->size;
-		git_cached_obj_decref(evict);
+		key = git_array_get(shard->clock, shard->clock_hand);
+		evict = git_oidmap_get(shard->map, key);
+		scanned++;
 
-		git_oidmap_delete(cache->map, key);
+		if (evict && evict->referenced) {
+			evict->referenced = 0;
+			shard->clock_hand++;
+			continue;
+		}
+
+		if (evict) {
+			evicted_memory += evict->size;
+			shard->evictions++;
+
+			git_oidmap_delete(shard->map, key);
+			git_cached_obj_decref(evict);
+		}
+
+		/* fill the hole with the last entry, which the hand visits next */
+		last = git_array_pop(shard->clock);
+		if (last != key)
+			git_oid_cpy(key, last);
+
+		scanned = 0;
 	}
 
-	cache->used_memory -= evicted_memory;
+	shard->used_memory -= evicted_memory;
 	git_atomic_ssize_add(&git_cache__current_storage, -evicted_memory);
 }
 
+/*
+ * Make room for `size` more bytes under the global limit, visiting the
+ * shards in turn from a cursor that every call advances so that no
+ * shard pays for all the others. Only one shard lock is held at a time.
+ */
+static void cache_evict_entries(git_cache *cache, ssize_t size)
+{
+	size_t start, i;
+	ssize_t wanted;
+
+	start = (size_t)git_atomic_inc(&cache->evict_cursor);
+
+	for (i = 0; i < GIT_CACHE_SHARDS; i++) {
+		git_cache_shard *shard = &cache->shards[(start + i) % GIT_CACHE_SHARDS];
+
+		wanted = git_cache__current_storage.val + size - git_cache__max_storage;
+		if (wanted <= 0)
+			break;
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		shard_evict_entries(shard, wanted);
+		git_mutex_unlock(&shard->lock);
+	}
+}
+
 static bool cache_should_store(git_object_t object_type, size_t object_size)
 {
 	size_t max_size = git_cache__max_object_size[object_type];
@@ -151,31 +382,45 @@ static bool cache_should_store(git_object_t object_type, size_t object_size)
 
 static void *cache_get(git_cache *cache, const git_oid *oid, unsigned int flags)
 {
-	git_cached_obj *entry;
+	git_cache_shard *shard = cache_shard(cache, oid);
+	git_cached_obj *entry = NULL;
 
-	if (!git_cache__enabled || git_rwlock_rdlock(&cache->lock) < 0)
+	if (!git_cache__enabled)
 		return NULL;
 
-	if ((entry = git_oidmap_get(cache->map, oid)) != NULL) {
+	if (!git_atomic_get(&cache->registered))
+		cache_register(cache);
+
+	if (git_mutex_lock(&shard->lock) < 0)
+		return NULL;
+
+	if (shard->map && (entry = git_oidmap_get(shard->map, oid)) != NULL) {
 		if (flags && entry->flags != flags) {
 			entry = NULL;
 		} else {
+			entry->referenced = 1;
 			git_cached_obj_incref(entry);
 		}
 	}
 
-	git_rwlock_rdunlock(&cache->lock);
+	if (entry)
+		shard->hits++;
+	else
+		shard->misses++;
+
+	git_mutex_unlock(&shard->lock);
 
 	return entry;
 }
 
 static void *cache_store(git_cache *cache, git_cached_obj *entry)
 {
+	git_cache_shard *shard = cache_shard(cache, &entry->oid);
 	git_cached_obj *stored_entry;
 
 	git_cached_obj_incref(entry);
 
-	if (!git_cache__enabled && cache->used_memory > 0) {
+	if (!git_cache__enabled && git_cache_size(cache) > 0) {
 		git_cache_clear(cache);
 		return entry;
 	}
@@ -183,19 +428,31 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 	if (!cache_should_store(entry->type, entry->size))
 		return entry;
 
-	if (git_rwlock_wrlock(&cache->lock) < 0)
+	/* make room for the new entry */
+	if (git_cache__current_storage.val + (ssize_t)entry->size > git_cache__max_storage)
+		cache_evict_entries(cache, (ssize_t)entry->size);
+
+	if (git_mutex_lock(&shard->lock) < 0)
 		return entry;
 
-	/* soften the load on the cache */
-	if (git_cache__current_storage.val > git_cache__max_storage)
-		cache_evict_entries(cache);
+	if (!shard->map && git_oidmap_new(&shard->map) < 0) {
+		git_error_clear();
+		git_mutex_unlock(&shard->lock);
+		return entry;
+	}
 
 	/* not found */
-	if ((stored_entry = git_oidmap_get(cache->map, &entry->oid)) == NULL) {
-		if (git_oidmap_set(cache->map, &entry->oid, entry) == 0) {
+	if ((stored_entry = git_oidmap_get(shard->map, &entry->oid)) == NULL) {
+		git_oid *key = git_array_alloc(shard->clock);
+
+		if (key && git_oidmap_set(shard->map, &entry->oid, entry) == 0) {
+			git_oid_cpy(key, &entry->oid);
+			entry->referenced = 0;
 			git_cached_obj_incref(entry);
-			cache->used_memory += entry->size;
+			shard->used_memory += entry->size;
 			git_atomic_ssize_add(&git_cache__current_storage, (ssize_t)entry->size);
+		} else if (key) {
+			git_array_pop(shard->clock);
 		}
 	}
 	/* found */
@@ -203,19 +460,21 @@ static void *cache_store(git_cache *cache, git_cached_obj *entry)
 		if (stored_entry->flags == entry->flags) {
 			git_cached_obj_decref(entry);
 			git_cached_obj_incref(stored_entry);
+			stored_entry->referenced = 1;
 			entry = stored_entry;
 		} else if (stored_entry->flags == GIT_CACHE_STORE_RAW &&
 			   entry->flags == GIT_CACHE_STORE_PARSED) {
 			git_cached_obj_decref(stored_entry);
 			git_cached_obj_incref(entry);
+			entry->referenced = 1;
 
-			git_oidmap_set(cache->map, &entry->oid, entry);
+			git_oidmap_set(shard->map, &entry->oid, entry);
 		} else {
 			/* NO OP */
 		}
 	}
 
-	git_rwlock_wrunlock(&cache->lock);
+	git_mutex_unlock(&shard->lock);
 	return entry;
 }
 
@@ -13,6 +13,7 @@
 #include "git2/oid.h"
 #include "git2/odb.h"
 
+#include "array.h"
 #include "thread-utils.h"
 #include "oidmap.h"
 
@@ -25,15 +26,40 @@ enum {
 typedef struct {
 	git_oid    oid;
 	int16_t    type;  /* git_object_t value */
-	uint16_t   flags; /* GIT_CACHE_STORE value */
+	uint8_t    flags; /* GIT_CACHE_STORE value */
+	uint8_t    referenced; /* CLOCK reference bit, protected by the shard lock */
 	size_t     size;
 	git_atomic refcount;
 } git_cached_obj;
 
+/*
+ * The cache is split in shards, each with its own lock, so that threads
+ * sharing a repository rarely contend for the same lock. Entries are
+ * evicted with the CLOCK algorithm: the shard keeps its entries in a
+ * ring, and the eviction hand skips (and clears the reference bit of)
+ * the entries that were looked up since it last passed them. The limit
+ * on the cached memory is global, so a store evicts from every shard in
+ * turn until the new entry fits.
+ */
+#define GIT_CACHE_SHARDS 16
+
 typedef struct {
 	git_oidmap *map;
-	git_rwlock  lock;
+	git_mutex   lock;
 	ssize_t     used_memory;
+
+	git_array_t(git_oid) clock;
+	size_t      clock_hand;
+
+	size_t      hits;
+	size_t      misses;
+	size_t      evictions;
+} git_cache_shard;
+
+typedef struct {
+	git_cache_shard shards[GIT_CACHE_SHARDS];
+	git_atomic      evict_cursor;
+	git_atomic      registered;
 } git_cache;
 
 extern bool git_cache__enabled;
@@ -42,6 +68,12 @@ extern git_atomic_ssize git_cache__current_storage;
 
 int git_cache_set_max_object_size(git_object_t type, size_t size);
 
+int git_cache_global_init(void);
+
+/* Hit, miss and eviction counts summed over every cache. */
+void git_cache_stats(size_t *hits, size_t *misses, size_t *evictions);
+void git_cache_stats_reset(void);
+
 int git_cache_init(git_cache *cache);
 void git_cache_dispose(git_cache *cache);
 void git_cache_clear(git_cache *cache);
@@ -53,10 +85,7 @@ git_odb_object *git_cache_get_raw(git_cache *cache, const git_oid *oid);
 git_object *git_cache_get_parsed(git_cache *cache, const git_oid *oid);
 void *git_cache_get_any(git_cache *cache, const git_oid *oid);
 
-GIT_INLINE(size_t) git_cache_size(git_cache *cache)
-{
-	return (size_t)git_oidmap_size(cache->map);
-}
+size_t git_cache_size(git_cache *cache);
 
 GIT_INLINE(void) git_cached_obj_incref(void *_obj)
 {
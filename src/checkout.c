@@ -51,6 +51,12 @@ enum {
 		(CHECKOUT_ACTION__UPDATE_BLOB | CHECKOUT_ACTION__REMOVE),
 };
 
+/* Number of blobs that are read ahead together while creating files */
+#define CHECKOUT_PREFETCH_COUNT 32
+
+/* Blobs larger than this are not read ahead, but when they are written */
+#define CHECKOUT_PREFETCH_MAX_SIZE (1024 * 1024)
+
 typedef struct {
 	git_repository *repo;
 	git_iterator *target;
@@ -77,6 +83,8 @@ typedef struct {
 	git_checkout_perfdata perfdata;
 	git_strmap *mkdir_map;
 	git_attr_session attr_session;
+	git_odb_object *prefetched[CHECKOUT_PREFETCH_COUNT];
+	size_t prefetched_count;
 } checkout_data;
 
 typedef struct {
@@ -1728,6 +1736,23 @@ static int checkout_safe_for_update_only(
 	return 0;
 }
 
+static int checkout_lookup_blob(
+	git_blob **out, checkout_data *data, const git_oid *oid)
+{
+	git_odb_object *obj;
+	size_t i;
+
+	for (i = 0; i < data->prefetched_count; i++) {
+		obj = data->prefetched[i];
+
+		if (git_oid_equal(git_odb_object_id(obj), oid))
+			return git_object__from_odb_object(
+				(git_object **)out, data->repo, obj, GIT_OBJECT_BLOB);
+	}
+
+	return git_blob_lookup(out, data->repo, oid);
+}
+
 static int checkout_write_content(
 	checkout_data *data,
 	const git_oid *oid,
@@ -1739,7 +1764,7 @@ static int checkout_write_content(
 	int error = 0;
 	git_blob *blob;
 
-	if ((error = git_blob_lookup(&blob, data->repo, oid)) < 0)
+	if ((error = checkout_lookup_blob(&blob, data, oid)) < 0)
 		return error;
 
 	if (S_ISLNK(mode))
@@ -1875,35 +1900,102 @@ static int checkout_deferred_remove(git_repository *repo, const char *path)
 #endif
 }
 
+static void checkout_prefetch_clear(checkout_data *data)
+{
+	size_t i;
+
+	for (i = 0; i < data->prefetched_count; i++)
+		git_odb_object_free(data->prefetched[i]);
+
+	data->prefetched_count = 0;
+}
+
+/*
+ * Read the blobs of the next files to create together, which lets the
+ * object database read them in pack order and on several threads.
+ * Large blobs are left out, so that only a bounded amount of memory is
+ * held at once.  Returns the position of the first delta that was not
+ * looked at.
+ */
+static size_t checkout_prefetch(
+	checkout_data *data, unsigned int *actions, size_t start)
+{
+	git_oid ids[CHECKOUT_PREFETCH_COUNT];
+	git_diff_delta *delta;
+	git_object_t type;
+	git_odb *odb;
+	size_t i, size, count = 0;
+
+	checkout_prefetch_clear(data);
+
+	if (git_repository_odb__weakptr(&odb, data->repo) < 0) {
+		git_error_clear();
+		return start + 1;
+	}
+
+	for (i = start; i < data->diff->deltas.length &&
+			count < CHECKOUT_PREFETCH_COUNT; i++) {
+		if ((actions[i] & CHECKOUT_ACTION__UPDATE_BLOB) == 0)
+			continue;
+
+		delta = git_vector_get(&data->diff->deltas, i);
+
+		/* the blob is looked up on its own, and any error is
+		 * reported then */
+		if (git_odb_read_header(&size, &type, odb, &delta->new_file.id) < 0) {
+			git_error_clear();
+			continue;
+		}
+
+		if (size > CHECKOUT_PREFETCH_MAX_SIZE)
+			continue;
+
+		git_oid_cpy(&ids[count++], &delta->new_file.id);
+	}
+
+	/* the blobs are looked up one at a time otherwise, and any error
+	 * is reported then */
+	if (count > 1 && git_odb_read_many(data->prefetched, odb, ids, count) < 0)
+		git_error_clear();
+	else if (count > 1)
+		data->prefetched_count = count;
+
+	return i;
+}
+
 static int checkout_create_the_new(
 	unsigned int *actions,
 	checkout_data *data)
 {
 	int error = 0;
 	git_diff_delta *delta;
-	size_t i;
+	size_t i, prefetch_next = 0;
 
 	git_vector_foreach(&data->diff->deltas, i, delta) {
+		if (i == prefetch_next)
+			prefetch_next = checkout_prefetch(data, actions, i);
+
 		if (actions[i] & CHECKOUT_ACTION__DEFER_REMOVE) {
 			/* this had a blocker directory that should only be removed iff
 			 * all of the contents of the directory were safely removed
 			 */
 			if ((error = checkout_deferred_remove(
 					data->repo, delta->old_file.path)) < 0)
-				return error;
+				break;
 		}
 
 		if (actions[i] & CHECKOUT_ACTION__UPDATE_BLOB) {
 			error = checkout_blob(data, &delta->new_file);
 			if (error < 0)
-				return error;
+				break;
 
 			data->completed_steps++;
 			report_progress(data, delta->new_file.path);
 		}
 	}
 
-	return 0;
+	checkout_prefetch_clear(data);
+	return error;
 }
 
 static int checkout_create_submodules(
@@ -0,0 +1,880 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "commit_graph.h"
+
+#include "array.h"
+#include "buffer.h"
+#include "commit.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "odb.h"
+#include "oidmap.h"
+#include "pack.h"
+#include "revwalk.h"
+#include "sha1_lookup.h"
+
+#define GIT_COMMIT_GRAPH_MISSING_PARENT 0x70000000
+#define GIT_COMMIT_GRAPH_EXTRA_EDGE_FLAG 0x80000000
+#define GIT_COMMIT_GRAPH_LAST_EDGE 0x80000000
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+#define COMMIT_GRAPH_OBJECT_ID_VERSION 1
+
+#define COMMIT_GRAPH_OID_FANOUT_ID 0x4f494446 /* "OIDF" */
+#define COMMIT_GRAPH_OID_LOOKUP_ID 0x4f49444c /* "OIDL" */
+#define COMMIT_GRAPH_COMMIT_DATA_ID 0x43444154 /* "CDAT" */
+#define COMMIT_GRAPH_EXTRA_EDGE_LIST_ID 0x45444745 /* "EDGE" */
+
+#define COMMIT_DATA_SIZE (GIT_OID_RAWSZ + 16)
+
+struct git_commit_graph_header {
+	uint32_t signature;
+	uint8_t version;
+	uint8_t object_id_version;
+	uint8_t chunks;
+	uint8_t base_graph_files;
+};
+
+struct git_commit_graph_chunk {
+	git_off_t offset;
+	size_t length;
+};
+
+static int commit_graph_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid commit-graph file - %s", message);
+	return -1;
+}
+
+static int commit_graph_parse_oid_fanout(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_fanout)
+{
+	uint32_t i, nr;
+	if (chunk_oid_fanout->offset == 0)
+		return commit_graph_error("missing OID Fanout chunk");
+	if (chunk_oid_fanout->length == 0)
+		return commit_graph_error("empty OID Fanout chunk");
+	if (chunk_oid_fanout->length != 256 * 4)
+		return commit_graph_error("OID Fanout chunk has wrong length");
+
+	file->oid_fanout = (const uint32_t *)(data + chunk_oid_fanout->offset);
+	nr = 0;
+	for (i = 0; i < 256; ++i) {
+		uint32_t n = ntohl(file->oid_fanout[i]);
+		if (n < nr)
+			return commit_graph_error("index is non-monotonic");
+		nr = n;
+	}
+	file->num_commits = nr;
+	return 0;
+}
+
+static int commit_graph_parse_oid_lookup(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_oid_lookup)
+{
+	uint32_t i;
+	const git_oid *oid, *prev_oid = NULL;
+
+	if (chunk_oid_lookup->offset == 0)
+		return commit_graph_error("missing OID Lookup chunk");
+	if (chunk_oid_lookup->length == 0)
+		return commit_graph_error("empty OID Lookup chunk");
+	if (chunk_oid_lookup->length != file->num_commits * GIT_OID_RAWSZ)
+		return commit_graph_error("OID Lookup chunk has wrong length");
+
+	file->oid_lookup = oid = (const git_oid *)(data + chunk_oid_lookup->offset);
+	for (i = 0; i < file->num_commits; ++i, ++oid) {
+		if (prev_oid && git_oid_cmp(prev_oid, oid) >= 0)
+			return commit_graph_error("OID Lookup index is non-monotonic");
+		prev_oid = oid;
+	}
+
+	return 0;
+}
+
+static int commit_graph_parse_commit_data(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_commit_data)
+{
+	if (chunk_commit_data->offset == 0)
+		return commit_graph_error("missing Commit Data chunk");
+	if (chunk_commit_data->length == 0)
+		return commit_graph_error("empty Commit Data chunk");
+	if (chunk_commit_data->length != file->num_commits * COMMIT_DATA_SIZE)
+		return commit_graph_error("Commit Data chunk has wrong length");
+
+	file->commit_data = data + chunk_commit_data->offset;
+
+	return 0;
+}
+
+static int commit_graph_parse_extra_edge_list(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		struct git_commit_graph_chunk *chunk_extra_edge_list)
+{
+	if (chunk_extra_edge_list->length == 0)
+		return 0;
+	if (chunk_extra_edge_list->length % 4 != 0)
+		return commit_graph_error("malformed Extra Edge List chunk");
+
+	file->extra_edge_list = (const uint32_t *)(data + chunk_extra_edge_list->offset);
+	file->num_extra_edge_list = chunk_extra_edge_list->length / 4;
+
+	return 0;
+}
+
+int git_commit_graph_parse(
+		git_commit_graph_file *file,
+		const unsigned char *data,
+		size_t size)
+{
+	struct git_commit_graph_header *hdr;
+	const unsigned char *chunk_hdr;
+	struct git_commit_graph_chunk *last_chunk;
+	uint32_t i;
+	git_off_t last_chunk_offset, chunk_offset, trailer_offset;
+	int error;
+	struct git_commit_graph_chunk chunk_oid_fanout = {0}, chunk_oid_lookup = {0},
+				      chunk_commit_data = {0}, chunk_extra_edge_list = {0},
+				      chunk_unsupported = {0};
+
+	assert(file);
+
+	if (size < sizeof(struct git_commit_graph_header) + GIT_OID_RAWSZ)
+		return commit_graph_error("commit-graph is too short");
+
+	hdr = ((struct git_commit_graph_header *)data);
+
+	if (hdr->signature != htonl(COMMIT_GRAPH_SIGNATURE) ||
+	    hdr->version != COMMIT_GRAPH_VERSION ||
+	    hdr->object_id_version != COMMIT_GRAPH_OBJECT_ID_VERSION) {
+		return commit_graph_error("unsupported commit-graph version");
+	}
+	if (hdr->chunks == 0)
+		return commit_graph_error("no chunks in commit-graph");
+
+	/*
+	 * The very first chunk's offset should be after the header, all the chunk
+	 * headers, and a special zero chunk.
+	 */
+	last_chunk_offset = sizeof(struct git_commit_graph_header) + (1 + hdr->chunks) * 12;
+	trailer_offset = size - GIT_OID_RAWSZ;
+	if (trailer_offset < last_chunk_offset)
+		return commit_graph_error("wrong commit-graph size");
+	/*
+	 * Hashing the whole file on every open would defeat the purpose of a
+	 * commit-graph on large repositories; like git, we only remember the
+	 * trailer so that we can tell when the file was rewritten.
+	 */
+	git_oid_cpy(&file->checksum, (git_oid *)(data + trailer_offset));
+
+	chunk_hdr = data + sizeof(struct git_commit_graph_header);
+	last_chunk = NULL;
+	for (i = 0; i < hdr->chunks; ++i, chunk_hdr += 12) {
+		chunk_offset = ((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 4)))) << 32
+				| ((git_off_t)ntohl(*((uint32_t *)(chunk_hdr + 8))));
+		if (chunk_offset < last_chunk_offset)
+			return commit_graph_error("chunks are non-monotonic");
+		if (chunk_offset >= trailer_offset)
+			return commit_graph_error("chunks extend beyond the trailer");
+		if (last_chunk != NULL)
+			last_chunk->length = (size_t)(chunk_offset - last_chunk_offset);
+		last_chunk_offset = chunk_offset;
+
+		switch (ntohl(*((uint32_t *)(chunk_hdr + 0)))) {
+		case COMMIT_GRAPH_OID_FANOUT_ID:
+			chunk_oid_fanout.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_fanout;
+			break;
+
+		case COMMIT_GRAPH_OID_LOOKUP_ID:
+			chunk_oid_lookup.offset = last_chunk_offset;
+			last_chunk = &chunk_oid_lookup;
+			break;
+
+		case COMMIT_GRAPH_COMMIT_DATA_ID:
+			chunk_commit_data.offset = last_chunk_offset;
+			last_chunk = &chunk_commit_data;
+			break;
+
+		case COMMIT_GRAPH_EXTRA_EDGE_LIST_ID:
+			chunk_extra_edge_list.offset = last_chunk_offset;
+			last_chunk = &chunk_extra_edge_list;
+			break;
+
+		default:
+			chunk_unsupported.offset = last_chunk_offset;
+			last_chunk = &chunk_unsupported;
+		}
+	}
+	last_chunk->length = (size_t)(trailer_offset - last_chunk_offset);
+
+	error = commit_graph_parse_oid_fanout(file, data, &chunk_oid_fanout);
+	if (error < 0)
+		return error;
+	error = commit_graph_parse_oid_lookup(file, data, &chunk_oid_lookup);
+	if (error < 0)
+		return error;
+	error = commit_graph_parse_commit_data(file, data, &chunk_commit_data);
+	if (error < 0)
+		return error;
+	error = commit_graph_parse_extra_edge_list(file, data, &chunk_extra_edge_list);
+	if (error < 0)
+		return error;
+
+	return 0;
+}
+
+int git_commit_graph_open(git_commit_graph_file **file_out, const char *path)
+{
+	git_commit_graph_file *file;
+	git_file fd = -1;
+	size_t cgraph_size;
+	struct stat st;
+	int error;
+
+	fd = git_futils_open_ro(path);
+	if (fd < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_ODB, "commit-graph file not found - '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+
+	if (!S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_ODB, "invalid commit-graph file '%s'", path);
+		return GIT_ENOTFOUND;
+	}
+	cgraph_size = (size_t)st.st_size;
+
+	file = git__calloc(1, sizeof(git_commit_graph_file));
+	GIT_ERROR_CHECK_ALLOC(file);
+
+	error = git_buf_sets(&file->filename, path);
+	if (error < 0) {
+		p_close(fd);
+		git_commit_graph_free(file);
+		return error;
+	}
+
+	error = git_futils_mmap_ro(&file->graph_map, fd, 0, cgraph_size);
+	p_close(fd);
+	if (error < 0) {
+		git_commit_graph_free(file);
+		return error;
+	}
+
+	if ((error = git_commit_graph_parse(file, file->graph_map.data, cgraph_size)) < 0) {
+		git_commit_graph_free(file);
+		return error;
+	}
+
+	*file_out = file;
+	return 0;
+}
+
+int git_commit_graph_entry_find(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		const git_oid *short_oid,
+		size_t len)
+{
+	int pos, found = 0;
+	uint32_t hi, lo;
+	const git_oid *current = NULL;
+	const unsigned char *commit_data;
+
+	assert(e && file && short_oid);
+
+	hi = ntohl(file->oid_fanout[(int)short_oid->id[0]]);
+	lo = ((short_oid->id[0] == 0x0) ? 0 : ntohl(file->oid_fanout[(int)short_oid->id[0] - 1]));
+
+	pos = sha1_position(file->oid_lookup, GIT_OID_RAWSZ, lo, hi, short_oid->id);
+
+	if (pos >= 0) {
+		/* An object matching exactly the oid was found */
+		found = 1;
+		current = file->oid_lookup + pos;
+	} else {
+		/* No object was found */
+		/* pos refers to the object with the "closest" oid to short_oid */
+		pos = -1 - pos;
+		if (pos < (int)file->num_commits) {
+			current = file->oid_lookup + pos;
+
+			if (!git_oid_ncmp(short_oid, current, len))
+				found = 1;
+		}
+	}
+
+	if (found && len != GIT_OID_HEXSZ && pos + 1 < (int)file->num_commits) {
+		/* Check for ambiguousity */
+		const git_oid *next = current + 1;
+
+		if (!git_oid_ncmp(short_oid, next, len)) {
+			found = 2;
+		}
+	}
+
+	if (!found)
+		return git_odb__error_notfound(
+				"failed to find offset for commit-graph index entry", short_oid, len);
+	if (found > 1)
+		return git_odb__error_ambiguous(
+				"found multiple offsets for commit-graph index entry");
+
+	commit_data = file->commit_data + pos * COMMIT_DATA_SIZE;
+	git_oid_cpy(&e->tree_oid, (const git_oid *)commit_data);
+	e->parent_indices[0] = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ)));
+	e->parent_indices[1] = ntohl(
+			*((uint32_t *)(commit_data + GIT_OID_RAWSZ + sizeof(uint32_t))));
+	e->parent_count = (e->parent_indices[0] != GIT_COMMIT_GRAPH_MISSING_PARENT)
+			+ (e->parent_indices[1] != GIT_COMMIT_GRAPH_MISSING_PARENT);
+	e->generation = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 2 * sizeof(uint32_t))));
+	e->commit_time = ntohl(*((uint32_t *)(commit_data + GIT_OID_RAWSZ + 3 * sizeof(uint32_t))));
+
+	e->commit_time |= (e->generation & UINT64_C(0x3)) << UINT64_C(32);
+	e->generation >>= 2u;
+	if (e->parent_indices[1] & GIT_COMMIT_GRAPH_EXTRA_EDGE_FLAG) {
+		const uint32_t *extra_edge;
+		size_t i;
+
+		e->extra_parents_index = e->parent_indices[1] & ~GIT_COMMIT_GRAPH_EXTRA_EDGE_FLAG;
+		e->parent_count = 1;
+		for (i = e->extra_parents_index; i < file->num_extra_edge_list; ++i) {
+			extra_edge = file->extra_edge_list + i;
+			e->parent_count++;
+			if (ntohl(*extra_edge) & GIT_COMMIT_GRAPH_LAST_EDGE)
+				break;
+		}
+
+		if (i == file->num_extra_edge_list)
+			return commit_graph_error("unterminated extra edge list");
+	}
+	git_oid_cpy(&e->sha1, current);
+	return 0;
+}
+
+static int commit_graph_entry_get_byindex(
+		git_commit_graph_entry *e,
+		const git_commit_graph_file *file,
+		size_t pos)
+{
+	if (pos >= file->num_commits) {
+		git_error_set(GIT_ERROR_INVALID, "commit index %zu does not exist", pos);
+		return GIT_ENOTFOUND;
+	}
+
+	return git_commit_graph_entry_find(e, file, &file->oid_lookup[pos], GIT_OID_HEXSZ);
+}
+
+int git_commit_graph_entry_parent(
+		git_commit_graph_entry *parent,
+		const git_commit_graph_file *file,
+		const git_commit_graph_entry *entry,
+		size_t n)
+{
+	assert(parent && file);
+
+	if (n >= entry->parent_count) {
+		git_error_set(GIT_ERROR_INVALID, "parent index %zu does not exist", n);
+		return GIT_ENOTFOUND;
+	}
+
+	if (n == 0 || (n == 1 && entry->parent_count == 2))
+		return commit_graph_entry_get_byindex(parent, file, entry->parent_indices[n]);
+
+	return commit_graph_entry_get_byindex(
+			parent,
+			file,
+			ntohl(
+				*(uint32_t *)(file->extra_edge_list + entry->extra_parents_index + n - 1))
+					& ~GIT_COMMIT_GRAPH_LAST_EDGE);
+}
+
+int git_commit_graph_close(git_commit_graph_file *file)
+{
+	assert(file);
+
+	if (file->graph_map.data)
+		git_futils_mmap_free(&file->graph_map);
+
+	return 0;
+}
+
+void git_commit_graph_free(git_commit_graph_file *file)
+{
+	if (!file)
+		return;
+
+	git_buf_dispose(&file->filename);
+	git_commit_graph_close(file);
+	git__free(file);
+}
+
+/*
+ * Writer
+ */
+
+typedef git_array_t(git_oid) git_array_oid_t;
+
+struct packed_commit {
+	size_t index;
+	git_oid sha1;
+	git_oid tree_oid;
+	uint32_t generation;
+	git_time_t commit_time;
+	git_array_oid_t parents;
+	git_array_t(size_t) parent_indices;
+};
+
+struct git_commit_graph_writer {
+	git_buf objects_info_dir;
+	git_vector commits;
+	git_oidmap *commit_map;
+};
+
+static void packed_commit_free(struct packed_commit *p)
+{
+	if (!p)
+		return;
+
+	git_array_clear(p->parents);
+	git_array_clear(p->parent_indices);
+	git__free(p);
+}
+
+static int packed_commit__cmp(const void *a_, const void *b_)
+{
+	const struct packed_commit *a = a_;
+	const struct packed_commit *b = b_;
+	return git_oid_cmp(&a->sha1, &b->sha1);
+}
+
+int git_commit_graph_writer_new(
+		git_commit_graph_writer **out,
+		const char *objects_info_dir)
+{
+	git_commit_graph_writer *w;
+
+	assert(out && objects_info_dir);
+
+	w = git__calloc(1, sizeof(git_commit_graph_writer));
+	GIT_ERROR_CHECK_ALLOC(w);
+
+	if (git_buf_sets(&w->objects_info_dir, objects_info_dir) < 0 ||
+	    git_vector_init(&w->commits, 0, packed_commit__cmp) < 0 ||
+	    git_oidmap_new(&w->commit_map) < 0) {
+		git_commit_graph_writer_free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+void git_commit_graph_writer_free(git_commit_graph_writer *w)
+{
+	struct packed_commit *packed_commit;
+	size_t i;
+
+	if (!w)
+		return;
+
+	git_vector_foreach (&w->commits, i, packed_commit)
+		packed_commit_free(packed_commit);
+	git_vector_free(&w->commits);
+	git_oidmap_free(w->commit_map);
+	git_buf_dispose(&w->objects_info_dir);
+	git__free(w);
+}
+
+int git_commit_graph_writer_add(
+		git_commit_graph_writer *w,
+		git_repository *repo,
+		const git_oid *commit_id)
+{
+	struct packed_commit *p;
+	git_commit *commit = NULL;
+	git_oid *parent;
+	unsigned int i, parentcount;
+	int error;
+
+	assert(w && repo && commit_id);
+
+	if (git_oidmap_exists(w->commit_map, commit_id))
+		return 0;
+
+	if ((error = git_commit_lookup(&commit, repo, commit_id)) < 0)
+		return error;
+
+	p = git__calloc(1, sizeof(struct packed_commit));
+	if (!p) {
+		git_commit_free(commit);
+		return -1;
+	}
+
+	git_oid_cpy(&p->sha1, commit_id);
+	git_oid_cpy(&p->tree_oid, git_commit_tree_id(commit));
+	p->commit_time = git_commit_time(commit);
+
+	parentcount = git_commit_parentcount(commit);
+	for (i = 0; i < parentcount; ++i) {
+		if ((parent = git_array_alloc(p->parents)) == NULL) {
+			git_commit_free(commit);
+			packed_commit_free(p);
+			return -1;
+		}
+		git_oid_cpy(parent, git_commit_parent_id(commit, i));
+	}
+	git_commit_free(commit);
+
+	if ((error = git_vector_insert(&w->commits, p)) < 0) {
+		packed_commit_free(p);
+		return error;
+	}
+
+	return git_oidmap_set(w->commit_map, &p->sha1, p);
+}
+
+int git_commit_graph_writer_add_revwalk(
+		git_commit_graph_writer *w,
+		git_revwalk *walk)
+{
+	git_oid id;
+	int error;
+
+	assert(w && walk);
+
+	while ((error = git_revwalk_next(&id, walk)) == 0) {
+		if ((error = git_commit_graph_writer_add(w, walk->repo, &id)) < 0)
+			return error;
+	}
+
+	if (error != GIT_ITEROVER)
+		return error;
+
+	return 0;
+}
+
+/*
+ * Resolve parent indices and compute generation numbers. The traversal
+ * uses an explicit stack so that very long linear histories don't
+ * exhaust the C stack.
+ */
+static int compute_generation_numbers(git_vector *commits, git_oidmap *commit_map)
+{
+	git_array_t(size_t) index_stack = GIT_ARRAY_INIT;
+	struct packed_commit *p, *parent;
+	size_t i, j, *index_ptr, *parent_idx;
+	git_oid *parent_id;
+	int error = 0;
+
+	git_vector_foreach (commits, i, p) {
+		git_array_foreach (p->parents, j, parent_id) {
+			parent = git_oidmap_get(commit_map, parent_id);
+			if (!parent) {
+				git_error_set(GIT_ERROR_ODB,
+					"commit-graph is missing the parent %s of commit %s",
+					git_oid_tostr_s(parent_id), git_oid_tostr_s(&p->sha1));
+				error = -1;
+				goto cleanup;
+			}
+
+			if ((parent_idx = git_array_alloc(p->parent_indices)) == NULL) {
+				error = -1;
+				goto cleanup;
+			}
+			*parent_idx = parent->index;
+		}
+	}
+
+	git_vector_foreach (commits, i, p) {
+		if (p->generation)
+			continue;
+
+		if ((index_ptr = git_array_alloc(index_stack)) == NULL) {
+			error = -1;
+			goto cleanup;
+		}
+		*index_ptr = i;
+
+		while (git_array_size(index_stack)) {
+			size_t *index = git_array_last(index_stack);
+			struct packed_commit *current = git_vector_get(commits, *index);
+			uint32_t max_generation = 0;
+			bool pending = false;
+
+			git_array_foreach (current->parent_indices, j, parent_idx) {
+				parent = git_vector_get(commits, *parent_idx);
+				if (!parent->generation) {
+					if ((index_ptr = git_array_alloc(index_stack)) == NULL) {
+						error = -1;
+						goto cleanup;
+					}
+					*index_ptr = *parent_idx;
+					pending = true;
+				} else if (parent->generation > max_generation) {
+					max_generation = parent->generation;
+				}
+			}
+
+			if (pending)
+				continue;
+
+			if (max_generation >= GIT_COMMIT_GRAPH_GENERATION_MAX)
+				current->generation = GIT_COMMIT_GRAPH_GENERATION_MAX;
+			else
+				current->generation = max_generation + 1;
+
+			git_array_pop(index_stack);
+		}
+	}
+
+cleanup:
+	git_array_clear(index_stack);
+	return error;
+}
+
+static int write_offset(git_off_t offset, git_buf *out)
+{
+	uint32_t word;
+
+	word = htonl((uint32_t)((offset >> 32) & 0xffffffffu));
+	if (git_buf_put(out, (const char *)&word, sizeof(word)) < 0)
+		return -1;
+	word = htonl((uint32_t)((offset >> 0) & 0xffffffffu));
+	return git_buf_put(out, (const char *)&word, sizeof(word));
+}
+
+static int write_chunk_header(int chunk_id, git_off_t offset, git_buf *out)
+{
+	uint32_t word = htonl(chunk_id);
+	if (git_buf_put(out, (const char *)&word, sizeof(word)) < 0)
+		return -1;
+	return write_offset(offset, out);
+}
+
+static int commit_graph_write(git_buf *out, git_commit_graph_writer *w)
+{
+	int error = 0;
+	size_t i, j;
+	struct packed_commit *packed_commit;
+	struct git_commit_graph_header hdr = {0};
+	uint32_t oid_fanout_count;
+	uint32_t extra_edge_list_count;
+	uint32_t oid_fanout[256];
+	git_off_t offset;
+	git_buf oid_lookup = GIT_BUF_INIT, commit_data = GIT_BUF_INIT,
+		extra_edge_list = GIT_BUF_INIT;
+	git_oid cgraph_checksum;
+
+	hdr.signature = htonl(COMMIT_GRAPH_SIGNATURE);
+	hdr.version = COMMIT_GRAPH_VERSION;
+	hdr.object_id_version = COMMIT_GRAPH_OBJECT_ID_VERSION;
+	hdr.chunks = 0;
+	hdr.base_graph_files = 0;
+
+	if (w->commits.length > UINT32_MAX - 1) {
+		git_error_set(GIT_ERROR_ODB, "too many commits for a commit-graph");
+		return -1;
+	}
+
+	git_vector_sort(&w->commits);
+	git_vector_foreach (&w->commits, i, packed_commit)
+		packed_commit->index = i;
+
+	if ((error = compute_generation_numbers(&w->commits, w->commit_map)) < 0)
+		goto cleanup;
+
+	/* Fill the OID Fanout table. */
+	oid_fanout_count = 0;
+	for (i = 0; i < 256; i++) {
+		while (oid_fanout_count < git_vector_length(&w->commits) &&
+		       (packed_commit = git_vector_get(&w->commits, oid_fanout_count)) &&
+		       packed_commit->sha1.id[0] <= i)
+			++oid_fanout_count;
+		oid_fanout[i] = htonl(oid_fanout_count);
+	}
+
+	/* Fill the OID Lookup table. */
+	git_vector_foreach (&w->commits, i, packed_commit) {
+		error = git_buf_put(&oid_lookup,
+			(const char *)&packed_commit->sha1, sizeof(git_oid));
+		if (error < 0)
+			goto cleanup;
+	}
+
+	/* Fill the Commit Data and Extra Edge List tables. */
+	extra_edge_list_count = 0;
+	git_vector_foreach (&w->commits, i, packed_commit) {
+		uint64_t commit_time;
+		uint32_t generation;
+		uint32_t word;
+		size_t *packed_index;
+		unsigned int parentcount = (unsigned int)git_array_size(packed_commit->parents);
+
+		error = git_buf_put(&commit_data,
+			(const char *)&packed_commit->tree_oid, sizeof(git_oid));
+		if (error < 0)
+			goto cleanup;
+
+		if (parentcount == 0) {
+			word = htonl(GIT_COMMIT_GRAPH_MISSING_PARENT);
+		} else {
+			packed_index = git_array_get(packed_commit->parent_indices, 0);
+			word = htonl((uint32_t)*packed_index);
+		}
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+
+		if (parentcount < 2) {
+			word = htonl(GIT_COMMIT_GRAPH_MISSING_PARENT);
+		} else if (parentcount == 2) {
+			packed_index = git_array_get(packed_commit->parent_indices, 1);
+			word = htonl((uint32_t)*packed_index);
+		} else {
+			word = htonl(0x80000000u | extra_edge_list_count);
+		}
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+
+		if (parentcount > 2) {
+			for (j = 1; j < parentcount; ++j) {
+				packed_index = git_array_get(packed_commit->parent_indices, j);
+				word = htonl((uint32_t)(*packed_index | (j + 1 == parentcount ? 0x80000000u : 0)));
+				error = git_buf_put(&extra_edge_list, (const char *)&word, sizeof(word));
+				if (error < 0)
+					goto cleanup;
+			}
+			extra_edge_list_count += j - 1;
+		}
+
+		generation = packed_commit->generation;
+		commit_time = (uint64_t)packed_commit->commit_time;
+		if (generation > GIT_COMMIT_GRAPH_GENERATION_MAX)
+			generation = GIT_COMMIT_GRAPH_GENERATION_MAX;
+		word = htonl((uint32_t)((generation << 2) | ((commit_time >> 32ull) & 0x3ull)));
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+		word = htonl((uint32_t)(commit_time & 0xffffffffull));
+		error = git_buf_put(&commit_data, (const char *)&word, sizeof(word));
+		if (error < 0)
+			goto cleanup;
+	}
+
+	/* Write the header. */
+	hdr.chunks = 3;
+	if (git_buf_len(&extra_edge_list) > 0)
+		hdr.chunks++;
+	if ((error = git_buf_put(out, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto cleanup;
+
+	/* Write the chunk headers. */
+	offset = sizeof(hdr) + (hdr.chunks + 1) * 12;
+	if ((error = write_chunk_header(COMMIT_GRAPH_OID_FANOUT_ID, offset, out)) < 0)
+		goto cleanup;
+	offset += sizeof(oid_fanout);
+	if ((error = write_chunk_header(COMMIT_GRAPH_OID_LOOKUP_ID, offset, out)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&oid_lookup);
+	if ((error = write_chunk_header(COMMIT_GRAPH_COMMIT_DATA_ID, offset, out)) < 0)
+		goto cleanup;
+	offset += git_buf_len(&commit_data);
+	if (git_buf_len(&extra_edge_list) > 0) {
+		if ((error = write_chunk_header(
+				COMMIT_GRAPH_EXTRA_EDGE_LIST_ID, offset, out)) < 0)
+			goto cleanup;
+		offset += git_buf_len(&extra_edge_list);
+	}
+	if ((error = write_chunk_header(0, offset, out)) < 0)
+		goto cleanup;
+
+	/* Write all the chunks. */
+	if ((error = git_buf_put(out, (const char *)oid_fanout, sizeof(oid_fanout))) < 0 ||
+	    (error = git_buf_put(out, git_buf_cstr(&oid_lookup), git_buf_len(&oid_lookup))) < 0 ||
+	    (error = git_buf_put(out, git_buf_cstr(&commit_data), git_buf_len(&commit_data))) < 0 ||
+	    (error = git_buf_put(out, git_buf_cstr(&extra_edge_list), git_buf_len(&extra_edge_list))) < 0)
+		goto cleanup;
+
+	/* Finalize the checksum and write the trailer. */
+	if ((error = git_hash_buf(&cgraph_checksum, git_buf_cstr(out), git_buf_len(out))) < 0)
+		goto cleanup;
+	error = git_buf_put(out, (const char *)&cgraph_checksum, sizeof(cgraph_checksum));
+
+cleanup:
+	git_buf_dispose(&oid_lookup);
+	git_buf_dispose(&commit_data);
+	git_buf_dispose(&extra_edge_list);
+	return error;
+}
+
+int git_commit_graph_writer_commit(
+		git_commit_graph_writer *w)
+{
+	int error;
+	int filebuf_flags = GIT_FILEBUF_DO_NOT_BUFFER;
+	git_buf commit_graph_path = GIT_BUF_INIT, out = GIT_BUF_INIT;
+	git_filebuf output = GIT_FILEBUF_INIT;
+
+	assert(w);
+
+	if ((error = git_buf_joinpath(
+			&commit_graph_path, git_buf_cstr(&w->objects_info_dir), "commit-graph")) < 0)
+		goto cleanup;
+
+	if (git_repository__fsync_gitdir)
+		filebuf_flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = commit_graph_write(&out, w)) < 0)
+		goto cleanup;
+
+	if ((error = git_futils_mkdir(git_buf_cstr(&w->objects_info_dir),
+			GIT_OBJECT_DIR_MODE, GIT_MKDIR_PATH)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_open(&output, git_buf_cstr(&commit_graph_path),
+			filebuf_flags, 0644)) < 0)
+		goto cleanup;
+
+	if ((error = git_filebuf_write(&output, out.ptr, out.size)) < 0) {
+		git_filebuf_cleanup(&output);
+		goto cleanup;
+	}
+
+	error = git_filebuf_commit(&output);
+
+cleanup:
+	git_buf_dispose(&out);
+	git_buf_dispose(&commit_graph_path);
+	return error;
+}
+
+int git_commit_graph_writer_dump(
+		git_buf *cgraph,
+		git_commit_graph_writer *w)
+{
+	assert(cgraph && w);
+
+	git_buf_sanitize(cgraph);
+	return commit_graph_write(cgraph, w);
+}
@@ -10,6 +10,7 @@
 #include "revwalk.h"
 #include "pool.h"
 #include "odb.h"
+#include "repository.h"
 
 int git_commit_list_time_cmp(const void *a, const void *b)
 {
@@ -24,6 +25,30 @@ int git_commit_list_time_cmp(const void *a, const void *b)
 	return 0;
 }
 
+/*
+ * Orders by generation number first (an unknown generation, which is
+ * stored as zero, sorts as infinitely high, since such a commit is
+ * newer than anything in the commit-graph) and then by commit time.
+ * Walks that pop in this order never see a commit before any of its
+ * descendants that are reachable from the starting points.
+ */
+int git_commit_list_generation_cmp(const void *a, const void *b)
+{
+	uint32_t generation_a = ((git_commit_list_node *) a)->generation;
+	uint32_t generation_b = ((git_commit_list_node *) b)->generation;
+
+	if (generation_a != generation_b) {
+		if (!generation_a)
+			return -1;
+		if (!generation_b)
+			return 1;
+
+		return generation_a < generation_b ? 1 : -1;
+	}
+
+	return git_commit_list_time_cmp(a, b);
+}
+
 git_commit_list *git_commit_list_insert(git_commit_list_node *item, git_commit_list **list_p)
 {
 	git_commit_list *new_list = git__malloc(sizeof(git_commit_list));
@@ -181,14 +206,96 @@ static int commit_quick_parse(
 	return 0;
 }
 
+static int commit_graph_parse(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_graph_file *cgraph_file,
+	git_commit_graph_entry *e)
+{
+	git_commit_graph_entry parent;
+	size_t i;
+
+	commit->parents = alloc_parents(walk, commit, e->parent_count);
+	GIT_ERROR_CHECK_ALLOC(commit->parents);
+
+	for (i = 0; i < e->parent_count; ++i) {
+		git_commit_list_node *p;
+
+		if (git_commit_graph_entry_parent(&parent, cgraph_file, e, i) < 0)
+			return -1;
+
+		if ((p = git_revwalk__commit_lookup(walk, &parent.sha1)) == NULL)
+			return -1;
+
+		if (!p->generation)
+			p->generation = (uint32_t)parent.generation;
+
+		commit->parents[i] = p;
+	}
+
+	commit->out_degree = (unsigned short)e->parent_count;
+	commit->time = e->commit_time;
+	commit->generation = (uint32_t)e->generation;
+	commit->parsed = 1;
+	return 0;
+}
+
+/*
+ * Grafts and a shallow file change the parents of commits, which the
+ * commit-graph does not know about, so git ignores the graph when either
+ * is present and so do we.
+ */
+static bool commit_graph_allowed(git_repository *repo)
+{
+	git_buf path = GIT_BUF_INIT;
+	bool allowed;
+
+	if (git_repository_is_shallow(repo) != 0 ||
+	    git_buf_joinpath(&path, repo->gitdir, "info/grafts") < 0) {
+		git_error_clear();
+		return false;
+	}
+
+	allowed = !git_path_exists(path.ptr);
+	git_buf_dispose(&path);
+
+	return allowed;
+}
+
+static git_commit_graph_file *walk_commit_graph(git_revwalk *walk)
+{
+	if (!walk->commit_graph_checked) {
+		walk->commit_graph_checked = 1;
+
+		if (!commit_graph_allowed(walk->repo))
+			walk->commit_graph = NULL;
+		else if (git_odb__get_commit_graph_file(&walk->commit_graph, walk->odb) < 0) {
+			walk->commit_graph = NULL;
+			git_error_clear();
+		}
+	}
+
+	return walk->commit_graph;
+}
+
 int git_commit_list_parse(git_revwalk *walk, git_commit_list_node *commit)
 {
 	git_odb_object *obj;
+	git_commit_graph_file *cgraph_file;
+	git_commit_graph_entry e;
 	int error;
 
 	if (commit->parsed)
 		return 0;
 
+	if ((cgraph_file = walk_commit_graph(walk)) != NULL) {
+		if (git_commit_graph_entry_find(
+				&e, cgraph_file, &commit->oid, GIT_OID_HEXSZ) == 0)
+			return commit_graph_parse(walk, commit, cgraph_file, &e);
+
+		git_error_clear();
+	}
+
 	if ((error = git_odb_read(&obj, walk->odb, &commit->oid)) < 0)
 		return error;
 
@@ -55,6 +55,8 @@ static void config_free(git_config *cfg)
 	}
 
 	git_vector_free(&cfg->backends);
+	git_config_compiled_free(cfg->compiled);
+	git_mutex_free(&cfg->compiled_lock);
 
 	git__memzero(cfg, sizeof(*cfg));
 	git__free(cfg);
@@ -90,11 +92,172 @@ int git_config_new(git_config **out)
 		return -1;
 	}
 
+	git_mutex_init(&cfg->compiled_lock);
+
 	*out = cfg;
 	GIT_REFCOUNT_INC(cfg);
 	return 0;
 }
 
+static int config_compile(git_config_compiled **out, const git_config *cfg)
+{
+	git_config_compiled *compiled;
+	backend_internal *internal;
+	git_config_iterator *iter;
+	git_config_entry *entry;
+	uint64_t *generation;
+	size_t i;
+	int error = 0;
+
+	if (git_config_compiled_new(&compiled) < 0)
+		return -1;
+
+	/* Lowest priority first, so that the winner of a name comes last */
+	for (i = cfg->backends.length; i > 0; i--) {
+		internal = git_vector_get(&cfg->backends, i - 1);
+
+		if ((generation = git_array_alloc(compiled->generations)) == NULL) {
+			error = -1;
+			goto out;
+		}
+
+		/*
+		 * Read the generation before the entries: if the backend
+		 * changes in between, the table is merely rebuilt again.
+		 */
+		if ((error = internal->backend->generation(generation, internal->backend)) < 0)
+			goto out;
+
+		if ((error = internal->backend->iterator(&iter, internal->backend)) == GIT_ENOTFOUND)
+			continue;
+		else if (error < 0)
+			goto out;
+
+		while ((error = iter->next(&entry, iter)) == 0)
+			if ((error = git_config_compiled_add(compiled, entry)) < 0)
+				break;
+
+		iter->free(iter);
+
+		if (error != GIT_ITEROVER)
+			goto out;
+	}
+
+	if ((error = git_config_compiled_finish(compiled)) < 0)
+		goto out;
+
+	*out = compiled;
+	return 0;
+
+out:
+	git_config_compiled_free(compiled);
+	return error;
+}
+
+static bool config_compiled_is_current(
+	int *error, const git_config *cfg, const git_config_compiled *compiled)
+{
+	backend_internal *internal;
+	uint64_t generation;
+	size_t i;
+
+	*error = 0;
+
+	if (!compiled ||
+	    git_array_size(compiled->generations) != cfg->backends.length)
+		return false;
+
+	for (i = 0; i < cfg->backends.length; i++) {
+		internal = git_vector_get(&cfg->backends, cfg->backends.length - i - 1);
+
+		if ((*error = internal->backend->generation(&generation, internal->backend)) < 0 ||
+		    generation != *git_array_get(compiled->generations, i))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Take a reference on the compiled table of the configuration,
+ * rebuilding it if any of the backends changed.  `out` is NULL when a
+ * backend cannot tell us whether it changed.
+ */
+static int config_compiled_take(git_config_compiled **out, const git_config *_cfg)
+{
+	git_config *cfg = (git_config *)_cfg;
+	git_config_compiled *compiled, *old;
+	backend_internal *internal;
+	size_t i;
+	int error;
+
+	*out = NULL;
+
+	if (cfg->frozen) {
+		git_config_compiled_incref(cfg->compiled);
+		*out = cfg->compiled;
+		return 0;
+	}
+
+	git_vector_foreach(&cfg->backends, i, internal) {
+		if (!internal->backend->generation)
+			return 0;
+	}
+
+	if (git_mutex_lock(&cfg->compiled_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock config");
+		return -1;
+	}
+
+	if ((compiled = cfg->compiled) != NULL)
+		git_config_compiled_incref(compiled);
+
+	git_mutex_unlock(&cfg->compiled_lock);
+
+	if (config_compiled_is_current(&error, cfg, compiled)) {
+		*out = compiled;
+		return 0;
+	}
+
+	git_config_compiled_free(compiled);
+
+	if (error < 0 || (error = config_compile(&compiled, cfg)) < 0)
+		return error;
+
+	if (git_mutex_lock(&cfg->compiled_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock config");
+		git_config_compiled_free(compiled);
+		return -1;
+	}
+
+	git_config_compiled_incref(compiled);
+	old = cfg->compiled;
+	cfg->compiled = compiled;
+
+	git_mutex_unlock(&cfg->compiled_lock);
+
+	git_config_compiled_free(old);
+
+	*out = compiled;
+	return 0;
+}
+
+static void config_compiled_clear(git_config *cfg)
+{
+	git_config_compiled *compiled;
+
+	if (git_mutex_lock(&cfg->compiled_lock) < 0)
+		return;
+
+	compiled = cfg->compiled;
+	cfg->compiled = NULL;
+	cfg->frozen = false;
+
+	git_mutex_unlock(&cfg->compiled_lock);
+
+	git_config_compiled_free(compiled);
+}
+
 int git_config_add_file_ondisk(
 	git_config *cfg,
 	const char *path,
@@ -152,6 +315,7 @@ int git_config_snapshot(git_config **out, git_config *in)
 	int error = 0;
 	size_t i;
 	backend_internal *internal;
+	git_config_compiled *compiled;
 	git_config *config;
 
 	*out = NULL;
@@ -171,6 +335,20 @@ int git_config_snapshot(git_config **out, git_config *in)
 		}
 	}
 
+	/*
+	 * The snapshot can share the compiled table of its source when they
+	 * see the same entries, and its table never needs to be checked
+	 * again afterwards.
+	 */
+	if (!error && (error = config_compiled_take(&compiled, in)) == 0 && compiled) {
+		config->compiled = compiled;
+
+		if ((error = config_compiled_take(&compiled, config)) == 0 && compiled) {
+			config->frozen = true;
+			git_config_compiled_free(compiled);
+		}
+	}
+
 	if (error < 0)
 		git_config_free(config);
 	else
@@ -268,6 +446,8 @@ static int git_config__add_internal(
 
 	GIT_REFCOUNT_INC(internal);
 
+	config_compiled_clear(cfg);
+
 	return 0;
 }
 
@@ -713,6 +893,48 @@ enum {
 	GET_NO_ERRORS  = 2
 };
 
+/*
+ * Values of entries from the compiled table have already been parsed;
+ * anything else (including invalid values, so that the error is the
+ * same) goes through the regular parsers.
+ */
+int git_config__parse_entry_bool(int *out, const git_config_entry *entry)
+{
+	const git_config_compiled_value *value;
+
+	if ((value = git_config_compiled_value_of(entry)) != NULL && value->has_bool) {
+		*out = value->bool_value;
+		return 0;
+	}
+
+	return git_config_parse_bool(out, entry->value);
+}
+
+static int config_entry_parse_int64(int64_t *out, const git_config_entry *entry)
+{
+	const git_config_compiled_value *value;
+
+	if ((value = git_config_compiled_value_of(entry)) != NULL && value->has_int) {
+		*out = value->int_value;
+		return 0;
+	}
+
+	return git_config_parse_int64(out, entry->value);
+}
+
+static int config_entry_parse_int32(int32_t *out, const git_config_entry *entry)
+{
+	const git_config_compiled_value *value;
+
+	if ((value = git_config_compiled_value_of(entry)) != NULL && value->has_int &&
+	    value->int_value == (int32_t)value->int_value) {
+		*out = (int32_t)value->int_value;
+		return 0;
+	}
+
+	return git_config_parse_int32(out, entry->value);
+}
+
 static int get_entry(
 	git_config_entry **out,
 	const git_config *cfg,
@@ -725,6 +947,8 @@ static int get_entry(
 	char *normalized = NULL;
 	size_t i;
 	backend_internal *internal;
+	git_config_compiled *compiled;
+	const git_config_compiled_key *compiled_key;
 
 	*out = NULL;
 
@@ -734,6 +958,22 @@ static int get_entry(
 		key = normalized;
 	}
 
+	if ((res = config_compiled_take(&compiled, cfg)) < 0)
+		goto out;
+
+	if (compiled) {
+		/* The entry keeps our reference on the table */
+		if ((compiled_key = git_config_compiled_lookup(compiled, key)) != NULL) {
+			*out = &git_config_compiled_winner(compiled, compiled_key)->entry;
+			res = 0;
+		} else {
+			git_config_compiled_free(compiled);
+			res = GIT_ENOTFOUND;
+		}
+
+		goto out;
+	}
+
 	res = GIT_ENOTFOUND;
 	git_vector_foreach(&cfg->backends, i, internal) {
 		if (!internal || !internal->backend)
@@ -744,6 +984,7 @@ static int get_entry(
 			break;
 	}
 
+out:
 	git__free(normalized);
 
 cleanup:
@@ -800,7 +1041,7 @@ int git_config_get_int64(int64_t *out, const git_config *cfg, const char *name)
 	if ((ret = get_entry(&entry, cfg, name, true, GET_ALL_ERRORS)) < 0)
 		return ret;
 
-	ret = git_config_parse_int64(out, entry->value);
+	ret = config_entry_parse_int64(out, entry);
 	git_config_entry_free(entry);
 
 	return ret;
@@ -814,7 +1055,7 @@ int git_config_get_int32(int32_t *out, const git_config *cfg, const char *name)
 	if ((ret = get_entry(&entry, cfg, name, true, GET_ALL_ERRORS)) < 0)
 		return ret;
 
-	ret = git_config_parse_int32(out, entry->value);
+	ret = config_entry_parse_int32(out, entry);
 	git_config_entry_free(entry);
 
 	return ret;
@@ -828,7 +1069,7 @@ int git_config_get_bool(int *out, const git_config *cfg, const char *name)
 	if ((ret = get_entry(&entry, cfg, name, true, GET_ALL_ERRORS)) < 0)
 		return ret;
 
-	ret = git_config_parse_bool(out, entry->value);
+	ret = git_config__parse_entry_bool(out, entry);
 	git_config_entry_free(entry);
 
 	return ret;
@@ -924,7 +1165,7 @@ int git_config__get_bool_force(
 
 	get_entry(&entry, cfg, key, false, GET_NO_ERRORS);
 
-	if (entry && git_config_parse_bool(&val, entry->value) < 0)
+	if (entry && git_config__parse_entry_bool(&val, entry) < 0)
 		git_error_clear();
 
 	git_config_entry_free(entry);
@@ -939,7 +1180,7 @@ int git_config__get_int_force(
 
 	get_entry(&entry, cfg, key, false, GET_NO_ERRORS);
 
-	if (entry && git_config_parse_int32(&val, entry->value) < 0)
+	if (entry && config_entry_parse_int32(&val, entry) < 0)
 		git_error_clear();
 
 	git_config_entry_free(entry);
@@ -980,16 +1221,37 @@ int git_config_get_multivar_foreach(
 typedef struct {
 	git_config_iterator parent;
 	git_config_iterator *iter;
+	git_config_compiled *compiled;
+	const git_config_compiled_key *key;
+	size_t pos;
 	char *name;
 	regex_t regex;
 	int have_regex;
 } multivar_iter;
 
+static int multivar_iter_next_compiled(git_config_entry **entry, multivar_iter *iter)
+{
+	while (iter->key && iter->pos < iter->key->count) {
+		*entry = &iter->compiled->values[iter->key->first + iter->pos++].entry;
+
+		if (!iter->have_regex)
+			return 0;
+
+		if (regexec(&iter->regex, (*entry)->value, 0, NULL, 0) == 0)
+			return 0;
+	}
+
+	return GIT_ITEROVER;
+}
+
 static int multivar_iter_next(git_config_entry **entry, git_config_iterator *_iter)
 {
 	multivar_iter *iter = (multivar_iter *) _iter;
 	int error = 0;
 
+	if (iter->compiled)
+		return multivar_iter_next_compiled(entry, iter);
+
 	while ((error = iter->iter->next(entry, iter->iter)) == 0) {
 		if (git__strcmp(iter->name, (*entry)->name))
 			continue;
@@ -1008,7 +1270,9 @@ void multivar_iter_free(git_config_iterator *_iter)
 {
 	multivar_iter *iter = (multivar_iter *) _iter;
 
-	iter->iter->free(iter->iter);
+	if (iter->iter)
+		iter->iter->free(iter->iter);
+	git_config_compiled_free(iter->compiled);
 
 	git__free(iter->name);
 	if (iter->have_regex)
@@ -1020,9 +1284,13 @@ int git_config_multivar_iterator_new(git_config_iterator **out, const git_config
 {
 	multivar_iter *iter = NULL;
 	git_config_iterator *inner = NULL;
+	git_config_compiled *compiled;
 	int error;
 
-	if ((error = git_config_iterator_new(&inner, cfg)) < 0)
+	if ((error = config_compiled_take(&compiled, cfg)) < 0)
+		return error;
+
+	if (!compiled && (error = git_config_iterator_new(&inner, cfg)) < 0)
 		return error;
 
 	iter = git__calloc(1, sizeof(multivar_iter));
@@ -1031,6 +1299,9 @@ int git_config_multivar_iterator_new(git_config_iterator **out, const git_config
 	if ((error = git_config__normalize_name(name, &iter->name)) < 0)
 		goto on_error;
 
+	if (compiled)
+		iter->key = git_config_compiled_lookup(compiled, iter->name);
+
 	if (regexp != NULL) {
 		error = p_regcomp(&iter->regex, regexp, REG_EXTENDED);
 		if (error != 0) {
@@ -1044,6 +1315,7 @@ int git_config_multivar_iterator_new(git_config_iterator **out, const git_config
 	}
 
 	iter->iter = inner;
+	iter->compiled = compiled;
 	iter->parent.free = multivar_iter_free;
 	iter->parent.next = multivar_iter_next;
 
@@ -1053,7 +1325,10 @@ int git_config_multivar_iterator_new(git_config_iterator **out, const git_config
 
 on_error:
 
-	inner->free(inner);
+	if (inner)
+		inner->free(inner);
+	git_config_compiled_free(compiled);
+	git__free(iter->name);
 	git__free(iter);
 	return error;
 }
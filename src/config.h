@@ -13,6 +13,7 @@
 #include "git2/config.h"
 #include "vector.h"
 #include "repository.h"
+#include "config_compiled.h"
 
 #define GIT_CONFIG_FILENAME_PROGRAMDATA "config"
 #define GIT_CONFIG_FILENAME_SYSTEM "gitconfig"
@@ -25,6 +26,12 @@
 struct git_config {
 	git_refcount rc;
 	git_vector backends;
+
+	/* protects `compiled`, unless the configuration is frozen */
+	git_mutex compiled_lock;
+	git_config_compiled *compiled;
+	/* a snapshot whose compiled table can never go stale */
+	bool frozen;
 };
 
 extern int git_config__global_location(git_buf *buf);
@@ -43,6 +50,12 @@ extern int git_config__lookup_entry(
 	const char *key,
 	bool no_errors);
 
+/*
+ * internal only: parse the value of an entry as a boolean, using the
+ * value parsed when the configuration was compiled if there is one
+ */
+extern int git_config__parse_entry_bool(int *out, const git_config_entry *entry);
+
 /* internal only: update and/or delete entry string with constraints */
 extern int git_config__update_entry(
 	git_config *cfg,
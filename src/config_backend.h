@@ -25,6 +25,12 @@
  */
 extern int git_config_backend_from_file(git_config_backend **out, const char *path);
 
+/**
+ * Set up the cache of parsed system and global configuration files
+ * which is shared by every repository of the process.
+ */
+extern int git_config_diskfile_global_init(void);
+
 /**
  * Create an in-memory configuration file backend
  *
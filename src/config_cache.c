@@ -64,6 +64,17 @@ static git_cvar_map _cvar_map_logallrefupdates[] = {
 	{GIT_CVAR_STRING, "always", GIT_LOGALLREFUPDATES_ALWAYS},
 };
 
+static git_cvar_map _cvar_map_untrackedcache[] = {
+	{GIT_CVAR_FALSE, NULL, GIT_UNTRACKEDCACHE_FALSE},
+	{GIT_CVAR_TRUE, NULL, GIT_UNTRACKEDCACHE_TRUE},
+	{GIT_CVAR_STRING, "keep", GIT_UNTRACKEDCACHE_KEEP},
+};
+
+static git_cvar_map _cvar_map_splitindex[] = {
+	{GIT_CVAR_FALSE, NULL, GIT_SPLITINDEX_FALSE},
+	{GIT_CVAR_TRUE, NULL, GIT_SPLITINDEX_TRUE},
+};
+
 /*
  * Generic map for integer values
  */
@@ -86,6 +97,12 @@ static struct map_data _cvar_maps[] = {
 	{"core.protecthfs", NULL, 0, GIT_PROTECTHFS_DEFAULT },
 	{"core.protectntfs", NULL, 0, GIT_PROTECTNTFS_DEFAULT },
 	{"core.fsyncobjectfiles", NULL, 0, GIT_FSYNCOBJECTFILES_DEFAULT },
+	{"index.recordendofindexentries", NULL, 0, GIT_INDEXRECORDEOIE_DEFAULT },
+	{"index.recordoffsettable", NULL, 0, GIT_INDEXRECORDIEOT_DEFAULT },
+	{"core.untrackedcache", _cvar_map_untrackedcache, ARRAY_SIZE(_cvar_map_untrackedcache), GIT_UNTRACKEDCACHE_DEFAULT},
+	{"core.splitindex", _cvar_map_splitindex, ARRAY_SIZE(_cvar_map_splitindex), GIT_SPLITINDEX_DEFAULT},
+	{"splitindex.maxpercentchange", _cvar_map_int, 1, GIT_SPLITINDEXMAXCHANGE_DEFAULT },
+	{"core.mmappackedrefs", NULL, 0, GIT_MMAPPACKEDREFS_DEFAULT },
 };
 
 int git_config__cvar(int *out, git_config *config, git_cvar_cached cvar)
@@ -103,7 +120,7 @@ int git_config__cvar(int *out, git_config *config, git_cvar_cached cvar)
 		error = git_config_lookup_map_value(
 			out, data->maps, data->map_count, entry->value);
 	else
-		error = git_config_parse_bool(out, entry->value);
+		error = git_config__parse_entry_bool(out, entry);
 
 	git_config_entry_free(entry);
 	return error;
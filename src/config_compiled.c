@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "config_compiled.h"
+
+#include "config.h"
+
+#define COMPILED_MIN_SLOTS 64
+
+static uint32_t compiled_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static git_config_compiled_key *compiled_slot(
+	git_config_compiled_key *keys, size_t mask, const char *name, uint32_t hash)
+{
+	size_t pos = hash & mask;
+
+	while (keys[pos].name &&
+	       (keys[pos].hash != hash || strcmp(keys[pos].name, name)))
+		pos = (pos + 1) & mask;
+
+	return &keys[pos];
+}
+
+static int compiled_grow(git_config_compiled *compiled)
+{
+	git_config_compiled_key *keys, *slot;
+	size_t slots, i;
+
+	GIT_ERROR_CHECK_ALLOC_MULTIPLY(&slots, compiled->mask + 1, 2);
+
+	keys = git__calloc(slots, sizeof(git_config_compiled_key));
+	GIT_ERROR_CHECK_ALLOC(keys);
+
+	for (i = 0; i <= compiled->mask; i++) {
+		if (!compiled->keys[i].name)
+			continue;
+
+		slot = compiled_slot(keys, slots - 1,
+			compiled->keys[i].name, compiled->keys[i].hash);
+		*slot = compiled->keys[i];
+	}
+
+	git__free(compiled->keys);
+	compiled->keys = keys;
+	compiled->mask = slots - 1;
+
+	return 0;
+}
+
+int git_config_compiled_new(git_config_compiled **out)
+{
+	git_config_compiled *compiled;
+
+	compiled = git__calloc(1, sizeof(git_config_compiled));
+	GIT_ERROR_CHECK_ALLOC(compiled);
+
+	compiled->keys = git__calloc(COMPILED_MIN_SLOTS, sizeof(git_config_compiled_key));
+	if (!compiled->keys) {
+		git__free(compiled);
+		return -1;
+	}
+
+	compiled->mask = COMPILED_MIN_SLOTS - 1;
+	git_pool_init(&compiled->pool, 1);
+	GIT_REFCOUNT_INC(compiled);
+
+	*out = compiled;
+	return 0;
+}
+
+int git_config_compiled_add(
+	git_config_compiled *compiled, const git_config_entry *entry)
+{
+	git_config_compiled_key *key;
+	git_config_compiled_value *value;
+	uint32_t hash = compiled_hash(entry->name);
+	int bool_value;
+	int64_t int_value;
+
+	assert(compiled->values == NULL);
+
+	if ((compiled->nkeys + 1) * 2 > compiled->mask + 1 &&
+	    compiled_grow(compiled) < 0)
+		return -1;
+
+	key = compiled_slot(compiled->keys, compiled->mask, entry->name, hash);
+
+	if (!key->name) {
+		key->name = git_pool_strdup(&compiled->pool, entry->name);
+		GIT_ERROR_CHECK_ALLOC(key->name);
+		key->hash = hash;
+		compiled->nkeys++;
+	}
+
+	value = git_array_alloc(compiled->pending);
+	GIT_ERROR_CHECK_ALLOC(value);
+	memset(value, 0, sizeof(*value));
+
+	value->entry.name = key->name;
+	value->entry.level = entry->level;
+	value->entry.include_depth = entry->include_depth;
+
+	if (entry->value) {
+		value->entry.value = git_pool_strdup(&compiled->pool, entry->value);
+		GIT_ERROR_CHECK_ALLOC(value->entry.value);
+	}
+
+	/* Values which are not booleans or integers are fine */
+	if (git_config_parse_bool(&bool_value, entry->value) == 0) {
+		value->has_bool = 1;
+		value->bool_value = !!bool_value;
+	}
+
+	if (git_config_parse_int64(&int_value, entry->value) == 0) {
+		value->has_int = 1;
+		value->int_value = int_value;
+	}
+
+	git_error_clear();
+	key->count++;
+
+	return 0;
+}
+
+static void compiled_entry_free(git_config_entry *entry)
+{
+	git_config_compiled_free(entry->payload);
+}
+
+int git_config_compiled_finish(git_config_compiled *compiled)
+{
+	git_config_compiled_value *pending;
+	git_config_compiled_key *key;
+	size_t i, first = 0;
+
+	assert(compiled->values == NULL);
+
+	compiled->nvalues = git_array_size(compiled->pending);
+	compiled->values = git__calloc(compiled->nvalues ? compiled->nvalues : 1,
+		sizeof(git_config_compiled_value));
+	GIT_ERROR_CHECK_ALLOC(compiled->values);
+
+	/* Give every name its own run of values... */
+	for (i = 0; i <= compiled->mask; i++) {
+		key = &compiled->keys[i];
+		if (!key->name)
+			continue;
+
+		key->first = first;
+		first += key->count;
+		key->count = 0;
+	}
+
+	/* ...and fill them in the order they were added */
+	git_array_foreach(compiled->pending, i, pending) {
+		key = compiled_slot(compiled->keys, compiled->mask,
+			pending->entry.name, compiled_hash(pending->entry.name));
+
+		pending->entry.free = compiled_entry_free;
+		pending->entry.payload = compiled;
+
+		compiled->values[key->first + key->count++] = *pending;
+	}
+
+	git_array_clear(compiled->pending);
+
+	return 0;
+}
+
+const git_config_compiled_key *git_config_compiled_lookup(
+	const git_config_compiled *compiled, const char *name)
+{
+	const git_config_compiled_key *key;
+
+	key = compiled_slot(compiled->keys, compiled->mask, name, compiled_hash(name));
+
+	return key->name ? key : NULL;
+}
+
+const git_config_compiled_value *git_config_compiled_value_of(
+	const git_config_entry *entry)
+{
+	if (!entry || entry->free != compiled_entry_free)
+		return NULL;
+
+	return (const git_config_compiled_value *)entry;
+}
+
+void git_config_compiled_incref(git_config_compiled *compiled)
+{
+	GIT_REFCOUNT_INC(compiled);
+}
+
+static void compiled_free(git_config_compiled *compiled)
+{
+	git_pool_clear(&compiled->pool);
+	git_array_clear(compiled->generations);
+	git_array_clear(compiled->pending);
+	git__free(compiled->values);
+	git__free(compiled->keys);
+	git__free(compiled);
+}
+
+void git_config_compiled_free(git_config_compiled *compiled)
+{
+	if (!compiled)
+		return;
+
+	GIT_REFCOUNT_DEC(compiled, compiled_free);
+}
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_config_compiled_h__
+#define INCLUDE_config_compiled_h__
+
+#include "common.h"
+
+#include "array.h"
+#include "pool.h"
+#include "git2/config.h"
+
+/**
+ * A compiled configuration is an immutable view of every level of a
+ * `git_config`, merged into a single open-addressed hash table.  Every
+ * name is stored once and the values of a name are stored next to each
+ * other, from the lowest priority level to the highest, so that both
+ * single lookups and multivar lookups are a single probe.  Booleans and
+ * integers are parsed once, when the table is compiled.
+ *
+ * Once `git_config_compiled_finish` has been called the table is never
+ * modified again, so it can be read from any number of threads without
+ * locking; it is replaced as a whole when the configuration changes.
+ */
+
+typedef struct {
+	/* must be the first member, entries are handed out to callers */
+	git_config_entry entry;
+	int64_t int_value;
+	unsigned int has_bool:1,
+		bool_value:1,
+		has_int:1;
+} git_config_compiled_value;
+
+typedef struct {
+	const char *name;
+	uint32_t hash;
+	size_t first;
+	size_t count;
+} git_config_compiled_key;
+
+typedef struct git_config_compiled {
+	git_refcount rc;
+	git_pool pool;
+
+	git_config_compiled_key *keys;
+	size_t mask;
+	size_t nkeys;
+
+	git_config_compiled_value *values;
+	size_t nvalues;
+
+	/* the generation of every backend the table was compiled from */
+	git_array_t(uint64_t) generations;
+
+	/* the values in the order they were added, until finished */
+	git_array_t(git_config_compiled_value) pending;
+} git_config_compiled;
+
+extern int git_config_compiled_new(git_config_compiled **out);
+
+/**
+ * Add an entry to a table that is being compiled.  Entries must be
+ * added in the order of `git_config_iterator_new`, that is from the
+ * lowest priority level to the highest.
+ */
+extern int git_config_compiled_add(
+	git_config_compiled *compiled, const git_config_entry *entry);
+
+/** Lay the values out by name; the table is immutable afterwards. */
+extern int git_config_compiled_finish(git_config_compiled *compiled);
+
+/** Find a (normalized) name, or NULL if it is not set at any level. */
+extern const git_config_compiled_key *git_config_compiled_lookup(
+	const git_config_compiled *compiled, const char *name);
+
+/** The value a single lookup of `key` returns. */
+GIT_INLINE(git_config_compiled_value *) git_config_compiled_winner(
+	const git_config_compiled *compiled, const git_config_compiled_key *key)
+{
+	return &compiled->values[key->first + key->count - 1];
+}
+
+/**
+ * Return the compiled value an entry was handed out from, or NULL if
+ * the entry did not come from a compiled table.
+ */
+extern const git_config_compiled_value *git_config_compiled_value_of(
+	const git_config_entry *entry);
+
+extern void git_config_compiled_incref(git_config_compiled *compiled);
+extern void git_config_compiled_free(git_config_compiled *compiled);
+
+#endif
@@ -8,6 +8,7 @@
 #include "config.h"
 
 #include "filebuf.h"
+#include "global.h"
 #include "sysdir.h"
 #include "buffer.h"
 #include "buf_text.h"
@@ -31,6 +32,8 @@ typedef struct {
 	/* mutex to coordinate accessing the values */
 	git_mutex values_mutex;
 	git_config_entries *entries;
+	/* bumped every time `entries` is replaced */
+	uint64_t generation;
 	const git_repository *repo;
 	git_config_level_t level;
 } diskfile_header;
@@ -95,6 +98,28 @@ static git_config_entries *diskfile_entries_take(diskfile_header *h)
 	return entries;
 }
 
+/*
+ * A file modified in the same second it was read could be modified
+ * again without its stamp changing.
+ */
+static bool config_stamp_is_racy(const git_futils_filestamp *stamp)
+{
+	return stamp->mtime.tv_sec >= time(NULL);
+}
+
+static void config_file_stamp(struct config_file *file)
+{
+	struct stat st;
+
+	if (p_stat(file->path, &st) < 0) {
+		git_futils_filestamp_set(&file->stamp, NULL);
+		return;
+	}
+
+	git_futils_filestamp_set_from_stat(&file->stamp, &st);
+	file->racy = config_stamp_is_racy(&file->stamp);
+}
+
 static void config_file_clear(struct config_file *file)
 {
 	struct config_file *include;
@@ -111,31 +136,52 @@ static void config_file_clear(struct config_file *file)
 	git__free(file->path);
 }
 
-static int config_open(git_config_backend *cfg, git_config_level_t level, const git_repository *repo)
+static int config_file_dup(struct config_file *out, const struct config_file *in)
 {
-	int res;
-	diskfile_backend *b = (diskfile_backend *)cfg;
+	struct config_file *include, *copy;
+	uint32_t i;
 
-	b->header.level = level;
-	b->header.repo = repo;
+	memset(out, 0, sizeof(*out));
+	git_oid_cpy(&out->checksum, &in->checksum);
+	git_futils_filestamp_set(&out->stamp, &in->stamp);
+	out->racy = in->racy;
+	out->conditional = in->conditional;
 
-	if ((res = git_config_entries_new(&b->header.entries)) < 0)
-		return res;
+	out->path = git__strdup(in->path);
+	GIT_ERROR_CHECK_ALLOC(out->path);
 
-	if (!git_path_exists(b->file.path))
-		return 0;
+	git_array_foreach(in->includes, i, include) {
+		copy = git_array_alloc(out->includes);
+		GIT_ERROR_CHECK_ALLOC(copy);
+		memset(copy, 0, sizeof(*copy));
 
-	if (res < 0 || (res = config_read(b->header.entries, repo, &b->file, level, 0)) < 0) {
-		git_config_entries_free(b->header.entries);
-		b->header.entries = NULL;
+		if (config_file_dup(copy, include) < 0)
+			return -1;
 	}
 
-	return res;
+	return 0;
+}
+
+static bool config_file_is_conditional(const struct config_file *file)
+{
+	struct config_file *include;
+	uint32_t i;
+
+	if (file->conditional)
+		return true;
+
+	git_array_foreach(file->includes, i, include) {
+		if (config_file_is_conditional(include))
+			return true;
+	}
+
+	return false;
 }
 
 static int config_is_modified(int *modified, struct config_file *file)
 {
 	git_config_file *include;
+	git_futils_filestamp stamp;
 	git_buf buf = GIT_BUF_INIT;
 	git_oid hash;
 	uint32_t i;
@@ -143,15 +189,26 @@ static int config_is_modified(int *modified, struct config_file *file)
 
 	*modified = 0;
 
-	if ((error = git_futils_readbuffer(&buf, file->path)) < 0)
-		goto out;
+	git_futils_filestamp_set(&stamp, &file->stamp);
 
-	if ((error = git_hash_buf(&hash, buf.ptr, buf.size)) < 0)
+	if ((error = git_futils_filestamp_check(&stamp, file->path)) < 0)
 		goto out;
 
-	if (!git_oid_equal(&hash, &file->checksum)) {
-		*modified = 1;
-		goto out;
+	/* Only read the file when its stat data cannot tell */
+	if (error > 0 || file->racy) {
+		if ((error = git_futils_readbuffer(&buf, file->path)) < 0)
+			goto out;
+
+		if ((error = git_hash_buf(&hash, buf.ptr, buf.size)) < 0)
+			goto out;
+
+		if (!git_oid_equal(&hash, &file->checksum)) {
+			*modified = 1;
+			goto out;
+		}
+
+		git_futils_filestamp_set(&file->stamp, &stamp);
+		file->racy = config_stamp_is_racy(&stamp);
 	}
 
 	git_array_foreach(file->includes, i, include) {
@@ -165,6 +222,175 @@ out:
 	return error;
 }
 
+/*
+ * The system, XDG, global and programdata files are the same for every
+ * repository, so their parsed entries are shared by all the backends
+ * opening them, for as long as the files do not change.  Files with
+ * conditional includes depend on the repository and are not shared.
+ */
+typedef struct {
+	git_config_level_t level;
+	git_config_entries *entries;
+	struct config_file file;
+} diskfile_cache_entry;
+
+static git_mutex diskfile_cache_lock;
+static git_strmap *diskfile_cache;
+
+static bool diskfile_cache_level(git_config_level_t level)
+{
+	return level == GIT_CONFIG_LEVEL_PROGRAMDATA ||
+		level == GIT_CONFIG_LEVEL_SYSTEM ||
+		level == GIT_CONFIG_LEVEL_XDG ||
+		level == GIT_CONFIG_LEVEL_GLOBAL;
+}
+
+static void diskfile_cache_entry_free(diskfile_cache_entry *entry)
+{
+	if (entry == NULL)
+		return;
+
+	git_config_entries_free(entry->entries);
+	config_file_clear(&entry->file);
+	git__free(entry);
+}
+
+static void git_config_diskfile_global_shutdown(void)
+{
+	diskfile_cache_entry *entry;
+
+	git_strmap_foreach_value(diskfile_cache, entry, {
+		diskfile_cache_entry_free(entry);
+	});
+
+	git_strmap_free(diskfile_cache);
+	diskfile_cache = NULL;
+
+	git_mutex_free(&diskfile_cache_lock);
+}
+
+int git_config_diskfile_global_init(void)
+{
+	if (git_mutex_init(&diskfile_cache_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize config file cache mutex");
+		return -1;
+	}
+
+	if (git_strmap_new(&diskfile_cache) < 0)
+		return -1;
+
+	git__on_shutdown(git_config_diskfile_global_shutdown);
+	return 0;
+}
+
+/*
+ * Use the shared entries of the file, if they are still up to date;
+ * returns GIT_ENOTFOUND when the file has to be parsed.
+ */
+static int diskfile_cache_lookup(diskfile_backend *b)
+{
+	diskfile_cache_entry *entry;
+	int error = GIT_ENOTFOUND, modified;
+
+	if (!diskfile_cache_level(b->header.level))
+		return GIT_ENOTFOUND;
+
+	if (git_mutex_lock(&diskfile_cache_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock config file cache");
+		return -1;
+	}
+
+	entry = git_strmap_get(diskfile_cache, b->file.path);
+	if (entry == NULL || entry->level != b->header.level)
+		goto out;
+
+	if ((error = config_is_modified(&modified, &entry->file)) < 0 || modified) {
+		if (error < 0)
+			git_error_clear();
+
+		git_strmap_delete(diskfile_cache, b->file.path);
+		diskfile_cache_entry_free(entry);
+		error = GIT_ENOTFOUND;
+		goto out;
+	}
+
+	config_file_clear(&b->file);
+	if ((error = config_file_dup(&b->file, &entry->file)) < 0)
+		goto out;
+
+	git_config_entries_incref(entry->entries);
+	b->header.entries = entry->entries;
+
+out:
+	git_mutex_unlock(&diskfile_cache_lock);
+	return error;
+}
+
+static int diskfile_cache_store(diskfile_backend *b)
+{
+	diskfile_cache_entry *entry, *old;
+	int error;
+
+	if (!diskfile_cache_level(b->header.level) ||
+	    config_file_is_conditional(&b->file))
+		return 0;
+
+	entry = git__calloc(1, sizeof(diskfile_cache_entry));
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	entry->level = b->header.level;
+
+	if ((error = config_file_dup(&entry->file, &b->file)) < 0) {
+		diskfile_cache_entry_free(entry);
+		return error;
+	}
+
+	git_config_entries_incref(b->header.entries);
+	entry->entries = b->header.entries;
+
+	if (git_mutex_lock(&diskfile_cache_lock) < 0) {
+		diskfile_cache_entry_free(entry);
+		git_error_set(GIT_ERROR_OS, "failed to lock config file cache");
+		return -1;
+	}
+
+	old = git_strmap_get(diskfile_cache, entry->file.path);
+
+	if ((error = git_strmap_set(diskfile_cache, entry->file.path, entry)) < 0)
+		diskfile_cache_entry_free(entry);
+	else
+		diskfile_cache_entry_free(old);
+
+	git_mutex_unlock(&diskfile_cache_lock);
+	return error;
+}
+
+static int config_open(git_config_backend *cfg, git_config_level_t level, const git_repository *repo)
+{
+	int res;
+	diskfile_backend *b = (diskfile_backend *)cfg;
+
+	b->header.level = level;
+	b->header.repo = repo;
+
+	if (!git_path_exists(b->file.path))
+		return git_config_entries_new(&b->header.entries);
+
+	if ((res = diskfile_cache_lookup(b)) != GIT_ENOTFOUND)
+		return res;
+
+	if ((res = git_config_entries_new(&b->header.entries)) < 0)
+		return res;
+
+	if ((res = config_read(b->header.entries, repo, &b->file, level, 0)) < 0) {
+		git_config_entries_free(b->header.entries);
+		b->header.entries = NULL;
+		return res;
+	}
+
+	return diskfile_cache_store(b);
+}
+
 static int config_refresh(git_config_backend *cfg)
 {
 	diskfile_backend *b = (diskfile_backend *)cfg;
@@ -202,6 +428,7 @@ static int config_refresh(git_config_backend *cfg)
 
 	tmp = b->header.entries;
 	b->header.entries = entries;
+	b->header.generation++;
 	entries = tmp;
 
 	git_mutex_unlock(&b->header.values_mutex);
@@ -296,6 +523,26 @@ static void free_diskfile_entry(git_config_entry *entry)
 	git_config_entries_free(entries);
 }
 
+static int config_generation(uint64_t *out, git_config_backend *cfg)
+{
+	diskfile_header *h = (diskfile_header *)cfg;
+	int error;
+
+	if (!h->parent.readonly && ((error = config_refresh(cfg)) < 0))
+		return error;
+
+	if (git_mutex_lock(&h->values_mutex) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock config backend");
+		return -1;
+	}
+
+	*out = h->generation;
+
+	git_mutex_unlock(&h->values_mutex);
+
+	return 0;
+}
+
 /*
  * Internal function that actually gets the value in string form
  */
@@ -493,6 +740,7 @@ int git_config_backend_from_file(git_config_backend **out, const char *path)
 	backend->header.parent.lock = config_lock;
 	backend->header.parent.unlock = config_unlock;
 	backend->header.parent.free = backend_free;
+	backend->header.parent.generation = config_generation;
 
 	*out = (git_config_backend *)backend;
 
@@ -578,9 +826,17 @@ static int config_readonly_open(git_config_backend *cfg, git_config_level_t leve
 	GIT_UNUSED(level);
 	GIT_UNUSED(repo);
 
-	if ((entries = diskfile_entries_take(src_header)) == NULL)
+	if (git_mutex_lock(&src_header->values_mutex) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock config backend");
 		return -1;
+	}
+
+	entries = src_header->entries;
+	git_config_entries_incref(entries);
 	b->header.entries = entries;
+	b->header.generation = src_header->generation;
+
+	git_mutex_unlock(&src_header->values_mutex);
 
 	return 0;
 }
@@ -609,6 +865,7 @@ static int config_snapshot(git_config_backend **out, git_config_backend *in)
 	backend->header.parent.lock = config_lock_readonly;
 	backend->header.parent.unlock = config_unlock_readonly;
 	backend->header.parent.free = backend_readonly_free;
+	backend->header.parent.generation = config_generation;
 
 	*out = (git_config_backend *)backend;
 
@@ -769,7 +1026,12 @@ static int parse_conditional_include(git_config_parser *reader,
 	size_t i;
 	int error = 0, matches;
 
-	if (!parse_data->repo || !file)
+	if (!file)
+		return 0;
+
+	reader->file->conditional = true;
+
+	if (!parse_data->repo)
 		return 0;
 
 	condition = git__substrdup(section + strlen("includeIf."),
@@ -868,6 +1130,8 @@ static int config_read(
 		return -1;
 	}
 
+	config_file_stamp(file);
+
 	if ((error = git_futils_readbuffer(&contents, file->path)) < 0)
 		goto out;
 
@@ -174,6 +174,15 @@ static int config_memory_snapshot(git_config_backend **out, git_config_backend *
 	return -1;
 }
 
+static int config_memory_generation(uint64_t *out, git_config_backend *backend)
+{
+	GIT_UNUSED(backend);
+
+	/* The entries never change once the backend has been opened */
+	*out = 0;
+	return 0;
+}
+
 static void config_memory_free(git_config_backend *_backend)
 {
 	config_memory_backend *backend = (config_memory_backend *)_backend;
@@ -217,6 +226,7 @@ int git_config_backend_from_string(git_config_backend **out, const char *cfg, si
 	backend->parent.unlock = config_memory_unlock;
 	backend->parent.snapshot = config_memory_snapshot;
 	backend->parent.free = config_memory_free;
+	backend->parent.generation = config_memory_generation;
 
 	*out = (git_config_backend *)backend;
 
@@ -9,6 +9,7 @@
 
 #include "common.h"
 #include "array.h"
+#include "fileops.h"
 #include "oid.h"
 #include "parse.h"
 
@@ -17,6 +18,11 @@ extern const char *git_config_escaped;
 
 typedef struct config_file {
 	git_oid checksum;
+	git_futils_filestamp stamp;
+	/* the stamp could miss a change; compare the checksum instead */
+	bool racy;
+	/* the file has conditional includes, so depends on the repository */
+	bool conditional;
 	char *path;
 	git_array_t(struct config_file) includes;
 } git_config_file;
@@ -834,6 +834,19 @@ static int maybe_modified(
 			modified_uncertain = true;
 		}
 
+		/* the file matches its index entry, so the filesystem monitor
+		 * can vouch for the entry until it reports a change of the file
+		 */
+		else if (index && index->fsmonitor_token &&
+			info->old_iter->type == GIT_ITERATOR_TYPE_INDEX &&
+			git_iterator_index(info->old_iter) == index &&
+			!(oitem->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID))
+		{
+			((git_index_entry *)oitem)->flags_extended |=
+				GIT_INDEX_ENTRY_FSMONITOR_VALID;
+			index->fsmonitor_changed = 1;
+		}
+
 	/* if mode is GITLINK and submodules are ignored, then skip */
 	} else if (S_ISGITLINK(nmode) &&
 			 DIFF_FLAG_IS_SET(diff, GIT_DIFF_IGNORE_SUBMODULES)) {
@@ -1374,6 +1387,7 @@ int git_diff_index_to_workdir(
 	const git_diff_options *opts)
 {
 	git_diff *diff = NULL;
+	unsigned int workdir_flags = GIT_ITERATOR_DONT_AUTOEXPAND;
 	int error = 0;
 
 	assert(out && repo);
@@ -1383,16 +1397,22 @@ int git_diff_index_to_workdir(
 	if (!index && (error = diff_load_index(&index, repo)) < 0)
 		return error;
 
+	/* the untracked cache does not know about ignored files */
+	if (!opts || !(opts->flags & GIT_DIFF_INCLUDE_IGNORED))
+		workdir_flags |= GIT_ITERATOR_UNTRACKED_CACHE;
+
 	DIFF_FROM_ITERATORS(
 		git_iterator_for_index(&a, repo, index, &a_opts),
 		GIT_ITERATOR_INCLUDE_CONFLICTS,
 
 		git_iterator_for_workdir(&b, repo, index, NULL, &b_opts),
-		GIT_ITERATOR_DONT_AUTOEXPAND
+		workdir_flags
 	);
 
 	if (!error && (diff->opts.flags & GIT_DIFF_UPDATE_INDEX) != 0 &&
-		((git_diff_generated *)diff)->index_updated)
+		(((git_diff_generated *)diff)->index_updated ||
+		 (index->untracked && index->untracked->dirty) ||
+		 index->fsmonitor_changed))
 		error = git_index_write(index);
 
 	if (!error)
@@ -310,7 +310,8 @@ int git_filebuf_open_withsize(git_filebuf *file, const char *path, int flags, mo
 	if (flags & GIT_FILEBUF_HASH_CONTENTS) {
 		file->compute_digest = 1;
 
-		if (git_hash_ctx_init(&file->digest) < 0)
+		/* we are hashing what we write ourselves */
+		if (git_hash_ctx_init_mode(&file->digest, GIT_HASH_MODE_FAST) < 0)
 			goto cleanup;
 	}
 
@@ -8,6 +8,9 @@
 #include "global.h"
 
 #include "alloc.h"
+#include "cache.h"
+#include "config_backend.h"
+#include "pack.h"
 #include "hash.h"
 #include "sysdir.h"
 #include "filter.h"
@@ -38,7 +41,10 @@ static git_global_init_fn git__init_callbacks[] = {
 	git_stream_registry_global_init,
 	git_openssl_stream_global_init,
 	git_mbedtls_stream_global_init,
-	git_mwindow_global_init
+	git_mwindow_global_init,
+	git_cache_global_init,
+	git_pack_cache_global_init,
+	git_config_diskfile_global_init
 };
 
 static git_global_shutdown_fn git__shutdown_callbacks[ARRAY_SIZE(git__init_callbacks)];
@@ -60,7 +66,8 @@ static void git__global_state_cleanup(git_global_st *st)
 	if (!st)
 		return;
 
-	git__free(st->error_t.message);
+	/* the message is the buffer, unless it was detached by a capture */
+	git_buf_dispose(&st->error_buf);
 	st->error_t.message = NULL;
 }
 
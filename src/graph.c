@@ -43,7 +43,7 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 		return 0;
 	}
 
-	if (git_pqueue_init(&list, 0, 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&list, 0, 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	if (git_commit_list_parse(walk, one) < 0)
@@ -87,8 +87,13 @@ static int mark_parents(git_revwalk *walk, git_commit_list_node *one,
 				goto on_error;
 		}
 
-		/* Keep track of root commits, to make sure the path gets marked */
-		if (commit->out_degree == 0) {
+		/*
+		 * Keep track of root commits, to make sure the path gets marked.
+		 * Commits with a generation number are popped only after all of
+		 * their descendants, so their marks are already final and there
+		 * is no need to keep walking on their behalf.
+		 */
+		if (commit->out_degree == 0 && !commit->generation) {
 			if (git_commit_list_insert(commit, &roots) == NULL)
 				goto on_error;
 		}
@@ -114,7 +119,7 @@ static int ahead_behind(git_commit_list_node *one, git_commit_list_node *two,
 	*ahead = 0;
 	*behind = 0;
 
-	if (git_pqueue_init(&pq, 0, 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&pq, 0, 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	if ((error = git_pqueue_insert(&pq, one)) < 0 ||
@@ -174,21 +179,51 @@ on_error:
 	return -1;
 }
 
-int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const git_oid *ancestor)
+static int descendant_of(
+	git_repository *repo,
+	const git_oid *commit,
+	const git_oid *ancestor,
+	size_t max_commits)
 {
-	git_oid merge_base;
+	git_revwalk *walk;
+	git_commit_list_node *commit_node, *ancestor_node;
 	int error;
 
 	if (git_oid_equal(commit, ancestor))
 		return 0;
 
-	error = git_merge_base(&merge_base, repo, commit, ancestor);
-	/* No merge-base found, it's not a descendant */
-	if (error == GIT_ENOTFOUND)
-		return 0;
-
-	if (error < 0)
+	if ((error = git_revwalk_new(&walk, repo)) < 0)
 		return error;
 
-	return git_oid_equal(&merge_base, ancestor);
+	if ((commit_node = git_revwalk__commit_lookup(walk, commit)) == NULL ||
+	    (ancestor_node = git_revwalk__commit_lookup(walk, ancestor)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	error = git_merge__is_ancestor(walk, commit_node, ancestor_node, max_commits);
+
+	/* a commit which does not exist is nobody's descendant */
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		error = 0;
+	}
+
+done:
+	git_revwalk_free(walk);
+	return error;
+}
+
+int git_graph_descendant_of(git_repository *repo, const git_oid *commit, const git_oid *ancestor)
+{
+	return descendant_of(repo, commit, ancestor, 0);
+}
+
+int git_graph_descendant_of_bounded(
+	git_repository *repo,
+	const git_oid *commit,
+	const git_oid *ancestor,
+	size_t max_commits)
+{
+	return descendant_of(repo, commit, ancestor, max_commits);
 }
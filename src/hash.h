@@ -14,10 +14,24 @@
 typedef struct git_hash_prov git_hash_prov;
 typedef struct git_hash_ctx git_hash_ctx;
 
+/*
+ * Whether a hash context only computes the hash, or also checks whether
+ * the data looks like half of a SHA-1 collision.  `git_hash_ctx_init`
+ * checks; the fast mode is only for data that libgit2 produced itself,
+ * such as the files it writes.  Only the Accelerated backend tells the
+ * modes apart; CollisionDetection always checks.
+ */
+typedef enum {
+	GIT_HASH_MODE_FAST = 0,
+	GIT_HASH_MODE_DETECT_COLLISIONS,
+} git_hash_mode_t;
+
 int git_hash_ctx_init(git_hash_ctx *ctx);
 void git_hash_ctx_cleanup(git_hash_ctx *ctx);
 
-#if defined(GIT_SHA1_COLLISIONDETECT)
+#if defined(GIT_SHA1_ACCELERATED)
+# include "hash/hash_accelerated.h"
+#elif defined(GIT_SHA1_COLLISIONDETECT)
 # include "hash/hash_collisiondetect.h"
 #elif defined(GIT_SHA1_COMMON_CRYPTO)
 # include "hash/hash_common_crypto.h"
@@ -31,6 +45,10 @@ void git_hash_ctx_cleanup(git_hash_ctx *ctx);
 # include "hash/hash_generic.h"
 #endif
 
+#ifndef GIT_SHA1_ACCELERATED
+# define git_hash_ctx_init_mode(ctx, mode) (GIT_UNUSED(mode), git_hash_ctx_init(ctx))
+#endif
+
 typedef struct {
 	void *data;
 	size_t len;
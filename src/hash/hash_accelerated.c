@@ -0,0 +1,448 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "hash_accelerated.h"
+
+#include "hash.h"
+
+/*
+ * SHA-1 using the instructions of the CPU when it has them: the SHA
+ * extensions on x86 and the cryptography extensions on ARMv8.  On x86
+ * whether the CPU has them is only known at runtime, so the block
+ * function is picked by git_hash_global_init().  The ARMv8 instructions
+ * are only compiled in when the library is built for a CPU that has
+ * them (`__ARM_FEATURE_CRYPTO`), and are then checked for again.
+ *
+ * Contexts detect collisions with sha1dc unless they ask for the fast
+ * mode, which only data that libgit2 produced itself should.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || \
+	 (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+# define HASH_SHANI 1
+# define HASH_SHANI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+# include <cpuid.h>
+# include <immintrin.h>
+#elif (defined(_M_X64) || defined(_M_IX86)) && defined(_MSC_VER) && _MSC_VER >= 1900
+# define HASH_SHANI 1
+# define HASH_SHANI_TARGET
+# include <intrin.h>
+# include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && \
+	(defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+# define HASH_ARMV8 1
+# include <arm_neon.h>
+# if defined(__linux__)
+#  include <sys/auxv.h>
+#  include <asm/hwcap.h>
+# endif
+#endif
+
+typedef void (*hash_block_fn)(uint32_t H[5], const unsigned char *data, size_t blocks);
+
+#define get_be32(p) \
+	(((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | \
+	 ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+
+#define put_be32(p, v) do { \
+	(p)[0] = (unsigned char)((v) >> 24); \
+	(p)[1] = (unsigned char)((v) >> 16); \
+	(p)[2] = (unsigned char)((v) >> 8); \
+	(p)[3] = (unsigned char)(v); } while (0)
+
+#define ROL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+/*
+ * The portable implementation keeps a rolling window of 16 words of
+ * the message schedule instead of expanding all 80 up front.
+ */
+#define W(t) W[(t) & 15]
+
+#define SCHEDULE(t) \
+	(W(t) = ROL(W((t) + 13) ^ W((t) + 8) ^ W((t) + 2) ^ W(t), 1))
+
+#define ROUND(a, b, c, d, e, f, k, w) do { \
+	e += ROL(a, 5) + (f) + (k) + (w); \
+	b = ROL(b, 30); } while (0)
+
+#define F_00_19(b, c, d) ((((c) ^ (d)) & (b)) ^ (d))
+#define F_20_39(b, c, d) ((b) ^ (c) ^ (d))
+#define F_40_59(b, c, d) (((b) & (c)) + ((d) & ((b) ^ (c))))
+#define F_60_79(b, c, d) F_20_39(b, c, d)
+
+#define R0(t, a, b, c, d, e) \
+	ROUND(a, b, c, d, e, F_00_19(b, c, d), 0x5a827999, W(t) = get_be32(data + (t) * 4))
+#define R1(t, a, b, c, d, e) \
+	ROUND(a, b, c, d, e, F_00_19(b, c, d), 0x5a827999, SCHEDULE(t))
+#define R2(t, a, b, c, d, e) \
+	ROUND(a, b, c, d, e, F_20_39(b, c, d), 0x6ed9eba1, SCHEDULE(t))
+#define R3(t, a, b, c, d, e) \
+	ROUND(a, b, c, d, e, F_40_59(b, c, d), 0x8f1bbcdc, SCHEDULE(t))
+#define R4(t, a, b, c, d, e) \
+	ROUND(a, b, c, d, e, F_60_79(b, c, d), 0xca62c1d6, SCHEDULE(t))
+
+#define FIVE(R, t) \
+	R((t), A, B, C, D, E); R((t) + 1, E, A, B, C, D); \
+	R((t) + 2, D, E, A, B, C); R((t) + 3, C, D, E, A, B); \
+	R((t) + 4, B, C, D, E, A)
+
+static void hash_block_portable(uint32_t H[5], const unsigned char *data, size_t blocks)
+{
+	uint32_t A, B, C, D, E, W[16];
+
+	for (; blocks; blocks--, data += 64) {
+		A = H[0];
+		B = H[1];
+		C = H[2];
+		D = H[3];
+		E = H[4];
+
+		FIVE(R0, 0); FIVE(R0, 5); FIVE(R0, 10);
+		R0(15, A, B, C, D, E); R1(16, E, A, B, C, D);
+		R1(17, D, E, A, B, C); R1(18, C, D, E, A, B);
+		R1(19, B, C, D, E, A);
+
+		FIVE(R2, 20); FIVE(R2, 25); FIVE(R2, 30); FIVE(R2, 35);
+		FIVE(R3, 40); FIVE(R3, 45); FIVE(R3, 50); FIVE(R3, 55);
+		FIVE(R4, 60); FIVE(R4, 65); FIVE(R4, 70); FIVE(R4, 75);
+
+		H[0] += A;
+		H[1] += B;
+		H[2] += C;
+		H[3] += D;
+		H[4] += E;
+	}
+}
+
+#ifdef HASH_SHANI
+
+static bool cpu_has_shani(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	bool has_ssse3, has_sse41;
+
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+
+	__cpuid(info, 1);
+	ecx = (unsigned int)info[2];
+	has_ssse3 = !!(ecx & (1 << 9));
+	has_sse41 = !!(ecx & (1 << 19));
+
+	__cpuidex(info, 7, 0);
+	ebx = (unsigned int)info[1];
+	GIT_UNUSED(eax);
+	GIT_UNUSED(edx);
+#else
+	if (__get_cpuid_max(0, NULL) < 7 ||
+	    !__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+
+	has_ssse3 = !!(ecx & (1 << 9));
+	has_sse41 = !!(ecx & (1 << 19));
+
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+#endif
+
+	return has_ssse3 && has_sse41 && (ebx & (1 << 29));
+}
+
+/*
+ * Four rounds, which also move the message schedule along: `m0` has
+ * the words of these rounds, and the next ones are derived from it.
+ */
+#define SHANI_ROUNDS(e_cur, e_next, m0, m1, m2, m3, f) \
+	e_cur = _mm_sha1nexte_epu32(e_cur, m0); \
+	e_next = abcd; \
+	m1 = _mm_sha1msg2_epu32(m1, m0); \
+	abcd = _mm_sha1rnds4_epu32(abcd, e_cur, f); \
+	m3 = _mm_sha1msg1_epu32(m3, m0); \
+	m2 = _mm_xor_si128(m2, m0)
+
+HASH_SHANI_TARGET
+static void hash_block_shani(uint32_t H[5], const unsigned char *data, size_t blocks)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)H), 0x1b);
+	e0 = _mm_set_epi32((int)H[4], 0, 0, 0);
+
+	for (; blocks; blocks--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 0)), mask);
+		m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), mask);
+		m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), mask);
+		m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), mask);
+
+		/* rounds 0-15 start the message schedule */
+		e0 = _mm_add_epi32(e0, m0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+		e1 = _mm_sha1nexte_epu32(e1, m1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m0 = _mm_sha1msg1_epu32(m0, m1);
+
+		e0 = _mm_sha1nexte_epu32(e0, m2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		m1 = _mm_sha1msg1_epu32(m1, m2);
+		m0 = _mm_xor_si128(m0, m2);
+
+		e1 = _mm_sha1nexte_epu32(e1, m3);
+		e0 = abcd;
+		m0 = _mm_sha1msg2_epu32(m0, m3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		m2 = _mm_sha1msg1_epu32(m2, m3);
+		m1 = _mm_xor_si128(m1, m3);
+
+		/* rounds 16-79; the schedule runs past the end harmlessly */
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 0);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 1);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 1);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 1);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 1);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 2);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 2);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 2);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 2);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+		SHANI_ROUNDS(e0, e1, m0, m1, m2, m3, 3);
+		SHANI_ROUNDS(e1, e0, m1, m2, m3, m0, 3);
+		SHANI_ROUNDS(e0, e1, m2, m3, m0, m1, 3);
+		SHANI_ROUNDS(e1, e0, m3, m0, m1, m2, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+
+	_mm_storeu_si128((__m128i *)H, _mm_shuffle_epi32(abcd, 0x1b));
+	H[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+#endif
+
+#ifdef HASH_ARMV8
+
+static bool cpu_has_armv8_sha1(void)
+{
+#if defined(__linux__) && defined(HWCAP_SHA1)
+	return !!(getauxval(AT_HWCAP) & HWCAP_SHA1);
+#else
+	/* we were built for a CPU that has them */
+	return true;
+#endif
+}
+
+/*
+ * Four rounds with the function `op`, which also move the message
+ * schedule along and add the constant `k` to the words of the rounds
+ * after the next ones.
+ */
+#define ARMV8_ROUNDS(e_cur, e_next, tmp, m0, m1, m2, m3, op, k) \
+	e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0)); \
+	abcd = op(abcd, e_cur, tmp); \
+	tmp = vaddq_u32(m2, vdupq_n_u32(k)); \
+	m3 = vsha1su1q_u32(m3, m2); \
+	m0 = vsha1su0q_u32(m0, m1, m2)
+
+static void hash_block_armv8(uint32_t H[5], const unsigned char *data, size_t blocks)
+{
+	uint32x4_t abcd, abcd_save, t0, t1, m0, m1, m2, m3;
+	uint32_t e0, e0_save, e1;
+
+	abcd = vld1q_u32(H);
+	e0 = H[4];
+
+	for (; blocks; blocks--, data += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		m0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+		m1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+		m2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+		m3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+		t0 = vaddq_u32(m0, vdupq_n_u32(0x5a827999));
+		t1 = vaddq_u32(m1, vdupq_n_u32(0x5a827999));
+
+		/* rounds 0-3 have no schedule to finish yet */
+		e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+		abcd = vsha1cq_u32(abcd, e0, t0);
+		t0 = vaddq_u32(m2, vdupq_n_u32(0x5a827999));
+		m0 = vsha1su0q_u32(m0, m1, m2);
+
+		/* rounds 4-79; the schedule runs past the end harmlessly */
+		ARMV8_ROUNDS(e1, e0, t1, m1, m2, m3, m0, vsha1cq_u32, 0x5a827999);
+		ARMV8_ROUNDS(e0, e1, t0, m2, m3, m0, m1, vsha1cq_u32, 0x5a827999);
+		ARMV8_ROUNDS(e1, e0, t1, m3, m0, m1, m2, vsha1cq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS(e0, e1, t0, m0, m1, m2, m3, vsha1cq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS(e1, e0, t1, m1, m2, m3, m0, vsha1pq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS(e0, e1, t0, m2, m3, m0, m1, vsha1pq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS(e1, e0, t1, m3, m0, m1, m2, vsha1pq_u32, 0x6ed9eba1);
+		ARMV8_ROUNDS(e0, e1, t0, m0, m1, m2, m3, vsha1pq_u32, 0x8f1bbcdc);
+		ARMV8_ROUNDS(e1, e0, t1, m1, m2, m3, m0, vsha1pq_u32, 0x8f1bbcdc);
+		ARMV8_ROUNDS(e0, e1, t0, m2, m3, m0, m1, vsha1mq_u32, 0x8f1bbcdc);
+		ARMV8_ROUNDS(e1, e0, t1, m3, m0, m1, m2, vsha1mq_u32, 0x8f1bbcdc);
+		ARMV8_ROUNDS(e0, e1, t0, m0, m1, m2, m3, vsha1mq_u32, 0x8f1bbcdc);
+		ARMV8_ROUNDS(e1, e0, t1, m1, m2, m3, m0, vsha1mq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS(e0, e1, t0, m2, m3, m0, m1, vsha1mq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS(e1, e0, t1, m3, m0, m1, m2, vsha1pq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS(e0, e1, t0, m0, m1, m2, m3, vsha1pq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS(e1, e0, t1, m1, m2, m3, m0, vsha1pq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS(e0, e1, t0, m2, m3, m0, m1, vsha1pq_u32, 0xca62c1d6);
+		ARMV8_ROUNDS(e1, e0, t1, m3, m0, m1, m2, vsha1pq_u32, 0xca62c1d6);
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		e0 += e0_save;
+	}
+
+	vst1q_u32(H, abcd);
+	H[4] = e0;
+}
+
+#endif
+
+static hash_block_fn hash_block = hash_block_portable;
+
+static hash_block_fn hash_block_detect(void)
+{
+#ifdef HASH_SHANI
+	if (cpu_has_shani())
+		return hash_block_shani;
+#endif
+#ifdef HASH_ARMV8
+	if (cpu_has_armv8_sha1())
+		return hash_block_armv8;
+#endif
+	return hash_block_portable;
+}
+
+int git_hash_global_init(void)
+{
+	hash_block = hash_block_detect();
+	return 0;
+}
+
+bool git_hash__set_accelerated(bool enabled)
+{
+	hash_block = enabled ? hash_block_detect() : hash_block_portable;
+	return (hash_block != hash_block_portable);
+}
+
+int git_hash_ctx_init_mode(git_hash_ctx *ctx, git_hash_mode_t mode)
+{
+	assert(ctx);
+	ctx->mode = mode;
+	return git_hash_init(ctx);
+}
+
+int git_hash_init(git_hash_ctx *ctx)
+{
+	assert(ctx);
+
+	if (ctx->mode == GIT_HASH_MODE_DETECT_COLLISIONS) {
+		SHA1DCInit(&ctx->c.dc);
+		return 0;
+	}
+
+	ctx->c.fast.size = 0;
+	ctx->c.fast.H[0] = 0x67452301;
+	ctx->c.fast.H[1] = 0xefcdab89;
+	ctx->c.fast.H[2] = 0x98badcfe;
+	ctx->c.fast.H[3] = 0x10325476;
+	ctx->c.fast.H[4] = 0xc3d2e1f0;
+
+	return 0;
+}
+
+int git_hash_update(git_hash_ctx *ctx, const void *data, size_t len)
+{
+	const unsigned char *in = data;
+	size_t used, blocks;
+
+	assert(ctx);
+
+	if (ctx->mode == GIT_HASH_MODE_DETECT_COLLISIONS) {
+		SHA1DCUpdate(&ctx->c.dc, data, len);
+		return 0;
+	}
+
+	used = (size_t)(ctx->c.fast.size & 63);
+	ctx->c.fast.size += len;
+
+	if (used) {
+		size_t left = 64 - used;
+
+		if (len < left) {
+			memcpy(ctx->c.fast.block + used, in, len);
+			return 0;
+		}
+
+		memcpy(ctx->c.fast.block + used, in, left);
+		hash_block(ctx->c.fast.H, ctx->c.fast.block, 1);
+		in += left;
+		len -= left;
+	}
+
+	if ((blocks = len / 64) > 0) {
+		hash_block(ctx->c.fast.H, in, blocks);
+		in += blocks * 64;
+		len -= blocks * 64;
+	}
+
+	if (len)
+		memcpy(ctx->c.fast.block, in, len);
+
+	return 0;
+}
+
+int git_hash_final(git_oid *out, git_hash_ctx *ctx)
+{
+	static const unsigned char pad[64] = { 0x80 };
+	unsigned char length[8];
+	uint64_t bits;
+	int i;
+
+	assert(ctx);
+
+	if (ctx->mode == GIT_HASH_MODE_DETECT_COLLISIONS) {
+		if (SHA1DCFinal(out->id, &ctx->c.dc)) {
+			git_error_set(GIT_ERROR_SHA1, "SHA1 collision attack detected");
+			return -1;
+		}
+
+		return 0;
+	}
+
+	/* Pad with a binary 1 (ie 0x80), then zeroes, then length */
+	bits = ctx->c.fast.size << 3;
+	put_be32(length, (uint32_t)(bits >> 32));
+	put_be32(length + 4, (uint32_t)bits);
+
+	git_hash_update(ctx, pad, 1 + (63 & (55 - (size_t)(ctx->c.fast.size & 63))));
+	git_hash_update(ctx, length, 8);
+
+	for (i = 0; i < 5; i++)
+		put_be32(out->id + i * 4, ctx->c.fast.H[i]);
+
+	return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_hash_hash_accelerated_h__
+#define INCLUDE_hash_hash_accelerated_h__
+
+#include "common.h"
+
+#include "hash.h"
+#include "sha1dc/sha1.h"
+
+struct git_hash_ctx {
+	git_hash_mode_t mode;
+	union {
+		/* with GIT_HASH_MODE_DETECT_COLLISIONS */
+		SHA1_CTX dc;
+
+		/* with GIT_HASH_MODE_FAST */
+		struct {
+			uint64_t size;
+			uint32_t H[5];
+			unsigned char block[64];
+		} fast;
+	} c;
+};
+
+#define git_hash_ctx_init(ctx) git_hash_ctx_init_mode(ctx, GIT_HASH_MODE_DETECT_COLLISIONS)
+#define git_hash_ctx_cleanup(ctx)
+
+extern int git_hash_global_init(void);
+extern int git_hash_ctx_init_mode(git_hash_ctx *ctx, git_hash_mode_t mode);
+
+/*
+ * Use the SHA-1 instructions of the CPU when it has them, or only the
+ * portable implementation; this is only meant for the tests.  Returns
+ * whether instructions are used.
+ */
+extern bool git_hash__set_accelerated(bool enabled);
+
+#endif
@@ -17,6 +17,7 @@
 #define GIT_IGNORE_INTERNAL		"[internal]exclude"
 
 #define GIT_IGNORE_DEFAULT_RULES ".\n..\n.git\n"
+#define GIT_IGNORE_DEFAULT_RULES_COUNT 3
 
 /**
  * A negative ignore pattern can negate a positive one without
@@ -362,6 +363,12 @@ cleanup:
 	return error;
 }
 
+bool git_ignore__has_internal_rules(git_ignores *ign)
+{
+	return ign->ign_internal &&
+		ign->ign_internal->rules.length > GIT_IGNORE_DEFAULT_RULES_COUNT;
+}
+
 int git_ignore__push_dir(git_ignores *ign, const char *dir)
 {
 	if (git_buf_joinpath(&ign->dir, ign->dir.ptr, dir) < 0)
@@ -38,6 +38,9 @@ typedef struct {
 extern int git_ignore__for_path(
 	git_repository *repo, const char *path, git_ignores *ign);
 
+/* Whether rules were added with `git_ignore_add_rule` */
+extern bool git_ignore__has_internal_rules(git_ignores *ign);
+
 extern int git_ignore__push_dir(git_ignores *ign, const char *dir);
 
 extern int git_ignore__pop_dir(git_ignores *ign);
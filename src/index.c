@@ -16,10 +16,14 @@
 #include "iterator.h"
 #include "pathspec.h"
 #include "ignore.h"
+#include "attrcache.h"
 #include "blob.h"
 #include "idxmap.h"
 #include "diff.h"
 #include "varint.h"
+#include "array.h"
+#include "bitmap.h"
+#include "config.h"
 
 #include "git2/odb.h"
 #include "git2/oid.h"
@@ -69,6 +73,20 @@ static const unsigned int INDEX_HEADER_SIG = 0x44495243;
 static const char INDEX_EXT_TREECACHE_SIG[] = {'T', 'R', 'E', 'E'};
 static const char INDEX_EXT_UNMERGED_SIG[] = {'R', 'E', 'U', 'C'};
 static const char INDEX_EXT_CONFLICT_NAME_SIG[] = {'N', 'A', 'M', 'E'};
+static const char INDEX_EXT_EOIE_SIG[] = {'E', 'O', 'I', 'E'};
+static const char INDEX_EXT_IEOT_SIG[] = {'I', 'E', 'O', 'T'};
+static const char INDEX_EXT_UNTRACKED_SIG[] = {'U', 'N', 'T', 'R'};
+static const char INDEX_EXT_FSMONITOR_SIG[] = {'F', 'S', 'M', 'N'};
+static const char INDEX_EXT_LINK_SIG[] = {'l', 'i', 'n', 'k'};
+
+#define INDEX_SHARED_PREFIX "sharedindex."
+
+/* offset of the first extension and hash of the extension headers */
+static const size_t INDEX_EOIE_SIZE = 4 + GIT_OID_RAWSZ;
+static const uint32_t INDEX_IEOT_VERSION = 1;
+
+/* an index smaller than this is hashed on the thread reading it */
+#define INDEX_THREADED_HASH_SIZE (1024 * 1024)
 
 #define INDEX_OWNER(idx) ((git_repository *)(GIT_REFCOUNT_OWNER(idx)))
 
@@ -123,12 +141,45 @@ struct entry_srch_key {
 	int stage;
 };
 
+/*
+ * The entries read from disk are allocated together, from the arena of
+ * the thread that decoded them.  An arena is freed along with the last
+ * of its entries.
+ */
+struct index_entry_arena {
+	git_pool pool;
+	size_t refcount;
+};
+
 struct entry_internal {
 	git_index_entry entry;
+	struct index_entry_arena *arena;
+	/* position + 1 in the shared index of an entry that is unchanged from it */
+	size_t shared_pos;
 	size_t pathlen;
 	char path[GIT_FLEX_ARRAY];
 };
 
+/* A block of the index entry offset table */
+struct index_entry_block {
+	uint32_t offset; /* of its first entry, from the start of the file */
+	uint32_t count;
+};
+
+typedef git_array_t(struct index_entry_block) index_entry_blocks;
+
+/* The extensions that are applied once all of the entries are read */
+struct index_read_extensions {
+	git_bitmap fsmonitor_dirty;
+
+	bool has_link;
+	git_oid shared_id;
+	git_bitmap shared_deleted;
+	git_bitmap shared_replaced;
+};
+
+#define INDEX_READ_EXTENSIONS_INIT { GIT_BITMAP_INIT, false, {{0}}, GIT_BITMAP_INIT, GIT_BITMAP_INIT }
+
 struct reuc_entry_internal {
 	git_index_reuc_entry entry;
 	size_t pathlen;
@@ -136,12 +187,15 @@ struct reuc_entry_internal {
 };
 
 bool git_index__enforce_unsaved_safety = false;
+size_t git_index__offset_table_block_size = 10000;
+unsigned int git_index__read_threads = 0;
 
 /* local declarations */
-static int read_extension(size_t *read_len, git_index *index, const char *buffer, size_t buffer_size);
+static int read_extension(size_t *read_len, git_index *index, index_entry_blocks *blocks, struct index_read_extensions *ext, const char *buffer, size_t buffer_size);
 static int read_header(struct index_header *dest, const void *buffer);
 
 static int parse_index(git_index *index, const char *buffer, size_t buffer_size);
+static int index_error_invalid(const char *message);
 static bool is_index_extended(git_index *index);
 static int write_index(git_oid *checksum, git_index *index, git_filebuf *file);
 
@@ -321,13 +375,26 @@ static void index_entry_reuc_free(git_index_reuc_entry *reuc)
 	git__free(reuc);
 }
 
+static void index_entry_arena_free(struct index_entry_arena *arena)
+{
+	if (!arena || --arena->refcount > 0)
+		return;
+
+	git_pool_clear(&arena->pool);
+	git__free(arena);
+}
+
 static void index_entry_free(git_index_entry *entry)
 {
 	if (!entry)
 		return;
 
 	memset(&entry->id, 0, sizeof(entry->id));
-	git__free(entry);
+
+	if (((struct entry_internal *)entry)->arena)
+		index_entry_arena_free(((struct entry_internal *)entry)->arena);
+	else
+		git__free(entry);
 }
 
 unsigned int git_index__create_mode(unsigned int mode)
@@ -507,6 +574,7 @@ static int index_remove_entry(git_index *index, size_t pos)
 
 	if (entry != NULL) {
 		git_tree_cache_invalidate_path(index->tree, entry->path);
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		DELETE_IN_MAP(index, entry);
 	}
 
@@ -535,6 +603,12 @@ int git_index_clear(git_index *index)
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
 
+	git_untracked_cache_free(index->untracked);
+	index->untracked = NULL;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = NULL;
+
 	git_idxmap_clear(index->entries_map);
 	while (!error && index->entries.length > 0)
 		error = index_remove_entry(index, index->entries.length - 1);
@@ -629,10 +703,42 @@ static int compare_checksum(git_index *index)
 	return !!git_oid_cmp(&checksum, &index->checksum);
 }
 
+/*
+ * Map the index file; the entries are copied out of the map as they are
+ * read, so it is only kept while parsing.
+ */
+static int index_map(git_map *out, const char *path)
+{
+	git_file fd;
+	git_off_t size;
+	int error;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if ((size = git_futils_filesize(fd)) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	if (!git__is_sizet(size) ||
+	    (size_t)size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE) {
+		error = index_error_invalid("insufficient buffer space");
+		goto done;
+	}
+
+	if ((error = git_futils_mmap_ro(out, fd, 0, (size_t)size)) == 0)
+		p_madvise(out, GIT_MADV_SEQUENTIAL);
+
+done:
+	p_close(fd);
+	return error;
+}
+
 int git_index_read(git_index *index, int force)
 {
 	int error = 0, updated;
-	git_buf buffer = GIT_BUF_INIT;
+	git_map map;
 	git_futils_filestamp stamp = index->stamp;
 
 	if (!index->index_file_path)
@@ -661,8 +767,7 @@ int git_index_read(git_index *index, int force)
 	if (!updated && !force)
 		return 0;
 
-	error = git_futils_readbuffer(&buffer, index->index_file_path);
-	if (error < 0)
+	if ((error = index_map(&map, index->index_file_path)) < 0)
 		return error;
 
 	index->tree = NULL;
@@ -671,14 +776,14 @@ int git_index_read(git_index *index, int force)
 	error = git_index_clear(index);
 
 	if (!error)
-		error = parse_index(index, buffer.ptr, buffer.size);
+		error = parse_index(index, map.data, map.len);
 
 	if (!error) {
 		git_futils_filestamp_set(&index->stamp, &stamp);
 		index->dirty = 0;
 	}
 
-	git_buf_dispose(&buffer);
+	git_futils_mmap_free(&map);
 	return error;
 }
 
@@ -703,6 +808,177 @@ int git_index__changed_relative_to(
 	return !!git_oid_cmp(&index->checksum, checksum);
 }
 
+int git_index__untracked_cache(git_untracked_cache **out, git_index *index)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_buf ident = GIT_BUF_INIT, info_exclude = GIT_BUF_INIT;
+	int setting, error;
+
+	*out = NULL;
+
+	if (!repo || git_repository_is_bare(repo))
+		return 0;
+
+	if ((error = git_repository__cvar(&setting, repo, GIT_CVAR_UNTRACKEDCACHE)) < 0)
+		return error;
+
+	if (setting == GIT_UNTRACKEDCACHE_FALSE) {
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+		return 0;
+	}
+
+	if (setting == GIT_UNTRACKEDCACHE_KEEP && !index->untracked)
+		return 0;
+
+	if ((error = git_untracked_cache_ident(&ident, git_repository_workdir(repo))) < 0)
+		goto done;
+
+	/*
+	 * a cache of another working directory is of no use here, and
+	 * neither is one that does not list the untracked directories.
+	 */
+	if (index->untracked &&
+	    (index->untracked->ident.size != ident.size + 1 ||
+	     memcmp(index->untracked->ident.ptr, ident.ptr, ident.size) != 0 ||
+	     (index->untracked->dir_flags != GIT_UNTRACKED_CACHE_DIR_FLAGS &&
+	      index->untracked->dir_flags != GIT_UNTRACKED_CACHE_DIR_FLAGS_HIDE_EMPTY))) {
+		if (setting == GIT_UNTRACKEDCACHE_KEEP)
+			goto done;
+
+		git_untracked_cache_free(index->untracked);
+		index->untracked = NULL;
+	}
+
+	if (!index->untracked &&
+	    (error = git_untracked_cache_new(&index->untracked, ident.ptr)) < 0)
+		goto done;
+
+	if ((error = git_attr_cache__init(repo)) < 0 ||
+	    (error = git_repository_item_path(&info_exclude, repo, GIT_REPOSITORY_ITEM_INFO)) < 0 ||
+	    (error = git_buf_joinpath(&info_exclude, info_exclude.ptr, GIT_IGNORE_FILE_INREPO)) < 0 ||
+	    (error = git_untracked_cache_check_excludes(index->untracked, info_exclude.ptr,
+			git_repository_attr_cache(repo)->cfg_excl_file)) < 0)
+		goto done;
+
+	*out = index->untracked;
+
+done:
+	git_buf_dispose(&ident);
+	git_buf_dispose(&info_exclude);
+	return error;
+}
+
+static void fsmonitor_invalidate_all(git_index *index)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&index->entries, i, entry)
+		entry->flags_extended &= ~GIT_INDEX_ENTRY_FSMONITOR_VALID;
+}
+
+static void fsmonitor_invalidate_path(
+	git_index *index, const char *path, size_t path_len)
+{
+	int (*strncomp)(const char *a, const char *b, size_t sz);
+	bool is_dir = (path[path_len - 1] == '/');
+	git_index_entry *entry;
+	size_t pos;
+
+	strncomp = index->ignore_case ? git__strncasecmp : git__strncmp;
+
+	index_find(&pos, index, path, path_len, 0);
+
+	/* the entries of the path itself, or of the directory at the path */
+	for (; pos < index->entries.length; pos++) {
+		entry = git_vector_get(&index->entries, pos);
+
+		if (strncomp(entry->path, path, path_len) != 0)
+			break;
+
+		if (is_dir || entry->path[path_len] == '\0' ||
+		    entry->path[path_len] == '/')
+			entry->flags_extended &= ~GIT_INDEX_ENTRY_FSMONITOR_VALID;
+	}
+}
+
+int git_index__fsmonitor_refresh(bool *valid, git_index *index)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	git_fsmonitor *fsmonitor;
+	git_buf response = GIT_BUF_INIT;
+	const char *path, *end;
+	size_t token_len, path_len;
+	char *token = NULL;
+	int error;
+
+	*valid = false;
+
+	if (!repo || (fsmonitor = repo->fsmonitor) == NULL)
+		return 0;
+
+	error = fsmonitor->query(&response, fsmonitor, index->fsmonitor_token);
+
+	/* the monitor cannot tell what changed, look at everything */
+	if (error == GIT_PASSTHROUGH) {
+		fsmonitor_invalidate_all(index);
+		error = 0;
+		goto done;
+	} else if (error < 0) {
+		git_error_set_after_callback_function(error, "git_fsmonitor query");
+		goto done;
+	}
+
+	if ((token_len = strlen(response.ptr)) == 0) {
+		git_error_set(GIT_ERROR_INDEX, "filesystem monitor did not give a token");
+		error = -1;
+		goto done;
+	}
+
+	if ((token = git__strndup(response.ptr, token_len)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	/* without a token, we cannot know what changed before it */
+	if (!index->fsmonitor_token) {
+		fsmonitor_invalidate_all(index);
+	} else {
+		end = response.ptr + response.size;
+
+		for (path = response.ptr + token_len + 1; path < end; path += path_len + 1) {
+			if ((path_len = strlen(path)) == 0)
+				continue;
+
+			if (path_len == 1 && path[0] == '/') {
+				fsmonitor_invalidate_all(index);
+				break;
+			}
+
+			fsmonitor_invalidate_path(index, path, path_len);
+		}
+	}
+
+	*valid = true;
+
+done:
+	if (!index->fsmonitor_token || !token ||
+	    strcmp(index->fsmonitor_token, token) != 0)
+		index->fsmonitor_changed = 1;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = error < 0 ? NULL : token;
+
+	if (error < 0) {
+		git__free(token);
+		fsmonitor_invalidate_all(index);
+	}
+
+	git_buf_dispose(&response);
+	return error;
+}
+
 static bool is_racy_entry(git_index *index, const git_index_entry *entry)
 {
 	/* Git special-cases submodules in the check */
@@ -758,6 +1034,8 @@ static int truncate_racily_clean(git_index *index)
 		 */
 		if (entry) {
 			entry->file_size = 0;
+			entry->flags_extended &= ~GIT_INDEX_ENTRY_FSMONITOR_VALID;
+			((struct entry_internal *)entry)->shared_pos = 0;
 			index->dirty = 1;
 		}
 	}
@@ -1060,6 +1338,24 @@ static void index_entry_cpy(
 	tgt->path = tgt_path;
 }
 
+static bool index_entry_differs_on_disk(
+	const git_index_entry *a,
+	const git_index_entry *b)
+{
+	return (a->ctime.seconds != b->ctime.seconds ||
+		a->ctime.nanoseconds != b->ctime.nanoseconds ||
+		a->mtime.seconds != b->mtime.seconds ||
+		a->mtime.nanoseconds != b->mtime.nanoseconds ||
+		a->dev != b->dev || a->ino != b->ino ||
+		a->mode != b->mode || a->uid != b->uid || a->gid != b->gid ||
+		a->file_size != b->file_size ||
+		!git_oid_equal(&a->id, &b->id) ||
+		(a->flags & ~GIT_INDEX_ENTRY_EXTENDED) !=
+			(b->flags & ~GIT_INDEX_ENTRY_EXTENDED) ||
+		(a->flags_extended & GIT_INDEX_ENTRY_EXTENDED_FLAGS) !=
+			(b->flags_extended & GIT_INDEX_ENTRY_EXTENDED_FLAGS));
+}
+
 static int index_entry_dup(
 	git_index_entry **out,
 	git_index *index,
@@ -1069,6 +1365,9 @@ static int index_entry_dup(
 		return -1;
 
 	index_entry_cpy(*out, src);
+
+	/* the filesystem monitor knows nothing about the new entry */
+	(*out)->flags_extended &= ~GIT_INDEX_ENTRY_FSMONITOR_VALID;
 	return 0;
 }
 
@@ -1346,6 +1645,7 @@ static int index_insert(
 
 	/* This entry is now up-to-date and should not be checked for raciness */
 	entry->flags_extended |= GIT_INDEX_ENTRY_UPTODATE;
+	entry->flags_extended &= ~GIT_INDEX_ENTRY_FSMONITOR_VALID;
 
 	git_vector_sort(&index->entries);
 
@@ -1385,6 +1685,11 @@ static int index_insert(
 	 */
 	if (existing) {
 		if (replace) {
+			/* a changed entry is no longer the shared one */
+			if (index_entry_differs_on_disk(existing, entry) ||
+			    (trust_path && strcmp(existing->path, entry->path)))
+				((struct entry_internal *)existing)->shared_pos = 0;
+
 			index_entry_cpy(existing, entry);
 
 			if (trust_path)
@@ -1403,6 +1708,8 @@ static int index_insert(
 			goto out;
 
 		INSERT_IN_MAP(index, entry, error);
+
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 	}
 
 	index->dirty = 1;
@@ -1640,6 +1947,7 @@ int git_index__fill(git_index *index, const git_vector *source_entries)
 		if (ret < 0)
 			break;
 
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		index->dirty = 1;
 	}
 
@@ -2402,20 +2710,42 @@ static size_t index_entry_size(size_t path_len, size_t varint_len, uint32_t flag
 	}
 }
 
+static int index_entry_arena_new(struct index_entry_arena **out)
+{
+	struct index_entry_arena *arena;
+
+	arena = git__calloc(1, sizeof(struct index_entry_arena));
+	GIT_ERROR_CHECK_ALLOC(arena);
+
+	git_pool_init(&arena->pool, 1);
+
+	/* the reader holds a reference until it is done reading entries */
+	arena->refcount = 1;
+
+	*out = arena;
+	return 0;
+}
+
+/*
+ * Read an entry into `arena`.  In index v4, `last` is the path of the
+ * previous entry, or NULL at the start of a block of entries, where
+ * the path is written in full.
+ */
 static int read_entry(
 	git_index_entry **out,
 	size_t *out_size,
 	git_index *index,
+	struct index_entry_arena *arena,
 	const void *buffer,
 	size_t buffer_size,
 	const char *last)
 {
-	size_t path_length, entry_size;
-	const char *path_ptr;
+	size_t entry_size, alloclen, varint_len = 0, prefix_len = 0, suffix_len;
+	const char *path_ptr, *path_end;
 	struct entry_short source;
-	git_index_entry entry = {{0}};
+	struct entry_internal *entry;
+	git_index_entry src = {{0}};
 	bool compressed = index->version >= INDEX_VERSION_NUMBER_COMP;
-	char *tmp_path = NULL;
 
 	if (INDEX_FOOTER_SIZE + minimal_entry_size > buffer_size)
 		return -1;
@@ -2423,20 +2753,20 @@ static int read_entry(
 	/* buffer is not guaranteed to be aligned */
 	memcpy(&source, buffer, sizeof(struct entry_short));
 
-	entry.ctime.seconds = (git_time_t)ntohl(source.ctime.seconds);
-	entry.ctime.nanoseconds = ntohl(source.ctime.nanoseconds);
-	entry.mtime.seconds = (git_time_t)ntohl(source.mtime.seconds);
-	entry.mtime.nanoseconds = ntohl(source.mtime.nanoseconds);
-	entry.dev = ntohl(source.dev);
-	entry.ino = ntohl(source.ino);
-	entry.mode = ntohl(source.mode);
-	entry.uid = ntohl(source.uid);
-	entry.gid = ntohl(source.gid);
-	entry.file_size = ntohl(source.file_size);
-	git_oid_cpy(&entry.id, &source.oid);
-	entry.flags = ntohs(source.flags);
-
-	if (entry.flags & GIT_INDEX_ENTRY_EXTENDED) {
+	src.ctime.seconds = (git_time_t)ntohl(source.ctime.seconds);
+	src.ctime.nanoseconds = ntohl(source.ctime.nanoseconds);
+	src.mtime.seconds = (git_time_t)ntohl(source.mtime.seconds);
+	src.mtime.nanoseconds = ntohl(source.mtime.nanoseconds);
+	src.dev = ntohl(source.dev);
+	src.ino = ntohl(source.ino);
+	src.mode = ntohl(source.mode);
+	src.uid = ntohl(source.uid);
+	src.gid = ntohl(source.gid);
+	src.file_size = ntohl(source.file_size);
+	git_oid_cpy(&src.id, &source.oid);
+	src.flags = ntohs(source.flags);
+
+	if (src.flags & GIT_INDEX_ENTRY_EXTENDED) {
 		uint16_t flags_raw;
 		size_t flags_offset;
 
@@ -2445,54 +2775,49 @@ static int read_entry(
 			sizeof(flags_raw));
 		flags_raw = ntohs(flags_raw);
 
-		memcpy(&entry.flags_extended, &flags_raw, sizeof(flags_raw));
+		memcpy(&src.flags_extended, &flags_raw, sizeof(flags_raw));
 		path_ptr = (const char *) buffer + offsetof(struct entry_long, path);
 	} else
 		path_ptr = (const char *) buffer + offsetof(struct entry_short, path);
 
-	if (!compressed) {
-		path_length = entry.flags & GIT_INDEX_ENTRY_NAMEMASK;
-
-		/* if this is a very long string, we must find its
-		 * real length without overflowing */
-		if (path_length == 0xFFF) {
-			const char *path_end;
-
-			path_end = memchr(path_ptr, '\0', buffer_size);
-			if (path_end == NULL)
-				return -1;
-
-			path_length = path_end - path_ptr;
-		}
-
-		entry_size = index_entry_size(path_length, 0, entry.flags);
-		entry.path = (char *)path_ptr;
-	} else {
-		size_t varint_len, last_len, prefix_len, suffix_len, path_len;
+	if (compressed) {
 		uintmax_t strip_len;
 
 		strip_len = git_decode_varint((const unsigned char *)path_ptr, &varint_len);
-		last_len = strlen(last);
 
-		if (varint_len == 0 || last_len < strip_len)
+		if (varint_len == 0)
 			return index_error_invalid("incorrect prefix length");
 
-		prefix_len = last_len - (size_t)strip_len;
-		suffix_len = strlen(path_ptr + varint_len);
+		if (last) {
+			size_t last_len = strlen(last);
+
+			if (last_len < strip_len)
+				return index_error_invalid("incorrect prefix length");
 
-		GIT_ERROR_CHECK_ALLOC_ADD(&path_len, prefix_len, suffix_len);
-		GIT_ERROR_CHECK_ALLOC_ADD(&path_len, path_len, 1);
+			prefix_len = last_len - (size_t)strip_len;
+		}
+	}
+
+	/* the buffer may be mapped, so never look for the end of the
+	 * path outside of it */
+	path_end = memchr(path_ptr + varint_len, '\0',
+		buffer_size - (path_ptr + varint_len - (const char *)buffer));
+	if (path_end == NULL)
+		return -1;
 
-		if (path_len > GIT_PATH_MAX)
-			return index_error_invalid("unreasonable path length");
+	suffix_len = path_end - (path_ptr + varint_len);
 
-		tmp_path = git__malloc(path_len);
-		GIT_ERROR_CHECK_ALLOC(tmp_path);
+	if (!compressed) {
+		size_t path_length = src.flags & GIT_INDEX_ENTRY_NAMEMASK;
+
+		/* if this is a very long string, we must find its
+		 * real length without overflowing */
+		if (path_length == 0xFFF)
+			path_length = suffix_len;
 
-		memcpy(tmp_path, last, prefix_len);
-		memcpy(tmp_path + prefix_len, path_ptr + varint_len, suffix_len + 1);
-		entry_size = index_entry_size(suffix_len, varint_len, entry.flags);
-		entry.path = tmp_path;
+		entry_size = index_entry_size(path_length, 0, src.flags);
+	} else {
+		entry_size = index_entry_size(suffix_len, varint_len, src.flags);
 	}
 
 	if (entry_size == 0)
@@ -2501,174 +2826,973 @@ static int read_entry(
 	if (INDEX_FOOTER_SIZE + entry_size > buffer_size)
 		return -1;
 
-	if (index_entry_dup(out, index, &entry) < 0) {
-		git__free(tmp_path);
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, prefix_len, suffix_len);
+
+	if (alloclen > GIT_PATH_MAX)
+		return index_error_invalid("unreasonable path length");
+
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, alloclen, sizeof(struct entry_internal) + 1);
+
+	entry = git_pool_malloc(&arena->pool, (uint32_t)alloclen);
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	if (prefix_len)
+		memcpy(entry->path, last, prefix_len);
+	memcpy(entry->path + prefix_len, path_ptr + varint_len, suffix_len);
+	entry->path[prefix_len + suffix_len] = '\0';
+
+	/* the entries of a split index that replace shared ones have no
+	 * path, which is checked when merging them */
+	if (entry->path[0] != '\0' &&
+	    !git_path_isvalid(INDEX_OWNER(index), entry->path, 0, GIT_PATH_REJECT_INDEX_DEFAULTS)) {
+		git_error_set(GIT_ERROR_INDEX, "invalid path: '%s'", entry->path);
 		return -1;
 	}
 
-	git__free(tmp_path);
+	entry->entry = src;
+	entry->entry.path = entry->path;
+	entry->pathlen = prefix_len + suffix_len;
+	entry->shared_pos = 0;
+	entry->arena = arena;
+	arena->refcount++;
+
+	*out = (git_index_entry *)entry;
 	*out_size = entry_size;
 	return 0;
 }
 
-static int read_header(struct index_header *dest, const void *buffer)
+/* Read `count` entries, the first one starting a block in index v4 */
+static int read_entries(
+	size_t *read_len,
+	git_index_entry **out,
+	size_t count,
+	git_index *index,
+	struct index_entry_arena *arena,
+	const char *buffer,
+	size_t buffer_size)
 {
-	const struct index_header *source = buffer;
+	const char *last = NULL;
+	size_t i, entry_size, offset = 0;
 
-	dest->signature = ntohl(source->signature);
-	if (dest->signature != INDEX_HEADER_SIG)
-		return index_error_invalid("incorrect header signature");
+	for (i = 0; i < count; i++) {
+		if (buffer_size - offset <= INDEX_FOOTER_SIZE)
+			return index_error_invalid("header entries changed while parsing");
 
-	dest->version = ntohl(source->version);
-	if (dest->version < INDEX_VERSION_NUMBER_LB ||
-		dest->version > INDEX_VERSION_NUMBER_UB)
-		return index_error_invalid("incorrect header version");
+		if (read_entry(&out[i], &entry_size, index, arena,
+				buffer + offset, buffer_size - offset, last) < 0)
+			return index_error_invalid("invalid entry");
 
-	dest->entry_count = ntohl(source->entry_count);
+		last = out[i]->path;
+		offset += entry_size;
+	}
+
+	*read_len = offset;
 	return 0;
 }
 
-static int read_extension(size_t *read_len, git_index *index, const char *buffer, size_t buffer_size)
+/* Move entries read into the vector's free space into the index */
+static int index_take_read_entries(git_index *index, size_t count)
 {
-	struct index_extension dest;
-	size_t total_size;
-
-	/* buffer is not guaranteed to be aligned */
-	memcpy(&dest, buffer, sizeof(struct index_extension));
-	dest.extension_size = ntohl(dest.extension_size);
+	git_index_entry *entry;
+	int error = 0;
 
-	total_size = dest.extension_size + sizeof(struct index_extension);
+	while (count--) {
+		entry = index->entries.contents[index->entries.length];
 
-	if (dest.extension_size > total_size ||
-		buffer_size < total_size ||
-		buffer_size - total_size < INDEX_FOOTER_SIZE) {
-		index_error_invalid("extension is truncated");
-		return -1;
-	}
+		INSERT_IN_MAP(index, entry, error);
+		if (error < 0)
+			return error;
 
-	/* optional extension */
-	if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
-		/* tree cache */
-		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
-			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size, &index->tree_pool) < 0)
-				return -1;
-		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
-			if (read_reuc(index, buffer + 8, dest.extension_size) < 0)
-				return -1;
-		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
-			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
-				return -1;
-		}
-		/* else, unsupported extension. We cannot parse this, but we can skip
-		 * it by returning `total_size */
-	} else {
-		/* we cannot handle non-ignorable extensions;
-		 * in fact they aren't even defined in the standard */
-		git_error_set(GIT_ERROR_INDEX, "unsupported mandatory extension: '%.4s'", dest.signature);
-		return -1;
+		index->entries.length++;
 	}
 
-	*read_len = total_size;
-
 	return 0;
 }
 
-static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+static void index_free_read_entries(git_index *index, size_t entry_count)
 {
-	int error = 0;
-	unsigned int i;
-	struct index_header header = { 0 };
-	git_oid checksum_calculated, checksum_expected;
-	const char *last = NULL;
-	const char *empty = "";
+	size_t i;
 
-#define seek_forward(_increase) { \
-	if (_increase >= buffer_size) { \
-		error = index_error_invalid("ran out of data while parsing"); \
-		goto done; } \
-	buffer += _increase; \
-	buffer_size -= _increase;\
+	for (i = index->entries.length; i < entry_count; i++) {
+		index_entry_free(index->entries.contents[i]);
+		index->entries.contents[i] = NULL;
+	}
 }
 
-	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
-		return index_error_invalid("insufficient buffer space");
-
-	/* Precalculate the SHA1 of the files's contents -- we'll match it to
-	 * the provided SHA1 in the footer */
-	git_hash_buf(&checksum_calculated, buffer, buffer_size - INDEX_FOOTER_SIZE);
+static int read_entries_serial(
+	size_t *read_len,
+	git_index *index,
+	const char *buffer,
+	size_t buffer_size,
+	size_t entry_count)
+{
+	struct index_entry_arena *arena;
+	int error;
 
-	/* Parse header */
-	if ((error = read_header(&header, buffer)) < 0)
+	if ((error = index_entry_arena_new(&arena)) < 0)
 		return error;
 
-	index->version = header.version;
-	if (index->version >= INDEX_VERSION_NUMBER_COMP)
-		last = empty;
+	if ((error = read_entries(read_len, (git_index_entry **)index->entries.contents,
+			entry_count, index, arena, buffer, buffer_size)) == 0)
+		error = index_take_read_entries(index, entry_count);
 
-	seek_forward(INDEX_HEADER_SIZE);
+	index_entry_arena_free(arena);
+	return error;
+}
 
-	assert(!index->entries.length);
+#ifdef GIT_THREADS
 
-	if (index->ignore_case &&
-	    (error = git_idxmap_icase_resize((git_idxmap_icase *) index->entries_map,
-					     header.entry_count)) < 0)
-		return error;
-	else if ((error = git_idxmap_resize(index->entries_map, header.entry_count)) < 0)
+struct index_read {
+	git_index *index;
+	const char *buffer;
+	size_t buffer_size;
+	size_t entries_end;
+	const struct index_entry_block *blocks;
+	size_t nr_blocks;
+
+	/* index of the first entry of each block */
+	size_t *first_entry;
+
+	/* for each block: 0 while it is read, 1 once read, -1 on error */
+	int *done;
+
+	git_mutex lock;
+	git_cond cond;
+	int error_class;
+	char *error_msg;
+};
+
+struct index_read_worker {
+	struct index_read *ctx;
+	git_thread thread;
+	bool started;
+	size_t first_block, last_block;
+	struct index_entry_arena *arena;
+};
+
+static void *index_read_worker(void *arg)
+{
+	struct index_read_worker *worker = arg;
+	struct index_read *ctx = worker->ctx;
+	const struct index_entry_block *block;
+	size_t i, end, read_len;
+	int error = 0;
+
+	for (i = worker->first_block; i < worker->last_block; i++) {
+		block = &ctx->blocks[i];
+		end = i + 1 < ctx->nr_blocks ?
+			ctx->blocks[i + 1].offset : ctx->entries_end;
+
+		if (!error &&
+		    (error = read_entries(&read_len,
+			(git_index_entry **)ctx->index->entries.contents + ctx->first_entry[i],
+			block->count, ctx->index, worker->arena,
+			ctx->buffer + block->offset,
+			ctx->buffer_size - block->offset)) == 0 &&
+		    block->offset + read_len != end)
+			error = index_error_invalid("index entry offset table does not match the entries");
+
+		git_mutex_lock(&ctx->lock);
+
+		if (error && !ctx->error_msg) {
+			const git_error *last = git_error_last();
+
+			ctx->error_class = last ? last->klass : GIT_ERROR_INDEX;
+			ctx->error_msg = git__strdup(last ? last->message : "failed to read index entries");
+		}
+
+		ctx->done[i] = error ? -1 : 1;
+		git_cond_signal(&ctx->cond);
+		git_mutex_unlock(&ctx->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Read the entries of the blocks listed in an offset table on as many
+ * threads as there are blocks or processors.  The blocks are added to
+ * the index in order by this thread as the workers finish them.
+ */
+static int read_entries_threaded(
+	size_t *read_len,
+	git_index *index,
+	const char *buffer,
+	size_t entries_end,
+	index_entry_blocks *blocks,
+	size_t entry_count)
+{
+	struct index_read ctx = { 0 };
+	struct index_read_worker *workers = NULL;
+	size_t i, nr_threads, count = 0, nr_blocks = git_array_size(*blocks);
+	int status, error = 0;
+
+	if ((nr_threads = git_index__read_threads) == 0)
+		nr_threads = git_online_cpus();
+
+	if (nr_blocks < 2 || nr_threads < 2)
+		return GIT_PASSTHROUGH;
+
+	if (nr_threads > nr_blocks)
+		nr_threads = nr_blocks;
+
+	/* an offset table that does not describe the entries is ignored */
+	for (i = 0; i < nr_blocks; i++) {
+		const struct index_entry_block *block = git_array_get(*blocks, i);
+
+		if ((i == 0 && block->offset != INDEX_HEADER_SIZE) ||
+		    (i > 0 && block->offset <= git_array_get(*blocks, i - 1)->offset) ||
+		    block->offset >= entries_end ||
+		    block->count == 0 ||
+		    block->count > entry_count - count)
+			return GIT_PASSTHROUGH;
+
+		count += block->count;
+	}
+
+	if (count != entry_count)
+		return GIT_PASSTHROUGH;
+
+	/* warm up what path validation reads lazily from the repository */
+	if (INDEX_OWNER(index)) {
+		git_buf *reserved;
+		size_t reserved_len;
+
+		git_path_isvalid(INDEX_OWNER(index), "a", 0, GIT_PATH_REJECT_INDEX_DEFAULTS);
+		git_repository__reserved_names(&reserved, &reserved_len, INDEX_OWNER(index), true);
+	}
+
+	ctx.index = index;
+	ctx.buffer = buffer;
+	ctx.buffer_size = entries_end + INDEX_FOOTER_SIZE;
+	ctx.entries_end = entries_end;
+	ctx.blocks = blocks->ptr;
+	ctx.nr_blocks = nr_blocks;
+
+	ctx.first_entry = git__calloc(nr_blocks, sizeof(size_t));
+	ctx.done = git__calloc(nr_blocks, sizeof(int));
+	workers = git__calloc(nr_threads, sizeof(struct index_read_worker));
+
+	if (!ctx.first_entry || !ctx.done || !workers) {
+		git__free(ctx.first_entry);
+		git__free(ctx.done);
+		git__free(workers);
+		git_error_set_oom();
+		return -1;
+	}
+
+	for (i = 1; i < nr_blocks; i++)
+		ctx.first_entry[i] = ctx.first_entry[i - 1] + blocks->ptr[i - 1].count;
+
+	/* without the means to synchronise, read the entries serially */
+	if (git_mutex_init(&ctx.lock) < 0) {
+		error = GIT_PASSTHROUGH;
+		goto cleanup;
+	}
+
+	if (git_cond_init(&ctx.cond) < 0) {
+		git_mutex_free(&ctx.lock);
+		error = GIT_PASSTHROUGH;
+		goto cleanup;
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].ctx = &ctx;
+		workers[i].first_block = i * nr_blocks / nr_threads;
+		workers[i].last_block = (i + 1) * nr_blocks / nr_threads;
+
+		if ((error = index_entry_arena_new(&workers[i].arena)) < 0)
+			break;
+
+		if (git_thread_create(&workers[i].thread, index_read_worker, &workers[i]) == 0)
+			workers[i].started = true;
+		else
+			index_read_worker(&workers[i]);
+	}
+
+	for (i = 0; !error && i < nr_blocks; i++) {
+		git_mutex_lock(&ctx.lock);
+		while (!(status = ctx.done[i]))
+			git_cond_wait(&ctx.cond, &ctx.lock);
+		git_mutex_unlock(&ctx.lock);
+
+		if (status < 0) {
+			git_error_set_str(ctx.error_class, ctx.error_msg);
+			error = -1;
+		} else {
+			error = index_take_read_entries(index, blocks->ptr[i].count);
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		if (workers[i].started)
+			git_thread_join(&workers[i].thread, NULL);
+
+		index_entry_arena_free(workers[i].arena);
+	}
+
+	if (!error)
+		*read_len = entries_end - INDEX_HEADER_SIZE;
+
+	git_cond_free(&ctx.cond);
+	git_mutex_free(&ctx.lock);
+
+cleanup:
+	git__free(ctx.error_msg);
+	git__free(ctx.first_entry);
+	git__free(ctx.done);
+	git__free(workers);
+
+	return error;
+}
+
+#endif
+
+static int read_header(struct index_header *dest, const void *buffer)
+{
+	const struct index_header *source = buffer;
+
+	dest->signature = ntohl(source->signature);
+	if (dest->signature != INDEX_HEADER_SIG)
+		return index_error_invalid("incorrect header signature");
+
+	dest->version = ntohl(source->version);
+	if (dest->version < INDEX_VERSION_NUMBER_LB ||
+		dest->version > INDEX_VERSION_NUMBER_UB)
+		return index_error_invalid("incorrect header version");
+
+	dest->entry_count = ntohl(source->entry_count);
+	return 0;
+}
+
+static int read_offset_table(
+	index_entry_blocks *blocks, const char *buffer, size_t size)
+{
+	struct index_entry_block *block;
+	uint32_t version, raw[2];
+
+	/* a table we cannot use only means reading on a single thread */
+	if (size < sizeof(version) || (size - sizeof(version)) % sizeof(raw))
+		return 0;
+
+	memcpy(&version, buffer, sizeof(version));
+	if (ntohl(version) != INDEX_IEOT_VERSION)
+		return 0;
+
+	git_array_clear(*blocks);
+
+	for (buffer += sizeof(version), size -= sizeof(version);
+	     size > 0;
+	     buffer += sizeof(raw), size -= sizeof(raw)) {
+		block = git_array_alloc(*blocks);
+		GIT_ERROR_CHECK_ALLOC(block);
+
+		memcpy(raw, buffer, sizeof(raw));
+		block->offset = ntohl(raw[0]);
+		block->count = ntohl(raw[1]);
+	}
+
+	return 0;
+}
+
+/*
+ * Find where the entries end from the end of index entries extension,
+ * which must be the last one and must hash the headers of the other
+ * extensions.
+ */
+static int read_end_of_entries(
+	size_t *entries_end, const char *buffer, size_t buffer_size)
+{
+	const char *eoie, *ext;
+	struct index_extension dest;
+	git_hash_ctx ctx;
+	git_oid expected, actual;
+	uint32_t offset;
+	int error;
+
+	if (buffer_size < INDEX_HEADER_SIZE + sizeof(struct index_extension) +
+			INDEX_EOIE_SIZE + INDEX_FOOTER_SIZE)
+		return GIT_ENOTFOUND;
+
+	eoie = buffer + buffer_size - INDEX_FOOTER_SIZE - INDEX_EOIE_SIZE -
+		sizeof(struct index_extension);
+
+	memcpy(&dest, eoie, sizeof(struct index_extension));
+
+	if (memcmp(dest.signature, INDEX_EXT_EOIE_SIG, 4) != 0 ||
+	    ntohl(dest.extension_size) != INDEX_EOIE_SIZE)
+		return GIT_ENOTFOUND;
+
+	memcpy(&offset, eoie + sizeof(struct index_extension), sizeof(offset));
+	offset = ntohl(offset);
+
+	if (offset < INDEX_HEADER_SIZE || offset > (size_t)(eoie - buffer))
+		return GIT_ENOTFOUND;
+
+	memcpy(expected.id, eoie + sizeof(struct index_extension) + sizeof(offset),
+		GIT_OID_RAWSZ);
+
+	if ((error = git_hash_ctx_init(&ctx)) < 0)
 		return error;
 
-	/* Parse all the entries */
-	for (i = 0; i < header.entry_count && buffer_size > INDEX_FOOTER_SIZE; ++i) {
-		git_index_entry *entry = NULL;
-		size_t entry_size;
+	for (ext = buffer + offset; ext < eoie; ) {
+		size_t size;
 
-		if ((error = read_entry(&entry, &entry_size, index, buffer, buffer_size, last)) < 0) {
-			error = index_error_invalid("invalid entry");
+		if ((size_t)(eoie - ext) < sizeof(struct index_extension)) {
+			error = GIT_ENOTFOUND;
 			goto done;
 		}
 
-		if ((error = git_vector_insert(&index->entries, entry)) < 0) {
-			index_entry_free(entry);
+		memcpy(&dest, ext, sizeof(struct index_extension));
+		size = ntohl(dest.extension_size);
+
+		if (size > (size_t)(eoie - ext) - sizeof(struct index_extension)) {
+			error = GIT_ENOTFOUND;
 			goto done;
 		}
 
-		INSERT_IN_MAP(index, entry, error);
+		if ((error = git_hash_update(&ctx, ext, sizeof(struct index_extension))) < 0)
+			goto done;
 
-		if (error < 0) {
-			index_entry_free(entry);
+		ext += sizeof(struct index_extension) + size;
+	}
+
+	if ((error = git_hash_final(&actual, &ctx)) < 0)
+		goto done;
+
+	if (git_oid__cmp(&expected, &actual) != 0)
+		error = GIT_ENOTFOUND;
+	else
+		*entries_end = offset;
+
+done:
+	git_hash_ctx_cleanup(&ctx);
+	return error;
+}
+
+static int read_fsmonitor(
+	git_index *index, git_bitmap *dirty, const char *buffer, size_t size)
+{
+	git_buf token = GIT_BUF_INIT;
+	uint32_t version, raw[2], bitmap_size;
+	const char *nul;
+	size_t consumed;
+
+	if (size < 4)
+		goto invalid;
+
+	memcpy(&version, buffer, 4);
+	version = ntohl(version);
+	buffer += 4;
+	size -= 4;
+
+	/* the first version records the time of the last query as token */
+	if (version == 1) {
+		if (size < 8)
+			goto invalid;
+
+		memcpy(raw, buffer, 8);
+		if (git_buf_printf(&token, "%"PRId64, (int64_t)
+				(((uint64_t)ntohl(raw[0]) << 32) | ntohl(raw[1]))) < 0)
+			goto invalid;
+
+		buffer += 8;
+		size -= 8;
+	} else if (version == 2) {
+		if ((nul = memchr(buffer, '\0', size)) == NULL ||
+		    git_buf_put(&token, buffer, nul - buffer) < 0)
+			goto invalid;
+
+		size -= (nul - buffer) + 1;
+		buffer = nul + 1;
+	} else {
+		goto invalid;
+	}
+
+	if (size < 4)
+		goto invalid;
+
+	memcpy(&bitmap_size, buffer, 4);
+	bitmap_size = ntohl(bitmap_size);
+	buffer += 4;
+	size -= 4;
+
+	if (bitmap_size != size ||
+	    git_bitmap_read_ewah(dirty, &consumed,
+			(const unsigned char *)buffer, size) < 0 ||
+	    consumed != size)
+		goto invalid;
+
+	git__free(index->fsmonitor_token);
+	index->fsmonitor_token = git_buf_detach(&token);
+	return 0;
+
+invalid:
+	git_buf_dispose(&token);
+	return index_error_invalid("invalid filesystem monitor extension");
+}
+
+static int fsmonitor_dirty_check(size_t pos, void *payload)
+{
+	return (pos < *(size_t *)payload) ? 0 : -1;
+}
+
+/*
+ * The entries that are not dirty in the filesystem monitor extension are
+ * valid; call with the entries in the order they were read.
+ */
+static void apply_fsmonitor_dirty(git_index *index, git_bitmap *dirty)
+{
+	git_index_entry *entry;
+	size_t i;
+
+	if (git_bitmap_foreach(dirty, fsmonitor_dirty_check,
+			&index->entries.length) < 0) {
+		git_error_clear();
+		git__free(index->fsmonitor_token);
+		index->fsmonitor_token = NULL;
+		return;
+	}
+
+	git_vector_foreach(&index->entries, i, entry) {
+		if (!git_bitmap_get(dirty, i))
+			entry->flags_extended |= GIT_INDEX_ENTRY_FSMONITOR_VALID;
+	}
+}
+
+static int read_link(
+	struct index_read_extensions *ext, const char *buffer, size_t size)
+{
+	size_t consumed;
+
+	if (size < GIT_OID_RAWSZ)
+		return index_error_invalid("link extension is truncated");
+
+	git_oid_fromraw(&ext->shared_id, (const unsigned char *)buffer);
+	buffer += GIT_OID_RAWSZ;
+	size -= GIT_OID_RAWSZ;
+
+	/* the bitmaps of entries that are deleted and replaced */
+	if (size) {
+		if (git_bitmap_read_ewah(&ext->shared_deleted, &consumed,
+				(const unsigned char *)buffer, size) < 0)
+			return index_error_invalid("link extension has an invalid bitmap");
+
+		buffer += consumed;
+		size -= consumed;
+
+		if (git_bitmap_read_ewah(&ext->shared_replaced, &consumed,
+				(const unsigned char *)buffer, size) < 0 ||
+		    consumed != size)
+			return index_error_invalid("link extension has an invalid bitmap");
+	}
+
+	ext->has_link = true;
+	return 0;
+}
+
+static int shared_index_path(git_buf *out, git_index *index, const git_oid *id)
+{
+	char hex[GIT_OID_HEXSZ + 1];
+
+	git_oid_tostr(hex, sizeof(hex), id);
+
+	if (git_path_dirname_r(out, index->index_file_path) < 0 ||
+	    git_buf_joinpath(out, out->ptr, INDEX_SHARED_PREFIX) < 0 ||
+	    git_buf_puts(out, hex) < 0)
+		return -1;
+
+	return 0;
+}
+
+struct shared_merge {
+	git_index_entry **shared;
+	size_t shared_count;
+	git_index_entry **split;
+	size_t split_count;
+	size_t replaced;
+};
+
+static int shared_merge_replace(size_t pos, void *payload)
+{
+	struct shared_merge *merge = payload;
+	git_index_entry *entry, *replacement;
+
+	if (pos >= merge->shared_count || merge->replaced >= merge->split_count)
+		return -1;
+
+	entry = merge->shared[pos];
+	replacement = merge->split[merge->replaced];
+
+	/* replacements are written without a path */
+	if (replacement->path[0] != '\0')
+		return -1;
+
+	index_entry_cpy(entry, replacement);
+	index_entry_adjust_namemask(entry, ((struct entry_internal *)entry)->pathlen);
+	((struct entry_internal *)entry)->shared_pos = 0;
+
+	index_entry_free(replacement);
+	merge->split[merge->replaced++] = NULL;
+	return 0;
+}
+
+static int shared_merge_delete(size_t pos, void *payload)
+{
+	struct shared_merge *merge = payload;
+	git_index_entry *entry;
+
+	if (pos >= merge->shared_count || (entry = merge->shared[pos]) == NULL ||
+	    ((struct entry_internal *)entry)->shared_pos == 0)
+		return -1;
+
+	index_entry_free(entry);
+	merge->shared[pos] = NULL;
+	return 0;
+}
+
+/*
+ * The entries of a split index are those that were added or replaced
+ * since its shared index was written; merge them with the entries of the
+ * shared index that were neither replaced nor deleted.
+ */
+static int index_merge_shared(git_index *index, struct index_read_extensions *ext)
+{
+	struct shared_merge merge = { 0 };
+	git_index *shared = NULL;
+	git_index_entry *entry, *prev;
+	git_buf path = GIT_BUF_INIT;
+	size_t i, count;
+	int error = 0;
+
+	if ((error = shared_index_path(&path, index, &ext->shared_id)) < 0)
+		goto done;
+
+	if (!git_path_exists(path.ptr)) {
+		git_error_set(GIT_ERROR_INDEX, "shared index '%s' does not exist", path.ptr);
+		error = -1;
+		goto done;
+	}
+
+	if ((error = git_index_open(&shared, path.ptr)) < 0)
+		goto done;
+
+	if (!git_oid_equal(&shared->checksum, &ext->shared_id) ||
+	    !git_oid_iszero(&shared->shared_id)) {
+		error = index_error_invalid("invalid shared index");
+		goto done;
+	}
+
+	merge.shared = (git_index_entry **)shared->entries.contents;
+	merge.shared_count = shared->entries.length;
+	merge.split_count = index->entries.length;
+	if ((merge.split = git__calloc(merge.split_count + 1, sizeof(git_index_entry *))) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	memcpy(merge.split, index->entries.contents, merge.split_count * sizeof(git_index_entry *));
+	memset(index->entries.contents, 0, merge.split_count * sizeof(git_index_entry *));
+	index->entries.length = 0;
+	git_idxmap_clear(index->entries_map);
+
+	for (i = 0; i < merge.shared_count; i++)
+		((struct entry_internal *)merge.shared[i])->shared_pos = i + 1;
+
+	if (git_bitmap_foreach(&ext->shared_replaced, shared_merge_replace, &merge) < 0 ||
+	    git_bitmap_foreach(&ext->shared_deleted, shared_merge_delete, &merge) < 0) {
+		error = index_error_invalid("corrupted link extension");
+		goto done;
+	}
+
+	for (i = merge.replaced; i < merge.split_count; i++) {
+		if (merge.split[i]->path[0] == '\0') {
+			error = index_error_invalid("corrupted link extension");
 			goto done;
 		}
-		error = 0;
+	}
 
-		if (index->version >= INDEX_VERSION_NUMBER_COMP)
-			last = entry->path;
+	count = merge.shared_count + merge.split_count;
+
+	if ((error = git_vector_size_hint(&index->entries, count)) < 0 ||
+	    (index->ignore_case &&
+	     (error = git_idxmap_icase_resize((git_idxmap_icase *)index->entries_map, count)) < 0) ||
+	    (!index->ignore_case &&
+	     (error = git_idxmap_resize(index->entries_map, count)) < 0))
+		goto done;
 
-		seek_forward(entry_size);
+	for (i = 0; i < merge.shared_count; i++) {
+		if (merge.shared[i])
+			index->entries.contents[index->entries.length++] = merge.shared[i];
 	}
 
-	if (i != header.entry_count) {
-		error = index_error_invalid("header entries changed while parsing");
-		goto done;
+	for (i = merge.replaced; i < merge.split_count; i++) {
+		index->entries.contents[index->entries.length++] = merge.split[i];
+		merge.split[i] = NULL;
 	}
 
-	/* There's still space for some extensions! */
-	while (buffer_size > INDEX_FOOTER_SIZE) {
-		size_t extension_size;
+	/* the shared entries are ours now */
+	shared->entries.length = 0;
+
+	/* the entries are in disk order, with an added entry after the
+	 * shared entry it replaces */
+	git__tsort(index->entries.contents, index->entries.length, git_index_entry_cmp);
+
+	for (i = 0, prev = NULL; i < index->entries.length; i++) {
+		entry = index->entries.contents[i];
+
+		if (prev && git_index_entry_cmp(prev, entry) == 0) {
+			index_entry_free(prev);
+			git_vector_remove(&index->entries, --i);
+		}
+
+		INSERT_IN_MAP(index, entry, error);
+		if (error < 0)
+			goto done;
+
+		prev = entry;
+	}
+
+	git_oid_cpy(&index->shared_id, &ext->shared_id);
+	index->shared_count = merge.shared_count;
+
+done:
+	if (merge.split) {
+		for (i = 0; i < merge.split_count; i++)
+			index_entry_free(merge.split[i]);
+	}
+
+	git__free(merge.split);
+	git_index_free(shared);
+	git_buf_dispose(&path);
+	return error;
+}
+
+static int read_extension(size_t *read_len, git_index *index, index_entry_blocks *blocks, struct index_read_extensions *ext, const char *buffer, size_t buffer_size)
+{
+	struct index_extension dest;
+	size_t total_size;
+
+	/* buffer is not guaranteed to be aligned */
+	memcpy(&dest, buffer, sizeof(struct index_extension));
+	dest.extension_size = ntohl(dest.extension_size);
+
+	total_size = dest.extension_size + sizeof(struct index_extension);
+
+	if (dest.extension_size > total_size ||
+		buffer_size < total_size ||
+		buffer_size - total_size < INDEX_FOOTER_SIZE) {
+		index_error_invalid("extension is truncated");
+		return -1;
+	}
+
+	/* the link to the shared index of a split index */
+	if (memcmp(dest.signature, INDEX_EXT_LINK_SIG, 4) == 0) {
+		if (read_link(ext, buffer + 8, dest.extension_size) < 0)
+			return -1;
+
+	/* optional extension */
+	} else if (dest.signature[0] >= 'A' && dest.signature[0] <= 'Z') {
+		/* tree cache */
+		if (memcmp(dest.signature, INDEX_EXT_TREECACHE_SIG, 4) == 0) {
+			if (git_tree_cache_read(&index->tree, buffer + 8, dest.extension_size, &index->tree_pool) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNMERGED_SIG, 4) == 0) {
+			if (read_reuc(index, buffer + 8, dest.extension_size) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4) == 0) {
+			if (read_conflict_names(index, buffer + 8, dest.extension_size) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_IEOT_SIG, 4) == 0) {
+			/* only useful before the entries are read */
+			if (blocks && read_offset_table(blocks, buffer + 8, dest.extension_size) < 0)
+				return -1;
+		} else if (memcmp(dest.signature, INDEX_EXT_UNTRACKED_SIG, 4) == 0) {
+			/* the untracked cache is only an optimization, drop it if invalid */
+			git_untracked_cache_free(index->untracked);
+			index->untracked = NULL;
+
+			if (git_untracked_cache_read(&index->untracked, buffer + 8, dest.extension_size) < 0)
+				git_error_clear();
+		} else if (memcmp(dest.signature, INDEX_EXT_FSMONITOR_SIG, 4) == 0) {
+			/* likewise for the entries the filesystem monitor knows */
+			if (read_fsmonitor(index, &ext->fsmonitor_dirty, buffer + 8, dest.extension_size) < 0)
+				git_error_clear();
+		}
+		/* else, unsupported extension. We cannot parse this, but we can skip
+		 * it by returning `total_size */
+	} else {
+		/* we cannot handle non-ignorable extensions;
+		 * in fact they aren't even defined in the standard */
+		git_error_set(GIT_ERROR_INDEX, "unsupported mandatory extension: '%.4s'", dest.signature);
+		return -1;
+	}
+
+	*read_len = total_size;
+
+	return 0;
+}
+
+struct index_hash {
+	const char *buffer;
+	size_t size;
+	git_oid checksum;
+	int error;
+#ifdef GIT_THREADS
+	git_thread thread;
+	bool threaded;
+#endif
+};
+
+static void *index_hash_run(void *arg)
+{
+	struct index_hash *hash = arg;
+
+	hash->error = git_hash_buf(&hash->checksum, hash->buffer, hash->size);
+	return NULL;
+}
+
+/* Large indexes are hashed on a thread while the entries are read */
+static void index_hash_start(struct index_hash *hash, const char *buffer, size_t size)
+{
+	hash->buffer = buffer;
+	hash->size = size;
+
+#ifdef GIT_THREADS
+	hash->threaded = size >= INDEX_THREADED_HASH_SIZE &&
+		git_thread_create(&hash->thread, index_hash_run, hash) == 0;
+
+	if (hash->threaded)
+		return;
+#endif
+
+	index_hash_run(hash);
+}
+
+static int index_hash_finish(git_oid *out, struct index_hash *hash)
+{
+#ifdef GIT_THREADS
+	if (hash->threaded) {
+		git_thread_join(&hash->thread, NULL);
+		hash->threaded = false;
+
+		if (hash->error < 0)
+			git_error_set(GIT_ERROR_INDEX, "failed to hash the index");
+	}
+#endif
+
+	git_oid_cpy(out, &hash->checksum);
+	return hash->error;
+}
+
+static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
+{
+	int error = 0;
+	struct index_header header = { 0 };
+	struct index_hash hash = { 0 };
+	git_oid checksum_calculated, checksum_expected;
+	index_entry_blocks blocks = GIT_ARRAY_INIT;
+	struct index_read_extensions ext = INDEX_READ_EXTENSIONS_INIT;
+	git_index_entry *entry;
+	size_t offset, entries_end, read_len = 0, extension_size, i;
+	bool has_eoie;
+
+	if (buffer_size < INDEX_HEADER_SIZE + INDEX_FOOTER_SIZE)
+		return index_error_invalid("insufficient buffer space");
+
+	/* Parse header */
+	if ((error = read_header(&header, buffer)) < 0)
+		return error;
+
+	index->version = header.version;
 
-		if ((error = read_extension(&extension_size, index, buffer, buffer_size)) < 0) {
+	memset(&index->shared_id, 0, sizeof(git_oid));
+	index->shared_count = 0;
+
+	if (header.entry_count > (buffer_size - INDEX_HEADER_SIZE) / minimal_entry_size)
+		return index_error_invalid("header entries changed while parsing");
+
+	assert(!index->entries.length);
+
+	if (index->ignore_case &&
+	    (error = git_idxmap_icase_resize((git_idxmap_icase *) index->entries_map,
+					     header.entry_count)) < 0)
+		return error;
+	else if ((error = git_idxmap_resize(index->entries_map, header.entry_count)) < 0)
+		return error;
+
+	/* Entries are read straight into the vector's storage */
+	if ((error = git_vector_size_hint(&index->entries, header.entry_count)) < 0)
+		return error;
+
+	if (header.entry_count)
+		memset(index->entries.contents, 0, header.entry_count * sizeof(void *));
+
+	/* Precalculate the SHA1 of the files's contents -- we'll match it to
+	 * the provided SHA1 in the footer */
+	index_hash_start(&hash, buffer, buffer_size - INDEX_FOOTER_SIZE);
+
+	/* When we know where the entries end, the extensions can be read
+	 * first, which tells us whether the entries can be read in blocks */
+	has_eoie = (read_end_of_entries(&entries_end, buffer, buffer_size) == 0);
+
+	if (has_eoie) {
+		size_t eoie = buffer_size - INDEX_FOOTER_SIZE - INDEX_EOIE_SIZE -
+			sizeof(struct index_extension);
+
+		for (offset = entries_end; offset < eoie; offset += extension_size) {
+			if ((error = read_extension(&extension_size, index, &blocks,
+					&ext, buffer + offset, buffer_size - offset)) < 0)
+				goto done;
+		}
+	}
+
+	error = GIT_PASSTHROUGH;
+
+#ifdef GIT_THREADS
+	if (has_eoie)
+		error = read_entries_threaded(&read_len, index, buffer,
+			entries_end, &blocks, header.entry_count);
+#endif
+
+	if (error == GIT_PASSTHROUGH)
+		error = read_entries_serial(&read_len, index, buffer + INDEX_HEADER_SIZE,
+			buffer_size - INDEX_HEADER_SIZE, header.entry_count);
+
+	if (error < 0)
+		goto done;
+
+	offset = INDEX_HEADER_SIZE + read_len;
+
+	if (has_eoie) {
+		if (offset != entries_end) {
+			error = index_error_invalid("end of index entries does not match the entries");
 			goto done;
 		}
 
-		seek_forward(extension_size);
+		offset = buffer_size - INDEX_FOOTER_SIZE;
+	}
+
+	/* There's still space for some extensions! */
+	while (buffer_size - offset > INDEX_FOOTER_SIZE) {
+		if ((error = read_extension(&extension_size, index, NULL,
+				&ext, buffer + offset, buffer_size - offset)) < 0)
+			goto done;
+
+		offset += extension_size;
 	}
 
-	if (buffer_size != INDEX_FOOTER_SIZE) {
+	if (buffer_size - offset != INDEX_FOOTER_SIZE) {
 		error = index_error_invalid(
 			"buffer size does not match index footer size");
 		goto done;
 	}
 
+	if ((error = index_hash_finish(&checksum_calculated, &hash)) < 0)
+		goto done;
+
 	/* 160-bit SHA-1 over the content of the index file before this checksum. */
-	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer);
+	git_oid_fromraw(&checksum_expected, (const unsigned char *)buffer + offset);
 
 	if (git_oid__cmp(&checksum_calculated, &checksum_expected) != 0) {
 		error = index_error_invalid(
@@ -2678,7 +3802,23 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 
 	git_oid_cpy(&index->checksum, &checksum_calculated);
 
-#undef seek_forward
+	/* A split index only has the entries that changed since its
+	 * shared index was written */
+	if (ext.has_link && !git_oid_iszero(&ext.shared_id)) {
+		if ((error = index_merge_shared(index, &ext)) < 0)
+			goto done;
+	} else {
+		git_vector_foreach(&index->entries, i, entry) {
+			if (entry->path[0] == '\0') {
+				error = index_error_invalid("entry without a path");
+				goto done;
+			}
+		}
+	}
+
+	/* The extension refers to the entries in case-sensitive order */
+	if (index->fsmonitor_token)
+		apply_fsmonitor_dirty(index, &ext.fsmonitor_dirty);
 
 	/* Entries are stored case-sensitively on disk, so re-sort now if
 	 * in-memory index is supposed to be case-insensitive
@@ -2688,6 +3828,17 @@ static int parse_index(git_index *index, const char *buffer, size_t buffer_size)
 
 	index->dirty = 0;
 done:
+	if (error < 0) {
+		git_oid unused;
+
+		index_free_read_entries(index, header.entry_count);
+		index_hash_finish(&unused, &hash);
+	}
+
+	git_array_clear(blocks);
+	git_bitmap_dispose(&ext.fsmonitor_dirty);
+	git_bitmap_dispose(&ext.shared_deleted);
+	git_bitmap_dispose(&ext.shared_replaced);
 	return error;
 }
 
@@ -2709,7 +3860,16 @@ static bool is_index_extended(git_index *index)
 	return (extended > 0);
 }
 
-static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const char *last)
+/*
+ * Write an entry; in index v4, its path is compressed against `last`
+ * unless `full_path` is set.
+ */
+static int write_disk_entry(
+	size_t *out_size,
+	git_filebuf *file,
+	git_index_entry *entry,
+	const char *last,
+	bool full_path)
 {
 	void *mem = NULL;
 	struct entry_short ondisk;
@@ -2717,14 +3877,14 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 	int varint_len = 0;
 	char *path;
 	const char *path_start = entry->path;
-	size_t same_len = 0;
+	size_t same_len = 0, strip_len = 0;
 
 	path_len = ((struct entry_internal *)entry)->pathlen;
 
 	if (last) {
 		const char *last_c = last;
 
-		while (*path_start == *last_c) {
+		while (!full_path && *path_start == *last_c) {
 			if (!*path_start || !*last_c)
 				break;
 			++path_start;
@@ -2732,7 +3892,10 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 			++same_len;
 		}
 		path_len -= same_len;
-		varint_len = git_encode_varint(NULL, 0, same_len);
+
+		/* the number of bytes to remove from the end of the last path */
+		strip_len = strlen(last_c);
+		varint_len = git_encode_varint(NULL, 0, strip_len);
 	}
 
 	disk_size = index_entry_size(path_len, varint_len, entry->flags);
@@ -2740,6 +3903,8 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 	if (git_filebuf_reserve(file, &mem, disk_size) < 0)
 		return -1;
 
+	*out_size = disk_size;
+
 	memset(mem, 0x0, disk_size);
 
 	/**
@@ -2783,7 +3948,7 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 
 	if (last) {
 		varint_len = git_encode_varint((unsigned char *) path,
-					  disk_size, same_len);
+					  disk_size, strip_len);
 		assert(varint_len > 0);
 		path += varint_len;
 		disk_size -= varint_len;
@@ -2802,180 +3967,623 @@ static int write_disk_entry(git_filebuf *file, git_index_entry *entry, const cha
 		assert(disk_size > path_len);
 	}
 
-	memcpy(path, path_start, path_len + 1);
+	memcpy(path, path_start, path_len + 1);
+
+	return 0;
+}
+
+typedef enum {
+	INDEX_WRITE_ALL = 0,
+	/* all the entries, which are now those of the shared index */
+	INDEX_WRITE_SHARED,
+	/* only the entries that are not in the shared index */
+	INDEX_WRITE_SPLIT,
+} index_write_t;
+
+/*
+ * Write the entries, returning where they end.  When `blocks` is given,
+ * it records blocks of entries that can be read independently.
+ */
+static int write_entries(
+	size_t *entries_end,
+	git_index *index,
+	git_filebuf *file,
+	index_entry_blocks *blocks,
+	git_bitmap *fsmonitor_dirty,
+	index_write_t mode)
+{
+	int error = 0;
+	size_t i, written = 0, entry_size, offset = INDEX_HEADER_SIZE;
+	size_t block_size = git_index__offset_table_block_size;
+	git_vector case_sorted, *entries;
+	git_index_entry *entry;
+	struct index_entry_block *block = NULL;
+	const char *last = NULL;
+
+	/* If index->entries is sorted case-insensitively, then we need
+	 * to re-sort it case-sensitively before writing */
+	if (index->ignore_case) {
+		git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp);
+		git_vector_sort(&case_sorted);
+		entries = &case_sorted;
+	} else {
+		entries = &index->entries;
+	}
+
+	if (index->version >= INDEX_VERSION_NUMBER_COMP)
+		last = "";
+
+	git_vector_foreach(entries, i, entry) {
+		bool block_start = false;
+
+		/* the monitor's bitmap is in the order of all the entries */
+		if (fsmonitor_dirty &&
+		    !(entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) &&
+		    (error = git_bitmap_set(fsmonitor_dirty, i)) < 0)
+			break;
+
+		if (mode == INDEX_WRITE_SHARED)
+			((struct entry_internal *)entry)->shared_pos = i + 1;
+		else if (mode == INDEX_WRITE_SPLIT &&
+			 ((struct entry_internal *)entry)->shared_pos)
+			continue;
+
+		if (blocks && block_size && written % block_size == 0 &&
+		    git__is_uint32(offset)) {
+			if ((block = git_array_alloc(*blocks)) == NULL) {
+				error = -1;
+				break;
+			}
+
+			block->offset = (uint32_t)offset;
+			block->count = 0;
+			block_start = true;
+		}
+
+		if ((error = write_disk_entry(&entry_size, file, entry, last, block_start)) < 0)
+			break;
+		if (index->version >= INDEX_VERSION_NUMBER_COMP)
+			last = entry->path;
+		if (block)
+			block->count++;
+
+		offset += entry_size;
+		written++;
+	}
+
+	if (index->ignore_case)
+		git_vector_free(&case_sorted);
+
+	*entries_end = offset;
+	return error;
+}
+
+/*
+ * Write an extension, and add its header to `headers` when we keep
+ * them for the end of index entries extension.
+ */
+static int write_extension(git_filebuf *file, git_buf *headers, struct index_extension *header, git_buf *data)
+{
+	struct index_extension ondisk;
+
+	memset(&ondisk, 0x0, sizeof(struct index_extension));
+	memcpy(&ondisk, header, 4);
+	ondisk.extension_size = htonl(header->extension_size);
+
+	if (headers && git_buf_put(headers, (const char *)&ondisk, sizeof(struct index_extension)) < 0)
+		return -1;
+
+	git_filebuf_write(file, &ondisk, sizeof(struct index_extension));
+	return git_filebuf_write(file, data->ptr, data->size);
+}
+
+static int create_name_extension_data(git_buf *name_buf, git_index_name_entry *conflict_name)
+{
+	int error = 0;
+
+	if (conflict_name->ancestor == NULL)
+		error = git_buf_put(name_buf, "\0", 1);
+	else
+		error = git_buf_put(name_buf, conflict_name->ancestor, strlen(conflict_name->ancestor) + 1);
+
+	if (error != 0)
+		goto on_error;
+
+	if (conflict_name->ours == NULL)
+		error = git_buf_put(name_buf, "\0", 1);
+	else
+		error = git_buf_put(name_buf, conflict_name->ours, strlen(conflict_name->ours) + 1);
+
+	if (error != 0)
+		goto on_error;
+
+	if (conflict_name->theirs == NULL)
+		error = git_buf_put(name_buf, "\0", 1);
+	else
+		error = git_buf_put(name_buf, conflict_name->theirs, strlen(conflict_name->theirs) + 1);
+
+on_error:
+	return error;
+}
+
+static int write_name_extension(git_index *index, git_filebuf *file, git_buf *headers)
+{
+	git_buf name_buf = GIT_BUF_INIT;
+	git_vector *out = &index->names;
+	git_index_name_entry *conflict_name;
+	struct index_extension extension;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(out, i, conflict_name) {
+		if ((error = create_name_extension_data(&name_buf, conflict_name)) < 0)
+			goto done;
+	}
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
+	extension.extension_size = (uint32_t)name_buf.size;
+
+	error = write_extension(file, headers, &extension, &name_buf);
+
+	git_buf_dispose(&name_buf);
+
+done:
+	return error;
+}
+
+static int create_reuc_extension_data(git_buf *reuc_buf, git_index_reuc_entry *reuc)
+{
+	int i;
+	int error = 0;
+
+	if ((error = git_buf_put(reuc_buf, reuc->path, strlen(reuc->path) + 1)) < 0)
+		return error;
+
+	for (i = 0; i < 3; i++) {
+		if ((error = git_buf_printf(reuc_buf, "%o", reuc->mode[i])) < 0 ||
+			(error = git_buf_put(reuc_buf, "\0", 1)) < 0)
+			return error;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (reuc->mode[i] && (error = git_buf_put(reuc_buf, (char *)&reuc->oid[i].id, GIT_OID_RAWSZ)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+static int write_reuc_extension(git_index *index, git_filebuf *file, git_buf *headers)
+{
+	git_buf reuc_buf = GIT_BUF_INIT;
+	git_vector *out = &index->reuc;
+	git_index_reuc_entry *reuc;
+	struct index_extension extension;
+	size_t i;
+	int error = 0;
+
+	git_vector_foreach(out, i, reuc) {
+		if ((error = create_reuc_extension_data(&reuc_buf, reuc)) < 0)
+			goto done;
+	}
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
+	extension.extension_size = (uint32_t)reuc_buf.size;
+
+	error = write_extension(file, headers, &extension, &reuc_buf);
+
+	git_buf_dispose(&reuc_buf);
+
+done:
+	return error;
+}
+
+static int write_tree_extension(git_index *index, git_filebuf *file, git_buf *headers)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if (index->tree == NULL)
+		return 0;
+
+	if ((error = git_tree_cache_write(&buf, index->tree)) < 0)
+		return error;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, headers, &extension, &buf);
+
+	git_buf_dispose(&buf);
+
+	return error;
+}
+
+static int write_untracked_extension(git_index *index, git_filebuf *file, git_buf *headers)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	int error;
+
+	if ((error = git_untracked_cache_write(&buf, index->untracked)) < 0)
+		goto done;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_UNTRACKED_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, headers, &extension, &buf);
+
+done:
+	git_buf_dispose(&buf);
+	return error;
+}
+
+static int write_fsmonitor_extension(
+	git_index *index, git_filebuf *file, git_buf *headers, git_bitmap *dirty)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT, bitmap = GIT_BUF_INIT;
+	uint32_t raw;
+	int error;
+
+	if ((error = git_bitmap_write_ewah(&bitmap, dirty)) < 0)
+		goto done;
+
+	raw = htonl(2);
+	git_buf_put(&buf, (const char *)&raw, 4);
+	git_buf_put(&buf, index->fsmonitor_token, strlen(index->fsmonitor_token) + 1);
+	raw = htonl((uint32_t)bitmap.size);
+	git_buf_put(&buf, (const char *)&raw, 4);
+	git_buf_put(&buf, bitmap.ptr, bitmap.size);
+
+	if ((error = git_buf_oom(&buf) ? -1 : 0) < 0)
+		goto done;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_FSMONITOR_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, headers, &extension, &buf);
+
+done:
+	git_buf_dispose(&buf);
+	git_buf_dispose(&bitmap);
+	return error;
+}
+
+static int write_offset_table_extension(
+	git_filebuf *file, git_buf *headers, index_entry_blocks *blocks)
+{
+	struct index_extension extension;
+	struct index_entry_block *block;
+	git_buf buf = GIT_BUF_INIT;
+	uint32_t raw[2];
+	size_t i;
+	int error;
+
+	raw[0] = htonl(INDEX_IEOT_VERSION);
+	git_buf_put(&buf, (const char *)raw, sizeof(uint32_t));
+
+	git_array_foreach(*blocks, i, block) {
+		raw[0] = htonl(block->offset);
+		raw[1] = htonl(block->count);
+		git_buf_put(&buf, (const char *)raw, sizeof(raw));
+	}
+
+	if (git_buf_oom(&buf))
+		return -1;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_IEOT_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, headers, &extension, &buf);
+
+	git_buf_dispose(&buf);
+
+	return error;
+}
+
+/*
+ * The end of index entries extension is written last, and records where
+ * the entries end with a hash of the headers of the other extensions.
+ */
+static int write_end_of_entries_extension(
+	git_filebuf *file, git_buf *headers, size_t entries_end)
+{
+	struct index_extension extension;
+	git_buf buf = GIT_BUF_INIT;
+	git_oid hash;
+	uint32_t offset = htonl((uint32_t)entries_end);
+	int error;
+
+	if ((error = git_hash_buf(&hash, headers->ptr, headers->size)) < 0)
+		return error;
 
-	return 0;
+	git_buf_put(&buf, (const char *)&offset, sizeof(offset));
+	git_buf_put(&buf, (const char *)hash.id, GIT_OID_RAWSZ);
+
+	if (git_buf_oom(&buf))
+		return -1;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_EOIE_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
+
+	error = write_extension(file, NULL, &extension, &buf);
+
+	git_buf_dispose(&buf);
+
+	return error;
 }
 
-static int write_entries(git_index *index, git_filebuf *file)
+/*
+ * The link extension names the shared index, and has a bitmap of the
+ * shared entries that were deleted.  Changed entries are written as new
+ * entries, so the bitmap of the replaced ones stays empty.
+ */
+static int write_link_extension(git_index *index, git_filebuf *file, git_buf *headers)
 {
-	int error = 0;
-	size_t i;
-	git_vector case_sorted, *entries;
+	struct index_extension extension;
+	git_bitmap shared = GIT_BITMAP_INIT, deleted = GIT_BITMAP_INIT,
+		replaced = GIT_BITMAP_INIT;
+	git_buf buf = GIT_BUF_INIT;
 	git_index_entry *entry;
-	const char *last = NULL;
+	size_t i, pos;
+	int error;
 
-	/* If index->entries is sorted case-insensitively, then we need
-	 * to re-sort it case-sensitively before writing */
-	if (index->ignore_case) {
-		git_vector_dup(&case_sorted, &index->entries, git_index_entry_cmp);
-		git_vector_sort(&case_sorted);
-		entries = &case_sorted;
-	} else {
-		entries = &index->entries;
+	git_vector_foreach(&index->entries, i, entry) {
+		if ((pos = ((struct entry_internal *)entry)->shared_pos) != 0 &&
+		    (error = git_bitmap_set(&shared, pos - 1)) < 0)
+			goto done;
 	}
 
-	if (index->version >= INDEX_VERSION_NUMBER_COMP)
-		last = "";
-
-	git_vector_foreach(entries, i, entry) {
-		if ((error = write_disk_entry(file, entry, last)) < 0)
-			break;
-		if (index->version >= INDEX_VERSION_NUMBER_COMP)
-			last = entry->path;
+	for (i = 0; i < index->shared_count; i++) {
+		if (!git_bitmap_get(&shared, i) &&
+		    (error = git_bitmap_set(&deleted, i)) < 0)
+			goto done;
 	}
 
-	if (index->ignore_case)
-		git_vector_free(&case_sorted);
+	git_buf_put(&buf, (const char *)index->shared_id.id, GIT_OID_RAWSZ);
+
+	if ((error = git_bitmap_write_ewah(&buf, &deleted)) < 0 ||
+	    (error = git_bitmap_write_ewah(&buf, &replaced)) < 0)
+		goto done;
+
+	if ((error = git_buf_oom(&buf) ? -1 : 0) < 0)
+		goto done;
+
+	memset(&extension, 0x0, sizeof(struct index_extension));
+	memcpy(&extension.signature, INDEX_EXT_LINK_SIG, 4);
+	extension.extension_size = (uint32_t)buf.size;
 
+	error = write_extension(file, headers, &extension, &buf);
+
+done:
+	git_bitmap_dispose(&shared);
+	git_bitmap_dispose(&deleted);
+	git_bitmap_dispose(&replaced);
+	git_buf_dispose(&buf);
 	return error;
 }
 
-static int write_extension(git_filebuf *file, struct index_extension *header, git_buf *data)
+static int write_index_header(git_index *index, git_filebuf *file, size_t entry_count)
 {
-	struct index_extension ondisk;
+	struct index_header header;
+	uint32_t index_version_number;
 
-	memset(&ondisk, 0x0, sizeof(struct index_extension));
-	memcpy(&ondisk, header, 4);
-	ondisk.extension_size = htonl(header->extension_size);
+	if (index->version <= INDEX_VERSION_NUMBER_EXT)
+		index_version_number = is_index_extended(index) ?
+			INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER_LB;
+	else
+		index_version_number = index->version;
 
-	git_filebuf_write(file, &ondisk, sizeof(struct index_extension));
-	return git_filebuf_write(file, data->ptr, data->size);
+	header.signature = htonl(INDEX_HEADER_SIG);
+	header.version = htonl(index_version_number);
+	header.entry_count = htonl((uint32_t)entry_count);
+
+	return git_filebuf_write(file, &header, sizeof(struct index_header));
 }
 
-static int create_name_extension_data(git_buf *name_buf, git_index_name_entry *conflict_name)
+static void clear_shared(git_index *index)
 {
-	int error = 0;
+	git_index_entry *entry;
+	size_t i;
 
-	if (conflict_name->ancestor == NULL)
-		error = git_buf_put(name_buf, "\0", 1);
-	else
-		error = git_buf_put(name_buf, conflict_name->ancestor, strlen(conflict_name->ancestor) + 1);
+	git_vector_foreach(&index->entries, i, entry)
+		((struct entry_internal *)entry)->shared_pos = 0;
 
-	if (error != 0)
-		goto on_error;
+	memset(&index->shared_id, 0, sizeof(git_oid));
+	index->shared_count = 0;
+}
 
-	if (conflict_name->ours == NULL)
-		error = git_buf_put(name_buf, "\0", 1);
-	else
-		error = git_buf_put(name_buf, conflict_name->ours, strlen(conflict_name->ours) + 1);
+struct shared_expire {
+	const git_oid *keep;
+	git_time_t expire;
+};
 
-	if (error != 0)
-		goto on_error;
+static int expire_shared_index(void *payload, git_buf *path)
+{
+	struct shared_expire *data = payload;
+	const char *filename = path->ptr + git_path_basename_offset(path);
+	char hex[GIT_OID_HEXSZ + 1];
+	struct stat st;
 
-	if (conflict_name->theirs == NULL)
-		error = git_buf_put(name_buf, "\0", 1);
-	else
-		error = git_buf_put(name_buf, conflict_name->theirs, strlen(conflict_name->theirs) + 1);
+	if (git__prefixcmp(filename, INDEX_SHARED_PREFIX) != 0 ||
+	    strlen(filename) != CONST_STRLEN(INDEX_SHARED_PREFIX) + GIT_OID_HEXSZ)
+		return 0;
 
-on_error:
-	return error;
+	git_oid_tostr(hex, sizeof(hex), data->keep);
+
+	if (strcmp(filename + CONST_STRLEN(INDEX_SHARED_PREFIX), hex) != 0 &&
+	    p_stat(path->ptr, &st) == 0 && st.st_mtime < data->expire)
+		p_unlink(path->ptr);
+
+	return 0;
 }
 
-static int write_name_extension(git_index *index, git_filebuf *file)
+/*
+ * Remove the shared indexes that no split index used since
+ * `splitIndex.sharedIndexExpire`; the ones in use are freshened
+ * whenever their split index is written.
+ */
+static void expire_shared_indexes(git_index *index)
 {
-	git_buf name_buf = GIT_BUF_INIT;
-	git_vector *out = &index->names;
-	git_index_name_entry *conflict_name;
-	struct index_extension extension;
-	size_t i;
-	int error = 0;
+	struct shared_expire data;
+	git_repository *repo = INDEX_OWNER(index);
+	git_config *cfg;
+	git_buf dir = GIT_BUF_INIT;
+	char *expire = NULL;
 
-	git_vector_foreach(out, i, conflict_name) {
-		if ((error = create_name_extension_data(&name_buf, conflict_name)) < 0)
-			goto done;
-	}
+	if (!repo || git_repository_config__weakptr(&cfg, repo) < 0)
+		goto done;
 
-	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_CONFLICT_NAME_SIG, 4);
-	extension.extension_size = (uint32_t)name_buf.size;
+	expire = git_config__get_string_force(cfg,
+		"splitindex.sharedindexexpire", "2.weeks.ago");
 
-	error = write_extension(file, &extension, &name_buf);
+	if (!expire || !strcmp(expire, "never") ||
+	    git__date_parse(&data.expire, expire) < 0)
+		goto done;
 
-	git_buf_dispose(&name_buf);
+	data.keep = &index->shared_id;
+
+	if (git_path_dirname_r(&dir, index->index_file_path) < 0)
+		goto done;
+
+	git_path_direach(&dir, 0, expire_shared_index, &data);
 
 done:
-	return error;
+	git_error_clear();
+	git__free(expire);
+	git_buf_dispose(&dir);
 }
 
-static int create_reuc_extension_data(git_buf *reuc_buf, git_index_reuc_entry *reuc)
+/*
+ * Write all the entries to a new shared index, which is named after its
+ * checksum and lives next to the index.
+ */
+static int write_shared_index(git_index *index)
 {
-	int i;
-	int error = 0;
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf path = GIT_BUF_INIT;
+	git_oid checksum;
+	size_t entries_end;
+	int error;
 
-	if ((error = git_buf_put(reuc_buf, reuc->path, strlen(reuc->path) + 1)) < 0)
-		return error;
+	if ((error = git_path_dirname_r(&path, index->index_file_path)) < 0 ||
+	    (error = git_buf_joinpath(&path, path.ptr, "sharedindex")) < 0 ||
+	    (error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_HASH_CONTENTS, GIT_INDEX_FILE_MODE)) < 0)
+		goto done;
 
-	for (i = 0; i < 3; i++) {
-		if ((error = git_buf_printf(reuc_buf, "%o", reuc->mode[i])) < 0 ||
-			(error = git_buf_put(reuc_buf, "\0", 1)) < 0)
-			return error;
-	}
+	if ((error = write_index_header(index, &file, index->entries.length)) < 0 ||
+	    (error = write_entries(&entries_end, index, &file, NULL, NULL,
+			INDEX_WRITE_SHARED)) < 0)
+		goto done;
 
-	for (i = 0; i < 3; i++) {
-		if (reuc->mode[i] && (error = git_buf_put(reuc_buf, (char *)&reuc->oid[i].id, GIT_OID_RAWSZ)) < 0)
-			return error;
-	}
+	git_filebuf_hash(&checksum, &file);
+
+	if ((error = git_filebuf_write(&file, checksum.id, GIT_OID_RAWSZ)) < 0 ||
+	    (error = shared_index_path(&path, index, &checksum)) < 0 ||
+	    (error = git_filebuf_commit_at(&file, path.ptr)) < 0)
+		goto done;
+
+	git_oid_cpy(&index->shared_id, &checksum);
+	index->shared_count = index->entries.length;
+
+	expire_shared_indexes(index);
+
+done:
+	if (error < 0)
+		clear_shared(index);
+
+	git_filebuf_cleanup(&file);
+	git_buf_dispose(&path);
+	return error;
+}
+
+/*
+ * Whether to split the index, as asked by `core.splitIndex`; when it is
+ * not set, an index stays split if it was.
+ */
+static int index_should_split(bool *out, git_index *index)
+{
+	git_repository *repo = INDEX_OWNER(index);
+	int split = GIT_SPLITINDEX_DEFAULT;
+
+	if (repo && git_repository__cvar(&split, repo, GIT_CVAR_SPLITINDEX) < 0)
+		return -1;
+
+	if (split == GIT_SPLITINDEX_UNSET)
+		*out = !git_oid_iszero(&index->shared_id);
+	else
+		*out = (split == GIT_SPLITINDEX_TRUE);
 
 	return 0;
 }
 
-static int write_reuc_extension(git_index *index, git_filebuf *file)
+/*
+ * Whether too many entries are missing from the shared index, as set by
+ * `splitIndex.maxPercentChange`, so that a new one should be written.
+ */
+static int too_many_not_shared(bool *out, git_index *index)
 {
-	git_buf reuc_buf = GIT_BUF_INIT;
-	git_vector *out = &index->reuc;
-	git_index_reuc_entry *reuc;
-	struct index_extension extension;
-	size_t i;
-	int error = 0;
+	git_repository *repo = INDEX_OWNER(index);
+	int max_change = GIT_SPLITINDEXMAXCHANGE_DEFAULT;
+	git_index_entry *entry;
+	size_t i, not_shared = 0;
 
-	git_vector_foreach(out, i, reuc) {
-		if ((error = create_reuc_extension_data(&reuc_buf, reuc)) < 0)
-			goto done;
-	}
+	if (repo && git_repository__cvar(&max_change, repo, GIT_CVAR_SPLITINDEXMAXCHANGE) < 0)
+		return -1;
 
-	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_UNMERGED_SIG, 4);
-	extension.extension_size = (uint32_t)reuc_buf.size;
+	if (max_change < 0 || max_change > 100)
+		max_change = GIT_SPLITINDEXMAXCHANGE_DEFAULT;
 
-	error = write_extension(file, &extension, &reuc_buf);
+	git_vector_foreach(&index->entries, i, entry) {
+		if (((struct entry_internal *)entry)->shared_pos == 0)
+			not_shared++;
+	}
 
-	git_buf_dispose(&reuc_buf);
+	*out = (max_change == 0) ||
+		(max_change < 100 &&
+		 not_shared * 100 > index->entries.length * (size_t)max_change);
 
-done:
-	return error;
+	return 0;
 }
 
-static int write_tree_extension(git_index *index, git_filebuf *file)
+/*
+ * Get ready to write a split index, writing a new shared index when the
+ * current one is missing or too many entries changed since it was.
+ */
+static int prepare_split_index(git_index *index)
 {
-	struct index_extension extension;
-	git_buf buf = GIT_BUF_INIT;
-	int error;
-
-	if (index->tree == NULL)
-		return 0;
-
-	if ((error = git_tree_cache_write(&buf, index->tree)) < 0)
-		return error;
+	git_buf path = GIT_BUF_INIT;
+	bool rewrite = true;
+	int error = 0;
 
-	memset(&extension, 0x0, sizeof(struct index_extension));
-	memcpy(&extension.signature, INDEX_EXT_TREECACHE_SIG, 4);
-	extension.extension_size = (uint32_t)buf.size;
+	if (!git_oid_iszero(&index->shared_id)) {
+		if ((error = too_many_not_shared(&rewrite, index)) < 0)
+			goto done;
 
-	error = write_extension(file, &extension, &buf);
+		/* keep the shared index from expiring while it is in use */
+		if (!rewrite &&
+		    ((error = shared_index_path(&path, index, &index->shared_id)) < 0 ||
+		     p_utimes(path.ptr, NULL) < 0))
+			rewrite = true;
+	}
 
-	git_buf_dispose(&buf);
+	if (rewrite) {
+		clear_shared(index);
+		error = write_shared_index(index);
+	}
 
+done:
+	git_buf_dispose(&path);
 	return error;
 }
 
@@ -2991,40 +4599,93 @@ static void clear_uptodate(git_index *index)
 static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 {
 	git_oid hash_final;
-	struct index_header header;
-	bool is_extended;
-	uint32_t index_version_number;
+	git_repository *repo = INDEX_OWNER(index);
+	int record_eoie = 0, record_ieot = 0;
+	index_entry_blocks blocks = GIT_ARRAY_INIT;
+	git_bitmap fsmonitor_dirty = GIT_BITMAP_INIT;
+	git_buf eoie_headers = GIT_BUF_INIT, *headers = NULL;
+	size_t entries_end, entry_count, i;
+	bool record_fsmonitor, split;
+	index_write_t mode = INDEX_WRITE_ALL;
+	git_index_entry *entry;
+	int error = -1;
 
 	assert(index && file);
 
-	if (index->version <= INDEX_VERSION_NUMBER_EXT)  {
-		is_extended = is_index_extended(index);
-		index_version_number = is_extended ? INDEX_VERSION_NUMBER_EXT : INDEX_VERSION_NUMBER_LB;
-	} else {
-		index_version_number = index->version;
+	if (repo &&
+	    (git_repository__cvar(&record_eoie, repo, GIT_CVAR_INDEXRECORDEOIE) < 0 ||
+	     git_repository__cvar(&record_ieot, repo, GIT_CVAR_INDEXRECORDIEOT) < 0))
+		return -1;
+
+	/* the offset table is only found through the end of index entries */
+	if (record_ieot)
+		record_eoie = 1;
+
+	/* what the filesystem monitor knew is only kept while we have it */
+	record_fsmonitor = (repo && repo->fsmonitor && index->fsmonitor_token);
+
+	if (index_should_split(&split, index) < 0)
+		goto done;
+
+	if (!split)
+		clear_shared(index);
+	else if (prepare_split_index(index) < 0)
+		goto done;
+	else
+		mode = INDEX_WRITE_SPLIT;
+
+	entry_count = index->entries.length;
+
+	if (mode == INDEX_WRITE_SPLIT) {
+		git_vector_foreach(&index->entries, i, entry) {
+			if (((struct entry_internal *)entry)->shared_pos)
+				entry_count--;
+		}
 	}
 
-	header.signature = htonl(INDEX_HEADER_SIG);
-	header.version = htonl(index_version_number);
-	header.entry_count = htonl((uint32_t)index->entries.length);
+	if (write_index_header(index, file, entry_count) < 0)
+		goto done;
 
-	if (git_filebuf_write(file, &header, sizeof(struct index_header)) < 0)
-		return -1;
+	if (write_entries(&entries_end, index, file, record_ieot ? &blocks : NULL,
+			record_fsmonitor ? &fsmonitor_dirty : NULL, mode) < 0)
+		goto done;
 
-	if (write_entries(index, file) < 0)
-		return -1;
+	if (record_eoie && git__is_uint32(entries_end))
+		headers = &eoie_headers;
+
+	/* write the link to the shared index */
+	if (mode == INDEX_WRITE_SPLIT && write_link_extension(index, file, headers) < 0)
+		goto done;
+
+	/* write the index entry offset table extension */
+	if (headers && git_array_size(blocks) > 1 &&
+	    write_offset_table_extension(file, headers, &blocks) < 0)
+		goto done;
 
 	/* write the tree cache extension */
-	if (index->tree != NULL && write_tree_extension(index, file) < 0)
-		return -1;
+	if (index->tree != NULL && write_tree_extension(index, file, headers) < 0)
+		goto done;
 
 	/* write the rename conflict extension */
-	if (index->names.length > 0 && write_name_extension(index, file) < 0)
-		return -1;
+	if (index->names.length > 0 && write_name_extension(index, file, headers) < 0)
+		goto done;
 
 	/* write the reuc extension */
-	if (index->reuc.length > 0 && write_reuc_extension(index, file) < 0)
-		return -1;
+	if (index->reuc.length > 0 && write_reuc_extension(index, file, headers) < 0)
+		goto done;
+
+	/* write the untracked cache extension */
+	if (index->untracked && write_untracked_extension(index, file, headers) < 0)
+		goto done;
+
+	/* write the filesystem monitor extension */
+	if (record_fsmonitor &&
+	    write_fsmonitor_extension(index, file, headers, &fsmonitor_dirty) < 0)
+		goto done;
+
+	/* write the end of index entries extension */
+	if (headers && write_end_of_entries_extension(file, headers, entries_end) < 0)
+		goto done;
 
 	/* get out the hash for all the contents we've appended to the file */
 	git_filebuf_hash(&hash_final, file);
@@ -3032,12 +4693,22 @@ static int write_index(git_oid *checksum, git_index *index, git_filebuf *file)
 
 	/* write it at the end of the file */
 	if (git_filebuf_write(file, hash_final.id, GIT_OID_RAWSZ) < 0)
-		return -1;
+		goto done;
 
 	/* file entries are no longer up to date */
 	clear_uptodate(index);
 
-	return 0;
+	if (index->untracked)
+		index->untracked->dirty = 0;
+
+	index->fsmonitor_changed = 0;
+	error = 0;
+
+done:
+	git_array_clear(blocks);
+	git_bitmap_dispose(&fsmonitor_dirty);
+	git_buf_dispose(&eoie_headers);
+	return error;
 }
 
 int git_index_entry_stage(const git_index_entry *entry)
@@ -3123,6 +4794,9 @@ int git_index_read_tree(git_index *index, const git_tree *tree)
 	index->tree = NULL;
 	git_pool_clear(&index->tree_pool);
 
+	git_untracked_cache_free(index->untracked);
+	index->untracked = NULL;
+
 	git_vector_sort(&index->entries);
 
 	if ((error = git_tree_walk(tree, GIT_TREEWALK_POST, read_tree_cb, &data)) < 0)
@@ -3258,6 +4932,9 @@ static int git_index_read_iterator(
 		if (dup_entry && !remove_entry && index->tree)
 			git_tree_cache_invalidate_path(index->tree, dup_entry->path);
 
+		if (dup_entry && !remove_entry)
+			git_untracked_cache_invalidate_path(index->untracked, dup_entry->path);
+
 		if (add_entry) {
 			if ((error = git_vector_insert(&new_entries, add_entry)) == 0)
 				INSERT_IN_MAP_EX(index, new_entries_map, add_entry, error);
@@ -3294,6 +4971,7 @@ static int git_index_read_iterator(
 		if (index->tree)
 			git_tree_cache_invalidate_path(index->tree, entry->path);
 
+		git_untracked_cache_invalidate_path(index->untracked, entry->path);
 		index_entry_free(entry);
 	}
 
@@ -14,6 +14,7 @@
 #include "vector.h"
 #include "idxmap.h"
 #include "tree-cache.h"
+#include "untracked-cache.h"
 #include "git2/odb.h"
 #include "git2/index.h"
 
@@ -22,6 +23,12 @@
 
 extern bool git_index__enforce_unsaved_safety;
 
+/* Number of entries in each block of a written index entry offset table */
+extern size_t git_index__offset_table_block_size;
+
+/* Number of threads reading the entries of such blocks, 0 for the CPUs */
+extern unsigned int git_index__read_threads;
+
 struct git_index {
 	git_refcount rc;
 
@@ -44,6 +51,16 @@ struct git_index {
 	git_tree_cache *tree;
 	git_pool tree_pool;
 
+	git_untracked_cache *untracked;
+
+	/* the shared index that a split index was read from or written to */
+	git_oid shared_id;
+	size_t shared_count;
+
+	/* the token of the filesystem monitor that the entries are valid for */
+	char *fsmonitor_token;
+	unsigned int fsmonitor_changed:1;
+
 	git_vector names;
 	git_vector reuc;
 
@@ -138,6 +155,21 @@ GIT_INLINE(const git_futils_filestamp *) git_index__filestamp(git_index *index)
 
 extern int git_index__changed_relative_to(git_index *index, const git_oid *checksum);
 
+/*
+ * Get the untracked cache of the index to use with the working directory,
+ * creating or dropping it according to `core.untrackedCache`.  Gives NULL
+ * when there is no usable cache.
+ */
+extern int git_index__untracked_cache(git_untracked_cache **out, git_index *index);
+
+/*
+ * Ask the filesystem monitor of the repository which entries changed
+ * since the index was last refreshed, so that the others can be trusted
+ * to match the working directory.  `valid` is set when the entries that
+ * have `GIT_INDEX_ENTRY_FSMONITOR_VALID` can be trusted.
+ */
+extern int git_index__fsmonitor_refresh(bool *valid, git_index *index);
+
 /* Copy the current entries vector *and* increment the index refcount.
  * Call `git_index__release_snapshot` when done.
  */
@@ -24,8 +24,6 @@
 #include "zstream.h"
 #include "object.h"
 
-extern git_mutex git__mwindow_mutex;
-
 size_t git_indexer__max_objects = UINT32_MAX;
 
 #define UINT31_MAX (0x7FFFFFFF)
@@ -47,6 +45,7 @@ struct git_indexer {
 	struct git_pack_header hdr;
 	struct git_pack_file *pack;
 	unsigned int mode;
+	unsigned int nr_threads;
 	git_off_t off;
 	git_off_t entry_start;
 	git_object_t entry_type;
@@ -62,6 +61,9 @@ struct git_indexer {
 	void *progress_payload;
 	char objbuf[8*1024];
 
+	/* Set while appended data is being indexed in the background */
+	struct indexer_pipeline *pipeline;
+
 	/* OIDs referenced from pack objects. Used for verification. */
 	git_oidmap *expected_oids;
 
@@ -76,8 +78,69 @@ struct git_indexer {
 
 struct delta_info {
 	git_off_t delta_off;
+	git_off_t delta_end;
+};
+
+#ifdef GIT_THREADS
+
+/*
+ * In pipelined mode, `git_indexer_append` only copies the data into a
+ * ring buffer.  A writer thread appends it to the packfile and feeds
+ * the trailer hash, while a parser thread follows it through the file,
+ * inflating, hashing and checksumming the objects.  Everything below
+ * `lock` is protected by it.
+ */
+struct indexer_pipeline {
+	git_thread writer;
+	git_thread parser;
+
+	/* Owned by the parser thread */
+	git_indexer_progress stats;
+
+	git_mutex lock;
+	git_cond space_cond;   /* signalled when the ring buffer drains */
+	git_cond data_cond;    /* signalled when the ring buffer fills */
+	git_cond written_cond; /* signalled when the packfile grows */
+
+	unsigned char *ring;
+	size_t ring_size, head, used;
+
+	/* How much of the packfile the writer has written */
+	git_off_t written;
+
+	/* The latest progress of the parser, and whether it was reported */
+	git_indexer_progress progress;
+	unsigned int progress_pending :1;
+
+	unsigned int finished :1,
+		writer_done :1,
+		stop :1;
+
+	/* The first error hit by either thread */
+	int error;
+	int error_class;
+	char *error_msg;
 };
 
+static int pipeline_start(git_indexer *idx, size_t buffer_size);
+
+static int pipeline_publish(
+	struct indexer_pipeline *pipe, const git_indexer_progress *stats)
+{
+	if (git_mutex_lock(&pipe->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock indexer pipeline");
+		return -1;
+	}
+
+	memcpy(&pipe->progress, stats, sizeof(pipe->progress));
+	pipe->progress_pending = 1;
+
+	git_mutex_unlock(&pipe->lock);
+	return 0;
+}
+
+#endif
+
 const git_oid *git_indexer_hash(const git_indexer *idx)
 {
 	return &idx->hash;
@@ -160,6 +223,12 @@ int git_indexer_new(
 
 	idx->do_verify = opts.verify;
 
+#ifdef GIT_THREADS
+	idx->nr_threads = opts.threads ? opts.threads : 1;
+#else
+	idx->nr_threads = 1;
+#endif
+
 	if (git_repository__fsync_gitdir)
 		idx->do_fsync = 1;
 
@@ -182,6 +251,14 @@ int git_indexer_new(
 	if ((error = git_mwindow_file_register(&idx->pack->mwf)) < 0)
 		goto cleanup;
 
+#ifdef GIT_THREADS
+	if (opts.pipeline_buffer_size &&
+	    pipeline_start(idx, opts.pipeline_buffer_size) < 0) {
+		git_indexer_free(idx);
+		return -1;
+	}
+#endif
+
 	*out = idx;
 	return 0;
 
@@ -214,6 +291,7 @@ static int store_delta(git_indexer *idx)
 	delta = git__calloc(1, sizeof(struct delta_info));
 	GIT_ERROR_CHECK_ALLOC(delta);
 	delta->delta_off = idx->entry_start;
+	delta->delta_end = idx->off;
 
 	if (git_vector_insert(&idx->deltas, delta) < 0)
 		return -1;
@@ -424,7 +502,11 @@ static int store_object(git_indexer *idx)
 	pentry = git__calloc(1, sizeof(struct git_pack_entry));
 	GIT_ERROR_CHECK_ALLOC(pentry);
 
-	git_hash_final(&oid, &idx->hash_ctx);
+	if (git_hash_final(&oid, &idx->hash_ctx) < 0) {
+		git__free(pentry);
+		goto on_error;
+	}
+
 	entry_size = idx->off - entry_start;
 	if (entry_start > UINT31_MAX) {
 		entry->offset = UINT32_MAX;
@@ -552,6 +634,12 @@ on_error:
 
 static int do_progress_callback(git_indexer *idx, git_indexer_progress *stats)
 {
+#ifdef GIT_THREADS
+	/* The parser thread leaves it to the appending thread to report */
+	if (idx->pipeline)
+		return pipeline_publish(idx->pipeline, stats);
+#endif
+
 	if (idx->progress_cb)
 		return git_error_set_after_callback_function(
 			idx->progress_cb(stats, idx->progress_payload),
@@ -631,13 +719,13 @@ static int write_at(git_indexer *idx, const void *data, git_off_t offset, size_t
 	return 0;
 }
 
-static int append_to_pack(git_indexer *idx, const void *data, size_t size)
+static int append_to_pack(
+	git_indexer *idx, git_off_t current_size, const void *data, size_t size)
 {
 	git_off_t new_size;
 	size_t mmap_alignment;
 	size_t page_offset;
 	git_off_t page_start;
-	git_off_t current_size = idx->pack->mwf.size;
 	int fd = idx->pack->mwf.fd;
 	int error;
 
@@ -661,7 +749,7 @@ static int append_to_pack(git_indexer *idx, const void *data, size_t size)
 		return -1;
 	}
 
-	return write_at(idx, data, idx->pack->mwf.size, size);
+	return write_at(idx, data, current_size, size);
 }
 
 static int read_stream_object(git_indexer *idx, git_indexer_progress *stats)
@@ -753,22 +841,16 @@ static int read_stream_object(git_indexer *idx, git_indexer_progress *stats)
 	return 0;
 }
 
-int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_indexer_progress *stats)
+/*
+ * Index whatever complete objects the first `mwf.size` bytes of the
+ * packfile hold that have not been indexed yet.
+ */
+static int parse_pack(git_indexer *idx, git_indexer_progress *stats)
 {
 	int error = -1;
 	struct git_pack_header *hdr = &idx->hdr;
 	git_mwindow_file *mwf = &idx->pack->mwf;
 
-	assert(idx && data && stats);
-
-	if ((error = append_to_pack(idx, data, size)) < 0)
-		return error;
-
-	hash_partially(idx, data, (int)size);
-
-	/* Make sure we set the new size of the pack */
-	idx->pack->mwf.size += size;
-
 	if (!idx->parsed_header) {
 		unsigned int total_objects;
 
@@ -831,6 +913,321 @@ on_error:
 	return error;
 }
 
+#ifdef GIT_THREADS
+
+/* Record the first error of a pipeline thread and stop the others */
+static void pipeline_fail(struct indexer_pipeline *pipe, int error)
+{
+	const git_error *e = git_error_last();
+
+	if (!pipe->error) {
+		pipe->error = error;
+		pipe->error_class = e ? e->klass : GIT_ERROR_INDEXER;
+		pipe->error_msg = git__strdup(e ? e->message : "indexer pipeline failed");
+	}
+
+	git_cond_signal(&pipe->space_cond);
+	git_cond_signal(&pipe->data_cond);
+	git_cond_signal(&pipe->written_cond);
+}
+
+static void *pipeline_writer(void *arg)
+{
+	git_indexer *idx = arg;
+	struct indexer_pipeline *pipe = idx->pipeline;
+	size_t tail, len;
+	int error;
+
+	if (git_mutex_lock(&pipe->lock) < 0)
+		return NULL;
+
+	while (1) {
+		while (!pipe->used && !pipe->finished && !pipe->stop && !pipe->error)
+			git_cond_wait(&pipe->data_cond, &pipe->lock);
+
+		if (pipe->stop || pipe->error || !pipe->used)
+			break;
+
+		tail = (pipe->head + pipe->ring_size - pipe->used) % pipe->ring_size;
+		len = min(pipe->used, pipe->ring_size - tail);
+
+		/* The appender does not touch the used part of the ring */
+		git_mutex_unlock(&pipe->lock);
+
+		error = append_to_pack(idx, pipe->written, pipe->ring + tail, len);
+		if (!error)
+			hash_partially(idx, pipe->ring + tail, len);
+
+		git_mutex_lock(&pipe->lock);
+
+		if (error < 0) {
+			pipeline_fail(pipe, error);
+			break;
+		}
+
+		pipe->used -= len;
+		pipe->written += len;
+
+		git_cond_signal(&pipe->space_cond);
+		git_cond_signal(&pipe->written_cond);
+	}
+
+	pipe->writer_done = 1;
+	git_cond_signal(&pipe->written_cond);
+	git_mutex_unlock(&pipe->lock);
+
+	return NULL;
+}
+
+static void *pipeline_parser(void *arg)
+{
+	git_indexer *idx = arg;
+	struct indexer_pipeline *pipe = idx->pipeline;
+	git_off_t written;
+	int error;
+
+	while (1) {
+		if (git_mutex_lock(&pipe->lock) < 0)
+			break;
+
+		while (pipe->written == idx->pack->mwf.size &&
+		       !pipe->writer_done && !pipe->stop && !pipe->error)
+			git_cond_wait(&pipe->written_cond, &pipe->lock);
+
+		written = pipe->written;
+
+		if (pipe->stop || pipe->error || written == idx->pack->mwf.size) {
+			git_mutex_unlock(&pipe->lock);
+			break;
+		}
+
+		git_mutex_unlock(&pipe->lock);
+
+		idx->pack->mwf.size = written;
+
+		if ((error = parse_pack(idx, &pipe->stats)) < 0) {
+			git_mutex_lock(&pipe->lock);
+			pipeline_fail(pipe, error);
+			git_mutex_unlock(&pipe->lock);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int pipeline_start(git_indexer *idx, size_t buffer_size)
+{
+	struct indexer_pipeline *pipe;
+
+	pipe = git__calloc(1, sizeof(struct indexer_pipeline));
+	GIT_ERROR_CHECK_ALLOC(pipe);
+
+	pipe->ring_size = buffer_size;
+	pipe->ring = git__malloc(buffer_size);
+
+	if (!pipe->ring) {
+		git__free(pipe);
+		return -1;
+	}
+
+	/* without the means to synchronise, index on the calling thread */
+	if (git_mutex_init(&pipe->lock) < 0)
+		goto on_init_error;
+
+	if (git_cond_init(&pipe->space_cond) < 0)
+		goto on_mutex_error;
+
+	if (git_cond_init(&pipe->data_cond) < 0)
+		goto on_space_error;
+
+	if (git_cond_init(&pipe->written_cond) < 0)
+		goto on_data_error;
+
+	idx->pipeline = pipe;
+
+	if (git_thread_create(&pipe->writer, pipeline_writer, idx) < 0)
+		goto on_error;
+
+	if (git_thread_create(&pipe->parser, pipeline_parser, idx) < 0) {
+		git_mutex_lock(&pipe->lock);
+		pipe->stop = 1;
+		git_cond_signal(&pipe->data_cond);
+		git_mutex_unlock(&pipe->lock);
+
+		git_thread_join(&pipe->writer, NULL);
+		goto on_error;
+	}
+
+	return 0;
+
+on_error:
+	git_error_set(GIT_ERROR_THREAD, "unable to create indexer thread");
+	git_cond_free(&pipe->space_cond);
+	git_cond_free(&pipe->data_cond);
+	git_cond_free(&pipe->written_cond);
+	git_mutex_free(&pipe->lock);
+	git__free(pipe->ring);
+	git__free(pipe);
+	idx->pipeline = NULL;
+	return -1;
+
+on_data_error:
+	git_cond_free(&pipe->data_cond);
+on_space_error:
+	git_cond_free(&pipe->space_cond);
+on_mutex_error:
+	git_mutex_free(&pipe->lock);
+on_init_error:
+	git__free(pipe->ring);
+	git__free(pipe);
+	return 0;
+}
+
+/* Report an error of the pipeline threads on the calling thread */
+static int pipeline_error(struct indexer_pipeline *pipe)
+{
+	if (pipe->error_msg)
+		git_error_set_str(pipe->error_class, pipe->error_msg);
+	else
+		git_error_set_oom();
+
+	return pipe->error;
+}
+
+/*
+ * Give the counters the indexer keeps to the caller's progress, which
+ * also holds counters of the caller's own, and tell it about them.
+ */
+static int pipeline_report(
+	git_indexer *idx, git_indexer_progress *stats, const git_indexer_progress *progress)
+{
+	stats->total_objects = progress->total_objects;
+	stats->indexed_objects = progress->indexed_objects;
+	stats->received_objects = progress->received_objects;
+	stats->local_objects = progress->local_objects;
+	stats->total_deltas = progress->total_deltas;
+	stats->indexed_deltas = progress->indexed_deltas;
+
+	if (idx->progress_cb)
+		return git_error_set_after_callback_function(
+			idx->progress_cb(stats, idx->progress_payload),
+			"indexer progress");
+
+	return 0;
+}
+
+static int pipeline_append(
+	git_indexer *idx, const unsigned char *data, size_t size, git_indexer_progress *stats)
+{
+	struct indexer_pipeline *pipe = idx->pipeline;
+	git_indexer_progress progress;
+	bool pending;
+	size_t len;
+
+	if (git_mutex_lock(&pipe->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock indexer pipeline");
+		return -1;
+	}
+
+	while (size && !pipe->error) {
+		while (pipe->used == pipe->ring_size && !pipe->error)
+			git_cond_wait(&pipe->space_cond, &pipe->lock);
+
+		if (pipe->error)
+			break;
+
+		len = min(size, pipe->ring_size - pipe->used);
+		len = min(len, pipe->ring_size - pipe->head);
+
+		/* The writer does not touch the free part of the ring */
+		git_mutex_unlock(&pipe->lock);
+		memcpy(pipe->ring + pipe->head, data, len);
+		git_mutex_lock(&pipe->lock);
+
+		pipe->head = (pipe->head + len) % pipe->ring_size;
+		pipe->used += len;
+		data += len;
+		size -= len;
+
+		git_cond_signal(&pipe->data_cond);
+	}
+
+	if (pipe->error) {
+		git_mutex_unlock(&pipe->lock);
+		return pipeline_error(pipe);
+	}
+
+	pending = pipe->progress_pending;
+	memcpy(&progress, &pipe->progress, sizeof(progress));
+	pipe->progress_pending = 0;
+
+	git_mutex_unlock(&pipe->lock);
+
+	return pending ? pipeline_report(idx, stats, &progress) : 0;
+}
+
+/*
+ * Wait for the pipeline threads to be done with everything that was
+ * appended (or, if `stop` is set, to give up on it) and tear it down.
+ */
+static int pipeline_finish(git_indexer *idx, git_indexer_progress *stats, bool stop)
+{
+	struct indexer_pipeline *pipe = idx->pipeline;
+	int error = 0;
+
+	git_mutex_lock(&pipe->lock);
+	pipe->finished = 1;
+	pipe->stop = stop;
+	git_cond_signal(&pipe->data_cond);
+	git_cond_signal(&pipe->written_cond);
+	git_mutex_unlock(&pipe->lock);
+
+	git_thread_join(&pipe->writer, NULL);
+	git_thread_join(&pipe->parser, NULL);
+
+	/* The threads are gone; the parser's own counters are final */
+	if (pipe->error)
+		error = pipeline_error(pipe);
+	else if (stats)
+		error = pipeline_report(idx, stats, &pipe->stats);
+
+	git_cond_free(&pipe->space_cond);
+	git_cond_free(&pipe->data_cond);
+	git_cond_free(&pipe->written_cond);
+	git_mutex_free(&pipe->lock);
+	git__free(pipe->error_msg);
+	git__free(pipe->ring);
+	git__free(pipe);
+	idx->pipeline = NULL;
+
+	return error;
+}
+
+#endif
+
+int git_indexer_append(git_indexer *idx, const void *data, size_t size, git_indexer_progress *stats)
+{
+	int error;
+
+	assert(idx && data && stats);
+
+#ifdef GIT_THREADS
+	if (idx->pipeline)
+		return pipeline_append(idx, data, size, stats);
+#endif
+
+	if ((error = append_to_pack(idx, idx->pack->mwf.size, data, size)) < 0)
+		return error;
+
+	hash_partially(idx, data, (int)size);
+
+	/* Make sure we set the new size of the pack */
+	idx->pack->mwf.size += size;
+
+	return parse_pack(idx, stats);
+}
+
 static int index_path(git_buf *path, git_indexer *idx, const char *suffix)
 {
 	const char prefix[] = "pack-";
@@ -894,7 +1291,7 @@ static int inject_object(git_indexer *idx, git_oid *id)
 
 	/* Write out the object header */
 	hdr_len = git_packfile__object_header(hdr, len, git_odb_object_type(obj));
-	if ((error = append_to_pack(idx, hdr, hdr_len)) < 0)
+	if ((error = append_to_pack(idx, idx->pack->mwf.size, hdr, hdr_len)) < 0)
 		goto cleanup;
 
 	idx->pack->mwf.size += hdr_len;
@@ -904,7 +1301,7 @@ static int inject_object(git_indexer *idx, git_oid *id)
 		goto cleanup;
 
 	/* And then the compressed object */
-	if ((error = append_to_pack(idx, buf.ptr, buf.size)) < 0)
+	if ((error = append_to_pack(idx, idx->pack->mwf.size, buf.ptr, buf.size)) < 0)
 		goto cleanup;
 
 	idx->pack->mwf.size += buf.size;
@@ -913,7 +1310,7 @@ static int inject_object(git_indexer *idx, git_oid *id)
 
 	/* Write a fake trailer so the pack functions play ball */
 
-	if ((error = append_to_pack(idx, &foo, GIT_OID_RAWSZ)) < 0)
+	if ((error = append_to_pack(idx, idx->pack->mwf.size, &foo, GIT_OID_RAWSZ)) < 0)
 		goto cleanup;
 
 	idx->pack->mwf.size += GIT_OID_RAWSZ;
@@ -999,6 +1396,210 @@ static int fix_thin_pack(git_indexer *idx, git_indexer_progress *stats)
 	return 0;
 }
 
+#ifdef GIT_THREADS
+
+/*
+ * Deltas are handed out to the workers in batches of this many, which
+ * keeps neighbouring deltas, which tend to share bases, on one thread.
+ */
+#define RESOLVE_BATCH_SIZE 64
+
+enum resolve_state {
+	RESOLVE_PENDING = 0,
+	RESOLVE_DONE,
+	RESOLVE_FAILED
+};
+
+struct resolved_delta {
+	git_oid oid;
+	uint32_t crc;
+	enum resolve_state state;
+
+	/* why the delta failed, to be raised on the main thread */
+	git_error_state error;
+};
+
+struct resolve_round {
+	git_indexer *idx;
+	struct resolved_delta *results;
+	git_atomic next;
+	git_mutex verify_lock;
+};
+
+/*
+ * Unpack, hash and checksum one delta. This only reads from the pack
+ * and its object map, so it can run on any thread while the main
+ * thread waits; the results are merged afterwards by the main thread.
+ */
+static void resolve_one(struct resolve_round *round, size_t i)
+{
+	git_indexer *idx = round->idx;
+	struct delta_info *delta = git_vector_get(&idx->deltas, i);
+	struct resolved_delta *result = &round->results[i];
+	git_off_t off;
+	git_rawobj obj = {0};
+	int error;
+
+	if (!delta)
+		return;
+
+	off = delta->delta_off;
+	if ((error = git_packfile_unpack(&obj, idx->pack, &off)) < 0) {
+		/* a base we have not seen yet stays pending for the next round */
+		if (error == GIT_PASSTHROUGH)
+			git_error_clear();
+		else
+			goto out;
+
+		return;
+	}
+
+	if (idx->do_verify) {
+		if ((error = git_mutex_lock(&round->verify_lock)) < 0) {
+			git_error_set(GIT_ERROR_OS, "failed to lock indexer mutex");
+			goto out;
+		}
+
+		error = check_object_connectivity(idx, &obj);
+		git_mutex_unlock(&round->verify_lock);
+
+		if (error < 0)
+			goto out;
+	}
+
+	if ((error = git_odb__hashobj(&result->oid, &obj)) < 0 ||
+	    (error = crc_object(&result->crc, &idx->pack->mwf,
+			delta->delta_off, delta->delta_end - delta->delta_off)) < 0)
+		goto out;
+
+	result->state = RESOLVE_DONE;
+
+out:
+	if (error < 0) {
+		git_error_state_capture(&result->error, error);
+		result->state = RESOLVE_FAILED;
+	}
+
+	git__free(obj.data);
+}
+
+static void *resolve_worker(void *arg)
+{
+	struct resolve_round *round = arg;
+	size_t count = git_vector_length(&round->idx->deltas), start, i;
+
+	while ((start = (size_t)git_atomic_add(&round->next, RESOLVE_BATCH_SIZE) -
+			RESOLVE_BATCH_SIZE) < count) {
+		for (i = start; i < count && i < start + RESOLVE_BATCH_SIZE; i++)
+			resolve_one(round, i);
+	}
+
+	return NULL;
+}
+
+/*
+ * Resolve every delta whose base is available, spreading the work over
+ * `idx->nr_threads` threads, then record the resolved objects in order.
+ */
+static int resolve_round_threaded(
+	git_indexer *idx,
+	git_indexer_progress *stats,
+	int *progressed)
+{
+	struct resolve_round round;
+	git_thread *threads = NULL;
+	size_t count = git_vector_length(&idx->deltas), nr_threads, started = 0, i;
+	struct delta_info *delta;
+	int error = 0;
+
+	nr_threads = min(idx->nr_threads, (count + RESOLVE_BATCH_SIZE - 1) / RESOLVE_BATCH_SIZE);
+
+	memset(&round, 0, sizeof(round));
+	round.idx = idx;
+
+	round.results = git__calloc(count, sizeof(struct resolved_delta));
+	GIT_ERROR_CHECK_ALLOC(round.results);
+
+	if (git_mutex_init(&round.verify_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize indexer mutex");
+		git__free(round.results);
+		return -1;
+	}
+
+	/* This thread is one of the workers */
+	if (nr_threads > 1) {
+		threads = git__mallocarray(nr_threads - 1, sizeof(git_thread));
+		GIT_ERROR_CHECK_ALLOC(threads);
+
+		for (started = 0; started < nr_threads - 1; started++) {
+			if (git_thread_create(&threads[started], resolve_worker, &round) != 0)
+				break;
+		}
+	}
+
+	/* Work alongside the workers; this covers a failure to start them, too */
+	resolve_worker(&round);
+
+	for (i = 0; i < started; i++)
+		git_thread_join(&threads[i], NULL);
+
+	git__free(threads);
+	git_mutex_free(&round.verify_lock);
+
+	git_vector_foreach(&idx->deltas, i, delta) {
+		struct resolved_delta *result = &round.results[i];
+		struct git_pack_entry *pentry;
+		struct entry *entry;
+
+		if (!delta || result->state == RESOLVE_PENDING)
+			continue;
+
+		/* the first failure is the one we report */
+		if (result->state == RESOLVE_FAILED) {
+			error = result->error.error_code;
+			git_error_state_restore(&result->error);
+			break;
+		}
+
+		entry = git__calloc(1, sizeof(*entry));
+		pentry = git__calloc(1, sizeof(*pentry));
+		if (!entry || !pentry) {
+			git__free(entry);
+			git__free(pentry);
+			error = -1;
+			break;
+		}
+
+		git_oid_cpy(&entry->oid, &result->oid);
+		git_oid_cpy(&pentry->sha1, &result->oid);
+		entry->crc = result->crc;
+
+		if (save_entry(idx, entry, pentry, delta->delta_off) < 0) {
+			git__free(entry);
+			git__free(pentry);
+			continue;
+		}
+
+		stats->indexed_objects++;
+		stats->indexed_deltas++;
+		*progressed = 1;
+		if ((error = do_progress_callback(idx, stats)) < 0)
+			break;
+
+		/* remove from the list */
+		git_vector_set(NULL, &idx->deltas, i, NULL);
+		git__free(delta);
+	}
+
+	for (i = 0; i < count; i++)
+		git_error_state_free(&round.results[i].error);
+
+	git__free(round.results);
+	return error;
+}
+
+#endif
+
 static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 {
 	unsigned int i;
@@ -1009,6 +1610,24 @@ static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 	while (idx->deltas.length > 0) {
 		progressed = 0;
 		non_null = 0;
+
+#ifdef GIT_THREADS
+		if (idx->nr_threads > 1) {
+			git_vector_foreach(&idx->deltas, i, delta) {
+				if (delta) {
+					non_null = 1;
+					break;
+				}
+			}
+
+			if (non_null &&
+			    (error = resolve_round_threaded(idx, stats, &progressed)) < 0)
+				return error;
+
+			goto round_done;
+		}
+#endif
+
 		git_vector_foreach(&idx->deltas, i, delta) {
 			git_rawobj obj = {0};
 
@@ -1044,6 +1663,9 @@ static int resolve_deltas(git_indexer *idx, git_indexer_progress *stats)
 			git__free(delta);
 		}
 
+#ifdef GIT_THREADS
+round_done:
+#endif
 		/* if none were actually set, we're done */
 		if (!non_null)
 			break;
@@ -1109,6 +1731,11 @@ int git_indexer_commit(git_indexer *idx, git_indexer_progress *stats)
 	git_filebuf index_file = {0};
 	void *packfile_trailer;
 
+#ifdef GIT_THREADS
+	if (idx->pipeline && (error = pipeline_finish(idx, stats, false)) < 0)
+		return error;
+#endif
+
 	if (!idx->parsed_header) {
 		git_error_set(GIT_ERROR_INDEXER, "incomplete pack header");
 		return -1;
@@ -1312,6 +1939,11 @@ void git_indexer_free(git_indexer *idx)
 	if (idx == NULL)
 		return;
 
+#ifdef GIT_THREADS
+	if (idx->pipeline)
+		pipeline_finish(idx, NULL, true);
+#endif
+
 	if (idx->have_stream)
 		git_packfile_stream_dispose(&idx->stream);
 
@@ -1328,13 +1960,10 @@ void git_indexer_free(git_indexer *idx)
 
 	git_vector_free_deep(&idx->deltas);
 
-	if (!git_mutex_lock(&git__mwindow_mutex)) {
-		if (!idx->pack_committed)
-			git_packfile_close(idx->pack, true);
+	if (!idx->pack_committed)
+		git_packfile_close(idx->pack, true);
 
-		git_packfile_free(idx->pack);
-		git_mutex_unlock(&git__mwindow_mutex);
-	}
+	git_packfile_free(idx->pack);
 
 	iter = 0;
 	while (git_oidmap_iterate((void **) &value, idx->expected_oids, &iter, &key) == 0)
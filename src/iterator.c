@@ -1034,6 +1034,13 @@ typedef struct {
 	git_array_t(filesystem_iterator_frame) frames;
 	git_ignores ignores;
 
+	/* whether the untracked cache of the index is used and updated */
+	bool untracked_cache;
+	time_t untracked_cache_time;
+
+	/* whether the filesystem monitor vouches for valid index entries */
+	bool fsmonitor;
+
 	/* info about the current entry */
 	git_index_entry entry;
 	git_buf current_path;
@@ -1082,6 +1089,18 @@ static int filesystem_iterator_entry_cmp_icase(const void *_a, const void *_b)
 
 #define FILESYSTEM_MAX_DEPTH 100
 
+GIT_INLINE(git_dir_flag) entry_dir_flag(uint32_t mode)
+{
+#if defined(GIT_WIN32) && !defined(__MINGW32__)
+	return mode ?
+		(S_ISDIR(mode) ? GIT_DIR_FLAG_TRUE : GIT_DIR_FLAG_FALSE) :
+		GIT_DIR_FLAG_UNKNOWN;
+#else
+	GIT_UNUSED(mode);
+	return GIT_DIR_FLAG_UNKNOWN;
+#endif
+}
+
 /**
  * Figure out if an entry is a submodule.
  *
@@ -1326,66 +1345,111 @@ static int filesystem_iterator_entry_init(
 	return error;
 }
 
-static int filesystem_iterator_frame_push(
+static int filesystem_iterator_frame_add(
 	filesystem_iterator *iter,
-	filesystem_iterator_entry *frame_entry)
+	filesystem_iterator_frame *new_frame,
+	const char *path,
+	size_t path_len,
+	struct stat *statbuf,
+	bool dir_expected,
+	iterator_pathlist_search_t pathlist_match)
 {
-	filesystem_iterator_frame *new_frame = NULL;
-	git_path_diriter diriter = GIT_PATH_DIRITER_INIT;
-	git_buf root = GIT_BUF_INIT;
-	const char *path;
 	filesystem_iterator_entry *entry;
-	struct stat statbuf;
-	size_t path_len;
 	int error;
 
-	if (iter->frames.size == FILESYSTEM_MAX_DEPTH) {
-		git_error_set(GIT_ERROR_REPOSITORY,
-			"directory nesting too deep (%"PRIuZ")", iter->frames.size);
-		return -1;
-	}
+	iter->base.stat_calls++;
 
-	new_frame = git_array_alloc(iter->frames);
-	GIT_ERROR_CHECK_ALLOC(new_frame);
+	/* Ignore wacky things in the filesystem */
+	if (!S_ISDIR(statbuf->st_mode) &&
+		!S_ISREG(statbuf->st_mode) &&
+		!S_ISLNK(statbuf->st_mode) &&
+		statbuf->st_mode != GIT_FILEMODE_UNREADABLE)
+		return 0;
 
-	memset(new_frame, 0, sizeof(filesystem_iterator_frame));
+	if (filesystem_iterator_is_dot_git(iter, path, path_len))
+		return 0;
 
-	if (frame_entry)
-		git_buf_joinpath(&root, iter->root, frame_entry->path);
-	else
-		git_buf_puts(&root, iter->root);
+	/* convert submodules to GITLINK and remove trailing slashes */
+	if (S_ISDIR(statbuf->st_mode)) {
+		bool submodule = false;
 
-	if (git_buf_oom(&root)) {
-		error = -1;
-		goto done;
+		if ((error = filesystem_iterator_is_submodule(&submodule,
+				iter, path, path_len)) < 0)
+			return error;
+
+		if (submodule)
+			statbuf->st_mode = GIT_FILEMODE_COMMIT;
 	}
 
-	new_frame->path_len = frame_entry ? frame_entry->path_len : 0;
+	/* Ensure that the pathlist entry lines up with what we expected */
+	else if (dir_expected)
+		return 0;
 
-	/* Any error here is equivalent to the dir not existing, skip over it */
-	if ((error = git_path_diriter_init(
-			&diriter, root.ptr, iter->dirload_flags)) < 0) {
-		error = GIT_ENOTFOUND;
-		goto done;
-	}
+	if ((error = filesystem_iterator_entry_init(&entry,
+		iter, new_frame, path, path_len, statbuf, pathlist_match)) < 0)
+		return error;
 
-	if ((error = git_vector_init(&new_frame->entries, 64,
-			iterator__ignore_case(&iter->base) ?
-			filesystem_iterator_entry_cmp_icase :
-			filesystem_iterator_entry_cmp)) < 0)
-		goto done;
+	return git_vector_insert(&new_frame->entries, entry);
+}
 
-	git_pool_init(&new_frame->entry_pool, 1);
+/*
+ * Index entries that the filesystem monitor did not report as changed
+ * still match the file, whose stat data can be taken from them.
+ */
+static bool filesystem_iterator_fsmonitor_stat(
+	struct stat *out,
+	filesystem_iterator *iter,
+	const char *path,
+	size_t path_len)
+{
+	const git_index_entry *entry;
+	size_t pos;
 
-	/* check if this directory is ignored */
-	filesystem_iterator_frame_push_ignores(iter, frame_entry, new_frame);
+	if (!iter->fsmonitor ||
+		git_index_snapshot_find(&pos, &iter->index_snapshot,
+			iter->base.entry_srch, path, path_len, 0) < 0)
+		return false;
+
+	entry = git_vector_get(&iter->index_snapshot, pos);
 
-	while ((error = git_path_diriter_next(&diriter)) == 0) {
+	if (!(entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) ||
+		S_ISGITLINK(entry->mode) || memcmp(entry->path, path, path_len) != 0)
+		return false;
+
+	memset(out, 0, sizeof(struct stat));
+	out->st_mode = entry->mode;
+	out->st_size = entry->file_size;
+	out->st_ctime = entry->ctime.seconds;
+	out->st_mtime = entry->mtime.seconds;
+#if defined(GIT_USE_NSEC)
+	out->st_ctime_nsec = entry->ctime.nanoseconds;
+	out->st_mtime_nsec = entry->mtime.nanoseconds;
+#endif
+	out->st_dev = entry->dev;
+	out->st_ino = entry->ino;
+	out->st_uid = entry->uid;
+	out->st_gid = entry->gid;
+
+	return true;
+}
+
+static int filesystem_iterator_frame_load_dir(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *new_frame,
+	filesystem_iterator_entry *frame_entry,
+	git_path_diriter *diriter)
+{
+	const char *path;
+	struct stat statbuf;
+	size_t path_len;
+	int error;
+
+	while ((error = git_path_diriter_next(diriter)) == 0) {
 		iterator_pathlist_search_t pathlist_match = ITERATOR_PATHLIST_FULL;
 		bool dir_expected = false;
 
-		if ((error = git_path_diriter_fullpath(&path, &path_len, &diriter)) < 0)
-			goto done;
+		if ((error = git_path_diriter_fullpath(&path, &path_len, diriter)) < 0)
+			return error;
 
 		assert(path_len > iter->root_len);
 
@@ -1402,11 +1466,12 @@ static int filesystem_iterator_frame_push(
 			iter, frame_entry, path, path_len))
 			continue;
 
-		/* TODO: don't need to stat if assume unchanged for this path and
-		 * we have an index, we can just copy the data out of it.
+		/* files that the filesystem monitor did not see change need
+		 * not be stat'ed, the index has their data.
 		 */
-
-		if ((error = git_path_diriter_stat(&statbuf, &diriter)) < 0) {
+		if (filesystem_iterator_fsmonitor_stat(&statbuf, iter, path, path_len))
+			/* use it */;
+		else if ((error = git_path_diriter_stat(&statbuf, diriter)) < 0) {
 			/* file was removed between readdir and lstat */
 			if (error == GIT_ENOTFOUND)
 				continue;
@@ -1418,47 +1483,338 @@ static int filesystem_iterator_frame_push(
 			error = 0;
 		}
 
-		iter->base.stat_calls++;
+		if ((error = filesystem_iterator_frame_add(iter, new_frame,
+				path, path_len, &statbuf, dir_expected, pathlist_match)) < 0)
+			return error;
+	}
 
-		/* Ignore wacky things in the filesystem */
-		if (!S_ISDIR(statbuf.st_mode) &&
-			!S_ISREG(statbuf.st_mode) &&
-			!S_ISLNK(statbuf.st_mode) &&
-			statbuf.st_mode != GIT_FILEMODE_UNREADABLE)
-			continue;
+	return (error == GIT_ITEROVER) ? 0 : error;
+}
+
+static int filesystem_iterator_frame_add_cached(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *new_frame,
+	git_buf *path,
+	const git_buf *root,
+	const char *name,
+	size_t name_len)
+{
+	struct stat statbuf;
+	int error;
+
+	git_buf_clear(path);
+
+	if (git_buf_put(path, root->ptr, root->size) < 0 ||
+	    git_buf_put(path, name, name_len) < 0)
+		return -1;
+
+	if (filesystem_iterator_fsmonitor_stat(&statbuf, iter,
+			path->ptr + iter->root_len, path->size - iter->root_len))
+		/* use it */;
+	else if ((error = git_path_lstat(path->ptr, &statbuf)) < 0) {
+		/* file was removed since the directory was read */
+		if (error == GIT_ENOTFOUND)
+			return 0;
+
+		/* treat the file as unreadable */
+		memset(&statbuf, 0, sizeof(statbuf));
+		statbuf.st_mode = GIT_FILEMODE_UNREADABLE;
+	}
+
+	return filesystem_iterator_frame_add(iter, new_frame,
+		path->ptr + iter->root_len, path->size - iter->root_len,
+		&statbuf, false, ITERATOR_PATHLIST_FULL);
+}
+
+/*
+ * Load the entries of a directory whose untracked entries are cached
+ * without reading it: the tracked entries are those in the index.
+ */
+static int filesystem_iterator_frame_load_cached(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *new_frame,
+	git_untracked_cache_dir *cached,
+	const git_buf *root)
+{
+	const char *dir_path = root->ptr + iter->root_len, *name, *slash;
+	const char *last = NULL;
+	git_buf path = GIT_BUF_INIT;
+	git_index_entry *index_entry;
+	size_t pos, name_len, last_len = 0;
+	int error = 0;
+
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, dir_path, new_frame->path_len, 0);
+
+	while ((index_entry = git_vector_get(&iter->index_snapshot, pos++)) != NULL &&
+	       !iter->base.prefixcomp(index_entry->path, dir_path)) {
+		name = index_entry->path + new_frame->path_len;
+		slash = strchr(name, '/');
+		name_len = slash ? (size_t)(slash - name) : strlen(name);
 
-		if (filesystem_iterator_is_dot_git(iter, path, path_len))
+		/* entries of the same subdirectory are next to each other */
+		if (!name_len ||
+		    (last && last_len == name_len && !memcmp(last, name, name_len)))
 			continue;
 
-		/* convert submodules to GITLINK and remove trailing slashes */
-		if (S_ISDIR(statbuf.st_mode)) {
-			bool submodule = false;
+		last = name;
+		last_len = name_len;
+
+		if ((error = filesystem_iterator_frame_add_cached(iter,
+				new_frame, &path, root, name, name_len)) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(&cached->untracked, pos, name) {
+		name_len = strlen(name);
 
-			if ((error = filesystem_iterator_is_submodule(&submodule,
-					iter, path, path_len)) < 0)
+		if (name_len && name[name_len - 1] == '/')
+			name_len--;
+
+		if (name_len && (error = filesystem_iterator_frame_add_cached(iter,
+				new_frame, &path, root, name, name_len)) < 0)
+			goto done;
+	}
+
+	/* git does not list directories without untracked files in them */
+	if (iter->index->untracked->dir_flags ==
+			GIT_UNTRACKED_CACHE_DIR_FLAGS_HIDE_EMPTY) {
+		git_untracked_cache_dir *child;
+
+		git_vector_foreach(&cached->dirs, pos, child) {
+			if ((error = filesystem_iterator_frame_add_cached(iter,
+					new_frame, &path, root, child->name, strlen(child->name))) < 0)
 				goto done;
+		}
+	}
 
-			if (submodule)
-				statbuf.st_mode = GIT_FILEMODE_COMMIT;
+done:
+	git_buf_dispose(&path);
+	return error;
+}
+
+/* Whether the index has an entry at `path`, or under it */
+static bool filesystem_iterator_is_tracked(
+	filesystem_iterator *iter, git_buf *buf, const char *path, size_t path_len)
+{
+	git_index_entry *index_entry;
+	size_t pos;
+
+	if (path_len && path[path_len - 1] == '/')
+		path_len--;
+
+	git_buf_clear(buf);
+	git_buf_put(buf, path, path_len);
+	git_buf_putc(buf, '/');
+
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, buf->ptr, path_len, 0);
+
+	if ((index_entry = git_vector_get(&iter->index_snapshot, pos)) != NULL &&
+	    !iter->base.strncomp(index_entry->path, buf->ptr, path_len) &&
+	    index_entry->path[path_len] == '\0')
+		return true;
+
+	git_index_snapshot_find(&pos, &iter->index_snapshot,
+		iter->base.entry_srch, buf->ptr, path_len + 1, 0);
+
+	return (index_entry = git_vector_get(&iter->index_snapshot, pos)) != NULL &&
+		!iter->base.prefixcomp(index_entry->path, buf->ptr);
+}
+
+/* Record the untracked entries of a directory that was read */
+static int filesystem_iterator_frame_record(
+	filesystem_iterator *iter,
+	filesystem_iterator_frame *frame,
+	const char *dir_path,
+	const git_untracked_cache_stat *dir_st)
+{
+	git_vector untracked = GIT_VECTOR_INIT;
+	filesystem_iterator_entry *entry;
+	git_buf buf = GIT_BUF_INIT;
+	char *name;
+	size_t i;
+	int ignored, error = 0;
+
+	git_vector_foreach(&frame->entries, i, entry) {
+		if (filesystem_iterator_is_tracked(iter, &buf, entry->path, entry->path_len))
+			continue;
+
+		if (git_buf_oom(&buf)) {
+			error = -1;
+			goto done;
 		}
 
-		/* Ensure that the pathlist entry lines up with what we expected */
-		else if (dir_expected)
+		if ((error = git_ignore__lookup(&ignored, &iter->ignores, entry->path,
+				entry_dir_flag(git_futils_canonical_mode(entry->st.st_mode)))) < 0)
+			goto done;
+
+		if (ignored <= GIT_IGNORE_NOTFOUND)
+			ignored = frame->is_ignored;
+
+		if (ignored == GIT_IGNORE_TRUE)
 			continue;
 
-		if ((error = filesystem_iterator_entry_init(&entry,
-			iter, new_frame, path, path_len, &statbuf, pathlist_match)) < 0)
+		name = git__strdup(entry->path + frame->path_len);
+		GIT_ERROR_CHECK_ALLOC(name);
+
+		if ((error = git_vector_insert(&untracked, name)) < 0) {
+			git__free(name);
 			goto done;
+		}
+	}
+
+	error = git_untracked_cache_set(iter->index->untracked,
+		dir_path, dir_st, &untracked);
+
+done:
+	git_vector_foreach(&untracked, i, name)
+		git__free(name);
+
+	git_vector_free(&untracked);
+	git_buf_dispose(&buf);
+	return error;
+}
+
+/*
+ * Look up the untracked cache for a directory: either its entries can be
+ * taken from it, or they can be recorded in it once the directory is read.
+ */
+static int filesystem_iterator_frame_untracked(
+	git_untracked_cache_dir **cached,
+	bool *record,
+	git_untracked_cache_stat *dir_st,
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry,
+	const git_buf *root)
+{
+	git_untracked_cache *cache = iter->index->untracked;
+	const char *dir_path = root->ptr + iter->root_len;
+	git_untracked_cache_dir *dir;
+	git_buf ignore_path = GIT_BUF_INIT;
+	git_oid exclude_id;
+	struct stat st;
+	int error = 0;
+
+	*cached = NULL;
+	*record = false;
+
+	if (!cache)
+		return 0;
+
+	/* the stat of subdirectories was taken when reading their parent */
+	if (frame_entry)
+		memcpy(&st, &frame_entry->st, sizeof(struct stat));
+	else if (p_lstat(root->ptr, &st) < 0)
+		return 0;
+
+	git_untracked_cache_stat_init(dir_st, &st);
+
+	if ((error = git_buf_joinpath(&ignore_path, root->ptr, GIT_IGNORE_FILE)) < 0)
+		goto done;
 
-		git_vector_insert(&new_frame->entries, entry);
+	/* an unreadable ignore file leaves the cache alone */
+	if (git_untracked_cache_exclude_id(&exclude_id, ignore_path.ptr) < 0) {
+		git_error_clear();
+		goto done;
 	}
 
-	if (error == GIT_ITEROVER)
-		error = 0;
+	if ((error = git_untracked_cache_set_exclude_id(cache, dir_path, &exclude_id)) < 0)
+		goto done;
+
+	if ((dir = git_untracked_cache_get(cache, dir_path)) != NULL &&
+	    git_untracked_cache_stat_equal(&dir->stat, dir_st))
+		*cached = dir;
+
+	/*
+	 * a directory changed as recently as this iteration started may
+	 * change again without its timestamp changing; don't record it.
+	 */
+	else
+		*record = (st.st_mtime < iter->untracked_cache_time);
+
+done:
+	git_buf_dispose(&ignore_path);
+	return error;
+}
+
+static int filesystem_iterator_frame_push(
+	filesystem_iterator *iter,
+	filesystem_iterator_entry *frame_entry)
+{
+	filesystem_iterator_frame *new_frame = NULL;
+	git_path_diriter diriter = GIT_PATH_DIRITER_INIT;
+	git_buf root = GIT_BUF_INIT;
+	git_untracked_cache_dir *cached = NULL;
+	git_untracked_cache_stat cached_st;
+	bool record = false;
+	int error;
+
+	if (iter->frames.size == FILESYSTEM_MAX_DEPTH) {
+		git_error_set(GIT_ERROR_REPOSITORY,
+			"directory nesting too deep (%"PRIuZ")", iter->frames.size);
+		return -1;
+	}
+
+	new_frame = git_array_alloc(iter->frames);
+	GIT_ERROR_CHECK_ALLOC(new_frame);
+
+	memset(new_frame, 0, sizeof(filesystem_iterator_frame));
+
+	if (frame_entry)
+		git_buf_joinpath(&root, iter->root, frame_entry->path);
+	else
+		git_buf_puts(&root, iter->root);
+
+	if (git_buf_oom(&root)) {
+		error = -1;
+		goto done;
+	}
+
+	new_frame->path_len = frame_entry ? frame_entry->path_len : 0;
+
+	if (iter->untracked_cache &&
+	    (error = filesystem_iterator_frame_untracked(&cached, &record,
+			&cached_st, iter, frame_entry, &root)) < 0)
+		goto done;
+
+	/* Any error here is equivalent to the dir not existing, skip over it */
+	if (!cached && (error = git_path_diriter_init(
+			&diriter, root.ptr, iter->dirload_flags)) < 0) {
+		error = GIT_ENOTFOUND;
+		goto done;
+	}
+
+	if ((error = git_vector_init(&new_frame->entries, 64,
+			iterator__ignore_case(&iter->base) ?
+			filesystem_iterator_entry_cmp_icase :
+			filesystem_iterator_entry_cmp)) < 0)
+		goto done;
+
+	git_pool_init(&new_frame->entry_pool, 1);
+
+	/* check if this directory is ignored */
+	filesystem_iterator_frame_push_ignores(iter, frame_entry, new_frame);
+
+	if (cached)
+		error = filesystem_iterator_frame_load_cached(iter, new_frame, cached, &root);
+	else
+		error = filesystem_iterator_frame_load_dir(iter, new_frame, frame_entry, &diriter);
+
+	if (error < 0)
+		goto done;
 
 	/* sort now that directory suffix is added */
 	git_vector_sort(&new_frame->entries);
 
+	/* an untracked entry may have been tracked as well */
+	if (cached)
+		git_vector_uniq(&new_frame->entries, NULL);
+
+	if (record)
+		error = filesystem_iterator_frame_record(iter, new_frame,
+			root.ptr + iter->root_len, &cached_st);
+
 done:
 	if (error < 0)
 		git_array_pop(iter->frames);
@@ -1683,22 +2039,10 @@ int git_iterator_current_workdir_path(git_buf **out, git_iterator *i)
 	return 0;
 }
 
-GIT_INLINE(git_dir_flag) entry_dir_flag(git_index_entry *entry)
-{
-#if defined(GIT_WIN32) && !defined(__MINGW32__)
-	return (entry && entry->mode) ?
-		(S_ISDIR(entry->mode) ? GIT_DIR_FLAG_TRUE : GIT_DIR_FLAG_FALSE) :
-		GIT_DIR_FLAG_UNKNOWN;
-#else
-	GIT_UNUSED(entry);
-	return GIT_DIR_FLAG_UNKNOWN;
-#endif
-}
-
 static void filesystem_iterator_update_ignored(filesystem_iterator *iter)
 {
 	filesystem_iterator_frame *frame;
-	git_dir_flag dir_flag = entry_dir_flag(&iter->entry);
+	git_dir_flag dir_flag = entry_dir_flag(iter->entry.mode);
 
 	if (git_ignore__lookup(&iter->current_is_ignored,
 			&iter->ignores, iter->entry.path, dir_flag) < 0) {
@@ -1851,6 +2195,48 @@ static void filesystem_iterator_clear(filesystem_iterator *iter)
 	iterator_clear(&iter->base);
 }
 
+static int filesystem_iterator_init_untracked_cache(filesystem_iterator *iter)
+{
+	git_untracked_cache *cache;
+	int error;
+
+	iter->untracked_cache = false;
+
+	/*
+	 * the cache only holds whole directories of the working directory,
+	 * without the ignored files and for the default ignore rules.
+	 */
+	if (!iterator__flag(&iter->base, UNTRACKED_CACHE) ||
+	    iter->base.type != GIT_ITERATOR_TYPE_WORKDIR || !iter->index ||
+	    iter->base.start_len || iter->base.end_len ||
+	    iter->base.pathlist.length || iterator__ignore_case(&iter->base) ||
+	    !git_repository_workdir(iter->base.repo) ||
+	    strcmp(iter->root, git_repository_workdir(iter->base.repo)) != 0 ||
+	    git_ignore__has_internal_rules(&iter->ignores))
+		return 0;
+
+	if ((error = git_index__untracked_cache(&cache, iter->index)) < 0 || !cache)
+		return error;
+
+	iter->untracked_cache = true;
+	iter->untracked_cache_time = time(NULL);
+
+	return 0;
+}
+
+static int filesystem_iterator_init_fsmonitor(filesystem_iterator *iter)
+{
+	iter->fsmonitor = false;
+
+	/* the index entries describe the files of the working directory */
+	if (iter->base.type != GIT_ITERATOR_TYPE_WORKDIR || !iter->index ||
+	    !git_repository_workdir(iter->base.repo) ||
+	    strcmp(iter->root, git_repository_workdir(iter->base.repo)) != 0)
+		return 0;
+
+	return git_index__fsmonitor_refresh(&iter->fsmonitor, iter->index);
+}
+
 static int filesystem_iterator_init(filesystem_iterator *iter)
 {
 	int error;
@@ -1860,6 +2246,9 @@ static int filesystem_iterator_init(filesystem_iterator *iter)
 			".gitignore", &iter->ignores)) < 0)
 		return error;
 
+	if ((error = filesystem_iterator_init_untracked_cache(iter)) < 0)
+		return error;
+
 	if ((error = filesystem_iterator_frame_push(iter, NULL)) < 0)
 		return error;
 
@@ -1948,6 +2337,10 @@ static int iterator_for_filesystem(
 		goto on_error;
 
 	iter->index = index;
+
+	if ((error = filesystem_iterator_init_fsmonitor(iter)) < 0)
+		goto on_error;
+
 	iter->dirload_flags =
 		(iterator__ignore_case(&iter->base) ? GIT_PATH_DIR_IGNORE_CASE : 0) |
 		(iterator__flag(&iter->base, PRECOMPOSE_UNICODE) ?
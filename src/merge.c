@@ -353,16 +353,22 @@ static void clear_commit_marks(git_commit_list_node *commit, unsigned int mark)
 }
 
 static int paint_down_to_common(
-	git_commit_list **out, git_revwalk *walk, git_commit_list_node *one, git_vector *twos)
+	git_commit_list **out,
+	git_revwalk *walk,
+	git_commit_list_node *one,
+	git_vector *twos,
+	uint32_t min_generation,
+	size_t max_commits)
 {
 	git_pqueue list;
 	git_commit_list *result = NULL;
 	git_commit_list_node *two;
+	size_t visited = 0;
 
 	int error;
 	unsigned int i;
 
-	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_time_cmp) < 0)
+	if (git_pqueue_init(&list, 0, twos->length * 2, git_commit_list_generation_cmp) < 0)
 		return -1;
 
 	one->flags |= PARENT1;
@@ -387,6 +393,22 @@ static int paint_down_to_common(
 		if (commit == NULL)
 			break;
 
+		/*
+		 * The queue is ordered by generation, so once we pop a commit
+		 * below the generation we care about, nothing that is left can
+		 * reach the commits of interest any more.
+		 */
+		if (min_generation && commit->generation &&
+		    commit->generation < min_generation)
+			break;
+
+		/* the caller decides whether it has its answer already */
+		if (max_commits && ++visited > max_commits) {
+			git_commit_list_free(&result);
+			git_pqueue_free(&list);
+			return GIT_ELIMIT;
+		}
+
 		flags = commit->flags & (PARENT1 | PARENT2 | STALE);
 		if (flags == (PARENT1 | PARENT2)) {
 			if (!(commit->flags & RESULT)) {
@@ -438,6 +460,7 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits)
 	for (i = 0; i < commits->length; ++i) {
 		git_commit_list *common = NULL;
 		git_commit_list_node *commit = commits->contents[i];
+		uint32_t min_generation = commit->generation;
 
 		if (redundant[i])
 			continue;
@@ -445,15 +468,20 @@ static int remove_redundant(git_revwalk *walk, git_vector *commits)
 		git_vector_clear(&work);
 
 		for (j = 0; j < commits->length; j++) {
+			git_commit_list_node *other = commits->contents[j];
+
 			if (i == j || redundant[j])
 				continue;
 
 			filled_index[work.length] = j;
-			if ((error = git_vector_insert(&work, commits->contents[j])) < 0)
+			if ((error = git_vector_insert(&work, other)) < 0)
 				goto done;
+
+			if (!other->generation || other->generation < min_generation)
+				min_generation = other->generation;
 		}
 
-		error = paint_down_to_common(&common, walk, commit, &work);
+		error = paint_down_to_common(&common, walk, commit, &work, min_generation, 0);
 		if (error < 0)
 			goto done;
 
@@ -506,7 +534,7 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 	if (git_commit_list_parse(walk, one) < 0)
 		return -1;
 
-	error = paint_down_to_common(&result, walk, one, twos);
+	error = paint_down_to_common(&result, walk, one, twos, 0, 0);
 	if (error < 0)
 		return error;
 
@@ -551,6 +579,46 @@ int git_merge__bases_many(git_commit_list **out, git_revwalk *walk, git_commit_l
 	return 0;
 }
 
+int git_merge__is_ancestor(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_list_node *ancestor,
+	size_t max_commits)
+{
+	git_commit_list *result = NULL;
+	git_vector ancestors = GIT_VECTOR_INIT;
+	int error;
+
+	if (commit == ancestor)
+		return 1;
+
+	if ((error = git_commit_list_parse(walk, commit)) < 0 ||
+	    (error = git_commit_list_parse(walk, ancestor)) < 0)
+		return error;
+
+	/* nothing can reach a commit with a generation as high as its own */
+	if (commit->generation && ancestor->generation &&
+	    commit->generation <= ancestor->generation)
+		return 0;
+
+	if ((error = git_vector_insert(&ancestors, ancestor)) < 0)
+		return error;
+
+	error = paint_down_to_common(&result, walk, commit, &ancestors,
+		ancestor->generation, max_commits);
+
+	/* the walk may have reached the ancestor before it gave up */
+	if (error == GIT_ELIMIT && !(ancestor->flags & PARENT1))
+		git_error_set(GIT_ERROR_MERGE,
+			"gave up after walking %"PRIuZ" commits", max_commits);
+	else if (!error || error == GIT_ELIMIT)
+		error = (ancestor->flags & PARENT1) ? 1 : 0;
+
+	git_commit_list_free(&result);
+	git_vector_free(&ancestors);
+	return error;
+}
+
 int git_repository_mergehead_foreach(
 	git_repository *repo,
 	git_repository_mergehead_foreach_cb cb,
@@ -125,6 +125,18 @@ typedef struct {
 
 } git_merge_diff;
 
+/*
+ * Determine whether `ancestor` is reachable from `commit`. Walks are
+ * pruned with generation numbers when both commits have them. If
+ * `max_commits` is non-zero, gives up with GIT_ELIMIT once that many
+ * commits have been visited without reaching `ancestor`.
+ */
+int git_merge__is_ancestor(
+	git_revwalk *walk,
+	git_commit_list_node *commit,
+	git_commit_list_node *ancestor,
+	size_t max_commits);
+
 int git_merge__bases_many(
 	git_commit_list **out,
 	git_revwalk *walk,
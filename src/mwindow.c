@@ -24,8 +24,8 @@
 
 size_t git_mwindow__window_size = DEFAULT_WINDOW_SIZE;
 size_t git_mwindow__mapped_limit = DEFAULT_MAPPED_LIMIT;
+int git_mwindow__full_mmap = 0;
 
-/* Whenever you want to read or modify this, grab git__mwindow_mutex */
 static git_mwindow_ctl mem_ctl;
 
 /* Global list of mwindow files, to open packs once across repos */
@@ -105,62 +105,73 @@ void git_mwindow_put_pack(struct git_pack_file *pack)
 	assert(git_strmap_exists(git__pack_cache, pack->pack_name));
 
 	count = git_atomic_dec(&pack->refcount);
-	if (count == 0) {
+	if (count == 0)
 		git_strmap_delete(git__pack_cache, pack->pack_name);
-		git_packfile_free(pack);
-	}
 
 	git_mutex_unlock(&git__mwindow_mutex);
-	return;
+
+	/* nobody else can reach the pack anymore */
+	if (count == 0)
+		git_packfile_free(pack);
 }
 
-void git_mwindow_free_all(git_mwindow_file *mwf)
+GIT_INLINE(size_t) mapped_get(void)
 {
-	if (git_mutex_lock(&git__mwindow_mutex)) {
-		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
-		return;
-	}
+	return (size_t)git_atomic_ssize_add(&mem_ctl.mapped, 0);
+}
 
-	git_mwindow_free_all_locked(mwf);
+static void free_window(git_mwindow *w)
+{
+	git_atomic_ssize_add(&mem_ctl.mapped, -(int64_t)w->window_map.len);
+	git_atomic_dec(&mem_ctl.open_windows);
 
-	git_mutex_unlock(&git__mwindow_mutex);
+	git_futils_mmap_free(&w->window_map);
+	git__free(w);
+}
+
+static int mwindow_file_matches(const git_vector *v, size_t idx, void *mwf)
+{
+	return git_vector_get(v, idx) == mwf;
 }
 
 /*
  * Free all the windows in a sequence, typically because we're done
  * with the file
  */
-void git_mwindow_free_all_locked(git_mwindow_file *mwf)
+void git_mwindow_free_all(git_mwindow_file *mwf)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
-	size_t i;
+
+	if (git_mutex_lock(&git__mwindow_mutex)) {
+		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
+		return;
+	}
 
 	/*
-	 * Remove these windows from the global list
+	 * Remove these windows from the global list; once this is done,
+	 * eviction cannot reach them anymore.
 	 */
-	for (i = 0; i < ctl->windowfiles.length; ++i){
-		if (git_vector_get(&ctl->windowfiles, i) == mwf) {
-			git_vector_remove(&ctl->windowfiles, i);
-			break;
-		}
-	}
+	git_vector_remove_matching(&ctl->windowfiles, mwindow_file_matches, mwf);
 
 	if (ctl->windowfiles.length == 0) {
 		git_vector_free(&ctl->windowfiles);
 		ctl->windowfiles.contents = NULL;
 	}
 
-	while (mwf->windows) {
-		git_mwindow *w = mwf->windows;
-		assert(w->inuse_cnt == 0);
+	git_mutex_unlock(&git__mwindow_mutex);
 
-		ctl->mapped -= w->window_map.len;
-		ctl->open_windows--;
+	if (mwf->full_map.data) {
+		git_futils_mmap_free(&mwf->full_map);
+		mwf->full_map.data = NULL;
+		mwf->full_map.len = 0;
+	}
 
-		git_futils_mmap_free(&w->window_map);
+	while (mwf->windows) {
+		git_mwindow *w = mwf->windows;
+		assert(git_atomic_get(&w->inuse_cnt) == 0);
 
 		mwf->windows = w->next;
-		git__free(w);
+		free_window(w);
 	}
 }
 
@@ -175,78 +186,81 @@ int git_mwindow_contains(git_mwindow *win, git_off_t offset)
 }
 
 /*
- * Find the least-recently-used window in a file
+ * Find the least-recently-used window of a file that is not in use.
+ * Run with the file's lock held.
  */
-static void git_mwindow_scan_lru(
-	git_mwindow_file *mwf,
-	git_mwindow **lru_w,
-	git_mwindow **lru_l)
+static git_mwindow *scan_lru(git_mwindow_file *mwf, git_mwindow **lru_l)
 {
-	git_mwindow *w, *w_l;
+	git_mwindow *w, *w_l, *lru_w = NULL;
 
 	for (w_l = NULL, w = mwf->windows; w; w = w->next) {
-		if (!w->inuse_cnt) {
-			/*
-			 * If the current one is more recent than the last one,
-			 * store it in the output parameter. If lru_w is NULL,
-			 * it's the first loop, so store it as well.
-			 */
-			if (!*lru_w || w->last_used < (*lru_w)->last_used) {
-				*lru_w = w;
+		if (!git_atomic_get(&w->inuse_cnt) &&
+		    (!lru_w || w->last_used < lru_w->last_used)) {
+			lru_w = w;
+			if (lru_l)
 				*lru_l = w_l;
-			}
 		}
 		w_l = w;
 	}
+
+	return lru_w;
 }
 
 /*
- * Close the least recently used window. You should check to see if
- * the file descriptors need closing from time to time. Called under
- * lock from new_window.
+ * Close the least recently used windows, across all the files, until
+ * no more than `target` bytes are mapped. Windows in use are never
+ * closed, so this may stop early.
+ *
+ * This must be called without holding the lock of any file.
  */
-static int git_mwindow_close_lru(git_mwindow_file *mwf)
+static void mwindow_evict(size_t target)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
-	size_t i;
-	git_mwindow *lru_w = NULL, *lru_l = NULL, **list = &mwf->windows;
-
-	/* FIXME: Does this give us any advantage? */
-	if(mwf->windows)
-		git_mwindow_scan_lru(mwf, &lru_w, &lru_l);
-
-	for (i = 0; i < ctl->windowfiles.length; ++i) {
-		git_mwindow *last = lru_w;
-		git_mwindow_file *cur = git_vector_get(&ctl->windowfiles, i);
-		git_mwindow_scan_lru(cur, &lru_w, &lru_l);
-		if (lru_w != last)
-			list = &cur->windows;
-	}
 
-	if (!lru_w) {
-		git_error_set(GIT_ERROR_OS, "failed to close memory window; couldn't find LRU");
-		return -1;
-	}
+	if (git_mutex_lock(&git__mwindow_mutex))
+		return;
 
-	ctl->mapped -= lru_w->window_map.len;
-	git_futils_mmap_free(&lru_w->window_map);
+	/* somebody else may have evicted while we waited */
+	while (mapped_get() > target) {
+		git_mwindow_file *cur, *lru_f = NULL;
+		git_mwindow *lru_w, *lru_l = NULL;
+		size_t lru_used = 0, i;
 
-	if (lru_l)
-		lru_l->next = lru_w->next;
-	else
-		*list = lru_w->next;
+		git_vector_foreach(&ctl->windowfiles, i, cur) {
+			if (git_mutex_lock(&cur->lock))
+				continue;
 
-	git__free(lru_w);
-	ctl->open_windows--;
+			if ((lru_w = scan_lru(cur, NULL)) != NULL &&
+			    (!lru_f || lru_w->last_used < lru_used)) {
+				lru_f = cur;
+				lru_used = lru_w->last_used;
+			}
 
-	return 0;
+			git_mutex_unlock(&cur->lock);
+		}
+
+		if (!lru_f || git_mutex_lock(&lru_f->lock))
+			break;
+
+		/* the window may have been taken in the meantime; look again */
+		if ((lru_w = scan_lru(lru_f, &lru_l)) != NULL) {
+			if (lru_l)
+				lru_l->next = lru_w->next;
+			else
+				lru_f->windows = lru_w->next;
+
+			free_window(lru_w);
+		}
+
+		git_mutex_unlock(&lru_f->lock);
+	}
+
+	git_mutex_unlock(&git__mwindow_mutex);
 }
 
-/* This gets called under lock from git_mwindow_open */
+/* This gets called with the file's lock held from git_mwindow_open */
 static git_mwindow *new_window(
 	git_mwindow_file *mwf,
-	git_file fd,
-	git_off_t size,
 	git_off_t offset)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
@@ -262,45 +276,61 @@ static git_mwindow *new_window(
 	memset(w, 0x0, sizeof(*w));
 	w->offset = (offset / walign) * walign;
 
-	len = size - w->offset;
+	len = mwf->size - w->offset;
 	if (len > (git_off_t)git_mwindow__window_size)
 		len = (git_off_t)git_mwindow__window_size;
 
-	ctl->mapped += (size_t)len;
+	if (git_futils_mmap_ro(&w->window_map, mwf->fd, w->offset, (size_t)len) < 0) {
+		git__free(w);
+		return NULL;
+	}
 
-	while (git_mwindow__mapped_limit < ctl->mapped &&
-			git_mwindow_close_lru(mwf) == 0) /* nop */;
+	git_atomic_ssize_add(&ctl->mapped, (int64_t)len);
+	git_atomic_inc(&ctl->mmap_calls);
+	git_atomic_inc(&ctl->open_windows);
 
-	/*
-	 * We treat `mapped_limit` as a soft limit. If we can't find a
-	 * window to close and are above the limit, we still mmap the new
-	 * window.
-	 */
+	w->next = mwf->windows;
+	mwf->windows = w;
 
-	if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
-		/*
-		 * The first error might be down to memory fragmentation even if
-		 * we're below our soft limits, so free up what we can and try again.
-		 */
+	return w;
+}
 
-		while (git_mwindow_close_lru(mwf) == 0)
-			/* nop */;
+static git_mwindow *find_window(
+	git_mwindow_file *mwf,
+	git_off_t offset,
+	size_t extra,
+	bool *created)
+{
+	git_mwindow *w;
 
-		if (git_futils_mmap_ro(&w->window_map, fd, w->offset, (size_t)len) < 0) {
-			git__free(w);
-			return NULL;
-		}
+	*created = false;
+
+	if (git_mutex_lock(&mwf->lock)) {
+		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow file mutex");
+		return NULL;
 	}
 
-	ctl->mmap_calls++;
-	ctl->open_windows++;
+	for (w = mwf->windows; w; w = w->next) {
+		if (git_mwindow_contains(w, offset) &&
+			git_mwindow_contains(w, offset + extra))
+			break;
+	}
 
-	if (ctl->mapped > ctl->peak_mapped)
-		ctl->peak_mapped = ctl->mapped;
+	/*
+	 * If there isn't a suitable window, we need to create a new
+	 * one.
+	 */
+	if (!w) {
+		w = new_window(mwf, offset);
+		*created = (w != NULL);
+	}
 
-	if (ctl->open_windows > ctl->peak_open_windows)
-		ctl->peak_open_windows = ctl->open_windows;
+	if (w) {
+		w->last_used = (size_t)git_atomic_ssize_add(&mem_ctl.used_ctr, 1);
+		git_atomic_inc(&w->inuse_cnt);
+	}
 
+	git_mutex_unlock(&mwf->lock);
 	return w;
 }
 
@@ -315,44 +345,53 @@ unsigned char *git_mwindow_open(
 	size_t extra,
 	unsigned int *left)
 {
-	git_mwindow_ctl *ctl = &mem_ctl;
 	git_mwindow *w = *cursor;
+	bool created;
 
-	if (git_mutex_lock(&git__mwindow_mutex)) {
-		git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
-		return NULL;
+	if (mwf->full_map.data) {
+		size_t avail;
+
+		/* A corrupt or truncated pack may point past its end */
+		if (offset < 0 || (size_t)offset > mwf->full_map.len ||
+		    extra > mwf->full_map.len - (size_t)offset) {
+			git_error_set(GIT_ERROR_ODB,
+				"invalid offset %" PRId64 " in packfile", (int64_t)offset);
+			return NULL;
+		}
+
+		avail = mwf->full_map.len - (size_t)offset;
+
+		if (left)
+			*left = (unsigned int)min(avail, UINT_MAX);
+
+		return (unsigned char *)mwf->full_map.data + offset;
 	}
 
 	if (!w || !(git_mwindow_contains(w, offset) && git_mwindow_contains(w, offset + extra))) {
-		if (w) {
-			w->inuse_cnt--;
-		}
+		if (w)
+			git_atomic_dec(&w->inuse_cnt);
 
-		for (w = mwf->windows; w; w = w->next) {
-			if (git_mwindow_contains(w, offset) &&
-				git_mwindow_contains(w, offset + extra))
-				break;
+		*cursor = NULL;
+
+		if ((w = find_window(mwf, offset, extra, &created)) == NULL) {
+			/*
+			 * The failure might be down to memory fragmentation even if
+			 * we're below our soft limits, so free up what we can and try again.
+			 */
+			mwindow_evict(0);
+
+			if ((w = find_window(mwf, offset, extra, &created)) == NULL)
+				return NULL;
 		}
 
 		/*
-		 * If there isn't a suitable window, we need to create a new
-		 * one.
+		 * We treat `mapped_limit` as a soft limit and only evict once
+		 * we are over it, down to seven eighths of it, so that the
+		 * cost of the global scan is spread over many new windows.
 		 */
-		if (!w) {
-			w = new_window(mwf, mwf->fd, mwf->size, offset);
-			if (w == NULL) {
-				git_mutex_unlock(&git__mwindow_mutex);
-				return NULL;
-			}
-			w->next = mwf->windows;
-			mwf->windows = w;
-		}
-	}
+		if (created && mapped_get() > git_mwindow__mapped_limit)
+			mwindow_evict(git_mwindow__mapped_limit - git_mwindow__mapped_limit / 8);
 
-	/* If we changed w, store it in the cursor */
-	if (w != *cursor) {
-		w->last_used = ctl->used_ctr++;
-		w->inuse_cnt++;
 		*cursor = w;
 	}
 
@@ -361,10 +400,43 @@ unsigned char *git_mwindow_open(
 	if (left)
 		*left = (unsigned int)(w->window_map.len - offset);
 
-	git_mutex_unlock(&git__mwindow_mutex);
 	return (unsigned char *) w->window_map.data + offset;
 }
 
+bool git_mwindow_full_mmap_enabled(void)
+{
+	/* Mapping every pack in full needs a 64-bit address space. */
+	return git_mwindow__full_mmap && sizeof(void *) >= 8;
+}
+
+void git_mwindow_file_map_full(git_mwindow_file *mwf)
+{
+	git_map map;
+
+	if (!git_mwindow_full_mmap_enabled() || mwf->full_map.data ||
+	    mwf->fd < 0 || !mwf->size || !git__is_sizet(mwf->size))
+		return;
+
+	if (git_futils_mmap_ro(&map, mwf->fd, 0, (size_t)mwf->size) < 0) {
+		git_error_clear();
+		return;
+	}
+
+	/* Objects are read from all over a pack; don't read ahead. */
+	p_madvise(&map, GIT_MADV_RANDOM);
+
+	/*
+	 * Readers look at `full_map` without locking; make sure they see
+	 * the length before they see the data.
+	 */
+	mwf->full_map.len = map.len;
+#ifdef GIT_WIN32
+	mwf->full_map.fmh = map.fmh;
+#endif
+	GIT_MEMORY_BARRIER;
+	mwf->full_map.data = map.data;
+}
+
 int git_mwindow_file_register(git_mwindow_file *mwf)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
@@ -390,19 +462,11 @@ int git_mwindow_file_register(git_mwindow_file *mwf)
 void git_mwindow_file_deregister(git_mwindow_file *mwf)
 {
 	git_mwindow_ctl *ctl = &mem_ctl;
-	git_mwindow_file *cur;
-	size_t i;
 
 	if (git_mutex_lock(&git__mwindow_mutex))
 		return;
 
-	git_vector_foreach(&ctl->windowfiles, i, cur) {
-		if (cur == mwf) {
-			git_vector_remove(&ctl->windowfiles, i);
-			git_mutex_unlock(&git__mwindow_mutex);
-			return;
-		}
-	}
+	git_vector_remove_matching(&ctl->windowfiles, mwindow_file_matches, mwf);
 	git_mutex_unlock(&git__mwindow_mutex);
 }
 
@@ -410,13 +474,7 @@ void git_mwindow_close(git_mwindow **window)
 {
 	git_mwindow *w = *window;
 	if (w) {
-		if (git_mutex_lock(&git__mwindow_mutex)) {
-			git_error_set(GIT_ERROR_THREAD, "unable to lock mwindow mutex");
-			return;
-		}
-
-		w->inuse_cnt--;
-		git_mutex_unlock(&git__mwindow_mutex);
+		git_atomic_dec(&w->inuse_cnt);
 		*window = NULL;
 	}
 }
@@ -18,30 +18,53 @@ typedef struct git_mwindow {
 	git_map window_map;
 	git_off_t offset;
 	size_t last_used;
-	size_t inuse_cnt;
+	git_atomic inuse_cnt;
 } git_mwindow;
 
+/*
+ * The list of windows of a file is guarded by the file's own lock, so
+ * that threads reading from different packs don't contend; a cursor
+ * that already covers the requested range is used without locking.
+ *
+ * When the whole file is mapped in `full_map`, windows aren't used at
+ * all.
+ */
 typedef struct git_mwindow_file {
+	git_mutex lock;
+	git_map full_map;
 	git_mwindow *windows;
 	int fd;
 	git_off_t size;
 } git_mwindow_file;
 
+/*
+ * The counters are updated atomically; `windowfiles` is guarded by
+ * git__mwindow_mutex and only used to register files and to evict
+ * windows once `mapped` goes over the limit.
+ */
 typedef struct git_mwindow_ctl {
-	size_t mapped;
-	unsigned int open_windows;
-	unsigned int mmap_calls;
-	unsigned int peak_open_windows;
-	size_t peak_mapped;
-	size_t used_ctr;
+	git_atomic_ssize mapped;
+	git_atomic open_windows;
+	git_atomic mmap_calls;
+	git_atomic_ssize used_ctr;
 	git_vector windowfiles;
 } git_mwindow_ctl;
 
 int git_mwindow_contains(git_mwindow *win, git_off_t offset);
-void git_mwindow_free_all(git_mwindow_file *mwf); /* locks */
-void git_mwindow_free_all_locked(git_mwindow_file *mwf); /* run under lock */
+void git_mwindow_free_all(git_mwindow_file *mwf);
 unsigned char *git_mwindow_open(git_mwindow_file *mwf, git_mwindow **cursor, git_off_t offset, size_t extra, unsigned int *left);
 int git_mwindow_file_register(git_mwindow_file *mwf);
+
+/*
+ * Map the whole file at once, if that was enabled through
+ * GIT_OPT_ENABLE_PACK_FULL_MMAP and the address space is large enough.
+ * Falls back silently to windows when the file can't be mapped.
+ * Run with the owner's lock held, before the file is used.
+ */
+void git_mwindow_file_map_full(git_mwindow_file *mwf);
+
+/* Whether whole-file mapping is in effect. */
+bool git_mwindow_full_mmap_enabled(void);
 void git_mwindow_file_deregister(git_mwindow_file *mwf);
 void git_mwindow_close(git_mwindow **w_cursor);
 
@@ -33,6 +33,8 @@
 #define GIT_ALTERNATES_MAX_DEPTH 5
 
 bool git_odb__strict_hash_verification = true;
+unsigned int git_odb__read_threads = 0;
+int git_odb__refresh_interval = 0;
 
 typedef struct
 {
@@ -42,6 +44,13 @@ typedef struct
 	ino_t disk_inode;
 } backend_internal;
 
+typedef struct
+{
+	git_odb_backend *backend;
+	git_futils_filestamp stamp;
+	char path[GIT_FLEX_ARRAY];
+} odb_pack_dir;
+
 static git_cache *odb_cache(git_odb *odb)
 {
 	if (odb->rc.owner != NULL) {
@@ -55,6 +64,7 @@ static git_cache *odb_cache(git_odb *odb)
 static int odb_otype_fast(git_object_t *type_p, git_odb *db, const git_oid *id);
 static int load_alternates(git_odb *odb, const char *objects_dir, int alternate_depth);
 static int error_null_oid(int error, const char *message);
+static int odb_refresh(git_odb *db);
 
 static git_object_t odb_hardcoded_type(const git_oid *id)
 {
@@ -443,12 +453,18 @@ int git_odb_new(git_odb **out)
 	git_odb *db = git__calloc(1, sizeof(*db));
 	GIT_ERROR_CHECK_ALLOC(db);
 
+	if (git_mutex_init(&db->lock) < 0) {
+		git__free(db);
+		return -1;
+	}
 	if (git_cache_init(&db->own_cache) < 0) {
+		git_mutex_free(&db->lock);
 		git__free(db);
 		return -1;
 	}
 	if (git_vector_init(&db->backends, 4, backend_sort_cmp) < 0) {
 		git_cache_dispose(&db->own_cache);
+		git_mutex_free(&db->lock);
 		git__free(db);
 		return -1;
 	}
@@ -529,6 +545,32 @@ int git_odb_get_backend(git_odb_backend **out, git_odb *odb, size_t pos)
 	return GIT_ENOTFOUND;
 }
 
+static int add_pack_dir(
+	git_odb *db, git_odb_backend *backend, const char *objects_dir)
+{
+	odb_pack_dir *dir;
+	size_t objects_len = strlen(objects_dir), alloclen;
+
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, sizeof(odb_pack_dir), objects_len);
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, alloclen, strlen("/pack") + 1);
+
+	dir = git__calloc(1, alloclen);
+	GIT_ERROR_CHECK_ALLOC(dir);
+
+	dir->backend = backend;
+	memcpy(dir->path, objects_dir, objects_len);
+	if (objects_len && objects_dir[objects_len - 1] != '/')
+		dir->path[objects_len++] = '/';
+	memcpy(dir->path + objects_len, "pack", strlen("pack") + 1);
+
+	if (git_vector_insert(&db->pack_dirs, dir) < 0) {
+		git__free(dir);
+		return -1;
+	}
+
+	return 0;
+}
+
 int git_odb__add_default_backends(
 	git_odb *db, const char *objects_dir,
 	bool as_alternates, int alternate_depth)
@@ -563,6 +605,11 @@ int git_odb__add_default_backends(
 	}
 #endif
 
+	/* the commit-graph of the main object directory is loaded lazily */
+	if (!as_alternates && !git_buf_len(&db->commit_graph_path) &&
+		git_buf_joinpath(&db->commit_graph_path, objects_dir, GIT_COMMIT_GRAPH_FILE) < 0)
+		return -1;
+
 	/* add the loose object backend */
 	if (git_odb_backend_loose(&loose, objects_dir, -1, db->do_fsync, 0, 0) < 0 ||
 		add_backend_internal(db, loose, GIT_LOOSE_PRIORITY, as_alternates, inode) < 0)
@@ -573,6 +620,9 @@ int git_odb__add_default_backends(
 		add_backend_internal(db, packed, GIT_PACKED_PRIORITY, as_alternates, inode) < 0)
 		return -1;
 
+	if (add_pack_dir(db, packed, objects_dir) < 0)
+		return -1;
+
 	return load_alternates(db, objects_dir, alternate_depth);
 }
 
@@ -687,6 +737,12 @@ static void odb_free(git_odb *db)
 
 	git_vector_free(&db->backends);
 	git_cache_dispose(&db->own_cache);
+	git_commit_graph_free(db->commit_graph);
+	git_buf_dispose(&db->commit_graph_path);
+	git_vector_free_deep(&db->pack_dirs);
+	git_oidmap_free(db->missing);
+	git__free(db->missing_ids);
+	git_mutex_free(&db->lock);
 
 	git__memzero(db, sizeof(*db));
 	git__free(db);
@@ -746,14 +802,176 @@ static int odb_freshen_1(
 	return (int)found;
 }
 
+/*
+ * Check whether any pack directory changed since we last looked.  A
+ * directory that was modified within the last second may still change
+ * without its timestamp moving, so it is always treated as changed.
+ * Must be called with the odb lock held.
+ */
+static bool pack_dirs_changed(git_odb *db)
+{
+	odb_pack_dir *dir;
+	time_t racy = time(NULL) - 1;
+	bool changed = false;
+	size_t i;
+
+	git_vector_foreach(&db->pack_dirs, i, dir) {
+		if (git_futils_filestamp_check(&dir->stamp, dir->path) != 0 ||
+		    dir->stamp.mtime.tv_sec >= racy)
+			changed = true;
+	}
+
+	return changed;
+}
+
+/*
+ * Ids that were missing after a refresh can only be trusted to stay
+ * missing when every backend that can refresh is a pack backend whose
+ * directory is watched by `pack_dirs_changed`; any other backend may
+ * find them at any time.  Must be called with the odb lock held.
+ */
+static bool missing_is_trusted(git_odb *db)
+{
+	backend_internal *internal;
+	odb_pack_dir *dir;
+	size_t i, j;
+	bool watched;
+
+	git_vector_foreach(&db->backends, i, internal) {
+		if (!internal->backend->refresh)
+			continue;
+
+		watched = false;
+		git_vector_foreach(&db->pack_dirs, j, dir) {
+			if (dir->backend == internal->backend) {
+				watched = true;
+				break;
+			}
+		}
+
+		if (!watched)
+			return false;
+	}
+
+	return true;
+}
+
+static void missing_clear(git_odb *db)
+{
+	if (db->missing)
+		git_oidmap_clear(db->missing);
+
+	db->missing_epoch++;
+}
+
+/*
+ * Refresh the backends after a lookup of `id` (or of a prefix, when `id`
+ * is NULL) failed, so that the lookup can be retried.  The refresh is
+ * skipped when `id` was still missing after an earlier refresh and no
+ * pack has been added since (see `missing_is_trusted`), or when the last refresh is less than
+ * `git_odb__refresh_interval` milliseconds ago.  Returns 0 when the
+ * backends were refreshed, 1 when they were not.
+ */
+static int odb_refresh_missing(
+	unsigned int *epoch, git_odb *db, const git_oid *id)
+{
+	double now = git__timer();
+	bool skip = false;
+
+	if (git_mutex_lock(&db->lock) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return -1;
+	}
+
+	if (id && pack_dirs_changed(db))
+		missing_clear(db);
+
+	if (id && db->missing && git_oidmap_exists(db->missing, id) &&
+	    missing_is_trusted(db))
+		skip = true;
+	else if (git_odb__refresh_interval > 0 && db->last_refresh > 0 &&
+	         (now - db->last_refresh) * 1000 < git_odb__refresh_interval)
+		skip = true;
+	else
+		db->last_refresh = now;
+
+	*epoch = db->missing_epoch;
+	git_mutex_unlock(&db->lock);
+
+	return skip ? 1 : odb_refresh(db);
+}
+
+/*
+ * Remember that `id` could not be found after a refresh, unless the
+ * missing ids were invalidated since `epoch` or cannot be trusted at
+ * all.  The oldest id is evicted
+ * when `GIT_ODB_MISSING_MAX` ids are remembered already.
+ */
+static void odb_remember_missing(
+	git_odb *db, const git_oid *id, unsigned int epoch)
+{
+	git_oid *slot;
+
+	if (git_mutex_lock(&db->lock) < 0)
+		return;
+
+	if (epoch != db->missing_epoch || !missing_is_trusted(db))
+		goto done;
+
+	if (!db->missing) {
+		if (git_oidmap_new(&db->missing) < 0)
+			goto done;
+
+		db->missing_ids = git__calloc(GIT_ODB_MISSING_MAX, sizeof(git_oid));
+		if (!db->missing_ids) {
+			git_oidmap_free(db->missing);
+			db->missing = NULL;
+			goto done;
+		}
+	}
+
+	if (git_oidmap_exists(db->missing, id))
+		goto done;
+
+	slot = &db->missing_ids[db->missing_next];
+	git_oidmap_delete(db->missing, slot);
+	git_oid_cpy(slot, id);
+
+	if (git_oidmap_set(db->missing, slot, slot) < 0)
+		goto done;
+
+	db->missing_next = (db->missing_next + 1) % GIT_ODB_MISSING_MAX;
+
+done:
+	git_mutex_unlock(&db->lock);
+}
+
+/* `id` was just written, so it must not be reported as missing anymore */
+static void odb_forget_missing(git_odb *db, const git_oid *id)
+{
+	git_oid *slot;
+
+	if (git_mutex_lock(&db->lock) < 0)
+		return;
+
+	if (db->missing && (slot = git_oidmap_get(db->missing, id)) != NULL) {
+		git_oidmap_delete(db->missing, id);
+		memset(slot, 0, sizeof(*slot));
+	}
+
+	git_mutex_unlock(&db->lock);
+}
+
 int git_odb__freshen(git_odb *db, const git_oid *id)
 {
+	unsigned int epoch;
+
 	assert(db && id);
 
 	if (odb_freshen_1(db, id, false))
 		return 1;
 
-	if (!git_odb_refresh(db))
+	if (!odb_refresh_missing(&epoch, db, id))
 		return odb_freshen_1(db, id, true);
 
 	/* Failed to refresh, hence not found */
@@ -763,6 +981,7 @@ int git_odb__freshen(git_odb *db, const git_oid *id)
 int git_odb_exists(git_odb *db, const git_oid *id)
 {
 	git_odb_object *object;
+	unsigned int epoch;
 
 	assert(db && id);
 
@@ -777,8 +996,12 @@ int git_odb_exists(git_odb *db, const git_oid *id)
 	if (odb_exists_1(db, id, false))
 		return 1;
 
-	if (!git_odb_refresh(db))
-		return odb_exists_1(db, id, true);
+	if (!odb_refresh_missing(&epoch, db, id)) {
+		if (odb_exists_1(db, id, true))
+			return 1;
+
+		odb_remember_missing(db, id, epoch);
+	}
 
 	/* Failed to refresh, hence not found */
 	return 0;
@@ -829,6 +1052,7 @@ static int odb_exists_prefix_1(git_oid *out, git_odb *db,
 int git_odb_exists_prefix(
 	git_oid *out, git_odb *db, const git_oid *short_id, size_t len)
 {
+	unsigned int epoch;
 	int error;
 	git_oid key = {{0}};
 
@@ -852,7 +1076,7 @@ int git_odb_exists_prefix(
 
 	error = odb_exists_prefix_1(out, db, &key, len, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh_missing(&epoch, db, NULL))
 		error = odb_exists_prefix_1(out, db, &key, len, true);
 
 	if (error == GIT_ENOTFOUND)
@@ -988,6 +1212,7 @@ int git_odb__read_header_or_object(
 	git_odb *db, const git_oid *id)
 {
 	int error = GIT_ENOTFOUND;
+	unsigned int epoch;
 	git_odb_object *object;
 
 	assert(db && id && out && len_p && type_p);
@@ -1006,8 +1231,9 @@ int git_odb__read_header_or_object(
 
 	error = odb_read_header_1(len_p, type_p, db, id, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
-		error = odb_read_header_1(len_p, type_p, db, id, true);
+	if (error == GIT_ENOTFOUND && !odb_refresh_missing(&epoch, db, id) &&
+	    (error = odb_read_header_1(len_p, type_p, db, id, true)) == GIT_ENOTFOUND)
+		odb_remember_missing(db, id, epoch);
 
 	if (error == GIT_ENOTFOUND)
 		return git_odb__error_notfound("cannot read header for", id, GIT_OID_HEXSZ);
@@ -1095,6 +1321,7 @@ out:
 
 int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 {
+	unsigned int epoch;
 	int error;
 
 	assert(out && db && id);
@@ -1108,8 +1335,9 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 
 	error = odb_read_1(out, db, id, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
-		error = odb_read_1(out, db, id, true);
+	if (error == GIT_ENOTFOUND && !odb_refresh_missing(&epoch, db, id) &&
+	    (error = odb_read_1(out, db, id, true)) == GIT_ENOTFOUND)
+		odb_remember_missing(db, id, epoch);
 
 	if (error == GIT_ENOTFOUND)
 		return git_odb__error_notfound("no match for id", id, GIT_OID_HEXSZ);
@@ -1117,6 +1345,209 @@ int git_odb_read(git_odb_object **out, git_odb *db, const git_oid *id)
 	return error;
 }
 
+/* The objects of a `git_odb_read_many` that are not in the cache */
+struct read_many {
+	git_oid *ids;
+	size_t *positions;
+	void **data;
+	size_t *lens;
+	git_object_t *types;
+	size_t count;
+};
+
+static bool read_many_done(struct read_many *pending)
+{
+	size_t i;
+
+	for (i = 0; i < pending->count; i++) {
+		if (pending->types[i] == GIT_OBJECT_INVALID)
+			return false;
+	}
+
+	return true;
+}
+
+static int read_many_1(git_odb *db, struct read_many *pending, bool only_refreshed)
+{
+	size_t i, j;
+	int error = 0;
+
+	for (i = 0; i < db->backends.length && !read_many_done(pending); ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		if (only_refreshed && !b->refresh)
+			continue;
+
+		if (b->read_many != NULL) {
+			error = b->read_many(pending->data, pending->lens, pending->types,
+				b, pending->ids, pending->count);
+
+			if (error < 0 && error != GIT_PASSTHROUGH && error != GIT_ENOTFOUND)
+				return error;
+
+			if (error != GIT_PASSTHROUGH)
+				continue;
+		}
+
+		if (b->read == NULL)
+			continue;
+
+		/* read the objects one at a time otherwise */
+		for (j = 0; j < pending->count; j++) {
+			if (pending->types[j] != GIT_OBJECT_INVALID)
+				continue;
+
+			error = b->read(&pending->data[j], &pending->lens[j],
+				&pending->types[j], b, &pending->ids[j]);
+
+			if (error < 0) {
+				pending->data[j] = NULL;
+				pending->types[j] = GIT_OBJECT_INVALID;
+			}
+
+			if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND)
+				continue;
+
+			if (error < 0)
+				return error;
+		}
+	}
+
+	return 0;
+}
+
+static int read_many_store(
+	git_odb_object **out, git_odb *db, struct read_many *pending, size_t i)
+{
+	git_odb_object *object;
+	git_rawobj raw;
+	git_oid hashed;
+	int error;
+
+	raw.data = pending->data[i];
+	raw.len = pending->lens[i];
+	raw.type = pending->types[i];
+
+	if (git_odb__strict_hash_verification) {
+		if ((error = git_odb_hash(&hashed, raw.data, raw.len, raw.type)) < 0)
+			return error;
+
+		if (!git_oid_equal(&pending->ids[i], &hashed))
+			return git_odb__error_mismatch(&pending->ids[i], &hashed);
+	}
+
+	if ((object = odb_object__alloc(&pending->ids[i], &raw)) == NULL)
+		return -1;
+
+	pending->data[i] = NULL;
+	*out = git_cache_store_raw(odb_cache(db), object);
+	return 0;
+}
+
+int git_odb_read_many(
+	git_odb_object **out, git_odb *db, const git_oid *ids, size_t count)
+{
+	struct read_many pending = { 0 };
+	git_rawobj raw;
+	unsigned int epoch;
+	bool found;
+	size_t i;
+	int error = 0;
+
+	assert(db && ((out && ids) || !count));
+
+	if (count)
+		memset(out, 0, count * sizeof(git_odb_object *));
+
+	pending.ids = git__calloc(count, sizeof(git_oid));
+	pending.positions = git__calloc(count, sizeof(size_t));
+	pending.data = git__calloc(count, sizeof(void *));
+	pending.lens = git__calloc(count, sizeof(size_t));
+	pending.types = git__calloc(count, sizeof(git_object_t));
+
+	if (count && (!pending.ids || !pending.positions || !pending.data ||
+	    !pending.lens || !pending.types)) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (git_oid_iszero(&ids[i])) {
+			error = error_null_oid(GIT_ENOTFOUND, "cannot read object");
+			goto done;
+		}
+
+		if ((out[i] = git_cache_get_raw(odb_cache(db), &ids[i])) != NULL)
+			continue;
+
+		if ((error = odb_read_hardcoded(&found, &raw, &ids[i])) < 0)
+			goto done;
+
+		if (found) {
+			if ((out[i] = odb_object__alloc(&ids[i], &raw)) == NULL) {
+				git__free(raw.data);
+				error = -1;
+				goto done;
+			}
+
+			out[i] = git_cache_store_raw(odb_cache(db), out[i]);
+			continue;
+		}
+
+		git_oid_cpy(&pending.ids[pending.count], &ids[i]);
+		pending.positions[pending.count] = i;
+		pending.types[pending.count] = GIT_OBJECT_INVALID;
+		pending.count++;
+	}
+
+	if (!pending.count)
+		goto done;
+
+	if ((error = read_many_1(db, &pending, false)) < 0)
+		goto done;
+
+	if (!read_many_done(&pending) && !odb_refresh_missing(&epoch, db, NULL) &&
+	    (error = read_many_1(db, &pending, true)) < 0)
+		goto done;
+
+	for (i = 0; i < pending.count; i++) {
+		if (pending.types[i] == GIT_OBJECT_INVALID) {
+			error = git_odb__error_notfound("no match for id",
+				&pending.ids[i], GIT_OID_HEXSZ);
+			goto done;
+		}
+	}
+
+	git_error_clear();
+
+	for (i = 0; i < pending.count; i++) {
+		if ((error = read_many_store(&out[pending.positions[i]],
+				db, &pending, i)) < 0)
+			goto done;
+	}
+
+done:
+	if (error < 0) {
+		for (i = 0; i < count; i++) {
+			git_odb_object_free(out[i]);
+			out[i] = NULL;
+		}
+	}
+
+	for (i = 0; i < pending.count; i++) {
+		if (pending.types[i] != GIT_OBJECT_INVALID)
+			git__free(pending.data[i]);
+	}
+
+	git__free(pending.ids);
+	git__free(pending.positions);
+	git__free(pending.data);
+	git__free(pending.lens);
+	git__free(pending.types);
+	return error;
+}
+
 static int odb_otype_fast(git_object_t *type_p, git_odb *db, const git_oid *id)
 {
 	git_odb_object *object;
@@ -1228,6 +1659,7 @@ int git_odb_read_prefix(
 	git_odb_object **out, git_odb *db, const git_oid *short_id, size_t len)
 {
 	git_oid key = {{0}};
+	unsigned int epoch;
 	int error;
 
 	assert(out && db);
@@ -1248,7 +1680,7 @@ int git_odb_read_prefix(
 
 	error = read_prefix_1(out, db, &key, len, false);
 
-	if (error == GIT_ENOTFOUND && !git_odb_refresh(db))
+	if (error == GIT_ENOTFOUND && !odb_refresh_missing(&epoch, db, NULL))
 		error = read_prefix_1(out, db, &key, len, true);
 
 	if (error == GIT_ENOTFOUND)
@@ -1301,8 +1733,10 @@ int git_odb_write(
 			error = b->write(b, oid, data, len, type);
 	}
 
-	if (!error || error == GIT_PASSTHROUGH)
+	if (!error || error == GIT_PASSTHROUGH) {
+		odb_forget_missing(db, oid);
 		return 0;
+	}
 
 	/* if no backends were able to write the object directly, we try a
 	 * streaming write to the backends; just write the whole object into the
@@ -1312,7 +1746,8 @@ int git_odb_write(
 		return error;
 
 	stream->write(stream, data, len);
-	error = stream->finalize_write(stream, oid);
+	if ((error = stream->finalize_write(stream, oid)) == 0)
+		odb_forget_missing(db, oid);
 	git_odb_stream_free(stream);
 
 	return error;
@@ -1411,6 +1846,8 @@ int git_odb_stream_write(git_odb_stream *stream, const char *buffer, size_t len)
 
 int git_odb_stream_finalize_write(git_oid *out, git_odb_stream *stream)
 {
+	int error;
+
 	if (stream->received_bytes != stream->declared_size)
 		return git_odb_stream__invalid_length(stream,
 			"stream_finalize_write()");
@@ -1420,7 +1857,10 @@ int git_odb_stream_finalize_write(git_oid *out, git_odb_stream *stream)
 	if (git_odb__freshen(stream->backend->odb, out))
 		return 0;
 
-	return stream->finalize_write(stream, out);
+	if ((error = stream->finalize_write(stream, out)) == 0)
+		odb_forget_missing(stream->backend->odb, out);
+
+	return error;
 }
 
 int git_odb_stream_read(git_odb_stream *stream, char *buffer, size_t len)
@@ -1497,6 +1937,35 @@ int git_odb_write_pack(struct git_odb_writepack **out, git_odb *db, git_indexer_
 	return error;
 }
 
+int git_odb_write_multi_pack_index(git_odb *db)
+{
+	size_t i, writes = 0;
+	int error = GIT_ERROR;
+
+	assert(db);
+
+	for (i = 0; i < db->backends.length && error < 0; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+		git_odb_backend *b = internal->backend;
+
+		/* we don't write in alternates! */
+		if (internal->is_alternate)
+			continue;
+
+		if (b->writemidx != NULL) {
+			++writes;
+			error = b->writemidx(b);
+		}
+	}
+
+	if (error == GIT_PASSTHROUGH)
+		error = 0;
+	if (error < 0 && !writes)
+		error = git_odb__error_unsupported_in_backend("write multi-pack-index");
+
+	return error;
+}
+
 void *git_odb_backend_data_alloc(git_odb_backend *backend, size_t len)
 {
 	GIT_UNUSED(backend);
@@ -1514,10 +1983,75 @@ void git_odb_backend_data_free(git_odb_backend *backend, void *data)
 	git__free(data);
 }
 
-int git_odb_refresh(struct git_odb *db)
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb)
+{
+	int error = 0;
+
+	if (git_mutex_lock(&odb->lock) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return -1;
+	}
+
+	if (!odb->commit_graph_checked) {
+		git_commit_graph_file *file = NULL;
+
+		odb->commit_graph_checked = 1;
+
+		if (git_buf_len(&odb->commit_graph_path) &&
+		    git_path_exists(git_buf_cstr(&odb->commit_graph_path))) {
+			if ((error = git_commit_graph_open(&file,
+					git_buf_cstr(&odb->commit_graph_path))) < 0) {
+				/* a broken commit-graph is ignored, just like git does */
+				git_error_clear();
+				error = 0;
+			} else {
+				odb->commit_graph = file;
+			}
+		}
+	}
+
+	if (!odb->commit_graph)
+		error = GIT_ENOTFOUND;
+
+	*out = odb->commit_graph;
+	git_mutex_unlock(&odb->lock);
+	return error;
+}
+
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out, git_odb *db, const git_oid *id)
 {
 	size_t i;
-	assert(db);
+	int error;
+
+	assert(out && db && id);
+
+	for (i = 0; i < db->backends.length; ++i) {
+		backend_internal *internal = git_vector_get(&db->backends, i);
+
+		error = git_odb__pack_backend_entry(out, internal->backend, id);
+
+		if (error == GIT_PASSTHROUGH || error == GIT_ENOTFOUND)
+			continue;
+
+		return error;
+	}
+
+	return git_odb__error_notfound("no pack entry for object", id, GIT_OID_HEXSZ);
+}
+
+static int odb_refresh(git_odb *db)
+{
+	size_t i;
+
+	/* pick up a commit-graph that was written since we last looked */
+	if (git_mutex_lock(&db->lock) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return -1;
+	}
+	if (!db->commit_graph)
+		db->commit_graph_checked = 0;
+	git_mutex_unlock(&db->lock);
 
 	for (i = 0; i < db->backends.length; ++i) {
 		backend_internal *internal = git_vector_get(&db->backends, i);
@@ -1533,6 +2067,21 @@ int git_odb_refresh(struct git_odb *db)
 	return 0;
 }
 
+int git_odb_refresh(struct git_odb *db)
+{
+	assert(db);
+
+	if (git_mutex_lock(&db->lock) < 0) {
+		git_error_set(GIT_ERROR_ODB, "failed to acquire the odb lock");
+		return -1;
+	}
+	missing_clear(db);
+	db->last_refresh = git__timer();
+	git_mutex_unlock(&db->lock);
+
+	return odb_refresh(db);
+}
+
 int git_odb__error_mismatch(const git_oid *expected, const git_oid *actual)
 {
 	char expected_oid[GIT_OID_HEXSZ + 1], actual_oid[GIT_OID_HEXSZ + 1];
@@ -15,6 +15,9 @@
 
 #include "vector.h"
 #include "cache.h"
+#include "oidmap.h"
+#include "fileops.h"
+#include "commit_graph.h"
 #include "posix.h"
 #include "filter.h"
 
@@ -24,6 +27,15 @@
 
 extern bool git_odb__strict_hash_verification;
 
+/* Number of threads inflating the objects of a batched read, 0 for the CPUs */
+extern unsigned int git_odb__read_threads;
+
+/* Minimum milliseconds between refreshes triggered by failed lookups */
+extern int git_odb__refresh_interval;
+
+/* Number of ids remembered as missing after a refresh */
+#define GIT_ODB_MISSING_MAX 1024
+
 /* DO NOT EXPORT */
 typedef struct {
 	void *data;			/**< Raw, decompressed object data. */
@@ -40,9 +52,19 @@ struct git_odb_object {
 /* EXPORT */
 struct git_odb {
 	git_refcount rc;
+	git_mutex lock;  /* protects the commit-graph and the missing ids */
 	git_vector backends;
 	git_cache own_cache;
-	unsigned int do_fsync :1;
+	git_buf commit_graph_path;
+	git_commit_graph_file *commit_graph;
+	git_vector pack_dirs;
+	git_oidmap *missing;
+	git_oid *missing_ids;
+	size_t missing_next;
+	unsigned int missing_epoch;
+	double last_refresh;
+	unsigned int do_fsync :1,
+		commit_graph_checked :1;
 };
 
 typedef enum {
@@ -125,6 +147,33 @@ int git_odb__read_header_or_object(
 	git_odb_object **out, size_t *len_p, git_object_t *type_p,
 	git_odb *db, const git_oid *id);
 
+/*
+ * Get the commit-graph file of the main object directory, loading it on
+ * first use.  Returns GIT_ENOTFOUND when there is no usable commit-graph.
+ * The file stays valid for the lifetime of the odb: commits are
+ * immutable, so a stale graph is merely incomplete.  The parents it
+ * records are those of the commit objects, though, so callers must not
+ * use it when grafts or a shallow file replace them.
+ */
+int git_odb__get_commit_graph_file(git_commit_graph_file **out, git_odb *odb);
+
+struct git_pack_entry;
+
+/*
+ * Find where the object is stored in one of the packfiles of the odb.
+ * Returns GIT_ENOTFOUND when no pack backend has it.  The entry stays
+ * valid for the lifetime of the odb.
+ */
+int git_odb__find_pack_entry(
+	struct git_pack_entry *out, git_odb *db, const git_oid *id);
+
+/*
+ * Find the pack entry of an object in a backend created by
+ * `git_odb_backend_pack`; returns GIT_PASSTHROUGH for other backends.
+ */
+int git_odb__pack_backend_entry(
+	struct git_pack_entry *out, git_odb_backend *backend, const git_oid *id);
+
 /* freshen an entry in the object database */
 int git_odb__freshen(git_odb *db, const git_oid *id);
 
@@ -11,11 +11,13 @@
 #include "git2/repository.h"
 #include "git2/indexer.h"
 #include "git2/sys/odb_backend.h"
+#include "git2/sys/midx.h"
 #include "fileops.h"
 #include "hash.h"
 #include "odb.h"
 #include "delta.h"
 #include "sha1_lookup.h"
+#include "midx.h"
 #include "mwindow.h"
 #include "pack.h"
 
@@ -26,6 +28,8 @@
 
 struct pack_backend {
 	git_odb_backend parent;
+	git_midx_file *midx;
+	git_vector midx_packs;
 	git_vector packs;
 	struct git_pack_file *last_found;
 	char *pack_folder;
@@ -90,7 +94,9 @@ struct pack_writepack {
  * | that have been loaded for our ODB.
  * |
  * |-# pack_entry_find
- *	| Iterate through all the packs that have been preloaded
+ *	| If there is a multi-pack-index, a single binary search in it
+ *	| finds the object in any of the packs it covers. Otherwise
+ *	| iterate through all the packs that have been preloaded
  *	| (starting by the pack where the latest object was found)
  *	| to try to find the OID in one of them.
  *	|
@@ -207,6 +213,13 @@ static int packfile_load__cb(void *data, git_buf *path)
 
 	cmp_len -= strlen(".idx");
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+
+		if (strncmp(p->pack_name, path_str, cmp_len) == 0)
+			return 0;
+	}
+
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 
@@ -257,9 +270,38 @@ static int pack_entry_find_inner(
 	return -1;
 }
 
+/*
+ * Search the packs covered by the multi-pack-index one by one, for when
+ * the multi-pack-index is stale and does not know about an object.
+ */
+static int pack_entry_find_midx_packs(
+	struct git_pack_entry *e,
+	struct pack_backend *backend,
+	const git_oid *oid)
+{
+	struct git_pack_file *p;
+	size_t i;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if (p && git_pack_entry_find(e, p, oid, GIT_OID_HEXSZ) == 0)
+			return 0;
+	}
+
+	return -1;
+}
+
 static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backend, const git_oid *oid)
 {
 	struct git_pack_file *last_found = backend->last_found;
+	git_midx_entry midx_entry;
+
+	if (backend->midx &&
+		git_midx_entry_find(&midx_entry, backend->midx, oid, GIT_OID_HEXSZ) == 0 &&
+		midx_entry.pack_index < git_vector_length(&backend->midx_packs) &&
+		git_pack_entry_at(e,
+			git_vector_get(&backend->midx_packs, midx_entry.pack_index),
+			&midx_entry.sha1, midx_entry.offset) == 0)
+		return 0;
 
 	if (backend->last_found &&
 		git_pack_entry_find(e, backend->last_found, oid, GIT_OID_HEXSZ) == 0)
@@ -268,6 +310,9 @@ static int pack_entry_find(struct git_pack_entry *e, struct pack_backend *backen
 	if (!pack_entry_find_inner(e, backend, oid, last_found))
 		return 0;
 
+	if (backend->midx && !pack_entry_find_midx_packs(e, backend, oid))
+		return 0;
+
 	return git_odb__error_notfound(
 		"failed to find pack entry", oid, GIT_OID_HEXSZ);
 }
@@ -282,21 +327,49 @@ static int pack_entry_find_prefix(
 	size_t i;
 	git_oid found_full_oid = {{0}};
 	bool found = false;
-	struct git_pack_file *last_found = backend->last_found;
+	struct git_pack_file *last_found = backend->last_found, *p;
+	git_midx_entry midx_entry;
+
+	if (backend->midx) {
+		error = git_midx_entry_find(&midx_entry, backend->midx, short_oid, len);
+		if (error == GIT_EAMBIGUOUS)
+			return error;
+		if (!error && midx_entry.pack_index < git_vector_length(&backend->midx_packs) &&
+		    git_pack_entry_at(e,
+				git_vector_get(&backend->midx_packs, midx_entry.pack_index),
+				&midx_entry.sha1, midx_entry.offset) == 0) {
+			git_oid_cpy(&found_full_oid, &e->sha1);
+			found = true;
+		}
+
+		/* A stale multi-pack-index may not know about the object */
+		for (i = 0; !found && i < backend->midx_packs.length; i++) {
+			if ((p = git_vector_get(&backend->midx_packs, i)) == NULL)
+				continue;
+
+			error = git_pack_entry_find(e, p, short_oid, len);
+			if (error == GIT_EAMBIGUOUS)
+				return error;
+			if (!error) {
+				git_oid_cpy(&found_full_oid, &e->sha1);
+				found = true;
+			}
+		}
+	}
 
 	if (last_found) {
 		error = git_pack_entry_find(e, last_found, short_oid, len);
 		if (error == GIT_EAMBIGUOUS)
 			return error;
 		if (!error) {
+			if (found && git_oid_cmp(&e->sha1, &found_full_oid))
+				return git_odb__error_ambiguous("found multiple pack entries");
 			git_oid_cpy(&found_full_oid, &e->sha1);
 			found = true;
 		}
 	}
 
 	for (i = 0; i < backend->packs.length; ++i) {
-		struct git_pack_file *p;
-
 		p = git_vector_get(&backend->packs, i);
 		if (p == last_found)
 			continue;
@@ -328,6 +401,143 @@ static int pack_entry_find_prefix(
  * Implement the git_odb_backend API calls
  *
  ***********************************************************/
+static void remove_multi_pack_index(struct pack_backend *backend)
+{
+	size_t i, j = git_vector_length(&backend->packs);
+	struct git_pack_file *p;
+
+	/* the packs stay loaded, they are just no longer covered by the midx */
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		if (git_vector_insert(&backend->packs, p) < 0)
+			git_mwindow_put_pack(p);
+	}
+
+	if (j != git_vector_length(&backend->packs))
+		git_vector_sort(&backend->packs);
+
+	git_vector_clear(&backend->midx_packs);
+	git_midx_free(backend->midx);
+	backend->midx = NULL;
+}
+
+static int process_multi_pack_index_pack(
+	struct pack_backend *backend,
+	size_t i,
+	const char *packfile_name)
+{
+	int error;
+	struct git_pack_file *pack;
+	size_t found_position;
+	git_buf pack_path = GIT_BUF_INIT, index_prefix = GIT_BUF_INIT;
+
+	error = git_buf_joinpath(&pack_path, backend->pack_folder, packfile_name);
+	if (error < 0)
+		return error;
+
+	/* This is ensured by midx_parse_packfile_name() */
+	if (git_buf_len(&pack_path) <= strlen(".idx") ||
+	    git__suffixcmp(git_buf_cstr(&pack_path), ".idx") != 0) {
+		git_buf_dispose(&pack_path);
+		return git_odb__error_notfound("midx file contained a non-index", NULL, 0);
+	}
+
+	git_buf_attach_notowned(&index_prefix, git_buf_cstr(&pack_path),
+		git_buf_len(&pack_path) - strlen(".idx"));
+
+	/* a pack that is already loaded moves over to the midx packs */
+	for (found_position = 0; found_position < backend->packs.length; ++found_position) {
+		struct git_pack_file *p = git_vector_get(&backend->packs, found_position);
+
+		if (strncmp(p->pack_name, git_buf_cstr(&index_prefix),
+				git_buf_len(&index_prefix)) == 0 &&
+		    p->pack_name[git_buf_len(&index_prefix)] == '.')
+			break;
+	}
+
+	if (found_position < backend->packs.length) {
+		pack = git_vector_get(&backend->packs, found_position);
+		git_vector_remove(&backend->packs, found_position);
+		if (backend->last_found == pack)
+			backend->last_found = NULL;
+		git_buf_dispose(&pack_path);
+		return git_vector_set(NULL, &backend->midx_packs, i, pack);
+	}
+
+	/* Pack was not found. Allocate a new one. */
+	error = git_mwindow_get_pack(&pack, git_buf_cstr(&pack_path));
+	git_buf_dispose(&pack_path);
+	if (error < 0)
+		return error;
+
+	return git_vector_set(NULL, &backend->midx_packs, i, pack);
+}
+
+/*
+ * Reads the multi-pack-index. If this fails for whatever reason, the
+ * multi-pack-index object is freed, and all the packfiles that are related to
+ * it are moved to the unindexed packfiles vector.
+ */
+static int refresh_multi_pack_index(struct pack_backend *backend)
+{
+	int error;
+	git_buf midx_path = GIT_BUF_INIT;
+	const char *packfile_name;
+	size_t i;
+
+	error = git_buf_joinpath(&midx_path, backend->pack_folder, GIT_MIDX_FILE);
+	if (error < 0)
+		return error;
+
+	/*
+	 * Check whether the multi-pack-index has changed. If it has, close any
+	 * old multi-pack-index and move all the packfiles to the unindexed
+	 * packs. This is done to prevent losing any open packfiles in case
+	 * refreshing the new multi-pack-index fails, or the file is deleted.
+	 */
+	if (backend->midx) {
+		if (!git_midx_needs_refresh(backend->midx, git_buf_cstr(&midx_path))) {
+			git_buf_dispose(&midx_path);
+			return 0;
+		}
+		remove_multi_pack_index(backend);
+	}
+
+	if (!git_path_exists(git_buf_cstr(&midx_path))) {
+		git_buf_dispose(&midx_path);
+		return 0;
+	}
+
+	/* a broken multi-pack-index is ignored; the packs are still there */
+	error = git_midx_open(&backend->midx, git_buf_cstr(&midx_path));
+	git_buf_dispose(&midx_path);
+	if (error < 0) {
+		git_error_clear();
+		backend->midx = NULL;
+		return 0;
+	}
+
+	git_vector_resize_to(&backend->midx_packs, git_vector_length(&backend->midx->packfile_names));
+
+	git_vector_foreach(&backend->midx->packfile_names, i, packfile_name) {
+		error = process_multi_pack_index_pack(backend, i, packfile_name);
+		if (error < 0) {
+			/*
+			 * Something failed during reading multi-pack-index.
+			 * Restore the state of backend as if the
+			 * multi-pack-index was never there, and move all
+			 * packfiles that have been processed so far to the
+			 * unindexed packs.
+			 */
+			git_vector_resize_to(&backend->midx_packs, i);
+			remove_multi_pack_index(backend);
+			git_error_clear();
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
 static int pack_backend__refresh(git_odb_backend *backend_)
 {
 	int error;
@@ -341,6 +551,9 @@ static int pack_backend__refresh(git_odb_backend *backend_)
 	if (p_stat(backend->pack_folder, &st) < 0 || !S_ISDIR(st.st_mode))
 		return git_odb__error_notfound("failed to refresh packfiles", NULL, 0);
 
+	if ((error = refresh_multi_pack_index(backend)) < 0)
+		return error;
+
 	git_buf_sets(&path, backend->pack_folder);
 
 	/* reload all packs */
@@ -408,6 +621,164 @@ static int pack_backend__read(
 	return 0;
 }
 
+/*
+ * The objects of a batched read are handed out to the threads in runs
+ * of this many, which keeps neighbouring objects, which tend to share
+ * delta bases, on one thread.
+ */
+#define READ_MANY_BATCH_SIZE 16
+
+struct pack_read {
+	size_t pos;
+	struct git_pack_file *p;
+	git_off_t offset;
+	git_rawobj raw;
+	int error;
+	git_error_state error_state;
+};
+
+struct pack_read_many {
+	struct pack_read *reads;
+	size_t count;
+	git_atomic next;
+};
+
+static int pack_read_cmp(const void *a, const void *b)
+{
+	const struct pack_read *ra = a, *rb = b;
+
+	if (ra->p != rb->p)
+		return ((uintptr_t)ra->p < (uintptr_t)rb->p) ? -1 : 1;
+
+	return (ra->offset < rb->offset) ? -1 : (ra->offset > rb->offset);
+}
+
+static void *pack_read_worker(void *payload)
+{
+	struct pack_read_many *ctx = payload;
+	struct pack_read *read;
+	git_off_t offset;
+	size_t start, i;
+
+	while ((start = (size_t)git_atomic_add(&ctx->next, READ_MANY_BATCH_SIZE) -
+			READ_MANY_BATCH_SIZE) < ctx->count) {
+		for (i = start; i < ctx->count && i < start + READ_MANY_BATCH_SIZE; i++) {
+			read = &ctx->reads[i];
+			offset = read->offset;
+			read->error = git_packfile_unpack(&read->raw, read->p, &offset);
+
+			/* keep the message, which is lost with the worker thread */
+			if (read->error < 0)
+				git_error_state_capture(&read->error_state, read->error);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Inflate the objects in the order they are in their packs, so that the
+ * packs are read sequentially and the delta base cache serves the bases
+ * that several of them share, on as many threads as are worth it.
+ */
+static void pack_read_objects(struct pack_read_many *ctx)
+{
+#ifdef GIT_THREADS
+	git_thread *threads = NULL;
+	size_t nr_threads, started = 0, i;
+
+	if ((nr_threads = git_odb__read_threads) == 0)
+		nr_threads = git_online_cpus();
+
+	nr_threads = min(nr_threads,
+		(ctx->count + READ_MANY_BATCH_SIZE - 1) / READ_MANY_BATCH_SIZE);
+
+	if (nr_threads > 1 &&
+	    (threads = git__mallocarray(nr_threads - 1, sizeof(git_thread))) != NULL) {
+		for (started = 0; started < nr_threads - 1; started++) {
+			if (git_thread_create(&threads[started], pack_read_worker, ctx) != 0)
+				break;
+		}
+	}
+
+	/* Work alongside the workers; this covers a failure to start them, too */
+	pack_read_worker(ctx);
+
+	for (i = 0; i < started; i++)
+		git_thread_join(&threads[i], NULL);
+
+	git__free(threads);
+#else
+	pack_read_worker(ctx);
+#endif
+}
+
+static int pack_backend__read_many(
+	void **buffers, size_t *lens, git_object_t *types,
+	git_odb_backend *_backend, const git_oid *ids, size_t count)
+{
+	struct pack_backend *backend = (struct pack_backend *)_backend;
+	struct pack_read_many ctx = { 0 };
+	struct pack_read *read;
+	struct git_pack_entry e;
+	size_t i;
+	int error = 0;
+
+	if ((ctx.reads = git__calloc(count ? count : 1, sizeof(struct pack_read))) == NULL)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		if (types[i] != GIT_OBJECT_INVALID)
+			continue;
+
+		if ((error = pack_entry_find(&e, backend, &ids[i])) == GIT_ENOTFOUND)
+			continue;
+		else if (error < 0)
+			goto done;
+
+		read = &ctx.reads[ctx.count++];
+		read->pos = i;
+		read->p = e.p;
+		read->offset = e.offset;
+	}
+
+	error = 0;
+	git_error_clear();
+
+	qsort(ctx.reads, ctx.count, sizeof(struct pack_read), pack_read_cmp);
+	pack_read_objects(&ctx);
+
+	for (i = 0; i < ctx.count; i++) {
+		read = &ctx.reads[i];
+
+		/* the first failure is the one we report */
+		if (read->error < 0) {
+			error = read->error;
+			git_error_state_restore(&read->error_state);
+			goto done;
+		}
+	}
+
+	for (i = 0; i < ctx.count; i++) {
+		read = &ctx.reads[i];
+
+		buffers[read->pos] = read->raw.data;
+		lens[read->pos] = read->raw.len;
+		types[read->pos] = read->raw.type;
+	}
+
+done:
+	for (i = 0; i < ctx.count; i++) {
+		if (error < 0 && ctx.reads[i].error == 0)
+			git__free(ctx.reads[i].raw.data);
+
+		git_error_state_free(&ctx.reads[i].error_state);
+	}
+
+	git__free(ctx.reads);
+	return error;
+}
+
 static int pack_backend__read_prefix(
 	git_oid *out_oid,
 	void **buffer_p,
@@ -477,6 +848,9 @@ static int pack_backend__foreach(git_odb_backend *_backend, git_odb_foreach_cb c
 	if ((error = pack_backend__refresh(_backend)) < 0)
 		return error;
 
+	if (backend->midx && (error = git_midx_foreach_entry(backend->midx, cb, data)) != 0)
+		return error;
+
 	git_vector_foreach(&backend->packs, i, p) {
 		if ((error = git_pack_foreach_entry(p, cb, data)) != 0)
 			return error;
@@ -551,6 +925,82 @@ static int pack_backend__writepack(struct git_odb_writepack **out,
 	return 0;
 }
 
+static int get_idx_path(
+		git_buf *idx_path,
+		struct pack_backend *backend,
+		struct git_pack_file *p)
+{
+	size_t path_len;
+	int error;
+
+	error = git_path_prettify(idx_path, p->pack_name, backend->pack_folder);
+	if (error < 0)
+		return error;
+	path_len = git_buf_len(idx_path);
+	if (path_len <= strlen(".pack") || git__suffixcmp(git_buf_cstr(idx_path), ".pack") != 0)
+		return git_odb__error_notfound("packfile does not end in .pack", NULL, 0);
+	path_len -= strlen(".pack");
+	error = git_buf_splice(idx_path, path_len, strlen(".pack"), ".idx", strlen(".idx"));
+	if (error < 0)
+		return error;
+
+	return 0;
+}
+
+static int pack_backend__writemidx(git_odb_backend *_backend)
+{
+	struct pack_backend *backend;
+	git_midx_writer *w = NULL;
+	struct git_pack_file *p;
+	size_t i;
+	int error = 0;
+
+	assert(_backend);
+
+	backend = (struct pack_backend *)_backend;
+
+	if (backend->pack_folder == NULL)
+		return 0;
+
+	error = git_midx_writer_new(&w, backend->pack_folder);
+	if (error < 0)
+		return error;
+
+	git_vector_foreach(&backend->midx_packs, i, p) {
+		git_buf idx_path = GIT_BUF_INIT;
+		error = get_idx_path(&idx_path, backend, p);
+		if (error < 0)
+			goto cleanup;
+		error = git_midx_writer_add(w, git_buf_cstr(&idx_path));
+		git_buf_dispose(&idx_path);
+		if (error < 0)
+			goto cleanup;
+	}
+	git_vector_foreach(&backend->packs, i, p) {
+		git_buf idx_path = GIT_BUF_INIT;
+		error = get_idx_path(&idx_path, backend, p);
+		if (error < 0)
+			goto cleanup;
+		error = git_midx_writer_add(w, git_buf_cstr(&idx_path));
+		git_buf_dispose(&idx_path);
+		if (error < 0)
+			goto cleanup;
+	}
+
+	/*
+	 * Invalidate the previous midx before writing the new one.
+	 */
+	remove_multi_pack_index(backend);
+	error = git_midx_writer_commit(w);
+	if (error < 0)
+		goto cleanup;
+	error = refresh_multi_pack_index(backend);
+
+cleanup:
+	git_midx_writer_free(w);
+	return error;
+}
+
 static void pack_backend__free(git_odb_backend *_backend)
 {
 	struct pack_backend *backend;
@@ -560,11 +1010,17 @@ static void pack_backend__free(git_odb_backend *_backend)
 
 	backend = (struct pack_backend *)_backend;
 
+	for (i = 0; i < backend->midx_packs.length; ++i) {
+		struct git_pack_file *p = git_vector_get(&backend->midx_packs, i);
+		git_mwindow_put_pack(p);
+	}
 	for (i = 0; i < backend->packs.length; ++i) {
 		struct git_pack_file *p = git_vector_get(&backend->packs, i);
 		git_mwindow_put_pack(p);
 	}
 
+	git_midx_free(backend->midx);
+	git_vector_free(&backend->midx_packs);
 	git_vector_free(&backend->packs);
 	git__free(backend->pack_folder);
 	git__free(backend);
@@ -575,7 +1031,13 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	struct pack_backend *backend = git__calloc(1, sizeof(struct pack_backend));
 	GIT_ERROR_CHECK_ALLOC(backend);
 
+	if (git_vector_init(&backend->midx_packs, 0, NULL) < 0) {
+		git__free(backend);
+		return -1;
+	}
+
 	if (git_vector_init(&backend->packs, initial_size, packfile_sort__cb) < 0) {
+		git_vector_free(&backend->midx_packs);
 		git__free(backend);
 		return -1;
 	}
@@ -585,11 +1047,13 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	backend->parent.read = &pack_backend__read;
 	backend->parent.read_prefix = &pack_backend__read_prefix;
 	backend->parent.read_header = &pack_backend__read_header;
+	backend->parent.read_many = &pack_backend__read_many;
 	backend->parent.exists = &pack_backend__exists;
 	backend->parent.exists_prefix = &pack_backend__exists_prefix;
 	backend->parent.refresh = &pack_backend__refresh;
 	backend->parent.foreach = &pack_backend__foreach;
 	backend->parent.writepack = &pack_backend__writepack;
+	backend->parent.writemidx = &pack_backend__writemidx;
 	backend->parent.freshen = &pack_backend__freshen;
 	backend->parent.free = &pack_backend__free;
 
@@ -597,6 +1061,15 @@ static int pack_backend__alloc(struct pack_backend **out, size_t initial_size)
 	return 0;
 }
 
+int git_odb__pack_backend_entry(
+	struct git_pack_entry *out, git_odb_backend *backend, const git_oid *id)
+{
+	if (backend->read != &pack_backend__read)
+		return GIT_PASSTHROUGH;
+
+	return pack_entry_find(out, (struct pack_backend *)backend, id);
+}
+
 int git_odb_backend_one_pack(git_odb_backend **backend_out, const char *idx)
 {
 	struct pack_backend *backend = NULL;
@@ -0,0 +1,681 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "pack-bitmap.h"
+
+#include "array.h"
+#include "commit.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "hash.h"
+#include "pack.h"
+#include "repository.h"
+#include "tree.h"
+
+#define BITMAP_SIGNATURE "BITM"
+#define BITMAP_VERSION 1
+
+/* Every bitmap covers the full closure of its commit. */
+#define BITMAP_OPT_FULL_DAG 0x1
+/* The file ends with the name hash of every object, in `.idx` order. */
+#define BITMAP_OPT_HASH_CACHE 0x4
+
+/* Entries may be XOR-ed with an entry at most this far back. */
+#define BITMAP_MAX_XOR_OFFSET 160
+
+struct git_pack_bitmap_header {
+	char signature[4];
+	uint16_t version;
+	uint16_t options;
+	uint32_t entry_count;
+	git_oid pack_checksum;
+};
+
+struct bitmap_object {
+	git_oid id;
+	git_off_t offset;
+	uint32_t idx_pos;
+};
+
+struct stored_bitmap {
+	git_oid commit;
+	const unsigned char *data;
+	size_t len;
+	/* the entry this one is XOR-ed with, if any */
+	struct stored_bitmap *xor_base;
+	/* the decoded bitmap, once `loaded` is set */
+	git_bitmap bitmap;
+	unsigned int loaded:1;
+};
+
+struct git_pack_bitmap_index {
+	git_map map;
+
+	/* The objects of the pack, in pack (offset) order. */
+	struct bitmap_object *objects;
+	size_t num_objects;
+	/* Maps an `.idx` position to a pack position. */
+	uint32_t *idx_to_pos;
+	/* Maps an object id to its `struct bitmap_object`. */
+	git_oidmap *positions;
+
+	/* The stored commit bitmaps, keyed by commit id. */
+	git_mutex lock; /* protects decoding them */
+	struct stored_bitmap *entries;
+	size_t num_entries;
+	git_oidmap *commits;
+
+	/* The name-hash cache, in `.idx` order, or NULL. */
+	const unsigned char *hashes;
+};
+
+static int bitmap_error(const char *message)
+{
+	git_error_set(GIT_ERROR_ODB, "invalid bitmap index: %s", message);
+	return -1;
+}
+
+typedef git_array_t(struct bitmap_object) bitmap_object_array_t;
+
+static int collect_object(const git_oid *id, git_off_t offset, void *payload)
+{
+	bitmap_object_array_t *objects = payload;
+	struct bitmap_object *obj = git_array_alloc(*objects);
+	GIT_ERROR_CHECK_ALLOC(obj);
+
+	git_oid_cpy(&obj->id, id);
+	obj->offset = offset;
+	obj->idx_pos = (uint32_t)(git_array_size(*objects) - 1);
+
+	return 0;
+}
+
+static int bitmap_object_cmp(const void *a_, const void *b_)
+{
+	const struct bitmap_object *a = a_, *b = b_;
+
+	if (a->offset < b->offset)
+		return -1;
+	return a->offset > b->offset ? 1 : 0;
+}
+
+/* Lay out the objects of the pack in offset order. */
+static int index_init_positions(git_pack_bitmap_index *idx, struct git_pack_file *p)
+{
+	bitmap_object_array_t objects = GIT_ARRAY_INIT;
+	size_t i;
+	int error;
+
+	if ((error = git_pack_foreach_entry_offset(p, collect_object, &objects)) < 0) {
+		git_array_clear(objects);
+		return error;
+	}
+
+	idx->objects = objects.ptr;
+	idx->num_objects = git_array_size(objects);
+	idx->idx_to_pos = git__calloc(idx->num_objects ? idx->num_objects : 1, sizeof(uint32_t));
+	GIT_ERROR_CHECK_ALLOC(idx->idx_to_pos);
+
+	qsort(idx->objects, idx->num_objects, sizeof(struct bitmap_object), bitmap_object_cmp);
+
+	if (git_oidmap_new(&idx->positions) < 0)
+		return -1;
+
+	for (i = 0; i < idx->num_objects; i++) {
+		idx->idx_to_pos[idx->objects[i].idx_pos] = (uint32_t)i;
+
+		if (git_oidmap_set(idx->positions, &idx->objects[i].id, &idx->objects[i]) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int index_position(size_t *out, git_pack_bitmap_index *idx, const git_oid *id)
+{
+	struct bitmap_object *obj;
+
+	if ((obj = git_oidmap_get(idx->positions, id)) == NULL)
+		return GIT_PASSTHROUGH;
+
+	*out = obj - idx->objects;
+	return 0;
+}
+
+static int index_parse(
+	git_pack_bitmap_index *idx,
+	struct git_pack_file *p,
+	const unsigned char *data,
+	size_t size)
+{
+	const struct git_pack_bitmap_header *hdr;
+	const unsigned char *ptr, *end;
+	const git_oid *pack_checksum;
+	git_bitmap scratch = GIT_BITMAP_INIT;
+	size_t consumed, i;
+	uint16_t options;
+	int error = 0;
+
+	if (size < sizeof(struct git_pack_bitmap_header) + GIT_OID_RAWSZ)
+		return bitmap_error("file is too short");
+
+	hdr = (const struct git_pack_bitmap_header *)data;
+	if (memcmp(hdr->signature, BITMAP_SIGNATURE, 4) != 0 ||
+	    ntohs(hdr->version) != BITMAP_VERSION)
+		return bitmap_error("unsupported signature or version");
+
+	options = ntohs(hdr->options);
+	if (!(options & BITMAP_OPT_FULL_DAG))
+		return bitmap_error("bitmaps do not cover the full DAG");
+
+	pack_checksum = (const git_oid *)((const unsigned char *)p->index_map.data + p->index_map.len - 40);
+	if (!git_oid_equal(&hdr->pack_checksum, pack_checksum))
+		return bitmap_error("pack checksum mismatch");
+
+	ptr = data + sizeof(struct git_pack_bitmap_header);
+	end = data + size - GIT_OID_RAWSZ;
+
+	/* The commit, tree, blob and tag bitmaps. */
+	for (i = 0; i < 4; i++) {
+		if ((error = git_bitmap_read_ewah(&scratch, &consumed, ptr, end - ptr)) < 0)
+			goto done;
+		ptr += consumed;
+	}
+
+	idx->num_entries = ntohl(hdr->entry_count);
+	idx->entries = git__calloc(idx->num_entries ? idx->num_entries : 1, sizeof(struct stored_bitmap));
+	GIT_ERROR_CHECK_ALLOC(idx->entries);
+
+	if ((error = git_oidmap_new(&idx->commits)) < 0)
+		goto done;
+
+	for (i = 0; i < idx->num_entries; i++) {
+		struct stored_bitmap *entry = &idx->entries[i];
+		uint32_t idx_pos;
+		uint8_t xor_offset;
+
+		if (end - ptr < 6) {
+			error = bitmap_error("truncated entry");
+			goto done;
+		}
+
+		idx_pos = ntohl(*(const uint32_t *)ptr);
+		xor_offset = ptr[4];
+		ptr += 6;
+
+		if (idx_pos >= idx->num_objects) {
+			error = bitmap_error("entry refers to an unknown object");
+			goto done;
+		}
+		if (xor_offset > BITMAP_MAX_XOR_OFFSET || xor_offset > i) {
+			error = bitmap_error("invalid XOR offset");
+			goto done;
+		}
+
+		git_oid_cpy(&entry->commit, &idx->objects[idx->idx_to_pos[idx_pos]].id);
+		entry->xor_base = xor_offset ? &idx->entries[i - xor_offset] : NULL;
+		entry->data = ptr;
+
+		if ((error = git_bitmap_read_ewah(&scratch, &consumed, ptr, end - ptr)) < 0)
+			goto done;
+		entry->len = consumed;
+		ptr += consumed;
+
+		if ((error = git_oidmap_set(idx->commits, &entry->commit, entry)) < 0)
+			goto done;
+	}
+
+	if (options & BITMAP_OPT_HASH_CACHE) {
+		if ((size_t)(end - ptr) / 4 < idx->num_objects) {
+			error = bitmap_error("truncated name-hash cache");
+			goto done;
+		}
+		idx->hashes = ptr;
+	}
+
+done:
+	git_bitmap_dispose(&scratch);
+	return error;
+}
+
+int git_pack_bitmap_index_open(
+	git_pack_bitmap_index **out,
+	struct git_pack_file *p,
+	const char *path)
+{
+	git_pack_bitmap_index *idx;
+	git_file fd;
+	struct stat st;
+	int error;
+
+	*out = NULL;
+
+	if ((fd = git_futils_open_ro(path)) < 0)
+		return fd;
+
+	if (p_fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || !git__is_sizet(st.st_size)) {
+		p_close(fd);
+		git_error_set(GIT_ERROR_ODB, "invalid bitmap index '%s'", path);
+		return -1;
+	}
+
+	idx = git__calloc(1, sizeof(git_pack_bitmap_index));
+	if (!idx) {
+		p_close(fd);
+		return -1;
+	}
+
+	if (git_mutex_init(&idx->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize bitmap index mutex");
+		git__free(idx);
+		p_close(fd);
+		return -1;
+	}
+
+	error = git_futils_mmap_ro(&idx->map, fd, 0, (size_t)st.st_size);
+	p_close(fd);
+
+	if (error < 0 ||
+	    (error = index_init_positions(idx, p)) < 0 ||
+	    (error = index_parse(idx, p, idx->map.data, idx->map.len)) < 0) {
+		git_pack_bitmap_index_free(idx);
+		return error;
+	}
+
+	*out = idx;
+	return 0;
+}
+
+void git_pack_bitmap_index_free(git_pack_bitmap_index *idx)
+{
+	size_t i;
+
+	if (!idx)
+		return;
+
+	if (idx->map.data)
+		git_futils_mmap_free(&idx->map);
+
+	git_oidmap_free(idx->positions);
+	git_oidmap_free(idx->commits);
+	git__free(idx->objects);
+	git__free(idx->idx_to_pos);
+
+	for (i = 0; idx->entries && i < idx->num_entries; i++)
+		git_bitmap_dispose(&idx->entries[i].bitmap);
+	git__free(idx->entries);
+	git_mutex_free(&idx->lock);
+	git__free(idx);
+}
+
+size_t git_pack_bitmap_index_entrycount(git_pack_bitmap_index *idx)
+{
+	return idx->num_objects;
+}
+
+const git_oid *git_pack_bitmap_index_oid(git_pack_bitmap_index *idx, size_t pos)
+{
+	return pos < idx->num_objects ? &idx->objects[pos].id : NULL;
+}
+
+uint32_t git_pack_bitmap_index_name_hash(git_pack_bitmap_index *idx, size_t pos)
+{
+	if (!idx->hashes || pos >= idx->num_objects)
+		return 0;
+
+	return ntohl(*(const uint32_t *)(idx->hashes + 4 * idx->objects[pos].idx_pos));
+}
+
+/*
+ * Decode a stored bitmap, XOR-ed with its chain of bases. The chain is
+ * resolved from its first undecoded base upwards, and every decoded
+ * bitmap is kept, so bases shared by several entries are decoded once.
+ * Decoded bitmaps never change, so they can be read without the lock.
+ */
+static int stored_bitmap_load(
+	const git_bitmap **out,
+	git_pack_bitmap_index *idx,
+	struct stored_bitmap *entry)
+{
+	git_array_t(struct stored_bitmap *) chain = GIT_ARRAY_INIT;
+	struct stored_bitmap **pending, *e;
+	size_t consumed;
+	int error = 0;
+
+	if (git_mutex_lock(&idx->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock bitmap index");
+		return -1;
+	}
+
+	for (e = entry; e && !e->loaded; e = e->xor_base) {
+		if ((pending = git_array_alloc(chain)) == NULL) {
+			error = -1;
+			goto done;
+		}
+		*pending = e;
+	}
+
+	while ((pending = git_array_pop(chain)) != NULL) {
+		e = *pending;
+
+		if ((error = git_bitmap_read_ewah(&e->bitmap, &consumed, e->data, e->len)) < 0 ||
+		    (e->xor_base && (error = git_bitmap_xor(&e->bitmap, &e->xor_base->bitmap)) < 0))
+			break;
+
+		e->loaded = 1;
+	}
+
+done:
+	git_mutex_unlock(&idx->lock);
+	git_array_clear(chain);
+
+	*out = &entry->bitmap;
+	return error;
+}
+
+typedef git_array_t(git_oid) oid_array_t;
+
+struct fill_context {
+	git_pack_bitmap_index *idx;
+	git_repository *repo;
+	git_bitmap *bitmap;
+	/* bitmaps computed while writing, keyed by commit id */
+	git_oidmap *computed;
+};
+
+static int fill_tree(struct fill_context *ctx, const git_oid *id)
+{
+	git_tree *tree = NULL;
+	size_t pos, i;
+	int error;
+
+	if ((error = index_position(&pos, ctx->idx, id)) < 0)
+		return error;
+
+	if (git_bitmap_get(ctx->bitmap, pos))
+		return 0;
+
+	if ((error = git_bitmap_set(ctx->bitmap, pos)) < 0 ||
+	    (error = git_tree_lookup(&tree, ctx->repo, id)) < 0)
+		return error;
+
+	for (i = 0; i < git_tree_entrycount(tree); i++) {
+		const git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+
+		switch (git_tree_entry_type(entry)) {
+		case GIT_OBJECT_TREE:
+			error = fill_tree(ctx, git_tree_entry_id(entry));
+			break;
+		case GIT_OBJECT_BLOB:
+			if ((error = index_position(&pos, ctx->idx, git_tree_entry_id(entry))) == 0)
+				error = git_bitmap_set(ctx->bitmap, pos);
+			break;
+		default:
+			/* submodule commits are not part of the closure */
+			break;
+		}
+
+		if (error < 0)
+			break;
+	}
+
+	git_tree_free(tree);
+	return error;
+}
+
+static int fill_commit(struct fill_context *ctx, oid_array_t *pending, const git_oid *id)
+{
+	struct stored_bitmap *stored;
+	const git_bitmap *computed;
+	git_commit *commit;
+	size_t pos, i;
+	int error;
+
+	if ((error = index_position(&pos, ctx->idx, id)) < 0)
+		return error;
+
+	if (git_bitmap_get(ctx->bitmap, pos))
+		return 0;
+
+	if (ctx->idx->commits &&
+	    (stored = git_oidmap_get(ctx->idx->commits, id)) != NULL) {
+		const git_bitmap *loaded;
+
+		if ((error = stored_bitmap_load(&loaded, ctx->idx, stored)) < 0)
+			return error;
+
+		return git_bitmap_or(ctx->bitmap, loaded);
+	}
+
+	if (ctx->computed &&
+	    (computed = git_oidmap_get(ctx->computed, id)) != NULL)
+		return git_bitmap_or(ctx->bitmap, computed);
+
+	if ((error = git_bitmap_set(ctx->bitmap, pos)) < 0 ||
+	    (error = git_commit_lookup(&commit, ctx->repo, id)) < 0)
+		return error;
+
+	if ((error = fill_tree(ctx, git_commit_tree_id(commit))) < 0)
+		goto done;
+
+	for (i = 0; i < git_commit_parentcount(commit); i++) {
+		git_oid *parent = git_array_alloc(*pending);
+		GIT_ERROR_CHECK_ALLOC(parent);
+
+		git_oid_cpy(parent, git_commit_parent_id(commit, (unsigned int)i));
+	}
+
+done:
+	git_commit_free(commit);
+	return error;
+}
+
+static int fill(struct fill_context *ctx, const git_oid *id)
+{
+	oid_array_t pending = GIT_ARRAY_INIT;
+	git_oid *next, current;
+	int error = 0;
+
+	next = git_array_alloc(pending);
+	GIT_ERROR_CHECK_ALLOC(next);
+	git_oid_cpy(next, id);
+
+	while ((next = git_array_pop(pending)) != NULL) {
+		git_oid_cpy(&current, next);
+
+		if ((error = fill_commit(ctx, &pending, &current)) < 0)
+			break;
+	}
+
+	git_array_clear(pending);
+	return error;
+}
+
+int git_pack_bitmap_index_fill(
+	git_bitmap *bitmap,
+	git_pack_bitmap_index *idx,
+	git_repository *repo,
+	const git_oid *id)
+{
+	struct fill_context ctx = { idx, repo, bitmap, NULL };
+
+	return fill(&ctx, id);
+}
+
+static int put_be32(git_buf *out, uint32_t value)
+{
+	value = htonl(value);
+	return git_buf_put(out, (const char *)&value, sizeof(value));
+}
+
+static int write_bitmaps(
+	git_buf *out,
+	git_pack_bitmap_index *idx,
+	struct git_pack_file *p,
+	git_repository *repo,
+	git_vector *commits,
+	git_pack_bitmap_object_cb object_cb,
+	void *payload)
+{
+	struct git_pack_bitmap_header hdr;
+	git_bitmap types[4] = { GIT_BITMAP_INIT, GIT_BITMAP_INIT, GIT_BITMAP_INIT, GIT_BITMAP_INIT };
+	git_array_t(const git_oid *) selected = GIT_ARRAY_INIT;
+	git_oidmap *computed = NULL;
+	git_bitmap *bitmap;
+	uint32_t *name_hashes = NULL;
+	const git_oid *id;
+	git_oid checksum;
+	size_t i, pos;
+	int error;
+
+	if ((error = git_oidmap_new(&computed)) < 0)
+		goto done;
+
+	name_hashes = git__calloc(idx->num_objects ? idx->num_objects : 1, sizeof(uint32_t));
+	GIT_ERROR_CHECK_ALLOC(name_hashes);
+
+	for (pos = 0; pos < idx->num_objects; pos++) {
+		const struct bitmap_object *obj = &idx->objects[pos];
+		git_object_t type;
+		uint32_t hash = 0;
+
+		if ((error = object_cb(&type, &hash, &obj->id, payload)) < 0)
+			goto done;
+
+		switch (type) {
+		case GIT_OBJECT_COMMIT: error = git_bitmap_set(&types[0], pos); break;
+		case GIT_OBJECT_TREE: error = git_bitmap_set(&types[1], pos); break;
+		case GIT_OBJECT_BLOB: error = git_bitmap_set(&types[2], pos); break;
+		case GIT_OBJECT_TAG: error = git_bitmap_set(&types[3], pos); break;
+		default:
+			git_error_set(GIT_ERROR_ODB, "invalid object type in pack");
+			error = -1;
+		}
+
+		if (error < 0)
+			goto done;
+
+		name_hashes[obj->idx_pos] = hash;
+	}
+
+	/* Compute every selected bitmap, reusing the ones computed so far. */
+	git_vector_foreach(commits, i, id) {
+		struct fill_context ctx = { idx, repo, NULL, computed };
+		const git_oid **selected_id;
+
+		if (git_oidmap_exists(computed, id))
+			continue;
+
+		bitmap = git__calloc(1, sizeof(git_bitmap));
+		GIT_ERROR_CHECK_ALLOC(bitmap);
+
+		ctx.bitmap = bitmap;
+		if ((error = fill(&ctx, id)) < 0 ||
+		    (error = git_oidmap_set(computed, id, bitmap)) < 0) {
+			git_bitmap_dispose(bitmap);
+			git__free(bitmap);
+			goto done;
+		}
+
+		selected_id = git_array_alloc(selected);
+		GIT_ERROR_CHECK_ALLOC(selected_id);
+		*selected_id = id;
+	}
+
+	memcpy(hdr.signature, BITMAP_SIGNATURE, 4);
+	hdr.version = htons(BITMAP_VERSION);
+	hdr.options = htons(BITMAP_OPT_FULL_DAG | BITMAP_OPT_HASH_CACHE);
+	hdr.entry_count = htonl((uint32_t)git_array_size(selected));
+	git_oid_cpy(&hdr.pack_checksum,
+		(const git_oid *)((const unsigned char *)p->index_map.data + p->index_map.len - 40));
+
+	if ((error = git_buf_put(out, (const char *)&hdr, sizeof(hdr))) < 0)
+		goto done;
+
+	for (i = 0; i < 4; i++) {
+		if ((error = git_bitmap_write_ewah(out, &types[i])) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < git_array_size(selected); i++) {
+		id = *git_array_get(selected, i);
+		bitmap = git_oidmap_get(computed, id);
+		index_position(&pos, idx, id);
+
+		if ((error = put_be32(out, idx->objects[pos].idx_pos)) < 0 ||
+		    (error = git_buf_putc(out, 0)) < 0 || /* xor offset */
+		    (error = git_buf_putc(out, 0)) < 0 || /* flags */
+		    (error = git_bitmap_write_ewah(out, bitmap)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < idx->num_objects; i++) {
+		if ((error = put_be32(out, name_hashes[i])) < 0)
+			goto done;
+	}
+
+	if ((error = git_hash_buf(&checksum, out->ptr, out->size)) < 0 ||
+	    (error = git_buf_put(out, (const char *)checksum.id, GIT_OID_RAWSZ)) < 0)
+		goto done;
+
+done:
+	if (computed) {
+		git_oidmap_foreach_value(computed, bitmap, {
+			git_bitmap_dispose(bitmap);
+			git__free(bitmap);
+		});
+		git_oidmap_free(computed);
+	}
+	for (i = 0; i < 4; i++)
+		git_bitmap_dispose(&types[i]);
+	git_array_clear(selected);
+	git__free(name_hashes);
+	return error;
+}
+
+int git_pack_bitmap_write(
+	const char *path,
+	unsigned int mode,
+	struct git_pack_file *p,
+	git_repository *repo,
+	git_vector *commits,
+	git_pack_bitmap_object_cb object_cb,
+	void *payload)
+{
+	git_pack_bitmap_index *idx;
+	git_filebuf output = GIT_FILEBUF_INIT;
+	git_buf out = GIT_BUF_INIT;
+	int filebuf_flags = GIT_FILEBUF_DO_NOT_BUFFER;
+	int error;
+
+	assert(path && p && repo && commits && object_cb);
+
+	idx = git__calloc(1, sizeof(git_pack_bitmap_index));
+	GIT_ERROR_CHECK_ALLOC(idx);
+
+	if ((error = index_init_positions(idx, p)) < 0 ||
+	    (error = write_bitmaps(&out, idx, p, repo, commits, object_cb, payload)) < 0)
+		goto done;
+
+	if (git_repository__fsync_gitdir)
+		filebuf_flags |= GIT_FILEBUF_FSYNC;
+
+	if ((error = git_filebuf_open(&output, path, filebuf_flags, mode)) < 0)
+		goto done;
+
+	if ((error = git_filebuf_write(&output, out.ptr, out.size)) < 0) {
+		git_filebuf_cleanup(&output);
+		goto done;
+	}
+
+	error = git_filebuf_commit(&output);
+
+done:
+	git_buf_dispose(&out);
+	git_pack_bitmap_index_free(idx);
+	return error;
+}
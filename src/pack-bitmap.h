@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_pack_bitmap_h__
+#define INCLUDE_pack_bitmap_h__
+
+#include "common.h"
+
+#include "git2/oid.h"
+
+#include "bitmap.h"
+#include "map.h"
+#include "oidmap.h"
+#include "vector.h"
+
+struct git_pack_file;
+
+/*
+ * A reachability bitmap index (`.bitmap` file) for a single packfile.
+ *
+ * Bit `n` of every bitmap refers to the `n`th object of the pack in
+ * offset order. The index stores, for a selection of commits, the set
+ * of objects that are reachable from them, so that the objects needed
+ * to satisfy a set of wants and haves can be computed with a few
+ * bitwise operations instead of a full object walk.
+ */
+typedef struct git_pack_bitmap_index git_pack_bitmap_index;
+
+/*
+ * Open the `.bitmap` file at `path`, which belongs to the pack `p`.
+ * Returns GIT_ENOTFOUND if the file does not exist.
+ */
+int git_pack_bitmap_index_open(
+	git_pack_bitmap_index **out,
+	struct git_pack_file *p,
+	const char *path);
+
+void git_pack_bitmap_index_free(git_pack_bitmap_index *idx);
+
+/* The number of objects that the index covers. */
+size_t git_pack_bitmap_index_entrycount(git_pack_bitmap_index *idx);
+
+/* The id of the object at `pos`, in pack order. */
+const git_oid *git_pack_bitmap_index_oid(git_pack_bitmap_index *idx, size_t pos);
+
+/*
+ * The name hash of the object at `pos`, as used for delta base
+ * selection; zero if the index has no name-hash cache.
+ */
+uint32_t git_pack_bitmap_index_name_hash(git_pack_bitmap_index *idx, size_t pos);
+
+/*
+ * Add the objects reachable from the commit `id` to `bitmap`.
+ *
+ * Stored bitmaps are used wherever possible; the rest of the history
+ * is walked. Returns GIT_PASSTHROUGH if some of those objects are not
+ * in the pack, in which case the contents of `bitmap` are undefined.
+ *
+ * Stored bitmaps are kept decoded in the index once they were used.
+ */
+int git_pack_bitmap_index_fill(
+	git_bitmap *bitmap,
+	git_pack_bitmap_index *idx,
+	git_repository *repo,
+	const git_oid *id);
+
+/*
+ * Write a `.bitmap` file for the pack `p` to `path`, storing bitmaps
+ * for the commits in `commits` (a vector of `git_oid *`).
+ *
+ * `object_cb` is called for every object of the pack to supply its
+ * type and name hash. Returns GIT_PASSTHROUGH, without writing
+ * anything, if the pack is not closed under reachability from the
+ * selected commits.
+ */
+typedef int (*git_pack_bitmap_object_cb)(
+	git_object_t *type,
+	uint32_t *name_hash,
+	const git_oid *id,
+	void *payload);
+
+int git_pack_bitmap_write(
+	const char *path,
+	unsigned int mode,
+	struct git_pack_file *p,
+	git_repository *repo,
+	git_vector *commits,
+	git_pack_bitmap_object_cb object_cb,
+	void *payload);
+
+#endif
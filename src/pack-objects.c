@@ -11,7 +11,9 @@
 #include "delta.h"
 #include "iterator.h"
 #include "netops.h"
+#include "odb.h"
 #include "pack.h"
+#include "pack-bitmap.h"
 #include "thread-utils.h"
 #include "tree.h"
 #include "util.h"
@@ -43,8 +45,12 @@ struct pack_write_context {
 
 struct walk_object {
 	git_oid id;
+	unsigned int hash; /* name hint hash, for uninteresting blobs */
 	unsigned int uninteresting:1,
-		seen:1;
+		seen:1,
+		blob:1,
+		edge_tree:1,
+		thin_base:1;
 };
 
 #ifdef GIT_THREADS
@@ -72,6 +78,9 @@ struct walk_object {
 /* Size of the buffer to feed to zlib */
 #define COMPRESS_BUFLEN (1024 * 1024)
 
+/* Deflated data the write workers may keep waiting for the writer */
+#define DEFLATE_POOL_BUFFER (32 * 1024 * 1024)
+
 static unsigned name_hash(const char *name)
 {
 	unsigned c, hash = 0;
@@ -152,7 +161,8 @@ int git_packbuilder_new(git_packbuilder **out, git_repository *repo)
 	pb->repo = repo;
 	pb->nr_threads = 1; /* do not spawn any thread by default */
 
-	if (git_hash_ctx_init(&pb->ctx) < 0 ||
+	/* the checksum of the pack we write, which needs no detection */
+	if (git_hash_ctx_init_mode(&pb->ctx, GIT_HASH_MODE_FAST) < 0 ||
 		git_zstream_init(&pb->zstream, GIT_ZSTREAM_DEFLATE) < 0 ||
 		git_repository_odb(&pb->odb, repo) < 0 ||
 		packbuilder_config(pb) < 0)
@@ -192,6 +202,30 @@ unsigned int git_packbuilder_set_threads(git_packbuilder *pb, unsigned int n)
 	return pb->nr_threads;
 }
 
+int git_packbuilder_set_write_bitmap(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+
+	pb->write_bitmap = !!enabled;
+	return 0;
+}
+
+int git_packbuilder_set_ofs_delta(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+
+	pb->ofs_delta = !!enabled;
+	return 0;
+}
+
+int git_packbuilder_set_thin(git_packbuilder *pb, int enabled)
+{
+	assert(pb);
+
+	pb->thin = !!enabled;
+	return 0;
+}
+
 static int rehash(git_packbuilder *pb)
 {
 	git_pobject *po;
@@ -207,15 +241,13 @@ static int rehash(git_packbuilder *pb)
 	return 0;
 }
 
-int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
-			   const char *name)
+static int packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			      unsigned int hash)
 {
 	git_pobject *po;
 	size_t newsize;
 	int ret;
 
-	assert(pb && oid);
-
 	/* If the object already exists in the hash table, then we don't
 	 * have any work to do */
 	if (git_oidmap_exists(pb->object_ix, oid))
@@ -248,7 +280,7 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 
 	pb->nr_objects++;
 	git_oid_cpy(&po->id, oid);
-	po->hash = name_hash(name);
+	po->hash = hash;
 
 	if (git_oidmap_set(pb->object_ix, &po->id, po) < 0) {
 		git_error_set_oom();
@@ -276,44 +308,627 @@ int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
 	return 0;
 }
 
-static int get_delta(void **out, git_odb *odb, git_pobject *po)
+int git_packbuilder_insert(git_packbuilder *pb, const git_oid *oid,
+			   const char *name)
+{
+	assert(pb && oid);
+
+	return packbuilder_insert(pb, oid, name_hash(name));
+}
+
+static int get_delta(
+	void **out, git_odb *odb, git_pobject *po, git_pobject *base)
 {
 	git_odb_object *src = NULL, *trg = NULL;
 	size_t delta_size;
 	void *delta_buf;
 	int error;
 
-	*out = NULL;
+	*out = NULL;
+
+	if (git_odb_read(&src, odb, &base->id) < 0 ||
+	    git_odb_read(&trg, odb, &po->id) < 0)
+		goto on_error;
+
+	error = git_delta(&delta_buf, &delta_size,
+		git_odb_object_data(src), git_odb_object_size(src),
+		git_odb_object_data(trg), git_odb_object_size(trg),
+		0);
+
+	if (error < 0 && error != GIT_EBUFS)
+		goto on_error;
+
+	if (error == GIT_EBUFS || delta_size != po->delta_size) {
+		git_error_set(GIT_ERROR_INVALID, "delta size changed");
+		goto on_error;
+	}
+
+	*out = delta_buf;
+
+	git_odb_object_free(src);
+	git_odb_object_free(trg);
+	return 0;
+
+on_error:
+	git_odb_object_free(src);
+	git_odb_object_free(trg);
+	return -1;
+}
+
+/*
+ * Deltas against objects of the pack can give how far back their base
+ * is; deltas against objects the receiver has must name them.
+ */
+GIT_INLINE(bool) write_as_ofs_delta(git_packbuilder *pb, git_pobject *po)
+{
+	return pb->ofs_delta && !po->delta->preferred_base;
+}
+
+/* Write the reference to the delta base that follows a delta's header */
+static int write_delta_base(
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	unsigned char ofs[10];
+	size_t pos = sizeof(ofs) - 1;
+	git_off_t distance;
+	int error;
+
+	if (!write_as_ofs_delta(pb, po)) {
+		if ((error = write_cb(po->delta->id.id, GIT_OID_RAWSZ, cb_data)) < 0 ||
+		    (error = git_hash_update(&pb->ctx, po->delta->id.id, GIT_OID_RAWSZ)) < 0)
+			return error;
+
+		return 0;
+	}
+
+	/* The base is always written before the delta */
+	distance = po->offset - po->delta->offset;
+	assert(distance > 0);
+
+	ofs[pos] = distance & 127;
+	while (distance >>= 7)
+		ofs[--pos] = 128 | (--distance & 127);
+
+	if ((error = write_cb(ofs + pos, sizeof(ofs) - pos, cb_data)) < 0 ||
+	    (error = git_hash_update(&pb->ctx, ofs + pos, sizeof(ofs) - pos)) < 0)
+		return error;
+
+	return 0;
+}
+
+/*
+ * Find the delta base of the packed object whose header ends at
+ * `curpos`, and move `curpos` past the reference to it.
+ */
+static int packed_delta_base(
+	git_oid *out,
+	struct git_pack_file *p,
+	git_off_t offset,
+	git_off_t *curpos,
+	git_object_t type)
+{
+	git_mwindow *w = NULL;
+	git_off_t base_offset, end;
+	unsigned char *base_info;
+	unsigned int left;
+	uint32_t nth;
+
+	if (type == GIT_OBJECT_REF_DELTA) {
+		base_info = git_mwindow_open(&p->mwf, &w, *curpos, GIT_OID_RAWSZ, &left);
+		if (base_info == NULL || left < GIT_OID_RAWSZ) {
+			git_mwindow_close(&w);
+			return -1;
+		}
+
+		git_oid_fromraw(out, base_info);
+		git_mwindow_close(&w);
+
+		*curpos += GIT_OID_RAWSZ;
+		return 0;
+	}
+
+	base_offset = get_delta_base(p, &w, curpos, type, offset);
+	git_mwindow_close(&w);
+
+	if (base_offset <= 0 ||
+	    git_pack_entry_end(&end, &nth, p, base_offset) < 0 ||
+	    git_pack_nth_oid(out, p, nth) < 0)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Look for the object in the local packs.  When it is stored whole,
+ * its compressed data can be copied as it is, unless we find a delta
+ * for it.  When it is stored as a delta against another object that we
+ * are sending, the delta can be copied and there is no need to search
+ * for one.
+ */
+static int find_reusable(git_packbuilder *pb, git_pobject *po)
+{
+	struct git_pack_entry e;
+	git_mwindow *w = NULL;
+	git_off_t curpos;
+	git_object_t type;
+	git_pobject *base, *b;
+	git_oid base_id;
+	size_t size, depth;
+
+	if (po->reuse_pack || po->delta)
+		return 0;
+
+	if (git_odb__find_pack_entry(&e, pb->odb, &po->id) < 0)
+		goto not_reusable;
+
+	curpos = e.offset;
+	if (git_packfile_unpack_header(&size, &type, &e.p->mwf, &w, &curpos) < 0)
+		goto not_reusable;
+
+	git_mwindow_close(&w);
+
+	if (type == GIT_OBJECT_REF_DELTA || type == GIT_OBJECT_OFS_DELTA) {
+		if (packed_delta_base(&base_id, e.p, e.offset, &curpos, type) < 0)
+			goto not_reusable;
+
+		if ((base = git_oidmap_get(pb->object_ix, &base_id)) == NULL)
+			return 0;
+
+		/* Packs may disagree on which way a delta goes; don't loop. */
+		for (b = base, depth = 1; b; b = b->delta, depth++) {
+			if (b == po || depth >= GIT_PACK_DEPTH)
+				return 0;
+		}
+
+		po->delta = base;
+		po->delta_size = size;
+		po->reuse_delta = 1;
+
+		po->delta_sibling = base->delta_child;
+		base->delta_child = po;
+	} else if (type != po->type || size != po->size) {
+		return 0;
+	}
+
+	po->reuse_pack = e.p;
+	po->reuse_offset = e.offset;
+	return 0;
+
+not_reusable:
+	git_mwindow_close(&w);
+	git_error_clear();
+	return 0;
+}
+
+static int packed_crc(
+	uint32_t *out,
+	struct git_pack_file *p,
+	git_off_t start,
+	git_off_t end)
+{
+	git_mwindow *w = NULL;
+	unsigned char *data;
+	unsigned int left, len;
+	uint32_t crc = crc32(0L, Z_NULL, 0);
+
+	while (start < end) {
+		if ((data = git_mwindow_open(&p->mwf, &w, start, 0, &left)) == NULL) {
+			git_mwindow_close(&w);
+			return -1;
+		}
+
+		len = (unsigned int)min((git_off_t)left, end - start);
+		crc = crc32(crc, data, len);
+		start += len;
+	}
+
+	git_mwindow_close(&w);
+
+	*out = crc;
+	return 0;
+}
+
+static int write_packed(
+	git_packbuilder *pb,
+	struct git_pack_file *p,
+	git_off_t start,
+	git_off_t end,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	git_mwindow *w = NULL;
+	unsigned char *data;
+	unsigned int left, len;
+	int error = 0;
+
+	while (start < end) {
+		if ((data = git_mwindow_open(&p->mwf, &w, start, 0, &left)) == NULL) {
+			error = -1;
+			break;
+		}
+
+		len = (unsigned int)min((git_off_t)left, end - start);
+
+		if ((error = write_cb(data, len, cb_data)) < 0 ||
+		    (error = git_hash_update(&pb->ctx, data, len)) < 0)
+			break;
+
+		start += len;
+	}
+
+	git_mwindow_close(&w);
+	return error;
+}
+
+/*
+ * Copy an object, or the delta it is stored as, from the pack that
+ * holds it, once its packed bytes have been checked against the CRC
+ * recorded in the pack's index.  Returns GIT_PASSTHROUGH when it must
+ * be written the slow way instead.
+ */
+static int write_reused(
+	git_packbuilder *pb,
+	git_pobject *po,
+	int (*write_cb)(void *buf, size_t size, void *cb_data),
+	void *cb_data)
+{
+	struct git_pack_file *p = po->reuse_pack;
+	git_mwindow *w = NULL;
+	git_off_t curpos = po->reuse_offset, end;
+	git_object_t type;
+	git_oid base_id;
+	unsigned char hdr[10];
+	size_t hdr_len, size;
+	uint32_t nth, crc, expected_crc;
+	int error;
+
+	po->offset = pb->write_offset;
+
+	if (git_pack_entry_end(&end, &nth, p, po->reuse_offset) < 0 ||
+	    git_pack_nth_crc(&expected_crc, p, nth) < 0 ||
+	    git_packfile_unpack_header(&size, &type, &p->mwf, &w, &curpos) < 0) {
+		git_mwindow_close(&w);
+		goto passthrough;
+	}
+
+	git_mwindow_close(&w);
+
+	if (po->reuse_delta) {
+		if ((type != GIT_OBJECT_REF_DELTA && type != GIT_OBJECT_OFS_DELTA) ||
+		    packed_delta_base(&base_id, p, po->reuse_offset, &curpos, type) < 0 ||
+		    !git_oid_equal(&base_id, &po->delta->id))
+			goto passthrough;
+
+		type = write_as_ofs_delta(pb, po) ?
+			GIT_OBJECT_OFS_DELTA : GIT_OBJECT_REF_DELTA;
+	} else if (type != po->type) {
+		goto passthrough;
+	}
+
+	if (packed_crc(&crc, p, po->reuse_offset, end) < 0 || crc != expected_crc)
+		goto passthrough;
+
+	hdr_len = git_packfile__object_header(hdr, size, type);
+
+	if ((error = write_cb(hdr, hdr_len, cb_data)) < 0 ||
+	    (error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
+		return error;
+
+	if (po->reuse_delta &&
+	    (error = write_delta_base(pb, po, write_cb, cb_data)) < 0)
+		return error;
+
+	if ((error = write_packed(pb, p, curpos, end, write_cb, cb_data)) < 0)
+		return error;
+
+	pb->nr_written++;
+	pb->nr_reused++;
+	if (po->reuse_delta)
+		pb->nr_reused_deltas++;
+
+	return 0;
+
+passthrough:
+	git_error_clear();
+	return GIT_PASSTHROUGH;
+}
+
+#ifdef GIT_THREADS
+
+/*
+ * While the pack is written on the calling thread, which emits the
+ * objects in order and hashes them, a pool of workers deflates the
+ * objects that come next in the write order.  The deflated data they
+ * keep waiting is bounded; the writer deflates the objects that no
+ * worker has started on yet itself.
+ */
+
+enum deflate_job_state {
+	DEFLATE_JOB_PENDING = 0,
+	DEFLATE_JOB_WORKING,
+	DEFLATE_JOB_DONE,
+	DEFLATE_JOB_TAKEN
+};
+
+struct deflate_job {
+	git_pobject *base; /* the delta base, or NULL for the whole object */
+	git_object_t type;
+	size_t size; /* inflated size */
+	git_buf data;
+	enum deflate_job_state state;
+	bool failed;
+};
+
+struct deflate_worker {
+	git_thread thread;
+	git_cond space;
+	struct deflate_pool *pool;
+};
+
+struct deflate_pool {
+	git_packbuilder *pb;
+	git_pobject **write_order;
+	struct deflate_job *jobs; /* in the order of pb->object_list */
+
+	struct deflate_worker *workers;
+	size_t nr_workers;
+
+	git_mutex lock;
+	git_cond done;
+	size_t next; /* position in write_order of the next job */
+	size_t buffered; /* bytes deflated but not written yet */
+	bool stop;
+};
+
+static int deflate_job_run(
+	struct deflate_job *job,
+	git_zstream *zstream,
+	git_packbuilder *pb,
+	git_pobject *po)
+{
+	git_odb_object *obj = NULL;
+	void *delta = NULL;
+	const void *data;
+	int error;
+
+	if (job->base) {
+		if ((error = get_delta(&delta, pb->odb, po, job->base)) < 0)
+			goto done;
+
+		data = delta;
+		job->size = po->delta_size;
+	} else {
+		if ((error = git_odb_read(&obj, pb->odb, &po->id)) < 0)
+			goto done;
+
+		data = git_odb_object_data(obj);
+		job->size = git_odb_object_size(obj);
+		job->type = git_odb_object_type(obj);
+	}
+
+	git_zstream_reset(zstream);
+
+	if ((error = git_zstream_set_input(zstream, data, job->size)) < 0)
+		goto done;
+
+	while (!git_zstream_done(zstream)) {
+		size_t written = git_zstream_suggest_output_len(zstream);
+
+		if ((error = git_buf_grow_by(&job->data, written)) < 0 ||
+		    (error = git_zstream_get_output(
+				job->data.ptr + job->data.size, &written, zstream)) < 0)
+			goto done;
+
+		job->data.size += written;
+	}
+
+done:
+	git__free(delta);
+	git_odb_object_free(obj);
+	return error;
+}
+
+static void *deflate_worker(void *arg)
+{
+	struct deflate_worker *me = arg;
+	struct deflate_pool *pool = me->pool;
+	git_packbuilder *pb = pool->pb;
+	git_zstream zstream = GIT_ZSTREAM_INIT;
+	int error;
+
+	/* The writer deflates whatever we do not */
+	if (git_zstream_init(&zstream, GIT_ZSTREAM_DEFLATE) < 0) {
+		git_error_clear();
+		return NULL;
+	}
+
+	git_mutex_lock(&pool->lock);
+
+	while (!pool->stop && pool->next < pb->nr_objects) {
+		git_pobject *po;
+		struct deflate_job *job;
+
+		if (pool->buffered >= DEFLATE_POOL_BUFFER) {
+			git_cond_wait(&me->space, &pool->lock);
+			continue;
+		}
+
+		po = pool->write_order[pool->next++];
+		job = &pool->jobs[po - pb->object_list];
+
+		if (job->state != DEFLATE_JOB_PENDING)
+			continue;
+
+		job->state = DEFLATE_JOB_WORKING;
+		git_mutex_unlock(&pool->lock);
+
+		error = deflate_job_run(job, &zstream, pb, po);
+
+		git_mutex_lock(&pool->lock);
+
+		if (error < 0) {
+			/* The writer will try again, and report the error */
+			git_error_clear();
+			git_buf_dispose(&job->data);
+			job->failed = true;
+		}
+
+		pool->buffered += job->data.size;
+		job->state = DEFLATE_JOB_DONE;
+		git_cond_signal(&pool->done);
+	}
+
+	git_mutex_unlock(&pool->lock);
+	git_zstream_free(&zstream);
+	return NULL;
+}
+
+/*
+ * Take the deflated data of an object from the pool, waiting for the
+ * worker deflating it.  Returns NULL when the writer must deflate the
+ * object itself.
+ */
+static struct deflate_job *deflate_pool_take(
+	git_packbuilder *pb, git_pobject *po, git_pobject *base)
+{
+	struct deflate_pool *pool = pb->deflate_pool;
+	struct deflate_job *job;
+	size_t i;
+
+	if (!pool)
+		return NULL;
+
+	job = &pool->jobs[po - pb->object_list];
+
+	git_mutex_lock(&pool->lock);
+
+	while (job->state == DEFLATE_JOB_WORKING)
+		git_cond_wait(&pool->done, &pool->lock);
+
+	if (job->state == DEFLATE_JOB_DONE) {
+		pool->buffered -= job->data.size;
+
+		for (i = 0; i < pool->nr_workers; i++)
+			git_cond_signal(&pool->workers[i].space);
+	}
+
+	job->state = DEFLATE_JOB_TAKEN;
+	git_mutex_unlock(&pool->lock);
+
+	/* the delta may have been given up to break a cycle */
+	if (job->failed || !job->data.size || job->base != base) {
+		git_buf_dispose(&job->data);
+		return NULL;
+	}
+
+	return job;
+}
+
+static void deflate_pool_stop(git_packbuilder *pb)
+{
+	struct deflate_pool *pool = pb->deflate_pool;
+	size_t i;
+
+	if (!pool)
+		return;
+
+	git_mutex_lock(&pool->lock);
+	pool->stop = true;
+	for (i = 0; i < pool->nr_workers; i++)
+		git_cond_signal(&pool->workers[i].space);
+	git_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < pool->nr_workers; i++) {
+		git_thread_join(&pool->workers[i].thread, NULL);
+		git_cond_free(&pool->workers[i].space);
+	}
+
+	for (i = 0; i < pb->nr_objects; i++)
+		git_buf_dispose(&pool->jobs[i].data);
+
+	git_cond_free(&pool->done);
+	git_mutex_free(&pool->lock);
+	git__free(pool->workers);
+	git__free(pool->jobs);
+	git__free(pool);
+
+	pb->deflate_pool = NULL;
+}
+
+static int deflate_pool_start(git_packbuilder *pb, git_pobject **write_order)
+{
+	struct deflate_pool *pool;
+	size_t i;
+
+	if (!pb->nr_threads)
+		pb->nr_threads = git_online_cpus();
+
+	if (pb->nr_threads <= 1 || pb->nr_objects < 2)
+		return 0;
+
+	pool = git__calloc(1, sizeof(*pool));
+	GIT_ERROR_CHECK_ALLOC(pool);
+
+	pool->pb = pb;
+	pool->write_order = write_order;
+	pool->jobs = git__calloc(pb->nr_objects, sizeof(*pool->jobs));
+	pool->workers = git__calloc(pb->nr_threads, sizeof(*pool->workers));
+
+	if (!pool->jobs || !pool->workers ||
+	    git_mutex_init(&pool->lock) < 0 || git_cond_init(&pool->done) < 0) {
+		git__free(pool->jobs);
+		git__free(pool->workers);
+		git__free(pool);
+		git_error_set(GIT_ERROR_OS, "failed to initialize the deflate workers");
+		return -1;
+	}
+
+	/*
+	 * Only what write_object would deflate itself is worth the work;
+	 * big files are left to the writer rather than kept in memory.
+	 */
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = pb->object_list + i;
+		struct deflate_job *job = &pool->jobs[i];
+		bool delta = po->delta && !po->reuse_delta;
+
+		if ((po->reuse_pack && (po->reuse_delta ? po->delta != NULL : po->delta == NULL)) ||
+		    (delta && po->delta_data) ||
+		    po->size > pb->big_file_threshold)
+			job->state = DEFLATE_JOB_TAKEN;
+		else
+			job->base = delta ? po->delta : NULL;
+	}
+
+	pb->deflate_pool = pool;
+
+	for (i = 0; i < pb->nr_threads; i++) {
+		struct deflate_worker *worker = &pool->workers[i];
 
-	if (git_odb_read(&src, odb, &po->delta->id) < 0 ||
-	    git_odb_read(&trg, odb, &po->id) < 0)
-		goto on_error;
+		worker->pool = pool;
 
-	error = git_delta(&delta_buf, &delta_size,
-		git_odb_object_data(src), git_odb_object_size(src),
-		git_odb_object_data(trg), git_odb_object_size(trg),
-		0);
+		if (git_cond_init(&worker->space) < 0)
+			break;
 
-	if (error < 0 && error != GIT_EBUFS)
-		goto on_error;
+		if (git_thread_create(&worker->thread, deflate_worker, worker) != 0) {
+			git_cond_free(&worker->space);
+			break;
+		}
 
-	if (error == GIT_EBUFS || delta_size != po->delta_size) {
-		git_error_set(GIT_ERROR_INVALID, "delta size changed");
-		goto on_error;
+		pool->nr_workers++;
 	}
 
-	*out = delta_buf;
-
-	git_odb_object_free(src);
-	git_odb_object_free(trg);
+	/* Fewer workers, or none, only mean more work for the writer */
 	return 0;
-
-on_error:
-	git_odb_object_free(src);
-	git_odb_object_free(trg);
-	return -1;
 }
 
+#else
+# define deflate_pool_take(pb, po, base) NULL
+#endif
+
 static int write_object(
 	git_packbuilder *pb,
 	git_pobject *po,
@@ -321,25 +936,50 @@ static int write_object(
 	void *cb_data)
 {
 	git_odb_object *obj = NULL;
+	struct deflate_job *deflated;
 	git_object_t type;
 	unsigned char hdr[10], *zbuf = NULL;
 	void *data = NULL;
 	size_t hdr_len, zbuf_len = COMPRESS_BUFLEN, data_len;
+	bool delta;
 	int error;
 
+	po->offset = pb->write_offset;
+
+	/*
+	 * Copy what we can from the packs as it is.  A delta that we cannot
+	 * copy is written as the whole object: we never computed it.
+	 */
+	if (po->reuse_pack && (po->reuse_delta ? po->delta != NULL : po->delta == NULL) &&
+	    (error = write_reused(pb, po, write_cb, cb_data)) != GIT_PASSTHROUGH)
+		return error;
+
+	delta = po->delta && !po->reuse_delta;
+	deflated = deflate_pool_take(pb, po, delta ? po->delta : NULL);
+
 	/*
 	 * If we have a delta base, let's use the delta to save space.
 	 * Otherwise load the whole object. 'data' ends up pointing to
 	 * whatever data we want to put into the packfile.
 	 */
-	if (po->delta) {
+	if (deflated) {
+		data = deflated->data.ptr;
+		data_len = deflated->size;
+		type = deflated->type;
+		pb->nr_pool_deflated++;
+
+		if (delta)
+			type = write_as_ofs_delta(pb, po) ?
+				GIT_OBJECT_OFS_DELTA : GIT_OBJECT_REF_DELTA;
+	} else if (delta) {
 		if (po->delta_data)
 			data = po->delta_data;
-		else if ((error = get_delta(&data, pb->odb, po)) < 0)
+		else if ((error = get_delta(&data, pb->odb, po, po->delta)) < 0)
 				goto done;
 
 		data_len = po->delta_size;
-		type = GIT_OBJECT_REF_DELTA;
+		type = write_as_ofs_delta(pb, po) ?
+			GIT_OBJECT_OFS_DELTA : GIT_OBJECT_REF_DELTA;
 	} else {
 		if ((error = git_odb_read(&obj, pb->odb, &po->id)) < 0)
 			goto done;
@@ -356,14 +996,15 @@ static int write_object(
 		(error = git_hash_update(&pb->ctx, hdr, hdr_len)) < 0)
 		goto done;
 
-	if (type == GIT_OBJECT_REF_DELTA) {
-		if ((error = write_cb(po->delta->id.id, GIT_OID_RAWSZ, cb_data)) < 0 ||
-			(error = git_hash_update(&pb->ctx, po->delta->id.id, GIT_OID_RAWSZ)) < 0)
-			goto done;
-	}
+	if (delta && (error = write_delta_base(pb, po, write_cb, cb_data)) < 0)
+		goto done;
 
 	/* Write data */
-	if (po->z_delta_size) {
+	if (deflated) {
+		if ((error = write_cb(data, deflated->data.size, cb_data)) < 0 ||
+		    (error = git_hash_update(&pb->ctx, data, deflated->data.size)) < 0)
+			goto done;
+	} else if (po->z_delta_size) {
 		data_len = po->z_delta_size;
 
 		if ((error = write_cb(data, data_len, cb_data)) < 0 ||
@@ -393,7 +1034,7 @@ static int write_object(
 	 * data from there instead of get_delta(). If we didn't,
 	 * there's no harm.
 	 */
-	if (po->delta) {
+	if (delta && !deflated) {
 		git__free(data);
 		po->delta_data = NULL;
 	}
@@ -401,6 +1042,8 @@ static int write_object(
 	pb->nr_written++;
 
 done:
+	if (deflated)
+		git_buf_dispose(&deflated->data);
 	git__free(zbuf);
 	git_odb_object_free(obj);
 	return error;
@@ -413,6 +1056,12 @@ enum write_one_status {
 	WRITE_ONE_RECURSIVE = 2 /* already scheduled to be written */
 };
 
+/* The delta base of an object, unless it is not part of the pack */
+GIT_INLINE(git_pobject *) in_pack_delta(git_pobject *po)
+{
+	return (po->delta && !po->delta->preferred_base) ? po->delta : NULL;
+}
+
 static int write_one(
 	enum write_one_status *status,
 	git_packbuilder *pb,
@@ -430,7 +1079,7 @@ static int write_one(
 		return 0;
 	}
 
-	if (po->delta) {
+	if (in_pack_delta(po)) {
 		po->recursing = 1;
 
 		if ((error = write_one(status, pb, po->delta, write_cb, cb_data)) < 0)
@@ -483,11 +1132,11 @@ static void add_descendants_to_write_order(git_pobject **wo, size_t *endp,
 				continue;
 			}
 			/* go back to our parent node */
-			po = po->delta;
+			po = in_pack_delta(po);
 			while (po && !po->delta_sibling) {
 				/* we're on the right side of a subtree, keep
 				 * going up until we can go right again */
-				po = po->delta;
+				po = in_pack_delta(po);
 			}
 			if (!po) {
 				/* done- we hit our original root node */
@@ -504,7 +1153,7 @@ static void add_family_to_write_order(git_pobject **wo, size_t *endp,
 {
 	git_pobject *root;
 
-	for (root = po; root->delta; root = root->delta)
+	for (root = po; in_pack_delta(root); root = root->delta)
 		; /* nothing */
 	add_descendants_to_write_order(wo, endp, root);
 }
@@ -549,7 +1198,7 @@ static git_pobject **compute_write_order(git_packbuilder *pb)
 	 */
 	for (i = pb->nr_objects; i > 0;) {
 		git_pobject *po = &pb->object_list[--i];
-		if (!po->delta)
+		if (!in_pack_delta(po))
 			continue;
 		/* Mark me as the first child */
 		po->delta_sibling = po->delta->delta_child;
@@ -624,10 +1273,29 @@ static git_pobject **compute_write_order(git_packbuilder *pb)
 	return wo;
 }
 
+struct counting_write {
+	git_packbuilder *pb;
+	int (*write_cb)(void *buf, size_t size, void *cb_data);
+	void *cb_data;
+};
+
+/* Keep track of the offset into the pack, for offset deltas */
+static int write_counted(void *buf, size_t size, void *data)
+{
+	struct counting_write *w = data;
+	int error;
+
+	if ((error = w->write_cb(buf, size, w->cb_data)) == 0)
+		w->pb->write_offset += size;
+
+	return error;
+}
+
 static int write_pack(git_packbuilder *pb,
 	int (*write_cb)(void *buf, size_t size, void *cb_data),
 	void *cb_data)
 {
+	struct counting_write counted = { pb, write_cb, cb_data };
 	git_pobject **write_order;
 	git_pobject *po;
 	enum write_one_status status;
@@ -650,11 +1318,21 @@ static int write_pack(git_packbuilder *pb,
 	ph.hdr_version = htonl(PACK_VERSION);
 	ph.hdr_entries = htonl(pb->nr_objects);
 
+	pb->write_offset = 0;
+	write_cb = write_counted;
+	cb_data = &counted;
+
+#ifdef GIT_THREADS
+	if ((error = deflate_pool_start(pb, write_order)) < 0)
+		goto done;
+#endif
+
 	if ((error = write_cb(&ph, sizeof(ph), cb_data)) < 0 ||
 		(error = git_hash_update(&pb->ctx, &ph, sizeof(ph))) < 0)
 		goto done;
 
 	pb->nr_remaining = pb->nr_objects;
+	pb->nr_reused = pb->nr_reused_deltas = pb->nr_pool_deflated = 0;
 	do {
 		pb->nr_written = 0;
 		for ( ; i < pb->nr_objects; ++i) {
@@ -673,6 +1351,10 @@ static int write_pack(git_packbuilder *pb,
 	error = write_cb(entry_oid.id, GIT_OID_RAWSZ, cb_data);
 
 done:
+#ifdef GIT_THREADS
+	deflate_pool_stop(pb);
+#endif
+
 	/* if callback cancelled writing, we must still free delta_data */
 	for ( ; i < pb->nr_objects; ++i) {
 		po = write_order[i];
@@ -705,14 +1387,10 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->hash < b->hash)
 		return 1;
-	/*
-	 * TODO
-	 *
-	if (a->preferred_base > b->preferred_base)
+	if (a->preferred_base && !b->preferred_base)
 		return -1;
-	if (a->preferred_base < b->preferred_base)
+	if (!a->preferred_base && b->preferred_base)
 		return 1;
-	*/
 	if (a->size > b->size)
 		return -1;
 	if (a->size < b->size)
@@ -969,11 +1647,13 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 			break;
 		}
 
-		pb->nr_deltified += 1;
-		report_delta_progress(pb, pb->nr_deltified, false);
-
 		po = *list++;
 		(*list_size)--;
+
+		if (!po->preferred_base) {
+			pb->nr_deltified += 1;
+			report_delta_progress(pb, pb->nr_deltified, false);
+		}
 		git_packbuilder__progress_unlock(pb);
 
 		mem_usage -= free_unpacked(n);
@@ -993,6 +1673,11 @@ static int find_deltas(git_packbuilder *pb, git_pobject **list,
 		 * otherwise they would become too deep.
 		 */
 		max_depth = depth;
+
+		/* Bases the receiver has are only candidates as sources */
+		if (po->preferred_base)
+			goto next;
+
 		if (po->delta_child) {
 			size_t delta_limit = check_delta_limit(po, 0);
 
@@ -1312,7 +1997,7 @@ static int ll_find_deltas(git_packbuilder *pb, git_pobject **list,
 static int prepare_pack(git_packbuilder *pb)
 {
 	git_pobject **delta_list;
-	size_t i, n = 0;
+	size_t i, n = 0, alloc_len;
 
 	if (pb->nr_objects == 0 || pb->done)
 		return 0; /* nothing to do */
@@ -1324,12 +2009,25 @@ static int prepare_pack(git_packbuilder *pb)
 	if (pb->progress_cb)
 			pb->progress_cb(GIT_PACKBUILDER_DELTAFICATION, 0, pb->nr_objects, pb->progress_cb_payload);
 
-	delta_list = git__mallocarray(pb->nr_objects, sizeof(*delta_list));
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloc_len,
+		pb->nr_objects, git_array_size(pb->thin_bases));
+	delta_list = git__mallocarray(alloc_len, sizeof(*delta_list));
 	GIT_ERROR_CHECK_ALLOC(delta_list);
 
+	for (i = 0; i < pb->nr_objects; ++i) {
+		if (find_reusable(pb, pb->object_list + i) < 0) {
+			git__free(delta_list);
+			return -1;
+		}
+	}
+
 	for (i = 0; i < pb->nr_objects; ++i) {
 		git_pobject *po = pb->object_list + i;
 
+		/* Deltas copied from a pack need no search */
+		if (po->reuse_delta)
+			continue;
+
 		/* Make sure the item is within our size limits */
 		if (po->size < 50 || po->size > pb->big_file_threshold)
 			continue;
@@ -1337,6 +2035,15 @@ static int prepare_pack(git_packbuilder *pb)
 		delta_list[n++] = po;
 	}
 
+	for (i = 0; i < git_array_size(pb->thin_bases); ++i) {
+		git_pobject *po = git_array_get(pb->thin_bases, i);
+
+		if (po->size < 50 || po->size > pb->big_file_threshold)
+			continue;
+
+		delta_list[n++] = po;
+	}
+
 	if (n > 1) {
 		git__tsort((void **)delta_list, n, type_size_sort);
 		if (ll_find_deltas(pb, delta_list, n,
@@ -1375,6 +2082,123 @@ static int write_cb(void *buf, size_t len, void *payload)
 	return git_indexer_append(ctx->indexer, buf, len, ctx->stats);
 }
 
+static int bitmap_object_cb(
+	git_object_t *type,
+	uint32_t *name_hash,
+	const git_oid *id,
+	void *payload)
+{
+	git_packbuilder *pb = payload;
+	git_pobject *po;
+
+	if ((po = git_oidmap_get(pb->object_ix, id)) == NULL) {
+		git_error_set(GIT_ERROR_INVALID, "object %s is not in the packbuilder",
+			git_oid_tostr_s(id));
+		return -1;
+	}
+
+	*type = po->type;
+	*name_hash = po->hash;
+	return 0;
+}
+
+/*
+ * Pick the commits to store bitmaps for: every commit that is not the
+ * parent of another packed commit (the tips) and every nth commit in
+ * insertion order. They are returned oldest first, so that the bitmap
+ * of a commit can reuse the ones of its selected ancestors.
+ */
+static int select_bitmap_commits(git_vector *out, git_packbuilder *pb)
+{
+	git_oidmap *parents = NULL;
+	git_commit *commit;
+	git_pobject *po;
+	size_t i, n = 0;
+	unsigned int p;
+	int error;
+
+	if ((error = git_oidmap_new(&parents)) < 0)
+		return error;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		po = &pb->object_list[i];
+
+		if (po->type != GIT_OBJECT_COMMIT)
+			continue;
+
+		if ((error = git_commit_lookup(&commit, pb->repo, &po->id)) < 0)
+			goto done;
+
+		for (p = 0; !error && p < git_commit_parentcount(commit); p++) {
+			git_pobject *parent = git_oidmap_get(pb->object_ix, git_commit_parent_id(commit, p));
+
+			if (parent)
+				error = git_oidmap_set(parents, &parent->id, parent);
+		}
+
+		git_commit_free(commit);
+		if (error < 0)
+			goto done;
+	}
+
+	for (i = pb->nr_objects; i > 0; i--) {
+		po = &pb->object_list[i - 1];
+
+		if (po->type != GIT_OBJECT_COMMIT)
+			continue;
+
+		if ((n++ % GIT_PACK_BITMAP_INTERVAL) == 0 ||
+		    !git_oidmap_exists(parents, &po->id)) {
+			if ((error = git_vector_insert(out, &po->id)) < 0)
+				goto done;
+		}
+	}
+
+done:
+	git_oidmap_free(parents);
+	return error;
+}
+
+static int write_bitmap(git_packbuilder *pb, const char *path, unsigned int mode)
+{
+	struct git_pack_file *pack = NULL;
+	git_vector commits = GIT_VECTOR_INIT;
+	git_buf name = GIT_BUF_INIT;
+	size_t root_len;
+	int error;
+
+	if ((error = git_buf_joinpath(&name, path, "pack-")) < 0 ||
+	    (error = git_buf_puts(&name, git_oid_tostr_s(&pb->pack_oid))) < 0)
+		goto cleanup;
+
+	root_len = git_buf_len(&name);
+
+	if ((error = git_buf_puts(&name, ".idx")) < 0 ||
+	    (error = git_mwindow_get_pack(&pack, name.ptr)) < 0 ||
+	    (error = select_bitmap_commits(&commits, pb)) < 0)
+		goto cleanup;
+
+	git_buf_truncate(&name, root_len);
+	if ((error = git_buf_puts(&name, ".bitmap")) < 0)
+		goto cleanup;
+
+	error = git_pack_bitmap_write(name.ptr, mode ? mode : GIT_PACK_FILE_MODE,
+		pack, pb->repo, &commits, bitmap_object_cb, pb);
+
+	/* The pack does not contain the full history of its commits. */
+	if (error == GIT_PASSTHROUGH) {
+		git_error_clear();
+		error = 0;
+	}
+
+cleanup:
+	if (pack)
+		git_mwindow_put_pack(pack);
+	git_vector_free(&commits);
+	git_buf_dispose(&name);
+	return error;
+}
+
 int git_packbuilder_write(
 	git_packbuilder *pb,
 	const char *path,
@@ -1412,6 +2236,10 @@ int git_packbuilder_write(
 	git_oid_cpy(&pb->pack_oid, git_indexer_hash(indexer));
 
 	git_indexer_free(indexer);
+
+	if (pb->write_bitmap)
+		return write_bitmap(pb, path, mode);
+
 	return 0;
 }
 
@@ -1550,7 +2378,8 @@ static int retrieve_object(struct walk_object **out, git_packbuilder *pb, const
 	return 0;
 }
 
-static int mark_blob_uninteresting(git_packbuilder *pb, const git_oid *id)
+static int mark_blob_uninteresting(
+	git_packbuilder *pb, const git_oid *id, const char *name)
 {
 	int error;
 	struct walk_object *obj;
@@ -1558,6 +2387,11 @@ static int mark_blob_uninteresting(git_packbuilder *pb, const git_oid *id)
 	if ((error = retrieve_object(&obj, pb, id)) < 0)
 		return error;
 
+	if (!obj->uninteresting) {
+		obj->blob = 1;
+		obj->hash = name_hash(name);
+	}
+
 	obj->uninteresting = 1;
 
 	return 0;
@@ -1590,7 +2424,8 @@ static int mark_tree_uninteresting(git_packbuilder *pb, const git_oid *id)
 				goto cleanup;
 			break;
 		case GIT_OBJECT_BLOB:
-			if ((error = mark_blob_uninteresting(pb, entry_id)) < 0)
+			if ((error = mark_blob_uninteresting(pb, entry_id,
+					git_tree_entry_name(entry))) < 0)
 				goto cleanup;
 			break;
 		default:
@@ -1614,6 +2449,7 @@ static int mark_edges_uninteresting(git_packbuilder *pb, git_commit_list *commit
 	int error;
 	git_commit_list *list;
 	git_commit *commit;
+	struct walk_object *obj;
 
 	for (list = commits; list; list = list->next) {
 		if (!list->item->uninteresting)
@@ -1622,11 +2458,14 @@ static int mark_edges_uninteresting(git_packbuilder *pb, git_commit_list *commit
 		if ((error = git_commit_lookup(&commit, pb->repo, &list->item->oid)) < 0)
 			return error;
 
-		error = mark_tree_uninteresting(pb, git_commit_tree_id(commit));
+		error = retrieve_object(&obj, pb, git_commit_tree_id(commit));
 		git_commit_free(commit);
 
-		if (error < 0)
+		if (error < 0 ||
+		    (error = mark_tree_uninteresting(pb, &obj->id)) < 0)
 			return error;
+
+		obj->edge_tree = 1;
 	}
 
 	return 0;
@@ -1711,6 +2550,212 @@ cleanup:
 	return error;
 }
 
+struct bitmap_insert_context {
+	git_packbuilder *pb;
+	git_pack_bitmap_index *idx;
+};
+
+static int insert_bitmap_object(size_t pos, void *payload)
+{
+	struct bitmap_insert_context *ctx = payload;
+
+	return packbuilder_insert(ctx->pb,
+		git_pack_bitmap_index_oid(ctx->idx, pos),
+		git_pack_bitmap_index_name_hash(ctx->idx, pos));
+}
+
+/*
+ * Find a pack in the repository that has a reachability bitmap index.
+ * Returns GIT_PASSTHROUGH if there is none. The pack directory is only
+ * read for the first walk; the pack is kept until the builder is freed.
+ */
+static int find_bitmap_index(git_packbuilder *pb)
+{
+	git_vector entries = GIT_VECTOR_INIT;
+	git_buf path = GIT_BUF_INIT;
+	struct git_pack_file *pack;
+	const char *entry;
+	size_t i, root_len;
+	int error = GIT_PASSTHROUGH;
+
+	if (pb->bitmap_checked)
+		return pb->bitmap_pack ? 0 : GIT_PASSTHROUGH;
+
+	if (git_repository_item_path(&path, pb->repo, GIT_REPOSITORY_ITEM_OBJECTS) < 0 ||
+	    git_buf_joinpath(&path, path.ptr, "pack") < 0 ||
+	    git_path_dirload(&entries, path.ptr, 0, 0) < 0) {
+		git_error_clear();
+		goto cleanup;
+	}
+
+	git_vector_foreach(&entries, i, entry) {
+		if (git__suffixcmp(entry, ".bitmap") != 0)
+			continue;
+
+		root_len = strlen(entry) - strlen(".bitmap");
+
+		git_buf_clear(&path);
+		if (git_buf_put(&path, entry, root_len) < 0 ||
+		    git_buf_puts(&path, ".idx") < 0) {
+			error = -1;
+			goto cleanup;
+		}
+
+		if (git_mwindow_get_pack(&pack, path.ptr) < 0) {
+			git_error_clear();
+			continue;
+		}
+
+		if (git_packfile_bitmap(&pb->bitmap_index, pack) == 0) {
+			pb->bitmap_pack = pack;
+			error = 0;
+			goto cleanup;
+		}
+
+		git_error_clear();
+		git_mwindow_put_pack(pack);
+	}
+
+cleanup:
+	if (error >= 0 || error == GIT_PASSTHROUGH)
+		pb->bitmap_checked = true;
+
+	git_vector_foreach(&entries, i, entry)
+		git__free((char *)entry);
+	git_vector_free(&entries);
+	git_buf_dispose(&path);
+	return error;
+}
+
+/*
+ * Compute the objects reachable from the walk's tips but not from its
+ * hidden commits with the reachability bitmaps of a pack, instead of
+ * walking every tree. Returns GIT_PASSTHROUGH when the bitmaps cannot
+ * answer the question, e.g. because some of the commits are not in
+ * the bitmapped pack.
+ */
+static int insert_walk_bitmap(git_packbuilder *pb, git_revwalk *walk)
+{
+	struct bitmap_insert_context ctx = { pb, NULL };
+	git_bitmap wants = GIT_BITMAP_INIT, haves = GIT_BITMAP_INIT;
+	git_commit_list *list;
+	int error;
+
+	/*
+	 * The bitmaps know nothing about these restrictions, and the
+	 * bases of a thin pack are found by the tree walk.
+	 */
+	if (walk->hide_cb || walk->first_parent || pb->thin)
+		return GIT_PASSTHROUGH;
+
+	if ((error = find_bitmap_index(pb)) < 0)
+		return error;
+
+	ctx.idx = pb->bitmap_index;
+
+	for (list = walk->user_input; list; list = list->next) {
+		git_bitmap *bitmap = list->item->uninteresting ? &haves : &wants;
+
+		if ((error = git_pack_bitmap_index_fill(bitmap, ctx.idx,
+				pb->repo, &list->item->oid)) < 0)
+			goto cleanup;
+	}
+
+	git_bitmap_and_not(&wants, &haves);
+	error = git_bitmap_foreach(&wants, insert_bitmap_object, &ctx);
+
+cleanup:
+	if (error == GIT_PASSTHROUGH)
+		git_error_clear();
+
+	git_bitmap_dispose(&wants);
+	git_bitmap_dispose(&haves);
+	return error;
+}
+
+/*
+ * Offer an object the receiver has as a delta base for the objects
+ * we send it, without sending it.
+ */
+static int add_thin_base(git_packbuilder *pb, struct walk_object *obj)
+{
+	git_pobject *po;
+	git_object_t type;
+	size_t size;
+	int error;
+
+	if (obj->thin_base || git_oidmap_exists(pb->object_ix, &obj->id))
+		return 0;
+
+	if ((error = git_odb_read_header(&size, &type, pb->odb, &obj->id)) < 0)
+		return error;
+
+	po = git_array_alloc(pb->thin_bases);
+	GIT_ERROR_CHECK_ALLOC(po);
+
+	memset(po, 0x0, sizeof(*po));
+	git_oid_cpy(&po->id, &obj->id);
+	po->type = type;
+	po->size = size;
+	po->hash = obj->hash;
+	po->preferred_base = 1;
+
+	obj->thin_base = 1;
+	return 0;
+}
+
+static int hash_cmp(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a;
+	unsigned int y = *(const unsigned int *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Pick the objects of the edges of the walk to delta against: the
+ * root trees of the hidden commits and the blobs they have under the
+ * same names as the blobs we send.
+ */
+static int add_thin_bases(git_packbuilder *pb)
+{
+	git_array_t(unsigned int) hashes = GIT_ARRAY_INIT;
+	struct walk_object *obj;
+	unsigned int *hash;
+	size_t i, iter = 0;
+	int error = 0;
+
+	for (i = 0; i < pb->nr_objects; i++) {
+		git_pobject *po = pb->object_list + i;
+
+		if (po->type != GIT_OBJECT_BLOB || !po->hash)
+			continue;
+
+		if ((hash = git_array_alloc(hashes)) == NULL) {
+			error = -1;
+			goto cleanup;
+		}
+
+		*hash = po->hash;
+	}
+
+	git_array_sort(hashes, hash_cmp);
+
+	while (git_oidmap_iterate((void **)&obj, pb->walk_objects, &iter, NULL) == 0) {
+		if (!obj->edge_tree &&
+		    (!obj->blob || !obj->hash ||
+		     git_array_search(NULL, hashes, hash_cmp, &obj->hash) < 0))
+			continue;
+
+		if ((error = add_thin_base(pb, obj)) < 0)
+			goto cleanup;
+	}
+
+cleanup:
+	git_array_clear(hashes);
+	return error;
+}
+
 int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 {
 	int error;
@@ -1719,6 +2764,9 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 
 	assert(pb && walk);
 
+	if ((error = insert_walk_bitmap(pb, walk)) != GIT_PASSTHROUGH)
+		return error;
+
 	if ((error = mark_edges_uninteresting(pb, walk->user_input)) < 0)
 		return error;
 
@@ -1744,6 +2792,9 @@ int git_packbuilder_insert_walk(git_packbuilder *pb, git_revwalk *walk)
 	if (error == GIT_ITEROVER)
 		error = 0;
 
+	if (!error && pb->thin)
+		error = add_thin_bases(pb);
+
 	return error;
 }
 
@@ -1782,6 +2833,10 @@ void git_packbuilder_free(git_packbuilder *pb)
 
 	git_oidmap_free(pb->walk_objects);
 	git_pool_clear(&pb->object_pool);
+	git_array_clear(pb->thin_bases);
+
+	if (pb->bitmap_pack)
+		git_mwindow_put_pack(pb->bitmap_pack);
 
 	git_hash_ctx_cleanup(&pb->ctx);
 	git_zstream_free(&pb->zstream);
@@ -16,7 +16,9 @@
 #include "netops.h"
 #include "zstream.h"
 #include "pool.h"
+#include "array.h"
 #include "indexer.h"
+#include "pack-bitmap.h"
 
 #include "git2/oid.h"
 #include "git2/pack.h"
@@ -26,6 +28,7 @@
 #define GIT_PACK_DELTA_CACHE_SIZE (256 * 1024 * 1024)
 #define GIT_PACK_DELTA_CACHE_LIMIT 1000
 #define GIT_PACK_BIG_FILE_THRESHOLD (512 * 1024 * 1024)
+#define GIT_PACK_BITMAP_INTERVAL 100 /* store a bitmap for every nth commit */
 
 typedef struct git_pobject {
 	git_oid id;
@@ -46,10 +49,16 @@ typedef struct git_pobject {
 	size_t delta_size;
 	size_t z_delta_size;
 
+	/* where the object is packed already, if it is */
+	struct git_pack_file *reuse_pack;
+	git_off_t reuse_offset;
+
 	int written:1,
 	    recursing:1,
 	    tagged:1,
-	    filled:1;
+	    filled:1,
+	    reuse_delta:1, /* the delta against `delta` is copied from reuse_pack */
+	    preferred_base:1; /* a delta base the receiver has; never written */
 } git_pobject;
 
 struct git_packbuilder {
@@ -62,18 +71,30 @@ struct git_packbuilder {
 	uint32_t nr_objects,
 		nr_deltified,
 		nr_written,
-		nr_remaining;
+		nr_remaining,
+		nr_reused, /* objects copied from a pack as they were */
+		nr_reused_deltas, /* ...of which deltas */
+		nr_pool_deflated; /* objects deflated by the deflate workers */
 
 	size_t nr_alloc;
 
 	git_pobject *object_list;
 
+	/* objects the receiver has, to delta against in thin packs */
+	git_array_t(git_pobject) thin_bases;
+
 	git_oidmap *object_ix;
 
 	git_oidmap *walk_objects;
 	git_pool object_pool;
 
 	git_oid pack_oid; /* hash of written pack */
+	git_off_t write_offset; /* bytes of the pack written so far */
+	struct deflate_pool *deflate_pool; /* deflates ahead of the writer */
+
+	/* the pack whose bitmaps answer walks, once looked for */
+	struct git_pack_file *bitmap_pack;
+	git_pack_bitmap_index *bitmap_index;
 
 	/* synchronization objects */
 	git_mutex cache_mutex;
@@ -94,6 +115,10 @@ struct git_packbuilder {
 	double last_progress_report_time; /* the time progress was last reported */
 
 	bool done;
+	bool bitmap_checked;
+	bool write_bitmap;
+	bool ofs_delta;
+	bool thin;
 };
 
 int git_packbuilder_write_buf(git_buf *buf, git_packbuilder *pb);
@@ -12,6 +12,7 @@
 #include "sha1_lookup.h"
 #include "mwindow.h"
 #include "fileops.h"
+#include "global.h"
 #include "oid.h"
 
 #include <zlib.h>
@@ -53,6 +54,115 @@ static int packfile_error(const char *message)
  * Delta base cache
  ********************/
 
+/*
+ * The cache is split into shards by offset, each with its own lock,
+ * LRU lists and share of the budget, so that threads reading different
+ * objects do not wait on each other.
+ */
+typedef struct {
+	git_mutex lock;
+
+	/* sentinels of the circular LRU lists; the head is the most recent */
+	git_pack_cache_entry probation;
+	git_pack_cache_entry protected;
+
+	size_t memory_used;
+	size_t protected_used;
+	size_t memory_limit;
+
+	size_t hits;
+	size_t misses;
+	size_t evictions;
+} pack_cache_shard;
+
+static struct {
+	pack_cache_shard shards[GIT_PACK_CACHE_SHARDS];
+	size_t memory_limit;
+} delta_base_cache;
+
+GIT_INLINE(size_t) cache_shard_pos(git_off_t offset)
+{
+	return (size_t)(((uint64_t)offset * 0x9E3779B97F4A7C15ull) >> 32) % GIT_PACK_CACHE_SHARDS;
+}
+
+static void git_pack_cache_global_shutdown(void)
+{
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++)
+		git_mutex_free(&delta_base_cache.shards[i].lock);
+}
+
+int git_pack_cache_global_init(void)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &delta_base_cache.shards[i];
+
+		if (git_mutex_init(&shard->lock)) {
+			git_error_set(GIT_ERROR_OS, "failed to initialize delta base cache mutex");
+
+			while (i--)
+				git_mutex_free(&delta_base_cache.shards[i].lock);
+			return -1;
+		}
+
+		shard->probation.prev = shard->probation.next = &shard->probation;
+		shard->protected.prev = shard->protected.next = &shard->protected;
+
+		shard->memory_used = shard->protected_used = 0;
+		shard->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT / GIT_PACK_CACHE_SHARDS;
+		shard->hits = shard->misses = shard->evictions = 0;
+	}
+
+	delta_base_cache.memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
+
+	git__on_shutdown(git_pack_cache_global_shutdown);
+	return 0;
+}
+
+/*
+ * Only bases that are not in use are on the LRU lists, so that eviction
+ * can always take the tail. Run these with the shard's lock held.
+ */
+static void lru_unlink(pack_cache_shard *shard, git_pack_cache_entry *e)
+{
+	e->prev->next = e->next;
+	e->next->prev = e->prev;
+	e->prev = e->next = NULL;
+
+	if (e->protected)
+		shard->protected_used -= e->raw.len;
+}
+
+static void lru_push(pack_cache_shard *shard, git_pack_cache_entry *e)
+{
+	git_pack_cache_entry *head = e->protected ?
+		&shard->protected : &shard->probation;
+
+	e->next = head->next;
+	e->prev = head;
+	head->next->prev = e;
+	head->next = e;
+
+	if (e->protected)
+		shard->protected_used += e->raw.len;
+}
+
+/* Keep the protected segment to three quarters of the budget */
+static void lru_rebalance(pack_cache_shard *shard)
+{
+	while (shard->protected_used > shard->memory_limit / 4 * 3) {
+		git_pack_cache_entry *e = shard->protected.prev;
+
+		lru_unlink(shard, e);
+		e->protected = 0;
+		lru_push(shard, e);
+	}
+}
+
 static git_pack_cache_entry *new_cache_object(git_rawobj *source)
 {
 	git_pack_cache_entry *e = git__calloc(1, sizeof(git_pack_cache_entry));
@@ -76,34 +186,52 @@ static void free_cache_object(void *o)
 	}
 }
 
+/* Run with the lock held */
+static void cache_remove(pack_cache_shard *shard, git_pack_cache_entry *e)
+{
+	lru_unlink(shard, e);
+	git_offmap_delete(e->owner->entries[cache_shard_pos(e->offset)], e->offset);
+	shard->memory_used -= e->raw.len;
+	free_cache_object(e);
+}
+
 static void cache_free(git_pack_cache *cache)
 {
+	pack_cache_shard *shard;
 	git_pack_cache_entry *entry;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		if (!cache->entries[i])
+			continue;
 
-	if (cache->entries) {
-		git_offmap_foreach_value(cache->entries, entry, {
-			free_cache_object(entry);
-		});
+		shard = &delta_base_cache.shards[i];
 
-		git_offmap_free(cache->entries);
-		cache->entries = NULL;
+		if (git_mutex_lock(&shard->lock) == 0) {
+			git_offmap_foreach_value(cache->entries[i], entry, {
+				if (entry->prev)
+					lru_unlink(shard, entry);
+				shard->memory_used -= entry->raw.len;
+				free_cache_object(entry);
+			});
+
+			git_mutex_unlock(&shard->lock);
+		}
+
+		git_offmap_free(cache->entries[i]);
+		cache->entries[i] = NULL;
 	}
 }
 
 static int cache_init(git_pack_cache *cache)
 {
-	if (git_offmap_new(&cache->entries) < 0)
-		return -1;
-
-	cache->memory_limit = GIT_PACK_CACHE_MEMORY_LIMIT;
-
-	if (git_mutex_init(&cache->lock)) {
-		git_error_set(GIT_ERROR_OS, "failed to initialize pack cache mutex");
+	size_t i;
 
-		git__free(cache->entries);
-		cache->entries = NULL;
-
-		return -1;
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		if (git_offmap_new(&cache->entries[i]) < 0) {
+			cache_free(cache);
+			return -1;
+		}
 	}
 
 	return 0;
@@ -111,66 +239,180 @@ static int cache_init(git_pack_cache *cache)
 
 static git_pack_cache_entry *cache_get(git_pack_cache *cache, git_off_t offset)
 {
+	size_t pos = cache_shard_pos(offset);
+	pack_cache_shard *shard = &delta_base_cache.shards[pos];
 	git_pack_cache_entry *entry;
 
-	if (git_mutex_lock(&cache->lock) < 0)
+	if (git_mutex_lock(&shard->lock) < 0)
 		return NULL;
 
-	if ((entry = git_offmap_get(cache->entries, offset)) != NULL) {
-		git_atomic_inc(&entry->refcount);
-		entry->last_usage = cache->use_ctr++;
+	if ((entry = git_offmap_get(cache->entries[pos], offset)) != NULL) {
+		if (git_atomic_inc(&entry->refcount) == 1)
+			lru_unlink(shard, entry);
+
+		/* a second use promotes the base to the protected segment */
+		entry->protected = 1;
+
+		shard->hits++;
+	} else {
+		shard->misses++;
 	}
-	git_mutex_unlock(&cache->lock);
+
+	git_mutex_unlock(&shard->lock);
 
 	return entry;
 }
 
-/* Run with the cache lock held */
-static void free_lowest_entry(git_pack_cache *cache)
+/*
+ * Evict the least recently used bases, probationary ones first, until
+ * `needed` more bytes fit in the shard's budget. Run with the lock held.
+ */
+static void cache_evict(pack_cache_shard *shard, size_t needed)
 {
-	git_off_t offset;
-	git_pack_cache_entry *entry;
+	git_pack_cache_entry *e;
+
+	while (shard->memory_used + needed > shard->memory_limit) {
+		if (shard->probation.prev != &shard->probation)
+			e = shard->probation.prev;
+		else if (shard->protected.prev != &shard->protected)
+			e = shard->protected.prev;
+		else
+			/* everything is in use; the budget is a soft limit */
+			break;
 
-	git_offmap_foreach(cache->entries, offset, entry, {
-		if (entry && entry->refcount.val == 0) {
-			cache->memory_used -= entry->raw.len;
-			git_offmap_delete(cache->entries, offset);
-			free_cache_object(entry);
-		}
-	});
+		cache_remove(shard, e);
+		shard->evictions++;
+	}
 }
 
+/* Give back a base returned by `cache_get` or `cache_add`. */
+static void cache_release(git_pack_cache_entry *entry)
+{
+	pack_cache_shard *shard = &delta_base_cache.shards[cache_shard_pos(entry->offset)];
+
+	if (git_mutex_lock(&shard->lock) < 0)
+		return;
+
+	if (git_atomic_dec(&entry->refcount) == 0) {
+		lru_push(shard, entry);
+		lru_rebalance(shard);
+		cache_evict(shard, 0);
+	}
+
+	git_mutex_unlock(&shard->lock);
+}
+
+void git_pack_cache_set_limit(size_t limit)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	delta_base_cache.memory_limit = limit;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &delta_base_cache.shards[i];
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			return;
+
+		shard->memory_limit = limit / GIT_PACK_CACHE_SHARDS;
+		cache_evict(shard, 0);
+		lru_rebalance(shard);
+
+		git_mutex_unlock(&shard->lock);
+	}
+}
+
+size_t git_pack_cache_limit(void)
+{
+	return delta_base_cache.memory_limit;
+}
+
+void git_pack_cache_stats(
+	size_t *hits,
+	size_t *misses,
+	size_t *evictions,
+	size_t *memory_used)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	*hits = *misses = *evictions = *memory_used = 0;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &delta_base_cache.shards[i];
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		*hits += shard->hits;
+		*misses += shard->misses;
+		*evictions += shard->evictions;
+		*memory_used += shard->memory_used;
+
+		git_mutex_unlock(&shard->lock);
+	}
+}
+
+void git_pack_cache_stats_reset(void)
+{
+	pack_cache_shard *shard;
+	size_t i;
+
+	for (i = 0; i < GIT_PACK_CACHE_SHARDS; i++) {
+		shard = &delta_base_cache.shards[i];
+
+		if (git_mutex_lock(&shard->lock) < 0)
+			continue;
+
+		shard->hits = shard->misses = shard->evictions = 0;
+
+		git_mutex_unlock(&shard->lock);
+	}
+}
+
+/*
+ * Add a base to the cache. `depth` is the number of deltas that were
+ * applied to rebuild it. The base stays in use until it is released.
+ */
 static int cache_add(
 		git_pack_cache_entry **cached_out,
 		git_pack_cache *cache,
 		git_rawobj *base,
-		git_off_t offset)
+		git_off_t offset,
+		size_t depth)
 {
+	size_t pos = cache_shard_pos(offset);
+	pack_cache_shard *shard = &delta_base_cache.shards[pos];
 	git_pack_cache_entry *entry;
 	int exists;
 
-	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT)
+	if (base->len > GIT_PACK_CACHE_SIZE_LIMIT ||
+	    base->len > shard->memory_limit)
 		return -1;
 
 	entry = new_cache_object(base);
 	if (entry) {
-		if (git_mutex_lock(&cache->lock) < 0) {
+		if (git_mutex_lock(&shard->lock) < 0) {
 			git_error_set(GIT_ERROR_OS, "failed to lock cache");
 			git__free(entry);
 			return -1;
 		}
 		/* Add it to the cache if nobody else has */
-		exists = git_offmap_exists(cache->entries, offset);
+		exists = git_offmap_exists(cache->entries[pos], offset);
 		if (!exists) {
-			while (cache->memory_used + base->len > cache->memory_limit)
-				free_lowest_entry(cache);
+			cache_evict(shard, base->len);
+
+			entry->owner = cache;
+			entry->offset = offset;
+			entry->protected = depth >= GIT_PACK_CACHE_DEEP_BASE;
 
-			git_offmap_set(cache->entries, offset, entry);
-			cache->memory_used += entry->raw.len;
+			git_offmap_set(cache->entries[pos], offset, entry);
+			shard->memory_used += entry->raw.len;
 
 			*cached_out = entry;
 		}
-		git_mutex_unlock(&cache->lock);
+		git_mutex_unlock(&shard->lock);
 		/* Somebody beat us to adding it into the cache */
 		if (exists) {
 			git__free(entry);
@@ -234,6 +476,10 @@ static int pack_index_check(const char *path, struct git_pack_file *p)
 	if (error < 0)
 		return error;
 
+	/* every lookup touches the index; fault it in up front */
+	if (git_mwindow_full_mmap_enabled())
+		p_madvise(&p->index_map, GIT_MADV_WILLNEED);
+
 	hdr = idx_map = p->index_map.data;
 
 	if (hdr->idx_signature == htonl(PACK_IDX_SIGNATURE)) {
@@ -628,7 +874,7 @@ int git_packfile_unpack(
 	struct pack_chain_elem *elem = NULL, *stack;
 	git_pack_cache_entry *cached = NULL;
 	struct pack_chain_elem small_stack[SMALL_STACK_SIZE];
-	size_t stack_size = 0, elem_pos, alloclen;
+	size_t stack_size = 0, elem_pos, alloclen, depth = 0;
 	git_object_t base_type;
 
 	/*
@@ -693,7 +939,7 @@ int git_packfile_unpack(
 		GIT_ERROR_CHECK_ALLOC(obj->data);
 
 		memcpy(obj->data, data, obj->len + 1);
-		git_atomic_dec(&cached->refcount);
+		cache_release(cached);
 		goto cleanup;
 	}
 
@@ -706,7 +952,7 @@ int git_packfile_unpack(
 		 * long as it's not already the cached one.
 		 */
 		if (!cached)
-			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key);
+			free_base = !!cache_add(&cached, &p->bases, obj, elem->base_key, depth);
 
 		elem = &stack[elem_pos - 1];
 		curpos = elem->offset;
@@ -741,7 +987,7 @@ int git_packfile_unpack(
 		}
 
 		if (cached) {
-			git_atomic_dec(&cached->refcount);
+			cache_release(cached);
 			cached = NULL;
 		}
 
@@ -749,13 +995,14 @@ int git_packfile_unpack(
 			break;
 
 		elem_pos--;
+		depth++;
 	}
 
 cleanup:
 	if (error < 0) {
 		git__free(obj->data);
 		if (cached)
-			git_atomic_dec(&cached->refcount);
+			cache_release(cached);
 	}
 
 	if (elem)
@@ -986,7 +1233,7 @@ git_off_t get_delta_base(
 void git_packfile_close(struct git_pack_file *p, bool unlink_packfile)
 {
 	if (p->mwf.fd >= 0) {
-		git_mwindow_free_all_locked(&p->mwf);
+		git_mwindow_free_all(&p->mwf);
 		p_close(p->mwf.fd);
 		p->mwf.fd = -1;
 	}
@@ -1002,14 +1249,17 @@ void git_packfile_free(struct git_pack_file *p)
 
 	cache_free(&p->bases);
 
+	git_pack_bitmap_index_free(p->bitmap);
+	git__free(p->revindex);
+
 	git_packfile_close(p, false);
 
 	pack_index_free(p);
 
 	git__free(p->bad_object_sha1);
 
+	git_mutex_free(&p->mwf.lock);
 	git_mutex_free(&p->lock);
-	git_mutex_free(&p->bases.lock);
 	git__free(p);
 }
 
@@ -1079,14 +1329,18 @@ static int packfile_open(struct git_pack_file *p)
 	if (git_oid__cmp(&sha1, (git_oid *)idx_sha1) != 0)
 		goto cleanup;
 
+	git_mwindow_file_map_full(&p->mwf);
+
 	git_mutex_unlock(&p->lock);
 	return 0;
 
 cleanup:
 	git_error_set(GIT_ERROR_OS, "invalid packfile '%s'", p->pack_name);
 
-	if (p->mwf.fd >= 0)
+	if (p->mwf.fd >= 0) {
+		git_mwindow_file_deregister(&p->mwf);
 		p_close(p->mwf.fd);
+	}
 	p->mwf.fd = -1;
 
 	git_mutex_unlock(&p->lock);
@@ -1166,7 +1420,16 @@ int git_packfile_alloc(struct git_pack_file **pack_out, const char *path)
 		return -1;
 	}
 
+	if (git_mutex_init(&p->mwf.lock)) {
+		git_error_set(GIT_ERROR_OS, "failed to initialize packfile window mutex");
+		git_mutex_free(&p->lock);
+		git__free(p);
+		return -1;
+	}
+
 	if (cache_init(&p->bases) < 0) {
+		git_mutex_free(&p->mwf.lock);
+		git_mutex_free(&p->lock);
 		git__free(p);
 		return -1;
 	}
@@ -1215,18 +1478,20 @@ int git_pack_foreach_entry(
 	git_odb_foreach_cb cb,
 	void *data)
 {
-	const unsigned char *index = p->index_map.data, *current;
+	const unsigned char *index, *current;
 	uint32_t i;
 	int error = 0;
 
-	if (index == NULL) {
-		if ((error = pack_index_open(p)) < 0)
-			return error;
+	/*
+	 * The index map is published before it is validated, so wait for
+	 * the version, which is set last, rather than checking the map.
+	 */
+	if ((error = pack_index_open(p)) < 0)
+		return error;
 
-		assert(p->index_map.data);
+	assert(p->index_map.data);
 
-		index = p->index_map.data;
-	}
+	index = p->index_map.data;
 
 	if (p->index_version > 1) {
 		index += 8;
@@ -1234,14 +1499,18 @@ int git_pack_foreach_entry(
 
 	index += 4 * 256;
 
+	if ((error = git_mutex_lock(&p->lock)) < 0)
+		return packfile_error("failed to get lock for foreach");
+
 	if (p->oids == NULL) {
 		git_vector offsets, oids;
 
-		if ((error = git_vector_init(&oids, p->num_objects, NULL)))
-			return error;
-
-		if ((error = git_vector_init(&offsets, p->num_objects, git__memcmp4)))
+		if ((error = git_vector_init(&oids, p->num_objects, NULL)) ||
+		    (error = git_vector_init(&offsets, p->num_objects, git__memcmp4))) {
+			git_vector_free(&oids);
+			git_mutex_unlock(&p->lock);
 			return error;
+		}
 
 		if (p->index_version > 1) {
 			const unsigned char *off = index + 24 * p->num_objects;
@@ -1262,6 +1531,8 @@ int git_pack_foreach_entry(
 		p->oids = (git_oid **)git_vector_detach(NULL, NULL, &oids);
 	}
 
+	git_mutex_unlock(&p->lock);
+
 	for (i = 0; i < p->num_objects; i++)
 		if ((error = cb(p->oids[i], data)) != 0)
 			return git_error_set_after_callback(error);
@@ -1269,6 +1540,193 @@ int git_pack_foreach_entry(
 	return error;
 }
 
+int git_pack_foreach_entry_offset(
+	struct git_pack_file *p,
+	git_pack_foreach_entry_offset_cb cb,
+	void *data)
+{
+	const unsigned char *index;
+	git_off_t offset;
+	uint32_t i;
+	int error = 0;
+
+	if (p->index_version == -1) {
+		if ((error = pack_index_open(p)) < 0)
+			return error;
+
+		assert(p->index_map.data);
+	}
+
+	index = p->index_map.data;
+
+	if (p->index_version > 1)
+		index += 8;
+
+	index += 4 * 256;
+
+	for (i = 0; i < p->num_objects; i++) {
+		const unsigned char *current;
+
+		if ((offset = nth_packed_object_offset(p, i)) < 0) {
+			git_error_set(GIT_ERROR_ODB, "packfile index is corrupt");
+			return -1;
+		}
+
+		if (p->index_version > 1)
+			current = index + 20 * i;
+		else
+			current = index + 24 * i + 4;
+
+		if ((error = cb((const git_oid *)current, offset, data)) != 0)
+			return git_error_set_after_callback(error);
+	}
+
+	return error;
+}
+
+static int revindex_cmp(const void *a, const void *b)
+{
+	const struct git_pack_revindex_entry *entry_a = a, *entry_b = b;
+
+	if (entry_a->offset < entry_b->offset)
+		return -1;
+	return entry_a->offset > entry_b->offset ? 1 : 0;
+}
+
+static int pack_revindex_build(struct git_pack_file *p)
+{
+	struct git_pack_revindex_entry *revindex;
+	uint32_t i;
+	int error;
+
+	/* The index map is published before it is validated, so wait for the version */
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (git_mutex_lock(&p->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock packfile reader");
+		return -1;
+	}
+
+	if (p->revindex) {
+		git_mutex_unlock(&p->lock);
+		return 0;
+	}
+
+	revindex = git__mallocarray(p->num_objects, sizeof(*revindex));
+	if (!revindex) {
+		git_mutex_unlock(&p->lock);
+		return -1;
+	}
+
+	for (i = 0; i < p->num_objects; i++) {
+		if ((revindex[i].offset = nth_packed_object_offset(p, i)) < 0) {
+			git_error_set(GIT_ERROR_ODB, "packfile index is corrupt");
+			git__free(revindex);
+			git_mutex_unlock(&p->lock);
+			return -1;
+		}
+
+		revindex[i].nth = i;
+	}
+
+	qsort(revindex, p->num_objects, sizeof(*revindex), revindex_cmp);
+
+	/* readers look at the reverse index without the lock */
+	GIT_MEMORY_BARRIER;
+	p->revindex = revindex;
+	git_mutex_unlock(&p->lock);
+
+	return 0;
+}
+
+int git_pack_entry_end(
+	git_off_t *end_out,
+	uint32_t *nth_out,
+	struct git_pack_file *p,
+	git_off_t offset)
+{
+	size_t lo = 0, hi, mid;
+	int error;
+
+	assert(end_out && p);
+
+	if (!p->revindex && (error = pack_revindex_build(p)) < 0)
+		return error;
+
+	hi = p->num_objects;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (p->revindex[mid].offset == offset) {
+			if (mid + 1 < p->num_objects)
+				*end_out = p->revindex[mid + 1].offset;
+			else
+				*end_out = p->mwf.size - GIT_OID_RAWSZ;
+
+			if (nth_out)
+				*nth_out = p->revindex[mid].nth;
+
+			return 0;
+		}
+
+		if (p->revindex[mid].offset < offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	git_error_set(GIT_ERROR_ODB, "no object at offset %"PRId64" in packfile", (int64_t)offset);
+	return GIT_ENOTFOUND;
+}
+
+int git_pack_nth_oid(git_oid *out, struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (n >= p->num_objects) {
+		git_error_set(GIT_ERROR_ODB, "object index %u out of range", n);
+		return -1;
+	}
+
+	index = (const unsigned char *)p->index_map.data + 4 * 256;
+
+	if (p->index_version > 1)
+		git_oid_fromraw(out, index + 8 + 20 * n);
+	else
+		git_oid_fromraw(out, index + 24 * n + 4);
+
+	return 0;
+}
+
+int git_pack_nth_crc(uint32_t *out, struct git_pack_file *p, uint32_t n)
+{
+	const unsigned char *index;
+	int error;
+
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if (p->index_version == 1)
+		return GIT_ENOTFOUND;
+
+	if (n >= p->num_objects) {
+		git_error_set(GIT_ERROR_ODB, "object index %u out of range", n);
+		return -1;
+	}
+
+	index = (const unsigned char *)p->index_map.data + 8 + 4 * 256;
+	index += 20 * p->num_objects + 4 * n;
+
+	*out = ntohl(*((uint32_t *)index));
+	return 0;
+}
+
 static int pack_entry_find_offset(
 	git_off_t *offset_out,
 	git_oid *found_oid,
@@ -1404,3 +1862,76 @@ int git_pack_entry_find(
 	git_oid_cpy(&e->sha1, &found_oid);
 	return 0;
 }
+
+int git_pack_entry_at(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset)
+{
+	int error;
+
+	assert(e && p && oid);
+
+	if (p->num_bad_objects) {
+		unsigned i;
+		for (i = 0; i < p->num_bad_objects; i++)
+			if (git_oid__cmp(oid, &p->bad_object_sha1[i]) == 0)
+				return packfile_error("bad object found in packfile");
+	}
+
+	/* make sure the packfile backing the entry still exists on disk */
+	if (p->mwf.fd == -1 && (error = packfile_open(p)) < 0)
+		return error;
+
+	e->offset = offset;
+	e->p = p;
+
+	git_oid_cpy(&e->sha1, oid);
+	return 0;
+}
+
+int git_packfile_bitmap(
+	git_pack_bitmap_index **out,
+	struct git_pack_file *p)
+{
+	git_buf path = GIT_BUF_INIT;
+	size_t name_len;
+	int error;
+
+	*out = NULL;
+
+	/* The positions are read from the index, which takes the lock. */
+	if ((error = pack_index_open(p)) < 0)
+		return error;
+
+	if ((error = git_mutex_lock(&p->lock)) < 0)
+		return packfile_error("failed to get lock for bitmap");
+
+	if (!p->bitmap_checked) {
+		name_len = strlen(p->pack_name);
+
+		if (git_buf_put(&path, p->pack_name, name_len - strlen(".pack")) < 0 ||
+		    git_buf_puts(&path, ".bitmap") < 0) {
+			git_mutex_unlock(&p->lock);
+			git_buf_dispose(&path);
+			return -1;
+		}
+
+		/* A missing or broken bitmap index only means we cannot use it. */
+		if (git_path_isfile(path.ptr) &&
+		    git_pack_bitmap_index_open(&p->bitmap, p, path.ptr) < 0)
+			git_error_clear();
+
+		p->bitmap_checked = 1;
+		git_buf_dispose(&path);
+	}
+
+	git_mutex_unlock(&p->lock);
+
+	if (!p->bitmap)
+		return GIT_ENOTFOUND;
+
+	*out = p->bitmap;
+	return 0;
+}
@@ -20,6 +20,7 @@
 #include "offmap.h"
 #include "oidmap.h"
 #include "array.h"
+#include "pack-bitmap.h"
 
 #define GIT_PACK_FILE_MODE 0444
 
@@ -58,7 +59,12 @@ struct git_pack_idx_header {
 };
 
 typedef struct git_pack_cache_entry {
-	size_t last_usage; /* enough? */
+	/* position in the delta base cache's LRU lists, NULL while in use */
+	struct git_pack_cache_entry *prev, *next;
+	struct git_pack_cache *owner;
+	git_off_t offset;
+	unsigned int protected:1;
+
 	git_atomic refcount;
 	git_rawobj raw;
 } git_pack_cache_entry;
@@ -72,17 +78,41 @@ struct pack_chain_elem {
 
 typedef git_array_t(struct pack_chain_elem) git_dependency_chain;
 
-#define GIT_PACK_CACHE_MEMORY_LIMIT 16 * 1024 * 1024
+/*
+ * The delta base cache is shared by every pack: its entries are looked
+ * up in per-pack maps, but one byte budget applies across all
+ * repositories.
+ *
+ * The cache is split into GIT_PACK_CACHE_SHARDS shards by offset, each
+ * with its own lock, an equal share of the budget and a segmented LRU
+ * that its bases are evicted from. New bases enter the probationary
+ * segment and are promoted to the protected one when they are used
+ * again; bases that took at least GIT_PACK_CACHE_DEEP_BASE deltas to
+ * rebuild enter the protected segment directly, since losing them means
+ * replaying the whole chain.
+ */
+#define GIT_PACK_CACHE_MEMORY_LIMIT 96 * 1024 * 1024
 #define GIT_PACK_CACHE_SIZE_LIMIT 1024 * 1024 /* don't bother caching anything over 1MB */
+#define GIT_PACK_CACHE_DEEP_BASE 4
+#define GIT_PACK_CACHE_SHARDS 16
 
-typedef struct {
-	size_t memory_used;
-	size_t memory_limit;
-	size_t use_ctr;
-	git_mutex lock;
-	git_offmap *entries;
+typedef struct git_pack_cache {
+	git_offmap *entries[GIT_PACK_CACHE_SHARDS];
 } git_pack_cache;
 
+int git_pack_cache_global_init(void);
+
+/* Set the byte budget of the delta base cache, evicting bases to fit it. */
+void git_pack_cache_set_limit(size_t limit);
+size_t git_pack_cache_limit(void);
+
+void git_pack_cache_stats(
+		size_t *hits,
+		size_t *misses,
+		size_t *evictions,
+		size_t *memory_used);
+void git_pack_cache_stats_reset(void);
+
 struct git_pack_file {
 	git_mwindow_file mwf;
 	git_map index_map;
@@ -95,18 +125,26 @@ struct git_pack_file {
 
 	int index_version;
 	git_time_t mtime;
-	unsigned pack_local:1, pack_keep:1, has_cache:1;
+	unsigned pack_local:1, pack_keep:1, has_cache:1, bitmap_checked:1;
 	git_oidmap *idx_cache;
 	git_oid **oids;
 
 	git_pack_cache bases; /* delta base cache */
 
+	struct git_pack_bitmap_index *bitmap; /* reachability bitmaps, loaded on demand */
+	struct git_pack_revindex_entry *revindex; /* entries by offset, built on demand */
+
 	time_t last_freshen; /* last time the packfile was freshened */
 
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[GIT_FLEX_ARRAY]; /* more */
 };
 
+struct git_pack_revindex_entry {
+	git_off_t offset;
+	uint32_t nth; /* position in the index */
+};
+
 struct git_pack_entry {
 	git_off_t offset;
 	git_oid sha1;
@@ -157,9 +195,59 @@ int git_pack_entry_find(
 		struct git_pack_file *p,
 		const git_oid *short_oid,
 		size_t len);
+int git_pack_entry_at(
+		struct git_pack_entry *e,
+		struct git_pack_file *p,
+		const git_oid *oid,
+		git_off_t offset);
 int git_pack_foreach_entry(
 		struct git_pack_file *p,
 		git_odb_foreach_cb cb,
 		void *data);
 
+typedef int (*git_pack_foreach_entry_offset_cb)(
+		const git_oid *id,
+		git_off_t offset,
+		void *payload);
+
+/*
+ * Calls `cb` for every object in the pack index together with its
+ * offset, in index (i.e. object id) order.
+ */
+int git_pack_foreach_entry_offset(
+		struct git_pack_file *p,
+		git_pack_foreach_entry_offset_cb cb,
+		void *data);
+
+/*
+ * Find the entry that starts at `offset` in the pack: where it ends,
+ * and its position in the index.  Returns GIT_ENOTFOUND when no entry
+ * starts there.  The pack must be open; its reverse index is built on
+ * first use.
+ */
+int git_pack_entry_end(
+		git_off_t *end_out,
+		uint32_t *nth_out,
+		struct git_pack_file *p,
+		git_off_t offset);
+
+/* Get the id of the `n`th object of the pack index. */
+int git_pack_nth_oid(git_oid *out, struct git_pack_file *p, uint32_t n);
+
+/*
+ * Get the CRC32 the pack index records for the packed bytes of its
+ * `n`th object.  Returns GIT_ENOTFOUND for version 1 indexes, which
+ * do not record any.
+ */
+int git_pack_nth_crc(uint32_t *out, struct git_pack_file *p, uint32_t n);
+
+/*
+ * Get the reachability bitmap index (the `.bitmap` file next to the
+ * `.pack`) of the given pack, loading it on first use. Returns
+ * GIT_ENOTFOUND if the pack has no usable bitmap index.
+ */
+int git_packfile_bitmap(
+		git_pack_bitmap_index **out,
+		struct git_pack_file *p);
+
 #endif
@@ -309,4 +309,10 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+void p_madvise(git_map *map, int advice)
+{
+	GIT_UNUSED(map);
+	GIT_UNUSED(advice);
+}
+
 #endif
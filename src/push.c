@@ -432,6 +432,9 @@ static int do_push(git_push *push, const git_remote_callbacks *callbacks)
 
 	git_packbuilder_set_threads(push->pb, push->pb_parallelism);
 
+	/* The receiving end has the objects we are leaving out */
+	git_packbuilder_set_thin(push->pb, 1);
+
 	if (callbacks && callbacks->pack_progress)
 		if ((error = git_packbuilder_set_callbacks(push->pb, callbacks->pack_progress, callbacks->payload)) < 0)
 			goto on_error;
@@ -12,10 +12,12 @@
 #include "git2/refdb.h"
 #include "git2/sys/refdb_backend.h"
 
+#include "config.h"
 #include "hash.h"
 #include "refs.h"
 #include "reflog.h"
 #include "posix.h"
+#include "repository.h"
 
 int git_refdb_new(git_refdb **out, git_repository *repo)
 {
@@ -33,6 +35,69 @@ int git_refdb_new(git_refdb **out, git_repository *repo)
 	return 0;
 }
 
+/*
+ * Extensions are only honored when they are set in the repository's own
+ * configuration, and that configuration declares format version 1.
+ */
+static int refdb_storage(git_config_entry **out, git_repository *repo)
+{
+	git_config *config, *local = NULL;
+	int version, error;
+
+	*out = NULL;
+
+	if ((error = git_repository_config__weakptr(&config, repo)) < 0)
+		return error;
+
+	if ((error = git_config_open_level(&local, config, GIT_CONFIG_LEVEL_LOCAL)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+
+		git_error_clear();
+		return 0;
+	}
+
+	if ((error = git_config_get_int32(&version, local, "core.repositoryformatversion")) < 0) {
+		if (error == GIT_ENOTFOUND) {
+			git_error_clear();
+			error = 0;
+		}
+		goto done;
+	}
+
+	if (version == 1)
+		error = git_config__lookup_entry(out, local, "extensions.refstorage", false);
+
+done:
+	git_config_free(local);
+	return error;
+}
+
+static int refdb_open_backend(git_refdb_backend **out, git_repository *repo)
+{
+	git_config_entry *storage = NULL;
+	int error;
+
+	if (!repo->gitdir)
+		return git_refdb_backend_fs(out, repo);
+
+	if ((error = refdb_storage(&storage, repo)) < 0)
+		return error;
+
+	if (!storage || !strcasecmp(storage->value, "files"))
+		error = git_refdb_backend_fs(out, repo);
+	else if (!strcasecmp(storage->value, "reftable"))
+		error = git_refdb_backend_reftable(out, repo);
+	else {
+		git_error_set(GIT_ERROR_REFERENCE,
+			"unsupported reference storage format '%s'", storage->value);
+		error = -1;
+	}
+
+	git_config_entry_free(storage);
+	return error;
+}
+
 int git_refdb_open(git_refdb **out, git_repository *repo)
 {
 	git_refdb *db;
@@ -45,8 +110,8 @@ int git_refdb_open(git_refdb **out, git_repository *repo)
 	if (git_refdb_new(&db, repo) < 0)
 		return -1;
 
-	/* Add the default (filesystem) backend */
-	if (git_refdb_backend_fs(&dir, repo) < 0) {
+	/* Add the backend the repository asks for, or the filesystem one */
+	if (refdb_open_backend(&dir, repo) < 0) {
 		git_refdb_free(db);
 		return -1;
 	}
@@ -258,3 +323,31 @@ int git_refdb_unlock(git_refdb *db, void *payload, int success, int update_reflo
 
 	return db->backend->unlock(db->backend, payload, success, update_reflog, ref, sig, message);
 }
+
+int git_refdb_unlock_many(git_refdb *db, git_refdb_update *updates, size_t count)
+{
+	size_t i;
+	int error = 0, unlock_error;
+
+	assert(db && (updates || !count));
+
+	if (db->backend->unlock_many &&
+	    (error = db->backend->unlock_many(db->backend, updates, count)) != GIT_PASSTHROUGH)
+		return error;
+
+	error = 0;
+
+	/* Keep going after a failure so that every lock gets released */
+	for (i = 0; i < count; i++) {
+		git_refdb_update *update = &updates[i];
+
+		unlock_error = db->backend->unlock(db->backend, update->payload,
+			error ? 0 : update->success, update->update_reflog,
+			update->ref, update->sig, update->message);
+
+		if (unlock_error < 0 && !error)
+			error = unlock_error;
+	}
+
+	return error;
+}
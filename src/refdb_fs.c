@@ -64,6 +64,12 @@ typedef struct refdb_fs_backend {
 	git_iterator_flag_t iterator_flags;
 	uint32_t direach_flags;
 	int fsync;
+
+	/* search packed-refs in place instead of loading the refcache */
+	int packed_mmap;
+	git_mutex snapshot_lock;
+	struct packed_snapshot *snapshot;
+	git_futils_filestamp snapshot_stamp;
 } refdb_fs_backend;
 
 static int refdb_reflog_fs__delete(git_refdb_backend *_backend, const char *name);
@@ -197,6 +203,338 @@ parse_failed:
 	return -1;
 }
 
+/*
+ * A snapshot of the packed-refs file that is searched in place instead of
+ * being parsed into the refcache.  Its records are "<OID> <refname>\n",
+ * optionally followed by a "^<OID>\n" peel line, and must be sorted by
+ * refname, which git promises with the "sorted" trait in the header.
+ */
+typedef struct packed_snapshot {
+	git_refcount rc;
+	git_map map;
+	git_buf buf;
+	const char *start;
+	const char *end;
+} packed_snapshot;
+
+/* A record of a packed snapshot; `name` is not NUL-terminated */
+typedef struct {
+	const char *name;
+	size_t name_len;
+	git_oid oid;
+	git_oid peel;
+} packed_record;
+
+static void packed_snapshot_free(packed_snapshot *snapshot)
+{
+	if (!snapshot)
+		return;
+
+	if (snapshot->map.data)
+		git_futils_mmap_free(&snapshot->map);
+	git_buf_dispose(&snapshot->buf);
+	git__free(snapshot);
+}
+
+static void packed_snapshot_release(packed_snapshot *snapshot)
+{
+	if (snapshot)
+		GIT_REFCOUNT_DEC(snapshot, packed_snapshot_free);
+}
+
+/*
+ * Skip the header of the snapshot, returning GIT_PASSTHROUGH when the
+ * file cannot be searched in place.
+ */
+static int packed_snapshot_parse_header(packed_snapshot *snapshot)
+{
+	static const char *traits_header = "# pack-refs with: ";
+	const char *scan = snapshot->start, *eol;
+
+	if (scan == snapshot->end)
+		return 0;
+
+	if (snapshot->end[-1] != '\n' || *scan != '#' ||
+	    git__prefixncmp(scan, snapshot->end - scan, traits_header) != 0)
+		return GIT_PASSTHROUGH;
+
+	eol = memchr(scan, '\n', snapshot->end - scan);
+
+	/* the traits are separated and terminated by a space */
+	if (!git__memmem(scan, eol - scan, " sorted ", strlen(" sorted ")))
+		return GIT_PASSTHROUGH;
+
+	scan = eol + 1;
+
+	while (scan < snapshot->end && *scan == '#')
+		scan = (const char *)memchr(scan, '\n', snapshot->end - scan) + 1;
+
+	snapshot->start = scan;
+	return 0;
+}
+
+static int packed_snapshot_new(packed_snapshot **out)
+{
+	packed_snapshot *snapshot = git__calloc(1, sizeof(packed_snapshot));
+	GIT_ERROR_CHECK_ALLOC(snapshot);
+
+	GIT_REFCOUNT_INC(snapshot);
+
+	*out = snapshot;
+	return 0;
+}
+
+static int packed_snapshot_load(packed_snapshot **out, const char *path)
+{
+	packed_snapshot *snapshot;
+	git_file fd = -1;
+	struct stat st;
+	int error;
+
+	*out = NULL;
+
+	if ((error = packed_snapshot_new(&snapshot)) < 0)
+		return error;
+
+	if ((fd = git_futils_open_ro(path)) < 0) {
+		error = fd;
+		goto done;
+	}
+
+	if ((error = p_fstat(fd, &st)) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to stat '%s'", path);
+		goto done;
+	}
+
+	if (!git__is_sizet(st.st_size)) {
+		git_error_set(GIT_ERROR_REFERENCE, "packed-refs file too large");
+		error = -1;
+		goto done;
+	}
+
+	/*
+	 * Windows cannot replace a file that is mapped, which would stop
+	 * other writers from updating packed-refs; read it there instead.
+	 */
+#ifdef GIT_WIN32
+	if ((error = git_futils_readbuffer_fd(&snapshot->buf, fd, (size_t)st.st_size)) < 0)
+		goto done;
+
+	snapshot->start = snapshot->buf.ptr;
+#else
+	if (st.st_size &&
+	    (error = git_futils_mmap_ro(&snapshot->map, fd, 0, (size_t)st.st_size)) < 0)
+		goto done;
+
+	snapshot->start = snapshot->map.data;
+#endif
+	snapshot->end = snapshot->start + (size_t)st.st_size;
+
+	error = packed_snapshot_parse_header(snapshot);
+
+done:
+	if (fd >= 0)
+		p_close(fd);
+
+	if (error < 0)
+		packed_snapshot_release(snapshot);
+	else
+		*out = snapshot;
+
+	return error;
+}
+
+/*
+ * Get the current snapshot of packed-refs, reloading it when the file
+ * changed.  `out` is NULL when packed-refs must be read into the refcache
+ * instead, because searching in place is disabled or the file is not
+ * sorted.
+ */
+static int packed_snapshot_get(packed_snapshot **out, refdb_fs_backend *backend)
+{
+	packed_snapshot *snapshot = NULL;
+	const char *path;
+	int error;
+
+	*out = NULL;
+
+	if (!backend->packed_mmap || !backend->gitpath)
+		return 0;
+
+	path = git_sortedcache_path(backend->refcache);
+
+	if (git_mutex_lock(&backend->snapshot_lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock packed-refs snapshot");
+		return -1;
+	}
+
+	if ((error = git_futils_filestamp_check(&backend->snapshot_stamp, path)) > 0)
+		error = packed_snapshot_load(&snapshot, path);
+
+	if (error == GIT_ENOTFOUND) {
+		git_error_clear();
+		git_futils_filestamp_set(&backend->snapshot_stamp, NULL);
+
+		error = 0;
+		if (!backend->snapshot || backend->snapshot->start != backend->snapshot->end)
+			error = packed_snapshot_new(&snapshot);
+	}
+
+	if (error < 0 && error != GIT_PASSTHROUGH) {
+		git_futils_filestamp_set(&backend->snapshot_stamp, NULL);
+		goto done;
+	}
+
+	if (snapshot || error == GIT_PASSTHROUGH) {
+		packed_snapshot_release(backend->snapshot);
+		backend->snapshot = snapshot;
+	}
+
+	if (backend->snapshot) {
+		GIT_REFCOUNT_INC(backend->snapshot);
+		*out = backend->snapshot;
+	}
+
+	error = 0;
+
+done:
+	git_mutex_unlock(&backend->snapshot_lock);
+	return error;
+}
+
+static int packed_snapshot_corrupted(void)
+{
+	git_error_set(GIT_ERROR_REFERENCE, "corrupted packed references file");
+	return -1;
+}
+
+/* Find the start of the record that `pos` points into */
+static const char *packed_record_start(
+	const packed_snapshot *snapshot, const char *pos)
+{
+	while (pos > snapshot->start && pos[-1] != '\n')
+		pos--;
+
+	/* a peel line belongs to the record before it */
+	if (*pos == '^' && pos > snapshot->start) {
+		pos--;
+		while (pos > snapshot->start && pos[-1] != '\n')
+			pos--;
+	}
+
+	return pos;
+}
+
+/* Find the start of the record after the one starting at `rec` */
+static const char *packed_record_next(
+	const packed_snapshot *snapshot, const char *rec)
+{
+	rec = (const char *)memchr(rec, '\n', snapshot->end - rec) + 1;
+
+	if (rec < snapshot->end && *rec == '^')
+		rec = (const char *)memchr(rec, '\n', snapshot->end - rec) + 1;
+
+	return rec;
+}
+
+/* Parse the name of the record starting at `rec` */
+static int packed_record_name(
+	packed_record *out, const packed_snapshot *snapshot, const char *rec)
+{
+	const char *eol = memchr(rec, '\n', snapshot->end - rec);
+
+	if ((size_t)(eol - rec) < GIT_OID_HEXSZ + 2 || rec[GIT_OID_HEXSZ] != ' ')
+		return packed_snapshot_corrupted();
+
+	out->name = rec + GIT_OID_HEXSZ + 1;
+	out->name_len = eol - out->name;
+
+	if (eol[-1] == '\r')
+		out->name_len--;
+
+	return 0;
+}
+
+/* Parse the record starting at `rec` */
+static int packed_record_parse(
+	packed_record *out, const packed_snapshot *snapshot, const char *rec)
+{
+	const char *peel;
+
+	if (packed_record_name(out, snapshot, rec) < 0 ||
+	    git_oid_fromstrn(&out->oid, rec, GIT_OID_HEXSZ) < 0)
+		return packed_snapshot_corrupted();
+
+	memset(&out->peel, 0, sizeof(git_oid));
+	peel = (const char *)memchr(rec, '\n', snapshot->end - rec) + 1;
+
+	if (peel < snapshot->end && *peel == '^' &&
+	    (snapshot->end - peel < GIT_OID_HEXSZ + 1 ||
+	     git_oid_fromstrn(&out->peel, peel + 1, GIT_OID_HEXSZ) < 0))
+		return packed_snapshot_corrupted();
+
+	return 0;
+}
+
+static int packed_record_cmp(
+	const packed_record *rec, const char *name, size_t name_len)
+{
+	int cmp = memcmp(rec->name, name, min(rec->name_len, name_len));
+
+	if (cmp)
+		return cmp;
+
+	return (rec->name_len < name_len) ? -1 : (rec->name_len > name_len);
+}
+
+/*
+ * Find the first record of the snapshot whose name sorts at or after
+ * `name`, by binary search over the bytes of the file.
+ */
+static int packed_snapshot_seek(
+	const char **out,
+	const packed_snapshot *snapshot,
+	const char *name,
+	size_t name_len)
+{
+	const char *lo = snapshot->start, *hi = snapshot->end;
+	packed_record rec;
+
+	while (lo < hi) {
+		const char *mid = packed_record_start(snapshot, lo + (hi - lo) / 2);
+
+		if (packed_record_name(&rec, snapshot, mid) < 0)
+			return -1;
+
+		if (packed_record_cmp(&rec, name, name_len) < 0)
+			lo = packed_record_next(snapshot, mid);
+		else
+			hi = mid;
+	}
+
+	*out = lo;
+	return 0;
+}
+
+/* Look up the record named `name`, returning GIT_ENOTFOUND without an error */
+static int packed_snapshot_lookup(
+	packed_record *out, const packed_snapshot *snapshot, const char *name)
+{
+	size_t name_len = strlen(name);
+	const char *rec;
+
+	if (packed_snapshot_seek(&rec, snapshot, name, name_len) < 0)
+		return -1;
+
+	if (rec == snapshot->end)
+		return GIT_ENOTFOUND;
+
+	if (packed_record_parse(out, snapshot, rec) < 0)
+		return -1;
+
+	return packed_record_cmp(out, name, name_len) ? GIT_ENOTFOUND : 0;
+}
+
 static int loose_parse_oid(
 	git_oid *oid, const char *filename, git_buf *file_content)
 {
@@ -329,6 +667,8 @@ static int refdb_fs_backend__exists(
 {
 	refdb_fs_backend *backend = GIT_CONTAINER_OF(_backend, refdb_fs_backend, parent);
 	git_buf ref_path = GIT_BUF_INIT;
+	packed_snapshot *snapshot = NULL;
+	packed_record rec;
 	int error;
 
 	assert(backend);
@@ -343,6 +683,17 @@ static int refdb_fs_backend__exists(
 		goto out;
 	}
 
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		goto out;
+
+	if (snapshot) {
+		if ((error = packed_snapshot_lookup(&rec, snapshot, ref_name)) == 0)
+			*exists = 1;
+		else if (error == GIT_ENOTFOUND)
+			error = 0;
+		goto out;
+	}
+
 	if ((error = packed_reload(backend)) < 0)
 		goto out;
 
@@ -352,6 +703,7 @@ static int refdb_fs_backend__exists(
 	}
 
 out:
+	packed_snapshot_release(snapshot);
 	git_buf_dispose(&ref_path);
 	return error;
 }
@@ -443,6 +795,21 @@ static int packed_lookup(
 {
 	int error = 0;
 	struct packref *entry;
+	packed_snapshot *snapshot;
+	packed_record rec;
+
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		return error;
+
+	if (snapshot) {
+		if ((error = packed_snapshot_lookup(&rec, snapshot, ref_name)) == GIT_ENOTFOUND)
+			error = ref_error_notfound(ref_name);
+		else if (!error && (*out = git_reference__alloc(ref_name, &rec.oid, &rec.peel)) == NULL)
+			error = -1;
+
+		packed_snapshot_release(snapshot);
+		return error;
+	}
 
 	if ((error = packed_reload(backend)) < 0)
 		return error;
@@ -498,6 +865,13 @@ typedef struct {
 	git_sortedcache *cache;
 	size_t loose_pos;
 	size_t packed_pos;
+
+	/* when searching packed-refs in place */
+	packed_snapshot *snapshot;
+	const char *snapshot_pos;
+	size_t prefix_len;
+	git_vector shadowed;
+	git_buf name;
 } refdb_fs_iter;
 
 static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
@@ -505,8 +879,11 @@ static void refdb_fs_backend__iterator_free(git_reference_iterator *_iter)
 	refdb_fs_iter *iter = GIT_CONTAINER_OF(_iter, refdb_fs_iter, parent);
 
 	git_vector_free(&iter->loose);
+	git_vector_free(&iter->shadowed);
 	git_pool_clear(&iter->pool);
 	git_sortedcache_free(iter->cache);
+	packed_snapshot_release(iter->snapshot);
+	git_buf_dispose(&iter->name);
 	git__free(iter);
 }
 
@@ -587,6 +964,59 @@ static int iter_load_loose_paths(refdb_fs_backend *backend, refdb_fs_iter *iter)
 	return error;
 }
 
+/* Mark the packed ref named `path` as shadowed by a loose ref */
+static int iter_shadow_packed(refdb_fs_iter *iter, const char *path)
+{
+	struct packref *ref;
+
+	if (iter->snapshot)
+		return git_vector_insert(&iter->shadowed, (char *)path);
+
+	if ((ref = git_sortedcache_lookup(iter->cache, path)) != NULL)
+		ref->flags |= PACKREF_SHADOWED;
+
+	return 0;
+}
+
+/*
+ * Find the next packed ref of the snapshot that matches the glob, which
+ * were all seeked to when the iterator was created.  Its name is left in
+ * `iter->name`.
+ */
+static int iter_snapshot_next(packed_record *out, refdb_fs_iter *iter)
+{
+	const char *end = iter->snapshot->end;
+
+	git_vector_sort(&iter->shadowed);
+
+	while (iter->snapshot_pos < end) {
+		if (packed_record_parse(out, iter->snapshot, iter->snapshot_pos) < 0)
+			return -1;
+
+		if (iter->prefix_len &&
+		    (out->name_len < iter->prefix_len ||
+		     memcmp(out->name, iter->glob, iter->prefix_len) != 0)) {
+			iter->snapshot_pos = end;
+			break;
+		}
+
+		iter->snapshot_pos = packed_record_next(iter->snapshot, iter->snapshot_pos);
+
+		git_buf_clear(&iter->name);
+		if (git_buf_put(&iter->name, out->name, out->name_len) < 0)
+			return -1;
+
+		if (git_vector_bsearch(NULL, &iter->shadowed, iter->name.ptr) == 0)
+			continue;
+		if (iter->glob && p_fnmatch(iter->glob, iter->name.ptr, 0) != 0)
+			continue;
+
+		return 0;
+	}
+
+	return GIT_ITEROVER;
+}
+
 static int refdb_fs_backend__iterator_next(
 	git_reference **out, git_reference_iterator *_iter)
 {
@@ -594,14 +1024,16 @@ static int refdb_fs_backend__iterator_next(
 	refdb_fs_iter *iter = GIT_CONTAINER_OF(_iter, refdb_fs_iter, parent);
 	refdb_fs_backend *backend = GIT_CONTAINER_OF(iter->parent.db->backend, refdb_fs_backend, parent);
 	struct packref *ref;
+	packed_record rec;
 
 	while (iter->loose_pos < iter->loose.length) {
 		const char *path = git_vector_get(&iter->loose, iter->loose_pos++);
 
 		if (loose_lookup(out, backend, path) == 0) {
-			ref = git_sortedcache_lookup(iter->cache, path);
-			if (ref)
-				ref->flags |= PACKREF_SHADOWED;
+			if (iter_shadow_packed(iter, path) < 0) {
+				git_reference_free(*out);
+				return -1;
+			}
 
 			return 0;
 		}
@@ -609,6 +1041,14 @@ static int refdb_fs_backend__iterator_next(
 		git_error_clear();
 	}
 
+	if (iter->snapshot) {
+		if ((error = iter_snapshot_next(&rec, iter)) < 0)
+			return error;
+
+		*out = git_reference__alloc(iter->name.ptr, &rec.oid, &rec.peel);
+		return (*out != NULL) ? 0 : -1;
+	}
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
@@ -635,15 +1075,14 @@ static int refdb_fs_backend__iterator_next_name(
 	refdb_fs_iter *iter = GIT_CONTAINER_OF(_iter, refdb_fs_iter, parent);
 	refdb_fs_backend *backend = GIT_CONTAINER_OF(iter->parent.db->backend, refdb_fs_backend, parent);
 	struct packref *ref;
+	packed_record rec;
 
 	while (iter->loose_pos < iter->loose.length) {
 		const char *path = git_vector_get(&iter->loose, iter->loose_pos++);
-		struct packref *ref;
 
 		if (loose_lookup(NULL, backend, path) == 0) {
-			ref = git_sortedcache_lookup(iter->cache, path);
-			if (ref)
-				ref->flags |= PACKREF_SHADOWED;
+			if (iter_shadow_packed(iter, path) < 0)
+				return -1;
 
 			*out = path;
 			return 0;
@@ -652,6 +1091,14 @@ static int refdb_fs_backend__iterator_next_name(
 		git_error_clear();
 	}
 
+	if (iter->snapshot) {
+		if ((error = iter_snapshot_next(&rec, iter)) < 0)
+			return error;
+
+		*out = iter->name.ptr;
+		return 0;
+	}
+
 	error = GIT_ITEROVER;
 	while (iter->packed_pos < git_sortedcache_entrycount(iter->cache)) {
 		ref = git_sortedcache_entry(iter->cache, iter->packed_pos++);
@@ -697,11 +1144,30 @@ static int refdb_fs_backend__iterator(
 	if ((error = iter_load_loose_paths(backend, iter)) < 0)
 		goto out;
 
-	if ((error = packed_reload(backend)) < 0)
+	if ((error = packed_snapshot_get(&iter->snapshot, backend)) < 0)
 		goto out;
 
-	if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
-		goto out;
+	if (iter->snapshot) {
+		if ((error = git_vector_init(&iter->shadowed, 8, git__strcmp_cb)) < 0)
+			goto out;
+
+		iter->snapshot_pos = iter->snapshot->start;
+
+		/* seek to the packed refs starting with the glob's literal prefix */
+		if (iter->glob) {
+			iter->prefix_len = strcspn(iter->glob, "?*[\\");
+
+			if ((error = packed_snapshot_seek(&iter->snapshot_pos, iter->snapshot,
+					iter->glob, iter->prefix_len)) < 0)
+				goto out;
+		}
+	} else {
+		if ((error = packed_reload(backend)) < 0)
+			goto out;
+
+		if ((error = git_sortedcache_copy(&iter->cache, backend->refcache, 1, NULL, NULL)) < 0)
+			goto out;
+	}
 
 	iter->parent.next = refdb_fs_backend__iterator_next;
 	iter->parent.next_name = refdb_fs_backend__iterator_next_name;
@@ -731,16 +1197,75 @@ static bool ref_is_available(
 	return true;
 }
 
+/*
+ * Check that no packed ref other than `old_ref` is a directory of
+ * `new_ref` or lives in a directory named `new_ref`, by seeking to the
+ * refs that could collide instead of scanning them all.
+ */
+static int packed_snapshot_path_available(
+	const packed_snapshot *snapshot, const char *new_ref, const char *old_ref)
+{
+	git_buf dir = GIT_BUF_INIT;
+	size_t new_len = strlen(new_ref), i;
+	packed_record rec;
+	const char *pos;
+	int error = 0;
+
+	for (i = 0; i < new_len; i++) {
+		if (new_ref[i] != '/')
+			continue;
+
+		if ((error = packed_snapshot_seek(&pos, snapshot, new_ref, i)) < 0 ||
+		    (pos < snapshot->end &&
+		     (error = packed_record_name(&rec, snapshot, pos)) < 0))
+			goto done;
+
+		if (pos < snapshot->end && !packed_record_cmp(&rec, new_ref, i) &&
+		    (!old_ref || strlen(old_ref) != i || strncmp(old_ref, new_ref, i)))
+			goto collides;
+	}
+
+	if ((error = git_buf_printf(&dir, "%s/", new_ref)) < 0 ||
+	    (error = packed_snapshot_seek(&pos, snapshot, dir.ptr, dir.size)) < 0)
+		goto done;
+
+	for (; pos < snapshot->end; pos = packed_record_next(snapshot, pos)) {
+		if ((error = packed_record_name(&rec, snapshot, pos)) < 0)
+			goto done;
+
+		if (rec.name_len < dir.size || memcmp(rec.name, dir.ptr, dir.size))
+			break;
+
+		if (!old_ref || packed_record_cmp(&rec, old_ref, strlen(old_ref)))
+			goto collides;
+	}
+
+	goto done;
+
+collides:
+	git_error_set(GIT_ERROR_REFERENCE,
+		"path to reference '%s' collides with existing one", new_ref);
+	error = -1;
+
+done:
+	git_buf_dispose(&dir);
+	return error;
+}
+
 static int reference_path_available(
 	refdb_fs_backend *backend,
 	const char *new_ref,
 	const char* old_ref,
 	int force)
 {
+	packed_snapshot *snapshot;
 	size_t i;
 	int error;
 
-	if ((error = packed_reload(backend)) < 0)
+	if ((error = packed_snapshot_get(&snapshot, backend)) < 0)
+		return error;
+
+	if (!snapshot && (error = packed_reload(backend)) < 0)
 		return error;
 
 	if (!force) {
@@ -748,10 +1273,12 @@ static int reference_path_available(
 
 		if ((error = refdb_fs_backend__exists(
 			&exists, (git_refdb_backend *)backend, new_ref)) < 0) {
+			packed_snapshot_release(snapshot);
 			return error;
 		}
 
 		if (exists) {
+			packed_snapshot_release(snapshot);
 			git_error_set(GIT_ERROR_REFERENCE,
 				"failed to write reference '%s': a reference with "
 				"that name already exists.", new_ref);
@@ -759,6 +1286,12 @@ static int reference_path_available(
 		}
 	}
 
+	if (snapshot) {
+		error = packed_snapshot_path_available(snapshot, new_ref, old_ref);
+		packed_snapshot_release(snapshot);
+		return error;
+	}
+
 	git_sortedcache_rlock(backend->refcache);
 
 	for (i = 0; i < git_sortedcache_entrycount(backend->refcache); ++i) {
@@ -776,6 +1309,45 @@ static int reference_path_available(
 	return 0;
 }
 
+/*
+ * Check that no loose reference lives beneath the path of `name`.
+ * Empty directories are fine, locking the reference removes them.
+ */
+static int loose_path_available(refdb_fs_backend *backend, const char *name)
+{
+	git_buf path = GIT_BUF_INIT;
+	const char *basedir;
+	int error;
+
+	basedir = is_per_worktree_ref(name) ? backend->gitpath : backend->commonpath;
+
+	if ((error = git_buf_joinpath(&path, basedir, name)) < 0)
+		return error;
+
+	if (git_path_isdir(path.ptr) && !git_path_is_empty_dir(path.ptr)) {
+		git_error_set(GIT_ERROR_REFERENCE,
+			"path to reference '%s' collides with existing one", name);
+		error = -1;
+	}
+
+	git_buf_dispose(&path);
+	return error;
+}
+
+/*
+ * Check a locked reference which is about to be written against both
+ * the packed and the loose references.
+ */
+static int locked_path_available(refdb_fs_backend *backend, const char *name)
+{
+	int error;
+
+	if ((error = reference_path_available(backend, name, NULL, true)) < 0)
+		return error;
+
+	return loose_path_available(backend, name);
+}
+
 static int loose_lock(git_filebuf *file, refdb_fs_backend *backend, const char *name)
 {
 	int error, filebuf_flags;
@@ -876,6 +1448,9 @@ static int refdb_fs_backend__unlock(git_refdb_backend *backend, void *payload, i
 
 	if (success == 2)
 		error = refdb_fs_backend__delete_tail(backend, lock, ref->name, NULL, NULL);
+	else if (success &&
+		 (error = locked_path_available((refdb_fs_backend *)backend, ref->name)) < 0)
+		git_filebuf_cleanup(lock);
 	else if (success)
 		error = refdb_fs_backend__write_tail(backend, ref, lock, update_reflog, sig, message, NULL, NULL);
 	else
@@ -1096,7 +1671,9 @@ fail:
 	return error;
 }
 
-static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *author, const char *message);
+static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *author, const char *message, git_strmap *batch);
+static int reflog_batch_write(refdb_fs_backend *backend, git_strmap *batch);
+static void reflog_batch_free(git_strmap *batch);
 static int has_reflog(git_repository *repo, const char *name);
 
 static int should_write_reflog(int *write, git_repository *repo, const char *name)
@@ -1186,7 +1763,7 @@ out:
  * check with HEAD only which should cover 99% of all usage
  * scenarios (even 100% of the default ones).
  */
-static int maybe_append_head(refdb_fs_backend *backend, const git_reference *ref, const git_signature *who, const char *message)
+static int maybe_append_head(refdb_fs_backend *backend, const git_reference *ref, const git_signature *who, const char *message, git_strmap *batch)
 {
 	int error;
 	git_oid old_id;
@@ -1231,7 +1808,7 @@ static int maybe_append_head(refdb_fs_backend *backend, const git_reference *ref
 	if (strcmp(name, ref->name))
 		goto cleanup;
 
-	error = reflog_append(backend, head, &old_id, git_reference_target(ref), who, message);
+	error = reflog_append(backend, head, &old_id, git_reference_target(ref), who, message, batch);
 
 cleanup:
 	git_reference_free(tmp);
@@ -1308,9 +1885,9 @@ static int refdb_fs_backend__write_tail(
 			goto on_error;
 
 		if (should_write) {
-			if ((error = reflog_append(backend, ref, NULL, NULL, who, message)) < 0)
+			if ((error = reflog_append(backend, ref, NULL, NULL, who, message, NULL)) < 0)
 				goto on_error;
-			if ((error = maybe_append_head(backend, ref, who, message)) < 0)
+			if ((error = maybe_append_head(backend, ref, who, message, NULL)) < 0)
 				goto on_error;
 		}
 	}
@@ -1486,7 +2063,7 @@ static int refdb_fs_backend__rename(
 	/* Try to rename the refog; it's ok if the old doesn't exist */
 	error = refdb_reflog_fs__rename(_backend, old_name, new_name);
 	if (((error == 0) || (error == GIT_ENOTFOUND)) &&
-	    ((error = reflog_append(backend, new, git_reference_target(new), NULL, who, message)) < 0)) {
+	    ((error = reflog_append(backend, new, git_reference_target(new), NULL, who, message, NULL)) < 0)) {
 		git_reference_free(new);
 		git_filebuf_cleanup(&file);
 		return error;
@@ -1523,6 +2100,294 @@ static int refdb_fs_backend__compress(git_refdb_backend *_backend)
 	return 0;
 }
 
+/*
+ * Transactions which update or delete fewer references than this are
+ * written as loose references; larger ones are applied with a single
+ * rewrite of the packed-refs file instead of a file per reference.
+ */
+#define PACKED_BATCH_MIN 16
+
+enum {
+	BATCH_DISCARD = 0,
+	BATCH_PACK,
+	BATCH_DELETE,
+	BATCH_LOOSE,
+};
+
+static int packed_batch_prepare(
+	int *action,
+	refdb_fs_backend *backend,
+	git_refdb_update *update,
+	git_strmap *reflogs)
+{
+	const git_reference *ref = update->ref;
+	int error, cmp, exists, should_write;
+
+	*action = BATCH_DISCARD;
+
+	if (!update->success)
+		return 0;
+
+	if (update->success == 2) {
+		if ((error = refdb_fs_backend__exists(&exists, &backend->parent, ref->name)) < 0)
+			return error;
+
+		if (!exists)
+			return ref_error_notfound(ref->name);
+
+		*action = BATCH_DELETE;
+		return 0;
+	}
+
+	if ((error = locked_path_available(backend, ref->name)) < 0)
+		return error;
+
+	if (ref->type == GIT_REFERENCE_SYMBOLIC) {
+		*action = BATCH_LOOSE;
+		return 0;
+	}
+
+	error = cmp_old_ref(&cmp, &backend->parent, ref->name, &ref->target.oid, NULL);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	/* Don't update if we have the same value */
+	if (!error && !cmp)
+		return 0;
+
+	if (update->update_reflog) {
+		if ((error = should_write_reflog(&should_write, backend->repo, ref->name)) < 0)
+			return error;
+
+		if (should_write &&
+		    ((error = reflog_append(backend, ref, NULL, NULL, update->sig, update->message, reflogs)) < 0 ||
+		     (error = maybe_append_head(backend, ref, update->sig, update->message, reflogs)) < 0))
+			return error;
+	}
+
+	*action = BATCH_PACK;
+	return 0;
+}
+
+/*
+ * Check that the references a batch writes don't live in a directory
+ * named after one another.
+ */
+static int batch_paths_available(
+	git_refdb_update *updates,
+	const int *actions,
+	size_t count)
+{
+	git_strmap *names;
+	git_buf dir = GIT_BUF_INIT;
+	const char *name, *slash;
+	size_t i;
+	int error;
+
+	if ((error = git_strmap_new(&names)) < 0)
+		return error;
+
+	for (i = 0; i < count; i++) {
+		if (actions[i] != BATCH_PACK && actions[i] != BATCH_LOOSE)
+			continue;
+
+		name = updates[i].ref->name;
+		if ((error = git_strmap_set(names, name, (void *)name)) < 0)
+			goto done;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (actions[i] != BATCH_PACK && actions[i] != BATCH_LOOSE)
+			continue;
+
+		name = updates[i].ref->name;
+
+		for (slash = strchr(name, '/'); slash; slash = strchr(slash + 1, '/')) {
+			if ((error = git_buf_set(&dir, name, slash - name)) < 0)
+				goto done;
+
+			if (git_strmap_exists(names, dir.ptr)) {
+				git_error_set(GIT_ERROR_REFERENCE,
+					"path to reference '%s' collides with existing one", name);
+				error = -1;
+				goto done;
+			}
+		}
+	}
+
+done:
+	git_buf_dispose(&dir);
+	git_strmap_free(names);
+	return error;
+}
+
+/*
+ * Check that no packed ref lives in a directory named after another
+ * one; must be called with the refcache write-locked.
+ */
+static int packed_paths_available(refdb_fs_backend *backend)
+{
+	git_buf dir = GIT_BUF_INIT;
+	const char *slash;
+	size_t i;
+	int error = 0;
+
+	for (i = 0; i < git_sortedcache_entrycount(backend->refcache); i++) {
+		struct packref *ref = git_sortedcache_entry(backend->refcache, i);
+
+		for (slash = strchr(ref->name, '/'); slash; slash = strchr(slash + 1, '/')) {
+			if ((error = git_buf_set(&dir, ref->name, slash - ref->name)) < 0)
+				goto done;
+
+			if (git_sortedcache_lookup(backend->refcache, dir.ptr) != NULL) {
+				git_error_set(GIT_ERROR_REFERENCE,
+					"path to reference '%s' collides with existing one", ref->name);
+				error = -1;
+				goto done;
+			}
+		}
+	}
+
+done:
+	git_buf_dispose(&dir);
+	return error;
+}
+
+static int packed_batch_apply(
+	refdb_fs_backend *backend,
+	git_refdb_update *updates,
+	const int *actions,
+	size_t count)
+{
+	struct packref *packref;
+	size_t i, pos, entries;
+	bool added = false;
+	int error;
+
+	if ((error = packed_reload(backend)) < 0 ||
+	    (error = git_sortedcache_wlock(backend->refcache)) < 0)
+		return error;
+
+	for (i = 0; i < count && !error; i++) {
+		const git_reference *ref = updates[i].ref;
+
+		if (actions[i] == BATCH_PACK) {
+			entries = git_sortedcache_entrycount(backend->refcache);
+
+			if ((error = git_sortedcache_upsert((void **)&packref, backend->refcache, ref->name)) < 0)
+				break;
+
+			added |= git_sortedcache_entrycount(backend->refcache) != entries;
+
+			git_oid_cpy(&packref->oid, &ref->target.oid);
+			packref->flags = 0;
+
+			/* A loose ref may point to a missing object, so may this one */
+			if (packed_find_peel(backend, packref) < 0) {
+				git_error_clear();
+				packref->flags |= PACKREF_CANNOT_PEEL;
+			}
+		} else if (actions[i] == BATCH_DELETE) {
+			/* The reference may only exist as a loose file */
+			if (!(error = git_sortedcache_lookup_index(&pos, backend->refcache, ref->name)))
+				error = git_sortedcache_remove(backend->refcache, pos);
+			else if (error == GIT_ENOTFOUND)
+				error = 0;
+		}
+	}
+
+	if (!error && added)
+		error = packed_paths_available(backend);
+
+	git_sortedcache_wunlock(backend->refcache);
+
+	if (!error)
+		error = packed_write(backend);
+
+	/* The cache no longer matches the file; have it read again */
+	if (error < 0) {
+		git_sortedcache_clear(backend->refcache, true);
+		git_futils_filestamp_set(&backend->refcache->stamp, NULL);
+	}
+
+	return error;
+}
+
+static int refdb_fs_backend__unlock_many(
+	git_refdb_backend *_backend,
+	git_refdb_update *updates,
+	size_t count)
+{
+	refdb_fs_backend *backend = GIT_CONTAINER_OF(_backend, refdb_fs_backend, parent);
+	git_strmap *reflogs = NULL;
+	git_filebuf *lock;
+	int *actions = NULL;
+	size_t packed = 0, i;
+	int error = 0;
+
+	for (i = 0; i < count; i++) {
+		if (updates[i].success == 2 ||
+		    (updates[i].success && updates[i].ref->type == GIT_REFERENCE_DIRECT))
+			packed++;
+	}
+
+	if (packed < PACKED_BATCH_MIN)
+		return GIT_PASSTHROUGH;
+
+	actions = git__calloc(count, sizeof(int));
+	if (!actions || (error = git_strmap_new(&reflogs)) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	for (i = 0; i < count; i++) {
+		if ((error = packed_batch_prepare(&actions[i], backend, &updates[i], reflogs)) < 0)
+			goto done;
+	}
+
+	if ((error = batch_paths_available(updates, actions, count)) < 0)
+		goto done;
+
+	/*
+	 * Every reflog is written before the new values are made visible
+	 * by the single commit of the packed-refs file.
+	 */
+	if ((error = reflog_batch_write(backend, reflogs)) < 0 ||
+	    (error = packed_batch_apply(backend, updates, actions, count)) < 0)
+		goto done;
+
+	for (i = 0; i < count; i++) {
+		lock = updates[i].payload;
+
+		if (actions[i] == BATCH_PACK || actions[i] == BATCH_DELETE) {
+			/* The loose file would shadow the packed value */
+			if (p_unlink(lock->path_original) < 0 && errno != ENOENT && !error) {
+				git_error_set(GIT_ERROR_OS, "failed to remove loose reference '%s'", lock->path_original);
+				error = -1;
+			}
+
+			git_filebuf_cleanup(lock);
+
+			if (actions[i] == BATCH_DELETE)
+				refdb_fs_backend__try_delete_empty_ref_hierarchie(backend, updates[i].ref->name, false);
+		} else if (actions[i] == BATCH_LOOSE && !error) {
+			error = refdb_fs_backend__write_tail(_backend, updates[i].ref, lock,
+				updates[i].update_reflog, updates[i].sig, updates[i].message, NULL, NULL);
+		}
+	}
+
+done:
+	for (i = 0; i < count; i++) {
+		lock = updates[i].payload;
+		git_filebuf_cleanup(lock);
+		git__free(lock);
+	}
+
+	reflog_batch_free(reflogs);
+	git__free(actions);
+	return error;
+}
+
 static void refdb_fs_backend__free(git_refdb_backend *_backend)
 {
 	refdb_fs_backend *backend = GIT_CONTAINER_OF(_backend, refdb_fs_backend, parent);
@@ -1530,6 +2395,8 @@ static void refdb_fs_backend__free(git_refdb_backend *_backend)
 	assert(backend);
 
 	git_sortedcache_free(backend->refcache);
+	packed_snapshot_release(backend->snapshot);
+	git_mutex_free(&backend->snapshot_lock);
 	git__free(backend->gitpath);
 	git__free(backend->commonpath);
 	git__free(backend);
@@ -1887,8 +2754,76 @@ success:
 	return error;
 }
 
-/* Append to the reflog, must be called under reference lock */
-static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *who, const char *message)
+/*
+ * Reflog entries of a batched update, collected per reflog file so
+ * that each file is opened (and synced) only once.
+ */
+typedef struct {
+	git_buf entries;
+	char path[GIT_FLEX_ARRAY];
+} reflog_batch_entry;
+
+static int reflog_batch_add(git_strmap *batch, const char *path, git_buf *entry)
+{
+	reflog_batch_entry *e;
+	size_t pathlen = strlen(path), alloclen;
+
+	if ((e = git_strmap_get(batch, path)) == NULL) {
+		GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, sizeof(reflog_batch_entry), pathlen);
+		GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
+
+		e = git__calloc(1, alloclen);
+		GIT_ERROR_CHECK_ALLOC(e);
+		memcpy(e->path, path, pathlen);
+
+		if (git_strmap_set(batch, e->path, e) < 0) {
+			git__free(e);
+			return -1;
+		}
+	}
+
+	return git_buf_put(&e->entries, entry->ptr, entry->size);
+}
+
+static int reflog_batch_write(refdb_fs_backend *backend, git_strmap *batch)
+{
+	reflog_batch_entry *e;
+	int error, open_flags;
+
+	open_flags = O_WRONLY | O_CREAT | O_APPEND;
+
+	if (backend->fsync)
+		open_flags |= O_FSYNC;
+
+	git_strmap_foreach_value(batch, e, {
+		if ((error = git_futils_writebuffer(&e->entries, e->path, open_flags, GIT_REFLOG_FILE_MODE)) < 0)
+			return error;
+	});
+
+	return 0;
+}
+
+static void reflog_batch_free(git_strmap *batch)
+{
+	reflog_batch_entry *e;
+
+	if (!batch)
+		return;
+
+	git_strmap_foreach_value(batch, e, {
+		git_buf_dispose(&e->entries);
+		git__free(e);
+	});
+
+	git_strmap_free(batch);
+}
+
+/*
+ * Append to the reflog, must be called under reference lock.  When a
+ * `batch` is given, the entry is only added to it and gets written
+ * by `reflog_batch_write`.
+ */
+static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, const git_oid *old, const git_oid *new, const git_signature *who, const char *message, git_strmap *batch)
 {
 	int error, is_symbolic, open_flags;
 	git_oid old_id = {{0}}, new_id = {{0}};
@@ -1958,6 +2893,11 @@ static int reflog_append(refdb_fs_backend *backend, const git_reference *ref, co
 			goto cleanup;
 	}
 
+	if (batch) {
+		error = reflog_batch_add(batch, git_buf_cstr(&path), &buf);
+		goto cleanup;
+	}
+
 	open_flags = O_WRONLY | O_CREAT | O_APPEND;
 
 	if (backend->fsync)
@@ -2091,6 +3031,11 @@ int git_refdb_backend_fs(
 
 	backend->repo = repository;
 
+	if (git_mutex_init(&backend->snapshot_lock) < 0) {
+		git__free(backend);
+		return -1;
+	}
+
 	if (repository->gitdir) {
 		backend->gitpath = setup_namespace(repository, repository->gitdir);
 
@@ -2124,6 +3069,8 @@ int git_refdb_backend_fs(
 	if ((!git_repository__cvar(&t, backend->repo, GIT_CVAR_FSYNCOBJECTFILES) && t) ||
 		git_repository__fsync_gitdir)
 		backend->fsync = 1;
+	if (!git_repository__cvar(&t, backend->repo, GIT_CVAR_MMAPPACKEDREFS) && t)
+		backend->packed_mmap = 1;
 	backend->iterator_flags |= GIT_ITERATOR_DESCEND_SYMLINKS;
 
 	backend->parent.exists = &refdb_fs_backend__exists;
@@ -2135,6 +3082,7 @@ int git_refdb_backend_fs(
 	backend->parent.compress = &refdb_fs_backend__compress;
 	backend->parent.lock = &refdb_fs_backend__lock;
 	backend->parent.unlock = &refdb_fs_backend__unlock;
+	backend->parent.unlock_many = &refdb_fs_backend__unlock_many;
 	backend->parent.has_log = &refdb_reflog_fs__has_log;
 	backend->parent.ensure_log = &refdb_reflog_fs__ensure_log;
 	backend->parent.free = &refdb_fs_backend__free;
@@ -2148,6 +3096,7 @@ int git_refdb_backend_fs(
 
 fail:
 	git_buf_dispose(&gitpath);
+	git_mutex_free(&backend->snapshot_lock);
 	git__free(backend->gitpath);
 	git__free(backend->commonpath);
 	git__free(backend);
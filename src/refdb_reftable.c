@@ -0,0 +1,1428 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "common.h"
+
+#include "refs.h"
+#include "reflog.h"
+#include "refdb.h"
+#include "reftable.h"
+#include "repository.h"
+#include "fnmatch.h"
+
+#include <git2/tag.h>
+#include <git2/object.h>
+#include <git2/sys/refdb_backend.h>
+#include <git2/sys/refs.h>
+#include <git2/sys/reflog.h>
+
+typedef struct {
+	git_reftable_log log;
+	/* assigned an update index when the batch is written */
+	bool fresh;
+} batch_log;
+
+typedef struct refdb_reftable_backend {
+	git_refdb_backend parent;
+
+	git_repository *repo;
+	git_reftable_stack *stack;
+	/* protects the stack's list of tables */
+	git_mutex lock;
+
+	/*
+	 * Updates are collected while the stack is locked and written
+	 * out as a single table: one per operation, or one for all the
+	 * references of a transaction.
+	 */
+	git_reftable_addition *addition;
+	size_t locked_refs;
+	git_vector refs;
+	git_vector logs;
+} refdb_reftable_backend;
+
+static int ref_error_notfound(const char *name)
+{
+	git_error_set(GIT_ERROR_REFERENCE, "reference '%s' not found", name);
+	return GIT_ENOTFOUND;
+}
+
+static int ref_error_locked(void)
+{
+	git_error_set(GIT_ERROR_REFERENCE,
+		"the reference database is locked by a transaction");
+	return GIT_ELOCKED;
+}
+
+static int backend_tables(git_vector *out, refdb_reftable_backend *backend)
+{
+	int error;
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	if ((error = git_reftable_stack_reload(backend->stack, false)) == 0)
+		error = git_reftable_stack_tables(out, backend->stack);
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+static int read_ref(git_reftable_ref *out, refdb_reftable_backend *backend, const char *name)
+{
+	git_vector tables = GIT_VECTOR_INIT;
+	int error;
+
+	if ((error = backend_tables(&tables, backend)) < 0)
+		return error;
+
+	error = git_reftable_tables_read_ref(out, &tables, name);
+
+	git_reftable_stack_tables_release(&tables);
+	return error;
+}
+
+static int read_logs(
+	git_vector *out,
+	refdb_reftable_backend *backend,
+	const char *name,
+	bool with_deletions)
+{
+	git_vector tables = GIT_VECTOR_INIT;
+	int error;
+
+	if ((error = backend_tables(&tables, backend)) < 0)
+		return error;
+
+	error = git_reftable_tables_read_logs(out, &tables, name, with_deletions);
+
+	git_reftable_stack_tables_release(&tables);
+	return error;
+}
+
+static int ref_from_record(git_reference **out, const git_reftable_ref *record)
+{
+	switch (record->type) {
+	case GIT_REFTABLE_REF_VAL1:
+		*out = git_reference__alloc(record->name.ptr, &record->value, NULL);
+		break;
+	case GIT_REFTABLE_REF_VAL2:
+		*out = git_reference__alloc(record->name.ptr, &record->value, &record->peeled);
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		*out = git_reference__alloc_symbolic(record->name.ptr, record->target.ptr);
+		break;
+	default:
+		return ref_error_notfound(record->name.ptr);
+	}
+
+	GIT_ERROR_CHECK_ALLOC(*out);
+	return 0;
+}
+
+static int refdb_reftable_backend__exists(
+	int *exists,
+	git_refdb_backend *_backend,
+	const char *ref_name)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_reftable_ref record = GIT_REFTABLE_REF_INIT;
+	int error;
+
+	assert(backend);
+
+	*exists = 0;
+
+	if ((error = read_ref(&record, backend, ref_name)) == 0)
+		*exists = 1;
+	else if (error == GIT_ENOTFOUND)
+		error = 0;
+
+	git_reftable_ref_dispose(&record);
+	return error;
+}
+
+static int refdb_reftable_backend__lookup(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *ref_name)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_reftable_ref record = GIT_REFTABLE_REF_INIT;
+	int error;
+
+	assert(backend);
+
+	if ((error = read_ref(&record, backend, ref_name)) == 0)
+		error = ref_from_record(out, &record);
+	else if (error == GIT_ENOTFOUND)
+		error = ref_error_notfound(ref_name);
+
+	git_reftable_ref_dispose(&record);
+	return error;
+}
+
+typedef struct {
+	git_reference_iterator parent;
+
+	char *glob;
+	git_buf prefix;
+	git_reftable_merged_iter *iter;
+} refdb_reftable_iter;
+
+static void refdb_reftable_backend__iterator_free(git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = GIT_CONTAINER_OF(_iter, refdb_reftable_iter, parent);
+
+	git_reftable_merged_iter_free(iter->iter);
+	git_buf_dispose(&iter->prefix);
+	git__free(iter->glob);
+	git__free(iter);
+}
+
+static int iter_next_record(git_reftable_ref **out, refdb_reftable_iter *iter)
+{
+	git_reftable_ref *record;
+	int error;
+
+	while ((error = git_reftable_merged_iter_next(&record, iter->iter)) == 0) {
+		/* The records are sorted, so we are done once we leave the prefix */
+		if (git__prefixcmp(record->name.ptr, iter->prefix.ptr))
+			return GIT_ITEROVER;
+
+		if (git__prefixcmp(record->name.ptr, GIT_REFS_DIR) ||
+		    (iter->glob && p_fnmatch(iter->glob, record->name.ptr, 0) != 0))
+			continue;
+
+		*out = record;
+		return 0;
+	}
+
+	return error;
+}
+
+static int refdb_reftable_backend__iterator_next(
+	git_reference **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = GIT_CONTAINER_OF(_iter, refdb_reftable_iter, parent);
+	git_reftable_ref *record;
+	int error;
+
+	if ((error = iter_next_record(&record, iter)) < 0)
+		return error;
+
+	return ref_from_record(out, record);
+}
+
+static int refdb_reftable_backend__iterator_next_name(
+	const char **out, git_reference_iterator *_iter)
+{
+	refdb_reftable_iter *iter = GIT_CONTAINER_OF(_iter, refdb_reftable_iter, parent);
+	git_reftable_ref *record;
+	int error;
+
+	if ((error = iter_next_record(&record, iter)) < 0)
+		return error;
+
+	*out = record->name.ptr;
+	return 0;
+}
+
+static int refdb_reftable_backend__iterator(
+	git_reference_iterator **out, git_refdb_backend *_backend, const char *glob)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_vector tables = GIT_VECTOR_INIT;
+	refdb_reftable_iter *iter;
+	size_t prefix_len;
+	int error;
+
+	assert(backend);
+
+	iter = git__calloc(1, sizeof(refdb_reftable_iter));
+	GIT_ERROR_CHECK_ALLOC(iter);
+
+	/* Only the literal part of the glob can be searched for */
+	prefix_len = glob ? strcspn(glob, "?*[\\") : 0;
+
+	if (prefix_len < strlen(GIT_REFS_DIR) || git__prefixcmp(glob, GIT_REFS_DIR))
+		error = git_buf_puts(&iter->prefix, GIT_REFS_DIR);
+	else
+		error = git_buf_put(&iter->prefix, glob, prefix_len);
+
+	if (error < 0 ||
+	    (glob && (iter->glob = git__strdup(glob)) == NULL) ||
+	    (error = backend_tables(&tables, backend)) < 0 ||
+	    (error = git_reftable_merged_iter_new(&iter->iter, &tables, iter->prefix.ptr, false)) < 0) {
+		git_reftable_stack_tables_release(&tables);
+		refdb_reftable_backend__iterator_free(&iter->parent);
+		return error < 0 ? error : -1;
+	}
+
+	git_reftable_stack_tables_release(&tables);
+
+	iter->parent.next = refdb_reftable_backend__iterator_next;
+	iter->parent.next_name = refdb_reftable_backend__iterator_next_name;
+	iter->parent.free = refdb_reftable_backend__iterator_free;
+
+	*out = &iter->parent;
+	return 0;
+}
+
+/*
+ * Collecting updates
+ */
+
+static void batch_clear(refdb_reftable_backend *backend)
+{
+	git_reftable_ref *ref;
+	batch_log *entry;
+	size_t i;
+
+	git_vector_foreach(&backend->refs, i, ref) {
+		git_reftable_ref_dispose(ref);
+		git__free(ref);
+	}
+
+	git_vector_foreach(&backend->logs, i, entry) {
+		git_reftable_log_dispose(&entry->log);
+		git__free(entry);
+	}
+
+	git_vector_clear(&backend->refs);
+	git_vector_clear(&backend->logs);
+}
+
+static int batch_begin(refdb_reftable_backend *backend)
+{
+	int error;
+
+	assert(!backend->addition);
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	error = git_reftable_addition_new(&backend->addition, backend->stack);
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+static int batch_ref_cmp(const void *a_, const void *b_)
+{
+	const git_reftable_ref *a = a_, *b = b_;
+	return strcmp(a->name.ptr, b->name.ptr);
+}
+
+static int batch_log_cmp(const void *a_, const void *b_)
+{
+	const batch_log *a = a_, *b = b_;
+	int cmp;
+
+	if ((cmp = strcmp(a->log.name.ptr, b->log.name.ptr)) != 0)
+		return cmp;
+
+	if (a->fresh != b->fresh)
+		return a->fresh ? -1 : 1;
+
+	if (a->fresh)
+		return 0;
+
+	return (a->log.update_index < b->log.update_index) -
+		(a->log.update_index > b->log.update_index);
+}
+
+static int batch_write(git_buf *out, refdb_reftable_backend *backend)
+{
+	git_reftable_writer *writer = NULL;
+	git_reftable_ref *ref, *next_ref;
+	batch_log *entry, *next_log;
+	uint64_t update_index, max_update_index;
+	size_t i, j, run;
+	int error;
+
+	update_index = max_update_index =
+		git_reftable_stack_next_update_index(backend->stack);
+
+	/* Give new log entries increasing indexes, in the order they were made */
+	git_vector_sort(&backend->logs);
+
+	for (i = 0; i < backend->logs.length; i += run) {
+		entry = git_vector_get(&backend->logs, i);
+
+		for (run = 1; i + run < backend->logs.length; run++) {
+			next_log = git_vector_get(&backend->logs, i + run);
+
+			if (!next_log->fresh || strcmp(next_log->log.name.ptr, entry->log.name.ptr))
+				break;
+		}
+
+		if (!entry->fresh)
+			continue;
+
+		for (j = 0; j < run; j++) {
+			next_log = git_vector_get(&backend->logs, i + j);
+			next_log->log.update_index = update_index + j;
+			next_log->fresh = false;
+		}
+
+		if (update_index + run - 1 > max_update_index)
+			max_update_index = update_index + run - 1;
+	}
+
+	git_vector_set_sorted(&backend->logs, 0);
+	git_vector_sort(&backend->refs);
+	git_vector_sort(&backend->logs);
+
+	if ((error = git_reftable_writer_new(&writer, update_index, max_update_index)) < 0)
+		goto done;
+
+	/* The last update of a reference wins */
+	git_vector_foreach(&backend->refs, i, ref) {
+		next_ref = git_vector_get(&backend->refs, i + 1);
+
+		if (next_ref && !strcmp(next_ref->name.ptr, ref->name.ptr))
+			continue;
+
+		ref->update_index = update_index;
+
+		if ((error = git_reftable_writer_add_ref(writer, ref)) < 0)
+			goto done;
+	}
+
+	git_vector_foreach(&backend->logs, i, entry) {
+		next_log = git_vector_get(&backend->logs, i + 1);
+
+		if (next_log && !strcmp(next_log->log.name.ptr, entry->log.name.ptr) &&
+		    next_log->log.update_index == entry->log.update_index)
+			continue;
+
+		if ((error = git_reftable_writer_add_log(writer, &entry->log)) < 0)
+			goto done;
+	}
+
+	error = git_reftable_writer_finish(out, writer);
+
+done:
+	git_reftable_writer_free(writer);
+	return error;
+}
+
+static int batch_finish(refdb_reftable_backend *backend, int error)
+{
+	git_buf table = GIT_BUF_INIT;
+
+	if (!error && (backend->refs.length || backend->logs.length)) {
+		if ((error = batch_write(&table, backend)) == 0) {
+			if (git_mutex_lock(&backend->lock) < 0) {
+				git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+				error = -1;
+			} else {
+				error = git_reftable_addition_commit(backend->addition, &table);
+				git_mutex_unlock(&backend->lock);
+			}
+		}
+	}
+
+	git_reftable_addition_free(backend->addition);
+	backend->addition = NULL;
+	batch_clear(backend);
+	git_buf_dispose(&table);
+
+	return error;
+}
+
+static int batch_add_ref(
+	refdb_reftable_backend *backend,
+	const char *name,
+	const git_reference *ref)
+{
+	git_reftable_ref *record;
+	git_object *target = NULL, *peeled = NULL;
+
+	record = git__calloc(1, sizeof(git_reftable_ref));
+	GIT_ERROR_CHECK_ALLOC(record);
+
+	git_buf_puts(&record->name, name);
+
+	if (!ref) {
+		record->type = GIT_REFTABLE_REF_DELETION;
+	} else if (ref->type == GIT_REFERENCE_SYMBOLIC) {
+		record->type = GIT_REFTABLE_REF_SYMREF;
+		git_buf_puts(&record->target, ref->target.symbolic);
+	} else {
+		record->type = GIT_REFTABLE_REF_VAL1;
+		git_oid_cpy(&record->value, &ref->target.oid);
+
+		/* Store what tags point to, the way packed refs do */
+		if (git_object_lookup(&target, backend->repo, &ref->target.oid, GIT_OBJECT_ANY) == 0 &&
+		    git_object_type(target) == GIT_OBJECT_TAG &&
+		    git_tag_peel(&peeled, (git_tag *)target) == 0) {
+			record->type = GIT_REFTABLE_REF_VAL2;
+			git_oid_cpy(&record->peeled, git_object_id(peeled));
+		}
+
+		git_error_clear();
+		git_object_free(peeled);
+		git_object_free(target);
+	}
+
+	if (git_buf_oom(&record->name) || git_buf_oom(&record->target) ||
+	    git_vector_insert(&backend->refs, record) < 0) {
+		git_reftable_ref_dispose(record);
+		git__free(record);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int batch_add_log(
+	refdb_reftable_backend *backend,
+	const char *name,
+	const git_reftable_log *log,
+	bool fresh)
+{
+	batch_log *entry;
+
+	entry = git__calloc(1, sizeof(batch_log));
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	entry->fresh = fresh;
+	entry->log.type = log->type;
+	entry->log.update_index = log->update_index;
+	git_oid_cpy(&entry->log.old_id, &log->old_id);
+	git_oid_cpy(&entry->log.new_id, &log->new_id);
+	entry->log.time = log->time;
+	entry->log.tz_offset = log->tz_offset;
+
+	git_buf_puts(&entry->log.name, name);
+	git_buf_set(&entry->log.committer_name, log->committer_name.ptr, log->committer_name.size);
+	git_buf_set(&entry->log.committer_email, log->committer_email.ptr, log->committer_email.size);
+	git_buf_set(&entry->log.message, log->message.ptr, log->message.size);
+
+	if (git_buf_oom(&entry->log.name) || git_buf_oom(&entry->log.committer_name) ||
+	    git_buf_oom(&entry->log.committer_email) || git_buf_oom(&entry->log.message) ||
+	    git_vector_insert(&backend->logs, entry) < 0) {
+		git_reftable_log_dispose(&entry->log);
+		git__free(entry);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int batch_add_entry(
+	refdb_reftable_backend *backend,
+	const char *name,
+	const git_oid *old_id,
+	const git_oid *new_id,
+	const git_signature *who,
+	const char *message)
+{
+	git_reftable_log log = GIT_REFTABLE_LOG_INIT;
+	int error;
+
+	log.type = GIT_REFTABLE_LOG_UPDATE;
+	git_oid_cpy(&log.old_id, old_id);
+	git_oid_cpy(&log.new_id, new_id);
+
+	if (who) {
+		git_buf_puts(&log.committer_name, who->name);
+		git_buf_puts(&log.committer_email, who->email);
+		log.time = (uint64_t)who->when.time;
+		log.tz_offset = (int16_t)who->when.offset;
+	}
+
+	/* Messages end with a newline, like they do in git's reftables */
+	if (message && *message) {
+		git_buf_puts(&log.message, message);
+		git_buf_rtrim(&log.message);
+		git_buf_putc(&log.message, '\n');
+	}
+
+	error = batch_add_log(backend, name, &log, true);
+
+	git_reftable_log_dispose(&log);
+	return error;
+}
+
+/*
+ * Hide every log entry of `name`, as of the start of the update,
+ * copying them over to `new_name` if given.
+ */
+static int batch_delete_logs(
+	refdb_reftable_backend *backend,
+	const char *name,
+	const char *new_name)
+{
+	git_vector logs = GIT_VECTOR_INIT;
+	git_reftable_log *log;
+	size_t i;
+	int error;
+
+	if ((error = read_logs(&logs, backend, name, false)) < 0)
+		return error;
+
+	git_vector_foreach(&logs, i, log) {
+		git_reftable_log deletion = GIT_REFTABLE_LOG_INIT;
+
+		deletion.type = GIT_REFTABLE_LOG_DELETION;
+		deletion.update_index = log->update_index;
+
+		if ((error = batch_add_log(backend, name, &deletion, false)) < 0)
+			break;
+
+		if (new_name && (error = batch_add_log(backend, new_name, log, false)) < 0)
+			break;
+	}
+
+	git_reftable_logs_free(&logs);
+	return error;
+}
+
+/*
+ * Reference updates, with the same semantics as the filesystem backend
+ */
+
+static int has_reflog(refdb_reftable_backend *backend, const char *name)
+{
+	git_vector logs = GIT_VECTOR_INIT;
+	int exists;
+
+	if (read_logs(&logs, backend, name, false) < 0) {
+		git_error_clear();
+		return 0;
+	}
+
+	exists = logs.length > 0;
+	git_reftable_logs_free(&logs);
+
+	return exists;
+}
+
+static int should_write_reflog(int *write, refdb_reftable_backend *backend, const char *name)
+{
+	int error, logall;
+
+	error = git_repository__cvar(&logall, backend->repo, GIT_CVAR_LOGALLREFUPDATES);
+	if (error < 0)
+		return error;
+
+	/* Defaults to the opposite of the repo being bare */
+	if (logall == GIT_LOGALLREFUPDATES_UNSET)
+		logall = !git_repository_is_bare(backend->repo);
+
+	switch (logall) {
+	case GIT_LOGALLREFUPDATES_FALSE:
+		*write = 0;
+		break;
+
+	case GIT_LOGALLREFUPDATES_TRUE:
+		*write = has_reflog(backend, name) ||
+			!git__prefixcmp(name, GIT_REFS_HEADS_DIR) ||
+			!git__strcmp(name, GIT_HEAD_FILE) ||
+			!git__prefixcmp(name, GIT_REFS_REMOTES_DIR) ||
+			!git__prefixcmp(name, GIT_REFS_NOTES_DIR);
+		break;
+
+	default:
+		*write = 1;
+		break;
+	}
+
+	return 0;
+}
+
+static int cmp_old_ref(
+	int *cmp,
+	refdb_reftable_backend *backend,
+	const char *name,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	git_reftable_ref record = GIT_REFTABLE_REF_INIT;
+	int error;
+
+	*cmp = 0;
+
+	/* It "matches" if there is no old value to compare against */
+	if (!old_id && !old_target)
+		return 0;
+
+	if ((error = read_ref(&record, backend, name)) < 0) {
+		if (error == GIT_ENOTFOUND)
+			ref_error_notfound(name);
+		goto out;
+	}
+
+	if (old_id)
+		*cmp = record.type == GIT_REFTABLE_REF_SYMREF ? -1 :
+			git_oid_cmp(old_id, &record.value);
+	else
+		*cmp = record.type != GIT_REFTABLE_REF_SYMREF ? 1 :
+			git__strcmp(old_target, record.target.ptr);
+
+out:
+	git_reftable_ref_dispose(&record);
+	return error;
+}
+
+/* Queue a reflog entry, like `reflog_append` in the filesystem backend */
+static int reflog_append(
+	refdb_reftable_backend *backend,
+	const git_reference *ref,
+	const git_oid *old,
+	const git_oid *new,
+	const git_signature *who,
+	const char *message)
+{
+	git_oid old_id = {{0}}, new_id = {{0}};
+	int error, is_symbolic;
+
+	is_symbolic = ref->type == GIT_REFERENCE_SYMBOLIC;
+
+	/* "normal" symbolic updates do not write */
+	if (is_symbolic && strcmp(ref->name, GIT_HEAD_FILE) && !(old && new))
+		return 0;
+
+	if (old) {
+		git_oid_cpy(&old_id, old);
+	} else {
+		error = git_reference_name_to_id(&old_id, backend->repo, ref->name);
+		if (error < 0 && error != GIT_ENOTFOUND)
+			return error;
+	}
+
+	if (new) {
+		git_oid_cpy(&new_id, new);
+	} else if (!is_symbolic) {
+		git_oid_cpy(&new_id, git_reference_target(ref));
+	} else {
+		error = git_reference_name_to_id(&new_id, backend->repo, git_reference_symbolic_target(ref));
+		if (error < 0 && error != GIT_ENOTFOUND)
+			return error;
+		/* detaching HEAD does not create an entry */
+		if (error == GIT_ENOTFOUND)
+			return 0;
+
+		git_error_clear();
+	}
+
+	return batch_add_entry(backend, ref->name, &old_id, &new_id, who, message);
+}
+
+/* Log updates of the branch HEAD points to in HEAD's reflog too */
+static int maybe_append_head(
+	refdb_reftable_backend *backend,
+	const git_reference *ref,
+	const git_signature *who,
+	const char *message)
+{
+	git_reference *tmp = NULL, *head = NULL, *peeled = NULL;
+	git_oid old_id;
+	const char *name;
+	int error;
+
+	if (ref->type == GIT_REFERENCE_SYMBOLIC)
+		return 0;
+
+	/* if we can't resolve, we use {0}*40 as old id */
+	if (git_reference_name_to_id(&old_id, backend->repo, ref->name) < 0)
+		memset(&old_id, 0, sizeof(old_id));
+
+	/* There is no HEAD until one is written to the stack */
+	if ((error = git_reference_lookup(&head, backend->repo, GIT_HEAD_FILE)) == GIT_ENOTFOUND) {
+		git_error_clear();
+		return 0;
+	} else if (error < 0) {
+		return error;
+	}
+
+	if (git_reference_type(head) == GIT_REFERENCE_DIRECT)
+		goto cleanup;
+
+	if ((error = git_reference_lookup(&tmp, backend->repo, GIT_HEAD_FILE)) < 0)
+		goto cleanup;
+
+	/* Go down the symref chain until we find the branch */
+	while (git_reference_type(tmp) == GIT_REFERENCE_SYMBOLIC) {
+		error = git_reference_lookup(&peeled, backend->repo, git_reference_symbolic_target(tmp));
+		if (error < 0)
+			break;
+
+		git_reference_free(tmp);
+		tmp = peeled;
+	}
+
+	if (error == GIT_ENOTFOUND) {
+		error = 0;
+		name = git_reference_symbolic_target(tmp);
+	} else if (error < 0) {
+		goto cleanup;
+	} else {
+		name = git_reference_name(tmp);
+	}
+
+	if (strcmp(name, ref->name))
+		goto cleanup;
+
+	error = reflog_append(backend, head, &old_id, git_reference_target(ref), who, message);
+
+cleanup:
+	git_reference_free(tmp);
+	git_reference_free(head);
+	return error;
+}
+
+/*
+ * Check that no reference other than `old_ref` is a directory of
+ * `new_ref` or lives in a directory named `new_ref`.
+ */
+static int reference_path_available(
+	refdb_reftable_backend *backend,
+	const char *new_ref,
+	const char *old_ref,
+	int force)
+{
+	git_reftable_merged_iter *iter = NULL;
+	git_reftable_ref record = GIT_REFTABLE_REF_INIT, *child;
+	git_vector tables = GIT_VECTOR_INIT;
+	git_buf dir = GIT_BUF_INIT;
+	const char *slash;
+	int error;
+
+	if ((error = backend_tables(&tables, backend)) < 0)
+		return error;
+
+	if (!force) {
+		if ((error = git_reftable_tables_read_ref(&record, &tables, new_ref)) == 0) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"failed to write reference '%s': a reference with "
+				"that name already exists.", new_ref);
+			error = GIT_EEXISTS;
+			goto done;
+		} else if (error != GIT_ENOTFOUND) {
+			goto done;
+		}
+	}
+
+	for (slash = strchr(new_ref, '/'); slash; slash = strchr(slash + 1, '/')) {
+		git_buf_clear(&dir);
+
+		if ((error = git_buf_put(&dir, new_ref, slash - new_ref)) < 0)
+			goto done;
+
+		if ((error = git_reftable_tables_read_ref(&record, &tables, dir.ptr)) == 0 &&
+		    (!old_ref || strcmp(old_ref, dir.ptr)))
+			goto collides;
+		else if (error < 0 && error != GIT_ENOTFOUND)
+			goto done;
+	}
+
+	git_buf_clear(&dir);
+
+	if ((error = git_buf_printf(&dir, "%s/", new_ref)) < 0 ||
+	    (error = git_reftable_merged_iter_new(&iter, &tables, dir.ptr, false)) < 0)
+		goto done;
+
+	while ((error = git_reftable_merged_iter_next(&child, iter)) == 0) {
+		if (git__prefixcmp(child->name.ptr, dir.ptr))
+			break;
+
+		if (!old_ref || strcmp(old_ref, child->name.ptr))
+			goto collides;
+	}
+
+	error = (error == GIT_ITEROVER) ? 0 : error;
+	goto done;
+
+collides:
+	git_error_set(GIT_ERROR_REFERENCE,
+		"path to reference '%s' collides with existing one", new_ref);
+	error = -1;
+
+done:
+	git_reftable_merged_iter_free(iter);
+	git_reftable_stack_tables_release(&tables);
+	git_reftable_ref_dispose(&record);
+	git_buf_dispose(&dir);
+	return error;
+}
+
+static int queue_write(
+	refdb_reftable_backend *backend,
+	const git_reference *ref,
+	int update_reflog,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	const git_oid *new_id = NULL;
+	const char *new_target = NULL;
+	int error, cmp, should_write;
+
+	if ((error = cmp_old_ref(&cmp, backend, ref->name, old_id, old_target)) < 0)
+		return error;
+
+	if (cmp) {
+		git_error_set(GIT_ERROR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	if (ref->type == GIT_REFERENCE_SYMBOLIC)
+		new_target = ref->target.symbolic;
+	else
+		new_id = &ref->target.oid;
+
+	error = cmp_old_ref(&cmp, backend, ref->name, new_id, new_target);
+	if (error < 0 && error != GIT_ENOTFOUND)
+		return error;
+
+	/* Don't update if we have the same value */
+	if (!error && !cmp)
+		return 0;
+
+	git_error_clear();
+
+	if (update_reflog) {
+		if ((error = should_write_reflog(&should_write, backend, ref->name)) < 0)
+			return error;
+
+		if (should_write &&
+		    ((error = reflog_append(backend, ref, NULL, NULL, who, message)) < 0 ||
+		     (error = maybe_append_head(backend, ref, who, message)) < 0))
+			return error;
+	}
+
+	return batch_add_ref(backend, ref->name, ref);
+}
+
+static int queue_delete(
+	refdb_reftable_backend *backend,
+	const char *ref_name,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	git_reftable_ref record = GIT_REFTABLE_REF_INIT;
+	int error, cmp;
+
+	if ((error = cmp_old_ref(&cmp, backend, ref_name, old_id, old_target)) < 0)
+		return error;
+
+	if (cmp) {
+		git_error_set(GIT_ERROR_REFERENCE, "old reference value does not match");
+		return GIT_EMODIFIED;
+	}
+
+	if ((error = read_ref(&record, backend, ref_name)) < 0) {
+		git_reftable_ref_dispose(&record);
+		return error == GIT_ENOTFOUND ? ref_error_notfound(ref_name) : error;
+	}
+
+	git_reftable_ref_dispose(&record);
+
+	if ((error = batch_delete_logs(backend, ref_name, NULL)) < 0)
+		return error;
+
+	return batch_add_ref(backend, ref_name, NULL);
+}
+
+static int refdb_reftable_backend__write(
+	git_refdb_backend *_backend,
+	const git_reference *ref,
+	int force,
+	const git_signature *who,
+	const char *message,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	int error;
+
+	assert(backend);
+
+	if (backend->addition)
+		return ref_error_locked();
+
+	if ((error = batch_begin(backend)) < 0)
+		return error;
+
+	if ((error = reference_path_available(backend, ref->name, NULL, force)) == 0)
+		error = queue_write(backend, ref, true, who, message, old_id, old_target);
+
+	return batch_finish(backend, error);
+}
+
+static int refdb_reftable_backend__delete(
+	git_refdb_backend *_backend,
+	const char *ref_name,
+	const git_oid *old_id,
+	const char *old_target)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	int error;
+
+	assert(backend && ref_name);
+
+	if (backend->addition)
+		return ref_error_locked();
+
+	if ((error = batch_begin(backend)) < 0)
+		return error;
+
+	error = queue_delete(backend, ref_name, old_id, old_target);
+
+	return batch_finish(backend, error);
+}
+
+static int refdb_reftable_backend__rename(
+	git_reference **out,
+	git_refdb_backend *_backend,
+	const char *old_name,
+	const char *new_name,
+	int force,
+	const git_signature *who,
+	const char *message)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_reference *old = NULL, *new = NULL;
+	int error;
+
+	assert(backend);
+
+	if (backend->addition)
+		return ref_error_locked();
+
+	if ((error = batch_begin(backend)) < 0)
+		return error;
+
+	if ((error = reference_path_available(backend, new_name, old_name, force)) < 0 ||
+	    (error = refdb_reftable_backend__lookup(&old, _backend, old_name)) < 0)
+		goto done;
+
+	if ((new = git_reference__set_name(old, new_name)) == NULL) {
+		error = -1;
+		goto done;
+	}
+
+	old = NULL;
+
+	/* The new name's log is replaced by the old one's */
+	if ((error = batch_delete_logs(backend, new_name, NULL)) == 0 &&
+	    (error = batch_delete_logs(backend, old_name, new_name)) == 0 &&
+	    (error = batch_add_ref(backend, old_name, NULL)) == 0 &&
+	    (error = batch_add_ref(backend, new_name, new)) == 0)
+		error = reflog_append(backend, new, git_reference_target(new), NULL, who, message);
+
+done:
+	git_reference_free(old);
+
+	if ((error = batch_finish(backend, error)) < 0 || !out) {
+		git_reference_free(new);
+		return error;
+	}
+
+	*out = new;
+	return 0;
+}
+
+static int refdb_reftable_backend__compress(git_refdb_backend *_backend)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	int error;
+
+	assert(backend);
+
+	if (backend->addition)
+		return ref_error_locked();
+
+	if (git_mutex_lock(&backend->lock) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to lock reftable stack");
+		return -1;
+	}
+
+	error = git_reftable_stack_compact_all(backend->stack);
+
+	git_mutex_unlock(&backend->lock);
+	return error;
+}
+
+/*
+ * Transactions lock the whole stack on their first reference and
+ * write every update in a single table once the last one is unlocked.
+ */
+static int refdb_reftable_backend__lock(void **out, git_refdb_backend *_backend, const char *refname)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	char *name;
+	int error;
+
+	assert(backend);
+
+	name = git__strdup(refname);
+	GIT_ERROR_CHECK_ALLOC(name);
+
+	if (!backend->addition && (error = batch_begin(backend)) < 0) {
+		git__free(name);
+		return error;
+	}
+
+	backend->locked_refs++;
+
+	*out = name;
+	return 0;
+}
+
+static int refdb_reftable_backend__unlock(
+	git_refdb_backend *_backend,
+	void *payload,
+	int success,
+	int update_reflog,
+	const git_reference *ref,
+	const git_signature *sig,
+	const char *message)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	char *name = payload;
+	int error = 0;
+
+	assert(backend && backend->addition && backend->locked_refs);
+
+	if (success == 2)
+		error = queue_delete(backend, name, NULL, NULL);
+	else if (success && (error = reference_path_available(backend, ref->name, NULL, true)) == 0)
+		error = queue_write(backend, ref, update_reflog, sig, message, NULL, NULL);
+
+	git__free(name);
+
+	if (--backend->locked_refs == 0)
+		return batch_finish(backend, 0) < 0 && !error ? -1 : error;
+
+	return error;
+}
+
+static void refdb_reftable_backend__free(git_refdb_backend *_backend)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+
+	if (!backend)
+		return;
+
+	if (backend->addition)
+		batch_finish(backend, -1);
+
+	git_reftable_stack_free(backend->stack);
+	git_vector_free(&backend->refs);
+	git_vector_free(&backend->logs);
+	git_mutex_free(&backend->lock);
+	git__free(backend);
+}
+
+/*
+ * Reflogs
+ */
+
+static int reflog_alloc(git_reflog **reflog, const char *name)
+{
+	git_reflog *log;
+
+	*reflog = NULL;
+
+	log = git__calloc(1, sizeof(git_reflog));
+	GIT_ERROR_CHECK_ALLOC(log);
+
+	log->ref_name = git__strdup(name);
+	GIT_ERROR_CHECK_ALLOC(log->ref_name);
+
+	if (git_vector_init(&log->entries, 0, NULL) < 0) {
+		git__free(log->ref_name);
+		git__free(log);
+		return -1;
+	}
+
+	*reflog = log;
+
+	return 0;
+}
+
+/* `ensure_log` records an entry with null ids to mark an empty log */
+GIT_INLINE(bool) is_log_marker(const git_reftable_log *log)
+{
+	return git_oid_iszero(&log->old_id) && git_oid_iszero(&log->new_id);
+}
+
+static int reflog_entry_from_log(git_reflog_entry **out, const git_reftable_log *log)
+{
+	git_reflog_entry *entry;
+	git_signature *committer;
+	size_t msg_len = log->message.size;
+
+	entry = git__calloc(1, sizeof(git_reflog_entry));
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	git_oid_cpy(&entry->oid_old, &log->old_id);
+	git_oid_cpy(&entry->oid_cur, &log->new_id);
+
+	if ((entry->committer = committer = git__calloc(1, sizeof(git_signature))) == NULL ||
+	    (committer->name = git__strndup(log->committer_name.ptr, log->committer_name.size)) == NULL ||
+	    (committer->email = git__strndup(log->committer_email.ptr, log->committer_email.size)) == NULL)
+		goto oom;
+
+	committer->when.time = (git_time_t)log->time;
+	committer->when.offset = log->tz_offset;
+	committer->when.sign = log->tz_offset < 0 ? '-' : '+';
+
+	if (msg_len && log->message.ptr[msg_len - 1] == '\n')
+		msg_len--;
+
+	if (msg_len && (entry->msg = git__strndup(log->message.ptr, msg_len)) == NULL)
+		goto oom;
+
+	*out = entry;
+	return 0;
+
+oom:
+	git_reflog_entry__free(entry);
+	git_error_set_oom();
+	return -1;
+}
+
+static int refdb_reftable_reflog__read(git_reflog **out, git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_vector logs = GIT_VECTOR_INIT;
+	git_reftable_log *log;
+	git_reflog_entry *entry;
+	git_reflog *reflog = NULL;
+	size_t i;
+	int error;
+
+	assert(out && backend && name);
+
+	if ((error = reflog_alloc(&reflog, name)) < 0 ||
+	    (error = read_logs(&logs, backend, name, false)) < 0)
+		goto done;
+
+	/* The log records are newest first, the reflog is oldest first */
+	for (i = logs.length; i > 0; i--) {
+		log = git_vector_get(&logs, i - 1);
+
+		if (is_log_marker(log))
+			continue;
+
+		if ((error = reflog_entry_from_log(&entry, log)) < 0)
+			goto done;
+
+		if ((error = git_vector_insert(&reflog->entries, entry)) < 0) {
+			git_reflog_entry__free(entry);
+			goto done;
+		}
+	}
+
+	*out = reflog;
+	reflog = NULL;
+
+done:
+	git_reflog_free(reflog);
+	git_reftable_logs_free(&logs);
+	return error;
+}
+
+static int refdb_reftable_reflog__has_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+
+	assert(backend && name);
+
+	return has_reflog(backend, name);
+}
+
+/*
+ * The reflog operations below can be part of a transaction, in which
+ * case they are written along with the references.
+ */
+static int reflog_begin(bool *owned, refdb_reftable_backend *backend)
+{
+	*owned = !backend->addition;
+
+	return *owned ? batch_begin(backend) : 0;
+}
+
+static int reflog_finish(refdb_reftable_backend *backend, bool owned, int error)
+{
+	return owned ? batch_finish(backend, error) : error;
+}
+
+static int refdb_reftable_reflog__ensure_log(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_oid zero = {{0}};
+	bool owned;
+	int error;
+
+	assert(backend && name);
+
+	if (has_reflog(backend, name))
+		return 0;
+
+	if ((error = reflog_begin(&owned, backend)) < 0)
+		return error;
+
+	error = batch_add_entry(backend, name, &zero, &zero, NULL, NULL);
+
+	return reflog_finish(backend, owned, error);
+}
+
+static int refdb_reftable_reflog__write(git_refdb_backend *_backend, git_reflog *reflog)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_reflog_entry *entry;
+	git_oid zero = {{0}};
+	bool owned;
+	size_t i;
+	int error;
+
+	assert(backend && reflog);
+
+	if ((error = reflog_begin(&owned, backend)) < 0)
+		return error;
+
+	if ((error = batch_delete_logs(backend, reflog->ref_name, NULL)) < 0)
+		goto done;
+
+	git_vector_foreach(&reflog->entries, i, entry) {
+		if ((error = batch_add_entry(backend, reflog->ref_name,
+				&entry->oid_old, &entry->oid_cur, entry->committer, entry->msg)) < 0)
+			goto done;
+	}
+
+	/* An emptied reflog still exists */
+	if (!reflog->entries.length)
+		error = batch_add_entry(backend, reflog->ref_name, &zero, &zero, NULL, NULL);
+
+done:
+	return reflog_finish(backend, owned, error);
+}
+
+static int refdb_reftable_reflog__rename(git_refdb_backend *_backend, const char *old_name, const char *new_name)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	git_buf normalized = GIT_BUF_INIT;
+	bool owned;
+	int error;
+
+	assert(backend && old_name && new_name);
+
+	if ((error = git_reference__normalize_name(
+		&normalized, new_name, GIT_REFERENCE_FORMAT_ALLOW_ONELEVEL)) < 0)
+		return error;
+
+	if (!has_reflog(backend, old_name)) {
+		git_buf_dispose(&normalized);
+		return GIT_ENOTFOUND;
+	}
+
+	if ((error = reflog_begin(&owned, backend)) < 0)
+		goto done;
+
+	if ((error = batch_delete_logs(backend, normalized.ptr, NULL)) == 0)
+		error = batch_delete_logs(backend, old_name, normalized.ptr);
+
+	error = reflog_finish(backend, owned, error);
+
+done:
+	git_buf_dispose(&normalized);
+	return error;
+}
+
+static int refdb_reftable_reflog__delete(git_refdb_backend *_backend, const char *name)
+{
+	refdb_reftable_backend *backend = GIT_CONTAINER_OF(_backend, refdb_reftable_backend, parent);
+	bool owned;
+	int error;
+
+	assert(backend && name);
+
+	if ((error = reflog_begin(&owned, backend)) < 0)
+		return error;
+
+	error = batch_delete_logs(backend, name, NULL);
+
+	return reflog_finish(backend, owned, error);
+}
+
+int git_refdb_backend_reftable(
+	git_refdb_backend **backend_out,
+	git_repository *repository)
+{
+	refdb_reftable_backend *backend;
+	git_buf path = GIT_BUF_INIT;
+	int t = 0;
+
+	assert(backend_out && repository);
+
+	if (repository->is_worktree) {
+		git_error_set(GIT_ERROR_REFERENCE,
+			"worktrees are not supported by the reftable backend");
+		return -1;
+	}
+
+	backend = git__calloc(1, sizeof(refdb_reftable_backend));
+	GIT_ERROR_CHECK_ALLOC(backend);
+
+	backend->repo = repository;
+
+	if (git_mutex_init(&backend->lock) < 0) {
+		git__free(backend);
+		return -1;
+	}
+
+	if (git_vector_init(&backend->refs, 0, batch_ref_cmp) < 0 ||
+	    git_vector_init(&backend->logs, 0, batch_log_cmp) < 0 ||
+	    git_buf_joinpath(&path, repository->commondir, GIT_REFTABLE_DIR) < 0 ||
+	    git_reftable_stack_open(&backend->stack, path.ptr) < 0)
+		goto fail;
+
+	if ((!git_repository__cvar(&t, backend->repo, GIT_CVAR_FSYNCOBJECTFILES) && t) ||
+		git_repository__fsync_gitdir)
+		backend->stack->fsync = 1;
+
+	backend->parent.exists = &refdb_reftable_backend__exists;
+	backend->parent.lookup = &refdb_reftable_backend__lookup;
+	backend->parent.iterator = &refdb_reftable_backend__iterator;
+	backend->parent.write = &refdb_reftable_backend__write;
+	backend->parent.del = &refdb_reftable_backend__delete;
+	backend->parent.rename = &refdb_reftable_backend__rename;
+	backend->parent.compress = &refdb_reftable_backend__compress;
+	backend->parent.lock = &refdb_reftable_backend__lock;
+	backend->parent.unlock = &refdb_reftable_backend__unlock;
+	backend->parent.has_log = &refdb_reftable_reflog__has_log;
+	backend->parent.ensure_log = &refdb_reftable_reflog__ensure_log;
+	backend->parent.free = &refdb_reftable_backend__free;
+	backend->parent.reflog_read = &refdb_reftable_reflog__read;
+	backend->parent.reflog_write = &refdb_reftable_reflog__write;
+	backend->parent.reflog_rename = &refdb_reftable_reflog__rename;
+	backend->parent.reflog_delete = &refdb_reftable_reflog__delete;
+
+	git_buf_dispose(&path);
+	*backend_out = (git_refdb_backend *)backend;
+	return 0;
+
+fail:
+	git_buf_dispose(&path);
+	git_vector_free(&backend->refs);
+	git_vector_free(&backend->logs);
+	git_mutex_free(&backend->lock);
+	git__free(backend);
+	return -1;
+}
@@ -0,0 +1,2089 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "reftable.h"
+
+#include "array.h"
+#include "path.h"
+
+#include <zlib.h>
+
+#define REFTABLE_SIGNATURE "REFT"
+#define REFTABLE_VERSION 1
+#define REFTABLE_HEADER_SIZE 24
+#define REFTABLE_FOOTER_SIZE 68
+
+/* Compact a run of tables once a table is smaller than this many times the newer ones. */
+#define REFTABLE_COMPACTION_FACTOR 2
+
+static int reftable_error(const char *message)
+{
+	git_error_set(GIT_ERROR_REFERENCE, "reftable is corrupt: %s", message);
+	return -1;
+}
+
+GIT_INLINE(uint16_t) get_be16(const unsigned char *p)
+{
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+GIT_INLINE(uint32_t) get_be24(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+}
+
+GIT_INLINE(uint32_t) get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | get_be24(p + 1);
+}
+
+GIT_INLINE(uint64_t) get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32) | get_be32(p + 4);
+}
+
+GIT_INLINE(void) put_be16(unsigned char *p, uint16_t v)
+{
+	p[0] = (unsigned char)(v >> 8);
+	p[1] = (unsigned char)v;
+}
+
+GIT_INLINE(void) put_be24(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 16);
+	p[1] = (unsigned char)(v >> 8);
+	p[2] = (unsigned char)v;
+}
+
+GIT_INLINE(void) put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	put_be24(p + 1, v);
+}
+
+GIT_INLINE(void) put_be64(unsigned char *p, uint64_t v)
+{
+	put_be32(p, (uint32_t)(v >> 32));
+	put_be32(p + 4, (uint32_t)v);
+}
+
+/*
+ * Variable length integers use the same encoding as the offsets of
+ * OFS_DELTA objects in packfiles.
+ */
+static int get_varint(uint64_t *out, const unsigned char **p, const unsigned char *end)
+{
+	const unsigned char *ptr = *p;
+	uint64_t val;
+
+	if (ptr >= end)
+		return -1;
+
+	val = *ptr & 0x7f;
+
+	while (*ptr++ & 0x80) {
+		if (ptr >= end || val >= (UINT64_MAX >> 7))
+			return -1;
+
+		val = ((val + 1) << 7) | (*ptr & 0x7f);
+	}
+
+	*out = val;
+	*p = ptr;
+	return 0;
+}
+
+static int put_varint(git_buf *buf, uint64_t val)
+{
+	unsigned char varint[10];
+	size_t pos = sizeof(varint) - 1;
+
+	varint[pos] = val & 0x7f;
+
+	while (val >>= 7)
+		varint[--pos] = 0x80 | (--val & 0x7f);
+
+	return git_buf_put(buf, (char *)varint + pos, sizeof(varint) - pos);
+}
+
+static int put_varint_string(git_buf *buf, const git_buf *str)
+{
+	if (put_varint(buf, str->size) < 0)
+		return -1;
+
+	return git_buf_put(buf, str->ptr, str->size);
+}
+
+static int get_varint_string(
+	git_buf *out, const unsigned char **p, const unsigned char *end)
+{
+	uint64_t len;
+
+	if (get_varint(&len, p, end) < 0 || len > (uint64_t)(end - *p))
+		return -1;
+
+	if (out && git_buf_set(out, *p, (size_t)len) < 0)
+		return -1;
+
+	*p += len;
+	return 0;
+}
+
+static int key_cmp(const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	int cmp = memcmp(a, b, min(a_len, b_len));
+
+	if (cmp)
+		return cmp;
+
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+void git_reftable_ref_dispose(git_reftable_ref *ref)
+{
+	if (!ref)
+		return;
+
+	git_buf_dispose(&ref->name);
+	git_buf_dispose(&ref->target);
+}
+
+void git_reftable_log_dispose(git_reftable_log *log)
+{
+	if (!log)
+		return;
+
+	git_buf_dispose(&log->name);
+	git_buf_dispose(&log->committer_name);
+	git_buf_dispose(&log->committer_email);
+	git_buf_dispose(&log->message);
+}
+
+/*
+ * Writer
+ */
+
+typedef struct {
+	uint64_t offset;
+	size_t key_len;
+	char key[GIT_FLEX_ARRAY];
+} index_entry;
+
+struct git_reftable_writer {
+	git_buf out;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+	uint32_t block_size;
+
+	/* The block being filled: type and length, then the records. */
+	git_buf block;
+	char block_type;
+	size_t header_off;
+	git_array_t(uint32_t) restarts;
+	size_t records;
+	git_buf last_key;
+	git_buf record;
+
+	/* The blocks written for the current section, for its index. */
+	git_vector index;
+
+	char section;
+	uint64_t ref_index_position;
+	uint64_t log_position;
+	uint64_t log_index_position;
+};
+
+static void write_header(unsigned char *out, const git_reftable_writer *w)
+{
+	memcpy(out, REFTABLE_SIGNATURE, 4);
+	out[4] = REFTABLE_VERSION;
+	put_be24(out + 5, w->block_size);
+	put_be64(out + 8, w->min_update_index);
+	put_be64(out + 16, w->max_update_index);
+}
+
+int git_reftable_writer_new(
+	git_reftable_writer **out,
+	uint64_t min_update_index,
+	uint64_t max_update_index)
+{
+	git_reftable_writer *w;
+	unsigned char header[REFTABLE_HEADER_SIZE];
+
+	assert(out && min_update_index <= max_update_index);
+
+	w = git__calloc(1, sizeof(git_reftable_writer));
+	GIT_ERROR_CHECK_ALLOC(w);
+
+	w->min_update_index = min_update_index;
+	w->max_update_index = max_update_index;
+	w->block_size = GIT_REFTABLE_BLOCK_SIZE;
+
+	write_header(header, w);
+
+	if (git_vector_init(&w->index, 0, NULL) < 0 ||
+	    git_buf_put(&w->out, (char *)header, sizeof(header)) < 0) {
+		git_reftable_writer_free(w);
+		return -1;
+	}
+
+	*out = w;
+	return 0;
+}
+
+static void writer_clear_index(git_reftable_writer *w)
+{
+	index_entry *entry;
+	size_t i;
+
+	git_vector_foreach(&w->index, i, entry)
+		git__free(entry);
+
+	git_vector_clear(&w->index);
+}
+
+void git_reftable_writer_free(git_reftable_writer *w)
+{
+	if (!w)
+		return;
+
+	writer_clear_index(w);
+	git_vector_free(&w->index);
+	git_array_clear(w->restarts);
+	git_buf_dispose(&w->out);
+	git_buf_dispose(&w->block);
+	git_buf_dispose(&w->last_key);
+	git_buf_dispose(&w->record);
+	git__free(w);
+}
+
+static int writer_block_start(git_reftable_writer *w, char type)
+{
+	git_buf_clear(&w->block);
+	git_buf_clear(&w->last_key);
+	w->restarts.size = 0;
+	w->records = 0;
+	w->block_type = type;
+
+	/* The first block of the file starts with the file header */
+	w->header_off = w->out.size == REFTABLE_HEADER_SIZE ? REFTABLE_HEADER_SIZE : 0;
+
+	return git_buf_put(&w->block, "\0\0\0\0", 4);
+}
+
+static int deflate_block(git_buf *out, const char *data, size_t len)
+{
+	z_stream zs;
+	int error = 0;
+
+	memset(&zs, 0, sizeof(zs));
+
+	if (deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK) {
+		git_error_set(GIT_ERROR_ZLIB, "failed to initialize deflate");
+		return -1;
+	}
+
+	if (git_buf_grow_by(out, deflateBound(&zs, (uLong)len)) < 0) {
+		error = -1;
+		goto done;
+	}
+
+	zs.next_in = (Bytef *)data;
+	zs.avail_in = (uInt)len;
+	zs.next_out = (Bytef *)out->ptr + out->size;
+	zs.avail_out = (uInt)(out->asize - out->size - 1);
+
+	if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		git_error_set(GIT_ERROR_ZLIB, "failed to deflate reftable block");
+		error = -1;
+		goto done;
+	}
+
+	out->size += zs.total_out;
+	out->ptr[out->size] = '\0';
+
+done:
+	deflateEnd(&zs);
+	return error;
+}
+
+static int writer_flush_block(git_reftable_writer *w)
+{
+	unsigned char be[3];
+	index_entry *entry;
+	uint64_t offset;
+	size_t i, len;
+
+	if (!w->records)
+		return 0;
+
+	for (i = 0; i < w->restarts.size; i++) {
+		put_be24(be, w->restarts.ptr[i]);
+		git_buf_put(&w->block, (char *)be, 3);
+	}
+
+	put_be16(be, (uint16_t)w->restarts.size);
+	git_buf_put(&w->block, (char *)be, 2);
+
+	if (git_buf_oom(&w->block))
+		return -1;
+
+	len = w->header_off + w->block.size;
+	w->block.ptr[0] = w->block_type;
+	put_be24((unsigned char *)w->block.ptr + 1, (uint32_t)len);
+
+	offset = w->out.size - w->header_off;
+
+	if (w->block_type == GIT_REFTABLE_BLOCK_LOG) {
+		/* Log blocks are deflated after their type and inflated length */
+		if (git_buf_put(&w->out, w->block.ptr, 4) < 0 ||
+		    deflate_block(&w->out, w->block.ptr + 4, w->block.size - 4) < 0)
+			return -1;
+	} else {
+		if (git_buf_put(&w->out, w->block.ptr, w->block.size) < 0)
+			return -1;
+
+		/* Pad the other blocks so that readers can find them without an index */
+		for (; len < w->block_size; len++)
+			git_buf_putc(&w->out, '\0');
+
+		if (git_buf_oom(&w->out))
+			return -1;
+	}
+
+	entry = git__malloc(sizeof(index_entry) + w->last_key.size);
+	GIT_ERROR_CHECK_ALLOC(entry);
+
+	entry->offset = offset;
+	entry->key_len = w->last_key.size;
+	memcpy(entry->key, w->last_key.ptr, w->last_key.size);
+
+	if (git_vector_insert(&w->index, entry) < 0) {
+		git__free(entry);
+		return -1;
+	}
+
+	w->records = 0;
+	return 0;
+}
+
+static int writer_add_record(
+	git_reftable_writer *w,
+	const char *key,
+	size_t key_len,
+	uint8_t value_type,
+	const git_buf *value)
+{
+	size_t prefix = 0, needed;
+	bool restart;
+	uint32_t *restart_offset;
+
+	restart = (w->records % GIT_REFTABLE_RESTART_INTERVAL) == 0;
+
+	if (!restart)
+		while (prefix < key_len && prefix < w->last_key.size &&
+		       key[prefix] == w->last_key.ptr[prefix])
+			prefix++;
+
+	git_buf_clear(&w->record);
+
+	if (put_varint(&w->record, prefix) < 0 ||
+	    put_varint(&w->record, ((uint64_t)(key_len - prefix) << 3) | value_type) < 0 ||
+	    git_buf_put(&w->record, key + prefix, key_len - prefix) < 0 ||
+	    git_buf_put(&w->record, value->ptr, value->size) < 0)
+		return -1;
+
+	needed = w->header_off + w->block.size + w->record.size +
+		(w->restarts.size + restart) * 3 + 2;
+
+	if (needed > w->block_size) {
+		if (!w->records) {
+			git_error_set(GIT_ERROR_REFERENCE,
+				"reftable record for '%.*s' does not fit in a block",
+				(int)key_len, key);
+			return -1;
+		}
+
+		if (writer_flush_block(w) < 0 ||
+		    writer_block_start(w, w->block_type) < 0)
+			return -1;
+
+		return writer_add_record(w, key, key_len, value_type, value);
+	}
+
+	if (restart) {
+		restart_offset = git_array_alloc(w->restarts);
+		GIT_ERROR_CHECK_ALLOC(restart_offset);
+		*restart_offset = (uint32_t)(w->header_off + w->block.size);
+	}
+
+	if (git_buf_put(&w->block, w->record.ptr, w->record.size) < 0 ||
+	    git_buf_set(&w->last_key, key, key_len) < 0)
+		return -1;
+
+	w->records++;
+	return 0;
+}
+
+/*
+ * Flush the last block of a section and write an index for it when it
+ * spans several blocks; indexes that do not fit in a block are
+ * indexed in turn.
+ */
+static int writer_finish_section(uint64_t *index_position, git_reftable_writer *w)
+{
+	git_vector level = GIT_VECTOR_INIT;
+	git_buf value = GIT_BUF_INIT;
+	index_entry *entry;
+	size_t i;
+	int error;
+
+	*index_position = 0;
+
+	if ((error = writer_flush_block(w)) < 0)
+		goto done;
+
+	while (w->index.length > 1) {
+		git_vector_swap(&level, &w->index);
+
+		if ((error = writer_block_start(w, GIT_REFTABLE_BLOCK_INDEX)) < 0)
+			goto done;
+
+		git_vector_foreach(&level, i, entry) {
+			git_buf_clear(&value);
+
+			if ((error = put_varint(&value, entry->offset)) < 0 ||
+			    (error = writer_add_record(w, entry->key, entry->key_len, 0, &value)) < 0)
+				goto done;
+		}
+
+		if ((error = writer_flush_block(w)) < 0)
+			goto done;
+
+		git_vector_foreach(&level, i, entry)
+			git__free(entry);
+		git_vector_clear(&level);
+
+		if (w->index.length == 1)
+			*index_position = ((index_entry *)git_vector_get(&w->index, 0))->offset;
+	}
+
+done:
+	git_vector_foreach(&level, i, entry)
+		git__free(entry);
+	git_vector_free(&level);
+	writer_clear_index(w);
+	git_buf_dispose(&value);
+	return error;
+}
+
+int git_reftable_writer_add_ref(git_reftable_writer *w, const git_reftable_ref *ref)
+{
+	git_buf value = GIT_BUF_INIT;
+	int error;
+
+	assert(w && ref);
+
+	if (w->section && w->section != GIT_REFTABLE_BLOCK_REF) {
+		git_error_set(GIT_ERROR_REFERENCE, "reftable refs must be written before the logs");
+		return -1;
+	}
+
+	if (w->section && key_cmp(ref->name.ptr, ref->name.size,
+			w->last_key.ptr, w->last_key.size) <= 0) {
+		git_error_set(GIT_ERROR_REFERENCE, "reftable refs must be written in order");
+		return -1;
+	}
+
+	if (ref->update_index < w->min_update_index ||
+	    ref->update_index > w->max_update_index) {
+		git_error_set(GIT_ERROR_REFERENCE, "reftable ref update index out of range");
+		return -1;
+	}
+
+	if (!w->section) {
+		if ((error = writer_block_start(w, GIT_REFTABLE_BLOCK_REF)) < 0)
+			return error;
+		w->section = GIT_REFTABLE_BLOCK_REF;
+	}
+
+	put_varint(&value, ref->update_index - w->min_update_index);
+
+	switch (ref->type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+	case GIT_REFTABLE_REF_VAL2:
+		git_buf_put(&value, (char *)ref->value.id, GIT_OID_RAWSZ);
+		git_buf_put(&value, (char *)ref->peeled.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_VAL1:
+		git_buf_put(&value, (char *)ref->value.id, GIT_OID_RAWSZ);
+		break;
+	case GIT_REFTABLE_REF_SYMREF:
+		put_varint_string(&value, &ref->target);
+		break;
+	default:
+		git_error_set(GIT_ERROR_REFERENCE, "invalid reftable ref type");
+		return -1;
+	}
+
+	if ((error = git_buf_oom(&value) ? -1 : 0) == 0)
+		error = writer_add_record(w, ref->name.ptr, ref->name.size, ref->type, &value);
+
+	git_buf_dispose(&value);
+	return error;
+}
+
+static int log_key(git_buf *out, const char *name, size_t name_len, uint64_t update_index)
+{
+	unsigned char be[8];
+
+	/* Newer entries sort first */
+	put_be64(be, UINT64_MAX - update_index);
+
+	git_buf_clear(out);
+	git_buf_put(out, name, name_len);
+	git_buf_putc(out, '\0');
+	git_buf_put(out, (char *)be, sizeof(be));
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+int git_reftable_writer_add_log(git_reftable_writer *w, const git_reftable_log *log)
+{
+	git_buf key = GIT_BUF_INIT, value = GIT_BUF_INIT;
+	unsigned char be[2];
+	int error;
+
+	assert(w && log);
+
+	if ((error = log_key(&key, log->name.ptr, log->name.size, log->update_index)) < 0)
+		goto done;
+
+	if (w->section == GIT_REFTABLE_BLOCK_LOG &&
+	    key_cmp(key.ptr, key.size, w->last_key.ptr, w->last_key.size) <= 0) {
+		git_error_set(GIT_ERROR_REFERENCE, "reftable logs must be written in order");
+		error = -1;
+		goto done;
+	}
+
+	if (w->section != GIT_REFTABLE_BLOCK_LOG) {
+		if (w->section == GIT_REFTABLE_BLOCK_REF &&
+		    (error = writer_finish_section(&w->ref_index_position, w)) < 0)
+			goto done;
+
+		w->log_position = w->out.size == REFTABLE_HEADER_SIZE ? 0 : w->out.size;
+
+		if ((error = writer_block_start(w, GIT_REFTABLE_BLOCK_LOG)) < 0)
+			goto done;
+
+		w->section = GIT_REFTABLE_BLOCK_LOG;
+	}
+
+	if (log->type == GIT_REFTABLE_LOG_UPDATE) {
+		put_be16(be, (uint16_t)log->tz_offset);
+
+		git_buf_put(&value, (char *)log->old_id.id, GIT_OID_RAWSZ);
+		git_buf_put(&value, (char *)log->new_id.id, GIT_OID_RAWSZ);
+		put_varint_string(&value, &log->committer_name);
+		put_varint_string(&value, &log->committer_email);
+		put_varint(&value, log->time);
+		git_buf_put(&value, (char *)be, 2);
+		put_varint_string(&value, &log->message);
+
+		if (git_buf_oom(&value)) {
+			error = -1;
+			goto done;
+		}
+	} else if (log->type != GIT_REFTABLE_LOG_DELETION) {
+		git_error_set(GIT_ERROR_REFERENCE, "invalid reftable log type");
+		error = -1;
+		goto done;
+	}
+
+	error = writer_add_record(w, key.ptr, key.size, log->type, &value);
+
+done:
+	git_buf_dispose(&key);
+	git_buf_dispose(&value);
+	return error;
+}
+
+int git_reftable_writer_finish(git_buf *out, git_reftable_writer *w)
+{
+	unsigned char footer[REFTABLE_FOOTER_SIZE];
+	int error = 0;
+
+	assert(out && w);
+
+	if (w->section == GIT_REFTABLE_BLOCK_REF)
+		error = writer_finish_section(&w->ref_index_position, w);
+	else if (w->section == GIT_REFTABLE_BLOCK_LOG)
+		error = writer_finish_section(&w->log_index_position, w);
+
+	if (error < 0)
+		return error;
+
+	memset(footer, 0, sizeof(footer));
+	write_header(footer, w);
+	put_be64(footer + 24, w->ref_index_position);
+	put_be64(footer + 48, w->log_position);
+	put_be64(footer + 56, w->log_index_position);
+	put_be32(footer + 64, (uint32_t)crc32(0L, footer, 64));
+
+	if (git_buf_put(&w->out, (char *)footer, sizeof(footer)) < 0)
+		return -1;
+
+	git_buf_swap(out, &w->out);
+	git_buf_clear(&w->out);
+	w->section = 0;
+	return 0;
+}
+
+/*
+ * Reader
+ */
+
+static int table_parse(git_reftable_table *table)
+{
+	const unsigned char *footer;
+	size_t end;
+
+	if (table->size < REFTABLE_HEADER_SIZE + REFTABLE_FOOTER_SIZE)
+		return reftable_error("file is too short");
+
+	if (memcmp(table->data, REFTABLE_SIGNATURE, 4))
+		return reftable_error("invalid signature");
+
+	if (table->data[4] != REFTABLE_VERSION) {
+		git_error_set(GIT_ERROR_REFERENCE,
+			"unsupported reftable version %d", table->data[4]);
+		return -1;
+	}
+
+	footer = table->data + table->size - REFTABLE_FOOTER_SIZE;
+
+	if (memcmp(footer, table->data, REFTABLE_HEADER_SIZE))
+		return reftable_error("footer does not match the header");
+
+	if (get_be32(footer + 64) != (uint32_t)crc32(0L, footer, 64))
+		return reftable_error("footer checksum mismatch");
+
+	table->block_size = get_be24(table->data + 5);
+	table->min_update_index = get_be64(table->data + 8);
+	table->max_update_index = get_be64(table->data + 16);
+	table->ref_index_position = get_be64(footer + 24);
+	table->log_position = get_be64(footer + 48);
+	table->log_index_position = get_be64(footer + 56);
+
+	end = table->size - REFTABLE_FOOTER_SIZE;
+
+	if (table->ref_index_position >= end ||
+	    table->log_position >= end ||
+	    table->log_index_position >= end)
+		return reftable_error("section offsets are out of range");
+
+	table->has_refs = end > REFTABLE_HEADER_SIZE &&
+		table->data[REFTABLE_HEADER_SIZE] == GIT_REFTABLE_BLOCK_REF;
+	table->has_logs = table->log_position > 0 || (end > REFTABLE_HEADER_SIZE &&
+		table->data[REFTABLE_HEADER_SIZE] == GIT_REFTABLE_BLOCK_LOG);
+
+	return 0;
+}
+
+static git_reftable_table *table_alloc(const char *name)
+{
+	git_reftable_table *table;
+	size_t namelen = strlen(name), alloclen;
+
+	if (GIT_ADD_SIZET_OVERFLOW(&alloclen, sizeof(git_reftable_table), namelen) ||
+	    GIT_ADD_SIZET_OVERFLOW(&alloclen, alloclen, 1))
+		return NULL;
+
+	if ((table = git__calloc(1, alloclen)) == NULL)
+		return NULL;
+
+	memcpy(table->name, name, namelen);
+	GIT_REFCOUNT_INC(table);
+
+	return table;
+}
+
+int git_reftable_table_open(
+	git_reftable_table **out, const char *path, const char *name)
+{
+	git_reftable_table *table;
+	int error;
+
+	assert(out && path && name);
+
+	table = table_alloc(name);
+	GIT_ERROR_CHECK_ALLOC(table);
+
+	if ((error = git_futils_mmap_ro_file(&table->map, path)) < 0) {
+		git__free(table);
+		return error;
+	}
+
+	table->data = table->map.data;
+	table->size = table->map.len;
+
+	if ((error = table_parse(table)) < 0) {
+		git_reftable_table_free(table);
+		return error;
+	}
+
+	*out = table;
+	return 0;
+}
+
+int git_reftable_table_from_buffer(
+	git_reftable_table **out, git_buf *contents, const char *name)
+{
+	git_reftable_table *table;
+	int error;
+
+	assert(out && contents && name);
+
+	table = table_alloc(name);
+	GIT_ERROR_CHECK_ALLOC(table);
+
+	git_buf_swap(&table->contents, contents);
+	table->data = (unsigned char *)table->contents.ptr;
+	table->size = table->contents.size;
+
+	if ((error = table_parse(table)) < 0) {
+		git_buf_swap(&table->contents, contents);
+		git_reftable_table_free(table);
+		return error;
+	}
+
+	*out = table;
+	return 0;
+}
+
+void git_reftable_table_free(git_reftable_table *table)
+{
+	if (!table)
+		return;
+
+	if (table->map.data)
+		git_futils_mmap_free(&table->map);
+
+	git_buf_dispose(&table->contents);
+	git__free(table);
+}
+
+static int block_inflate(
+	git_reftable_block *block,
+	const unsigned char *start,
+	size_t avail,
+	size_t header_len,
+	size_t len)
+{
+	z_stream zs;
+	int zerr;
+
+	if (len < header_len)
+		return reftable_error("log block is too short");
+
+	git_buf_clear(&block->inflated);
+
+	if (git_buf_grow(&block->inflated, len + 1) < 0)
+		return -1;
+
+	memcpy(block->inflated.ptr, start, header_len);
+
+	memset(&zs, 0, sizeof(zs));
+
+	if (inflateInit(&zs) != Z_OK) {
+		git_error_set(GIT_ERROR_ZLIB, "failed to initialize inflate");
+		return -1;
+	}
+
+	zs.next_in = (Bytef *)start + header_len;
+	zs.avail_in = (uInt)(avail - header_len);
+	zs.next_out = (Bytef *)block->inflated.ptr + header_len;
+	zs.avail_out = (uInt)(len - header_len);
+
+	zerr = inflate(&zs, Z_FINISH);
+	inflateEnd(&zs);
+
+	if (zerr != Z_STREAM_END || zs.total_out != len - header_len)
+		return reftable_error("failed to inflate log block");
+
+	block->inflated.size = len;
+	block->data = (unsigned char *)block->inflated.ptr;
+	block->full_len = header_len + zs.total_in;
+
+	return 0;
+}
+
+static int block_read(git_reftable_block *block, git_reftable_table *table, size_t off)
+{
+	size_t end = table->size - REFTABLE_FOOTER_SIZE, header_off, len;
+	const unsigned char *start = table->data + off;
+	int error;
+
+	header_off = off ? 0 : REFTABLE_HEADER_SIZE;
+
+	if (off + header_off + 4 > end)
+		return reftable_error("block is out of range");
+
+	block->header_off = header_off;
+	block->type = start[header_off];
+	block->len = len = get_be24(start + header_off + 1);
+
+	if (block->type == GIT_REFTABLE_BLOCK_LOG) {
+		if ((error = block_inflate(block, start, end - off, header_off + 4, len)) < 0)
+			return error;
+	} else {
+		if (len > end - off)
+			return reftable_error("block is out of range");
+
+		block->data = start;
+		block->full_len = table->block_size;
+
+		/* A block is followed by padding, unless the table is unaligned */
+		if (block->full_len < len ||
+		    (len < block->full_len && len < end - off && start[len] != 0))
+			block->full_len = len;
+
+		if (block->full_len > end - off)
+			block->full_len = end - off;
+	}
+
+	if (len < header_off + 4 + 2)
+		return reftable_error("block is too short");
+
+	block->restart_count = get_be16(block->data + len - 2);
+
+	if ((size_t)block->restart_count * 3 + 2 > len - header_off - 4)
+		return reftable_error("invalid restart count");
+
+	block->restarts = len - 2 - (size_t)block->restart_count * 3;
+	return 0;
+}
+
+GIT_INLINE(size_t) block_records(const git_reftable_block *block)
+{
+	return block->header_off + 4;
+}
+
+static int decode_key(
+	git_buf *key,
+	const git_buf *last_key,
+	uint8_t *value_type,
+	const unsigned char **p,
+	const unsigned char *end)
+{
+	uint64_t prefix, suffix;
+
+	if (get_varint(&prefix, p, end) < 0 ||
+	    get_varint(&suffix, p, end) < 0)
+		return reftable_error("invalid record key");
+
+	*value_type = suffix & 0x7;
+	suffix >>= 3;
+
+	if (prefix > last_key->size || suffix > (uint64_t)(end - *p))
+		return reftable_error("invalid record key");
+
+	git_buf_clear(key);
+
+	if (git_buf_put(key, last_key->ptr, (size_t)prefix) < 0 ||
+	    git_buf_put(key, (const char *)*p, (size_t)suffix) < 0)
+		return -1;
+
+	*p += suffix;
+	return 0;
+}
+
+static int skip_value(
+	char block_type,
+	uint8_t value_type,
+	const unsigned char **p,
+	const unsigned char *end)
+{
+	uint64_t unused;
+	size_t len = 0;
+
+	switch (block_type) {
+	case GIT_REFTABLE_BLOCK_INDEX:
+		return get_varint(&unused, p, end);
+
+	case GIT_REFTABLE_BLOCK_REF:
+		if (get_varint(&unused, p, end) < 0)
+			return -1;
+
+		if (value_type == GIT_REFTABLE_REF_SYMREF)
+			return get_varint_string(NULL, p, end);
+
+		len = value_type == GIT_REFTABLE_REF_VAL1 ? GIT_OID_RAWSZ :
+		      value_type == GIT_REFTABLE_REF_VAL2 ? 2 * GIT_OID_RAWSZ : 0;
+		break;
+
+	case GIT_REFTABLE_BLOCK_LOG:
+		if (value_type == GIT_REFTABLE_LOG_DELETION)
+			return 0;
+
+		if ((size_t)(end - *p) < 2 * GIT_OID_RAWSZ)
+			return -1;
+
+		*p += 2 * GIT_OID_RAWSZ;
+
+		if (get_varint_string(NULL, p, end) < 0 ||
+		    get_varint_string(NULL, p, end) < 0 ||
+		    get_varint(&unused, p, end) < 0)
+			return -1;
+
+		if ((size_t)(end - *p) < 2)
+			return -1;
+
+		*p += 2;
+
+		return get_varint_string(NULL, p, end);
+	}
+
+	if ((size_t)(end - *p) < len)
+		return -1;
+
+	*p += len;
+	return 0;
+}
+
+/*
+ * Position `iter` on the first record of its block whose key is not
+ * smaller than `key`, or past the last record if there is none.
+ */
+static int block_seek(git_reftable_table_iter *iter, const char *key, size_t key_len)
+{
+	git_reftable_block *block = &iter->block;
+	const unsigned char *p, *end = block->data + block->restarts;
+	size_t lo = 0, hi = block->restart_count;
+	uint8_t value_type;
+	int error;
+
+	git_buf_clear(&iter->key);
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		size_t off = get_be24(block->data + block->restarts + mid * 3);
+
+		if (off >= block->restarts)
+			return reftable_error("invalid restart offset");
+
+		p = block->data + off;
+
+		if ((error = decode_key(&iter->scratch, &iter->key, &value_type, &p, end)) < 0)
+			return error;
+
+		if (key_cmp(iter->scratch.ptr, iter->scratch.size, key, key_len) > 0)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	iter->pos = lo ? get_be24(block->data + block->restarts + (lo - 1) * 3) :
+		block_records(block);
+
+	while (iter->pos < block->restarts) {
+		p = block->data + iter->pos;
+
+		if ((error = decode_key(&iter->scratch, &iter->key, &value_type, &p, end)) < 0)
+			return error;
+
+		if (key_cmp(iter->scratch.ptr, iter->scratch.size, key, key_len) >= 0)
+			break;
+
+		if (skip_value(block->type, value_type, &p, end) < 0)
+			return reftable_error("invalid record value");
+
+		git_buf_swap(&iter->key, &iter->scratch);
+		iter->pos = p - block->data;
+	}
+
+	return 0;
+}
+
+static int block_first_key(git_buf *out, git_reftable_block *block)
+{
+	const unsigned char *p = block->data + block_records(block);
+	git_buf empty = GIT_BUF_INIT;
+	uint8_t value_type;
+
+	return decode_key(out, &empty, &value_type, &p, block->data + block->restarts);
+}
+
+static int table_seek(
+	git_reftable_table_iter *iter,
+	git_reftable_table *table,
+	char type,
+	const char *key,
+	size_t key_len)
+{
+	git_reftable_block next = { NULL, GIT_BUF_INIT }, tmp;
+	git_buf first_key = GIT_BUF_INIT;
+	uint64_t off, index;
+	size_t end = table->size - REFTABLE_FOOTER_SIZE;
+	uint8_t value_type;
+	int error = 0;
+
+	iter->table = table;
+	iter->type = type;
+	iter->done = true;
+	iter->pos = 0;
+	git_buf_clear(&iter->key);
+
+	if (type == GIT_REFTABLE_BLOCK_REF) {
+		if (!table->has_refs)
+			return 0;
+
+		off = 0;
+		index = table->ref_index_position;
+	} else {
+		if (!table->has_logs)
+			return 0;
+
+		off = table->log_position;
+		index = table->log_index_position;
+	}
+
+	if (index) {
+		/*
+		 * Walk down the index to the block that may hold `key`.  Every
+		 * block is written before the index that points to it, so each
+		 * hop must go back in the file, which also ends cycles.
+		 */
+		for (off = index; ; ) {
+			const unsigned char *p;
+			uint64_t block_off = off;
+
+			if ((error = block_read(&iter->block, table, (size_t)off)) < 0)
+				goto done;
+
+			if (iter->block.type == type)
+				break;
+
+			if (iter->block.type != GIT_REFTABLE_BLOCK_INDEX) {
+				error = reftable_error("invalid index block");
+				goto done;
+			}
+
+			if ((error = block_seek(iter, key, key_len)) < 0)
+				goto done;
+
+			if (iter->pos >= iter->block.restarts)
+				goto done;
+
+			p = iter->block.data + iter->pos;
+
+			if ((error = decode_key(&iter->scratch, &iter->key, &value_type,
+					&p, iter->block.data + iter->block.restarts)) < 0)
+				goto done;
+
+			if (get_varint(&off, &p, iter->block.data + iter->block.restarts) < 0 ||
+			    off >= block_off) {
+				error = reftable_error("invalid index record");
+				goto done;
+			}
+		}
+	} else {
+		if ((error = block_read(&iter->block, table, (size_t)off)) < 0)
+			goto done;
+
+		if (iter->block.type != type) {
+			error = reftable_error("unexpected block type");
+			goto done;
+		}
+
+		/* Without an index, skip the blocks that only hold smaller keys */
+		while (off + iter->block.full_len < end) {
+			uint64_t next_off = off + iter->block.full_len;
+
+			if (table->data[next_off] != type)
+				break;
+
+			if ((error = block_read(&next, table, (size_t)next_off)) < 0 ||
+			    (error = block_first_key(&first_key, &next)) < 0)
+				goto done;
+
+			if (key_cmp(first_key.ptr, first_key.size, key, key_len) > 0)
+				break;
+
+			tmp = iter->block;
+			iter->block = next;
+			next = tmp;
+			off = next_off;
+		}
+	}
+
+	iter->block_off = (size_t)off;
+	iter->done = false;
+
+	error = block_seek(iter, key, key_len);
+
+done:
+	git_buf_dispose(&next.inflated);
+	git_buf_dispose(&first_key);
+	return error;
+}
+
+int git_reftable_table_seek_ref(
+	git_reftable_table_iter *iter, git_reftable_table *table, const char *name)
+{
+	assert(iter && table && name);
+	return table_seek(iter, table, GIT_REFTABLE_BLOCK_REF, name, strlen(name));
+}
+
+int git_reftable_table_seek_log(
+	git_reftable_table_iter *iter, git_reftable_table *table, const char *name)
+{
+	size_t name_len;
+
+	assert(iter && table && name);
+
+	/* The name and its NUL terminator are a prefix of the log keys */
+	name_len = strlen(name);
+	return table_seek(iter, table, GIT_REFTABLE_BLOCK_LOG, name, name_len ? name_len + 1 : 0);
+}
+
+static int iter_next_key(
+	uint8_t *value_type,
+	const unsigned char **p,
+	const unsigned char **end,
+	git_reftable_table_iter *iter)
+{
+	git_reftable_table *table = iter->table;
+	size_t table_end;
+	int error;
+
+	if (iter->done)
+		return GIT_ITEROVER;
+
+	while (iter->pos >= iter->block.restarts) {
+		size_t next_off = iter->block_off + iter->block.full_len;
+
+		table_end = table->size - REFTABLE_FOOTER_SIZE;
+
+		if (next_off >= table_end || table->data[next_off] != iter->type) {
+			iter->done = true;
+			return GIT_ITEROVER;
+		}
+
+		if ((error = block_read(&iter->block, table, next_off)) < 0)
+			return error;
+
+		iter->block_off = next_off;
+		iter->pos = block_records(&iter->block);
+		git_buf_clear(&iter->key);
+	}
+
+	*p = iter->block.data + iter->pos;
+	*end = iter->block.data + iter->block.restarts;
+
+	if ((error = decode_key(&iter->scratch, &iter->key, value_type, p, *end)) < 0)
+		return error;
+
+	git_buf_swap(&iter->key, &iter->scratch);
+	return 0;
+}
+
+int git_reftable_table_next_ref(git_reftable_ref *out, git_reftable_table_iter *iter)
+{
+	const unsigned char *p, *end;
+	uint64_t delta;
+	uint8_t value_type;
+	int error;
+
+	assert(out && iter);
+
+	if ((error = iter_next_key(&value_type, &p, &end, iter)) < 0)
+		return error;
+
+	if (git_buf_set(&out->name, iter->key.ptr, iter->key.size) < 0)
+		return -1;
+
+	git_buf_clear(&out->target);
+	out->type = value_type;
+
+	if (get_varint(&delta, &p, end) < 0)
+		goto corrupt;
+
+	out->update_index = iter->table->min_update_index + delta;
+
+	switch (value_type) {
+	case GIT_REFTABLE_REF_DELETION:
+		break;
+
+	case GIT_REFTABLE_REF_VAL1:
+	case GIT_REFTABLE_REF_VAL2:
+		if ((size_t)(end - p) < (value_type == GIT_REFTABLE_REF_VAL2 ? 2 : 1) * GIT_OID_RAWSZ)
+			goto corrupt;
+
+		git_oid_fromraw(&out->value, p);
+		p += GIT_OID_RAWSZ;
+
+		if (value_type == GIT_REFTABLE_REF_VAL2) {
+			git_oid_fromraw(&out->peeled, p);
+			p += GIT_OID_RAWSZ;
+		}
+		break;
+
+	case GIT_REFTABLE_REF_SYMREF:
+		if (get_varint_string(&out->target, &p, end) < 0)
+			goto corrupt;
+		break;
+
+	default:
+		goto corrupt;
+	}
+
+	iter->pos = p - iter->block.data;
+	return 0;
+
+corrupt:
+	return reftable_error("invalid ref record");
+}
+
+int git_reftable_table_next_log(git_reftable_log *out, git_reftable_table_iter *iter)
+{
+	const unsigned char *p, *end;
+	uint8_t value_type;
+	size_t name_len;
+	int error;
+
+	assert(out && iter);
+
+	if ((error = iter_next_key(&value_type, &p, &end, iter)) < 0)
+		return error;
+
+	if (iter->key.size < 9 || iter->key.ptr[iter->key.size - 9] != '\0')
+		goto corrupt;
+
+	name_len = iter->key.size - 9;
+
+	if (git_buf_set(&out->name, iter->key.ptr, name_len) < 0)
+		return -1;
+
+	out->update_index = UINT64_MAX -
+		get_be64((unsigned char *)iter->key.ptr + name_len + 1);
+	out->type = value_type;
+
+	git_buf_clear(&out->committer_name);
+	git_buf_clear(&out->committer_email);
+	git_buf_clear(&out->message);
+
+	if (value_type == GIT_REFTABLE_LOG_UPDATE) {
+		if ((size_t)(end - p) < 2 * GIT_OID_RAWSZ)
+			goto corrupt;
+
+		git_oid_fromraw(&out->old_id, p);
+		git_oid_fromraw(&out->new_id, p + GIT_OID_RAWSZ);
+		p += 2 * GIT_OID_RAWSZ;
+
+		if (get_varint_string(&out->committer_name, &p, end) < 0 ||
+		    get_varint_string(&out->committer_email, &p, end) < 0 ||
+		    get_varint(&out->time, &p, end) < 0 ||
+		    (size_t)(end - p) < 2)
+			goto corrupt;
+
+		out->tz_offset = (int16_t)get_be16(p);
+		p += 2;
+
+		if (get_varint_string(&out->message, &p, end) < 0)
+			goto corrupt;
+	} else if (value_type != GIT_REFTABLE_LOG_DELETION) {
+		goto corrupt;
+	}
+
+	iter->pos = p - iter->block.data;
+	return 0;
+
+corrupt:
+	return reftable_error("invalid log record");
+}
+
+void git_reftable_table_iter_dispose(git_reftable_table_iter *iter)
+{
+	if (!iter)
+		return;
+
+	git_buf_dispose(&iter->block.inflated);
+	git_buf_dispose(&iter->key);
+	git_buf_dispose(&iter->scratch);
+	iter->done = true;
+}
+
+/*
+ * Merged views over several tables
+ */
+
+int git_reftable_tables_read_ref(
+	git_reftable_ref *out, git_vector *tables, const char *name)
+{
+	git_reftable_table_iter iter = GIT_REFTABLE_TABLE_ITER_INIT;
+	git_reftable_table *table;
+	size_t i;
+	int error = GIT_ENOTFOUND;
+
+	assert(out && tables && name);
+
+	git_vector_foreach(tables, i, table) {
+		if ((error = git_reftable_table_seek_ref(&iter, table, name)) < 0)
+			break;
+
+		error = git_reftable_table_next_ref(out, &iter);
+
+		if (error == GIT_ITEROVER || (!error && strcmp(out->name.ptr, name))) {
+			error = GIT_ENOTFOUND;
+			continue;
+		}
+
+		if (!error && out->type == GIT_REFTABLE_REF_DELETION)
+			error = GIT_ENOTFOUND;
+
+		break;
+	}
+
+	git_reftable_table_iter_dispose(&iter);
+	return error;
+}
+
+int git_reftable_merged_iter_new(
+	git_reftable_merged_iter **out,
+	git_vector *tables,
+	const char *name,
+	bool with_deletions)
+{
+	git_reftable_merged_iter *iter;
+	git_reftable_table *table;
+	size_t i;
+	int error;
+
+	assert(out && tables && name);
+
+	iter = git__calloc(1, sizeof(git_reftable_merged_iter));
+	GIT_ERROR_CHECK_ALLOC(iter);
+
+	iter->count = tables->length;
+	iter->with_deletions = with_deletions;
+	iter->iters = git__calloc(iter->count ? iter->count : 1, sizeof(git_reftable_table_iter));
+	iter->records = git__calloc(iter->count ? iter->count : 1, sizeof(git_reftable_ref));
+	iter->valid = git__calloc(iter->count ? iter->count : 1, sizeof(bool));
+
+	if (!iter->iters || !iter->records || !iter->valid ||
+	    git_vector_dup(&iter->tables, tables, NULL) < 0) {
+		git_reftable_merged_iter_free(iter);
+		return -1;
+	}
+
+	git_vector_foreach(&iter->tables, i, table)
+		GIT_REFCOUNT_INC(table);
+
+	git_vector_foreach(&iter->tables, i, table) {
+		if ((error = git_reftable_table_seek_ref(&iter->iters[i], table, name)) < 0 ||
+		    ((error = git_reftable_table_next_ref(&iter->records[i], &iter->iters[i])) < 0 &&
+		     error != GIT_ITEROVER)) {
+			git_reftable_merged_iter_free(iter);
+			return error;
+		}
+
+		iter->valid[i] = (error == 0);
+	}
+
+	*out = iter;
+	return 0;
+}
+
+int git_reftable_merged_iter_next(
+	git_reftable_ref **out, git_reftable_merged_iter *iter)
+{
+	git_reftable_ref tmp;
+	size_t i, best;
+	int error;
+
+	assert(out && iter);
+
+	for (;;) {
+		best = iter->count;
+
+		/* Ties go to the newest table, which comes first */
+		for (i = 0; i < iter->count; i++) {
+			if (iter->valid[i] && (best == iter->count ||
+			    strcmp(iter->records[i].name.ptr, iter->records[best].name.ptr) < 0))
+				best = i;
+		}
+
+		if (best == iter->count)
+			return GIT_ITEROVER;
+
+		tmp = iter->current;
+		iter->current = iter->records[best];
+		iter->records[best] = tmp;
+
+		for (i = 0; i < iter->count; i++) {
+			while (iter->valid[i] && (i == best ||
+			       !strcmp(iter->records[i].name.ptr, iter->current.name.ptr))) {
+				error = git_reftable_table_next_ref(&iter->records[i], &iter->iters[i]);
+
+				if (error == GIT_ITEROVER)
+					iter->valid[i] = false;
+				else if (error < 0)
+					return error;
+
+				if (i == best)
+					break;
+			}
+		}
+
+		if (iter->with_deletions || iter->current.type != GIT_REFTABLE_REF_DELETION)
+			break;
+	}
+
+	*out = &iter->current;
+	return 0;
+}
+
+void git_reftable_merged_iter_free(git_reftable_merged_iter *iter)
+{
+	size_t i;
+
+	if (!iter)
+		return;
+
+	for (i = 0; i < iter->count; i++) {
+		if (iter->iters)
+			git_reftable_table_iter_dispose(&iter->iters[i]);
+		if (iter->records)
+			git_reftable_ref_dispose(&iter->records[i]);
+	}
+
+	git_reftable_ref_dispose(&iter->current);
+	git_reftable_stack_tables_release(&iter->tables);
+	git__free(iter->iters);
+	git__free(iter->records);
+	git__free(iter->valid);
+	git__free(iter);
+}
+
+typedef struct {
+	git_reftable_log log;
+	size_t rank;
+} ranked_log;
+
+static int ranked_log_cmp(const void *a_, const void *b_)
+{
+	const ranked_log *a = a_, *b = b_;
+	int cmp;
+
+	if ((cmp = strcmp(a->log.name.ptr, b->log.name.ptr)) != 0)
+		return cmp;
+
+	if (a->log.update_index != b->log.update_index)
+		return a->log.update_index > b->log.update_index ? -1 : 1;
+
+	return (a->rank > b->rank) - (a->rank < b->rank);
+}
+
+static void ranked_log_free(ranked_log *entry)
+{
+	git_reftable_log_dispose(&entry->log);
+	git__free(entry);
+}
+
+int git_reftable_tables_read_logs(
+	git_vector *out, git_vector *tables, const char *name, bool with_deletions)
+{
+	git_reftable_table_iter iter = GIT_REFTABLE_TABLE_ITER_INIT;
+	git_vector logs = GIT_VECTOR_INIT;
+	git_reftable_table *table;
+	ranked_log *entry = NULL, *prev = NULL;
+	size_t i;
+	int error = 0;
+
+	assert(out && tables);
+
+	if ((error = git_vector_init(&logs, 0, ranked_log_cmp)) < 0 ||
+	    (error = git_vector_init(out, 0, NULL)) < 0)
+		goto done;
+
+	git_vector_foreach(tables, i, table) {
+		if ((error = git_reftable_table_seek_log(&iter, table, name ? name : "")) < 0)
+			goto done;
+
+		for (;;) {
+			if (!entry) {
+				entry = git__calloc(1, sizeof(ranked_log));
+				GIT_ERROR_CHECK_ALLOC(entry);
+			}
+
+			if ((error = git_reftable_table_next_log(&entry->log, &iter)) == GIT_ITEROVER)
+				break;
+			else if (error < 0)
+				goto done;
+
+			if (name && strcmp(entry->log.name.ptr, name))
+				break;
+
+			entry->rank = i;
+
+			if ((error = git_vector_insert(&logs, entry)) < 0)
+				goto done;
+
+			entry = NULL;
+		}
+
+		error = 0;
+	}
+
+	if (entry) {
+		ranked_log_free(entry);
+		entry = NULL;
+	}
+
+	git_vector_sort(&logs);
+
+	/* The newest record of every key wins; deletions hide the older ones */
+	git_vector_foreach(&logs, i, entry) {
+		git_reftable_log *log;
+
+		if (prev && !strcmp(prev->log.name.ptr, entry->log.name.ptr) &&
+		    prev->log.update_index == entry->log.update_index)
+			continue;
+
+		prev = entry;
+
+		if (!with_deletions && entry->log.type == GIT_REFTABLE_LOG_DELETION)
+			continue;
+
+		log = git__calloc(1, sizeof(git_reftable_log));
+		GIT_ERROR_CHECK_ALLOC(log);
+
+		if ((error = git_vector_insert(out, log)) < 0) {
+			git__free(log);
+			goto done;
+		}
+
+		/* Hand the record over, keeping its key for the comparisons */
+		*log = entry->log;
+		memset(&entry->log, 0, sizeof(entry->log));
+		entry->log.update_index = log->update_index;
+
+		if ((error = git_buf_set(&entry->log.name, log->name.ptr, log->name.size)) < 0)
+			goto done;
+	}
+
+	entry = NULL;
+
+done:
+	if (entry)
+		ranked_log_free(entry);
+
+	git_vector_foreach(&logs, i, entry)
+		ranked_log_free(entry);
+
+	git_vector_free(&logs);
+	git_reftable_table_iter_dispose(&iter);
+
+	if (error < 0)
+		git_reftable_logs_free(out);
+
+	return error;
+}
+
+void git_reftable_logs_free(git_vector *logs)
+{
+	git_reftable_log *log;
+	size_t i;
+
+	git_vector_foreach(logs, i, log) {
+		git_reftable_log_dispose(log);
+		git__free(log);
+	}
+
+	git_vector_free(logs);
+}
+
+/*
+ * Stack
+ */
+
+static int stack_list_path(git_buf *out, git_reftable_stack *stack)
+{
+	return git_buf_joinpath(out, stack->path, GIT_REFTABLE_LIST_FILE);
+}
+
+int git_reftable_stack_open(git_reftable_stack **out, const char *path)
+{
+	git_reftable_stack *stack;
+	git_buf list = GIT_BUF_INIT, empty = GIT_BUF_INIT;
+	int error;
+
+	assert(out && path);
+
+	stack = git__calloc(1, sizeof(git_reftable_stack));
+	GIT_ERROR_CHECK_ALLOC(stack);
+
+	stack->auto_compact = 1;
+	stack->path = git__strdup(path);
+
+	if (!stack->path || git_vector_init(&stack->tables, 0, NULL) < 0) {
+		error = -1;
+		goto fail;
+	}
+
+	/* Start an empty stack if there is none yet */
+	if ((error = git_futils_mkdir(path, 0777, GIT_MKDIR_PATH)) < 0 ||
+	    (error = stack_list_path(&list, stack)) < 0)
+		goto fail;
+
+	if (!git_path_exists(list.ptr) &&
+	    (error = git_futils_writebuffer(&empty, list.ptr, O_WRONLY | O_CREAT | O_EXCL, 0666)) < 0 &&
+	    error != GIT_EEXISTS) {
+		goto fail;
+	}
+
+	if ((error = git_reftable_stack_reload(stack, true)) < 0)
+		goto fail;
+
+	git_buf_dispose(&list);
+	*out = stack;
+	return 0;
+
+fail:
+	git_buf_dispose(&list);
+	git_reftable_stack_free(stack);
+	return error;
+}
+
+void git_reftable_stack_free(git_reftable_stack *stack)
+{
+	if (!stack)
+		return;
+
+	git_reftable_stack_tables_release(&stack->tables);
+	git__free(stack->path);
+	git__free(stack);
+}
+
+static git_reftable_table *stack_find_table(git_reftable_stack *stack, const char *name)
+{
+	git_reftable_table *table;
+	size_t i;
+
+	git_vector_foreach(&stack->tables, i, table) {
+		if (!strcmp(table->name, name))
+			return table;
+	}
+
+	return NULL;
+}
+
+static int stack_load(git_vector *out, git_reftable_stack *stack, const char *contents)
+{
+	git_buf path = GIT_BUF_INIT, name = GIT_BUF_INIT;
+	git_reftable_table *table;
+	const char *line = contents, *eol;
+	int error = 0;
+
+	while (*line) {
+		if ((eol = strchr(line, '\n')) == NULL)
+			eol = line + strlen(line);
+
+		if (eol > line) {
+			git_buf_clear(&name);
+			git_buf_put(&name, line, eol - line);
+
+			if (git_buf_oom(&name) || strchr(name.ptr, '/')) {
+				error = git_buf_oom(&name) ? -1 : reftable_error("invalid table name");
+				break;
+			}
+
+			if ((table = stack_find_table(stack, name.ptr)) != NULL) {
+				GIT_REFCOUNT_INC(table);
+			} else if ((error = git_buf_joinpath(&path, stack->path, name.ptr)) < 0 ||
+			           (error = git_reftable_table_open(&table, path.ptr, name.ptr)) < 0) {
+				break;
+			}
+
+			if ((error = git_vector_insert(out, table)) < 0) {
+				GIT_REFCOUNT_DEC(table, git_reftable_table_free);
+				break;
+			}
+		}
+
+		line = *eol ? eol + 1 : eol;
+	}
+
+	git_buf_dispose(&path);
+	git_buf_dispose(&name);
+	return error;
+}
+
+int git_reftable_stack_reload(git_reftable_stack *stack, bool force)
+{
+	git_buf list_path = GIT_BUF_INIT, contents = GIT_BUF_INIT;
+	git_vector tables = GIT_VECTOR_INIT;
+	int error, tries;
+
+	assert(stack);
+
+	if ((error = stack_list_path(&list_path, stack)) < 0)
+		return error;
+
+	error = git_futils_filestamp_check(&stack->stamp, list_path.ptr);
+
+	if (!force && error == 0)
+		goto done;
+
+	/*
+	 * A concurrent compaction may remove the tables we are about to
+	 * open; the list will have been replaced by then, so read it again.
+	 */
+	for (tries = 0; tries < 5; tries++) {
+		git_reftable_stack_tables_release(&tables);
+
+		if ((error = git_futils_readbuffer(&contents, list_path.ptr)) == GIT_ENOTFOUND) {
+			git_buf_clear(&contents);
+			error = 0;
+		} else if (error < 0) {
+			break;
+		}
+
+		if ((error = git_vector_init(&tables, 0, NULL)) < 0 ||
+		    (error = stack_load(&tables, stack, contents.ptr ? contents.ptr : "")) != GIT_ENOTFOUND)
+			break;
+	}
+
+	if (error < 0)
+		goto done;
+
+	git_vector_swap(&stack->tables, &tables);
+
+done:
+	if (error < 0)
+		memset(&stack->stamp, 0, sizeof(stack->stamp));
+
+	git_reftable_stack_tables_release(&tables);
+	git_buf_dispose(&list_path);
+	git_buf_dispose(&contents);
+	return error < 0 ? error : 0;
+}
+
+int git_reftable_stack_tables(git_vector *out, git_reftable_stack *stack)
+{
+	git_reftable_table *table;
+	size_t i;
+
+	assert(out && stack);
+
+	if (git_vector_init(out, stack->tables.length, NULL) < 0)
+		return -1;
+
+	for (i = stack->tables.length; i > 0; i--) {
+		table = git_vector_get(&stack->tables, i - 1);
+
+		if (git_vector_insert(out, table) < 0) {
+			git_reftable_stack_tables_release(out);
+			return -1;
+		}
+
+		GIT_REFCOUNT_INC(table);
+	}
+
+	return 0;
+}
+
+void git_reftable_stack_tables_release(git_vector *tables)
+{
+	git_reftable_table *table;
+	size_t i;
+
+	git_vector_foreach(tables, i, table)
+		GIT_REFCOUNT_DEC(table, git_reftable_table_free);
+
+	git_vector_free(tables);
+}
+
+uint64_t git_reftable_stack_next_update_index(git_reftable_stack *stack)
+{
+	git_reftable_table *last = git_vector_last(&stack->tables);
+
+	return last ? last->max_update_index + 1 : 1;
+}
+
+/*
+ * Merge `count` consecutive tables of the stack, starting at `start`,
+ * into a single one.  Deletions can only be dropped when nothing older
+ * remains below them.
+ */
+static int stack_merge(
+	git_reftable_table **out,
+	git_vector *stack_tables,
+	size_t start,
+	size_t count)
+{
+	git_reftable_merged_iter *refs = NULL;
+	git_reftable_writer *writer = NULL;
+	git_reftable_table *first, *last;
+	git_reftable_ref *ref;
+	git_reftable_log *log;
+	git_vector tables = GIT_VECTOR_INIT, logs = GIT_VECTOR_INIT;
+	git_buf contents = GIT_BUF_INIT;
+	bool with_deletions = start > 0;
+	size_t i;
+	int error;
+
+	first = git_vector_get(stack_tables, start);
+	last = git_vector_get(stack_tables, start + count - 1);
+
+	if ((error = git_vector_init(&tables, count, NULL)) < 0)
+		goto done;
+
+	for (i = start + count; i > start; i--)
+		if ((error = git_vector_insert(&tables, git_vector_get(stack_tables, i - 1))) < 0)
+			goto done;
+
+	if ((error = git_reftable_writer_new(&writer,
+			first->min_update_index, last->max_update_index)) < 0 ||
+	    (error = git_reftable_merged_iter_new(&refs, &tables, "", with_deletions)) < 0)
+		goto done;
+
+	while ((error = git_reftable_merged_iter_next(&ref, refs)) == 0)
+		if ((error = git_reftable_writer_add_ref(writer, ref)) < 0)
+			goto done;
+
+	if (error != GIT_ITEROVER ||
+	    (error = git_reftable_tables_read_logs(&logs, &tables, NULL, with_deletions)) < 0)
+		goto done;
+
+	git_vector_foreach(&logs, i, log)
+		if ((error = git_reftable_writer_add_log(writer, log)) < 0)
+			goto done;
+
+	if ((error = git_reftable_writer_finish(&contents, writer)) < 0)
+		goto done;
+
+	error = git_reftable_table_from_buffer(out, &contents, "");
+
+done:
+	git_reftable_logs_free(&logs);
+	git_reftable_merged_iter_free(refs);
+	git_reftable_writer_free(writer);
+	git_vector_free(&tables);
+	git_buf_dispose(&contents);
+	return error;
+}
+
+static int table_filename(git_buf *out, const git_reftable_table *table)
+{
+	git_buf_clear(out);
+
+	return git_buf_printf(out, "0x%012llx-0x%012llx-%08x.ref",
+		(unsigned long long)table->min_update_index,
+		(unsigned long long)table->max_update_index,
+		(uint32_t)crc32(0L, table->data, (uInt)table->size));
+}
+
+static int stack_write_table(
+	git_reftable_table **out,
+	git_reftable_stack *stack,
+	git_reftable_table *table)
+{
+	git_filebuf file = GIT_FILEBUF_INIT;
+	git_buf name = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	int error;
+
+	if ((error = table_filename(&name, table)) < 0 ||
+	    (error = git_buf_joinpath(&path, stack->path, name.ptr)) < 0 ||
+	    (error = git_filebuf_open(&file, path.ptr,
+			GIT_FILEBUF_FORCE | (stack->fsync ? GIT_FILEBUF_FSYNC : 0), 0444)) < 0 ||
+	    (error = git_filebuf_write(&file, table->data, table->size)) < 0 ||
+	    (error = git_filebuf_commit(&file)) < 0)
+		goto done;
+
+	error = git_reftable_table_open(out, path.ptr, name.ptr);
+
+done:
+	git_filebuf_cleanup(&file);
+	git_buf_dispose(&name);
+	git_buf_dispose(&path);
+	return error;
+}
+
+/*
+ * Pick the newest tables to merge so that, from the oldest to the
+ * newest, every table is at least REFTABLE_COMPACTION_FACTOR times
+ * bigger than all the tables above it.  This keeps the stack at a
+ * logarithmic number of tables while rewriting every ref a
+ * logarithmic number of times.
+ */
+static size_t suggest_compaction(git_vector *tables)
+{
+	git_reftable_table *table;
+	size_t start = tables->length, bytes = 0;
+
+	while (start > 0) {
+		table = git_vector_get(tables, start - 1);
+
+		if (bytes && table->size >= REFTABLE_COMPACTION_FACTOR * bytes)
+			break;
+
+		bytes += table->size;
+		start--;
+	}
+
+	return start;
+}
+
+static int stack_publish(
+	git_reftable_addition *addition,
+	git_vector *tables,
+	size_t start,
+	git_reftable_table *fresh)
+{
+	git_reftable_stack *stack = addition->stack;
+	git_reftable_table *table, *merged = NULL, *written = NULL;
+	git_vector obsolete = GIT_VECTOR_INIT;
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+	int error;
+
+	/* Merge the tail of the stack if there is more than one table in it */
+	if (start < tables->length - 1) {
+		if ((error = stack_merge(&merged, tables, start, tables->length - start)) < 0)
+			goto done;
+	} else if (start < tables->length) {
+		merged = git_vector_get(tables, start);
+		GIT_REFCOUNT_INC(merged);
+	}
+
+	if (merged && merged == fresh) {
+		if ((error = stack_write_table(&written, stack, merged)) < 0)
+			goto done;
+	} else if (merged) {
+		if ((error = stack_write_table(&written, stack, merged)) < 0)
+			goto done;
+
+		for (i = start; i < tables->length; i++) {
+			table = git_vector_get(tables, i);
+
+			if (table != fresh && (error = git_vector_insert(&obsolete, table)) < 0)
+				goto done;
+		}
+	}
+
+	for (i = 0; i < start; i++) {
+		table = git_vector_get(tables, i);
+		git_filebuf_printf(&addition->lock, "%s\n", table->name);
+	}
+
+	if (written)
+		git_filebuf_printf(&addition->lock, "%s\n", written->name);
+
+	if ((error = git_filebuf_commit(&addition->lock)) < 0)
+		goto done;
+
+	git_vector_foreach(&obsolete, i, table) {
+		if (git_buf_joinpath(&path, stack->path, table->name) == 0)
+			p_unlink(path.ptr);
+	}
+
+	error = git_reftable_stack_reload(stack, true);
+
+done:
+	if (merged)
+		GIT_REFCOUNT_DEC(merged, git_reftable_table_free);
+	if (written)
+		GIT_REFCOUNT_DEC(written, git_reftable_table_free);
+
+	git_vector_free(&obsolete);
+	git_buf_dispose(&path);
+	return error;
+}
+
+int git_reftable_addition_new(git_reftable_addition **out, git_reftable_stack *stack)
+{
+	git_reftable_addition *addition;
+	git_buf list = GIT_BUF_INIT;
+	int error;
+
+	assert(out && stack);
+
+	addition = git__calloc(1, sizeof(git_reftable_addition));
+	GIT_ERROR_CHECK_ALLOC(addition);
+
+	addition->stack = stack;
+
+	if ((error = stack_list_path(&list, stack)) < 0 ||
+	    (error = git_filebuf_open(&addition->lock, list.ptr,
+			stack->fsync ? GIT_FILEBUF_FSYNC : 0, 0666)) < 0 ||
+	    (error = git_reftable_stack_reload(stack, true)) < 0) {
+		git_reftable_addition_free(addition);
+		addition = NULL;
+	}
+
+	git_buf_dispose(&list);
+	*out = addition;
+	return error;
+}
+
+int git_reftable_addition_commit(git_reftable_addition *addition, git_buf *contents)
+{
+	git_reftable_table *fresh = NULL;
+	git_vector tables = GIT_VECTOR_INIT;
+	size_t start;
+	int error;
+
+	assert(addition && contents);
+
+	if ((error = git_reftable_table_from_buffer(&fresh, contents, "")) < 0 ||
+	    (error = git_vector_dup(&tables, &addition->stack->tables, NULL)) < 0 ||
+	    (error = git_vector_insert(&tables, fresh)) < 0)
+		goto done;
+
+	start = tables.length - 1;
+
+	if (addition->stack->auto_compact)
+		start = suggest_compaction(&tables);
+
+	error = stack_publish(addition, &tables, start, fresh);
+
+done:
+	if (fresh)
+		GIT_REFCOUNT_DEC(fresh, git_reftable_table_free);
+
+	git_vector_free(&tables);
+	return error;
+}
+
+void git_reftable_addition_free(git_reftable_addition *addition)
+{
+	if (!addition)
+		return;
+
+	git_filebuf_cleanup(&addition->lock);
+	git__free(addition);
+}
+
+int git_reftable_stack_compact_all(git_reftable_stack *stack)
+{
+	git_reftable_addition *addition;
+	int error;
+
+	assert(stack);
+
+	if ((error = git_reftable_addition_new(&addition, stack)) < 0)
+		return error;
+
+	if (stack->tables.length > 1)
+		error = stack_publish(addition, &stack->tables, 0, NULL);
+
+	git_reftable_addition_free(addition);
+	return error;
+}
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+#ifndef INCLUDE_reftable_h__
+#define INCLUDE_reftable_h__
+
+#include "common.h"
+
+#include "buffer.h"
+#include "filebuf.h"
+#include "fileops.h"
+#include "map.h"
+#include "vector.h"
+
+#include "git2/oid.h"
+
+/**
+ * Reftables store references and reflogs in immutable, sorted files
+ * that are stacked on top of each other.  Every table is made of
+ * blocks of prefix-compressed records with restart points so that a
+ * reader can binary search within a block, and an optional index that
+ * lets it find the right block with a handful of block reads.
+ *
+ * The format is the one described in git's
+ * Documentation/technical/reftable.txt (version 1, SHA-1 only).
+ */
+
+#define GIT_REFTABLE_DIR "reftable"
+#define GIT_REFTABLE_LIST_FILE "tables.list"
+
+#define GIT_REFTABLE_BLOCK_SIZE 4096
+#define GIT_REFTABLE_RESTART_INTERVAL 16
+
+#define GIT_REFTABLE_BLOCK_REF 'r'
+#define GIT_REFTABLE_BLOCK_LOG 'g'
+#define GIT_REFTABLE_BLOCK_INDEX 'i'
+
+typedef enum {
+	GIT_REFTABLE_REF_DELETION = 0,
+	GIT_REFTABLE_REF_VAL1 = 1,
+	GIT_REFTABLE_REF_VAL2 = 2,
+	GIT_REFTABLE_REF_SYMREF = 3,
+} git_reftable_ref_t;
+
+typedef enum {
+	GIT_REFTABLE_LOG_DELETION = 0,
+	GIT_REFTABLE_LOG_UPDATE = 1,
+} git_reftable_log_t;
+
+/** A reference record; `target` is only set for symbolic refs. */
+typedef struct {
+	git_buf name;
+	uint64_t update_index;
+	git_reftable_ref_t type;
+	git_oid value;
+	git_oid peeled;
+	git_buf target;
+} git_reftable_ref;
+
+#define GIT_REFTABLE_REF_INIT { GIT_BUF_INIT, 0, 0, {{0}}, {{0}}, GIT_BUF_INIT }
+
+/** A reflog record, keyed by the reference name and its update index. */
+typedef struct {
+	git_buf name;
+	uint64_t update_index;
+	git_reftable_log_t type;
+	git_oid old_id;
+	git_oid new_id;
+	git_buf committer_name;
+	git_buf committer_email;
+	uint64_t time;
+	int16_t tz_offset;
+	git_buf message;
+} git_reftable_log;
+
+#define GIT_REFTABLE_LOG_INIT { GIT_BUF_INIT, 0, 0, {{0}}, {{0}}, GIT_BUF_INIT, GIT_BUF_INIT, 0, 0, GIT_BUF_INIT }
+
+extern void git_reftable_ref_dispose(git_reftable_ref *ref);
+extern void git_reftable_log_dispose(git_reftable_log *log);
+
+/*
+ * Writing a single table.  Refs must be added in name order, followed
+ * by the logs in (name, descending update index) order.
+ */
+
+typedef struct git_reftable_writer git_reftable_writer;
+
+extern int git_reftable_writer_new(
+	git_reftable_writer **out,
+	uint64_t min_update_index,
+	uint64_t max_update_index);
+extern int git_reftable_writer_add_ref(
+	git_reftable_writer *w, const git_reftable_ref *ref);
+extern int git_reftable_writer_add_log(
+	git_reftable_writer *w, const git_reftable_log *log);
+extern int git_reftable_writer_finish(git_buf *out, git_reftable_writer *w);
+extern void git_reftable_writer_free(git_reftable_writer *w);
+
+/*
+ * Reading a single table.
+ */
+
+typedef struct git_reftable_table {
+	git_refcount rc;
+	git_map map;
+	git_buf contents;
+	const unsigned char *data;
+	size_t size;
+
+	uint32_t block_size;
+	uint64_t min_update_index;
+	uint64_t max_update_index;
+
+	uint64_t ref_index_position;
+	uint64_t log_position;
+	uint64_t log_index_position;
+	bool has_refs;
+	bool has_logs;
+
+	char name[GIT_FLEX_ARRAY];
+} git_reftable_table;
+
+extern int git_reftable_table_open(
+	git_reftable_table **out, const char *path, const char *name);
+extern int git_reftable_table_from_buffer(
+	git_reftable_table **out, git_buf *contents, const char *name);
+extern void git_reftable_table_free(git_reftable_table *table);
+
+/** A decoded block, either mapped from the table or inflated. */
+typedef struct {
+	const unsigned char *data;
+	git_buf inflated;
+	size_t header_off;
+	size_t len;
+	size_t full_len;
+	size_t restarts;
+	uint16_t restart_count;
+	char type;
+} git_reftable_block;
+
+/** Iterates over the refs or the logs of a single table. */
+typedef struct {
+	git_reftable_table *table;
+	git_reftable_block block;
+	size_t block_off;
+	size_t pos;
+	char type;
+	bool done;
+	git_buf key;
+	git_buf scratch;
+} git_reftable_table_iter;
+
+#define GIT_REFTABLE_TABLE_ITER_INIT { NULL, { NULL, GIT_BUF_INIT }, 0, 0, 0, 0, GIT_BUF_INIT, GIT_BUF_INIT }
+
+/**
+ * Position the iterator on the first ref whose name is not smaller
+ * than `name` (an empty name starts at the beginning of the table).
+ */
+extern int git_reftable_table_seek_ref(
+	git_reftable_table_iter *iter, git_reftable_table *table, const char *name);
+extern int git_reftable_table_next_ref(
+	git_reftable_ref *out, git_reftable_table_iter *iter);
+
+/** Position the iterator on the newest log entry of `name`. */
+extern int git_reftable_table_seek_log(
+	git_reftable_table_iter *iter, git_reftable_table *table, const char *name);
+extern int git_reftable_table_next_log(
+	git_reftable_log *out, git_reftable_table_iter *iter);
+
+extern void git_reftable_table_iter_dispose(git_reftable_table_iter *iter);
+
+/*
+ * A stack of tables, as listed (oldest first) in `tables.list`.
+ */
+
+typedef struct {
+	char *path;
+	git_vector tables;
+	git_futils_filestamp stamp;
+	int fsync;
+	int auto_compact;
+} git_reftable_stack;
+
+extern int git_reftable_stack_open(git_reftable_stack **out, const char *path);
+extern void git_reftable_stack_free(git_reftable_stack *stack);
+
+/** Re-read `tables.list` if it changed (or unconditionally, if `force`). */
+extern int git_reftable_stack_reload(git_reftable_stack *stack, bool force);
+
+/** Take a reference on every table of the stack, newest first. */
+extern int git_reftable_stack_tables(git_vector *out, git_reftable_stack *stack);
+extern void git_reftable_stack_tables_release(git_vector *tables);
+
+/** The update index the next appended table should use. */
+extern uint64_t git_reftable_stack_next_update_index(git_reftable_stack *stack);
+
+/** Look `name` up in a set of tables (newest first), deleted refs are not found. */
+extern int git_reftable_tables_read_ref(
+	git_reftable_ref *out, git_vector *tables, const char *name);
+
+/**
+ * Iterates over the refs of a set of tables (newest first), returning
+ * the newest record of every name.  Deletions are only returned when
+ * `with_deletions` is set.
+ */
+typedef struct {
+	git_vector tables;
+	git_reftable_table_iter *iters;
+	git_reftable_ref *records;
+	bool *valid;
+	size_t count;
+	git_reftable_ref current;
+	bool with_deletions;
+} git_reftable_merged_iter;
+
+extern int git_reftable_merged_iter_new(
+	git_reftable_merged_iter **out,
+	git_vector *tables,
+	const char *name,
+	bool with_deletions);
+extern int git_reftable_merged_iter_next(
+	git_reftable_ref **out, git_reftable_merged_iter *iter);
+extern void git_reftable_merged_iter_free(git_reftable_merged_iter *iter);
+
+/**
+ * Read the log entries of `name` (or of every ref, when `name` is
+ * NULL) from a set of tables (newest first), in the order they would
+ * be written to a table.  Deletions are only returned when
+ * `with_deletions` is set.
+ */
+extern int git_reftable_tables_read_logs(
+	git_vector *out, git_vector *tables, const char *name, bool with_deletions);
+extern void git_reftable_logs_free(git_vector *logs);
+
+/**
+ * Appending tables: an addition holds the `tables.list.lock` until it
+ * is committed or freed.
+ */
+typedef struct {
+	git_reftable_stack *stack;
+	git_filebuf lock;
+} git_reftable_addition;
+
+extern int git_reftable_addition_new(
+	git_reftable_addition **out, git_reftable_stack *stack);
+extern int git_reftable_addition_commit(
+	git_reftable_addition *addition, git_buf *table);
+extern void git_reftable_addition_free(git_reftable_addition *addition);
+
+/** Merge every table of the stack into a single one. */
+extern int git_reftable_stack_compact_all(git_reftable_stack *stack);
+
+#endif
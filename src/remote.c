@@ -11,6 +11,7 @@
 #include "git2/types.h"
 #include "git2/oid.h"
 #include "git2/net.h"
+#include "git2/transaction.h"
 
 #include "config.h"
 #include "repository.h"
@@ -19,6 +20,7 @@
 #include "refspec.h"
 #include "fetchhead.h"
 #include "push.h"
+#include "strmap.h"
 
 #define CONFIG_URL_FMT "remote.%s.url"
 #define CONFIG_PUSHURL_FMT "remote.%s.pushurl"
@@ -1353,6 +1355,91 @@ cleanup:
 	return error;
 }
 
+/*
+ * The tips are committed in batches, as every locked reference can
+ * hold a lockfile open until its transaction is committed.
+ */
+#define TIP_UPDATE_BATCH 256
+
+typedef struct {
+	git_oid old;
+	git_oid new;
+	char refname[GIT_FLEX_ARRAY];
+} tip_update;
+
+/*
+ * Lock and set a tip in the transaction; a refname seen twice keeps
+ * its first old value and takes the last new one.
+ */
+static int queue_tip_update(
+	git_transaction *tx,
+	git_vector *updates,
+	git_strmap *names,
+	const char *refname,
+	const git_oid *old,
+	const git_oid *new,
+	const char *log_message)
+{
+	tip_update *update;
+	size_t len = strlen(refname), alloclen;
+	int error;
+
+	if ((update = git_strmap_get(names, refname)) == NULL) {
+		GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, sizeof(tip_update), len);
+		GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
+
+		update = git__calloc(1, alloclen);
+		GIT_ERROR_CHECK_ALLOC(update);
+
+		memcpy(update->refname, refname, len);
+		git_oid_cpy(&update->old, old);
+
+		if ((error = git_vector_insert(updates, update)) < 0) {
+			git__free(update);
+			return error;
+		}
+
+		if ((error = git_strmap_set(names, update->refname, update)) < 0 ||
+		    (error = git_transaction_lock_ref(tx, refname)) < 0)
+			return error;
+	}
+
+	git_oid_cpy(&update->new, new);
+
+	return git_transaction_set_target(tx, refname, new, NULL, log_message);
+}
+
+/* Commit a batch of tips and tell the caller about them */
+static int commit_tip_updates(
+	git_transaction **tx,
+	git_vector *updates,
+	git_strmap *names,
+	const git_remote_callbacks *callbacks)
+{
+	tip_update *update;
+	size_t i;
+	int error;
+
+	if ((error = git_transaction_commit(*tx)) < 0)
+		return error;
+
+	if (callbacks && callbacks->update_tips != NULL) {
+		git_vector_foreach(updates, i, update) {
+			if ((error = callbacks->update_tips(update->refname,
+					&update->old, &update->new, callbacks->payload)) < 0)
+				return error;
+		}
+	}
+
+	git_transaction_free(*tx);
+	*tx = NULL;
+
+	git_strmap_clear(names);
+	git_vector_free_deep(updates);
+
+	return 0;
+}
+
 static int update_tips_for_spec(
 		git_remote *remote,
 		const git_remote_callbacks *callbacks,
@@ -1368,9 +1455,10 @@ static int update_tips_for_spec(
 	git_oid old;
 	git_odb *odb;
 	git_remote_head *head;
-	git_reference *ref;
 	git_refspec tagspec;
-	git_vector update_heads;
+	git_vector update_heads, updates = GIT_VECTOR_INIT;
+	git_strmap *names = NULL;
+	git_transaction *tx = NULL;
 
 	assert(remote);
 
@@ -1384,6 +1472,9 @@ static int update_tips_for_spec(
 	if (git_vector_init(&update_heads, 16, NULL) < 0)
 		return -1;
 
+	if (git_strmap_new(&names) < 0)
+		goto on_error;
+
 	for (; i < refs->length; ++i) {
 		head = git_vector_get(refs, i);
 		autotag = 0;
@@ -1444,39 +1535,44 @@ static int update_tips_for_spec(
 
 			if (autotag && git_vector_insert(&update_heads, head) < 0)
 				goto on_error;
+		} else if (autotag) {
+			/* In autotag mode, don't overwrite any locally-existing tags */
+			continue;
 		}
 
 		if (!git_oid__cmp(&old, &head->oid))
 			continue;
 
-		/* In autotag mode, don't overwrite any locally-existing tags */
-		error = git_reference_create(&ref, remote->repo, refname.ptr, &head->oid, !autotag,
-				log_message);
-
-		if (error == GIT_EEXISTS)
-			continue;
-
-		if (error < 0)
+		if (!tx && git_transaction_new(&tx, remote->repo) < 0)
 			goto on_error;
 
-		git_reference_free(ref);
+		if (queue_tip_update(tx, &updates, names, refname.ptr, &old, &head->oid, log_message) < 0)
+			goto on_error;
 
-		if (callbacks && callbacks->update_tips != NULL) {
-			if (callbacks->update_tips(refname.ptr, &old, &head->oid, callbacks->payload) < 0)
-				goto on_error;
-		}
+		if (updates.length >= TIP_UPDATE_BATCH &&
+		    commit_tip_updates(&tx, &updates, names, callbacks) < 0)
+			goto on_error;
 	}
 
+	if (tx && commit_tip_updates(&tx, &updates, names, callbacks) < 0)
+		goto on_error;
+
 	if (update_fetchhead &&
 	    (error = git_remote_write_fetchhead(remote, spec, &update_heads)) < 0)
 		goto on_error;
 
+	git_strmap_free(names);
+	git_vector_free_deep(&updates);
 	git_vector_free(&update_heads);
 	git_refspec__dispose(&tagspec);
 	git_buf_dispose(&refname);
 	return 0;
 
 on_error:
+	if (tx)
+		git_transaction_free(tx);
+	git_strmap_free(names);
+	git_vector_free_deep(&updates);
 	git_vector_free(&update_heads);
 	git_refspec__dispose(&tagspec);
 	git_buf_dispose(&refname);
@@ -11,6 +11,7 @@
 
 #include "git2/object.h"
 #include "git2/sys/repository.h"
+#include "git2/sys/fsmonitor.h"
 
 #include "common.h"
 #include "commit.h"
@@ -71,6 +72,7 @@ static int check_repositoryformatversion(git_config *config);
 #define GIT_BRANCH_MASTER "master"
 
 #define GIT_REPO_VERSION 0
+#define GIT_REPO_MAX_VERSION 1
 
 git_buf git_repository__reserved_names_win32[] = {
 	{ DOT_GIT, 0, CONST_STRLEN(DOT_GIT) },
@@ -165,6 +167,10 @@ void git_repository_free(git_repository *repo)
 	git_diff_driver_registry_free(repo->diff_drivers);
 	repo->diff_drivers = NULL;
 
+	if (repo->fsmonitor && repo->fsmonitor->free)
+		repo->fsmonitor->free(repo->fsmonitor);
+	repo->fsmonitor = NULL;
+
 	for (i = 0; i < repo->reserved_names.size; i++)
 		git_buf_dispose(git_array_get(repo->reserved_names, i));
 	git_array_clear(repo->reserved_names);
@@ -1212,6 +1218,28 @@ void git_repository_set_index(git_repository *repo, git_index *index)
 	set_index(repo, index);
 }
 
+int git_fsmonitor_init(git_fsmonitor *fsmonitor, unsigned int version)
+{
+	GIT_INIT_STRUCTURE_FROM_TEMPLATE(
+		fsmonitor, version, git_fsmonitor, GIT_FSMONITOR_INIT);
+	return 0;
+}
+
+int git_repository_set_fsmonitor(git_repository *repo, git_fsmonitor *fsmonitor)
+{
+	assert(repo);
+
+	if (fsmonitor)
+		GIT_ERROR_CHECK_VERSION(fsmonitor, GIT_FSMONITOR_VERSION, "git_fsmonitor");
+
+	if (repo->fsmonitor && repo->fsmonitor != fsmonitor &&
+	    repo->fsmonitor->free)
+		repo->fsmonitor->free(repo->fsmonitor);
+
+	repo->fsmonitor = fsmonitor;
+	return 0;
+}
+
 int git_repository_set_namespace(git_repository *repo, const char *namespace)
 {
 	git__free(repo->namespace);
@@ -1331,6 +1359,57 @@ bool git_repository__reserved_names(
 }
 #endif
 
+static const char *builtin_extensions[] = {
+	"noop",
+	"refstorage",
+};
+
+/*
+ * Version 1 repositories may only use the extensions we understand.  Like
+ * git, only the repository's own configuration can enable extensions.
+ */
+static int check_extensions(git_config *config)
+{
+	git_config *local = NULL;
+	git_config_iterator *iter;
+	git_config_entry *entry;
+	size_t i;
+	int error;
+
+	if ((error = git_config_open_level(&local, config, GIT_CONFIG_LEVEL_LOCAL)) < 0) {
+		if (error != GIT_ENOTFOUND)
+			return error;
+
+		git_error_clear();
+		return 0;
+	}
+
+	if ((error = git_config_iterator_glob_new(&iter, local, "^extensions\\.")) < 0) {
+		git_config_free(local);
+		return error;
+	}
+
+	while ((error = git_config_next(&entry, iter)) == 0) {
+		const char *name = entry->name + strlen("extensions.");
+
+		for (i = 0; i < ARRAY_SIZE(builtin_extensions); i++) {
+			if (!strcasecmp(name, builtin_extensions[i]))
+				break;
+		}
+
+		if (i == ARRAY_SIZE(builtin_extensions)) {
+			git_error_set(GIT_ERROR_REPOSITORY,
+				"unsupported extension name %s", name);
+			error = -1;
+			break;
+		}
+	}
+
+	git_config_iterator_free(iter);
+	git_config_free(local);
+	return error == GIT_ITEROVER ? 0 : error;
+}
+
 static int check_repositoryformatversion(git_config *config)
 {
 	int version, error;
@@ -1343,13 +1422,16 @@ static int check_repositoryformatversion(git_config *config)
 	if (error < 0)
 		return -1;
 
-	if (GIT_REPO_VERSION < version) {
+	if (GIT_REPO_MAX_VERSION < version) {
 		git_error_set(GIT_ERROR_REPOSITORY,
 			"unsupported repository version %d. Only versions up to %d are supported.",
-			version, GIT_REPO_VERSION);
+			version, GIT_REPO_MAX_VERSION);
 		return -1;
 	}
 
+	if (version >= 1)
+		return check_extensions(config);
+
 	return 0;
 }
 
@@ -15,6 +15,7 @@
 #include "git2/repository.h"
 #include "git2/object.h"
 #include "git2/config.h"
+#include "git2/sys/fsmonitor.h"
 
 #include "array.h"
 #include "cache.h"
@@ -51,6 +52,12 @@ typedef enum {
 	GIT_CVAR_PROTECTHFS,    /* core.protectHFS */
 	GIT_CVAR_PROTECTNTFS,   /* core.protectNTFS */
 	GIT_CVAR_FSYNCOBJECTFILES, /* core.fsyncObjectFiles */
+	GIT_CVAR_INDEXRECORDEOIE, /* index.recordEndOfIndexEntries */
+	GIT_CVAR_INDEXRECORDIEOT, /* index.recordOffsetTable */
+	GIT_CVAR_UNTRACKEDCACHE, /* core.untrackedCache */
+	GIT_CVAR_SPLITINDEX,    /* core.splitIndex */
+	GIT_CVAR_SPLITINDEXMAXCHANGE, /* splitIndex.maxPercentChange */
+	GIT_CVAR_MMAPPACKEDREFS, /* core.mmapPackedRefs */
 	GIT_CVAR_CACHE_MAX
 } git_cvar_cached;
 
@@ -116,6 +123,24 @@ typedef enum {
 	GIT_PROTECTNTFS_DEFAULT = GIT_CVAR_FALSE,
 	/* core.fsyncObjectFiles */
 	GIT_FSYNCOBJECTFILES_DEFAULT = GIT_CVAR_FALSE,
+	/* index.recordEndOfIndexEntries */
+	GIT_INDEXRECORDEOIE_DEFAULT = GIT_CVAR_FALSE,
+	/* index.recordOffsetTable */
+	GIT_INDEXRECORDIEOT_DEFAULT = GIT_CVAR_FALSE,
+	/* core.untrackedCache: false, true, 'keep' */
+	GIT_UNTRACKEDCACHE_FALSE = GIT_CVAR_FALSE,
+	GIT_UNTRACKEDCACHE_TRUE = GIT_CVAR_TRUE,
+	GIT_UNTRACKEDCACHE_KEEP = 2,
+	GIT_UNTRACKEDCACHE_DEFAULT = GIT_UNTRACKEDCACHE_KEEP,
+	/* core.splitIndex: false, true or unset to keep the index as it is */
+	GIT_SPLITINDEX_FALSE = GIT_CVAR_FALSE,
+	GIT_SPLITINDEX_TRUE = GIT_CVAR_TRUE,
+	GIT_SPLITINDEX_UNSET = 2,
+	GIT_SPLITINDEX_DEFAULT = GIT_SPLITINDEX_UNSET,
+	/* splitIndex.maxPercentChange */
+	GIT_SPLITINDEXMAXCHANGE_DEFAULT = 20,
+	/* core.mmapPackedRefs */
+	GIT_MMAPPACKEDREFS_DEFAULT = GIT_CVAR_FALSE,
 } git_cvar_value;
 
 /* internal repository init flags */
@@ -135,6 +160,7 @@ struct git_repository {
 	git_cache objects;
 	git_attr_cache *attrcache;
 	git_diff_driver_registry *diff_drivers;
+	git_fsmonitor *fsmonitor;
 
 	char *gitlink;
 	char *gitdir;
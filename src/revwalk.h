@@ -11,6 +11,7 @@
 
 #include "git2/revwalk.h"
 #include "oidmap.h"
+#include "commit_graph.h"
 #include "commit_list.h"
 #include "pqueue.h"
 #include "pool.h"
@@ -25,6 +26,9 @@ struct git_revwalk {
 	git_oidmap *commits;
 	git_pool commit_pool;
 
+	/* the odb's commit-graph, looked up on the first parse */
+	git_commit_graph_file *commit_graph;
+
 	git_commit_list *iterator_topo;
 	git_commit_list *iterator_rand;
 	git_commit_list *iterator_reverse;
@@ -34,6 +38,7 @@ struct git_revwalk {
 	int (*enqueue)(git_revwalk *, git_commit_list_node *);
 
 	unsigned walking:1,
+		commit_graph_checked: 1,
 		first_parent: 1,
 		did_hide: 1,
 		did_push: 1,
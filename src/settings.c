@@ -22,6 +22,7 @@
 #include "global.h"
 #include "object.h"
 #include "odb.h"
+#include "pack.h"
 #include "refs.h"
 #include "index.h"
 #include "transports/smart.h"
@@ -56,6 +57,7 @@ int git_libgit2_features(void)
 /* Declarations for tuneable settings */
 extern size_t git_mwindow__window_size;
 extern size_t git_mwindow__mapped_limit;
+extern int git_mwindow__full_mmap;
 extern size_t git_indexer__max_objects;
 extern bool git_disable_pack_keep_file_checks;
 
@@ -284,6 +286,55 @@ int git_libgit2_opts(int key, ...)
 		git_disable_pack_keep_file_checks = (va_arg(ap, int) != 0);
 		break;
 
+	case GIT_OPT_GET_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+
+			git_cache_stats(hits, misses, evictions);
+		}
+		break;
+
+	case GIT_OPT_RESET_CACHE_STATS:
+		git_cache_stats_reset();
+		break;
+
+	case GIT_OPT_ENABLE_PACK_FULL_MMAP:
+		git_mwindow__full_mmap = (va_arg(ap, int) != 0);
+		break;
+
+	case GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE:
+		git_pack_cache_set_limit(va_arg(ap, size_t));
+		break;
+
+	case GIT_OPT_GET_DELTA_BASE_CACHE_MAX_SIZE:
+		*(va_arg(ap, size_t *)) = git_pack_cache_limit();
+		break;
+
+	case GIT_OPT_GET_DELTA_BASE_CACHE_STATS:
+		{
+			size_t *hits = va_arg(ap, size_t *);
+			size_t *misses = va_arg(ap, size_t *);
+			size_t *evictions = va_arg(ap, size_t *);
+			size_t *used = va_arg(ap, size_t *);
+
+			git_pack_cache_stats(hits, misses, evictions, used);
+		}
+		break;
+
+	case GIT_OPT_RESET_DELTA_BASE_CACHE_STATS:
+		git_pack_cache_stats_reset();
+		break;
+
+	case GIT_OPT_SET_ODB_REFRESH_INTERVAL:
+		git_odb__refresh_interval = va_arg(ap, int);
+		break;
+
+	case GIT_OPT_GET_ODB_REFRESH_INTERVAL:
+		*(va_arg(ap, int *)) = git_odb__refresh_interval;
+		break;
+
 	default:
 		git_error_set(GIT_ERROR_INVALID, "invalid option key");
 		error = -1;
@@ -282,41 +282,42 @@ int git_transaction_set_reflog(git_transaction *tx, const char *refname, const g
 	return 0;
 }
 
-static int update_target(git_refdb *db, transaction_node *node)
+static int prepare_update(git_refdb_update *update, transaction_node *node)
 {
-	git_reference *ref;
-	int error, update_reflog;
+	git_reference *ref = NULL;
+
+	update->payload = node->payload;
 
 	if (node->ref_type == GIT_REFERENCE_DIRECT) {
 		ref = git_reference__alloc(node->name, &node->target.id, NULL);
 	} else if (node->ref_type == GIT_REFERENCE_SYMBOLIC) {
 		ref = git_reference__alloc_symbolic(node->name, node->target.symbolic);
 	} else {
-		abort();
+		/* locked but not updated */
+		return 0;
 	}
 
 	GIT_ERROR_CHECK_ALLOC(ref);
-	update_reflog = node->reflog == NULL;
+
+	update->ref = ref;
 
 	if (node->remove) {
-		error =  git_refdb_unlock(db, node->payload, 2, false, ref, NULL, NULL);
-	} else if (node->ref_type == GIT_REFERENCE_DIRECT) {
-		error = git_refdb_unlock(db, node->payload, true, update_reflog, ref, node->sig, node->message);
-	} else if (node->ref_type == GIT_REFERENCE_SYMBOLIC) {
-		error = git_refdb_unlock(db, node->payload, true, update_reflog, ref, node->sig, node->message);
+		update->success = 2;
 	} else {
-		abort();
+		update->success = true;
+		update->update_reflog = node->reflog == NULL;
+		update->sig = node->sig;
+		update->message = node->message;
 	}
 
-	git_reference_free(ref);
-	node->committed = true;
-
-	return error;
+	return 0;
 }
 
 int git_transaction_commit(git_transaction *tx)
 {
+	git_refdb_update *updates;
 	transaction_node *node;
+	size_t count = 0, i;
 	int error = 0;
 
 	assert(tx);
@@ -333,14 +334,38 @@ int git_transaction_commit(git_transaction *tx)
 			if ((error = tx->db->backend->reflog_write(tx->db->backend, node->reflog)) < 0)
 				return error;
 		}
+	});
 
-		if (node->ref_type != GIT_REFERENCE_INVALID) {
-			if ((error = update_target(tx->db, node)) < 0)
-				return error;
-		}
+	updates = git__calloc(max(git_strmap_size(tx->locks), 1), sizeof(git_refdb_update));
+	GIT_ERROR_CHECK_ALLOC(updates);
+
+	git_strmap_foreach_value(tx->locks, node, {
+		if (node->committed)
+			continue;
+
+		if ((error = prepare_update(&updates[count], node)) < 0)
+			goto cleanup;
+
+		count++;
 	});
 
-	return 0;
+	/*
+	 * Every reference is released at once, including the ones which
+	 * were locked but not updated, so that the backend can apply the
+	 * whole transaction together.
+	 */
+	git_strmap_foreach_value(tx->locks, node, {
+		node->committed = true;
+	});
+
+	error = git_refdb_unlock_many(tx->db, updates, count);
+
+cleanup:
+	for (i = 0; i < count; i++)
+		git_reference_free((git_reference *)updates[i].ref);
+
+	git__free(updates);
+	return error;
 }
 
 void git_transaction_free(git_transaction *tx)
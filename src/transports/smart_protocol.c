@@ -1021,6 +1021,7 @@ int git_smart__push(git_transport *transport, git_push *push, const git_remote_c
 	unsigned int i;
 
 	packbuilder_payload.pb = push->pb;
+	git_packbuilder_set_ofs_delta(push->pb, t->caps.ofs_delta);
 
 	if (cbs && cbs->push_transfer_progress) {
 		packbuilder_payload.cb = cbs->push_transfer_progress;
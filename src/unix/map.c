@@ -72,5 +72,28 @@ int p_munmap(git_map *map)
 	return 0;
 }
 
+void p_madvise(git_map *map, int advice)
+{
+	int madv;
+
+	assert(map != NULL);
+
+	switch (advice) {
+	case GIT_MADV_RANDOM:
+		madv = POSIX_MADV_RANDOM;
+		break;
+	case GIT_MADV_SEQUENTIAL:
+		madv = POSIX_MADV_SEQUENTIAL;
+		break;
+	case GIT_MADV_WILLNEED:
+		madv = POSIX_MADV_WILLNEED;
+		break;
+	default:
+		madv = POSIX_MADV_NORMAL;
+	}
+
+	(void)posix_madvise(map->data, map->len, madv);
+}
+
 #endif
 
@@ -0,0 +1,871 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#include "untracked-cache.h"
+
+#ifndef GIT_WIN32
+# include <sys/utsname.h>
+#endif
+
+#include "bitmap.h"
+#include "fileops.h"
+#include "odb.h"
+#include "varint.h"
+
+/* Size of the stat data on disk */
+#define UNTRACKED_CACHE_STAT_SIZE (9 * sizeof(uint32_t))
+
+/* Directories are nested at most this deep on disk */
+#define UNTRACKED_CACHE_MAX_DEPTH 4096
+
+static int dir_cmp(const void *a, const void *b)
+{
+	const git_untracked_cache_dir *dir_a = a, *dir_b = b;
+
+	return strcmp(dir_a->name, dir_b->name);
+}
+
+static void dir_clear_untracked(git_untracked_cache_dir *dir)
+{
+	size_t i;
+	char *name;
+
+	git_vector_foreach(&dir->untracked, i, name)
+		git__free(name);
+
+	git_vector_clear(&dir->untracked);
+}
+
+static void dir_free(git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	if (!dir)
+		return;
+
+	git_vector_foreach(&dir->dirs, i, child)
+		dir_free(child);
+
+	dir_clear_untracked(dir);
+	git_vector_free(&dir->untracked);
+	git_vector_free(&dir->dirs);
+	git__free(dir);
+}
+
+static int dir_new(git_untracked_cache_dir **out, const char *name, size_t name_len)
+{
+	git_untracked_cache_dir *dir;
+	size_t alloclen;
+
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, sizeof(git_untracked_cache_dir), name_len);
+	GIT_ERROR_CHECK_ALLOC_ADD(&alloclen, alloclen, 1);
+
+	dir = git__calloc(1, alloclen);
+	GIT_ERROR_CHECK_ALLOC(dir);
+
+	memcpy(dir->name, name, name_len);
+
+	if (git_vector_init(&dir->untracked, 0, NULL) < 0 ||
+	    git_vector_init(&dir->dirs, 0, dir_cmp) < 0) {
+		dir_free(dir);
+		return -1;
+	}
+
+	*out = dir;
+	return 0;
+}
+
+static int dir_find_child(
+	size_t *out, git_untracked_cache_dir *dir, const char *name, size_t name_len)
+{
+	size_t lo = 0, hi = dir->dirs.length, mid;
+	git_untracked_cache_dir *child;
+	int cmp;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		child = dir->dirs.contents[mid];
+
+		if ((cmp = strncmp(child->name, name, name_len)) == 0 &&
+		    child->name[name_len] != '\0')
+			cmp = 1;
+
+		if (cmp == 0) {
+			*out = mid;
+			return 0;
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*out = lo;
+	return GIT_ENOTFOUND;
+}
+
+static void dir_invalidate(git_untracked_cache *cache, git_untracked_cache_dir *dir)
+{
+	if (!dir->valid && !dir->untracked.length)
+		return;
+
+	dir->valid = 0;
+	dir->check_only = 0;
+	dir_clear_untracked(dir);
+
+	cache->dirty = 1;
+}
+
+/*
+ * Find the record of the directory at `path`, creating it and its
+ * parents when `create` is set.
+ */
+static int dir_lookup(
+	git_untracked_cache_dir **out,
+	git_untracked_cache *cache,
+	const char *path,
+	bool create)
+{
+	git_untracked_cache_dir *dir, *child;
+	const char *end;
+	size_t pos;
+	int error;
+
+	*out = NULL;
+
+	if (!cache->root) {
+		if (!create)
+			return GIT_ENOTFOUND;
+
+		if ((error = dir_new(&cache->root, "", 0)) < 0)
+			return error;
+	}
+
+	dir = cache->root;
+
+	while (*path) {
+		if ((end = strchr(path, '/')) == NULL)
+			end = path + strlen(path);
+
+		if (dir_find_child(&pos, dir, path, end - path) == 0) {
+			dir = dir->dirs.contents[pos];
+		} else if (!create) {
+			return GIT_ENOTFOUND;
+		} else {
+			if ((error = dir_new(&child, path, end - path)) < 0)
+				return error;
+
+			if ((error = git_vector_insert(&dir->dirs, child)) < 0) {
+				dir_free(child);
+				return error;
+			}
+
+			/* keep the directories sorted as we insert */
+			memmove(&dir->dirs.contents[pos + 1], &dir->dirs.contents[pos],
+				(dir->dirs.length - pos - 1) * sizeof(void *));
+			dir->dirs.contents[pos] = child;
+
+			dir = child;
+		}
+
+		path = *end ? end + 1 : end;
+	}
+
+	*out = dir;
+	return 0;
+}
+
+int git_untracked_cache_new(git_untracked_cache **out, const char *ident)
+{
+	git_untracked_cache *cache;
+
+	cache = git__calloc(1, sizeof(git_untracked_cache));
+	GIT_ERROR_CHECK_ALLOC(cache);
+
+	git_buf_init(&cache->ident, 0);
+	git_buf_put(&cache->ident, ident, strlen(ident) + 1);
+
+	cache->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+	cache->exclude_per_dir = git__strdup(".gitignore");
+	cache->dirty = 1;
+
+	if (git_buf_oom(&cache->ident) || !cache->exclude_per_dir) {
+		git_untracked_cache_free(cache);
+		git_error_set_oom();
+		return -1;
+	}
+
+	*out = cache;
+	return 0;
+}
+
+void git_untracked_cache_free(git_untracked_cache *cache)
+{
+	if (!cache)
+		return;
+
+	dir_free(cache->root);
+	git_buf_dispose(&cache->ident);
+	git__free(cache->exclude_per_dir);
+	git__free(cache);
+}
+
+void git_untracked_cache_reset(git_untracked_cache *cache)
+{
+	if (!cache || !cache->root)
+		return;
+
+	dir_free(cache->root);
+	cache->root = NULL;
+	cache->dirty = 1;
+}
+
+void git_untracked_cache_invalidate_path(git_untracked_cache *cache, const char *path)
+{
+	git_untracked_cache_dir *dir;
+	const char *end;
+	size_t pos;
+
+	if (!cache || !(dir = cache->root))
+		return;
+
+	/* every directory up to the path's own may have listed it */
+	dir_invalidate(cache, dir);
+
+	while ((end = strchr(path, '/')) != NULL) {
+		if (dir_find_child(&pos, dir, path, end - path) < 0)
+			return;
+
+		dir = dir->dirs.contents[pos];
+		dir_invalidate(cache, dir);
+
+		path = end + 1;
+	}
+}
+
+git_untracked_cache_dir *git_untracked_cache_get(
+	git_untracked_cache *cache, const char *path)
+{
+	git_untracked_cache_dir *dir;
+
+	/* git only looks for any untracked file in directories it checks */
+	if (!cache || dir_lookup(&dir, cache, path, false) < 0 ||
+	    !dir->valid || dir->check_only)
+		return NULL;
+
+	return dir;
+}
+
+static void dir_invalidate_all(git_untracked_cache *cache, git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i;
+
+	dir_invalidate(cache, dir);
+
+	git_vector_foreach(&dir->dirs, i, child)
+		dir_invalidate_all(cache, child);
+}
+
+int git_untracked_cache_set_exclude_id(
+	git_untracked_cache *cache,
+	const char *path,
+	const git_oid *exclude_id)
+{
+	git_untracked_cache_dir *dir;
+	int error;
+
+	/* directories without an ignore file need no record for it */
+	if ((error = dir_lookup(&dir, cache, path,
+			!git_oid_iszero(exclude_id))) == GIT_ENOTFOUND)
+		return 0;
+	else if (error < 0)
+		return error;
+
+	if (git_oid_equal(&dir->exclude_id, exclude_id))
+		return 0;
+
+	/* the rules of the subdirectories changed with it */
+	git_oid_cpy(&dir->exclude_id, exclude_id);
+	dir_invalidate_all(cache, dir);
+	cache->dirty = 1;
+
+	return 0;
+}
+
+int git_untracked_cache_set(
+	git_untracked_cache *cache,
+	const char *path,
+	const git_untracked_cache_stat *st,
+	git_vector *untracked)
+{
+	git_untracked_cache_dir *dir;
+	int error;
+
+	/* records of git's that hide empty directories cannot be mixed in */
+	if (cache->dir_flags != GIT_UNTRACKED_CACHE_DIR_FLAGS) {
+		git_untracked_cache_reset(cache);
+		cache->dir_flags = GIT_UNTRACKED_CACHE_DIR_FLAGS;
+	}
+
+	if ((error = dir_lookup(&dir, cache, path, true)) < 0)
+		return error;
+
+	dir_clear_untracked(dir);
+	git_vector_swap(&dir->untracked, untracked);
+
+	memcpy(&dir->stat, st, sizeof(git_untracked_cache_stat));
+	dir->valid = 1;
+	dir->check_only = 0;
+
+	cache->dirty = 1;
+
+	return 0;
+}
+
+void git_untracked_cache_stat_init(git_untracked_cache_stat *out, const struct stat *st)
+{
+	memset(out, 0, sizeof(git_untracked_cache_stat));
+
+	out->ctime_seconds = (uint32_t)st->st_ctime;
+	out->mtime_seconds = (uint32_t)st->st_mtime;
+#if defined(GIT_USE_NSEC)
+	out->ctime_nanoseconds = (uint32_t)st->st_ctime_nsec;
+	out->mtime_nanoseconds = (uint32_t)st->st_mtime_nsec;
+#endif
+	out->dev = (uint32_t)st->st_dev;
+	out->ino = (uint32_t)st->st_ino;
+	out->uid = (uint32_t)st->st_uid;
+	out->gid = (uint32_t)st->st_gid;
+	out->size = (uint32_t)st->st_size;
+}
+
+bool git_untracked_cache_stat_equal(
+	const git_untracked_cache_stat *a, const git_untracked_cache_stat *b)
+{
+	/* like git, the device is not compared */
+	return a->ctime_seconds == b->ctime_seconds &&
+		a->ctime_nanoseconds == b->ctime_nanoseconds &&
+		a->mtime_seconds == b->mtime_seconds &&
+		a->mtime_nanoseconds == b->mtime_nanoseconds &&
+		a->ino == b->ino &&
+		a->uid == b->uid &&
+		a->gid == b->gid &&
+		a->size == b->size;
+}
+
+int git_untracked_cache_exclude_id(git_oid *out, const char *path)
+{
+	int error;
+
+	if ((error = git_odb_hashfile(out, path, GIT_OBJECT_BLOB)) == GIT_ENOTFOUND) {
+		git_error_clear();
+		memset(out, 0, sizeof(git_oid));
+		error = 0;
+	}
+
+	return error;
+}
+
+static int check_exclude(
+	git_untracked_cache *cache,
+	bool *changed,
+	git_untracked_cache_stat *cached_st,
+	git_oid *cached_id,
+	const char *path)
+{
+	git_untracked_cache_stat current;
+	git_oid id = {{0}};
+	struct stat st;
+	int error;
+
+	if (path && p_stat(path, &st) == 0)
+		git_untracked_cache_stat_init(&current, &st);
+	else
+		memset(&current, 0, sizeof(current));
+
+	if (git_untracked_cache_stat_equal(cached_st, &current))
+		return 0;
+
+	if (path && (error = git_untracked_cache_exclude_id(&id, path)) < 0)
+		return error;
+
+	if (!git_oid_equal(&id, cached_id))
+		*changed = true;
+
+	memcpy(cached_st, &current, sizeof(current));
+	git_oid_cpy(cached_id, &id);
+	cache->dirty = 1;
+
+	return 0;
+}
+
+int git_untracked_cache_check_excludes(
+	git_untracked_cache *cache,
+	const char *info_exclude,
+	const char *excludes_file)
+{
+	bool changed = false;
+	int error;
+
+	if ((error = check_exclude(cache, &changed, &cache->info_exclude_stat,
+			&cache->info_exclude_id, info_exclude)) < 0 ||
+	    (error = check_exclude(cache, &changed, &cache->excludes_file_stat,
+			&cache->excludes_file_id, excludes_file)) < 0)
+		return error;
+
+	if (changed)
+		git_untracked_cache_reset(cache);
+
+	return 0;
+}
+
+int git_untracked_cache_ident(git_buf *out, const char *workdir)
+{
+	size_t len = strlen(workdir);
+	const char *sysname;
+#ifndef GIT_WIN32
+	struct utsname uts;
+
+	if (uname(&uts) < 0) {
+		git_error_set(GIT_ERROR_OS, "failed to get the system name");
+		return -1;
+	}
+
+	sysname = uts.sysname;
+#else
+	sysname = "Windows";
+#endif
+
+	/* git records the working directory without a trailing slash */
+	if (len > 1 && workdir[len - 1] == '/')
+		len--;
+
+	git_buf_clear(out);
+	git_buf_printf(out, "Location %.*s, system %s", (int)len, workdir, sysname);
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+/* Reading */
+
+typedef struct {
+	const char *data;
+	const char *end;
+
+	/* the directories in the order they are stored */
+	git_vector dirs;
+} untracked_cache_reader;
+
+static int untracked_cache_error(const char *message)
+{
+	git_error_set(GIT_ERROR_INDEX, "invalid untracked cache: %s", message);
+	return -1;
+}
+
+static int read_varint(size_t *out, untracked_cache_reader *reader)
+{
+	size_t len;
+	uintmax_t value;
+
+	if (reader->data >= reader->end)
+		return untracked_cache_error("truncated data");
+
+	value = git_decode_varint((const unsigned char *)reader->data, &len);
+
+	if (!len || len > (size_t)(reader->end - reader->data) ||
+	    value > SIZE_MAX)
+		return untracked_cache_error("invalid number");
+
+	reader->data += len;
+	*out = (size_t)value;
+	return 0;
+}
+
+static int read_string(const char **out, size_t *out_len, untracked_cache_reader *reader)
+{
+	const char *end;
+
+	if ((end = memchr(reader->data, '\0', reader->end - reader->data)) == NULL)
+		return untracked_cache_error("truncated string");
+
+	*out = reader->data;
+	*out_len = end - reader->data;
+	reader->data = end + 1;
+	return 0;
+}
+
+static void read_stat(git_untracked_cache_stat *out, const char *data)
+{
+	uint32_t raw[9];
+
+	memcpy(raw, data, UNTRACKED_CACHE_STAT_SIZE);
+
+	out->ctime_seconds = ntohl(raw[0]);
+	out->ctime_nanoseconds = ntohl(raw[1]);
+	out->mtime_seconds = ntohl(raw[2]);
+	out->mtime_nanoseconds = ntohl(raw[3]);
+	out->dev = ntohl(raw[4]);
+	out->ino = ntohl(raw[5]);
+	out->uid = ntohl(raw[6]);
+	out->gid = ntohl(raw[7]);
+	out->size = ntohl(raw[8]);
+}
+
+static int read_dir(
+	git_untracked_cache_dir **out,
+	untracked_cache_reader *reader,
+	size_t depth)
+{
+	git_untracked_cache_dir *dir = NULL, *child;
+	size_t untracked_nr, dirs_nr, len, i;
+	const char *name;
+	char *untracked;
+	int error;
+
+	if (depth > UNTRACKED_CACHE_MAX_DEPTH)
+		return untracked_cache_error("directories nested too deep");
+
+	if ((error = read_varint(&untracked_nr, reader)) < 0 ||
+	    (error = read_varint(&dirs_nr, reader)) < 0 ||
+	    (error = read_string(&name, &len, reader)) < 0 ||
+	    (error = dir_new(&dir, name, len)) < 0)
+		return error;
+
+	if ((error = git_vector_insert(&reader->dirs, dir)) < 0) {
+		dir_free(dir);
+		return error;
+	}
+
+	*out = dir;
+
+	for (i = 0; i < untracked_nr; i++) {
+		if ((error = read_string(&name, &len, reader)) < 0)
+			return error;
+
+		untracked = git__strndup(name, len);
+		GIT_ERROR_CHECK_ALLOC(untracked);
+
+		if ((error = git_vector_insert(&dir->untracked, untracked)) < 0) {
+			git__free(untracked);
+			return error;
+		}
+	}
+
+	for (i = 0; i < dirs_nr; i++) {
+		child = NULL;
+		error = read_dir(&child, reader, depth + 1);
+
+		if (child && git_vector_insert(&dir->dirs, child) < 0) {
+			dir_free(child);
+			return -1;
+		}
+
+		if (error < 0)
+			return error;
+	}
+
+	git_vector_sort(&dir->dirs);
+	return 0;
+}
+
+static int read_bitmap(git_bitmap *bitmap, untracked_cache_reader *reader)
+{
+	size_t consumed;
+	int error;
+
+	if ((error = git_bitmap_read_ewah(bitmap, &consumed,
+			(const unsigned char *)reader->data,
+			reader->end - reader->data)) < 0)
+		return error;
+
+	reader->data += consumed;
+	return 0;
+}
+
+static int read_dir_stat(size_t pos, void *payload)
+{
+	untracked_cache_reader *reader = payload;
+	git_untracked_cache_dir *dir;
+
+	if ((dir = git_vector_get(&reader->dirs, pos)) == NULL)
+		return untracked_cache_error("invalid directory");
+
+	if ((size_t)(reader->end - reader->data) < UNTRACKED_CACHE_STAT_SIZE)
+		return untracked_cache_error("truncated stat data");
+
+	read_stat(&dir->stat, reader->data);
+	dir->valid = 1;
+
+	reader->data += UNTRACKED_CACHE_STAT_SIZE;
+	return 0;
+}
+
+static int read_dir_check_only(size_t pos, void *payload)
+{
+	untracked_cache_reader *reader = payload;
+	git_untracked_cache_dir *dir;
+
+	if ((dir = git_vector_get(&reader->dirs, pos)) == NULL)
+		return untracked_cache_error("invalid directory");
+
+	dir->check_only = 1;
+	return 0;
+}
+
+static int read_dir_exclude_id(size_t pos, void *payload)
+{
+	untracked_cache_reader *reader = payload;
+	git_untracked_cache_dir *dir;
+
+	if ((dir = git_vector_get(&reader->dirs, pos)) == NULL)
+		return untracked_cache_error("invalid directory");
+
+	if ((size_t)(reader->end - reader->data) < GIT_OID_RAWSZ)
+		return untracked_cache_error("truncated exclude id");
+
+	git_oid_fromraw(&dir->exclude_id, (const unsigned char *)reader->data);
+
+	reader->data += GIT_OID_RAWSZ;
+	return 0;
+}
+
+static int read_dirs(git_untracked_cache *cache, untracked_cache_reader *reader)
+{
+	git_bitmap valid = GIT_BITMAP_INIT, check_only = GIT_BITMAP_INIT,
+		exclude_valid = GIT_BITMAP_INIT;
+	git_untracked_cache_dir *dir;
+	size_t dirs_nr, i;
+	int error;
+
+	if ((error = read_varint(&dirs_nr, reader)) < 0 || !dirs_nr)
+		return error;
+
+	if ((error = git_vector_init(&reader->dirs, dirs_nr, NULL)) < 0)
+		return error;
+
+	error = read_dir(&cache->root, reader, 0);
+
+	if (!error && reader->dirs.length != dirs_nr)
+		error = untracked_cache_error("directory count does not match");
+
+	if (error < 0 ||
+	    (error = read_bitmap(&valid, reader)) < 0 ||
+	    (error = read_bitmap(&check_only, reader)) < 0 ||
+	    (error = read_bitmap(&exclude_valid, reader)) < 0 ||
+	    (error = git_bitmap_foreach(&check_only, read_dir_check_only, reader)) < 0 ||
+	    (error = git_bitmap_foreach(&valid, read_dir_stat, reader)) < 0 ||
+	    (error = git_bitmap_foreach(&exclude_valid, read_dir_exclude_id, reader)) < 0)
+		goto done;
+
+	/* what git records for directories it did not read is not usable */
+	git_vector_foreach(&reader->dirs, i, dir) {
+		if (!dir->valid)
+			dir_clear_untracked(dir);
+	}
+
+done:
+	git_bitmap_dispose(&valid);
+	git_bitmap_dispose(&check_only);
+	git_bitmap_dispose(&exclude_valid);
+	git_vector_free(&reader->dirs);
+	return error;
+}
+
+int git_untracked_cache_read(git_untracked_cache **out, const char *buffer, size_t buffer_size)
+{
+	git_untracked_cache *cache;
+	untracked_cache_reader reader = {0};
+	const char *name;
+	size_t len;
+	uint32_t dir_flags;
+	int error;
+
+	*out = NULL;
+
+	/* the extension ends with a NUL that guards the strings in it */
+	if (buffer_size < 1 || buffer[buffer_size - 1] != '\0')
+		return untracked_cache_error("truncated data");
+
+	reader.data = buffer;
+	reader.end = buffer + buffer_size - 1;
+
+	cache = git__calloc(1, sizeof(git_untracked_cache));
+	GIT_ERROR_CHECK_ALLOC(cache);
+
+	if ((error = read_varint(&len, &reader)) < 0)
+		goto done;
+
+	if (len > (size_t)(reader.end - reader.data) ||
+	    (size_t)(reader.end - reader.data) - len <
+		2 * UNTRACKED_CACHE_STAT_SIZE + sizeof(uint32_t) + 2 * GIT_OID_RAWSZ) {
+		error = untracked_cache_error("truncated header");
+		goto done;
+	}
+
+	if ((error = git_buf_put(&cache->ident, reader.data, len)) < 0)
+		goto done;
+	reader.data += len;
+
+	read_stat(&cache->info_exclude_stat, reader.data);
+	reader.data += UNTRACKED_CACHE_STAT_SIZE;
+	read_stat(&cache->excludes_file_stat, reader.data);
+	reader.data += UNTRACKED_CACHE_STAT_SIZE;
+
+	memcpy(&dir_flags, reader.data, sizeof(uint32_t));
+	cache->dir_flags = ntohl(dir_flags);
+	reader.data += sizeof(uint32_t);
+
+	git_oid_fromraw(&cache->info_exclude_id, (const unsigned char *)reader.data);
+	reader.data += GIT_OID_RAWSZ;
+	git_oid_fromraw(&cache->excludes_file_id, (const unsigned char *)reader.data);
+	reader.data += GIT_OID_RAWSZ;
+
+	if ((error = read_string(&name, &len, &reader)) < 0)
+		goto done;
+
+	cache->exclude_per_dir = git__strndup(name, len);
+	GIT_ERROR_CHECK_ALLOC(cache->exclude_per_dir);
+
+	error = read_dirs(cache, &reader);
+
+done:
+	if (error < 0) {
+		git_untracked_cache_free(cache);
+		return error;
+	}
+
+	*out = cache;
+	return 0;
+}
+
+/* Writing */
+
+typedef struct {
+	git_buf dirs;
+	git_buf stats;
+	git_buf exclude_ids;
+	git_bitmap valid;
+	git_bitmap check_only;
+	git_bitmap exclude_valid;
+	size_t dirs_nr;
+} untracked_cache_writer;
+
+static int write_varint(git_buf *out, size_t value)
+{
+	unsigned char buf[16];
+	int len = git_encode_varint(buf, sizeof(buf), value);
+
+	assert(len > 0);
+	return git_buf_put(out, (const char *)buf, len);
+}
+
+static int write_stat(git_buf *out, const git_untracked_cache_stat *st)
+{
+	uint32_t raw[9];
+
+	raw[0] = htonl(st->ctime_seconds);
+	raw[1] = htonl(st->ctime_nanoseconds);
+	raw[2] = htonl(st->mtime_seconds);
+	raw[3] = htonl(st->mtime_nanoseconds);
+	raw[4] = htonl(st->dev);
+	raw[5] = htonl(st->ino);
+	raw[6] = htonl(st->uid);
+	raw[7] = htonl(st->gid);
+	raw[8] = htonl(st->size);
+
+	return git_buf_put(out, (const char *)raw, UNTRACKED_CACHE_STAT_SIZE);
+}
+
+static int write_dir(untracked_cache_writer *writer, git_untracked_cache_dir *dir)
+{
+	git_untracked_cache_dir *child;
+	size_t i, pos = writer->dirs_nr++;
+	char *name;
+	int error;
+
+	if (dir->valid) {
+		if ((error = git_bitmap_set(&writer->valid, pos)) < 0 ||
+		    (error = write_stat(&writer->stats, &dir->stat)) < 0)
+			return error;
+
+		if (dir->check_only &&
+		    (error = git_bitmap_set(&writer->check_only, pos)) < 0)
+			return error;
+	}
+
+	if (!git_oid_iszero(&dir->exclude_id) &&
+	    ((error = git_bitmap_set(&writer->exclude_valid, pos)) < 0 ||
+	     (error = git_buf_put(&writer->exclude_ids,
+			(const char *)dir->exclude_id.id, GIT_OID_RAWSZ)) < 0))
+		return error;
+
+	if ((error = write_varint(&writer->dirs, dir->valid ? dir->untracked.length : 0)) < 0 ||
+	    (error = write_varint(&writer->dirs, dir->dirs.length)) < 0 ||
+	    (error = git_buf_put(&writer->dirs, dir->name, strlen(dir->name) + 1)) < 0)
+		return error;
+
+	if (dir->valid) {
+		git_vector_foreach(&dir->untracked, i, name) {
+			if ((error = git_buf_put(&writer->dirs, name, strlen(name) + 1)) < 0)
+				return error;
+		}
+	}
+
+	git_vector_foreach(&dir->dirs, i, child) {
+		if ((error = write_dir(writer, child)) < 0)
+			return error;
+	}
+
+	return 0;
+}
+
+int git_untracked_cache_write(git_buf *out, git_untracked_cache *cache)
+{
+	untracked_cache_writer writer = {
+		GIT_BUF_INIT, GIT_BUF_INIT, GIT_BUF_INIT,
+		GIT_BITMAP_INIT, GIT_BITMAP_INIT, GIT_BITMAP_INIT, 0
+	};
+	uint32_t dir_flags = htonl(cache->dir_flags);
+	int error;
+
+	if ((error = write_varint(out, cache->ident.size)) < 0 ||
+	    (error = git_buf_put(out, cache->ident.ptr, cache->ident.size)) < 0 ||
+	    (error = write_stat(out, &cache->info_exclude_stat)) < 0 ||
+	    (error = write_stat(out, &cache->excludes_file_stat)) < 0 ||
+	    (error = git_buf_put(out, (const char *)&dir_flags, sizeof(uint32_t))) < 0 ||
+	    (error = git_buf_put(out, (const char *)cache->info_exclude_id.id, GIT_OID_RAWSZ)) < 0 ||
+	    (error = git_buf_put(out, (const char *)cache->excludes_file_id.id, GIT_OID_RAWSZ)) < 0 ||
+	    (error = git_buf_put(out, cache->exclude_per_dir, strlen(cache->exclude_per_dir) + 1)) < 0)
+		return error;
+
+	/* a lone zero directory count also ends the extension with a NUL */
+	if (!cache->root)
+		return write_varint(out, 0);
+
+	if ((error = write_dir(&writer, cache->root)) < 0 ||
+	    (error = write_varint(out, writer.dirs_nr)) < 0 ||
+	    (error = git_buf_put(out, writer.dirs.ptr, writer.dirs.size)) < 0 ||
+	    (error = git_bitmap_write_ewah(out, &writer.valid)) < 0 ||
+	    (error = git_bitmap_write_ewah(out, &writer.check_only)) < 0 ||
+	    (error = git_bitmap_write_ewah(out, &writer.exclude_valid)) < 0 ||
+	    (error = git_buf_put(out, writer.stats.ptr, writer.stats.size)) < 0 ||
+	    (error = git_buf_put(out, writer.exclude_ids.ptr, writer.exclude_ids.size)) < 0)
+		goto done;
+
+	error = git_buf_putc(out, '\0');
+
+done:
+	git_buf_dispose(&writer.dirs);
+	git_buf_dispose(&writer.stats);
+	git_buf_dispose(&writer.exclude_ids);
+	git_bitmap_dispose(&writer.valid);
+	git_bitmap_dispose(&writer.check_only);
+	git_bitmap_dispose(&writer.exclude_valid);
+	return error;
+}
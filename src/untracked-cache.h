@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) the libgit2 contributors. All rights reserved.
+ *
+ * This file is part of libgit2, distributed under the GNU GPL v2 with
+ * a Linking Exception. For full terms see the included COPYING file.
+ */
+
+#ifndef INCLUDE_untracked_cache_h__
+#define INCLUDE_untracked_cache_h__
+
+#include "common.h"
+
+#include "buffer.h"
+#include "vector.h"
+#include "git2/oid.h"
+
+/*
+ * The untracked cache (`UNTR` index extension) remembers, for every
+ * directory of the working directory, the files and directories in it
+ * that are neither tracked nor ignored, along with the stat data of the
+ * directory and the id of its `.gitignore`.  As long as those do not
+ * change, the directory does not need to be read again to find them.
+ */
+
+/* Stat data, truncated to 32 bits as in index entries */
+typedef struct {
+	uint32_t ctime_seconds;
+	uint32_t ctime_nanoseconds;
+	uint32_t mtime_seconds;
+	uint32_t mtime_nanoseconds;
+	uint32_t dev;
+	uint32_t ino;
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t size;
+} git_untracked_cache_stat;
+
+typedef struct git_untracked_cache_dir {
+	/* names of the untracked entries, directories end with a '/' */
+	git_vector untracked;
+
+	/* subdirectories, sorted by name */
+	git_vector dirs;
+
+	git_untracked_cache_stat stat;
+	git_oid exclude_id;
+
+	unsigned int valid:1,
+		check_only:1;
+
+	char name[GIT_FLEX_ARRAY];
+} git_untracked_cache_dir;
+
+typedef struct {
+	/* NUL-terminated strings describing where the cache can be used */
+	git_buf ident;
+
+	git_untracked_cache_stat info_exclude_stat;
+	git_untracked_cache_stat excludes_file_stat;
+	git_oid info_exclude_id;
+	git_oid excludes_file_id;
+
+	uint32_t dir_flags;
+	char *exclude_per_dir;
+
+	git_untracked_cache_dir *root;
+
+	/* whether the cache was changed since it was read */
+	unsigned int dirty:1;
+} git_untracked_cache;
+
+/*
+ * Our directory flags: untracked directories are recorded without
+ * looking into them.  Unlike git, directories that are empty or only
+ * contain ignored files are recorded too.
+ */
+#define GIT_UNTRACKED_CACHE_DIR_FLAGS (1 << 1)
+
+/*
+ * git's flags, which also hide the directories that are empty or only
+ * contain ignored files; we can use what git records with them.
+ */
+#define GIT_UNTRACKED_CACHE_DIR_FLAGS_HIDE_EMPTY ((1 << 1) | (1 << 2))
+
+int git_untracked_cache_new(git_untracked_cache **out, const char *ident);
+int git_untracked_cache_read(git_untracked_cache **out, const char *buffer, size_t buffer_size);
+int git_untracked_cache_write(git_buf *out, git_untracked_cache *cache);
+void git_untracked_cache_free(git_untracked_cache *cache);
+
+/* Forget everything that was recorded, keeping the cache itself */
+void git_untracked_cache_reset(git_untracked_cache *cache);
+
+/*
+ * Invalidate the directories that contain `path`, whose tracked status
+ * changed.
+ */
+void git_untracked_cache_invalidate_path(git_untracked_cache *cache, const char *path);
+
+/*
+ * Look up the valid record of the directory at `path`, relative to the
+ * working directory and with or without a trailing slash.
+ */
+git_untracked_cache_dir *git_untracked_cache_get(
+	git_untracked_cache *cache, const char *path);
+
+/*
+ * Update the id of the ignore file of the directory at `path`, which
+ * invalidates the directory and all of its subdirectories if it changed.
+ */
+int git_untracked_cache_set_exclude_id(
+	git_untracked_cache *cache,
+	const char *path,
+	const git_oid *exclude_id);
+
+/*
+ * Record the untracked entries of the directory at `path`.  The cache
+ * takes the strings in `untracked`, which is left empty.
+ */
+int git_untracked_cache_set(
+	git_untracked_cache *cache,
+	const char *path,
+	const git_untracked_cache_stat *st,
+	git_vector *untracked);
+
+void git_untracked_cache_stat_init(git_untracked_cache_stat *out, const struct stat *st);
+bool git_untracked_cache_stat_equal(
+	const git_untracked_cache_stat *a, const git_untracked_cache_stat *b);
+
+/*
+ * Compute the id of the ignore file at `path`, which is zero when the
+ * file does not exist.
+ */
+int git_untracked_cache_exclude_id(git_oid *out, const char *path);
+
+/*
+ * Check the global exclude files, `info/exclude` and `core.excludesfile`
+ * (either may be NULL), forgetting everything that was recorded if
+ * their contents changed.
+ */
+int git_untracked_cache_check_excludes(
+	git_untracked_cache *cache,
+	const char *info_exclude,
+	const char *excludes_file);
+
+/* The identity of the working directory that git records */
+int git_untracked_cache_ident(git_buf *out, const char *workdir);
+
+#endif
@@ -1636,3 +1636,40 @@ void test_checkout_tree__no_index_refresh(void)
 	modify_index_and_checkout_tree(&opts);
 	assert_status_entrycount(g_repo, 0);
 }
+
+void test_checkout_tree__writes_blobs_too_large_to_read_ahead(void)
+{
+	git_treebuilder *builder;
+	git_buf large = GIT_BUF_INIT;
+	git_oid id, tree_id;
+	git_tree *tree;
+	char name[16];
+	int i;
+
+	cl_git_pass(git_treebuilder_new(&builder, g_repo, NULL));
+
+	for (i = 0; i < 4; i++) {
+		p_snprintf(name, sizeof(name), "small%d", i);
+		cl_git_pass(git_blob_create_frombuffer(&id, g_repo, name, strlen(name)));
+		cl_git_pass(git_treebuilder_insert(NULL, builder, name, &id, GIT_FILEMODE_BLOB));
+	}
+
+	for (i = 0; i < 2 * 1024 * 1024 / 16; i++)
+		cl_git_pass(git_buf_puts(&large, "0123456789abcde\n"));
+	cl_git_pass(git_blob_create_frombuffer(&id, g_repo, large.ptr, large.size));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "large", &id, GIT_FILEMODE_BLOB));
+
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, g_repo, &tree_id));
+
+	g_opts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_REMOVE_UNTRACKED;
+	cl_git_pass(git_checkout_tree(g_repo, (git_object *)tree, &g_opts));
+
+	cl_assert_equal_file("small0", 6, "testrepo/small0");
+	cl_assert_equal_file("small3", 6, "testrepo/small3");
+	cl_assert_equal_file(large.ptr, large.size, "testrepo/large");
+
+	git_tree_free(tree);
+	git_treebuilder_free(builder);
+	git_buf_dispose(&large);
+}
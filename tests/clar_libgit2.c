@@ -1,6 +1,8 @@
 #include "clar_libgit2.h"
 #include "posix.h"
 #include "path.h"
+#include "fileops.h"
+#include "varint.h"
 #include "git2/sys/repository.h"
 
 void cl_git_report_failure(
@@ -483,6 +485,99 @@ void cl_repo_set_string(git_repository *repo, const char *cfg, const char *value
 	git_config_free(config);
 }
 
+static uint32_t index_read32(const git_buf *index, size_t pos)
+{
+	uint32_t value;
+
+	cl_assert(pos + sizeof(value) <= index->size);
+	memcpy(&value, index->ptr + pos, sizeof(value));
+	return ntohl(value);
+}
+
+static size_t index_path_len(const git_buf *index, size_t pos)
+{
+	const char *nul;
+
+	cl_assert(pos < index->size);
+	cl_assert(nul = memchr(index->ptr + pos, '\0', index->size - pos));
+	return nul - (index->ptr + pos);
+}
+
+bool cl_index_has_extension(const char *index_path, const char *signature)
+{
+	git_buf index = GIT_BUF_INIT;
+	uint32_t version, entries, i;
+	size_t pos, path_offset, varint_len, end;
+	uint16_t flags;
+	bool found = false;
+
+	cl_git_pass(git_futils_readbuffer(&index, index_path));
+	cl_assert(index.size >= 12 + GIT_OID_RAWSZ);
+	cl_assert_equal_strn("DIRC", index.ptr, 4);
+
+	version = index_read32(&index, 4);
+	entries = index_read32(&index, 8);
+	end = index.size - GIT_OID_RAWSZ;
+	pos = 12;
+
+	/* skip the entries, which are padded to 8 bytes before version 4 */
+	for (i = 0; i < entries; i++) {
+		cl_assert(pos + 62 <= end);
+		memcpy(&flags, index.ptr + pos + 60, sizeof(flags));
+		path_offset = (ntohs(flags) & GIT_INDEX_ENTRY_EXTENDED) ? 64 : 62;
+
+		if (version >= 4) {
+			pos += path_offset;
+			cl_assert(pos < end);
+			git_decode_varint((const unsigned char *)index.ptr + pos, &varint_len);
+			cl_assert(varint_len);
+			pos += varint_len;
+			pos += index_path_len(&index, pos) + 1;
+		} else {
+			pos += (path_offset + index_path_len(&index, pos + path_offset) + 8) & ~7;
+		}
+	}
+
+	/* and walk the headers of the extensions */
+	while (!found && pos + 8 <= end) {
+		found = !memcmp(index.ptr + pos, signature, 4);
+		pos += 8 + index_read32(&index, pos + 4);
+	}
+
+	cl_assert(found || pos == end);
+
+	git_buf_dispose(&index);
+	return found;
+}
+
+static int age_tree(void *payload, git_buf *path)
+{
+	struct p_timeval times[2];
+	struct stat st;
+
+	GIT_UNUSED(payload);
+
+	cl_must_pass(p_lstat(path->ptr, &st));
+
+	if (S_ISDIR(st.st_mode) && !git__suffixcmp(path->ptr, "/.git"))
+		return 0;
+
+	times[0].tv_sec = times[1].tv_sec = time(NULL) - 60;
+	times[0].tv_usec = times[1].tv_usec = 0;
+	cl_must_pass(p_utimes(path->ptr, times));
+
+	return S_ISDIR(st.st_mode) ? git_path_direach(path, 0, age_tree, NULL) : 0;
+}
+
+void cl_age_tree(const char *path)
+{
+	git_buf buf = GIT_BUF_INIT;
+
+	cl_git_pass(git_buf_puts(&buf, path));
+	cl_git_pass(age_tree(NULL, &buf));
+	git_buf_dispose(&buf);
+}
+
 /* this is essentially the code from git__unescape modified slightly */
 static size_t strip_cr_from_buf(char *start, size_t len)
 {
@@ -209,6 +209,19 @@ int cl_repo_get_bool(git_repository *repo, const char *cfg);
 
 void cl_repo_set_string(git_repository *repo, const char *cfg, const char *value);
 
+/*
+ * Whether the index file at `index_path` has an extension with the given
+ * four byte signature, found by walking the extension headers that follow
+ * the entries.
+ */
+bool cl_index_has_extension(const char *index_path, const char *signature);
+
+/*
+ * Move the timestamps of `path` and everything below it, except for `.git`
+ * directories, a minute into the past so that they are not racy.
+ */
+void cl_age_tree(const char *path);
+
 /* set up a fake "home" directory and set libgit2 GLOBAL search path.
  *
  * automatically configures cleanup function to restore the regular search
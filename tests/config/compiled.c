@@ -0,0 +1,157 @@
+#include "clar_libgit2.h"
+#include "config.h"
+
+static git_config *cfg;
+
+void test_config_compiled__initialize(void)
+{
+	cl_git_mkfile("system", "[core]\n\tfilemode = true\n[multi]\n\tvalue = system\n[sizes]\n\tbig = 1k\n");
+	cl_git_mkfile("global", "[core]\n\tfilemode = no\n[multi]\n\tvalue = global1\n\tvalue = global2\n");
+	cl_git_mkfile("local", "[multi]\n\tvalue = local\n[sizes]\n\thuge = 8g\n\tword = many\n");
+
+	cl_git_pass(git_config_new(&cfg));
+	cl_git_pass(git_config_add_file_ondisk(cfg, "system", GIT_CONFIG_LEVEL_SYSTEM, NULL, 0));
+	cl_git_pass(git_config_add_file_ondisk(cfg, "global", GIT_CONFIG_LEVEL_GLOBAL, NULL, 0));
+	cl_git_pass(git_config_add_file_ondisk(cfg, "local", GIT_CONFIG_LEVEL_LOCAL, NULL, 0));
+}
+
+void test_config_compiled__cleanup(void)
+{
+	git_config_free(cfg);
+	cfg = NULL;
+
+	cl_must_pass(p_unlink("system"));
+	cl_must_pass(p_unlink("global"));
+	cl_must_pass(p_unlink("local"));
+	if (git_path_exists("app"))
+		cl_must_pass(p_unlink("app"));
+}
+
+static int collect_values(const git_config_entry *entry, void *payload)
+{
+	git_buf *buf = payload;
+
+	git_buf_printf(buf, "%s;", entry->value);
+	return 0;
+}
+
+void test_config_compiled__levels_are_merged(void)
+{
+	git_config_entry *entry;
+	git_buf values = GIT_BUF_INIT;
+	int b;
+
+	cl_git_pass(git_config_get_bool(&b, cfg, "core.filemode"));
+	cl_assert_equal_i(0, b);
+
+	cl_git_pass(git_config_get_entry(&entry, cfg, "multi.value"));
+	cl_assert_equal_s("local", entry->value);
+	cl_assert_equal_i(GIT_CONFIG_LEVEL_LOCAL, entry->level);
+	git_config_entry_free(entry);
+
+	cl_git_pass(git_config_get_multivar_foreach(cfg, "Multi.Value", NULL, collect_values, &values));
+	cl_assert_equal_s("system;global1;global2;local;", values.ptr);
+
+	git_buf_clear(&values);
+	cl_git_pass(git_config_get_multivar_foreach(cfg, "multi.value", "^global", collect_values, &values));
+	cl_assert_equal_s("global1;global2;", values.ptr);
+
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_config_get_multivar_foreach(cfg, "multi.missing", NULL, collect_values, &values));
+	cl_git_fail_with(GIT_ENOTFOUND, git_config_get_entry(&entry, cfg, "core.missing"));
+
+	cl_assert(cfg->compiled);
+	cl_assert_equal_i(3, git_array_size(cfg->compiled->generations));
+
+	git_buf_dispose(&values);
+}
+
+void test_config_compiled__values_are_parsed(void)
+{
+	int64_t i64;
+	int32_t i32;
+	int b;
+
+	cl_git_pass(git_config_get_int64(&i64, cfg, "sizes.big"));
+	cl_assert_equal_i(1024, i64);
+	cl_git_pass(git_config_get_int32(&i32, cfg, "sizes.big"));
+	cl_assert_equal_i(1024, i32);
+	cl_git_pass(git_config_get_bool(&b, cfg, "sizes.big"));
+	cl_assert_equal_i(1, b);
+
+	cl_git_pass(git_config_get_int64(&i64, cfg, "sizes.huge"));
+	cl_assert(i64 == (int64_t)8 * 1024 * 1024 * 1024);
+	cl_git_fail(git_config_get_int32(&i32, cfg, "sizes.huge"));
+
+	cl_git_fail(git_config_get_int64(&i64, cfg, "sizes.word"));
+	cl_assert(git_error_last() != NULL);
+	cl_git_fail(git_config_get_bool(&b, cfg, "sizes.word"));
+}
+
+void test_config_compiled__writes_are_seen(void)
+{
+	git_config_compiled *before;
+	int32_t i32;
+
+	cl_git_pass(git_config_get_int32(&i32, cfg, "sizes.big"));
+	before = cfg->compiled;
+
+	cl_git_pass(git_config_get_int32(&i32, cfg, "sizes.big"));
+	cl_assert(cfg->compiled == before);
+
+	cl_git_pass(git_config_set_int32(cfg, "sizes.big", 42));
+	cl_git_pass(git_config_get_int32(&i32, cfg, "sizes.big"));
+	cl_assert_equal_i(42, i32);
+	cl_assert(cfg->compiled != before);
+
+	/* Simulate another process changing a lower level */
+	cl_git_rewritefile("system", "[core]\n\tfilemode = true\n[sizes]\n\tsmall = 7\n");
+	cl_git_pass(git_config_get_int32(&i32, cfg, "sizes.small"));
+	cl_assert_equal_i(7, i32);
+}
+
+void test_config_compiled__snapshot_shares_table(void)
+{
+	git_config *snapshot;
+	const char *str;
+	int b;
+
+	cl_git_pass(git_config_get_bool(&b, cfg, "core.filemode"));
+	cl_git_pass(git_config_snapshot(&snapshot, cfg));
+
+	cl_assert(snapshot->frozen);
+	cl_assert(snapshot->compiled == cfg->compiled);
+
+	cl_git_pass(git_config_get_string(&str, snapshot, "multi.value"));
+	cl_assert_equal_s("local", str);
+
+	/* The live configuration moves on, the snapshot keeps its table */
+	cl_git_pass(git_config_set_string(cfg, "multi.value", "changed"));
+	cl_git_pass(git_config_get_bool(&b, cfg, "core.filemode"));
+	cl_assert(snapshot->compiled != cfg->compiled);
+
+	cl_git_pass(git_config_get_string(&str, snapshot, "multi.value"));
+	cl_assert_equal_s("local", str);
+
+	git_config_free(snapshot);
+}
+
+void test_config_compiled__adding_a_level_recompiles(void)
+{
+	git_config_entry *entry;
+
+	cl_git_pass(git_config_get_entry(&entry, cfg, "multi.value"));
+	cl_assert_equal_s("local", entry->value);
+
+	cl_git_mkfile("app", "[multi]\n\tvalue = app\n");
+	cl_git_pass(git_config_add_file_ondisk(cfg, "app", GIT_CONFIG_LEVEL_APP, NULL, 0));
+	cl_assert(cfg->compiled == NULL);
+
+	/* Entries handed out before stay valid */
+	cl_assert_equal_s("local", entry->value);
+	git_config_entry_free(entry);
+
+	cl_git_pass(git_config_get_entry(&entry, cfg, "multi.value"));
+	cl_assert_equal_s("app", entry->value);
+	git_config_entry_free(entry);
+}
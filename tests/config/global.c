@@ -169,3 +169,66 @@ void test_config_global__open_programdata(void)
 	git_repository_free(repo);
 	cl_fixture_cleanup("./foo.git");
 }
+
+void test_config_global__shared_global_sees_changes(void)
+{
+	git_config *first, *second;
+	int32_t value;
+
+	cl_git_mkfile("home/.gitconfig", "[global]\n  test = 1\n");
+
+	cl_git_pass(git_config_open_default(&first));
+	cl_git_pass(git_config_get_int32(&value, first, "global.test"));
+	cl_assert_equal_i(1, value);
+
+	/* same size, and most likely the same second */
+	cl_git_rewritefile("home/.gitconfig", "[global]\n  test = 2\n");
+
+	cl_git_pass(git_config_open_default(&second));
+	cl_git_pass(git_config_get_int32(&value, second, "global.test"));
+	cl_assert_equal_i(2, value);
+
+	cl_git_pass(git_config_get_int32(&value, first, "global.test"));
+	cl_assert_equal_i(2, value);
+
+	git_config_free(second);
+	git_config_free(first);
+}
+
+static void assert_foo_bar(git_repository *repo, const char *expected)
+{
+	git_config *cfg;
+	git_buf buf = GIT_BUF_INIT;
+
+	cl_git_pass(git_repository_config(&cfg, repo));
+
+	if (expected) {
+		cl_git_pass(git_config_get_string_buf(&buf, cfg, "foo.bar"));
+		cl_assert_equal_s(expected, buf.ptr);
+	} else {
+		cl_git_fail_with(GIT_ENOTFOUND, git_config_get_string_buf(&buf, cfg, "foo.bar"));
+	}
+
+	git_buf_dispose(&buf);
+	git_config_free(cfg);
+}
+
+void test_config_global__conditional_includes_are_not_shared(void)
+{
+	git_repository *a, *b;
+
+	cl_git_mkfile("home/.gitconfig", "[includeIf \"gitdir:**/first/\"]\n  path = other\n");
+	cl_git_mkfile("home/other", "[foo]\n  bar = baz\n");
+
+	cl_git_pass(git_repository_init(&a, "first", false));
+	cl_git_pass(git_repository_init(&b, "second", false));
+
+	assert_foo_bar(b, NULL);
+	assert_foo_bar(a, "baz");
+	assert_foo_bar(b, NULL);
+
+	git_repository_free(a);
+	git_repository_free(b);
+	cl_fixture_cleanup("first");
+	cl_fixture_cleanup("second");
+}
@@ -1,5 +1,6 @@
 #include "clar_libgit2.h"
 #include "hash.h"
+#include "fileops.h"
 
 #define FIXTURE_DIR "sha1"
 
@@ -10,6 +11,9 @@ void test_core_sha1__initialize(void)
 
 void test_core_sha1__cleanup(void)
 {
+#ifdef GIT_SHA1_ACCELERATED
+	git_hash__set_accelerated(true);
+#endif
 	cl_fixture_cleanup(FIXTURE_DIR);
 }
 
@@ -62,3 +66,73 @@ void test_core_sha1__detect_collision_attack(void)
 #endif
 }
 
+/* test that the fast mode skips collision detection where it can */
+void test_core_sha1__fast_mode_skips_collision_detection(void)
+{
+#ifdef GIT_SHA1_ACCELERATED
+	git_hash_ctx ctx;
+	git_buf pdf = GIT_BUF_INIT;
+	git_oid oid, expected;
+
+	cl_git_pass(git_futils_readbuffer(&pdf, FIXTURE_DIR "/shattered-1.pdf"));
+
+	cl_git_pass(git_hash_ctx_init_mode(&ctx, GIT_HASH_MODE_FAST));
+	cl_git_pass(git_hash_update(&ctx, pdf.ptr, pdf.size));
+	cl_git_pass(git_hash_final(&oid, &ctx));
+	git_hash_ctx_cleanup(&ctx);
+
+	git_oid_fromstr(&expected, "38762cf7f55934b34d179ae6a4c80cadccbb7f0a");
+	cl_assert_equal_oid(&expected, &oid);
+
+	git_buf_dispose(&pdf);
+#else
+	cl_skip();
+#endif
+}
+
+#ifdef GIT_SHA1_ACCELERATED
+static void sha1_chunked(git_oid *oid, const unsigned char *data, size_t len,
+	size_t chunk, git_hash_mode_t mode)
+{
+	git_hash_ctx ctx;
+	size_t i;
+
+	cl_git_pass(git_hash_ctx_init_mode(&ctx, mode));
+
+	for (i = 0; i < len; i += chunk)
+		cl_git_pass(git_hash_update(&ctx, data + i, min(chunk, len - i)));
+
+	cl_git_pass(git_hash_final(oid, &ctx));
+	git_hash_ctx_cleanup(&ctx);
+}
+#endif
+
+/* test that every implementation agrees, whatever the length and chunks */
+void test_core_sha1__implementations_agree(void)
+{
+#ifdef GIT_SHA1_ACCELERATED
+	unsigned char data[1024];
+	git_oid expected, portable, accelerated;
+	size_t i, len;
+	size_t chunks[] = { 1, 7, 63, 64, 65, 1000 };
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (unsigned char)(i * 31 + (i >> 3));
+
+	for (len = 0; len <= sizeof(data); len += (len < 200 ? 1 : 37)) {
+		sha1_chunked(&expected, data, len, sizeof(data), GIT_HASH_MODE_DETECT_COLLISIONS);
+
+		for (i = 0; i < ARRAY_SIZE(chunks); i++) {
+			git_hash__set_accelerated(false);
+			sha1_chunked(&portable, data, len, chunks[i], GIT_HASH_MODE_FAST);
+			cl_assert_equal_oid(&expected, &portable);
+
+			git_hash__set_accelerated(true);
+			sha1_chunked(&accelerated, data, len, chunks[i], GIT_HASH_MODE_FAST);
+			cl_assert_equal_oid(&expected, &accelerated);
+		}
+	}
+#else
+	cl_skip();
+#endif
+}
@@ -0,0 +1,238 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/commit_graph.h>
+
+#include "commit_graph.h"
+#include "odb.h"
+#include "revwalk.h"
+
+static git_repository *_repo;
+
+void test_graph_commitgraph__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_graph_commitgraph__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+}
+
+static void dump_reachable(git_buf *out)
+{
+	git_commit_graph_writer *w;
+	git_revwalk *walk;
+
+	cl_git_pass(git_commit_graph_writer_new(&w, "testrepo.git/objects/info"));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_dump(out, w));
+
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+}
+
+static void write_reachable(void)
+{
+	git_commit_graph_writer *w;
+	git_revwalk *walk;
+
+	cl_git_pass(git_commit_graph_writer_new(&w, "testrepo.git/objects/info"));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push_glob(walk, "refs/*"));
+	cl_git_pass(git_commit_graph_writer_add_revwalk(w, walk));
+	cl_git_pass(git_commit_graph_writer_commit(w));
+
+	git_revwalk_free(walk);
+	git_commit_graph_writer_free(w);
+}
+
+void test_graph_commitgraph__dump_matches_commits(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_commit_graph_file file = {{0}};
+	git_commit_graph_entry e, parent;
+	git_commit *commit;
+	git_oid id;
+	size_t i, j;
+
+	dump_reachable(&buf);
+	cl_git_pass(git_commit_graph_parse(&file, (const unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_i(file.num_commits, 15);
+
+	for (i = 0; i < file.num_commits; ++i) {
+		git_oid_cpy(&id, &file.oid_lookup[i]);
+		cl_git_pass(git_commit_graph_entry_find(&e, &file, &id, GIT_OID_HEXSZ));
+		cl_git_pass(git_commit_lookup(&commit, _repo, &id));
+
+		cl_assert_equal_oid(&e.sha1, &id);
+		cl_assert_equal_oid(&e.tree_oid, git_commit_tree_id(commit));
+		cl_assert_equal_i(e.commit_time, git_commit_time(commit));
+		cl_assert_equal_sz(e.parent_count, git_commit_parentcount(commit));
+
+		if (e.parent_count == 0)
+			cl_assert_equal_sz(e.generation, 1);
+
+		for (j = 0; j < e.parent_count; ++j) {
+			cl_git_pass(git_commit_graph_entry_parent(&parent, &file, &e, j));
+			cl_assert_equal_oid(&parent.sha1, git_commit_parent_id(commit, (unsigned int)j));
+			cl_assert(parent.generation < e.generation);
+		}
+
+		git_commit_free(commit);
+	}
+
+	/* lookup by abbreviated id */
+	cl_git_pass(git_oid_fromstrn(&id, "a4a7dce8", 8));
+	cl_git_pass(git_commit_graph_entry_find(&e, &file, &id, 8));
+	cl_assert_equal_s(git_oid_tostr_s(&e.sha1), "a4a7dce85cf63874e984719f4fdd239f5145052f");
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000000"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_commit_graph_entry_find(&e, &file, &id, GIT_OID_HEXSZ));
+
+	git_buf_dispose(&buf);
+}
+
+void test_graph_commitgraph__parse_rejects_garbage(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_commit_graph_file file = {{0}};
+
+	dump_reachable(&buf);
+
+	cl_git_fail(git_commit_graph_parse(&file, (const unsigned char *)buf.ptr, 10));
+
+	buf.ptr[0] = 'X';
+	cl_git_fail(git_commit_graph_parse(&file, (const unsigned char *)buf.ptr, buf.size));
+
+	git_buf_dispose(&buf);
+}
+
+void test_graph_commitgraph__writer_requires_parents(void)
+{
+	git_commit_graph_writer *w;
+	git_buf buf = GIT_BUF_INIT;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_commit_graph_writer_new(&w, "testrepo.git/objects/info"));
+	cl_git_pass(git_commit_graph_writer_add(w, _repo, &id));
+	cl_git_fail(git_commit_graph_writer_dump(&buf, w));
+
+	git_buf_dispose(&buf);
+	git_commit_graph_writer_free(w);
+}
+
+void test_graph_commitgraph__revwalk_uses_graph(void)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_odb *odb;
+	git_commit_graph_file *file;
+	git_commit_list_node *node;
+	git_oid id, base, one, two;
+	size_t ahead, behind;
+	int count = 0;
+
+	write_reachable();
+	cl_assert(git_path_exists("testrepo.git/objects/info/commit-graph"));
+
+	/* a freshly opened repository picks up the new commit-graph */
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb__get_commit_graph_file(&file, odb));
+	cl_assert_equal_i(file->num_commits, 15);
+	git_odb_free(odb);
+
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+	while (git_revwalk_next(&id, walk) == 0)
+		count++;
+	cl_assert_equal_i(count, 7);
+
+	/* commits parsed through the graph carry their generation number */
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_assert((node = git_revwalk__commit_lookup(walk, &id)) != NULL);
+	cl_assert(node->parsed);
+	cl_assert(node->generation > 1);
+	git_revwalk_free(walk);
+
+	cl_git_pass(git_oid_fromstr(&one, "c47800c7266a2be04c571c04d5a6614691ea99bd"));
+	cl_git_pass(git_oid_fromstr(&two, "9fd738e8f7967c078dceed8190330fc8648ee56a"));
+	cl_git_pass(git_merge_base(&base, repo, &one, &two));
+	cl_assert_equal_s(git_oid_tostr_s(&base), "5b5b025afb0b4c913b4c338a42934a3863bf3644");
+
+	cl_git_pass(git_graph_ahead_behind(&ahead, &behind, repo, &one, &two));
+	cl_assert_equal_sz(ahead, 1);
+	cl_assert_equal_sz(behind, 2);
+
+	git_repository_free(repo);
+}
+
+void test_graph_commitgraph__generation_pruning(void)
+{
+	git_repository *repo;
+	git_oid tip, ancestor, unrelated;
+
+	write_reachable();
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+
+	cl_git_pass(git_oid_fromstr(&tip, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_git_pass(git_oid_fromstr(&ancestor, "8496071c1b46c854b31185ea97743be6a8774479"));
+	cl_git_pass(git_oid_fromstr(&unrelated, "e90810b8df3e80c413d903f631643c716887138d"));
+
+	cl_assert_equal_i(1, git_graph_descendant_of(repo, &tip, &ancestor));
+	cl_assert_equal_i(0, git_graph_descendant_of(repo, &ancestor, &tip));
+	cl_assert_equal_i(0, git_graph_descendant_of(repo, &tip, &unrelated));
+
+	/* the generation numbers answer this without walking at all */
+	cl_assert_equal_i(0, git_graph_descendant_of_bounded(repo, &ancestor, &tip, 1));
+
+	git_repository_free(repo);
+}
+
+static void assert_walk_ignores_graph(void)
+{
+	git_repository *repo;
+	git_revwalk *walk;
+	git_commit_list_node *node;
+	git_oid id;
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_revwalk_new(&walk, repo));
+	cl_git_pass(git_revwalk_push_head(walk));
+	while (git_revwalk_next(&id, walk) == 0)
+		;
+
+	/* commits parsed from their objects have no generation number */
+	cl_git_pass(git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"));
+	cl_assert((node = git_revwalk__commit_lookup(walk, &id)) != NULL);
+	cl_assert(node->parsed);
+	cl_assert_equal_i(0, node->generation);
+
+	git_revwalk_free(walk);
+	git_repository_free(repo);
+}
+
+void test_graph_commitgraph__shallow_ignores_graph(void)
+{
+	write_reachable();
+	cl_git_mkfile("testrepo.git/shallow",
+		"be3563ae3f795b2b4353bcce3a527ad0a4f7f644\n");
+
+	assert_walk_ignores_graph();
+}
+
+void test_graph_commitgraph__grafts_ignore_graph(void)
+{
+	write_reachable();
+	cl_must_pass(p_mkdir("testrepo.git/info", 0777));
+	cl_git_mkfile("testrepo.git/info/grafts",
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n");
+
+	assert_walk_ignores_graph();
+}
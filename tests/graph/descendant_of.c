@@ -53,3 +53,30 @@ void test_graph_descendant_of__nopath(void)
 	git_oid_fromstr(&oid, "e90810b8df3e80c413d903f631643c716887138d");
 	cl_assert_equal_i(0, git_graph_descendant_of(_repo, git_commit_id(commit), &oid));
 }
+
+void test_graph_descendant_of__bounded(void)
+{
+	git_commit *other;
+
+	cl_git_pass(git_commit_nth_gen_ancestor(&other, commit, 3));
+
+	cl_assert_equal_i(1, git_graph_descendant_of_bounded(_repo, git_commit_id(commit), git_commit_id(other), 0));
+	cl_assert_equal_i(1, git_graph_descendant_of_bounded(_repo, git_commit_id(commit), git_commit_id(other), 100));
+	cl_assert_equal_i(GIT_ELIMIT, git_graph_descendant_of_bounded(_repo, git_commit_id(commit), git_commit_id(other), 1));
+	cl_assert_equal_i(GIT_ERROR_MERGE, git_error_last()->klass);
+	cl_assert_equal_i(0, git_graph_descendant_of_bounded(_repo, git_commit_id(commit), git_commit_id(commit), 1));
+
+	/* the ancestor was reached when the walk gave up */
+	cl_assert_equal_i(1, git_graph_descendant_of_bounded(_repo, git_commit_id(commit), git_commit_id(other), 3));
+
+	git_commit_free(other);
+}
+
+void test_graph_descendant_of__missing_commit(void)
+{
+	git_oid oid;
+
+	git_oid_fromstr(&oid, "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef");
+	cl_assert_equal_i(0, git_graph_descendant_of(_repo, git_commit_id(commit), &oid));
+	cl_assert_equal_i(0, git_graph_descendant_of(_repo, &oid, git_commit_id(commit)));
+}
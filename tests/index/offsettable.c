@@ -0,0 +1,170 @@
+#include "clar_libgit2.h"
+#include "index.h"
+#include "hash.h"
+
+static git_repository *g_repo = NULL;
+static size_t g_block_size;
+static unsigned int g_read_threads;
+
+static const char *paths[] = {
+	"a", "ab", "abc", "abd", "b/a", "b/b", "b/c/d", "b/c/e",
+	"c", "d/long/path/to/a/file", "d/long/path/to/b", "e",
+};
+
+void test_index_offsettable__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("empty_standard_repo");
+
+	g_block_size = git_index__offset_table_block_size;
+	git_index__offset_table_block_size = 3;
+
+	g_read_threads = git_index__read_threads;
+	git_index__read_threads = 4;
+}
+
+void test_index_offsettable__cleanup(void)
+{
+	git_index__offset_table_block_size = g_block_size;
+	git_index__read_threads = g_read_threads;
+
+	cl_git_sandbox_cleanup();
+	g_repo = NULL;
+}
+
+static void write_index(unsigned int version, bool offset_table)
+{
+	git_index_entry entry;
+	git_index *index;
+	size_t i;
+
+	cl_repo_set_bool(g_repo, "index.recordOffsetTable", offset_table);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_set_version(index, version));
+
+	for (i = 0; i < ARRAY_SIZE(paths); i++) {
+		memset(&entry, 0, sizeof(entry));
+		entry.path = paths[i];
+		entry.mode = GIT_FILEMODE_BLOB;
+		cl_git_pass(git_index_add_frombuffer(index, &entry, paths[i],
+						     strlen(paths[i]) + 1));
+	}
+
+	cl_git_pass(git_index_write(index));
+	git_index_free(index);
+}
+
+static void assert_index_entries(unsigned int version)
+{
+	git_index *index;
+	const git_index_entry *entry;
+	size_t i;
+
+	/* read the index from disk, not the repository's cached one */
+	cl_git_pass(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert_equal_i(version, git_index_version(index));
+	cl_assert_equal_sz(ARRAY_SIZE(paths), git_index_entrycount(index));
+
+	for (i = 0; i < ARRAY_SIZE(paths); i++) {
+		cl_assert(entry = git_index_get_byindex(index, i));
+		cl_assert_equal_s(paths[i], entry->path);
+		cl_assert(git_index_get_bypath(index, paths[i], 0) == entry);
+	}
+
+	git_index_free(index);
+}
+
+void test_index_offsettable__is_not_written_by_default(void)
+{
+	write_index(2, false);
+
+	cl_assert(!cl_index_has_extension("empty_standard_repo/.git/index", "EOIE"));
+	cl_assert(!cl_index_has_extension("empty_standard_repo/.git/index", "IEOT"));
+
+	assert_index_entries(2);
+}
+
+void test_index_offsettable__can_write_and_read(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+
+	write_index(2, true);
+
+	cl_assert(cl_index_has_extension("empty_standard_repo/.git/index", "IEOT"));
+
+	cl_git_pass(git_futils_readbuffer(&buf, "empty_standard_repo/.git/index"));
+	cl_assert_equal_strn("EOIE",
+		buf.ptr + buf.size - GIT_OID_RAWSZ - 8 - 4 - GIT_OID_RAWSZ, 4);
+	git_buf_dispose(&buf);
+
+	assert_index_entries(2);
+}
+
+void test_index_offsettable__can_write_and_read_v4(void)
+{
+	write_index(4, true);
+	cl_assert(cl_index_has_extension("empty_standard_repo/.git/index", "IEOT"));
+	assert_index_entries(4);
+}
+
+void test_index_offsettable__can_read_v4_written_without_it(void)
+{
+	write_index(4, false);
+	cl_assert(!cl_index_has_extension("empty_standard_repo/.git/index", "IEOT"));
+	assert_index_entries(4);
+}
+
+void test_index_offsettable__ignores_invalid_end_of_entries(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_oid checksum;
+	size_t eoie_hash;
+
+	write_index(4, true);
+
+	cl_git_pass(git_futils_readbuffer(&buf, "empty_standard_repo/.git/index"));
+
+	/* damage the hash of the extension headers and fix up the trailer */
+	eoie_hash = buf.size - GIT_OID_RAWSZ - GIT_OID_RAWSZ;
+	buf.ptr[eoie_hash] ^= 0xff;
+
+	cl_git_pass(git_hash_buf(&checksum, buf.ptr, buf.size - GIT_OID_RAWSZ));
+	memcpy(buf.ptr + buf.size - GIT_OID_RAWSZ, checksum.id, GIT_OID_RAWSZ);
+
+	cl_git_pass(git_futils_writebuffer(&buf, "empty_standard_repo/.git/index",
+		O_WRONLY | O_TRUNC, 0644));
+	git_buf_dispose(&buf);
+
+	assert_index_entries(4);
+}
+
+void test_index_offsettable__reports_invalid_entries(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_index *index;
+	git_oid checksum;
+	size_t i;
+
+	write_index(2, true);
+
+	cl_git_pass(git_futils_readbuffer(&buf, "empty_standard_repo/.git/index"));
+
+	/* make a path of the third block of entries invalid */
+	for (i = 0; i + 6 <= buf.size; i++) {
+		if (memcmp(buf.ptr + i, "b/c/d", 6) == 0) {
+			memcpy(buf.ptr + i, "../ab", 5);
+			break;
+		}
+	}
+	cl_assert(i + 6 <= buf.size);
+
+	cl_git_pass(git_hash_buf(&checksum, buf.ptr, buf.size - GIT_OID_RAWSZ));
+	memcpy(buf.ptr + buf.size - GIT_OID_RAWSZ, checksum.id, GIT_OID_RAWSZ);
+
+	cl_git_pass(git_futils_writebuffer(&buf, "empty_standard_repo/.git/index",
+		O_WRONLY | O_TRUNC, 0644));
+	git_buf_dispose(&buf);
+
+	cl_git_fail(git_index_open(&index, "empty_standard_repo/.git/index"));
+	cl_assert(strstr(git_error_last()->message, "invalid entry") != NULL);
+}
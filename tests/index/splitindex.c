@@ -1,4 +1,5 @@
 #include "clar_libgit2.h"
+#include "fileops.h"
 #include "index.h"
 
 static git_repository *g_repo;
@@ -13,9 +14,233 @@ void test_index_splitindex__cleanup(void)
 	cl_git_sandbox_cleanup();
 }
 
-void test_index_splitindex__fail_on_open(void)
+static void add_files(git_index *index, const char *prefix, size_t count)
 {
-	git_index *idx;
-	cl_git_fail_with(-1, git_repository_index(&idx, g_repo));
-	cl_assert_equal_s(git_error_last()->message, "unsupported mandatory extension: 'link'");
+	git_buf path = GIT_BUF_INIT;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		git_buf_clear(&path);
+		cl_git_pass(git_buf_printf(&path, "splitindex/%s%02d", prefix, (int)i));
+		cl_git_mkfile(path.ptr, path.ptr);
+		cl_git_pass(git_index_add_bypath(index, path.ptr + strlen("splitindex/")));
+	}
+
+	git_buf_dispose(&path);
+}
+
+/* the number of entries in the header of the index file */
+static size_t index_file_entrycount(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	uint32_t count;
+
+	cl_git_pass(git_futils_readbuffer(&buf, "splitindex/.git/index"));
+	cl_assert(buf.size > 12);
+	memcpy(&count, buf.ptr + 8, sizeof(count));
+	git_buf_dispose(&buf);
+
+	return ntohl(count);
+}
+
+static bool shared_index_exists(const git_oid *id)
+{
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	bool exists;
+
+	git_oid_tostr(hex, sizeof(hex), id);
+	cl_git_pass(git_buf_printf(&path, "splitindex/.git/sharedindex.%s", hex));
+	exists = git_path_exists(path.ptr);
+	git_buf_dispose(&path);
+
+	return exists;
+}
+
+void test_index_splitindex__can_be_read(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_assert_equal_sz(0, git_index_entrycount(index));
+	cl_assert(!git_oid_iszero(&index->shared_id));
+
+	git_index_free(index);
+}
+
+void test_index_splitindex__can_write_and_read(void)
+{
+	git_index *index, *reread;
+	const git_index_entry *entry;
+	size_t i;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_files(index, "file", 20);
+	cl_git_pass(git_index_write(index));
+	cl_assert(shared_index_exists(&index->shared_id));
+
+	cl_git_pass(git_index_open(&reread, "splitindex/.git/index"));
+	cl_assert(git_oid_equal(&index->shared_id, &reread->shared_id));
+	cl_assert_equal_sz(git_index_entrycount(index), git_index_entrycount(reread));
+
+	for (i = 0; i < git_index_entrycount(index); i++) {
+		cl_assert(entry = git_index_get_bypath(reread,
+			git_index_get_byindex(index, i)->path, 0));
+		cl_assert(git_oid_equal(&entry->id, &git_index_get_byindex(index, i)->id));
+	}
+
+	git_index_free(reread);
+	git_index_free(index);
+}
+
+void test_index_splitindex__only_writes_changes(void)
+{
+	git_index *index, *reread;
+	git_oid shared_id;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_files(index, "file", 20);
+	cl_git_pass(git_index_write(index));
+	git_oid_cpy(&shared_id, &index->shared_id);
+
+	add_files(index, "new", 1);
+	cl_git_pass(git_index_remove_bypath(index, "file03"));
+	cl_git_pass(git_index_write(index));
+
+	cl_assert(git_oid_equal(&shared_id, &index->shared_id));
+	cl_assert_equal_sz(1, index_file_entrycount());
+
+	cl_git_pass(git_index_open(&reread, "splitindex/.git/index"));
+	cl_assert_equal_sz(20, git_index_entrycount(reread));
+	cl_assert(git_index_get_bypath(reread, "new00", 0) != NULL);
+	cl_assert(git_index_get_bypath(reread, "file03", 0) == NULL);
+	cl_assert(git_index_get_bypath(reread, "file04", 0) != NULL);
+
+	git_index_free(reread);
+	git_index_free(index);
+}
+
+void test_index_splitindex__writes_changed_entries(void)
+{
+	git_index *index, *reread;
+	const git_index_entry *entry;
+	git_oid shared_id;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_files(index, "file", 20);
+	cl_git_pass(git_index_write(index));
+	git_oid_cpy(&shared_id, &index->shared_id);
+
+	cl_git_rewritefile("splitindex/file07", "changed\n");
+	cl_git_pass(git_index_add_bypath(index, "file07"));
+	cl_git_pass(git_index_write(index));
+
+	cl_assert(git_oid_equal(&shared_id, &index->shared_id));
+	cl_assert_equal_sz(1, index_file_entrycount());
+
+	cl_git_pass(git_index_open(&reread, "splitindex/.git/index"));
+	cl_assert_equal_sz(20, git_index_entrycount(reread));
+	cl_assert(entry = git_index_get_bypath(reread, "file07", 0));
+	cl_assert_equal_i(strlen("changed\n"), entry->file_size);
+
+	git_index_free(reread);
+	git_index_free(index);
+}
+
+void test_index_splitindex__rewrites_shared_index_after_many_changes(void)
+{
+	git_index *index;
+	git_oid shared_id;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_files(index, "file", 20);
+	cl_git_pass(git_index_write(index));
+	git_oid_cpy(&shared_id, &index->shared_id);
+
+	/* more than 20% of the entries are not shared */
+	add_files(index, "new", 6);
+	cl_git_pass(git_index_write(index));
+
+	cl_assert(!git_oid_equal(&shared_id, &index->shared_id));
+	cl_assert_equal_sz(0, index_file_entrycount());
+
+	cl_repo_set_string(g_repo, "splitIndex.maxPercentChange", "0");
+	git_oid_cpy(&shared_id, &index->shared_id);
+
+	add_files(index, "other", 1);
+	cl_git_pass(git_index_write(index));
+	cl_assert(!git_oid_equal(&shared_id, &index->shared_id));
+
+	git_index_free(index);
+}
+
+static void age_shared_index(const git_oid *id)
+{
+	git_buf path = GIT_BUF_INIT;
+	char hex[GIT_OID_HEXSZ + 1];
+	struct p_timeval times[2];
+
+	times[0].tv_sec = times[1].tv_sec = time(NULL) - 60;
+	times[0].tv_usec = times[1].tv_usec = 0;
+
+	git_oid_tostr(hex, sizeof(hex), id);
+	cl_git_pass(git_buf_printf(&path, "splitindex/.git/sharedindex.%s", hex));
+	cl_must_pass(p_utimes(path.ptr, times));
+	git_buf_dispose(&path);
+}
+
+void test_index_splitindex__expires_unused_shared_indexes(void)
+{
+	git_index *index;
+	git_oid shared_id;
+
+	cl_repo_set_string(g_repo, "splitIndex.maxPercentChange", "0");
+	cl_repo_set_string(g_repo, "splitIndex.sharedIndexExpire", "never");
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	git_oid_cpy(&shared_id, &index->shared_id);
+	age_shared_index(&shared_id);
+
+	add_files(index, "file", 1);
+	cl_git_pass(git_index_write(index));
+	cl_assert(shared_index_exists(&shared_id));
+
+	cl_repo_set_string(g_repo, "splitIndex.sharedIndexExpire", "now");
+
+	add_files(index, "file", 2);
+	cl_git_pass(git_index_write(index));
+	cl_assert(!shared_index_exists(&shared_id));
+	cl_assert(shared_index_exists(&index->shared_id));
+
+	git_index_free(index);
+}
+
+void test_index_splitindex__can_be_unsplit(void)
+{
+	git_index *index, *reread;
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	add_files(index, "file", 5);
+	cl_git_pass(git_index_write(index));
+	cl_assert(!git_oid_iszero(&index->shared_id));
+
+	cl_repo_set_bool(g_repo, "core.splitIndex", false);
+	cl_git_pass(git_index_write(index));
+	cl_assert(git_oid_iszero(&index->shared_id));
+	cl_assert_equal_sz(5, index_file_entrycount());
+
+	cl_git_pass(git_index_open(&reread, "splitindex/.git/index"));
+	cl_assert(git_oid_iszero(&reread->shared_id));
+	cl_assert_equal_sz(5, git_index_entrycount(reread));
+	git_index_free(reread);
+
+	git_index_free(index);
+}
+
+void test_index_splitindex__fails_without_shared_index(void)
+{
+	git_index *index;
+
+	cl_must_pass(p_unlink("splitindex/.git/sharedindex.39d890139ee5356c7ef572216cebcd27aa41f9df"));
+	cl_git_fail(git_repository_index(&index, g_repo));
 }
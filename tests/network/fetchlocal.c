@@ -1,9 +1,14 @@
 #include "clar_libgit2.h"
 
 #include "buffer.h"
+#include "fileops.h"
 #include "path.h"
 #include "remote.h"
 
+#ifndef GIT_WIN32
+# include <sys/resource.h>
+#endif
+
 static const char* tagger_name = "Vicent Marti";
 static const char* tagger_email = "vicent@github.com";
 static const char* tagger_message = "This is my tag.\n\nThere are many tags, but this one is mine\n";
@@ -510,3 +515,118 @@ void test_network_fetchlocal__prune_load_fetch_prune_config(void)
 	git_remote_free(origin);
 	git_repository_free(repo);
 }
+
+#define MANY_TIPS 3000
+
+static git_repository *many_tips_remote(void)
+{
+	git_repository *remote_repo = cl_git_sandbox_init("testrepo.git");
+	git_buf packed = GIT_BUF_INIT;
+	int i;
+
+	for (i = 0; i < MANY_TIPS; i++)
+		cl_git_pass(git_buf_printf(&packed,
+			"a65fedf39aefe402d3bb6e24df4d4f5fe4547750 refs/heads/many/%04d\n", i));
+
+	cl_git_append2file("testrepo.git/packed-refs", packed.ptr);
+	git_buf_dispose(&packed);
+
+	return remote_repo;
+}
+
+struct updated_tips {
+	git_repository *repo;
+	int count;
+};
+
+static int updated_tip_cb(const char *refname, const git_oid *a, const git_oid *b, void *payload)
+{
+	struct updated_tips *tips = payload;
+	git_oid id;
+
+	GIT_UNUSED(a);
+
+	/* the tip has been written by the time we hear of it */
+	cl_git_pass(git_reference_name_to_id(&id, tips->repo, refname));
+	cl_assert_equal_oid(b, &id);
+
+	tips->count++;
+	return 0;
+}
+
+void test_network_fetchlocal__many_tips_with_few_file_descriptors(void)
+{
+#ifdef GIT_WIN32
+	cl_skip();
+#else
+	git_repository *repo;
+	git_remote *origin;
+	git_reference *ref;
+	git_repository *remote_repo = many_tips_remote();
+	const char *url = cl_git_path_url(git_repository_path(remote_repo));
+	git_fetch_options options = GIT_FETCH_OPTIONS_INIT;
+	struct updated_tips tips = { NULL, 0 };
+	struct rlimit limit, lowered;
+	int error;
+
+	cl_set_cleanup(&cleanup_local_repo, "foo");
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+	cl_git_pass(git_remote_create(&origin, repo, GIT_REMOTE_ORIGIN, url));
+
+	tips.repo = repo;
+	options.callbacks.update_tips = updated_tip_cb;
+	options.callbacks.payload = &tips;
+
+	/* far fewer than the tips, which must not all be locked at once */
+	cl_must_pass(getrlimit(RLIMIT_NOFILE, &limit));
+	lowered = limit;
+	if (lowered.rlim_cur == RLIM_INFINITY || lowered.rlim_cur > 512)
+		lowered.rlim_cur = 512;
+	cl_must_pass(setrlimit(RLIMIT_NOFILE, &lowered));
+
+	error = git_remote_fetch(origin, NULL, &options, NULL);
+	cl_must_pass(setrlimit(RLIMIT_NOFILE, &limit));
+	cl_git_pass(error);
+
+	cl_assert(tips.count > MANY_TIPS);
+
+	cl_git_pass(git_reference_lookup(&ref, repo, "refs/remotes/origin/many/0000"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_lookup(&ref, repo, "refs/remotes/origin/many/2999"));
+	git_reference_free(ref);
+
+	git_remote_free(origin);
+	git_repository_free(repo);
+#endif
+}
+
+void test_network_fetchlocal__conflicting_tip_fails_its_batch(void)
+{
+	git_repository *repo;
+	git_remote *origin;
+	git_reference *ref;
+	git_repository *remote_repo = many_tips_remote();
+	const char *url = cl_git_path_url(git_repository_path(remote_repo));
+
+	cl_set_cleanup(&cleanup_local_repo, "foo");
+	cl_git_pass(git_repository_init(&repo, "foo", true));
+	cl_git_pass(git_remote_create(&origin, repo, GIT_REMOTE_ORIGIN, url));
+
+	/* the last tip cannot be written next to this reference */
+	cl_git_pass(git_futils_mkpath2file("foo/refs/remotes/origin/many/2999/blocker", 0777));
+	cl_git_mkfile("foo/refs/remotes/origin/many/2999/blocker",
+		"a65fedf39aefe402d3bb6e24df4d4f5fe4547750\n");
+
+	cl_git_fail(git_remote_fetch(origin, NULL, NULL, NULL));
+
+	/* the batches before the conflicting tip are written, its own is not */
+	cl_git_pass(git_reference_lookup(&ref, repo, "refs/remotes/origin/many/0000"));
+	git_reference_free(ref);
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, repo, "refs/remotes/origin/many/2998"));
+	cl_git_fail_with(GIT_ENOTFOUND,
+		git_reference_lookup(&ref, repo, "refs/remotes/origin/many/2999"));
+
+	git_remote_free(origin);
+	git_repository_free(repo);
+}
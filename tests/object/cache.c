@@ -14,6 +14,7 @@ void test_object_cache__cleanup(void)
 	g_repo = NULL;
 
 	git_libgit2_opts(GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_BLOB, (size_t)0);
+	git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)(256 * 1024 * 1024));
 }
 
 static struct {
@@ -285,3 +286,95 @@ void test_object_cache__fast_thread_rush(void)
 		g_repo = NULL;
 	}
 }
+
+void test_object_cache__stats(void)
+{
+	size_t hits, misses, evictions;
+	git_object *obj;
+	git_oid oid;
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_CACHE_STATS));
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert_equal_sz(0, hits);
+	cl_assert_equal_sz(0, misses);
+	cl_assert_equal_sz(0, evictions);
+
+	cl_git_pass(git_oid_fromstr(&oid, g_data[4].sha));
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert_equal_sz(0, hits);
+	cl_assert(misses > 0);
+
+	cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+	git_object_free(obj);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert_equal_sz(1, hits);
+
+	/* the counters of a freed repository are kept */
+	git_repository_free(g_repo);
+	g_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert_equal_sz(1, hits);
+}
+
+void test_object_cache__evicts_over_limit(void)
+{
+	size_t hits, misses, evictions;
+	git_object *obj;
+	git_oid oid;
+	int i;
+
+	git_libgit2_opts(
+		GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_BLOB, (size_t)32767);
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, (ssize_t)1));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_CACHE_STATS));
+
+	for (i = 0; g_data[i].sha != NULL; ++i) {
+		cl_git_pass(git_oid_fromstr(&oid, g_data[i].sha));
+		cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+		cl_assert(g_data[i].type == git_object_type(obj));
+		git_object_free(obj);
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert(evictions > 0);
+
+	/* the limit is global, so only the object stored last is kept */
+	cl_assert(git_cache_size(&g_repo->objects) <= 1);
+}
+
+void test_object_cache__limit_spans_shards(void)
+{
+	ssize_t max_storage = 128;
+	size_t hits, misses, evictions;
+	git_object *obj;
+	git_oid oid;
+	int i;
+
+	git_libgit2_opts(
+		GIT_OPT_SET_CACHE_OBJECT_LIMIT, (int)GIT_OBJECT_BLOB, (size_t)32767);
+
+	cl_git_pass(git_repository_open(&g_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_CACHE_MAX_SIZE, max_storage));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_CACHE_STATS));
+
+	for (i = 0; g_data[i].sha != NULL; ++i) {
+		cl_git_pass(git_oid_fromstr(&oid, g_data[i].sha));
+		cl_git_pass(git_object_lookup(&obj, g_repo, &oid, GIT_OBJECT_ANY));
+		git_object_free(obj);
+
+		cl_assert(git_cache__current_storage.val <= max_storage);
+	}
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_CACHE_STATS, &hits, &misses, &evictions));
+	cl_assert(evictions > 0);
+	cl_assert(git_cache_size(&g_repo->objects) > 1);
+}
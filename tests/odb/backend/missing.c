@@ -0,0 +1,222 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "backend_helpers.h"
+
+static git_odb *_odb;
+static fake_backend *_fake;
+static int _refresh_interval;
+
+#define NONEXISTING_HASH "deadbeefdeadbeefdeadbeefdeadbeefdeadbeef"
+#define NONEXISTING_HASH2 "badc0ffeebadc0ffeebadc0ffeebadc0ffeebadc"
+#define EXISTING_HASH "e69de29bb2d1d6434b8b29ae775ad8c2e48c5391"
+
+static const fake_object _objects[] = {
+	{ EXISTING_HASH, "" },
+	{ NULL, NULL }
+};
+
+static int fake_backend__refresh(git_odb_backend *backend)
+{
+	((fake_backend *)backend)->refresh_calls++;
+	return 0;
+}
+
+void test_odb_backend_missing__initialize(void)
+{
+	git_odb_backend *backend;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_ODB_REFRESH_INTERVAL, &_refresh_interval));
+
+	cl_git_pass(git_odb_new(&_odb));
+	cl_git_pass(build_fake_backend(&backend, _objects));
+	backend->refresh = fake_backend__refresh;
+	cl_git_pass(git_odb_add_backend(_odb, backend, 10));
+
+	_fake = (fake_backend *)backend;
+}
+
+void test_odb_backend_missing__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_REFRESH_INTERVAL, _refresh_interval));
+
+	git_odb_free(_odb);
+	_odb = NULL;
+
+	cl_fixture_cleanup("testrepo.git");
+}
+
+void test_odb_backend_missing__custom_backend_is_refreshed_again(void)
+{
+	git_odb_object *obj;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, NONEXISTING_HASH));
+
+	/* nothing tells us when the fake backend gains objects */
+	cl_assert_equal_b(false, git_odb_exists(_odb, &id));
+	cl_assert_equal_i(1, _fake->refresh_calls);
+	cl_assert_equal_i(2, _fake->exists_calls);
+
+	cl_assert_equal_b(false, git_odb_exists(_odb, &id));
+	cl_assert_equal_i(2, _fake->refresh_calls);
+	cl_assert_equal_i(4, _fake->exists_calls);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb_read(&obj, _odb, &id));
+	cl_assert_equal_i(3, _fake->refresh_calls);
+	cl_assert_equal_i(2, _fake->read_calls);
+	cl_assert(_odb->missing == NULL);
+}
+
+void test_odb_backend_missing__other_ids_are_refreshed(void)
+{
+	git_oid id1, id2;
+
+	cl_git_pass(git_oid_fromstr(&id1, NONEXISTING_HASH));
+	cl_git_pass(git_oid_fromstr(&id2, NONEXISTING_HASH2));
+
+	cl_assert_equal_b(false, git_odb_exists(_odb, &id1));
+	cl_assert_equal_b(false, git_odb_exists(_odb, &id2));
+	cl_assert_equal_i(2, _fake->refresh_calls);
+}
+
+void test_odb_backend_missing__refresh_interval(void)
+{
+	git_oid id1, id2;
+	int interval;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_ODB_REFRESH_INTERVAL, 60 * 60 * 1000));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_ODB_REFRESH_INTERVAL, &interval));
+	cl_assert_equal_i(60 * 60 * 1000, interval);
+
+	cl_git_pass(git_oid_fromstr(&id1, NONEXISTING_HASH));
+	cl_git_pass(git_oid_fromstr(&id2, NONEXISTING_HASH2));
+
+	cl_assert_equal_b(false, git_odb_exists(_odb, &id1));
+	cl_assert_equal_b(false, git_odb_exists(_odb, &id2));
+	cl_assert_equal_i(1, _fake->refresh_calls);
+
+	/* explicit refreshes are not rate-limited */
+	cl_git_pass(git_odb_refresh(_odb));
+	cl_assert_equal_i(2, _fake->refresh_calls);
+}
+
+void test_odb_backend_missing__finds_existing_objects(void)
+{
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, EXISTING_HASH));
+
+	cl_assert_equal_b(true, git_odb_exists(_odb, &id));
+	cl_assert_equal_i(0, _fake->refresh_calls);
+}
+
+#define PACKED_ID "41bc8c69075bbdb46c5c6f0566cc8cc5b46e8bd9"
+#define PACKED_BASENAME "pack-d7c6adf9f61318f041845b01440d09aa7a91e1b5"
+
+static void open_settled_sandbox(git_odb **odb)
+{
+	struct p_timeval old_times[2];
+
+	cl_fixture_sandbox("testrepo.git");
+
+	/* a pack directory that changed within the last second is racy */
+	old_times[0].tv_sec = 1234567890;
+	old_times[0].tv_usec = 0;
+	old_times[1].tv_sec = 1234567890;
+	old_times[1].tv_usec = 0;
+	cl_must_pass(p_utimes("testrepo.git/objects/pack", old_times));
+
+	cl_git_pass(git_odb_open(odb, "testrepo.git/objects"));
+}
+
+void test_odb_backend_missing__watched_packs_remember_missing_ids(void)
+{
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, NONEXISTING_HASH));
+	open_settled_sandbox(&odb);
+
+	cl_assert_equal_b(false, git_odb_exists(odb, &id));
+	cl_assert(odb->missing && git_oidmap_exists(odb->missing, &id));
+
+	git_odb_free(odb);
+}
+
+void test_odb_backend_missing__custom_backend_is_not_trusted(void)
+{
+	git_odb *odb;
+	git_odb_backend *backend;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, NONEXISTING_HASH));
+	open_settled_sandbox(&odb);
+
+	cl_assert_equal_b(false, git_odb_exists(odb, &id));
+	cl_assert(odb->missing && git_oidmap_exists(odb->missing, &id));
+
+	cl_git_pass(build_fake_backend(&backend, _objects));
+	backend->refresh = fake_backend__refresh;
+	cl_git_pass(git_odb_add_backend(odb, backend, 10));
+
+	/* the id was remembered before, but the new backend must be asked */
+	cl_assert_equal_b(false, git_odb_exists(odb, &id));
+	cl_assert_equal_i(1, ((fake_backend *)backend)->refresh_calls);
+
+	cl_assert_equal_b(false, git_odb_exists(odb, &id));
+	cl_assert_equal_i(2, ((fake_backend *)backend)->refresh_calls);
+
+	git_odb_free(odb);
+}
+
+void test_odb_backend_missing__finds_added_pack(void)
+{
+	git_odb *odb;
+	git_oid id;
+	struct p_timeval old_times[2];
+
+	cl_fixture_sandbox("testrepo.git");
+
+	cl_git_pass(p_rename("testrepo.git/objects/pack/" PACKED_BASENAME ".idx",
+		"testrepo.git/" PACKED_BASENAME ".idx"));
+	cl_git_pass(p_rename("testrepo.git/objects/pack/" PACKED_BASENAME ".pack",
+		"testrepo.git/" PACKED_BASENAME ".pack"));
+
+	old_times[0].tv_sec = 1234567890;
+	old_times[0].tv_usec = 0;
+	old_times[1].tv_sec = 1234567890;
+	old_times[1].tv_usec = 0;
+	cl_must_pass(p_utimes("testrepo.git/objects/pack", old_times));
+
+	cl_git_pass(git_oid_fromstr(&id, PACKED_ID));
+	cl_git_pass(git_odb_open(&odb, "testrepo.git/objects"));
+
+	cl_assert_equal_b(false, git_odb_exists(odb, &id));
+	cl_assert_equal_b(false, git_odb_exists(odb, &id));
+
+	cl_git_pass(p_rename("testrepo.git/" PACKED_BASENAME ".idx",
+		"testrepo.git/objects/pack/" PACKED_BASENAME ".idx"));
+	cl_git_pass(p_rename("testrepo.git/" PACKED_BASENAME ".pack",
+		"testrepo.git/objects/pack/" PACKED_BASENAME ".pack"));
+
+	cl_assert_equal_b(true, git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+}
+
+void test_odb_backend_missing__explicit_refresh_forgets(void)
+{
+	git_odb *odb;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, NONEXISTING_HASH));
+	open_settled_sandbox(&odb);
+
+	cl_assert_equal_b(false, git_odb_exists(odb, &id));
+	cl_assert(git_oidmap_exists(odb->missing, &id));
+
+	cl_git_pass(git_odb_refresh(odb));
+	cl_assert(!git_oidmap_exists(odb->missing, &id));
+
+	git_odb_free(odb);
+}
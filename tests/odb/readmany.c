@@ -0,0 +1,139 @@
+#include "clar_libgit2.h"
+#include "odb.h"
+#include "fileops.h"
+#include "pack_data.h"
+
+static git_odb *_odb;
+static unsigned int g_read_threads;
+
+void test_odb_readmany__initialize(void)
+{
+	g_read_threads = git_odb__read_threads;
+	git_odb__read_threads = 4;
+
+	cl_git_pass(git_odb_open(&_odb, cl_fixture("testrepo.git/objects")));
+}
+
+void test_odb_readmany__cleanup(void)
+{
+	git_odb__read_threads = g_read_threads;
+
+	git_odb_free(_odb);
+	_odb = NULL;
+
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_read_many(const char **ids, size_t count)
+{
+	git_oid *oids;
+	git_odb_object **objs, *obj;
+	size_t i;
+
+	oids = git__calloc(count, sizeof(git_oid));
+	objs = git__calloc(count, sizeof(git_odb_object *));
+	cl_assert(oids && objs);
+
+	for (i = 0; i < count; i++)
+		cl_git_pass(git_oid_fromstr(&oids[i], ids[i]));
+
+	cl_git_pass(git_odb_read_many(objs, _odb, oids, count));
+
+	for (i = 0; i < count; i++) {
+		cl_assert(objs[i]);
+		cl_assert_equal_oid(&oids[i], git_odb_object_id(objs[i]));
+
+		cl_git_pass(git_odb_read(&obj, _odb, &oids[i]));
+		cl_assert_equal_i(git_odb_object_type(obj), git_odb_object_type(objs[i]));
+		cl_assert_equal_sz(git_odb_object_size(obj), git_odb_object_size(objs[i]));
+		cl_assert(memcmp(git_odb_object_data(obj), git_odb_object_data(objs[i]),
+			git_odb_object_size(obj)) == 0);
+
+		git_odb_object_free(obj);
+		git_odb_object_free(objs[i]);
+	}
+
+	git__free(objs);
+	git__free(oids);
+}
+
+void test_odb_readmany__packed(void)
+{
+	assert_read_many(packed_objects, ARRAY_SIZE(packed_objects));
+}
+
+void test_odb_readmany__loose(void)
+{
+	assert_read_many(loose_objects, ARRAY_SIZE(loose_objects));
+}
+
+void test_odb_readmany__mixed_and_cached(void)
+{
+	const char *ids[] = {
+		"fd8430bc864cfcd5f10e5590f8a447e01b942bfe",
+		"a8233120f6ad708f843d861ce2b7228ec4e3dec6",
+		"4b825dc642cb6eb9a060e54bf8d69288fbee4904",
+		"0266163a49e280c4f5ed1e08facd36a2bd716bcf",
+		"fd8430bc864cfcd5f10e5590f8a447e01b942bfe",
+	};
+	git_odb_object *obj;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, ids[3]));
+	cl_git_pass(git_odb_read(&obj, _odb, &id));
+
+	assert_read_many(ids, ARRAY_SIZE(ids));
+
+	git_odb_object_free(obj);
+}
+
+void test_odb_readmany__fails_on_missing_object(void)
+{
+	git_odb_object *objs[3];
+	git_oid ids[3];
+
+	cl_git_pass(git_oid_fromstr(&ids[0], packed_objects[0]));
+	cl_git_pass(git_oid_fromstr(&ids[1], "1234567890123456789012345678901234567890"));
+	cl_git_pass(git_oid_fromstr(&ids[2], loose_objects[0]));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_odb_read_many(objs, _odb, ids, 3));
+	cl_assert(objs[0] == NULL && objs[1] == NULL && objs[2] == NULL);
+}
+
+void test_odb_readmany__reads_nothing(void)
+{
+	cl_git_pass(git_odb_read_many(NULL, _odb, NULL, 0));
+}
+
+void test_odb_readmany__reports_corrupt_object(void)
+{
+	const char *pack = "testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack";
+	git_odb_object *objs[ARRAY_SIZE(packed_objects) + 1];
+	git_oid ids[ARRAY_SIZE(packed_objects) + 1];
+	git_buf buf = GIT_BUF_INIT;
+	const git_error *err;
+	size_t i;
+
+	cl_git_sandbox_init("testrepo.git");
+
+	/* garble the deflated data of blob 627513e7, stored whole at 86764 */
+	cl_git_pass(git_futils_readbuffer(&buf, pack));
+	memset(buf.ptr + 86764 + 64, 0xff, 64);
+	cl_git_pass(git_futils_writebuffer(&buf, pack, O_WRONLY | O_TRUNC, 0666));
+	git_buf_dispose(&buf);
+
+	git_odb_free(_odb);
+	cl_git_pass(git_odb_open(&_odb, "testrepo.git/objects"));
+
+	for (i = 0; i < ARRAY_SIZE(packed_objects); i++)
+		cl_git_pass(git_oid_fromstr(&ids[i], packed_objects[i]));
+	cl_git_pass(git_oid_fromstr(&ids[i], "627513e78ae0c8dbcdb62e371ea674495c841aca"));
+
+	cl_git_fail(git_odb_read_many(objs, _odb, ids, ARRAY_SIZE(ids)));
+
+	cl_assert((err = git_error_last()) != NULL);
+	cl_assert_equal_i(GIT_ERROR_ZLIB, err->klass);
+
+	for (i = 0; i < ARRAY_SIZE(ids); i++)
+		cl_assert(objs[i] == NULL);
+}
@@ -0,0 +1,97 @@
+#include "clar_libgit2.h"
+
+#include "pack.h"
+
+static git_repository *_repo;
+static git_odb *_odb;
+
+void test_pack_basecache__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_DELTA_BASE_CACHE_STATS));
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+}
+
+void test_pack_basecache__cleanup(void)
+{
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+	_odb = NULL;
+	_repo = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE,
+		(size_t)GIT_PACK_CACHE_MEMORY_LIMIT));
+}
+
+static int read_cb(const git_oid *id, void *payload)
+{
+	git_odb_object *obj;
+
+	GIT_UNUSED(payload);
+
+	cl_git_pass(git_odb_read(&obj, _odb, id));
+	git_odb_object_free(obj);
+	return 0;
+}
+
+static void read_all_twice(void)
+{
+	cl_git_pass(git_odb_foreach(_odb, read_cb, NULL));
+
+	/* drop the objects so that the second pass unpacks them again */
+	git_odb_free(_odb);
+	git_repository_free(_repo);
+	cl_git_pass(git_repository_open(&_repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&_odb, _repo));
+
+	cl_git_pass(git_odb_foreach(_odb, read_cb, NULL));
+}
+
+void test_pack_basecache__max_size(void)
+{
+	size_t limit;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_MAX_SIZE, &limit));
+	cl_assert_equal_sz(GIT_PACK_CACHE_MEMORY_LIMIT, limit);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, (size_t)1024));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_MAX_SIZE, &limit));
+	cl_assert_equal_sz(1024, limit);
+}
+
+void test_pack_basecache__stats(void)
+{
+	size_t hits, misses, evictions, used;
+
+	read_all_twice();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&hits, &misses, &evictions, &used));
+	cl_assert(hits > 0);
+	cl_assert(misses > 0);
+	cl_assert_equal_sz(0, evictions);
+	cl_assert(used > 0);
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_RESET_DELTA_BASE_CACHE_STATS));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&hits, &misses, &evictions, &used));
+	cl_assert_equal_sz(0, hits);
+	cl_assert_equal_sz(0, misses);
+	cl_assert_equal_sz(0, evictions);
+}
+
+void test_pack_basecache__stays_within_budget(void)
+{
+	size_t hits, misses, evictions, used;
+	size_t limit = GIT_PACK_CACHE_SHARDS * 16 * 1024;
+
+	/* every shard gets an equal share, which must fit some bases */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_DELTA_BASE_CACHE_MAX_SIZE, limit));
+
+	read_all_twice();
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_DELTA_BASE_CACHE_STATS,
+		&hits, &misses, &evictions, &used));
+	cl_assert(evictions > 0);
+	cl_assert(used <= limit);
+}
@@ -0,0 +1,55 @@
+#include "clar_libgit2.h"
+
+#include "pack.h"
+
+static struct git_pack_file *_pack;
+
+static int first_entry(const git_oid *id, void *payload)
+{
+	git_oid_cpy(payload, id);
+	return 1;
+}
+
+void test_pack_fullmap__initialize(void)
+{
+	struct git_pack_entry e;
+	git_oid id;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_FULL_MMAP, 1));
+	cl_git_pass(git_packfile_alloc(&_pack,
+		cl_fixture("testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx")));
+
+	/* Looking an object up opens the pack */
+	cl_git_fail_with(1, git_pack_foreach_entry(_pack, first_entry, &id));
+	cl_git_pass(git_pack_entry_find(&e, _pack, &id, GIT_OID_HEXSZ));
+}
+
+void test_pack_fullmap__cleanup(void)
+{
+	git_packfile_free(_pack);
+	_pack = NULL;
+
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_FULL_MMAP, 0));
+}
+
+void test_pack_fullmap__offsets_past_the_end_fail(void)
+{
+	git_mwindow *w = NULL;
+	unsigned int left;
+	git_off_t size;
+
+	if (!_pack->mwf.full_map.data)
+		cl_skip();
+
+	size = _pack->mwf.size;
+
+	cl_assert(git_mwindow_open(&_pack->mwf, &w, size - 20, 20, &left) != NULL);
+	cl_assert_equal_i(20, left);
+
+	cl_assert(git_mwindow_open(&_pack->mwf, &w, size - 10, 20, &left) == NULL);
+	cl_assert(git_mwindow_open(&_pack->mwf, &w, size + 4096, 0, &left) == NULL);
+	cl_assert(git_mwindow_open(&_pack->mwf, &w, -1, 0, &left) == NULL);
+	cl_assert(git_mwindow_open(&_pack->mwf, &w, 12, SIZE_MAX, &left) == NULL);
+
+	git_mwindow_close(&w);
+}
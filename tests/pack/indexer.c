@@ -112,6 +112,146 @@ void test_pack_indexer__out_of_order(void)
 	git_indexer_free(idx);
 }
 
+void test_pack_indexer__out_of_order_threaded(void)
+{
+	git_indexer *idx = 0;
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer_progress stats = { 0 };
+
+	opts.threads = 4;
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, &opts));
+	cl_git_pass(git_indexer_append(
+		idx, out_of_order_pack, out_of_order_pack_len, &stats));
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert_equal_i(stats.total_objects, 3);
+	cl_assert_equal_i(stats.received_objects, 3);
+	cl_assert_equal_i(stats.indexed_objects, 3);
+	cl_assert_equal_i(stats.indexed_deltas, 2);
+
+	git_indexer_free(idx);
+}
+
+static const char *testrepo_pack =
+	"testrepo.git/objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.pack";
+
+static void index_testrepo_pack(
+	git_buf *idx_contents, git_indexer_options *opts, size_t chunk)
+{
+	git_indexer *idx = NULL;
+	git_indexer_progress stats = { 0 };
+	git_buf pack = GIT_BUF_INIT, path = GIT_BUF_INIT;
+	size_t i, len;
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(testrepo_pack)));
+
+	if (!chunk)
+		chunk = pack.size;
+
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, opts));
+
+	for (i = 0; i < pack.size; i += len) {
+		len = min(chunk, pack.size - i);
+		cl_git_pass(git_indexer_append(idx, pack.ptr + i, len, &stats));
+	}
+
+	cl_git_pass(git_indexer_commit(idx, &stats));
+
+	cl_assert(stats.indexed_deltas > 0);
+	cl_assert_equal_i(stats.total_objects, stats.received_objects);
+	cl_assert_equal_i(stats.total_objects, stats.indexed_objects);
+
+	cl_git_pass(git_buf_printf(&path, "pack-%s.idx",
+		git_oid_tostr_s(git_indexer_hash(idx))));
+	cl_git_pass(git_futils_readbuffer(idx_contents, path.ptr));
+
+	git_indexer_free(idx);
+	git_buf_dispose(&path);
+	git_buf_dispose(&pack);
+}
+
+void test_pack_indexer__threaded_matches_serial(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_buf serial = GIT_BUF_INIT, threaded = GIT_BUF_INIT;
+
+	index_testrepo_pack(&serial, NULL, 0);
+
+	opts.threads = 8;
+	index_testrepo_pack(&threaded, &opts, 0);
+
+	cl_assert_equal_i(serial.size, threaded.size);
+	cl_assert(memcmp(serial.ptr, threaded.ptr, serial.size) == 0);
+
+	git_buf_dispose(&serial);
+	git_buf_dispose(&threaded);
+}
+
+void test_pack_indexer__pipelined_matches_serial(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_buf serial = GIT_BUF_INIT, pipelined = GIT_BUF_INIT;
+
+	index_testrepo_pack(&serial, NULL, 1000);
+
+	/* Appends larger than the buffer have to wait for it to drain */
+	opts.pipeline_buffer_size = 4096;
+	index_testrepo_pack(&pipelined, &opts, 1000);
+	cl_assert_equal_i(serial.size, pipelined.size);
+	cl_assert(memcmp(serial.ptr, pipelined.ptr, serial.size) == 0);
+	git_buf_dispose(&pipelined);
+
+	opts.pipeline_buffer_size = 333;
+	index_testrepo_pack(&pipelined, &opts, 1000);
+	cl_assert_equal_i(serial.size, pipelined.size);
+	cl_assert(memcmp(serial.ptr, pipelined.ptr, serial.size) == 0);
+
+	git_buf_dispose(&serial);
+	git_buf_dispose(&pipelined);
+}
+
+void test_pack_indexer__pipelined_reports_errors(void)
+{
+	static const unsigned char bad_signature[] = {
+		0x50, 0x41, 0x43, 0x58, 0x00, 0x00, 0x00, 0x02,
+		0x00, 0x00, 0x00, 0x01
+	};
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer *idx = NULL;
+	git_indexer_progress stats = { 0 };
+
+	opts.pipeline_buffer_size = 1024;
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, &opts));
+
+	/* The error may be found before or after this returns */
+	git_indexer_append(idx, bad_signature, sizeof(bad_signature), &stats);
+	cl_git_fail(git_indexer_commit(idx, &stats));
+
+	cl_assert(git_error_last() != NULL);
+	cl_assert_equal_i(git_error_last()->klass, GIT_ERROR_INDEXER);
+	cl_assert_equal_s(git_error_last()->message, "wrong pack signature");
+
+	git_indexer_free(idx);
+}
+
+void test_pack_indexer__pipelined_can_be_abandoned(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	git_indexer *idx = NULL;
+	git_indexer_progress stats = { 0 };
+	git_buf pack = GIT_BUF_INIT;
+
+	cl_git_pass(git_futils_readbuffer(&pack, cl_fixture(testrepo_pack)));
+
+	opts.pipeline_buffer_size = 512;
+	cl_git_pass(git_indexer_new(&idx, ".", 0, NULL, &opts));
+	cl_git_pass(git_indexer_append(idx, pack.ptr, pack.size / 2, &stats));
+	git_indexer_free(idx);
+
+	git_buf_dispose(&pack);
+}
+
 void test_pack_indexer__missing_trailer(void)
 {
 	git_indexer *idx = 0;
@@ -210,7 +350,7 @@ void test_pack_indexer__fix_thin(void)
 	}
 }
 
-void test_pack_indexer__corrupt_length(void)
+static void index_corrupt_thin_pack(git_indexer_options *opts)
 {
 	git_indexer *idx = NULL;
 	git_indexer_progress stats = { 0 };
@@ -226,7 +366,7 @@ void test_pack_indexer__corrupt_length(void)
 	git_oid_fromstr(&should_id, "e68fe8129b546b101aee9510c5328e7f21ca1d18");
 	cl_assert_equal_oid(&should_id, &id);
 
-	cl_git_pass(git_indexer_new(&idx, ".", 0, odb, NULL));
+	cl_git_pass(git_indexer_new(&idx, ".", 0, odb, opts));
 	cl_git_pass(git_indexer_append(
 		idx, corrupt_thin_pack, corrupt_thin_pack_len, &stats));
 	cl_git_fail(git_indexer_commit(idx, &stats));
@@ -239,6 +379,20 @@ void test_pack_indexer__corrupt_length(void)
 	git_repository_free(repo);
 }
 
+void test_pack_indexer__corrupt_length(void)
+{
+	index_corrupt_thin_pack(NULL);
+}
+
+void test_pack_indexer__corrupt_length_threaded(void)
+{
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+
+	/* the error of the worker is the one reported */
+	opts.threads = 4;
+	index_corrupt_thin_pack(&opts);
+}
+
 void test_pack_indexer__incomplete_pack_fails_with_strict(void)
 {
 	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
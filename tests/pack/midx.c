@@ -0,0 +1,227 @@
+#include "clar_libgit2.h"
+
+#include <git2.h>
+#include <git2/sys/midx.h>
+
+#include "midx.h"
+
+static git_repository *_repo;
+
+void test_pack_midx__initialize(void)
+{
+	_repo = cl_git_sandbox_init("testrepo.git");
+}
+
+void test_pack_midx__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	_repo = NULL;
+}
+
+static int add_idx_cb(void *payload, git_buf *path)
+{
+	git_midx_writer *w = (git_midx_writer *)payload;
+	char *name;
+	int error;
+
+	if (git__suffixcmp(git_buf_cstr(path), ".idx") != 0)
+		return 0;
+
+	name = git_path_basename(git_buf_cstr(path));
+	error = git_midx_writer_add(w, name);
+	git__free(name);
+
+	return error;
+}
+
+static void dump_midx(git_buf *out)
+{
+	git_midx_writer *w;
+	git_buf path = GIT_BUF_INIT;
+
+	cl_git_pass(git_midx_writer_new(&w, "testrepo.git/objects/pack"));
+	cl_git_pass(git_buf_sets(&path, "testrepo.git/objects/pack"));
+	cl_git_pass(git_path_direach(&path, 0, add_idx_cb, w));
+	cl_git_pass(git_midx_writer_dump(out, w));
+
+	git_buf_dispose(&path);
+	git_midx_writer_free(w);
+}
+
+static int count_cb(const git_oid *oid, void *payload)
+{
+	GIT_UNUSED(oid);
+	(*(size_t *)payload)++;
+	return 0;
+}
+
+void test_pack_midx__parse(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_midx_file *idx;
+	git_midx_entry e;
+	git_oid id;
+	size_t count = 0;
+
+	dump_midx(&buf);
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	cl_assert(idx);
+	cl_git_pass(git_midx_parse(idx, (const unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_i(3, git_vector_length(&idx->packfile_names));
+	cl_assert_equal_s("pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx",
+		git_vector_get(&idx->packfile_names, 0));
+
+	cl_git_pass(git_midx_foreach_entry(idx, count_cb, &count));
+	cl_assert_equal_i(idx->num_objects, count);
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+	cl_assert_equal_oid(&id, &e.sha1);
+	cl_assert_equal_i(1, e.pack_index);
+	cl_assert_equal_i(169, e.offset);
+
+	cl_git_pass(git_oid_fromstrn(&id, "5001298e", 8));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, 8));
+	cl_assert_equal_s("5001298e0c09ad9c34e4249bc5801c75e9754fa5", git_oid_tostr_s(&e.sha1));
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert_equal_i(GIT_ENOTFOUND, git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+
+	git_midx_free(idx);
+	git_buf_dispose(&buf);
+}
+
+void test_pack_midx__offsets_without_large_offsets_chunk(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_midx_file *idx;
+	git_midx_entry e;
+	git_oid id;
+	unsigned char *offsets;
+	size_t i;
+
+	dump_midx(&buf);
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	cl_assert(idx);
+	cl_git_pass(git_midx_parse(idx, (const unsigned char *)buf.ptr, buf.size));
+	cl_assert(idx->object_large_offsets == NULL);
+
+	/* Packs between 2 and 4GB have 32-bit offsets with the top bit set */
+	offsets = (unsigned char *)idx->object_offsets;
+	for (i = 0; i < idx->num_objects; i++)
+		offsets[i * 8 + 4] |= 0x80;
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_midx_entry_find(&e, idx, &id, GIT_OID_HEXSZ));
+	cl_assert(e.offset == 0x80000000 + 169);
+
+	git_midx_free(idx);
+	git_buf_dispose(&buf);
+}
+
+void test_pack_midx__parse_rejects_garbage(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_midx_file *idx;
+
+	dump_midx(&buf);
+
+	idx = git__calloc(1, sizeof(git_midx_file));
+	cl_assert(idx);
+
+	/* Truncated file. */
+	cl_git_fail(git_midx_parse(idx, (const unsigned char *)buf.ptr, 12));
+
+	/* Bad signature. */
+	buf.ptr[0] = 'X';
+	cl_git_fail(git_midx_parse(idx, (const unsigned char *)buf.ptr, buf.size));
+
+	git_midx_free(idx);
+	git_buf_dispose(&buf);
+}
+
+void test_pack_midx__lookup(void)
+{
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+	size_t before = 0, after = 0;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_foreach(odb, count_cb, &before));
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+	git_odb_free(odb);
+
+	cl_assert(git_path_isfile("testrepo.git/objects/pack/multi-pack-index"));
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	cl_git_pass(git_odb_foreach(odb, count_cb, &after));
+	cl_assert(after > 0 && after <= before);
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_assert(git_odb_exists(odb, &id));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	cl_assert_equal_i(GIT_OBJECT_COMMIT, git_odb_object_type(obj));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_oid_fromstrn(&id, "e90810b8df3", 11));
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &id, 11));
+	cl_assert_equal_s("e90810b8df3e80c413d903f631643c716887138d",
+		git_oid_tostr_s(git_odb_object_id(obj)));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_oid_fromstr(&id, "0000000000000000000000000000000000000001"));
+	cl_assert(!git_odb_exists(odb, &id));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+}
+
+void test_pack_midx__stale_index_falls_back_to_packs(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+	git_midx_file *idx;
+	git_repository *repo;
+	git_odb *odb;
+	git_odb_object *obj;
+	git_oid id;
+	unsigned char *offsets;
+	size_t i;
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_odb_write_multi_pack_index(odb));
+	git_odb_free(odb);
+
+	/* Point every object at a pack the index doesn't list */
+	cl_git_pass(git_futils_readbuffer(&buf, "testrepo.git/objects/pack/multi-pack-index"));
+	idx = git__calloc(1, sizeof(git_midx_file));
+	cl_assert(idx);
+	cl_git_pass(git_midx_parse(idx, (const unsigned char *)buf.ptr, buf.size));
+
+	offsets = (unsigned char *)idx->object_offsets;
+	for (i = 0; i < idx->num_objects; i++)
+		offsets[i * 8] = 0x7f;
+
+	git_midx_free(idx);
+	cl_git_pass(git_futils_writebuffer(&buf, "testrepo.git/objects/pack/multi-pack-index", 0, 0644));
+
+	cl_git_pass(git_repository_open(&repo, "testrepo.git"));
+	cl_git_pass(git_repository_odb(&odb, repo));
+
+	cl_git_pass(git_oid_fromstr(&id, "5001298e0c09ad9c34e4249bc5801c75e9754fa5"));
+	cl_git_pass(git_odb_read(&obj, odb, &id));
+	git_odb_object_free(obj);
+
+	cl_git_pass(git_oid_fromstrn(&id, "5001298e", 8));
+	cl_git_pass(git_odb_read_prefix(&obj, odb, &id, 8));
+	git_odb_object_free(obj);
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+	git_buf_dispose(&buf);
+}
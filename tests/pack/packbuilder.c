@@ -1,6 +1,8 @@
 #include "clar_libgit2.h"
 #include "fileops.h"
 #include "pack.h"
+#include "pack-bitmap.h"
+#include "pack-objects.h"
 #include "hash.h"
 #include "iterator.h"
 #include "vector.h"
@@ -270,3 +272,439 @@ void test_pack_packbuilder__keep_file_check(void)
 	cl_git_pass(git_libgit2_opts(GIT_OPT_DISABLE_PACK_KEEP_FILE_CHECKS, true));
 	assert(git_disable_pack_keep_file_checks);
 }
+
+void test_pack_packbuilder__write_bitmap(void)
+{
+	struct git_pack_file *pack;
+	git_pack_bitmap_index *idx;
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_oid head;
+
+	seed_packbuilder();
+	cl_git_pass(git_packbuilder_set_write_bitmap(_packbuilder, 1));
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, NULL, NULL));
+
+	cl_assert(git_path_isfile("pack-7f5fa362c664d68ba7221259be1cbd187434b2f0.bitmap"));
+
+	cl_git_pass(git_mwindow_get_pack(&pack, "pack-7f5fa362c664d68ba7221259be1cbd187434b2f0.idx"));
+	cl_git_pass(git_packfile_bitmap(&idx, pack));
+	cl_assert_equal_sz(git_packbuilder_object_count(_packbuilder),
+		git_pack_bitmap_index_entrycount(idx));
+
+	/* HEAD reaches every object of the pack. */
+	cl_git_pass(git_reference_name_to_id(&head, _repo, "HEAD"));
+	cl_git_pass(git_pack_bitmap_index_fill(&bitmap, idx, _repo, &head));
+	cl_assert_equal_sz(git_packbuilder_object_count(_packbuilder),
+		git_bitmap_count(&bitmap));
+
+	git_bitmap_dispose(&bitmap);
+	git_mwindow_put_pack(pack);
+}
+
+void test_pack_packbuilder__no_bitmap_without_closure(void)
+{
+	git_buf path = GIT_BUF_INIT;
+	git_oid head;
+
+	/* The commit alone does not contain the objects reachable from it. */
+	cl_git_pass(git_reference_name_to_id(&head, _repo, "HEAD"));
+	cl_git_pass(git_packbuilder_insert(_packbuilder, &head, NULL));
+	cl_git_pass(git_packbuilder_set_write_bitmap(_packbuilder, 1));
+	cl_git_pass(git_packbuilder_write(_packbuilder, ".", 0, NULL, NULL));
+
+	cl_git_pass(git_buf_printf(&path, "pack-%s",
+		git_oid_tostr_s(git_packbuilder_hash(_packbuilder))));
+	cl_git_pass(git_buf_puts(&path, ".pack"));
+	cl_assert(git_path_isfile(path.ptr));
+
+	git_buf_truncate(&path, git_buf_len(&path) - strlen(".pack"));
+	cl_git_pass(git_buf_puts(&path, ".bitmap"));
+	cl_assert(!git_path_exists(path.ptr));
+
+	git_buf_dispose(&path);
+}
+
+static void put_ewah_word(unsigned char *out, uint64_t word)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, word >>= 8)
+		out[i] = (unsigned char)word;
+}
+
+void test_pack_packbuilder__rejects_corrupt_ewah(void)
+{
+	git_bitmap bitmap = GIT_BITMAP_INIT;
+	git_buf buf = GIT_BUF_INIT;
+	unsigned char data[8 + 3 * 8 + 4] = { 0 };
+	size_t consumed;
+
+	/* 64 bits in one RLW... */
+	data[3] = 64;
+	data[7] = 1;
+
+	/* ...which claims a run of a million words */
+	put_ewah_word(data + 8, 1 | ((uint64_t)1 << 20 << 1));
+	cl_git_fail(git_bitmap_read_ewah(&bitmap, &consumed, data, 8 + 8 + 4));
+	cl_assert_equal_i(GIT_ERROR_ODB, git_error_last()->klass);
+
+	/* ...or two literal words */
+	data[7] = 3;
+	put_ewah_word(data + 8, (uint64_t)2 << 33);
+	put_ewah_word(data + 16, 0x5);
+	put_ewah_word(data + 24, 0x5);
+	cl_git_fail(git_bitmap_read_ewah(&bitmap, &consumed, data, sizeof(data)));
+	cl_assert_equal_i(GIT_ERROR_ODB, git_error_last()->klass);
+
+	/* the words are cut short */
+	cl_git_fail(git_bitmap_read_ewah(&bitmap, &consumed, data, sizeof(data) - 1));
+	cl_git_fail(git_bitmap_read_ewah(&bitmap, &consumed, data, 6));
+
+	/* one literal word is fine */
+	data[7] = 2;
+	put_ewah_word(data + 8, (uint64_t)1 << 33);
+	cl_git_pass(git_bitmap_read_ewah(&bitmap, &consumed, data, sizeof(data)));
+	cl_assert_equal_sz(8 + 2 * 8 + 4, consumed);
+	cl_assert_equal_sz(2, git_bitmap_count(&bitmap));
+
+	cl_git_pass(git_bitmap_write_ewah(&buf, &bitmap));
+	cl_git_pass(git_bitmap_read_ewah(&bitmap, &consumed, (unsigned char *)buf.ptr, buf.size));
+	cl_assert_equal_sz(buf.size, consumed);
+	cl_assert_equal_sz(2, git_bitmap_count(&bitmap));
+
+	git_buf_dispose(&buf);
+	git_bitmap_dispose(&bitmap);
+}
+
+static size_t count_walk_objects(const char *push, const char *hide)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	git_object *obj;
+	size_t count;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	cl_git_pass(git_revparse_single(&obj, _repo, push));
+	cl_git_pass(git_revwalk_push(walk, git_object_id(obj)));
+	git_object_free(obj);
+
+	if (hide) {
+		cl_git_pass(git_revparse_single(&obj, _repo, hide));
+		cl_git_pass(git_revwalk_hide(walk, git_object_id(obj)));
+		git_object_free(obj);
+	}
+
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	count = git_packbuilder_object_count(pb);
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+	return count;
+}
+
+void test_pack_packbuilder__insert_walk_with_bitmap(void)
+{
+	size_t head, range, branch;
+
+	head = count_walk_objects("HEAD", NULL);
+	range = count_walk_objects("HEAD", "HEAD~2");
+	branch = count_walk_objects("HEAD", "refs/heads/br2");
+
+	cl_git_pass(git_revwalk_push_glob(_revwalker, "refs/*"));
+	cl_git_pass(git_packbuilder_insert_walk(_packbuilder, _revwalker));
+	cl_git_pass(git_packbuilder_set_write_bitmap(_packbuilder, 1));
+	cl_git_pass(git_packbuilder_write(_packbuilder, "objects/pack", 0, NULL, NULL));
+
+	/*
+	 * The bitmaps exclude everything reachable from the hidden commits,
+	 * where the tree walk only excludes their trees; the counts match
+	 * `git rev-list --objects --use-bitmap-index`.
+	 */
+	cl_assert_equal_sz(head, count_walk_objects("HEAD", NULL));
+	cl_assert_equal_sz(8, count_walk_objects("HEAD", "HEAD~2"));
+	cl_assert(8 <= range);
+	cl_assert_equal_sz(4, count_walk_objects("HEAD", "refs/heads/br2"));
+	cl_assert(4 <= branch);
+}
+
+void test_pack_packbuilder__walks_share_bitmap_index(void)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+	struct git_pack_file *pack;
+
+	cl_git_pass(git_revwalk_push_glob(_revwalker, "refs/*"));
+	cl_git_pass(git_packbuilder_insert_walk(_packbuilder, _revwalker));
+	cl_git_pass(git_packbuilder_set_write_bitmap(_packbuilder, 1));
+	cl_git_pass(git_packbuilder_write(_packbuilder, "objects/pack", 0, NULL, NULL));
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+
+	cl_git_pass(git_revwalk_push_head(walk));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_assert(pb->bitmap_checked);
+	cl_assert((pack = pb->bitmap_pack) != NULL);
+
+	/* the pack directory is not read again for the next walk */
+	cl_git_pass(git_revwalk_push_ref(walk, "refs/heads/br2"));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_assert(pb->bitmap_pack == pack);
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+}
+
+static int insert_packed_object(const git_oid *id, git_off_t offset, void *payload)
+{
+	GIT_UNUSED(offset);
+	return git_packbuilder_insert(payload, id, NULL);
+}
+
+static void write_packed_objects(git_buf *out, const char *pack_name)
+{
+	struct git_pack_file *pack;
+	git_buf path = GIT_BUF_INIT;
+	git_indexer_progress stats = { 0 };
+
+	cl_git_pass(git_buf_printf(&path, "objects/pack/%s.idx", pack_name));
+	cl_git_pass(git_mwindow_get_pack(&pack, path.ptr));
+	cl_git_pass(git_pack_foreach_entry_offset(pack, insert_packed_object, _packbuilder));
+	git_mwindow_put_pack(pack);
+
+	cl_git_pass(git_packbuilder_write_buf(out, _packbuilder));
+
+	/* whatever was copied, the result must be a valid pack */
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, NULL, NULL));
+	cl_git_pass(git_indexer_append(_indexer, out->ptr, out->size, &stats));
+	cl_git_pass(git_indexer_commit(_indexer, &stats));
+	cl_assert_equal_i(_packbuilder->nr_objects, stats.indexed_objects);
+
+	git_buf_dispose(&path);
+}
+
+void test_pack_packbuilder__reuses_packed_objects(void)
+{
+	git_buf buf = GIT_BUF_INIT;
+
+	write_packed_objects(&buf, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695");
+
+	cl_assert(_packbuilder->nr_reused > 0);
+	cl_assert(_packbuilder->nr_reused_deltas > 0);
+	cl_assert(_packbuilder->nr_reused_deltas < _packbuilder->nr_reused);
+
+	git_buf_dispose(&buf);
+}
+
+void test_pack_packbuilder__does_not_reuse_on_crc_mismatch(void)
+{
+	const char *idx_path =
+		"objects/pack/pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695.idx";
+	git_buf idx = GIT_BUF_INIT, buf = GIT_BUF_INIT;
+	uint32_t nr, i;
+	size_t crcs;
+
+	/* Damage every CRC recorded in the index */
+	cl_git_pass(git_futils_readbuffer(&idx, idx_path));
+	memcpy(&nr, idx.ptr + 8 + 255 * 4, 4);
+	nr = ntohl(nr);
+	crcs = 8 + 256 * 4 + 20 * nr;
+
+	for (i = 0; i < 4 * nr; i++)
+		idx.ptr[crcs + i] ^= 0xff;
+
+	cl_git_pass(p_chmod(idx_path, 0644));
+	cl_git_write2file(idx_path, idx.ptr, idx.size, O_WRONLY | O_TRUNC, 0644);
+	git_buf_dispose(&idx);
+
+	write_packed_objects(&buf, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695");
+
+	cl_assert_equal_i(0, _packbuilder->nr_reused);
+
+	git_buf_dispose(&buf);
+}
+
+void test_pack_packbuilder__writes_ofs_deltas(void)
+{
+	git_buf ofs = GIT_BUF_INIT, ref = GIT_BUF_INIT;
+
+	cl_git_pass(git_packbuilder_set_ofs_delta(_packbuilder, 1));
+	write_packed_objects(&ofs, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695");
+	cl_assert(_packbuilder->nr_reused_deltas > 0);
+
+	git_indexer_free(_indexer);
+	git_packbuilder_free(_packbuilder);
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+
+	write_packed_objects(&ref, "pack-a81e489679b7d3418f9ab594bda8ceb37dd4c695");
+
+	/* offsets take fewer bytes than the base's id */
+	cl_assert(ofs.size < ref.size);
+
+	git_buf_dispose(&ofs);
+	git_buf_dispose(&ref);
+}
+
+static void commit_big_file(git_oid *out, const git_oid *parent, const char *tail)
+{
+	git_buf content = GIT_BUF_INIT;
+	git_treebuilder *builder;
+	git_signature *sig;
+	git_commit *parent_commit = NULL;
+	git_tree *tree;
+	git_oid blob_id, tree_id;
+	int i;
+
+	for (i = 0; i < 200; i++)
+		cl_git_pass(git_buf_printf(&content, "line %d of a file that is big enough to be deltified\n", i));
+	cl_git_pass(git_buf_puts(&content, tail));
+
+	cl_git_pass(git_blob_create_frombuffer(&blob_id, _repo, content.ptr, content.size));
+	cl_git_pass(git_treebuilder_new(&builder, _repo, NULL));
+	cl_git_pass(git_treebuilder_insert(NULL, builder, "big.txt", &blob_id, GIT_FILEMODE_BLOB));
+	cl_git_pass(git_treebuilder_write(&tree_id, builder));
+	cl_git_pass(git_tree_lookup(&tree, _repo, &tree_id));
+
+	if (parent)
+		cl_git_pass(git_commit_lookup(&parent_commit, _repo, parent));
+
+	cl_git_pass(git_signature_now(&sig, "Packer", "packer@example.com"));
+	cl_git_pass(git_commit_create_v(out, _repo, NULL, sig, sig, NULL, tail,
+		tree, parent ? 1 : 0, parent_commit));
+
+	git_signature_free(sig);
+	git_commit_free(parent_commit);
+	git_tree_free(tree);
+	git_treebuilder_free(builder);
+	git_buf_dispose(&content);
+}
+
+static void write_bitmapped_pack(const git_oid *tip)
+{
+	git_packbuilder *pb;
+	git_revwalk *walk;
+
+	cl_git_pass(git_packbuilder_new(&pb, _repo));
+	cl_git_pass(git_revwalk_new(&walk, _repo));
+	cl_git_pass(git_revwalk_push(walk, tip));
+	cl_git_pass(git_packbuilder_insert_walk(pb, walk));
+	cl_git_pass(git_packbuilder_set_write_bitmap(pb, 1));
+	cl_git_pass(git_packbuilder_write(pb, "objects/pack", 0, NULL, NULL));
+
+	git_revwalk_free(walk);
+	git_packbuilder_free(pb);
+}
+
+static void write_walk(git_indexer_progress *stats, int thin, int bitmap)
+{
+	git_oid base, tip;
+	git_odb *odb;
+	git_buf buf = GIT_BUF_INIT;
+
+	commit_big_file(&base, NULL, "base\n");
+	commit_big_file(&tip, &base, "tip\n");
+
+	if (bitmap)
+		write_bitmapped_pack(&tip);
+
+	cl_git_pass(git_revwalk_push(_revwalker, &tip));
+	cl_git_pass(git_revwalk_hide(_revwalker, &base));
+	cl_git_pass(git_packbuilder_set_thin(_packbuilder, thin));
+	cl_git_pass(git_packbuilder_insert_walk(_packbuilder, _revwalker));
+	cl_git_pass(git_packbuilder_write_buf(&buf, _packbuilder));
+
+	/* only the tip's commit, tree and blob are sent */
+	cl_assert_equal_sz(3, git_packbuilder_object_count(_packbuilder));
+
+	cl_git_pass(git_repository_odb(&odb, _repo));
+	cl_git_pass(git_indexer_new(&_indexer, ".", 0, odb, NULL));
+	cl_git_pass(git_indexer_append(_indexer, buf.ptr, buf.size, stats));
+	cl_git_pass(git_indexer_commit(_indexer, stats));
+
+	git_odb_free(odb);
+	git_buf_dispose(&buf);
+}
+
+void test_pack_packbuilder__writes_thin_packs(void)
+{
+	git_indexer_progress stats = { 0 };
+
+	write_walk(&stats, 1, 0);
+
+	/* the indexer had to complete the pack with the base blob */
+	cl_assert(stats.local_objects > 0);
+	cl_assert_equal_i(3, stats.received_objects);
+}
+
+void test_pack_packbuilder__writes_thin_packs_with_bitmaps(void)
+{
+	git_indexer_progress stats = { 0 };
+
+	write_walk(&stats, 1, 1);
+
+	cl_assert(stats.local_objects > 0);
+	cl_assert_equal_i(3, stats.received_objects);
+}
+
+void test_pack_packbuilder__writes_complete_packs_by_default(void)
+{
+	git_indexer_progress stats = { 0 };
+
+	write_walk(&stats, 0, 0);
+
+	cl_assert_equal_i(0, stats.local_objects);
+	cl_assert_equal_i(3, stats.indexed_objects);
+}
+
+static int write_after_workers_cb(void *buf, size_t size, void *payload)
+{
+	git_buf *out = payload;
+	double start;
+
+	/* give the workers a head start on the objects after the header */
+	if (out->size == 0)
+		for (start = git__timer(); git__timer() - start < 0.1; )
+			;
+
+	return git_buf_put(out, buf, size);
+}
+
+void test_pack_packbuilder__writes_in_parallel(void)
+{
+	git_buf serial = GIT_BUF_INIT, parallel = GIT_BUF_INIT;
+	git_oid *o;
+	size_t i;
+
+	seed_packbuilder();
+	git_packbuilder_set_threads(_packbuilder, 1);
+	cl_git_pass(git_packbuilder_write_buf(&serial, _packbuilder));
+	cl_assert_equal_i(0, _packbuilder->nr_pool_deflated);
+
+	git_packbuilder_free(_packbuilder);
+	cl_git_pass(git_packbuilder_new(&_packbuilder, _repo));
+	git_packbuilder_set_threads(_packbuilder, 4);
+
+	git_vector_foreach(&_commits, i, o) {
+		cl_git_pass(git_packbuilder_insert(_packbuilder, o, NULL));
+	}
+
+	git_vector_foreach(&_commits, i, o) {
+		git_commit *commit;
+		cl_git_pass(git_commit_lookup(&commit, _repo, o));
+		cl_git_pass(git_packbuilder_insert_tree(_packbuilder,
+					git_commit_tree_id(commit)));
+		git_commit_free(commit);
+	}
+
+	cl_git_pass(git_packbuilder_foreach(_packbuilder, write_after_workers_cb, &parallel));
+	cl_assert(_packbuilder->nr_pool_deflated > 0);
+
+	/* the objects are deflated by the workers, written in the same order */
+	cl_assert_equal_sz(serial.size, parallel.size);
+	cl_assert(memcmp(serial.ptr, parallel.ptr, serial.size) == 0);
+
+	git_buf_dispose(&serial);
+	git_buf_dispose(&parallel);
+}
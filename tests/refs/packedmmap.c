@@ -0,0 +1,214 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "refdb.h"
+#include "refs.h"
+#include "repository.h"
+
+#define MANY_REFS 2000
+
+#define COMMIT_ID "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"
+#define OTHER_ID "e90810b8df3e80c413d903f631643c716887138d"
+#define TAG_ID "7b4384978d2493e851f9cca7858815fac9b10980"
+
+static git_repository *g_repo;
+
+static void write_packed_refs(const char *header, int count)
+{
+	git_buf contents = GIT_BUF_INIT;
+	int i;
+
+	git_buf_puts(&contents, header);
+
+	for (i = 0; i < count; i++)
+		git_buf_printf(&contents, "%s refs/many/%04d\n", COMMIT_ID, i);
+
+	git_buf_printf(&contents, "%s refs/tags/annotated\n^%s\n", TAG_ID, COMMIT_ID);
+	cl_assert(!git_buf_oom(&contents));
+
+	cl_git_rewritefile("testrepo.git/packed-refs", contents.ptr);
+	git_buf_dispose(&contents);
+}
+
+void test_refs_packedmmap__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_repo_set_bool(g_repo, "core.mmapPackedRefs", true);
+
+	write_packed_refs("# pack-refs with: peeled fully-peeled sorted \n", MANY_REFS);
+	g_repo = cl_git_sandbox_reopen();
+}
+
+void test_refs_packedmmap__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_ref(const char *name, const char *id)
+{
+	git_reference *ref;
+	git_oid expected;
+
+	cl_git_pass(git_oid_fromstr(&expected, id));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
+	cl_assert_equal_oid(&expected, git_reference_target(ref));
+	git_reference_free(ref);
+}
+
+static size_t count_refs(const char *glob)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	size_t count = 0;
+	int error;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+
+	while ((error = git_reference_next_name(&name, iter)) == 0) {
+		cl_assert_equal_i(0, p_fnmatch(glob, name, 0));
+		count++;
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	return count;
+}
+
+void test_refs_packedmmap__lookup(void)
+{
+	git_reference *ref;
+	git_refdb *refdb;
+	int exists;
+
+	assert_ref("refs/many/0000", COMMIT_ID);
+	assert_ref("refs/many/1234", COMMIT_ID);
+	assert_ref("refs/many/1999", COMMIT_ID);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/many/2000"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/many/123"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/aaa"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/zzz"));
+
+	cl_git_pass(git_repository_refdb__weakptr(&refdb, g_repo));
+	cl_git_pass(git_refdb_exists(&exists, refdb, "refs/many/0042"));
+	cl_assert(exists);
+	cl_git_pass(git_refdb_exists(&exists, refdb, "refs/many/0042x"));
+	cl_assert(!exists);
+}
+
+void test_refs_packedmmap__lookup_peeled(void)
+{
+	git_reference *ref;
+	git_oid expected;
+
+	cl_git_pass(git_oid_fromstr(&expected, COMMIT_ID));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/annotated"));
+	cl_assert_equal_oid(&expected, git_reference_target_peel(ref));
+	git_reference_free(ref);
+}
+
+void test_refs_packedmmap__iterate_glob(void)
+{
+	cl_assert_equal_sz(1000, count_refs("refs/many/1*"));
+	cl_assert_equal_sz(100, count_refs("refs/many/00*"));
+	cl_assert_equal_sz(1, count_refs("refs/many/1999"));
+	cl_assert_equal_sz(0, count_refs("refs/nothing/*"));
+	cl_assert_equal_sz(MANY_REFS, count_refs("refs/many/*"));
+	cl_assert_equal_sz(20, count_refs("refs/many/[01]99*"));
+}
+
+void test_refs_packedmmap__loose_refs_shadow_packed_ones(void)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	git_oid other;
+	size_t count = 0;
+
+	cl_git_pass(git_oid_fromstr(&other, OTHER_ID));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/many/0001", &other, true, NULL));
+	git_reference_free(ref);
+
+	assert_ref("refs/many/0001", OTHER_ID);
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, "refs/many/000*"));
+
+	while (git_reference_next(&ref, iter) == 0) {
+		if (!strcmp(git_reference_name(ref), "refs/many/0001"))
+			cl_assert_equal_oid(&other, git_reference_target(ref));
+		git_reference_free(ref);
+		count++;
+	}
+
+	git_reference_iterator_free(iter);
+	cl_assert_equal_sz(10, count);
+}
+
+void test_refs_packedmmap__reloads_changed_file(void)
+{
+	git_reference *ref;
+
+	assert_ref("refs/many/0100", COMMIT_ID);
+
+	write_packed_refs("# pack-refs with: peeled fully-peeled sorted \n", 10);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/many/0100"));
+	assert_ref("refs/many/0009", COMMIT_ID);
+	cl_assert_equal_sz(10, count_refs("refs/many/*"));
+}
+
+void test_refs_packedmmap__unsorted_file(void)
+{
+	cl_git_rewritefile("testrepo.git/packed-refs",
+		"# pack-refs with: peeled \n"
+		COMMIT_ID " refs/many/b\n"
+		OTHER_ID " refs/many/a\n");
+
+	assert_ref("refs/many/a", OTHER_ID);
+	assert_ref("refs/many/b", COMMIT_ID);
+	cl_assert_equal_sz(2, count_refs("refs/many/*"));
+}
+
+void test_refs_packedmmap__path_conflicts(void)
+{
+	git_reference *ref;
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/many/0001/child", &id, false, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/many", &id, false, NULL));
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/many/0001", &id, false, NULL));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/many/0001-new", &id, false, NULL));
+	git_reference_free(ref);
+}
+
+void test_refs_packedmmap__delete(void)
+{
+	git_reference *ref;
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/many/0500"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/many/0500"));
+	assert_ref("refs/many/0499", COMMIT_ID);
+	assert_ref("refs/many/0501", COMMIT_ID);
+	cl_assert_equal_sz(MANY_REFS - 1, count_refs("refs/many/*"));
+}
+
+void test_refs_packedmmap__empty_file(void)
+{
+	git_reference *ref;
+
+	cl_git_rewritefile("testrepo.git/packed-refs", "");
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/many/0000"));
+	cl_assert_equal_sz(0, count_refs("refs/many/*"));
+
+	cl_must_pass(p_unlink("testrepo.git/packed-refs"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/many/0000"));
+	assert_ref("refs/heads/master", "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+}
@@ -0,0 +1,628 @@
+#include "clar_libgit2.h"
+
+#include "fileops.h"
+#include "refdb.h"
+#include "refs.h"
+#include "reftable.h"
+#include "repository.h"
+#include "git2/sys/refdb_backend.h"
+
+#define MANY_REFS 3000
+
+#define COMMIT_ID "a65fedf39aefe402d3bb6e24df4d4f5fe4547750"
+#define OTHER_ID "e90810b8df3e80c413d903f631643c716887138d"
+#define TAG_ID "7b4384978d2493e851f9cca7858815fac9b10980"
+
+static git_repository *g_repo;
+static git_signature *g_sig;
+
+void test_refs_reftable__initialize(void)
+{
+	git_reference *ref;
+	git_oid id;
+
+	g_repo = cl_git_sandbox_init("testrepo.git");
+	cl_repo_set_string(g_repo, "core.repositoryformatversion", "1");
+	cl_repo_set_string(g_repo, "extensions.refStorage", "reftable");
+	cl_repo_set_bool(g_repo, "core.logAllRefUpdates", true);
+	g_repo = cl_git_sandbox_reopen();
+
+	cl_git_pass(git_signature_new(&g_sig, "Someone", "someone@example.com", 1500000000, 60));
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &id, true, "initial"));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_symbolic_create(&ref, g_repo, "HEAD", "refs/heads/master", true, NULL));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__cleanup(void)
+{
+	git_signature_free(g_sig);
+	cl_git_sandbox_cleanup();
+}
+
+static void assert_ref(const char *name, const char *id)
+{
+	git_oid expected, actual;
+
+	cl_git_pass(git_oid_fromstr(&expected, id));
+	cl_git_pass(git_reference_name_to_id(&actual, g_repo, name));
+	cl_assert_equal_oid(&expected, &actual);
+}
+
+static size_t count_refs(const char *glob)
+{
+	git_reference_iterator *iter;
+	const char *name;
+	size_t count = 0;
+	int error;
+
+	cl_git_pass(git_reference_iterator_glob_new(&iter, g_repo, glob));
+
+	while ((error = git_reference_next_name(&name, iter)) == 0) {
+		cl_assert_equal_i(0, p_fnmatch(glob, name, 0));
+		count++;
+	}
+
+	cl_assert_equal_i(GIT_ITEROVER, error);
+	git_reference_iterator_free(iter);
+
+	return count;
+}
+
+static git_reftable_stack *open_stack(void)
+{
+	git_reftable_stack *stack;
+
+	cl_git_pass(git_reftable_stack_open(&stack, "testrepo.git/reftable"));
+	return stack;
+}
+
+static size_t count_tables(void)
+{
+	git_reftable_stack *stack = open_stack();
+	size_t count = stack->tables.length;
+
+	git_reftable_stack_free(stack);
+	return count;
+}
+
+static uint64_t next_update_index(void)
+{
+	git_reftable_stack *stack = open_stack();
+	uint64_t update_index = git_reftable_stack_next_update_index(stack);
+
+	git_reftable_stack_free(stack);
+	return update_index;
+}
+
+void test_refs_reftable__format_roundtrip(void)
+{
+	git_reftable_writer *writer;
+	git_reftable_table *table;
+	git_reftable_table_iter iter = GIT_REFTABLE_TABLE_ITER_INIT;
+	git_reftable_ref ref = GIT_REFTABLE_REF_INIT;
+	git_reftable_log log = GIT_REFTABLE_LOG_INIT;
+	git_buf contents = GIT_BUF_INIT;
+	git_oid id;
+	char name[64];
+	int i;
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+	cl_git_pass(git_reftable_writer_new(&writer, 1, 5));
+
+	for (i = 0; i < MANY_REFS; i++) {
+		git_buf_clear(&ref.name);
+		git_buf_printf(&ref.name, "refs/heads/branch-%04d", i);
+		ref.update_index = 1 + i % 5;
+		ref.type = GIT_REFTABLE_REF_VAL1;
+		git_oid_cpy(&ref.value, &id);
+		cl_git_pass(git_reftable_writer_add_ref(writer, &ref));
+	}
+
+	/* Records must come in order */
+	cl_git_fail(git_reftable_writer_add_ref(writer, &ref));
+
+	for (i = 0; i < 100; i++) {
+		git_buf_sets(&log.name, "refs/heads/branch-0000");
+		log.update_index = 100 - i;
+		log.type = GIT_REFTABLE_LOG_UPDATE;
+		git_oid_cpy(&log.new_id, &id);
+		git_buf_sets(&log.committer_name, "Someone");
+		git_buf_sets(&log.committer_email, "someone@example.com");
+		log.time = 1500000000 + i;
+		log.tz_offset = -120;
+		git_buf_clear(&log.message);
+		git_buf_printf(&log.message, "update %d\n", i);
+		cl_git_pass(git_reftable_writer_add_log(writer, &log));
+	}
+
+	cl_git_pass(git_reftable_writer_finish(&contents, writer));
+	git_reftable_writer_free(writer);
+
+	/* The refs span several blocks, so the table has an index */
+	cl_assert(contents.size > 4 * GIT_REFTABLE_BLOCK_SIZE);
+	cl_git_pass(git_reftable_table_from_buffer(&table, &contents, "test.ref"));
+	cl_assert(table->has_refs);
+	cl_assert(table->has_logs);
+	cl_assert(table->ref_index_position > 0);
+	cl_assert_equal_i(1, (int)table->min_update_index);
+	cl_assert_equal_i(5, (int)table->max_update_index);
+
+	for (i = 0; i < MANY_REFS; i += 7) {
+		p_snprintf(name, sizeof(name), "refs/heads/branch-%04d", i);
+		cl_git_pass(git_reftable_table_seek_ref(&iter, table, name));
+		cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+		cl_assert_equal_s(name, ref.name.ptr);
+		cl_assert_equal_i(1 + i % 5, (int)ref.update_index);
+		cl_assert_equal_oid(&id, &ref.value);
+	}
+
+	/* Seeking between two names lands on the next one */
+	cl_git_pass(git_reftable_table_seek_ref(&iter, table, "refs/heads/branch-1234-"));
+	cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+	cl_assert_equal_s("refs/heads/branch-1235", ref.name.ptr);
+
+	cl_git_pass(git_reftable_table_seek_ref(&iter, table, ""));
+	for (i = 0; i < MANY_REFS; i++)
+		cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+	cl_git_fail_with(GIT_ITEROVER, git_reftable_table_next_ref(&ref, &iter));
+
+	cl_git_pass(git_reftable_table_seek_log(&iter, table, "refs/heads/branch-0000"));
+	for (i = 0; i < 100; i++) {
+		cl_git_pass(git_reftable_table_next_log(&log, &iter));
+		cl_assert_equal_s("refs/heads/branch-0000", log.name.ptr);
+		cl_assert_equal_i(100 - i, (int)log.update_index);
+		cl_assert_equal_i(1500000000 + i, (int)log.time);
+		cl_assert_equal_i(-120, log.tz_offset);
+		cl_assert_equal_s("Someone", log.committer_name.ptr);
+	}
+	cl_git_fail_with(GIT_ITEROVER, git_reftable_table_next_log(&log, &iter));
+
+	git_reftable_table_iter_dispose(&iter);
+	git_reftable_ref_dispose(&ref);
+	git_reftable_log_dispose(&log);
+	git_reftable_table_free(table);
+	git_buf_dispose(&contents);
+}
+
+void test_refs_reftable__cyclic_index_fails(void)
+{
+	git_reftable_writer *writer;
+	git_reftable_table *table;
+	git_reftable_table_iter iter = GIT_REFTABLE_TABLE_ITER_INIT;
+	git_reftable_ref ref = GIT_REFTABLE_REF_INIT;
+	git_buf contents = GIT_BUF_INIT, copy = GIT_BUF_INIT;
+	unsigned char *block;
+	uint64_t index;
+	size_t i, failures = 0;
+	char name[64];
+	git_oid id;
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+	cl_git_pass(git_reftable_writer_new(&writer, 1, 1));
+
+	for (i = 0; i < 400; i++) {
+		git_buf_clear(&ref.name);
+		git_buf_printf(&ref.name, "refs/heads/branch-%04d", (int)i);
+		ref.update_index = 1;
+		ref.type = GIT_REFTABLE_REF_VAL1;
+		git_oid_cpy(&ref.value, &id);
+		cl_git_pass(git_reftable_writer_add_ref(writer, &ref));
+	}
+
+	cl_git_pass(git_reftable_writer_finish(&contents, writer));
+	git_reftable_writer_free(writer);
+
+	/* the table takes over the buffer it is read from */
+	cl_git_pass(git_buf_set(&copy, contents.ptr, contents.size));
+	cl_git_pass(git_reftable_table_from_buffer(&table, &copy, "test.ref"));
+	index = table->ref_index_position;
+	git_reftable_table_free(table);
+
+	/*
+	 * Point the index record of the second ref block back at the
+	 * index block itself; both offsets are two byte varints.
+	 */
+	cl_assert(index >= 128 + GIT_REFTABLE_BLOCK_SIZE && index < 16384);
+	block = (unsigned char *)contents.ptr + index;
+
+	for (i = 4; block + i + 1 < (unsigned char *)contents.ptr + contents.size; i++) {
+		if (block[i] == 0x9f && block[i + 1] == 0x00)
+			break;
+	}
+	cl_assert(block + i + 1 < (unsigned char *)contents.ptr + contents.size);
+
+	block[i] = 0x80 | (((index >> 7) - 1) & 0x7f);
+	block[i + 1] = index & 0x7f;
+
+	cl_git_pass(git_reftable_table_from_buffer(&table, &contents, "test.ref"));
+
+	for (i = 0; i < 400; i += 5) {
+		p_snprintf(name, sizeof(name), "refs/heads/branch-%04d", (int)i);
+		if (git_reftable_table_seek_ref(&iter, table, name) < 0)
+			failures++;
+	}
+	cl_assert(failures > 0);
+
+	git_reftable_table_iter_dispose(&iter);
+	git_reftable_ref_dispose(&ref);
+	git_reftable_table_free(table);
+	git_buf_dispose(&contents);
+	git_buf_dispose(&copy);
+}
+
+/*
+ * The fixture was encoded the way git writes tables: one padded ref block
+ * holding every kind of ref record, then a deflated log block.
+ */
+#define GIT_TABLE "reftable/0x000000000001-0x000000000002-6b2fa5e1.ref"
+
+void test_refs_reftable__reads_table_written_by_git(void)
+{
+	git_reftable_table *table;
+	git_reftable_table_iter iter = GIT_REFTABLE_TABLE_ITER_INIT;
+	git_reftable_ref ref = GIT_REFTABLE_REF_INIT;
+	git_reftable_log log = GIT_REFTABLE_LOG_INIT;
+
+	cl_git_pass(git_reftable_table_open(&table, cl_fixture(GIT_TABLE), "git.ref"));
+	cl_assert(table->has_refs);
+	cl_assert(table->has_logs);
+	cl_assert_equal_i(1, (int)table->min_update_index);
+	cl_assert_equal_i(2, (int)table->max_update_index);
+
+	cl_git_pass(git_reftable_table_seek_ref(&iter, table, ""));
+
+	cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+	cl_assert_equal_s("HEAD", ref.name.ptr);
+	cl_assert_equal_i(GIT_REFTABLE_REF_SYMREF, ref.type);
+	cl_assert_equal_s("refs/heads/master", ref.target.ptr);
+	cl_assert_equal_i(1, (int)ref.update_index);
+
+	cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+	cl_assert_equal_s("refs/heads/br2", ref.name.ptr);
+	cl_assert_equal_i(GIT_REFTABLE_REF_VAL1, ref.type);
+	cl_assert_equal_i(2, (int)ref.update_index);
+
+	cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+	cl_assert_equal_s("refs/heads/master", ref.name.ptr);
+	cl_assert_equal_i(GIT_REFTABLE_REF_VAL1, ref.type);
+	cl_assert_equal_i(0, git_oid_streq(&ref.value, COMMIT_ID));
+
+	cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+	cl_assert_equal_s("refs/tags/e90810b", ref.name.ptr);
+	cl_assert_equal_i(GIT_REFTABLE_REF_VAL2, ref.type);
+	cl_assert_equal_i(0, git_oid_streq(&ref.value, TAG_ID));
+	cl_assert_equal_i(0, git_oid_streq(&ref.peeled, OTHER_ID));
+
+	cl_git_fail_with(GIT_ITEROVER, git_reftable_table_next_ref(&ref, &iter));
+
+	cl_git_pass(git_reftable_table_seek_ref(&iter, table, "refs/heads/m"));
+	cl_git_pass(git_reftable_table_next_ref(&ref, &iter));
+	cl_assert_equal_s("refs/heads/master", ref.name.ptr);
+
+	cl_git_pass(git_reftable_table_seek_log(&iter, table, "refs/heads/master"));
+
+	cl_git_pass(git_reftable_table_next_log(&log, &iter));
+	cl_assert_equal_s("refs/heads/master", log.name.ptr);
+	cl_assert_equal_i(2, (int)log.update_index);
+	cl_assert_equal_i(GIT_REFTABLE_LOG_UPDATE, log.type);
+	cl_assert_equal_i(0, git_oid_streq(&log.old_id, COMMIT_ID));
+	cl_assert_equal_i(0, git_oid_streq(&log.new_id, OTHER_ID));
+	cl_assert_equal_s("Someone", log.committer_name.ptr);
+	cl_assert_equal_s("someone@example.com", log.committer_email.ptr);
+	cl_assert_equal_i(1500000100, (int)log.time);
+	cl_assert_equal_i(-120, log.tz_offset);
+	cl_assert_equal_s("commit: second\n", log.message.ptr);
+
+	cl_git_pass(git_reftable_table_next_log(&log, &iter));
+	cl_assert_equal_i(1, (int)log.update_index);
+	cl_assert(git_oid_iszero(&log.old_id));
+	cl_assert_equal_s("initial\n", log.message.ptr);
+
+	cl_git_fail_with(GIT_ITEROVER, git_reftable_table_next_log(&log, &iter));
+
+	git_reftable_table_iter_dispose(&iter);
+	git_reftable_ref_dispose(&ref);
+	git_reftable_log_dispose(&log);
+	git_reftable_table_free(table);
+}
+
+void test_refs_reftable__read_write(void)
+{
+	git_reference *ref;
+	git_oid id, other;
+
+	cl_assert(git_path_isfile("testrepo.git/reftable/tables.list"));
+
+	assert_ref("refs/heads/master", COMMIT_ID);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "HEAD"));
+	cl_assert_equal_i(GIT_REFERENCE_SYMBOLIC, git_reference_type(ref));
+	cl_assert_equal_s("refs/heads/master", git_reference_symbolic_target(ref));
+	git_reference_free(ref);
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+	cl_git_pass(git_oid_fromstr(&other, OTHER_ID));
+
+	cl_git_fail_with(GIT_EEXISTS,
+		git_reference_create(&ref, g_repo, "refs/heads/master", &other, false, NULL));
+	cl_git_fail_with(GIT_EMODIFIED,
+		git_reference_create_matching(&ref, g_repo, "refs/heads/master", &other, true, &other, NULL));
+	cl_git_pass(git_reference_create_matching(&ref, g_repo, "refs/heads/master", &other, true, &id, NULL));
+	git_reference_free(ref);
+
+	/* Directory / file conflicts are detected like on disk */
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads/master/child", &id, false, NULL));
+	cl_git_fail(git_reference_create(&ref, g_repo, "refs/heads", &id, false, NULL));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/tags/annotated", &id, false, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/tags/annotated", &id, true, NULL));
+	git_reference_free(ref);
+
+	g_repo = cl_git_sandbox_reopen();
+
+	assert_ref("refs/heads/master", OTHER_ID);
+	assert_ref("HEAD", OTHER_ID);
+	assert_ref("refs/tags/annotated", COMMIT_ID);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/nope"));
+
+	/* The reftable backend does not look at loose refs */
+	cl_assert(git_path_isfile("testrepo.git/refs/heads/br2"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+}
+
+void test_refs_reftable__peeled_tags(void)
+{
+	git_reference *ref;
+	git_oid tag, expected;
+
+	cl_git_pass(git_oid_fromstr(&tag, TAG_ID));
+	cl_git_pass(git_oid_fromstr(&expected, OTHER_ID));
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/tags/tagged", &tag, false, NULL));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/tags/tagged"));
+	cl_assert_equal_oid(&tag, git_reference_target(ref));
+	cl_assert_equal_oid(&expected, git_reference_target_peel(ref));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__iterate(void)
+{
+	git_reference_iterator *iter;
+	git_reference *ref;
+	git_oid id;
+	char name[64];
+	int i;
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+
+	for (i = 0; i < 200; i++) {
+		p_snprintf(name, sizeof(name), "refs/many/%04d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &id, false, NULL));
+		git_reference_free(ref);
+	}
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/many/0042"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_assert_equal_sz(199, count_refs("refs/many/*"));
+	cl_assert_equal_sz(100, count_refs("refs/many/01*"));
+	cl_assert_equal_sz(9, count_refs("refs/many/004*"));
+	cl_assert_equal_sz(0, count_refs("refs/nothing/*"));
+	cl_assert_equal_sz(20, count_refs("refs/many/0[01]9*"));
+
+	/* Plain iteration returns everything but HEAD */
+	cl_git_pass(git_reference_iterator_new(&iter, g_repo));
+	for (i = 0; git_reference_next(&ref, iter) == 0; i++) {
+		cl_assert(git__strcmp(git_reference_name(ref), "HEAD"));
+		git_reference_free(ref);
+	}
+	git_reference_iterator_free(iter);
+	cl_assert_equal_i(200, i);
+}
+
+void test_refs_reftable__transaction_appends_one_table(void)
+{
+	git_transaction *tx;
+	git_reference *ref;
+	git_oid id;
+	char name[64];
+	uint64_t update_index;
+	int i;
+
+	cl_git_pass(git_oid_fromstr(&id, OTHER_ID));
+	update_index = next_update_index();
+
+	cl_git_pass(git_transaction_new(&tx, g_repo));
+
+	for (i = 0; i < 500; i++) {
+		p_snprintf(name, sizeof(name), "refs/heads/batch/%04d", i);
+		cl_git_pass(git_transaction_lock_ref(tx, name));
+		cl_git_pass(git_transaction_set_target(tx, name, &id, g_sig, "batch"));
+	}
+
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_remove(tx, "refs/heads/master"));
+	cl_git_pass(git_transaction_lock_ref(tx, "refs/heads/untouched"));
+
+	/* Nothing is visible before the commit */
+	cl_assert_equal_sz(0, count_refs("refs/heads/batch/*"));
+	cl_assert_equal_i(update_index, next_update_index());
+
+	cl_git_pass(git_transaction_commit(tx));
+
+	cl_assert_equal_sz(500, count_refs("refs/heads/batch/*"));
+	cl_assert_equal_i(update_index + 1, next_update_index());
+	assert_ref("refs/heads/batch/0123", OTHER_ID);
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+
+	git_transaction_free(tx);
+	cl_assert_equal_i(update_index + 1, next_update_index());
+}
+
+void test_refs_reftable__auto_compaction(void)
+{
+	git_reference *ref;
+	git_refdb *refdb;
+	git_oid id;
+	char name[64];
+	int i;
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+
+	for (i = 0; i < 256; i++) {
+		p_snprintf(name, sizeof(name), "refs/heads/one/%04d", i);
+		cl_git_pass(git_reference_create(&ref, g_repo, name, &id, false, NULL));
+		git_reference_free(ref);
+
+		/* The stack stays logarithmic in the number of updates */
+		cl_assert(count_tables() <= 12);
+	}
+
+	cl_assert_equal_sz(256, count_refs("refs/heads/one/*"));
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/one/0000", &id, true, NULL));
+	git_reference_free(ref);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/one/0001"));
+	cl_git_pass(git_reference_delete(ref));
+	git_reference_free(ref);
+
+	cl_git_pass(git_repository_refdb__weakptr(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	cl_assert_equal_sz(1, count_tables());
+
+	cl_assert_equal_sz(255, count_refs("refs/heads/one/*"));
+	assert_ref("refs/heads/one/0255", COMMIT_ID);
+	assert_ref("HEAD", COMMIT_ID);
+}
+
+static void assert_reflog(const char *name, size_t count, const char *last_message)
+{
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, name));
+	cl_assert_equal_sz(count, git_reflog_entrycount(reflog));
+
+	if (count) {
+		entry = git_reflog_entry_byindex(reflog, 0);
+		cl_assert_equal_s(last_message, git_reflog_entry_message(entry));
+	}
+
+	git_reflog_free(reflog);
+}
+
+void test_refs_reftable__reflog(void)
+{
+	git_reflog *reflog;
+	const git_reflog_entry *entry;
+	git_reference *ref, *renamed;
+	git_oid id, other;
+	git_refdb *refdb;
+
+	cl_git_pass(git_oid_fromstr(&id, COMMIT_ID));
+	cl_git_pass(git_oid_fromstr(&other, OTHER_ID));
+
+	assert_reflog("refs/heads/master", 1, "initial");
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/master", &other, true, "second"));
+	git_reference_free(ref);
+
+	/* Updates of the current branch show in HEAD's log too */
+	assert_reflog("refs/heads/master", 2, "second");
+	assert_reflog("HEAD", 2, "second");
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	entry = git_reflog_entry_byindex(reflog, 0);
+	cl_assert_equal_oid(&id, git_reflog_entry_id_old(entry));
+	cl_assert_equal_oid(&other, git_reflog_entry_id_new(entry));
+
+	cl_git_pass(git_reflog_append(reflog, &id, g_sig, "appended"));
+	cl_git_pass(git_reflog_write(reflog));
+	git_reflog_free(reflog);
+
+	assert_reflog("refs/heads/master", 3, "appended");
+
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reflog_drop(reflog, 0, true));
+	cl_git_pass(git_reflog_drop(reflog, 0, true));
+	cl_git_pass(git_reflog_write(reflog));
+	git_reflog_free(reflog);
+
+	assert_reflog("refs/heads/master", 1, "initial");
+
+	cl_git_pass(git_repository_refdb__weakptr(&refdb, g_repo));
+	cl_assert_equal_i(0, git_refdb_has_log(refdb, "refs/tags/nolog"));
+	cl_git_pass(git_refdb_ensure_log(refdb, "refs/tags/nolog"));
+	cl_assert_equal_i(1, git_refdb_has_log(refdb, "refs/tags/nolog"));
+	assert_reflog("refs/tags/nolog", 0, NULL);
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_git_pass(git_reference_rename(&renamed, ref, "refs/heads/renamed", false, "renaming"));
+	git_reference_free(renamed);
+	git_reference_free(ref);
+
+	assert_reflog("refs/heads/renamed", 2, "renaming");
+	cl_assert_equal_i(0, git_refdb_has_log(refdb, "refs/heads/master"));
+
+	cl_git_pass(git_reflog_delete(g_repo, "refs/heads/renamed"));
+	cl_assert_equal_i(0, git_refdb_has_log(refdb, "refs/heads/renamed"));
+	assert_reflog("refs/heads/renamed", 0, NULL);
+}
+
+void test_refs_reftable__unknown_storage_fails(void)
+{
+	git_reference *ref;
+
+	cl_repo_set_string(g_repo, "extensions.refStorage", "magic");
+	g_repo = cl_git_sandbox_reopen();
+	cl_git_fail(git_reference_lookup(&ref, g_repo, "HEAD"));
+}
+
+
+void test_refs_reftable__storage_needs_format_version_1(void)
+{
+	git_reference *ref;
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+
+	/* version 0 repositories ignore extensions, so the loose refs are used */
+	cl_repo_set_string(g_repo, "core.repositoryformatversion", "0");
+	g_repo = cl_git_sandbox_reopen();
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	git_reference_free(ref);
+}
+
+void test_refs_reftable__global_extensions_are_ignored(void)
+{
+	git_config *config;
+	git_reference *ref;
+
+	cl_fake_home();
+	cl_git_mkfile("home/.gitconfig",
+		"[extensions]\n\trefStorage = reftable\n\tmagic = true\n");
+
+	cl_git_pass(git_repository_config(&config, g_repo));
+	cl_git_pass(git_config_delete_entry(config, "extensions.refStorage"));
+	git_config_free(config);
+
+	g_repo = cl_git_sandbox_reopen();
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	git_reference_free(ref);
+
+	cl_fixture_cleanup("home");
+}
@@ -1,5 +1,7 @@
 #include "clar_libgit2.h"
 #include "git2/transaction.h"
+#include "buffer.h"
+#include "fileops.h"
 
 static git_repository *g_repo;
 static git_transaction *g_tx;
@@ -97,6 +99,9 @@ void test_refs_transactions__single_create(void)
 	cl_git_pass(git_reference_lookup(&ref, g_repo, name));
 	cl_assert(!git_oid_cmp(&id, git_reference_target(ref)));
 	git_reference_free(ref);
+
+	/* small transactions are written as loose references */
+	cl_assert(git_path_isfile("testrepo/.git/refs/heads/new-branch"));
 }
 
 void test_refs_transactions__unlocked_set(void)
@@ -108,3 +113,229 @@ void test_refs_transactions__unlocked_set(void)
 	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_set_target(g_tx, "refs/heads/foo", &id, NULL, NULL));
 	cl_git_pass(git_transaction_commit(g_tx));
 }
+
+#define BATCH_COUNT 20
+
+static void lock_batch(const char *fmt)
+{
+	git_buf name = GIT_BUF_INIT;
+	int i;
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, fmt, i));
+		cl_git_pass(git_transaction_lock_ref(g_tx, name.ptr));
+	}
+
+	git_buf_dispose(&name);
+}
+
+void test_refs_transactions__batch_is_packed(void)
+{
+	git_buf name = GIT_BUF_INIT;
+	git_reference *ref;
+	git_reflog *reflog;
+	git_oid id;
+	int i;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	lock_batch("refs/heads/batch-%02d");
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/master"));
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/batch-%02d", i));
+		cl_git_pass(git_transaction_set_target(g_tx, name.ptr, &id, NULL, "batch"));
+	}
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/master", &id, NULL, "batch"));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/batch-%02d", i));
+
+		cl_git_pass(git_reference_lookup(&ref, g_repo, name.ptr));
+		cl_assert(!git_oid_cmp(&id, git_reference_target(ref)));
+		git_reference_free(ref);
+
+		cl_git_pass(git_reflog_read(&reflog, g_repo, name.ptr));
+		cl_assert_equal_i(1, git_reflog_entrycount(reflog));
+		cl_assert_equal_s("batch", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+		git_reflog_free(reflog);
+	}
+
+	/* the loose master was replaced by its packed value */
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/master"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/batch-00"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/master"));
+	cl_assert(!git_oid_cmp(&id, git_reference_target(ref)));
+	git_reference_free(ref);
+
+	/* HEAD points to master, so its log is updated as well */
+	cl_git_pass(git_reflog_read(&reflog, g_repo, "HEAD"));
+	cl_assert_equal_s("batch", git_reflog_entry_message(git_reflog_entry_byindex(reflog, 0)));
+	git_reflog_free(reflog);
+
+	git_buf_dispose(&name);
+}
+
+void test_refs_transactions__batch_delete(void)
+{
+	git_buf name = GIT_BUF_INIT;
+	git_reference *ref;
+	git_oid id;
+	int i;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	lock_batch("refs/tags/batch-%02d");
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/tags/batch-%02d", i));
+		cl_git_pass(git_transaction_set_target(g_tx, name.ptr, &id, NULL, NULL));
+	}
+	cl_git_pass(git_transaction_commit(g_tx));
+	git_transaction_free(g_tx);
+
+	cl_git_pass(git_transaction_new(&g_tx, g_repo));
+	lock_batch("refs/tags/batch-%02d");
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/packed"));
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/tags/batch-%02d", i));
+		cl_git_pass(git_transaction_remove(g_tx, name.ptr));
+	}
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/br2"));
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/packed"));
+	cl_git_pass(git_transaction_commit(g_tx));
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/tags/batch-%02d", i));
+		cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, name.ptr));
+	}
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/packed"));
+
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/packed-test"));
+	git_reference_free(ref);
+
+	git_buf_dispose(&name);
+}
+
+void test_refs_transactions__batch_delete_missing_fails(void)
+{
+	git_buf name = GIT_BUF_INIT;
+	git_reference *ref;
+	int i;
+
+	lock_batch("refs/heads/missing-%02d");
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/br2"));
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/missing-%02d", i));
+		cl_git_pass(git_transaction_remove(g_tx, name.ptr));
+	}
+	cl_git_pass(git_transaction_remove(g_tx, "refs/heads/br2"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_transaction_commit(g_tx));
+
+	/* nothing was applied and every lock was released */
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/br2"));
+	git_reference_free(ref);
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/br2.lock"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/missing-00.lock"));
+
+	git_buf_dispose(&name);
+}
+
+void test_refs_transactions__packed_directory_conflict_fails(void)
+{
+	git_reference *ref;
+	git_refdb *refdb;
+	git_oid id;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/remotes/origin/foo", &id, 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_repository_refdb(&refdb, g_repo));
+	cl_git_pass(git_refdb_compress(refdb));
+	git_refdb_free(refdb);
+	cl_git_pass(git_futils_rmdir_r("testrepo/.git/logs/refs/remotes", NULL, GIT_RMDIR_REMOVE_FILES));
+	cl_assert(!git_path_exists("testrepo/.git/refs/remotes/origin/foo"));
+
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/remotes/origin/foo/bar"));
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/remotes/origin/foo/bar", &id, NULL, NULL));
+	cl_git_fail(git_transaction_commit(g_tx));
+
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/remotes/origin/foo/bar"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/remotes/origin/foo/bar.lock"));
+}
+
+void test_refs_transactions__batch_loose_directory_conflict_fails(void)
+{
+	git_buf name = GIT_BUF_INIT;
+	git_reference *ref;
+	git_oid id;
+	int i;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	lock_batch("refs/heads/batch-%02d");
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/newdir"));
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/batch-%02d", i));
+		cl_git_pass(git_transaction_set_target(g_tx, name.ptr, &id, NULL, NULL));
+	}
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/newdir", &id, NULL, NULL));
+
+	/* Another writer creates a loose reference beneath the locked one */
+	cl_git_pass(git_reference_create(&ref, g_repo, "refs/heads/newdir/sub", &id, 0, NULL));
+	git_reference_free(ref);
+	cl_git_pass(git_futils_rmdir_r("testrepo/.git/logs/refs/heads/newdir", NULL, GIT_RMDIR_REMOVE_FILES));
+
+	cl_git_fail(git_transaction_commit(g_tx));
+
+	/* nothing was applied and every lock was released */
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/batch-00"));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/newdir"));
+	cl_git_pass(git_reference_lookup(&ref, g_repo, "refs/heads/newdir/sub"));
+	git_reference_free(ref);
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/newdir.lock"));
+	cl_assert(!git_path_exists("testrepo/.git/refs/heads/batch-00.lock"));
+
+	git_buf_dispose(&name);
+}
+
+void test_refs_transactions__batch_conflicting_names_fail(void)
+{
+	git_buf name = GIT_BUF_INIT;
+	git_reference *ref;
+	git_oid id;
+	int i;
+
+	git_oid_fromstr(&id, "a65fedf39aefe402d3bb6e24df4d4f5fe4547750");
+
+	lock_batch("refs/heads/batch-%02d");
+	cl_git_pass(git_transaction_lock_ref(g_tx, "refs/heads/batch-00/sub"));
+
+	for (i = 0; i < BATCH_COUNT; i++) {
+		git_buf_clear(&name);
+		cl_git_pass(git_buf_printf(&name, "refs/heads/batch-%02d", i));
+		cl_git_pass(git_transaction_set_target(g_tx, name.ptr, &id, NULL, NULL));
+	}
+	cl_git_pass(git_transaction_set_target(g_tx, "refs/heads/batch-00/sub", &id, NULL, NULL));
+
+	cl_git_fail(git_transaction_commit(g_tx));
+	cl_git_fail_with(GIT_ENOTFOUND, git_reference_lookup(&ref, g_repo, "refs/heads/batch-01"));
+	cl_assert(!git_path_exists("testrepo/.git/logs/refs/heads/batch-01"));
+
+	git_buf_dispose(&name);
+}
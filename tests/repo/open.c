@@ -32,10 +32,18 @@ void test_repo_open__format_version_1(void)
 	cl_git_pass(git_repository_config(&config, repo));
 
 	cl_git_pass(git_config_set_int32(config, "core.repositoryformatversion", 1));
-
-	git_config_free(config);
 	git_repository_free(repo);
+	cl_git_pass(git_repository_open(&repo, "empty_bare.git"));
+	git_repository_free(repo);
+
+	cl_git_pass(git_config_set_string(config, "extensions.unknown", "true"));
 	cl_git_fail(git_repository_open(&repo, "empty_bare.git"));
+
+	cl_git_pass(git_config_delete_entry(config, "extensions.unknown"));
+	cl_git_pass(git_config_set_int32(config, "core.repositoryformatversion", 2));
+	cl_git_fail(git_repository_open(&repo, "empty_bare.git"));
+
+	git_config_free(config);
 }
 
 void test_repo_open__standard_empty_repo_through_gitdir(void)
@@ -0,0 +1,216 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+#include "repository.h"
+#include "git2/sys/fsmonitor.h"
+
+typedef struct {
+	git_fsmonitor parent;
+	unsigned int token;
+	unsigned int queries;
+	int error;
+	git_buf changed;
+} fake_fsmonitor;
+
+static git_repository *g_repo = NULL;
+static fake_fsmonitor *g_fsmonitor = NULL;
+
+static int fake_fsmonitor_query(
+	git_buf *out, git_fsmonitor *fsmonitor, const char *token)
+{
+	fake_fsmonitor *fake = (fake_fsmonitor *)fsmonitor;
+
+	GIT_UNUSED(token);
+
+	fake->queries++;
+
+	if (fake->error)
+		return fake->error;
+
+	git_buf_printf(out, "token-%u", ++fake->token);
+	git_buf_putc(out, '\0');
+	git_buf_put(out, fake->changed.ptr, fake->changed.size);
+	git_buf_clear(&fake->changed);
+
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static void fake_fsmonitor_free(git_fsmonitor *fsmonitor)
+{
+	fake_fsmonitor *fake = (fake_fsmonitor *)fsmonitor;
+
+	git_buf_dispose(&fake->changed);
+	git__free(fake);
+
+	g_fsmonitor = NULL;
+}
+
+static void set_fsmonitor(void)
+{
+	g_fsmonitor = git__calloc(1, sizeof(fake_fsmonitor));
+	cl_assert(g_fsmonitor);
+
+	cl_git_pass(git_fsmonitor_init(&g_fsmonitor->parent, GIT_FSMONITOR_VERSION));
+	g_fsmonitor->parent.query = fake_fsmonitor_query;
+	g_fsmonitor->parent.free = fake_fsmonitor_free;
+
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, &g_fsmonitor->parent));
+}
+
+static void report_change(const char *path)
+{
+	cl_git_pass(git_buf_put(&g_fsmonitor->changed, path, strlen(path) + 1));
+}
+
+/* files changed just now are always looked at */
+static void age_workdir(void)
+{
+	cl_age_tree("status");
+}
+
+static unsigned int file_status(const char *path)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+	git_status_list *list;
+	const git_status_entry *entry;
+	unsigned int status = GIT_STATUS_CURRENT;
+	size_t i;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_UPDATE_INDEX;
+
+	cl_git_pass(git_status_list_new(&list, g_repo, &opts));
+
+	for (i = 0; i < git_status_list_entrycount(list); i++) {
+		entry = git_status_byindex(list, i);
+
+		if (entry->index_to_workdir &&
+		    !strcmp(entry->index_to_workdir->old_file.path, path))
+			status = entry->status;
+	}
+
+	git_status_list_free(list);
+	return status;
+}
+
+static bool entry_is_valid(const char *path)
+{
+	git_index *index;
+	const git_index_entry *entry;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_assert(entry = git_index_get_bypath(index, path, 0));
+
+	return (entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID) != 0;
+}
+
+void test_status_fsmonitor__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+	age_workdir();
+
+	/* record the stat data of the aged files */
+	file_status("current_file");
+}
+
+void test_status_fsmonitor__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	g_repo = NULL;
+
+	cl_assert(g_fsmonitor == NULL);
+}
+
+void test_status_fsmonitor__is_not_used_by_default(void)
+{
+	cl_assert_equal_i(GIT_STATUS_CURRENT, file_status("current_file"));
+
+	cl_assert(!entry_is_valid("current_file"));
+	cl_assert(!cl_index_has_extension("status/.git/index", "FSMN"));
+}
+
+void test_status_fsmonitor__vouches_for_unchanged_files(void)
+{
+	set_fsmonitor();
+
+	/* there is no token yet, so everything is looked at */
+	cl_assert_equal_i(GIT_STATUS_CURRENT, file_status("current_file"));
+	cl_assert_equal_i(1, g_fsmonitor->queries);
+	cl_assert(entry_is_valid("current_file"));
+	cl_assert(entry_is_valid("subdir/current_file"));
+	cl_assert(!entry_is_valid("modified_file"));
+	cl_assert(cl_index_has_extension("status/.git/index", "FSMN"));
+
+	/* a change that is not reported goes unnoticed */
+	cl_git_rewritefile("status/current_file", "changed behind our back\n");
+	cl_assert_equal_i(GIT_STATUS_CURRENT, file_status("current_file"));
+
+	report_change("current_file");
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, file_status("current_file"));
+	cl_assert(!entry_is_valid("current_file"));
+}
+
+void test_status_fsmonitor__follows_reported_directories(void)
+{
+	set_fsmonitor();
+	file_status("current_file");
+
+	cl_git_rewritefile("status/subdir/current_file", "changed\n");
+	cl_assert_equal_i(GIT_STATUS_CURRENT, file_status("subdir/current_file"));
+
+	report_change("subdir/");
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, file_status("subdir/current_file"));
+	cl_assert(entry_is_valid("current_file"));
+}
+
+void test_status_fsmonitor__can_report_everything(void)
+{
+	set_fsmonitor();
+	file_status("current_file");
+
+	cl_git_rewritefile("status/current_file", "changed\n");
+	cl_git_rewritefile("status/subdir/current_file", "changed\n");
+
+	report_change("/");
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, file_status("current_file"));
+
+	cl_git_rewritefile("status/current_file", "changed again\n");
+
+	g_fsmonitor->error = GIT_PASSTHROUGH;
+	cl_assert_equal_i(GIT_STATUS_WT_MODIFIED, file_status("subdir/current_file"));
+	cl_assert(!entry_is_valid("subdir/current_file"));
+}
+
+void test_status_fsmonitor__reports_errors(void)
+{
+	git_status_list *list;
+
+	set_fsmonitor();
+	g_fsmonitor->error = -42;
+
+	cl_git_fail_with(-42, git_status_list_new(&list, g_repo, NULL));
+}
+
+void test_status_fsmonitor__can_write_and_read(void)
+{
+	git_index *index;
+	const git_index_entry *entry;
+
+	set_fsmonitor();
+	file_status("current_file");
+
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert_equal_s("token-1", index->fsmonitor_token);
+
+	cl_assert(entry = git_index_get_bypath(index, "current_file", 0));
+	cl_assert(entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID);
+	cl_assert(entry = git_index_get_bypath(index, "modified_file", 0));
+	cl_assert(!(entry->flags_extended & GIT_INDEX_ENTRY_FSMONITOR_VALID));
+
+	git_index_free(index);
+
+	/* without a monitor, the extension is dropped */
+	cl_git_pass(git_repository_set_fsmonitor(g_repo, NULL));
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	cl_git_pass(git_index_write(index));
+	cl_assert(!cl_index_has_extension("status/.git/index", "FSMN"));
+}
@@ -0,0 +1,248 @@
+#include "clar_libgit2.h"
+#include "fileops.h"
+#include "index.h"
+#include "repository.h"
+#include "untracked-cache.h"
+
+static git_repository *g_repo = NULL;
+
+void test_status_untrackedcache__initialize(void)
+{
+	g_repo = cl_git_sandbox_init("status");
+
+	cl_must_pass(p_mkdir("status/untracked_dir", 0777));
+	cl_must_pass(p_mkdir("status/untracked_dir/nested", 0777));
+	cl_git_mkfile("status/untracked_dir/a", "a\n");
+	cl_git_mkfile("status/untracked_dir/nested/b", "b\n");
+	cl_git_mkfile("status/subdir/untracked_file", "c\n");
+	cl_git_mkfile("status/subdir/ignored_file", "d\n");
+	cl_must_pass(p_mkdir("status/empty_dir", 0777));
+}
+
+void test_status_untrackedcache__cleanup(void)
+{
+	cl_git_sandbox_cleanup();
+	g_repo = NULL;
+}
+
+/* directories changed just now are not recorded */
+static void age_workdir(void)
+{
+	cl_age_tree("status");
+}
+
+static int status_cb(const char *path, unsigned int status, void *payload)
+{
+	git_buf *out = payload;
+
+	git_buf_printf(out, "%s:%u\n", path, status);
+	return git_buf_oom(out) ? -1 : 0;
+}
+
+static void get_status(git_buf *out, unsigned int flags)
+{
+	git_status_options opts = GIT_STATUS_OPTIONS_INIT;
+
+	opts.flags = GIT_STATUS_OPT_INCLUDE_UNTRACKED | GIT_STATUS_OPT_UPDATE_INDEX |
+		flags;
+
+	git_buf_clear(out);
+	cl_git_pass(git_status_foreach_ext(g_repo, &opts, status_cb, out));
+}
+
+static void assert_status_with_cache(unsigned int flags)
+{
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	cl_repo_set_bool(g_repo, "core.untrackedCache", false);
+	get_status(&expected, flags);
+
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+
+	/* once to record the untracked files, then to use them */
+	get_status(&actual, flags);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	get_status(&actual, flags);
+	cl_assert_equal_s(expected.ptr, actual.ptr);
+
+	git_buf_dispose(&expected);
+	git_buf_dispose(&actual);
+}
+
+static git_untracked_cache *index_untracked_cache(void)
+{
+	git_index *index;
+
+	cl_git_pass(git_repository_index__weakptr(&index, g_repo));
+	return index->untracked;
+}
+
+void test_status_untrackedcache__is_not_written_by_default(void)
+{
+	git_buf status = GIT_BUF_INIT;
+
+	age_workdir();
+	get_status(&status, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+
+	cl_assert(index_untracked_cache() == NULL);
+	cl_assert(!cl_index_has_extension("status/.git/index", "UNTR"));
+
+	git_buf_dispose(&status);
+}
+
+void test_status_untrackedcache__matches_status_without_it(void)
+{
+	age_workdir();
+	assert_status_with_cache(GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+
+	cl_assert(cl_index_has_extension("status/.git/index", "UNTR"));
+	cl_assert(git_untracked_cache_get(index_untracked_cache(), "") != NULL);
+	cl_assert(git_untracked_cache_get(index_untracked_cache(), "subdir/") != NULL);
+	cl_assert(git_untracked_cache_get(index_untracked_cache(), "untracked_dir/nested") != NULL);
+}
+
+void test_status_untrackedcache__matches_status_of_untracked_dirs(void)
+{
+	age_workdir();
+	assert_status_with_cache(0);
+}
+
+void test_status_untrackedcache__is_used_for_unchanged_dirs(void)
+{
+	git_untracked_cache_dir *dir;
+	git_buf status = GIT_BUF_INIT;
+	char *name;
+	size_t i;
+
+	age_workdir();
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+	get_status(&status, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(status.ptr, "subdir/untracked_file:") != NULL);
+
+	/* forget a file that is only listed by the cache */
+	cl_assert(dir = git_untracked_cache_get(index_untracked_cache(), "subdir"));
+
+	git_vector_foreach(&dir->untracked, i, name) {
+		if (!strcmp(name, "untracked_file")) {
+			git_vector_remove(&dir->untracked, i);
+			git__free(name);
+			break;
+		}
+	}
+
+	get_status(&status, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(status.ptr, "subdir/untracked_file:") == NULL);
+	cl_assert(strstr(status.ptr, "subdir/new_file:") != NULL);
+
+	git_buf_dispose(&status);
+}
+
+void test_status_untrackedcache__finds_new_files(void)
+{
+	git_buf status = GIT_BUF_INIT;
+
+	age_workdir();
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+	get_status(&status, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+
+	cl_git_mkfile("status/untracked_dir/nested/new", "new\n");
+	cl_git_mkfile("status/empty_dir/new", "new\n");
+
+	get_status(&status, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(status.ptr, "untracked_dir/nested/new:") != NULL);
+	cl_assert(strstr(status.ptr, "empty_dir/new:") != NULL);
+
+	git_buf_dispose(&status);
+}
+
+void test_status_untrackedcache__follows_index_changes(void)
+{
+	git_index *index;
+	unsigned int status;
+
+	age_workdir();
+	assert_status_with_cache(GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+
+	cl_git_pass(git_repository_index(&index, g_repo));
+	cl_git_pass(git_index_add_bypath(index, "untracked_dir/nested/b"));
+	cl_git_pass(git_index_remove_bypath(index, "subdir/current_file"));
+	cl_git_pass(git_index_write(index));
+
+	cl_assert(git_untracked_cache_get(index_untracked_cache(), "untracked_dir/nested") == NULL);
+	cl_assert(git_untracked_cache_get(index_untracked_cache(), "subdir") == NULL);
+
+	assert_status_with_cache(GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+
+	cl_git_pass(git_status_file(&status, g_repo, "untracked_dir/nested/b"));
+	cl_assert_equal_i(GIT_STATUS_INDEX_NEW, status);
+	cl_git_pass(git_status_file(&status, g_repo, "subdir/current_file"));
+	cl_assert_equal_i(GIT_STATUS_INDEX_DELETED | GIT_STATUS_WT_NEW, status);
+
+	git_index_free(index);
+}
+
+void test_status_untrackedcache__follows_ignore_changes(void)
+{
+	git_buf status = GIT_BUF_INIT;
+
+	cl_git_mkfile("status/untracked_dir/.gitignore", "");
+
+	age_workdir();
+	cl_repo_set_bool(g_repo, "core.untrackedCache", true);
+	get_status(&status, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(status.ptr, "untracked_dir/nested/b:") != NULL);
+	cl_assert(strstr(status.ptr, "subdir/untracked_file:") != NULL);
+
+	/* neither of these adds or removes a file in a directory */
+	cl_git_rewritefile("status/untracked_dir/.gitignore", "b\n");
+	cl_git_rewritefile("status/.git/info/exclude", "untracked_file\n");
+
+	get_status(&status, GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+	cl_assert(strstr(status.ptr, "untracked_dir/nested/b:") == NULL);
+	cl_assert(strstr(status.ptr, "subdir/untracked_file:") == NULL);
+	cl_assert(strstr(status.ptr, "ignored_file:") != NULL);
+
+	git_buf_dispose(&status);
+}
+
+void test_status_untrackedcache__can_write_and_read(void)
+{
+	git_untracked_cache *cache;
+	git_index *index;
+	git_buf expected = GIT_BUF_INIT, actual = GIT_BUF_INIT;
+
+	age_workdir();
+	assert_status_with_cache(GIT_STATUS_OPT_RECURSE_UNTRACKED_DIRS);
+
+	cl_git_pass(git_untracked_cache_write(&expected, index_untracked_cache()));
+	cl_git_pass(git_untracked_cache_read(&cache, expected.ptr, expected.size));
+	cl_git_pass(git_untracked_cache_write(&actual, cache));
+
+	cl_assert_equal_sz(expected.size, actual.size);
+	cl_assert(!memcmp(expected.ptr, actual.ptr, expected.size));
+
+	git_untracked_cache_free(cache);
+
+	/* and it is read back with the index */
+	cl_git_pass(git_index_open(&index, "status/.git/index"));
+	cl_assert(index->untracked);
+
+	git_buf_clear(&actual);
+	cl_git_pass(git_untracked_cache_write(&actual, index->untracked));
+	cl_assert_equal_sz(expected.size, actual.size);
+	cl_assert(!memcmp(expected.ptr, actual.ptr, expected.size));
+
+	git_index_free(index);
+	git_buf_dispose(&expected);
+	git_buf_dispose(&actual);
+}
+
+void test_status_untrackedcache__ignores_invalid_data(void)
+{
+	git_untracked_cache *cache;
+
+	cl_git_fail(git_untracked_cache_read(&cache, "", 0));
+	cl_git_fail(git_untracked_cache_read(&cache, "\x05" "abc\0", 5));
+	cl_assert(cache == NULL);
+}
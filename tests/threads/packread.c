@@ -0,0 +1,63 @@
+#include "clar_libgit2.h"
+
+#include "thread_helpers.h"
+
+static size_t _window_size, _mapped_limit;
+
+void test_threads_packread__initialize(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_SIZE, &_window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_GET_MWINDOW_MAPPED_LIMIT, &_mapped_limit));
+}
+
+void test_threads_packread__cleanup(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, _window_size));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, _mapped_limit));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_FULL_MMAP, 0));
+}
+
+static int read_cb(const git_oid *id, void *payload)
+{
+	git_odb *odb = (git_odb *)payload;
+	git_odb_object *obj;
+
+	cl_git_pass(git_odb_read(&obj, odb, id));
+	git_odb_object_free(obj);
+	return 0;
+}
+
+static void *read_all(void *arg)
+{
+	git_repository *repo;
+	git_odb *odb;
+
+	GIT_UNUSED(arg);
+
+	cl_git_pass(git_repository_open(&repo, cl_fixture("testrepo.git")));
+	cl_git_pass(git_repository_odb(&odb, repo));
+	cl_git_pass(git_odb_foreach(odb, read_cb, odb));
+
+	git_odb_free(odb);
+	git_repository_free(repo);
+	return arg;
+}
+
+void test_threads_packread__small_windows(void)
+{
+	/*
+	 * Tiny windows and a mapped limit below a single pack force the
+	 * threads to keep opening windows and evicting each other's.
+	 */
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_SIZE, (size_t)16384));
+	cl_git_pass(git_libgit2_opts(GIT_OPT_SET_MWINDOW_MAPPED_LIMIT, (size_t)16384));
+
+	run_in_parallel(4, 8, read_all, NULL, NULL);
+}
+
+void test_threads_packread__full_mmap(void)
+{
+	cl_git_pass(git_libgit2_opts(GIT_OPT_ENABLE_PACK_FULL_MMAP, 1));
+
+	run_in_parallel(4, 8, read_all, NULL, NULL);
+}